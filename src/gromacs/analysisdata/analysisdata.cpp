@@ -1,7 +1,7 @@
 /*
  * This file is part of the GROMACS molecular simulation package.
  *
- * Copyright (c) 2010,2011,2012,2013,2014,2015,2016, by the GROMACS development team, led by
+ * Copyright (c) 2010,2011,2012,2013,2014,2015,2016,2017, by the GROMACS development team, led by
  * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
  * and including many others, as listed in the AUTHORS file in the
  * top-level source directory and at http://www.gromacs.org.
@@ -154,6 +154,13 @@ AnalysisData::setMultipoint(bool bMultipoint)
 }
 
 
+void
+AnalysisData::setStorageMemoryLimit(std::size_t bytes)
+{
+    impl_->storage_.setMemoryLimit(bytes);
+}
+
+
 int
 AnalysisData::frameCount() const
 {
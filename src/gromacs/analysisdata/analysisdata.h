@@ -1,7 +1,7 @@
 /*
  * This file is part of the GROMACS molecular simulation package.
  *
- * Copyright (c) 2010,2011,2012,2013,2014,2015,2016, by the GROMACS development team, led by
+ * Copyright (c) 2010,2011,2012,2013,2014,2015,2016,2017, by the GROMACS development team, led by
  * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
  * and including many others, as listed in the AUTHORS file in the
  * top-level source directory and at http://www.gromacs.org.
@@ -43,6 +43,8 @@
 #ifndef GMX_ANALYSISDATA_ANALYSISDATA_H
 #define GMX_ANALYSISDATA_ANALYSISDATA_H
 
+#include <cstddef>
+
 #include "gromacs/analysisdata/abstractdata.h"
 #include "gromacs/utility/real.h"
 
@@ -139,6 +141,19 @@ class AnalysisData : public AbstractAnalysisData
          * \see isMultipoint()
          */
         void setMultipoint(bool bMultipoint);
+        /*! \brief
+         * Sets the amount of memory to use for storing all frames.
+         *
+         * \param[in] bytes  Number of bytes of frame values to keep in
+         *      memory.
+         *
+         * If storage of all frames is requested, frames that would exceed
+         * this limit are stored in a compact form or written to a temporary
+         * file.
+         *
+         * \see AnalysisDataStorage::setMemoryLimit()
+         */
+        void setStorageMemoryLimit(std::size_t bytes);
 
         virtual int frameCount() const;
 
@@ -1,7 +1,7 @@
 /*
  * This file is part of the GROMACS molecular simulation package.
  *
- * Copyright (c) 2012,2013,2014, by the GROMACS development team, led by
+ * Copyright (c) 2012,2013,2014,2017, by the GROMACS development team, led by
  * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
  * and including many others, as listed in the AUTHORS file in the
  * top-level source directory and at http://www.gromacs.org.
@@ -175,11 +175,23 @@ AnalysisDataFrameRef::AnalysisDataFrameRef(
 }
 
 
+AnalysisDataFrameRef::AnalysisDataFrameRef(
+        const AnalysisDataFrameHeader                                &header,
+        const std::shared_ptr<const std::vector<AnalysisDataValue> > &values,
+        const std::vector<AnalysisDataPointSetInfo>                  &pointSets)
+    : header_(header), values_(constArrayRefFromVector<AnalysisDataValue>(values->begin(), values->end())),
+      pointSets_(constArrayRefFromVector<AnalysisDataPointSetInfo>(pointSets.begin(), pointSets.end())),
+      valueOwner_(values)
+{
+    GMX_ASSERT(!pointSets_.empty(), "There must always be a point set");
+}
+
+
 AnalysisDataFrameRef::AnalysisDataFrameRef(
         const AnalysisDataFrameRef &frame, int firstColumn, int columnCount)
     : header_(frame.header()),
       values_(constArrayRefFromArray(&frame.values_[firstColumn], columnCount)),
-      pointSets_(frame.pointSets_)
+      pointSets_(frame.pointSets_), valueOwner_(frame.valueOwner_)
 {
     // FIXME: This doesn't produce a valid internal state, although it does
     // work in some cases. The point sets cannot be correctly managed here, but
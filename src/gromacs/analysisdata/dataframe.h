@@ -1,7 +1,7 @@
 /*
  * This file is part of the GROMACS molecular simulation package.
  *
- * Copyright (c) 2012,2013,2014, by the GROMACS development team, led by
+ * Copyright (c) 2012,2013,2014,2017, by the GROMACS development team, led by
  * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
  * and including many others, as listed in the AUTHORS file in the
  * top-level source directory and at http://www.gromacs.org.
@@ -43,6 +43,7 @@
 #ifndef GMX_ANALYSISDATA_DATAFRAME_H
 #define GMX_ANALYSISDATA_DATAFRAME_H
 
+#include <memory>
 #include <vector>
 
 #include "gromacs/utility/arrayref.h"
@@ -548,6 +549,21 @@ class AnalysisDataFrameRef
         AnalysisDataFrameRef(const AnalysisDataFrameHeader               &header,
                              const std::vector<AnalysisDataValue>        &values,
                              const std::vector<AnalysisDataPointSetInfo> &pointSets);
+        /*! \brief
+         * Constructs a frame reference that shares ownership of its values.
+         *
+         * \param[in] header      Header for the frame.
+         * \param[in] values      Values for each column.
+         * \param[in] pointSets   Point set data.
+         *
+         * The reference keeps \p values alive, so that it remains valid
+         * even if the creator of the values releases them.  Point sets
+         * returned by pointSet() are only valid while a reference to the
+         * frame exists.
+         */
+        AnalysisDataFrameRef(const AnalysisDataFrameHeader                                &header,
+                             const std::shared_ptr<const std::vector<AnalysisDataValue> > &values,
+                             const std::vector<AnalysisDataPointSetInfo>                  &pointSets);
         /*! \brief
          * Constructs a frame reference to a subset of columns.
          *
@@ -663,6 +679,8 @@ class AnalysisDataFrameRef
         AnalysisDataFrameHeader      header_;
         AnalysisDataValuesRef        values_;
         AnalysisDataPointSetInfosRef pointSets_;
+        //! Owner of the values if shared with the reference, otherwise NULL.
+        std::shared_ptr<const std::vector<AnalysisDataValue> > valueOwner_;
 };
 
 } // namespace gmx
@@ -1,7 +1,7 @@
 /*
  * This file is part of the GROMACS molecular simulation package.
  *
- * Copyright (c) 2012,2013,2014,2015,2016, by the GROMACS development team, led by
+ * Copyright (c) 2012,2013,2014,2015,2016,2017, by the GROMACS development team, led by
  * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
  * and including many others, as listed in the AUTHORS file in the
  * top-level source directory and at http://www.gromacs.org.
@@ -43,7 +43,10 @@
 
 #include "datastorage.h"
 
+#include <cstdio>
+
 #include <algorithm>
+#include <deque>
 #include <iterator>
 #include <limits>
 #include <memory>
@@ -54,7 +57,9 @@
 #include "gromacs/analysisdata/datamodulemanager.h"
 #include "gromacs/analysisdata/paralleloptions.h"
 #include "gromacs/utility/exceptions.h"
+#include "gromacs/utility/futil.h"
 #include "gromacs/utility/gmxassert.h"
+#include "gromacs/utility/mutex.h"
 
 namespace gmx
 {
@@ -84,6 +89,17 @@ AnalysisDataParallelOptions::AnalysisDataParallelOptions(int parallelizationFact
 namespace internal
 {
 
+//! Default value for AnalysisDataStorageImpl::memoryLimit_ (1 GiB).
+const std::size_t c_defaultMemoryLimit = 1024*1024*1024;
+/*! \brief
+ * Number of compact frames that are kept decoded at the same time.
+ *
+ * This only limits how many frames are cached for repeated access: frame
+ * references share ownership of the decoded values, so they remain valid
+ * after the frame has been dropped from the cache.
+ */
+const std::size_t c_decodedFrameCount  = 16;
+
 //! Smart pointer type for managing a storage frame builder.
 typedef std::unique_ptr<AnalysisDataStorageFrame>
     AnalysisDataFrameBuilderPointer;
@@ -105,6 +121,7 @@ class AnalysisDataStorageImpl
         typedef std::vector<AnalysisDataFrameBuilderPointer> FrameBuilderList;
 
         AnalysisDataStorageImpl();
+        ~AnalysisDataStorageImpl();
 
         //! Returns whether the storage is set to use multipoint data.
         bool isMultipoint() const;
@@ -200,6 +217,30 @@ class AnalysisDataStorageImpl
          * Implementation for AnalysisDataStorage::finishFrameSerial().
          */
         void finishFrameSerial(int index);
+        /*! \brief
+         * Stores a notified frame when storage of all frames is requested.
+         *
+         * The frame is kept as is if it fits into \a memoryLimit_.
+         * Otherwise, its values are moved into compact storage, and if
+         * those do not fit either, written to \a spillFile_.
+         *
+         * \throws std::bad_alloc if out of memory.
+         * \throws FileIOError if the temporary file cannot be written.
+         */
+        void storeNotifiedFrame(AnalysisDataStorageFrameData *frame);
+        /*! \brief
+         * Returns a frame reference to a stored frame.
+         *
+         * If the frame is in compact storage, decodes it first, releasing
+         * the oldest decoded frame if \a c_decodedFrameCount frames are
+         * already decoded.  The returned reference shares ownership of the
+         * decoded values.  Can be called concurrently.
+         *
+         * \throws std::bad_alloc if out of memory.
+         * \throws FileIOError if the frame cannot be read back from
+         *      \a spillFile_.
+         */
+        AnalysisDataFrameRef frameReference(AnalysisDataStorageFrameData *frame) const;
 
 
         //! Parent data object to access data dimensionality etc.
@@ -270,6 +311,30 @@ class AnalysisDataStorageImpl
          * frame (see \a frames_).
          */
         int                     nextIndex_;
+        /*! \brief
+         * Number of bytes of frame values that are kept in memory.
+         *
+         * When storage of all frames has been requested, notified frames are
+         * kept as they are up to this limit.  Further frames are stored in
+         * compact form, and are written to \a spillFile_ if also their
+         * compact values would exceed this limit.
+         */
+        std::size_t             memoryLimit_;
+        //! Number of bytes currently used by notified frame values in memory.
+        std::size_t             storedMemorySize_;
+        //! Temporary file for frames exceeding \a memoryLimit_, or NULL.
+        std::FILE              *spillFile_;
+        /*! \brief
+         * Compact frames that currently have their values decoded.
+         *
+         * Oldest decoded frame is first.
+         */
+        mutable std::deque<AnalysisDataStorageFrameData *> decodedFrames_;
+        /*! \brief
+         * Protects \a decodedFrames_, the decoded values of the frames, and
+         * \a spillFile_ when frames are accessed concurrently.
+         */
+        mutable Mutex           decodedFramesMutex_;
 };
 
 /********************************************************************
@@ -320,6 +385,11 @@ class AnalysisDataStorageFrameData
         //! Whether the frame is ready to be available outside the storage.
         bool isAvailable() const { return status_ >= eFinished; }
 
+        //! Whether the values have been moved into compact storage.
+        bool isCompact() const { return bCompact_; }
+        //! Whether the values of a compact frame are currently decoded.
+        bool isDecoded() const { return decodedValues_ != nullptr; }
+
         //! Marks the frame as notified.
         void markNotified() { status_ = eNotified; }
 
@@ -364,15 +434,65 @@ class AnalysisDataStorageFrameData
          */
         AnalysisDataFrameBuilderPointer finishFrame(bool bMultipoint);
 
+        //! Returns the number of bytes used by the values of a notified frame.
+        std::size_t valueMemorySize() const
+        {
+            return values_.size() * sizeof(AnalysisDataValue);
+        }
+        /*! \brief
+         * Moves the values of a notified frame into compact storage.
+         *
+         * \returns Number of bytes used for the compact values.
+         * \throws  std::bad_alloc if out of memory.
+         *
+         * The values are stored as a contiguous array, and error estimates
+         * and flags are only stored for the values that have an error
+         * estimate or that are not set and present.
+         */
+        std::size_t compact();
+        /*! \brief
+         * Writes the compact values to the end of \p fp and releases them.
+         *
+         * \throws FileIOError if writing fails.
+         */
+        void spill(std::FILE *fp);
+        /*! \brief
+         * Decodes the compact values for access through frameReference().
+         *
+         * Frame references returned before releaseDecoded() keep the
+         * decoded values alive.
+         *
+         * \param  fp  File where the values have been written with spill().
+         * \throws std::bad_alloc if out of memory.
+         * \throws FileIOError if reading from \p fp fails.
+         */
+        void decode(std::FILE *fp);
+        //! Releases the values decoded with decode().
+        void releaseDecoded();
+
         //! Returns frame reference to this frame.
         AnalysisDataFrameRef frameReference() const
         {
+            if (isCompact())
+            {
+                GMX_ASSERT(isDecoded(),
+                           "Accessing values of a compact frame that is not decoded");
+                return AnalysisDataFrameRef(header_, decodedValues_, pointSets_);
+            }
             return AnalysisDataFrameRef(header_, values_, pointSets_);
         }
         //! Returns point set reference to a given point set.
         AnalysisDataPointSetRef pointSet(int index) const;
 
     private:
+        //! Flags stored in \a compactFlags_.
+        enum CompactFlag
+        {
+            ecfSet      = 1<<0, //!< Value has been set.
+            ecfError    = 1<<1, //!< Error estimate has been set.
+            ecfPresent  = 1<<2  //!< Value is set as present.
+        };
+
         //! Storage object that contains this frame.
         AnalysisDataStorageImpl                &storageImpl_;
         //! Header for the frame.
@@ -390,6 +510,29 @@ class AnalysisDataStorageFrameData
         AnalysisDataFrameBuilderPointer         builder_;
         //! In what state the frame currently is.
         Status                                  status_;
+        //! Whether the values have been moved into compact storage.
+        bool                                    bCompact_;
+        //! Decoded values of a compact frame, or NULL if not decoded.
+        std::shared_ptr<std::vector<AnalysisDataValue> > decodedValues_;
+        //! Number of values in compact storage.
+        int                                     compactValueCount_;
+        /*! \brief
+         * Values of a compact frame.
+         *
+         * Empty if the frame has been written to a temporary file.
+         */
+        std::vector<real>                       compactValues_;
+        /*! \brief
+         * Indices of values in a compact frame that have an error estimate
+         * or are not set and present.
+         */
+        std::vector<int>                        compactFlagIndices_;
+        //! Flags (see CompactFlag) for each entry in \a compactFlagIndices_.
+        std::vector<unsigned char>              compactFlags_;
+        //! Error estimates for entries in \a compactFlags_ that have ecfError.
+        std::vector<real>                       compactErrors_;
+        //! Offset of the values in the temporary file, or -1 if not written.
+        gmx_off_t                               spillOffset_;
 
         GMX_DISALLOW_COPY_AND_ASSIGN(AnalysisDataStorageFrameData);
 };
@@ -401,8 +544,19 @@ class AnalysisDataStorageFrameData
 AnalysisDataStorageImpl::AnalysisDataStorageImpl()
     : data_(NULL), modules_(NULL),
       storageLimit_(0), pendingLimit_(1),
-      firstFrameLocation_(0), firstUnnotifiedIndex_(0), nextIndex_(0)
+      firstFrameLocation_(0), firstUnnotifiedIndex_(0), nextIndex_(0),
+      memoryLimit_(c_defaultMemoryLimit), storedMemorySize_(0),
+      spillFile_(NULL)
+{
+}
+
+
+AnalysisDataStorageImpl::~AnalysisDataStorageImpl()
 {
+    if (spillFile_ != NULL)
+    {
+        std::fclose(spillFile_);
+    }
 }
 
 
@@ -548,13 +702,66 @@ AnalysisDataStorageImpl::finishFrameSerial(int index)
         modules_->notifyFrameFinish(storedFrame.header());
     }
     storedFrame.markNotified();
-    if (storedFrame.frameIndex() >= storageLimit_)
+    if (storeAll())
+    {
+        storeNotifiedFrame(&storedFrame);
+    }
+    else if (storedFrame.frameIndex() >= storageLimit_)
     {
         rotateBuffer();
     }
 }
 
 
+void
+AnalysisDataStorageImpl::storeNotifiedFrame(AnalysisDataStorageFrameData *frame)
+{
+    const std::size_t valueSize = frame->valueMemorySize();
+    if (storedMemorySize_ + valueSize <= memoryLimit_)
+    {
+        storedMemorySize_ += valueSize;
+        return;
+    }
+    const std::size_t size = frame->compact();
+    if (storedMemorySize_ + size <= memoryLimit_)
+    {
+        storedMemorySize_ += size;
+        return;
+    }
+    if (spillFile_ == NULL)
+    {
+        spillFile_ = std::tmpfile();
+        if (spillFile_ == NULL)
+        {
+            GMX_THROW(FileIOError("Could not create a temporary file for analysis data"));
+        }
+    }
+    frame->spill(spillFile_);
+}
+
+
+AnalysisDataFrameRef
+AnalysisDataStorageImpl::frameReference(AnalysisDataStorageFrameData *frame) const
+{
+    if (!frame->isCompact())
+    {
+        return frame->frameReference();
+    }
+    lock_guard<Mutex> lock(decodedFramesMutex_);
+    if (!frame->isDecoded())
+    {
+        if (decodedFrames_.size() >= c_decodedFrameCount)
+        {
+            decodedFrames_.front()->releaseDecoded();
+            decodedFrames_.pop_front();
+        }
+        frame->decode(spillFile_);
+        decodedFrames_.push_back(frame);
+    }
+    return frame->frameReference();
+}
+
+
 /********************************************************************
  * AnalysisDataStorageFrame implementation
  */
@@ -562,7 +769,8 @@ AnalysisDataStorageImpl::finishFrameSerial(int index)
 AnalysisDataStorageFrameData::AnalysisDataStorageFrameData(
         AnalysisDataStorageImpl *storageImpl,
         int                      index)
-    : storageImpl_(*storageImpl), header_(index, 0.0, 0.0), status_(eMissing)
+    : storageImpl_(*storageImpl), header_(index, 0.0, 0.0), status_(eMissing),
+      bCompact_(false), compactValueCount_(0), spillOffset_(-1)
 {
     GMX_RELEASE_ASSERT(storageImpl->data_ != NULL,
                        "Storage frame constructed before data started");
@@ -585,6 +793,7 @@ void
 AnalysisDataStorageFrameData::clearFrame(int newIndex)
 {
     GMX_RELEASE_ASSERT(!builder_, "Should not clear an in-progress frame");
+    GMX_RELEASE_ASSERT(!bCompact_, "Should not clear a compact frame");
     status_ = eMissing;
     header_ = AnalysisDataFrameHeader(newIndex, 0.0, 0.0);
     values_.clear();
@@ -657,6 +866,113 @@ AnalysisDataStorageFrameData::finishFrame(bool bMultipoint)
 }
 
 
+std::size_t
+AnalysisDataStorageFrameData::compact()
+{
+    GMX_RELEASE_ASSERT(isNotified() && !isCompact(),
+                       "Only notified frames can be made compact");
+    compactValueCount_ = values_.size();
+    compactValues_.resize(compactValueCount_);
+    for (int i = 0; i < compactValueCount_; ++i)
+    {
+        const AnalysisDataValue &value = values_[i];
+        compactValues_[i] = value.value();
+        const unsigned char      flags
+            = (value.isSet() ? ecfSet : 0)
+                | (value.hasError() ? ecfError : 0)
+                | (value.isPresent() ? ecfPresent : 0);
+        if (flags != (ecfSet | ecfPresent))
+        {
+            compactFlagIndices_.push_back(i);
+            compactFlags_.push_back(flags);
+            if (value.hasError())
+            {
+                compactErrors_.push_back(value.error());
+            }
+        }
+    }
+    std::vector<AnalysisDataValue>().swap(values_);
+    bCompact_ = true;
+    return compactValues_.size() * sizeof(real)
+           + compactFlagIndices_.size() * (sizeof(int) + sizeof(unsigned char))
+           + compactErrors_.size() * sizeof(real);
+}
+
+
+void
+AnalysisDataStorageFrameData::spill(std::FILE *fp)
+{
+    GMX_RELEASE_ASSERT(isCompact() && spillOffset_ < 0,
+                       "Only compact frames can be written to a file");
+    if (gmx_fseek(fp, 0, SEEK_END) != 0)
+    {
+        GMX_THROW(FileIOError("Could not write analysis data to a temporary file"));
+    }
+    spillOffset_ = gmx_ftell(fp);
+    const size_t count = compactValues_.size();
+    if (spillOffset_ < 0
+        || std::fwrite(compactValues_.data(), sizeof(real), count, fp) != count)
+    {
+        GMX_THROW(FileIOError("Could not write analysis data to a temporary file"));
+    }
+    std::vector<real>().swap(compactValues_);
+}
+
+
+void
+AnalysisDataStorageFrameData::decode(std::FILE *fp)
+{
+    GMX_RELEASE_ASSERT(isCompact() && !isDecoded(),
+                       "Only compact frames can be decoded");
+    std::vector<real> spilledValues;
+    if (spillOffset_ >= 0)
+    {
+        spilledValues.resize(compactValueCount_);
+        if (fp == NULL || gmx_fseek(fp, spillOffset_, SEEK_SET) != 0
+            || std::fread(spilledValues.data(), sizeof(real), compactValueCount_, fp)
+            != static_cast<size_t>(compactValueCount_))
+        {
+            GMX_THROW(FileIOError("Could not read analysis data from a temporary file"));
+        }
+    }
+    const std::vector<real> &compactValues
+        = (spillOffset_ >= 0 ? spilledValues : compactValues_);
+    std::shared_ptr<std::vector<AnalysisDataValue> > values(
+            new std::vector<AnalysisDataValue>());
+    values->reserve(compactValueCount_);
+    for (int i = 0; i < compactValueCount_; ++i)
+    {
+        values->emplace_back(compactValues[i]);
+    }
+    size_t errorIndex = 0;
+    for (size_t i = 0; i < compactFlagIndices_.size(); ++i)
+    {
+        AnalysisDataValue  &value = (*values)[compactFlagIndices_[i]];
+        const unsigned char flags = compactFlags_[i];
+        const real          y     = value.value();
+        value.clear();
+        value.value() = y;
+        if (flags & ecfSet)
+        {
+            value.setValue(y, (flags & ecfPresent) != 0);
+        }
+        if (flags & ecfError)
+        {
+            value.setError(compactErrors_[errorIndex]);
+            ++errorIndex;
+        }
+    }
+    decodedValues_ = std::move(values);
+}
+
+
+void
+AnalysisDataStorageFrameData::releaseDecoded()
+{
+    decodedValues_.reset();
+}
+
+
 AnalysisDataPointSetRef
 AnalysisDataStorageFrameData::pointSet(int index) const
 {
@@ -676,7 +992,8 @@ AnalysisDataStorageFrameData::pointSet(int index) const
 AnalysisDataStorageFrame::AnalysisDataStorageFrame(
         const AbstractAnalysisData &data)
     : data_(NULL), currentDataSet_(0), currentOffset_(0),
-      columnCount_(data.columnCount(0)), bPointSetInProgress_(false)
+      columnCount_(data.columnCount(0)), bPointSetInProgress_(false),
+      firstSetIndex_(0), lastSetIndex_(0)
 {
     int totalColumnCount = 0;
     for (int i = 0; i < data.dataSetCount(); ++i)
@@ -698,7 +1015,8 @@ AnalysisDataStorageFrame::clearValues()
     if (bPointSetInProgress_)
     {
         std::vector<AnalysisDataValue>::iterator i;
-        for (i = values_.begin(); i != values_.end(); ++i)
+        for (i = values_.begin() + firstSetIndex_;
+             i != values_.begin() + lastSetIndex_; ++i)
         {
             i->clear();
         }
@@ -735,25 +1053,14 @@ AnalysisDataStorageFrame::finishPointSet()
                        "Should not be called for non-multipoint data");
     if (bPointSetInProgress_)
     {
+        // Both ends of the range are set by construction, so no trimming
+        // is needed.
         std::vector<AnalysisDataValue>::const_iterator begin
-            = values_.begin() + currentOffset_;
+            = values_.begin() + firstSetIndex_;
         std::vector<AnalysisDataValue>::const_iterator end
-            = begin + columnCount_;
-        int firstColumn = 0;
-        while (begin != end && !begin->isSet())
-        {
-            ++begin;
-            ++firstColumn;
-        }
-        while (end != begin && !(end-1)->isSet())
-        {
-            --end;
-        }
-        if (begin == end)
-        {
-            firstColumn = 0;
-        }
-        data_->addPointSet(currentDataSet_, firstColumn, begin, end);
+            = values_.begin() + lastSetIndex_;
+        data_->addPointSet(currentDataSet_, firstSetIndex_ - currentOffset_,
+                           begin, end);
     }
     clearValues();
 }
@@ -797,13 +1104,13 @@ AnalysisDataStorage::tryGetDataFrame(int index) const
     {
         return AnalysisDataFrameRef();
     }
-    const internal::AnalysisDataStorageFrameData &storedFrame
-        = *impl_->frames_[storageIndex];
-    if (!storedFrame.isAvailable())
+    internal::AnalysisDataStorageFrameData *storedFrame
+        = impl_->frames_[storageIndex].get();
+    if (!storedFrame->isAvailable())
     {
         return AnalysisDataFrameRef();
     }
-    return storedFrame.frameReference();
+    return impl_->frameReference(storedFrame);
 }
 
 
@@ -826,6 +1133,13 @@ AnalysisDataStorage::requestStorage(int nframes)
 }
 
 
+void
+AnalysisDataStorage::setMemoryLimit(std::size_t bytes)
+{
+    impl_->memoryLimit_ = bytes;
+}
+
+
 void
 AnalysisDataStorage::startDataStorage(AbstractAnalysisData      *data,
                                       AnalysisDataModuleManager *modules)
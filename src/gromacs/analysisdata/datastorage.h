@@ -1,7 +1,7 @@
 /*
  * This file is part of the GROMACS molecular simulation package.
  *
- * Copyright (c) 2012,2013,2014, by the GROMACS development team, led by
+ * Copyright (c) 2012,2013,2014,2017, by the GROMACS development team, led by
  * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
  * and including many others, as listed in the AUTHORS file in the
  * top-level source directory and at http://www.gromacs.org.
@@ -43,6 +43,9 @@
 #ifndef GMX_ANALYSISDATA_DATASTORAGE_H
 #define GMX_ANALYSISDATA_DATASTORAGE_H
 
+#include <cstddef>
+
+#include <algorithm>
 #include <vector>
 
 #include "gromacs/analysisdata/dataframe.h"
@@ -122,7 +125,7 @@ class AnalysisDataStorageFrame
             GMX_ASSERT(column >= 0 && column < columnCount(),
                        "Invalid column index");
             values_[currentOffset_ + column].setValue(value, bPresent);
-            bPointSetInProgress_ = true;
+            markValueSet(currentOffset_ + column);
         }
         /*! \brief
          * Sets value for a column.
@@ -142,7 +145,7 @@ class AnalysisDataStorageFrame
             GMX_ASSERT(column >= 0 && column < columnCount(),
                        "Invalid column index");
             values_[currentOffset_ + column].setValue(value, error, bPresent);
-            bPointSetInProgress_ = true;
+            markValueSet(currentOffset_ + column);
         }
         /*! \brief
          * Access value for a column.
@@ -214,6 +217,21 @@ class AnalysisDataStorageFrame
          */
         explicit AnalysisDataStorageFrame(const AbstractAnalysisData &data);
 
+        //! Updates the range of set values after setting value \p index.
+        void markValueSet(int index)
+        {
+            if (!bPointSetInProgress_)
+            {
+                firstSetIndex_       = index;
+                lastSetIndex_        = index + 1;
+                bPointSetInProgress_ = true;
+            }
+            else
+            {
+                firstSetIndex_ = std::min(firstSetIndex_, index);
+                lastSetIndex_  = std::max(lastSetIndex_, index + 1);
+            }
+        }
         //! Clear all column values from the frame.
         void clearValues();
 
@@ -231,6 +249,16 @@ class AnalysisDataStorageFrame
 
         //! Whether any values have been set in the current point set.
         bool                                    bPointSetInProgress_;
+        /*! \brief
+         * Range of indices in \a values_ that have been set.
+         *
+         * Only valid if \a bPointSetInProgress_ is true.  Allows clearing and
+         * trimming sparse point sets in multipoint data without going through
+         * all the columns.
+         */
+        int                                     firstSetIndex_;
+        //! End of the range of set values (see \a firstSetIndex_).
+        int                                     lastSetIndex_;
 
         //! Needed for access to the constructor.
         friend class internal::AnalysisDataStorageImpl;
@@ -293,6 +321,16 @@ class AnalysisDataStorage
          * A valid reference for a frame will be returned after finishFrame()
          * has been called for that frame.
          *
+         * If storage of all frames has been requested and the frames exceed
+         * the limit set with setMemoryLimit(), frames are kept in a compact
+         * form or in a temporary file after all notifications for them have
+         * been sent, and are decoded when accessed through this method.
+         * The returned reference keeps the decoded values alive, so it
+         * remains valid while other frames are accessed.  If some of the
+         * frames have been written to a temporary file, this method can
+         * throw FileIOError if reading them back fails.
+         * This method can be called concurrently from multiple threads.
+         *
          * \see AbstractAnalysisData::tryGetDataFrameInternal()
          */
         AnalysisDataFrameRef tryGetDataFrame(int index) const;
@@ -306,6 +344,22 @@ class AnalysisDataStorage
          * \see AbstractAnalysisData::requestStorageInternal()
          */
         bool requestStorage(int nframes);
+        /*! \brief
+         * Sets the amount of memory to use for stored frames.
+         *
+         * \param[in] bytes  Number of bytes of frame values to keep in
+         *      memory.
+         *
+         * Only has an effect if storage of all frames has been requested.
+         * Frames are stored as they are up to the limit.  Frames that would
+         * exceed it are stored in a more compact form, and written to a
+         * temporary file and read back when accessed if also the compact
+         * form would exceed the limit.
+         * If not called, a limit of 1 GiB is used.
+         *
+         * Does not throw.
+         */
+        void setMemoryLimit(std::size_t bytes);
 
         /*! \brief
          * Start storing data.
@@ -1,7 +1,7 @@
 /*
  * This file is part of the GROMACS molecular simulation package.
  *
- * Copyright (c) 2010,2011,2012,2013,2014,2016, by the GROMACS development team, led by
+ * Copyright (c) 2010,2011,2012,2013,2014,2016,2017, by the GROMACS development team, led by
  * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
  * and including many others, as listed in the AUTHORS file in the
  * top-level source directory and at http://www.gromacs.org.
@@ -43,17 +43,89 @@
 
 #include "displacement.h"
 
+#include <algorithm>
+#include <vector>
+
 #include "gromacs/analysisdata/dataframe.h"
 #include "gromacs/analysisdata/datamodulemanager.h"
 #include "gromacs/analysisdata/modules/histogram.h"
 #include "gromacs/math/utilities.h"
+#include "gromacs/simd/simd.h"
+#include "gromacs/utility/alignedallocator.h"
 #include "gromacs/utility/exceptions.h"
 #include "gromacs/utility/gmxassert.h"
-#include "gromacs/utility/smalloc.h"
+#include "gromacs/utility/gmxomp.h"
 
 namespace gmx
 {
 
+namespace
+{
+
+#if GMX_SIMD_HAVE_REAL
+//! Number of particles processed together in the displacement kernel.
+const int c_particleBatchSize = GMX_SIMD_REAL_WIDTH;
+#else
+//! Number of particles processed together in the displacement kernel.
+const int c_particleBatchSize = 1;
+#endif
+/*! \brief
+ * Number of particles assigned to a thread at a time.
+ *
+ * Must be a multiple of \c c_particleBatchSize.
+ */
+const int c_particleBlockSize = 256;
+
+//! Aligned array of reals for use with SIMD loads and stores.
+typedef std::vector<real, AlignedAllocator<real> > AlignedRealArray;
+
+/*! \brief
+ * Computes squared displacements for a block of particles.
+ *
+ * \param[in]  current  Current positions.
+ * \param[in]  old      Old positions.
+ * \param[in]  ndim     Number of dimensions.
+ * \param[in]  stride   Distance between dimensions in \p current and \p old.
+ * \param[in]  begin    First particle to compute.
+ * \param[in]  end      One past the last particle to compute.
+ * \param[out] result   Squared displacement for each particle.
+ *
+ * Component \c d of particle \c i is at index `d*stride + i` in \p current
+ * and \p old.  \p begin and \p end must be multiples of
+ * \c c_particleBatchSize, and the arrays must be aligned for SIMD access.
+ */
+void computeSquaredDisplacements(const real *current, const real *old,
+                                 int ndim, int stride, int begin, int end,
+                                 real *result)
+{
+#if GMX_SIMD_HAVE_REAL
+    for (int i = begin; i < end; i += c_particleBatchSize)
+    {
+        SimdReal dist2 = setZero();
+        for (int d = 0; d < ndim; ++d)
+        {
+            const SimdReal x0    = load(old + d*stride + i);
+            const SimdReal displ = load(current + d*stride + i) - x0;
+            dist2 = fma(displ, displ, dist2);
+        }
+        store(result + i, dist2);
+    }
+#else
+    for (int i = begin; i < end; ++i)
+    {
+        real dist2 = 0.0;
+        for (int d = 0; d < ndim; ++d)
+        {
+            const real displ = current[d*stride + i] - old[d*stride + i];
+            dist2 += displ * displ;
+        }
+        result[i] = dist2;
+    }
+#endif
+}
+
+}   // namespace
+
 /********************************************************************
  * AnalysisDataDisplacementModule::Impl
  */
@@ -67,7 +139,20 @@ class AnalysisDataDisplacementModule::Impl
 {
     public:
         Impl();
-        ~Impl();
+
+        //! Returns the stored positions for slot \p slot in \a history_.
+        const real *slotPositions(int slot) const
+        {
+            return history_.data() + slot * ndim * paddedCount_;
+        }
+        //! Initializes \a lags_ once the number of stored frames is known.
+        void initLags();
+        /*! \brief
+         * Computes squared displacements into \a dist2_ for the current frame.
+         *
+         * \param[in] lagCount  Number of first \a lags_ to compute.
+         */
+        void computeDisplacements(int lagCount);
 
         //! Maximum number of particles for which the displacements are calculated.
         int                     nmax;
@@ -75,6 +160,12 @@ class AnalysisDataDisplacementModule::Impl
         real                    tmax;
         //! Number of dimensions per data point.
         int                     ndim;
+        /*! \brief
+         * Ratio between consecutive time differences to calculate.
+         *
+         * If not larger than one, all time differences are calculated.
+         */
+        real                    lagSpacing_;
 
         //! true if no frames have been read.
         bool                    bFirst;
@@ -84,15 +175,26 @@ class AnalysisDataDisplacementModule::Impl
         real                    dt;
         //! Stores the time of the current frame.
         real                    t;
-        //! Stores the index in the store for the current positions.
+        //! Stores the slot in \a history_ for the current positions.
         int                     ci;
 
-        //! Maximum number of positions to store for a particle.
-        int                            max_store;
-        //! The total number of positions ever stored (can be larger than \p max_store).
-        int                            nstored;
-        //! Old values.
-        real                          *oldval;
+        //! Maximum number of frames to store (-1 until known).
+        int                     max_store;
+        //! The total number of frames ever stored (can be larger than \p max_store).
+        int                     nstored;
+        //! Number of particles, padded for SIMD access.
+        int                     paddedCount_;
+        /*! \brief
+         * Old positions.
+         *
+         * Each stored frame occupies \a ndim consecutive arrays of
+         * \a paddedCount_ values, one for each dimension.
+         */
+        AlignedRealArray        history_;
+        //! Time differences (in frames) for which displacements are calculated.
+        std::vector<int>        lags_;
+        //! Squared displacements for each lag in \a lags_ for the current frame.
+        AlignedRealArray        dist2_;
         //! The most recently calculated displacements.
         std::vector<AnalysisDataValue> currValues_;
 
@@ -101,16 +203,57 @@ class AnalysisDataDisplacementModule::Impl
 };
 
 AnalysisDataDisplacementModule::Impl::Impl()
-    : nmax(0), tmax(0.0), ndim(3),
-      bFirst(true), t0(0.0), dt(0.0), t(0.0), ci(0),
-      max_store(-1), nstored(0), oldval(NULL),
+    : nmax(0), tmax(0.0), ndim(3), lagSpacing_(0.0),
+      bFirst(true), t0(0.0), dt(0.0), t(0.0), ci(-1),
+      max_store(-1), nstored(0), paddedCount_(0),
       histm(NULL)
 {
 }
 
-AnalysisDataDisplacementModule::Impl::~Impl()
+void
+AnalysisDataDisplacementModule::Impl::initLags()
+{
+    lags_.clear();
+    int lag = 1;
+    while (lag < max_store)
+    {
+        lags_.push_back(lag);
+        if (lagSpacing_ > 1.0)
+        {
+            lag = std::max(lag + 1, static_cast<int>(lag * lagSpacing_ + 0.5));
+        }
+        else
+        {
+            ++lag;
+        }
+    }
+    dist2_.resize(lags_.size() * paddedCount_);
+}
+
+void
+AnalysisDataDisplacementModule::Impl::computeDisplacements(int lagCount)
 {
-    sfree(oldval);
+    const int blockCount
+        = (paddedCount_ + c_particleBlockSize - 1) / c_particleBlockSize;
+    const int nthreads = std::min(gmx_omp_get_max_threads(), blockCount);
+    const real *current  = slotPositions(ci);
+#pragma omp parallel for num_threads(nthreads) schedule(static)
+    for (int block = 0; block < blockCount; ++block)
+    {
+        const int begin = block * c_particleBlockSize;
+        const int end   = std::min(begin + c_particleBlockSize, paddedCount_);
+        for (int l = 0; l < lagCount; ++l)
+        {
+            int slot = ci - lags_[l];
+            if (slot < 0)
+            {
+                slot += max_store;
+            }
+            computeSquaredDisplacements(current, slotPositions(slot),
+                                        ndim, paddedCount_, begin, end,
+                                        dist2_.data() + l * paddedCount_);
+        }
+    }
 }
 
 /********************************************************************
@@ -136,6 +279,13 @@ AnalysisDataDisplacementModule::setMaxTime(real tmax)
 }
 
 
+void
+AnalysisDataDisplacementModule::setLogarithmicLagSpacing(real factor)
+{
+    _impl->lagSpacing_ = factor;
+}
+
+
 void
 AnalysisDataDisplacementModule::setMSDHistogram(
         AnalysisDataBinAverageModulePointer histm)
@@ -146,6 +296,13 @@ AnalysisDataDisplacementModule::setMSDHistogram(
 }
 
 
+int
+AnalysisDataDisplacementModule::frameCount() const
+{
+    return std::max(_impl->nstored - 1, 0);
+}
+
+
 AnalysisDataFrameRef
 AnalysisDataDisplacementModule::tryGetDataFrameInternal(int /*index*/) const
 {
@@ -175,10 +332,12 @@ AnalysisDataDisplacementModule::dataStarted(AbstractAnalysisData *data)
         GMX_THROW(APIError("Data has incorrect number of columns"));
     }
     _impl->nmax = data->columnCount();
-    snew(_impl->oldval, _impl->nmax);
-    _impl->ci = -_impl->nmax;
+    const int particleCount = _impl->nmax / _impl->ndim;
+    _impl->paddedCount_
+        = (particleCount + c_particleBatchSize - 1) / c_particleBatchSize * c_particleBatchSize;
+    _impl->history_.assign(_impl->ndim * _impl->paddedCount_, 0.0);
 
-    int ncol = _impl->nmax / _impl->ndim + 1;
+    int ncol = particleCount + 1;
     _impl->currValues_.reserve(ncol);
     setColumnCount(0, ncol);
 }
@@ -212,23 +371,18 @@ AnalysisDataDisplacementModule::frameStarted(const AnalysisDataFrameHeader &head
     // Allocate memory for all the positions once it is possible.
     if (_impl->max_store == -1 && !_impl->bFirst)
     {
-        _impl->max_store = _impl->nmax * (int)(_impl->tmax/_impl->dt + 1);
-        srenew(_impl->oldval, _impl->max_store);
+        _impl->max_store = (int)(_impl->tmax/_impl->dt + 1);
+        _impl->history_.resize(_impl->max_store * _impl->ndim * _impl->paddedCount_, 0.0);
+        _impl->initLags();
     }
 
-    // Increment the index where current positions are stored.
-    _impl->ci += _impl->nmax;
+    // Increment the slot where current positions are stored.
+    _impl->ci++;
     if (_impl->ci >= _impl->max_store)
     {
         _impl->ci = 0;
     }
 
-/*
-    for (int i = 0; i < _impl->nmax; ++i)
-    {
-        _impl->p[_impl->ci + i].bPres = false;
-    }
- */
     _impl->nstored++;
     _impl->bFirst = false;
 }
@@ -242,9 +396,13 @@ AnalysisDataDisplacementModule::pointsAdded(const AnalysisDataPointSetRef &point
     {
         GMX_THROW(APIError("Partial data points"));
     }
+    const int ndim      = _impl->ndim;
+    const int stride    = _impl->paddedCount_;
+    real     *positions = _impl->history_.data() + _impl->ci * ndim * stride;
     for (int i = 0; i < points.columnCount(); ++i)
     {
-        _impl->oldval[_impl->ci + points.firstColumn() + i] = points.y(i);
+        const int column = points.firstColumn() + i;
+        positions[(column % ndim) * stride + column / ndim] = points.y(i);
     }
 }
 
@@ -257,13 +415,11 @@ AnalysisDataDisplacementModule::frameFinished(const AnalysisDataFrameHeader & /*
         return;
     }
 
-    int step, i;
-
     if (_impl->nstored == 2)
     {
         if (_impl->histm)
         {
-            _impl->histm->init(histogramFromBins(0, _impl->max_store / _impl->nmax,
+            _impl->histm->init(histogramFromBins(0, _impl->max_store,
                                                  _impl->dt).integerBins());
         }
         moduleManager().notifyDataStart(this);
@@ -271,28 +427,19 @@ AnalysisDataDisplacementModule::frameFinished(const AnalysisDataFrameHeader & /*
     AnalysisDataFrameHeader header(_impl->nstored - 2, _impl->t, 0);
     moduleManager().notifyFrameStart(header);
 
-    for (i = _impl->ci - _impl->nmax, step = 1;
-         step < _impl->nstored && i != _impl->ci;
-         i -= _impl->nmax, ++step)
+    const int lagCount
+        = std::lower_bound(_impl->lags_.begin(), _impl->lags_.end(), _impl->nstored)
+            - _impl->lags_.begin();
+    _impl->computeDisplacements(lagCount);
+    const int particleCount = _impl->nmax / _impl->ndim;
+    for (int l = 0; l < lagCount; ++l)
     {
-        if (i < 0)
-        {
-            i += _impl->max_store;
-        }
+        const real *dist2 = _impl->dist2_.data() + l * _impl->paddedCount_;
         _impl->currValues_.clear();
-        _impl->currValues_.emplace_back(step * _impl->dt);
-        int k = 1;
-        for (int j = 0; j < _impl->nmax; j += _impl->ndim, ++k)
+        _impl->currValues_.emplace_back(_impl->lags_[l] * _impl->dt);
+        for (int j = 0; j < particleCount; ++j)
         {
-            real dist2 = 0.0;
-
-            for (int d = 0; d < _impl->ndim; ++d)
-            {
-                real displ = _impl->oldval[_impl->ci + j + d]
-                    - _impl->oldval[i + j + d];
-                dist2 += displ * displ;
-            }
-            _impl->currValues_.emplace_back(dist2);
+            _impl->currValues_.emplace_back(dist2[j]);
         }
         moduleManager().notifyPointsAdd(AnalysisDataPointSetRef(header, _impl->currValues_));
     }
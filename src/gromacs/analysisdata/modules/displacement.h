@@ -1,7 +1,7 @@
 /*
  * This file is part of the GROMACS molecular simulation package.
  *
- * Copyright (c) 2010,2011,2012,2013,2014,2015, by the GROMACS development team, led by
+ * Copyright (c) 2010,2011,2012,2013,2014,2015,2017, by the GROMACS development team, led by
  * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
  * and including many others, as listed in the AUTHORS file in the
  * top-level source directory and at http://www.gromacs.org.
@@ -59,7 +59,10 @@ class AnalysisDataBinAverageModule;
  * first one.  For each frame, there can be multiple points, each of which
  * describes displacement for a certain time difference ending that that frame.
  * The first column contains the time difference (backwards from the current
- * frame), and the remaining columns the sizes of the displacements.
+ * frame), and the remaining columns the squared sizes of the displacements.
+ *
+ * The displacements for all particles are computed together using SIMD
+ * instructions, parallelized over particles with OpenMP.
  *
  * Current implementation is not very generic, but should be easy to extend.
  *
@@ -77,6 +80,21 @@ class AnalysisDataDisplacementModule : public AbstractAnalysisData,
          * Sets the largest displacement time to be calculated.
          */
         void setMaxTime(real tmax);
+        /*! \brief
+         * Sets logarithmic spacing for the time differences (lags).
+         *
+         * \param[in] factor  Minimum ratio between consecutive time
+         *      differences.
+         *
+         * By default, displacements are calculated for all time differences
+         * up to the time set with setMaxTime().  If \p factor is larger
+         * than one, the time differences are instead chosen such that each
+         * is at least \p factor times the previous one (1, 2, 4, ... frames
+         * for a factor of two), which keeps the cost low for long maximum
+         * times.  Every frame is still used as an origin.
+         * Must be called before the data is started.
+         */
+        void setLogarithmicLagSpacing(real factor);
         /*! \brief
          * Sets an histogram module that will receive a MSD histogram.
          *
@@ -84,6 +102,8 @@ class AnalysisDataDisplacementModule : public AbstractAnalysisData,
          */
         void setMSDHistogram(std::shared_ptr<AnalysisDataBinAverageModule> histm);
 
+        virtual int frameCount() const;
+
         virtual int flags() const;
 
         virtual void dataStarted(AbstractAnalysisData *data);
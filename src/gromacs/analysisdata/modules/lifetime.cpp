@@ -1,7 +1,7 @@
 /*
  * This file is part of the GROMACS molecular simulation package.
  *
- * Copyright (c) 2013,2014,2015,2016, by the GROMACS development team, led by
+ * Copyright (c) 2013,2014,2015,2016,2017, by the GROMACS development team, led by
  * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
  * and including many others, as listed in the AUTHORS file in the
  * top-level source directory and at http://www.gromacs.org.
@@ -71,7 +71,9 @@ class AnalysisDataLifetimeModule::Impl
         typedef std::deque<int> LifetimeHistogram;
 
         //! Initializes the implementation class with empty/default values.
-        Impl() : firstx_(0.0), lastx_(0.0), frameCount_(0), bCumulative_(false)
+        Impl()
+            : firstx_(0.0), lastx_(0.0), frameCount_(0), bCumulative_(false),
+              bMultipoint_(false)
         {
         }
 
@@ -102,14 +104,18 @@ class AnalysisDataLifetimeModule::Impl
         int                             frameCount_;
         //! Whether to add subintervals of longer intervals explicitly.
         bool                            bCumulative_;
+        //! Whether the input data only contains state transitions.
+        bool                            bMultipoint_;
         /*! \brief
-         * Length of current continuously present interval for each data column.
+         * Start of the current continuously present interval for each column.
          *
-         * While frame N has been processed, stores the length of an interval
-         * for each data column where that column has been continuously present
-         * up to and including frame N.
+         * While frame N has been processed, stores for each data column the
+         * index of the frame where the interval of continuous presence that
+         * extends up to and including frame N started, or -1 if the column is
+         * absent in frame N.  Only transitions need to update this, so the
+         * state is effectively run-length encoded.
          */
-        std::vector<std::vector<int> >  currentLifetimes_;
+        std::vector<std::vector<int> >  intervalStarts_;
         /*! \brief
          * Accumulated lifetime histograms for each data set.
          */
@@ -132,17 +138,19 @@ void AnalysisDataLifetimeModule::setCumulative(bool bCumulative)
 
 int AnalysisDataLifetimeModule::flags() const
 {
-    return efAllowMulticolumn | efAllowMissing | efAllowMultipleDataSets;
+    return efAllowMulticolumn | efAllowMultipoint | efAllowMissing
+           | efAllowMultipleDataSets;
 }
 
 void
 AnalysisDataLifetimeModule::dataStarted(AbstractAnalysisData *data)
 {
-    impl_->currentLifetimes_.reserve(data->dataSetCount());
+    impl_->bMultipoint_ = data->isMultipoint();
+    impl_->intervalStarts_.reserve(data->dataSetCount());
     impl_->lifetimeHistograms_.reserve(data->dataSetCount());
     for (int i = 0; i < data->dataSetCount(); ++i)
     {
-        impl_->currentLifetimes_.emplace_back(data->columnCount(i), 0);
+        impl_->intervalStarts_.emplace_back(data->columnCount(i), -1);
         impl_->lifetimeHistograms_.emplace_back();
     }
 }
@@ -162,24 +170,43 @@ AnalysisDataLifetimeModule::frameStarted(const AnalysisDataFrameHeader &header)
 void
 AnalysisDataLifetimeModule::pointsAdded(const AnalysisDataPointSetRef &points)
 {
-    const int dataSet = points.dataSetIndex();
-    // This assumption is strictly not necessary, but this is how the
-    // framework works currently, and makes the code below simpler.
-    GMX_ASSERT(points.firstColumn() == 0
-               && points.lastColumn() == static_cast<int>(impl_->currentLifetimes_[dataSet].size()) - 1,
+    const int         dataSet = points.dataSetIndex();
+    const int         frame   = impl_->frameCount_ - 1;
+    std::vector<int> &starts  = impl_->intervalStarts_[dataSet];
+    // For non-multipoint data, this assumption is strictly not necessary,
+    // but this is how the framework works currently.  For multipoint data,
+    // the point sets only contain the columns whose state changes, and
+    // columns not set in any point set keep their state from the previous
+    // frame.  For non-multipoint data, an unset column is absent.
+    GMX_ASSERT(impl_->bMultipoint_
+               || (points.firstColumn() == 0
+                   && points.lastColumn() == static_cast<int>(starts.size()) - 1),
                "Point set should cover all columns");
     for (int i = 0; i < points.columnCount(); ++i)
     {
+        if (impl_->bMultipoint_ && !points.values()[i].isSet())
+        {
+            continue;
+        }
         // TODO: Perhaps add control over how this is determined?
         const bool bPresent = points.present(i) && points.y(i) > 0.0;
+        int       &start    = starts[points.firstColumn() + i];
         if (bPresent)
         {
-            ++impl_->currentLifetimes_[dataSet][i];
+            if (start < 0)
+            {
+                start = frame;
+            }
         }
-        else if (impl_->currentLifetimes_[dataSet][i] > 0)
+        else if (start >= 0)
         {
-            impl_->addLifetime(dataSet, impl_->currentLifetimes_[dataSet][i]);
-            impl_->currentLifetimes_[dataSet][i] = 0;
+            // A column that was switched on in an earlier point set of this
+            // frame was never present at the end of a frame.
+            if (start < frame)
+            {
+                impl_->addLifetime(dataSet, frame - start);
+            }
+            start = -1;
         }
     }
 }
@@ -193,14 +220,18 @@ void
 AnalysisDataLifetimeModule::dataFinished()
 {
     // Need to process the elements present in the last frame explicitly.
-    for (size_t i = 0; i < impl_->currentLifetimes_.size(); ++i)
+    for (size_t i = 0; i < impl_->intervalStarts_.size(); ++i)
     {
-        for (size_t j = 0; j < impl_->currentLifetimes_[i].size(); ++j)
+        for (size_t j = 0; j < impl_->intervalStarts_[i].size(); ++j)
         {
-            impl_->addLifetime(i, impl_->currentLifetimes_[i][j]);
+            const int start = impl_->intervalStarts_[i][j];
+            if (start >= 0)
+            {
+                impl_->addLifetime(i, impl_->frameCount_ - start);
+            }
         }
     }
-    impl_->currentLifetimes_.clear();
+    impl_->intervalStarts_.clear();
 
     if (impl_->bCumulative_)
     {
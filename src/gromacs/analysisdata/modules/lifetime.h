@@ -1,7 +1,7 @@
 /*
  * This file is part of the GROMACS molecular simulation package.
  *
- * Copyright (c) 2013,2014,2015, by the GROMACS development team, led by
+ * Copyright (c) 2013,2014,2015,2017, by the GROMACS development team, led by
  * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
  * and including many others, as listed in the AUTHORS file in the
  * top-level source directory and at http://www.gromacs.org.
@@ -61,6 +61,14 @@ namespace gmx
  * Produces a histogram from the lengths of these intervals.
  * Input data should have frames with evenly spaced x values.
  *
+ * If the input data is multipoint, it is interpreted as a sequence of state
+ * transitions: only the columns that are set in a point set are updated,
+ * and all other columns keep the state they had in the previous frame
+ * (initially, all columns are absent).  This allows, e.g., reporting only
+ * contacts that are formed or broken in each frame, making the cost of the
+ * analysis proportional to the number of transitions instead of the number
+ * of columns times the number of frames.
+ *
  * Output data contains one column for each data set in the input data.
  * This column gives the lifetime histogram for the corresponding data set.
  * x axis in the output is spaced the same as in the input data, and extends
@@ -1,7 +1,7 @@
 /*
  * This file is part of the GROMACS molecular simulation package.
  *
- * Copyright (c) 2011,2012,2013,2014,2015, by the GROMACS development team, led by
+ * Copyright (c) 2011,2012,2013,2014,2015,2017, by the GROMACS development team, led by
  * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
  * and including many others, as listed in the AUTHORS file in the
  * top-level source directory and at http://www.gromacs.org.
@@ -49,6 +49,8 @@
 
 #include "gromacs/analysisdata/analysisdata.h"
 
+#include <vector>
+
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 
@@ -431,6 +433,29 @@ TYPED_TEST(AnalysisDataCommonTest, FullStorageWorks)
     ASSERT_NO_THROW_GMX(AnalysisDataTest::presentAllData());
 }
 
+/*
+ * Tests that data can be accessed correctly when all stored frames are
+ * written to a temporary file.
+ */
+TYPED_TEST(AnalysisDataCommonTest, FullStorageWorksWithTemporaryFile)
+{
+    this->data_.setStorageMemoryLimit(0);
+    ASSERT_NO_THROW_GMX(AnalysisDataTest::addStaticStorageCheckerModule(-1));
+    ASSERT_NO_THROW_GMX(AnalysisDataTest::presentAllData());
+}
+
+/*
+ * Tests that data can be accessed correctly when stored frames are kept
+ * partly as they are, partly in compact form, and partly in a temporary
+ * file.
+ */
+TYPED_TEST(AnalysisDataCommonTest, FullStorageWorksWithCompactFrames)
+{
+    this->data_.setStorageMemoryLimit(3*sizeof(gmx::AnalysisDataValue));
+    ASSERT_NO_THROW_GMX(AnalysisDataTest::addStaticStorageCheckerModule(-1));
+    ASSERT_NO_THROW_GMX(AnalysisDataTest::presentAllData());
+}
+
 /*
  * Tests that a data module can be added to an AnalysisData object after data
  * has been added if all data is still available in storage.
@@ -468,4 +493,51 @@ TEST(DISABLED_AnalysisDataCommonTest, GenericTests)
 
 #endif
 
+/********************************************************************
+ * Tests for stored frames of gmx::AnalysisData.
+ */
+
+/*
+ * Tests that references to frames read back from a temporary file remain
+ * valid while more frames are accessed than are kept decoded.
+ */
+TEST(AnalysisDataStorageTest, KeepsReferencesToSpilledFramesValid)
+{
+    const int         frameCount = 40;
+    gmx::AnalysisData data;
+    data.setColumnCount(0, 2);
+    data.setStorageMemoryLimit(0);
+    ASSERT_TRUE(data.requestStorage(-1));
+
+    gmx::AnalysisDataHandle handle = data.startData(gmx::AnalysisDataParallelOptions());
+    for (int i = 0; i < frameCount; ++i)
+    {
+        handle.startFrame(i, 0.5*i);
+        handle.setPoint(0, static_cast<real>(i), static_cast<real>(0.1*i));
+        handle.setPoint(1, static_cast<real>(-i), i % 2 == 0);
+        handle.finishFrame();
+    }
+    handle.finishData();
+
+    std::vector<gmx::AnalysisDataFrameRef> frames;
+    for (int i = 0; i < frameCount; ++i)
+    {
+        frames.push_back(data.getDataFrame(i));
+    }
+    for (int i = 0; i < frameCount; ++i)
+    {
+        const gmx::AnalysisDataFrameRef &frame = frames[i];
+        ASSERT_TRUE(frame.isValid());
+        EXPECT_EQ(i, frame.frameIndex());
+        // The values are stored without any arithmetic, so they should
+        // be exact.
+        EXPECT_EQ(static_cast<real>(0.5*i), frame.x());
+        EXPECT_EQ(static_cast<real>(i), frame.y(0));
+        EXPECT_EQ(static_cast<real>(0.1*i), frame.dy(0));
+        EXPECT_TRUE(frame.present(0));
+        EXPECT_EQ(static_cast<real>(-i), frame.y(1));
+        EXPECT_EQ(i % 2 == 0, frame.present(1));
+    }
+}
+
 } // namespace
@@ -1,7 +1,7 @@
 /*
  * This file is part of the GROMACS molecular simulation package.
  *
- * Copyright (c) 2013,2014, by the GROMACS development team, led by
+ * Copyright (c) 2013,2014,2017, by the GROMACS development team, led by
  * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
  * and including many others, as listed in the AUTHORS file in the
  * top-level source directory and at http://www.gromacs.org.
@@ -52,6 +52,7 @@
 #include <gtest/gtest.h>
 
 #include "gromacs/analysisdata/analysisdata.h"
+#include "gromacs/analysisdata/paralleloptions.h"
 
 #include "gromacs/analysisdata/tests/datatest.h"
 #include "testutils/testasserts.h"
@@ -88,6 +89,77 @@ class SimpleInputData
         AnalysisDataTestInput  data_;
 };
 
+/*! \brief
+ * Input data for gmx::AnalysisDataLifetimeModule tests that only contains
+ * state transitions.
+ *
+ * Describes the same columns as SimpleInputData.
+ */
+class EventInputData
+{
+    public:
+        static const AnalysisDataTestInput &get()
+        {
+#ifndef STATIC_ANON_NAMESPACE_BUG
+            static EventInputData singleton;
+            return singleton.data_;
+#else
+            static EventInputData singleton_lifetime;
+            return singleton_lifetime.data_;
+#endif
+        }
+
+        EventInputData() : data_(1, true)
+        {
+            using gmx::test::AnalysisDataTestInputFrame;
+            data_.setColumnCount(0, 3);
+            AnalysisDataTestInputFrame &frame1 = data_.addFrame(1.0);
+            frame1.addPointSetWithValues(0, 0, 1.0, 1.0, 1.0);
+            AnalysisDataTestInputFrame &frame2 = data_.addFrame(2.0);
+            frame2.addPointSetWithValues(0, 1, 0.0);
+            AnalysisDataTestInputFrame &frame3 = data_.addFrame(3.0);
+            frame3.addPointSetWithValues(0, 0, 0.0, 1.0);
+        }
+
+    private:
+        AnalysisDataTestInput  data_;
+};
+
+/*! \brief
+ * Input data for gmx::AnalysisDataLifetimeModule tests that switches a column
+ * on and off within a single frame.
+ */
+class EventWithinFrameInputData
+{
+    public:
+        static const AnalysisDataTestInput &get()
+        {
+#ifndef STATIC_ANON_NAMESPACE_BUG
+            static EventWithinFrameInputData singleton;
+            return singleton.data_;
+#else
+            static EventWithinFrameInputData singleton_lifetime;
+            return singleton_lifetime.data_;
+#endif
+        }
+
+        EventWithinFrameInputData() : data_(1, true)
+        {
+            using gmx::test::AnalysisDataTestInputFrame;
+            data_.setColumnCount(0, 2);
+            AnalysisDataTestInputFrame &frame1 = data_.addFrame(1.0);
+            frame1.addPointSetWithValues(0, 0, 1.0, 0.0);
+            AnalysisDataTestInputFrame &frame2 = data_.addFrame(2.0);
+            frame2.addPointSetWithValues(0, 1, 1.0);
+            frame2.addPointSetWithValues(0, 1, 0.0);
+            AnalysisDataTestInputFrame &frame3 = data_.addFrame(3.0);
+            frame3.addPointSetWithValues(0, 0, 0.0);
+        }
+
+    private:
+        AnalysisDataTestInput  data_;
+};
+
 // Input data with multiple data sets for gmx::AnalysisDataLifetimeModule tests.
 class MultiDataSetInputData
 {
@@ -182,4 +254,67 @@ TEST_F(LifetimeModuleTest, HandlesMultipleDataSets)
     ASSERT_NO_THROW_GMX(presentAllData(input, &data));
 }
 
+TEST_F(LifetimeModuleTest, HandlesEventInput)
+{
+    const AnalysisDataTestInput &input = EventInputData::get();
+    gmx::AnalysisData            data;
+    ASSERT_NO_THROW_GMX(setupDataObject(input, &data));
+
+    gmx::AnalysisDataLifetimeModulePointer module(
+            new gmx::AnalysisDataLifetimeModule);
+    module->setCumulative(false);
+    data.addModule(module);
+
+    ASSERT_NO_THROW_GMX(addStaticCheckerModule(input, &data));
+    ASSERT_NO_THROW_GMX(addReferenceCheckerModule("InputData", &data));
+    ASSERT_NO_THROW_GMX(addReferenceCheckerModule("Lifetime", module.get()));
+    ASSERT_NO_THROW_GMX(presentAllData(input, &data));
+}
+
+TEST_F(LifetimeModuleTest, IgnoresIntervalsWithinFrame)
+{
+    const AnalysisDataTestInput &input = EventWithinFrameInputData::get();
+    gmx::AnalysisData            data;
+    ASSERT_NO_THROW_GMX(setupDataObject(input, &data));
+
+    gmx::AnalysisDataLifetimeModulePointer module(
+            new gmx::AnalysisDataLifetimeModule);
+    module->setCumulative(false);
+    data.addModule(module);
+
+    ASSERT_NO_THROW_GMX(addStaticCheckerModule(input, &data));
+    ASSERT_NO_THROW_GMX(addReferenceCheckerModule("InputData", &data));
+    ASSERT_NO_THROW_GMX(addReferenceCheckerModule("Lifetime", module.get()));
+    ASSERT_NO_THROW_GMX(presentAllData(input, &data));
+}
+
+TEST_F(LifetimeModuleTest, TreatsUnsetColumnsAsAbsent)
+{
+    gmx::AnalysisData data;
+    data.setColumnCount(0, 2);
+
+    gmx::AnalysisDataLifetimeModulePointer module(
+            new gmx::AnalysisDataLifetimeModule);
+    module->setCumulative(false);
+    data.addModule(module);
+    ASSERT_NO_THROW_GMX(addReferenceCheckerModule("Lifetime", module.get()));
+
+    // The second column is not set in the second frame, which should end
+    // its interval like an explicit zero would.
+    gmx::AnalysisDataParallelOptions options;
+    gmx::AnalysisDataHandle          handle = data.startData(options);
+    handle.startFrame(0, 1.0);
+    handle.setPoint(0, 1.0);
+    handle.setPoint(1, 1.0);
+    handle.finishFrame();
+    handle.startFrame(1, 2.0);
+    handle.setPoint(0, 1.0);
+    handle.finishFrame();
+    handle.startFrame(2, 3.0);
+    handle.setPoint(0, 1.0);
+    handle.setPoint(1, 1.0);
+    handle.finishFrame();
+    handle.finishData();
+}
+
 } // namespace
@@ -51,6 +51,8 @@
 #include <cmath>
 
 #include <algorithm>
+#include <memory>
+#include <vector>
 
 #include "gromacs/correlationfunctions/expfit.h"
 #include "gromacs/correlationfunctions/integrate.h"
@@ -60,8 +62,10 @@
 #include "gromacs/math/functions.h"
 #include "gromacs/math/vec.h"
 #include "gromacs/utility/arraysize.h"
+#include "gromacs/utility/exceptions.h"
 #include "gromacs/utility/fatalerror.h"
 #include "gromacs/utility/futil.h"
+#include "gromacs/utility/gmxomp.h"
 #include "gromacs/utility/real.h"
 #include "gromacs/utility/smalloc.h"
 #include "gromacs/utility/stringutil.h"
@@ -87,42 +91,35 @@ enum {
 };
 
 /*! \brief Routine to compute ACF using FFT. */
-static void low_do_four_core(int nframes, real c1[], real cfour[],
-                             int nCos)
+static void low_do_four_core(gmx::AutoCorrelationBatch *acfBatch, int thread,
+                             int nframes, real c1[], real cfour[], int nCos)
 {
     int  i = 0;
-    std::vector<std::vector<real> > data;
-    data.resize(1);
-    data[0].resize(nframes, 0);
     switch (nCos)
     {
         case enNorm:
             for (i = 0; (i < nframes); i++)
             {
-                data[0][i] = c1[i];
+                cfour[i] = c1[i];
             }
             break;
         case enCos:
             for (i = 0; (i < nframes); i++)
             {
-                data[0][i] = cos(c1[i]);
+                cfour[i] = cos(c1[i]);
             }
             break;
         case enSin:
             for (i = 0; (i < nframes); i++)
             {
-                data[0][i] = sin(c1[i]);
+                cfour[i] = sin(c1[i]);
             }
             break;
         default:
             gmx_fatal(FARGS, "nCos = %d, %s %d", nCos, __FILE__, __LINE__);
     }
 
-    many_auto_correl(&data);
-    for (i = 0; (i < nframes); i++)
-    {
-        cfour[i] = data[0][i];
-    }
+    acfBatch->compute(thread, cfour);
 }
 
 /*! \brief Routine to comput ACF without FFT. */
@@ -337,23 +334,27 @@ static void dump_tmp(char *s, int n, real c[])
     gmx_ffclose(fp);
 }
 
-/*! \brief High level ACF routine. */
-static void do_four_core(unsigned long mode, int nframes,
-                         real c1[], real csum[], real ctmp[])
+/*! \brief High level ACF routine.
+ *
+ * Uses the FFT setup of thread in acfBatch, csum, ctmp and cfour are
+ * work arrays of nframes elements. On return c1 contains the ACF
+ * multiplied by invNumOrigins, the inverse number of time origins.
+ */
+static void do_four_core(gmx::AutoCorrelationBatch *acfBatch, int thread,
+                         unsigned long mode, int nframes,
+                         real c1[], real csum[], real ctmp[], real cfour[],
+                         const real invNumOrigins[])
 {
-    real   *cfour;
     char    buf[32];
     real    fac;
     int     j, m, m1;
 
-    snew(cfour, nframes);
-
     if (MODE(eacNormal))
     {
         /********************************************
          *  N O R M A L
          ********************************************/
-        low_do_four_core(nframes, c1, csum, enNorm);
+        low_do_four_core(acfBatch, thread, nframes, c1, csum, enNorm);
     }
     else if (MODE(eacCos))
     {
@@ -369,14 +370,14 @@ static void do_four_core(unsigned long mode, int nframes,
         }
 
         /* Cosine term of AC function */
-        low_do_four_core(nframes, ctmp, cfour, enCos);
+        low_do_four_core(acfBatch, thread, nframes, ctmp, cfour, enCos);
         for (j = 0; (j < nframes); j++)
         {
             c1[j]  = cfour[j];
         }
 
         /* Sine term of AC function */
-        low_do_four_core(nframes, ctmp, cfour, enSin);
+        low_do_four_core(acfBatch, thread, nframes, ctmp, cfour, enSin);
         for (j = 0; (j < nframes); j++)
         {
             c1[j]  += cfour[j];
@@ -443,7 +444,7 @@ static void do_four_core(unsigned long mode, int nframes,
                 dump_tmp(buf, nframes, ctmp);
             }
 
-            low_do_four_core(nframes, ctmp, cfour, enNorm);
+            low_do_four_core(acfBatch, thread, nframes, ctmp, cfour, enNorm);
 
             if (debug)
             {
@@ -471,7 +472,7 @@ static void do_four_core(unsigned long mode, int nframes,
                 sprintf(buf, "c1off%d.xvg", m);
                 dump_tmp(buf, nframes, ctmp);
             }
-            low_do_four_core(nframes, ctmp, cfour, enNorm);
+            low_do_four_core(acfBatch, thread, nframes, ctmp, cfour, enNorm);
             if (debug)
             {
                 sprintf(buf, "c1ofout%d.xvg", m);
@@ -510,7 +511,7 @@ static void do_four_core(unsigned long mode, int nframes,
             {
                 ctmp[j] = c1[DIM*j+m];
             }
-            low_do_four_core(nframes, ctmp, cfour, enNorm);
+            low_do_four_core(acfBatch, thread, nframes, ctmp, cfour, enNorm);
             for (j = 0; (j < nframes); j++)
             {
                 csum[j] += cfour[j];
@@ -522,10 +523,76 @@ static void do_four_core(unsigned long mode, int nframes,
         gmx_fatal(FARGS, "\nUnknown mode in do_autocorr (%d)", mode);
     }
 
-    sfree(cfour);
     for (j = 0; (j < nframes); j++)
     {
-        c1[j] = csum[j]/(real)(nframes-j);
+        c1[j] = csum[j]*invNumOrigins[j];
+    }
+}
+
+void compute_autocorr(int nframes, int nitem, int nout, real **c1,
+                      unsigned long mode, int nrestart, gmx_bool bFour,
+                      gmx_bool bVerbose)
+{
+    if (MODE(eacP3) || MODE(eacRcross))
+    {
+        bFour = FALSE;
+    }
+
+    /* The debug output of do_four_core uses fixed file names */
+    int                                        nthreads = (debug ? 1 : gmx_omp_get_max_threads());
+    std::unique_ptr<gmx::AutoCorrelationBatch> acfBatch;
+    std::vector<real>                          invNumOrigins;
+    if (bFour)
+    {
+        acfBatch.reset(new gmx::AutoCorrelationBatch(nframes, nthreads));
+        /* The normalization is the same for all items */
+        invNumOrigins.resize(nframes);
+        for (int j = 0; j < nframes; j++)
+        {
+            invNumOrigins[j] = 1.0/(nframes - j);
+        }
+    }
+
+    /* Loop over items (e.g. molecules or dihedrals), in parallel */
+    int nprogress = 0;
+#pragma omp parallel num_threads(nthreads)
+    {
+        try
+        {
+            int               thread = gmx_omp_get_thread_num();
+            std::vector<real> csum(nframes), ctmp(nframes), cfour(nframes);
+
+#pragma omp for schedule(dynamic)
+            for (int i = 0; i < nitem; i++)
+            {
+                if (bFour)
+                {
+                    do_four_core(acfBatch.get(), thread, mode, nframes, c1[i],
+                                 csum.data(), ctmp.data(), cfour.data(),
+                                 invNumOrigins.data());
+                }
+                else
+                {
+                    do_ac_core(nframes, nout, ctmp.data(), c1[i], nrestart, mode);
+                }
+                if (bVerbose)
+                {
+                    int n;
+#pragma omp atomic capture
+                    n = ++nprogress;
+                    if (thread == 0 && ((n % 100) == 0 || n == nitem))
+                    {
+                        fprintf(stderr, "\rThingie %d", n);
+                        fflush(stderr);
+                    }
+                }
+            }
+        }
+        GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR;
+    }
+    if (bVerbose)
+    {
+        fprintf(stderr, "\n");
     }
 }
 
@@ -538,8 +605,7 @@ void low_do_autocorr(const char *fn, const gmx_output_env_t *oenv, const char *t
 {
     FILE       *fp, *gp = NULL;
     int         i;
-    real       *csum;
-    real       *ctmp, *fit;
+    real       *fit;
     real        sum, Ct2av, Ctav;
     gmx_bool    bFour = acf.bFour;
 
@@ -582,37 +648,11 @@ void low_do_autocorr(const char *fn, const gmx_output_env_t *oenv, const char *t
                gmx::boolToString(bNormalize));
         printf("mode = %lu, dt = %g, nrestart = %d\n", mode, dt, nrestart);
     }
-    /* Allocate temp arrays */
-    snew(csum, nframes);
-    snew(ctmp, nframes);
 
-    /* Loop over items (e.g. molecules or dihedrals)
-     * In this loop the actual correlation functions are computed, but without
+    /* The actual correlation functions are computed here, but without
      * normalizing them.
      */
-    for (int i = 0; i < nitem; i++)
-    {
-        if (bVerbose && (((i % 100) == 0) || (i == nitem-1)))
-        {
-            fprintf(stderr, "\rThingie %d", i+1);
-            fflush(stderr);
-        }
-
-        if (bFour)
-        {
-            do_four_core(mode, nframes, c1[i], csum, ctmp);
-        }
-        else
-        {
-            do_ac_core(nframes, nout, ctmp, c1[i], nrestart, mode);
-        }
-    }
-    if (bVerbose)
-    {
-        fprintf(stderr, "\n");
-    }
-    sfree(ctmp);
-    sfree(csum);
+    compute_autocorr(nframes, nitem, nout, c1, mode, nrestart, bFour, bVerbose);
 
     if (fn)
     {
@@ -126,6 +126,29 @@ void do_autocorr(const char *fn, const gmx_output_env_t *oenv,
                  int nframes, int nitem, real **c1,
                  real dt, unsigned long mode, gmx_bool bAver);
 
+/*! \brief
+ * Computes autocorrelation functions without output, normalization or fitting.
+ *
+ * This does not use the settings stored by add_acf_pargs and can be
+ * called concurrently. The nitem items are processed in parallel
+ * using OpenMP. With bFour the FFT setup is shared by all items.
+ * Modes eacP3 and eacRcross are always computed without FFT.
+ *
+ * \param[in] nframes is the number of frames in the time series
+ * \param[in] nitem is the number of items
+ * \param[in] nout is the number of points to compute without FFT
+ * \param[inout] c1 is an array of dimension [ 0 .. nitem-1 ] [ 0 .. nframes-1 ]
+ *          (times 3 for vector modes), on output it is filled
+ *          with the correlation functions, averaged over time origins
+ * \param[in] mode is the type of ACF, see low_do_autocorr
+ * \param[in] nrestart is the number of steps between restarts without FFT
+ * \param[in] bFour If set, FFTs are used
+ * \param[in] bVerbose If set, the progress is printed
+ */
+void compute_autocorr(int nframes, int nitem, int nout, real **c1,
+                      unsigned long mode, int nrestart, gmx_bool bFour,
+                      gmx_bool bVerbose);
+
 /*! \brief
  * Low level computation of autocorrelation functions
  *
@@ -34,7 +34,7 @@
  */
 /*! \internal \file
  * \brief
- * Implements function to compute many autocorrelation functions
+ * Implements functions to compute many autocorrelation functions
  *
  * \author David van der Spoel <david.vanderspoel@icm.uu.se>
  * \ingroup module_correlationfunctions
@@ -74,57 +74,96 @@ int many_auto_correl(std::vector<std::vector<real> > *c)
         }
     }
 #endif
-    // Add buffer size to the arrays.
-    size_t nfft = (3*ndata/2) + 1;
-    // Pad arrays with zeros
+    int                       nthreads = std::min(gmx_omp_get_max_threads(), static_cast<int>(nfunc));
+    gmx::AutoCorrelationBatch acf(ndata, nthreads);
+    std::vector<real *>       ptr;
     for (auto &i : *c)
     {
-        i.resize(nfft, 0);
+        ptr.push_back(i.data());
     }
-    #pragma omp parallel
+    acf.computeMany(nfunc, ptr.data());
+
+    return 0;
+}
+
+namespace gmx
+{
+
+AutoCorrelationBatch::AutoCorrelationBatch(int ndata, int nthreads)
+    : ndata_(ndata)
+{
+    if (ndata < 1 || nthreads < 1)
     {
-        try
+        GMX_THROW(InconsistentInputError("Autocorrelation needs at least one point and one thread"));
+    }
+    // Add buffer size to the arrays.
+    nfft_ = (3*ndata_/2) + 1;
+    fft_.resize(nthreads, NULL);
+    in_.resize(nthreads);
+    out_.resize(nthreads);
+    for (int t = 0; t < nthreads; t++)
+    {
+        if (gmx_fft_init_1d(&fft_[t], nfft_, GMX_FFT_FLAG_CONSERVATIVE) != 0)
         {
-            gmx_fft_t         fft1;
-            std::vector<real> in, out;
+            GMX_THROW(InternalError("Could not set up the FFT for autocorrelation"));
+        }
+        in_[t].resize(2*nfft_);
+        out_[t].resize(2*nfft_);
+    }
+}
+
+AutoCorrelationBatch::~AutoCorrelationBatch()
+{
+    for (auto &fft : fft_)
+    {
+        gmx_fft_destroy(fft);
+    }
+}
 
-            int               nthreads  = gmx_omp_get_max_threads();
-            int               thread_id = gmx_omp_get_thread_num();
-            int               i0        = (thread_id*nfunc)/nthreads;
-            int               i1        = std::min(nfunc, ((thread_id+1)*nfunc)/nthreads);
+void AutoCorrelationBatch::compute(int thread, real c[])
+{
+    real *in  = in_[thread].data();
+    real *out = out_[thread].data();
 
-            gmx_fft_init_1d(&fft1, nfft, GMX_FFT_FLAG_CONSERVATIVE);
-            /* Allocate temporary arrays */
-            in.resize(2*nfft, 0);
-            out.resize(2*nfft, 0);
-            for (int i = i0; (i < i1); i++)
+    // The input is zero padded
+    for (int j = 0; j < ndata_; j++)
+    {
+        in[2*j+0] = c[j];
+        in[2*j+1] = 0;
+    }
+    for (int j = ndata_; j < nfft_; j++)
+    {
+        in[2*j+0] = 0;
+        in[2*j+1] = 0;
+    }
+    gmx_fft_1d(fft_[thread], GMX_FFT_BACKWARD, in, out);
+    for (int j = 0; j < nfft_; j++)
+    {
+        in[2*j+0] = (out[2*j+0]*out[2*j+0] + out[2*j+1]*out[2*j+1])/nfft_;
+        in[2*j+1] = 0;
+    }
+    gmx_fft_1d(fft_[thread], GMX_FFT_FORWARD, in, out);
+    for (int j = 0; j < ndata_; j++)
+    {
+        c[j] = out[2*j+0];
+    }
+}
+
+void AutoCorrelationBatch::computeMany(int nfunc, real *c[])
+{
+#pragma omp parallel num_threads(numThreads())
+    {
+        try
+        {
+            int thread = gmx_omp_get_thread_num();
+#pragma omp for schedule(dynamic, 4)
+            for (int i = 0; i < nfunc; i++)
             {
-                for (size_t j = 0; j < ndata; j++)
-                {
-                    in[2*j+0] = (*c)[i][j];
-                    in[2*j+1] = 0;
-                }
-                gmx_fft_1d(fft1, GMX_FFT_BACKWARD, (void *)in.data(), (void *)out.data());
-                for (size_t j = 0; j < nfft; j++)
-                {
-                    in[2*j+0] = (out[2*j+0]*out[2*j+0] + out[2*j+1]*out[2*j+1])/nfft;
-                    in[2*j+1] = 0;
-                }
-                gmx_fft_1d(fft1, GMX_FFT_FORWARD, (void *)in.data(), (void *)out.data());
-                for (size_t j = 0; (j < nfft); j++)
-                {
-                    (*c)[i][j] = out[2*j+0];
-                }
+                compute(thread, c[i]);
             }
-            /* Free the memory */
-            gmx_fft_destroy(fft1);
         }
         GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR;
     }
-    for (auto &i : *c)
-    {
-        i.resize(ndata);
-    }
-
-    return 0;
 }
+
+} // namespace gmx
@@ -35,7 +35,7 @@
 /*! \libinternal
  * \file
  * \brief
- * Declares routine for computing many correlation functions using OpenMP
+ * Declares routines for computing many correlation functions using OpenMP
  *
  * \author David van der Spoel <david.vanderspoel@icm.uu.se>
  * \inlibraryapi
@@ -47,6 +47,7 @@
 #include <vector>
 
 #include "gromacs/fft/fft.h"
+#include "gromacs/utility/classhelpers.h"
 #include "gromacs/utility/real.h"
 
 /*! \brief
@@ -70,4 +71,66 @@
  */
 int many_auto_correl(std::vector<std::vector<real> > *c);
 
+namespace gmx
+{
+
+/*! \libinternal \brief
+ * Computes many autocorrelation functions of equal length using FFTs.
+ *
+ * The FFT setup and work arrays for each thread are created once in the
+ * constructor and reused for all functions, so there is no setup cost
+ * per function. The object does not use any global state, different
+ * objects can be used concurrently.
+ *
+ * The result for series c is the sum over time origins
+ * C(t) = sum_tau c(tau) c(tau+t), without normalization.
+ * As with many_auto_correl(), the transform length is 3/2 of the
+ * number of points, so only the first half of C(t) is free of
+ * periodic artifacts.
+ *
+ * \inlibraryapi
+ * \ingroup module_correlationfunctions
+ */
+class AutoCorrelationBatch
+{
+    public:
+        /*! \brief
+         * Sets up FFTs for series of \p ndata points for \p nthreads threads.
+         *
+         * \throws InconsistentInputError if ndata or nthreads is < 1.
+         */
+        AutoCorrelationBatch(int ndata, int nthreads);
+        ~AutoCorrelationBatch();
+
+        //! Returns the number of points per series.
+        int numPoints() const { return ndata_; }
+        //! Returns the number of threads set up.
+        int numThreads() const { return static_cast<int>(fft_.size()); }
+
+        /*! \brief
+         * Replaces the ndata values in c by their autocorrelation.
+         *
+         * Uses the FFT setup of \p thread, this may be called
+         * concurrently for different values of \p thread.
+         */
+        void compute(int thread, real c[]);
+        /*! \brief
+         * Computes the autocorrelation of \p nfunc series c[i] in place.
+         *
+         * The series are distributed over the threads using OpenMP.
+         */
+        void computeMany(int nfunc, real *c[]);
+
+    private:
+        int                             ndata_;
+        int                             nfft_;
+        std::vector<gmx_fft_t>          fft_;
+        std::vector<std::vector<real> > in_;
+        std::vector<std::vector<real> > out_;
+
+        GMX_DISALLOW_COPY_AND_ASSIGN(AutoCorrelationBatch);
+};
+
+} // namespace gmx
+
 #endif
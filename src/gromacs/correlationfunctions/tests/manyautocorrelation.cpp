@@ -81,6 +81,40 @@ TEST_F (ManyAutocorrelationTest, DifferentLength)
 }
 #endif
 
+TEST_F (ManyAutocorrelationTest, BatchMatchesDirectSum)
+{
+    const int                       ndata = 20, nfunc = 7;
+    std::vector<std::vector<real> > c(nfunc), ref(nfunc);
+    std::vector<real *>             ptr;
+    for (int i = 0; i < nfunc; i++)
+    {
+        for (int j = 0; j < ndata; j++)
+        {
+            c[i].push_back(std::sin(0.3*(i + 1)*j) + 0.1*i);
+        }
+        ref[i].resize(ndata, 0);
+        for (int t = 0; t < ndata; t++)
+        {
+            for (int j = 0; j + t < ndata; j++)
+            {
+                ref[i][t] += c[i][j]*c[i][j+t];
+            }
+        }
+        ptr.push_back(c[i].data());
+    }
+
+    AutoCorrelationBatch acf(ndata, 2);
+    acf.computeMany(nfunc, ptr.data());
+    // Only the first half is free of periodic artifacts
+    for (int i = 0; i < nfunc; i++)
+    {
+        for (int t = 0; t < ndata/2; t++)
+        {
+            EXPECT_REAL_EQ_TOL(ref[i][t], c[i][t], test::absoluteTolerance(1e-4));
+        }
+    }
+}
+
 }
 
 }
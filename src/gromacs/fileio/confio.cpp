@@ -406,24 +406,38 @@ void readConfAndTopology(const char *infile,
     *haveTopology = fn2bTPX(infile);
     if (*haveTopology)
     {
-        t_tpxheader header;
-        read_tpxheader(infile, &header, TRUE);
+        /* Only read the sections we need from the file */
+        gmx::TprReader reader(infile);
+        const int      natoms = reader.header().natoms;
+        if (!reader.header().bTop)
+        {
+            gmx_fatal(FARGS, "No topology in %s", infile);
+        }
         if (x)
         {
-            snew(*x, header.natoms);
+            snew(*x, natoms);
+            if (reader.header().bX)
+            {
+                std::memcpy(*x, reader.x().data(), natoms*sizeof(rvec));
+            }
         }
         if (v)
         {
-            snew(*v, header.natoms);
+            snew(*v, natoms);
+            if (reader.header().bV)
+            {
+                std::memcpy(*v, reader.v().data(), natoms*sizeof(rvec));
+            }
+        }
+        if (box)
+        {
+            reader.getBox(box);
         }
-        int natoms;
-        int ePBC_tmp
-            = read_tpx(infile, NULL, box, &natoms,
-                       (x == NULL) ? NULL : *x, (v == NULL) ? NULL : *v, mtop);
         if (ePBC != NULL)
         {
-            *ePBC = ePBC_tmp;
+            *ePBC = reader.ePBC();
         }
+        reader.releaseMtop(mtop);
     }
     else
     {
@@ -42,6 +42,7 @@
 #include <cstring>
 
 #include <algorithm>
+#include <utility>
 
 #include "gromacs/fileio/gmxfio.h"
 #include "gromacs/fileio/gmxfio-xdr.h"
@@ -89,8 +90,13 @@ struct ener_file
 {
     ener_old_t eo;
     t_fileio  *fio;
+    gmx_bool   bDouble;       /* Whether the reals in the file are doubles */
     int        framenr;
     real       frametime;
+    gmx_bool  *bReadTerm;     /* Which energy terms to read, NULL reads all */
+    int        nterm_alloc;   /* Allocation size of bReadTerm */
+    int        nblock_id;     /* Number of block ids to read, -1 reads all */
+    int       *block_id;      /* The block ids to read */
 };
 
 static void enxsubblock_init(t_enxsubblock *sb)
@@ -755,6 +761,10 @@ void close_enx(ener_file_t ef)
     {
         gmx_file("Cannot close energy file; it might be corrupt, or maybe you are out of disk space?");
     }
+    sfree(ef->bReadTerm);
+    sfree(ef->block_id);
+    ef->bReadTerm = NULL;
+    ef->block_id  = NULL;
 }
 
 void done_ener_file(ener_file_t ef)
@@ -821,6 +831,7 @@ ener_file_t open_enx(const char *fn, const char *mode)
               (nre*4*(long int)sizeof(float) == fr->e_size)) ) )
         {
             fprintf(stderr, "Opened %s as single precision energy file\n", fn);
+            ef->bDouble = FALSE;
             free_enxnms(nre, nms);
         }
         else
@@ -839,6 +850,7 @@ ener_file_t open_enx(const char *fn, const char *mode)
             {
                 fprintf(stderr, "Opened %s as double precision energy file\n",
                         fn);
+                ef->bDouble = TRUE;
             }
             else
             {
@@ -865,6 +877,7 @@ ener_file_t open_enx(const char *fn, const char *mode)
 
     ef->framenr   = 0;
     ef->frametime = 0;
+    ef->nblock_id = -1;
     return ef;
 }
 
@@ -873,6 +886,118 @@ t_fileio *enx_file_pointer(const ener_file_t ef)
     return ef->fio;
 }
 
+void enx_set_read_selection(ener_file_t ef,
+                            int nterm, const int *terms,
+                            int nblock_id, const int *block_ids)
+{
+    int i;
+
+    if (nterm < 0)
+    {
+        sfree(ef->bReadTerm);
+        ef->bReadTerm   = NULL;
+        ef->nterm_alloc = 0;
+    }
+    else
+    {
+        int nalloc = 0;
+        for (i = 0; i < nterm; i++)
+        {
+            nalloc = std::max(nalloc, terms[i] + 1);
+        }
+        if (nalloc > ef->nterm_alloc || ef->bReadTerm == NULL)
+        {
+            ef->nterm_alloc = std::max(nalloc, 1);
+            srenew(ef->bReadTerm, ef->nterm_alloc);
+        }
+        for (i = 0; i < ef->nterm_alloc; i++)
+        {
+            ef->bReadTerm[i] = FALSE;
+        }
+        for (i = 0; i < nterm; i++)
+        {
+            ef->bReadTerm[terms[i]] = TRUE;
+        }
+    }
+
+    ef->nblock_id = nblock_id;
+    if (nblock_id > 0)
+    {
+        srenew(ef->block_id, nblock_id);
+        for (i = 0; i < nblock_id; i++)
+        {
+            ef->block_id[i] = block_ids[i];
+        }
+    }
+}
+
+/* Returns whether energy term i should be read from ef */
+static gmx_bool enx_read_term(const ener_file_t ef, int i)
+{
+    if (ef->bReadTerm == NULL || ef->eo.bOldFileOpen)
+    {
+        /* Converting old full sums needs all terms */
+        return TRUE;
+    }
+    return (i < ef->nterm_alloc && ef->bReadTerm[i]);
+}
+
+/* Returns whether blocks with the given id should be read from ef */
+static gmx_bool enx_read_block(const ener_file_t ef, int id)
+{
+    int i;
+
+    if (ef->nblock_id < 0)
+    {
+        return TRUE;
+    }
+    for (i = 0; i < ef->nblock_id; i++)
+    {
+        if (ef->block_id[i] == id)
+        {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/* Returns the number of bytes that sub occupies in the file,
+ * or -1 when that depends on the contents (strings). */
+static gmx_off_t enxsubblock_file_size(const t_enxsubblock *sub)
+{
+    switch (sub->type)
+    {
+        case xdr_datatype_float:
+        case xdr_datatype_int:
+        /* Each char is stored in a full XDR unit */
+        case xdr_datatype_char:
+            return 4*static_cast<gmx_off_t>(sub->nr);
+        case xdr_datatype_double:
+        case xdr_datatype_int64:
+            return 8*static_cast<gmx_off_t>(sub->nr);
+        default:
+            return -1;
+    }
+}
+
+/* Skips nbytes of data in ef. The last XDR unit of the skipped range is
+ * read to detect truncated frames, as seeking past the end of file does
+ * not fail. */
+static gmx_bool enx_skip(ener_file_t ef, gmx_off_t nbytes)
+{
+    int dum;
+
+    if (nbytes == 0)
+    {
+        return TRUE;
+    }
+    if (gmx_fio_seek(ef->fio, gmx_fio_ftell(ef->fio) + nbytes - 4) != 0)
+    {
+        return FALSE;
+    }
+    return gmx_fio_do_int(ef->fio, dum);
+}
+
 static void convert_full_sums(ener_old_t *ener_old, t_enxframe *fr)
 {
     int    nstep_all;
@@ -949,6 +1074,8 @@ gmx_bool do_enx(ener_file_t ef, t_enxframe *fr)
     int           i, b;
     gmx_bool      bRead, bOK, bOK1, bSane;
     real          tmp1, tmp2, rdum;
+    gmx_off_t     nskip;
+    int           nblock_read;
     /*int       d_size;*/
 
     bOK   = TRUE;
@@ -1017,9 +1144,23 @@ gmx_bool do_enx(ener_file_t ef, t_enxframe *fr)
         fr->e_alloc = fr->nre;
     }
 
+    /* Bytes of unselected data to skip before the next read */
+    nskip = 0;
     for (i = 0; i < fr->nre; i++)
     {
-        bOK = bOK && gmx_fio_do_real(ef->fio, fr->ener[i].e);
+        if (bRead && !enx_read_term(ef, i))
+        {
+            int nreal = 1;
+            if (file_version == 1 || fr->nsum > 0)
+            {
+                nreal += (file_version == 1) ? 3 : 2;
+            }
+            nskip += nreal*(ef->bDouble ? 8 : 4);
+            continue;
+        }
+        bOK   = bOK && enx_skip(ef, nskip);
+        nskip = 0;
+        bOK   = bOK && gmx_fio_do_real(ef->fio, fr->ener[i].e);
 
         /* Do not store sums of length 1,
          * since this does not add information.
@@ -1060,16 +1201,27 @@ gmx_bool do_enx(ener_file_t ef, t_enxframe *fr)
         convert_full_sums(&(ef->eo), fr);
     }
     /* read the blocks */
+    nblock_read = 0;
     for (b = 0; b < fr->nblock; b++)
     {
         /* now read the subblocks. */
-        int nsub = fr->block[b].nsub; /* shortcut */
-        int i;
+        int      nsub = fr->block[b].nsub; /* shortcut */
+        int      i;
+        gmx_bool bReadBlock;
 
+        bReadBlock = (!bRead || enx_read_block(ef, fr->block[b].id));
         for (i = 0; i < nsub; i++)
         {
             t_enxsubblock *sub = &(fr->block[b].sub[i]); /* shortcut */
 
+            if (!bReadBlock && enxsubblock_file_size(sub) >= 0)
+            {
+                nskip += enxsubblock_file_size(sub);
+                continue;
+            }
+            bOK   = bOK && enx_skip(ef, nskip);
+            nskip = 0;
+
             if (bRead)
             {
                 enxsubblock_alloc(sub);
@@ -1101,7 +1253,19 @@ gmx_bool do_enx(ener_file_t ef, t_enxframe *fr)
             }
             bOK = bOK && bOK1;
         }
+        if (bReadBlock)
+        {
+            /* Move the block to the front, keeping the allocated
+             * memory of skipped blocks for later frames */
+            if (b != nblock_read)
+            {
+                std::swap(fr->block[b], fr->block[nblock_read]);
+            }
+            nblock_read++;
+        }
     }
+    bOK         = bOK && enx_skip(ef, nskip);
+    fr->nblock  = nblock_read;
 
     if (!bRead)
     {
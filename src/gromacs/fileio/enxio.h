@@ -187,6 +187,20 @@ void free_enxnms(int n, gmx_enxnm_t *nms);
 gmx_bool do_enx(ener_file_t ef, t_enxframe *fr);
 /* Reads enx_frames, memory in fr is (re)allocated if necessary */
 
+void enx_set_read_selection(ener_file_t ef,
+                            int nterm, const int *terms,
+                            int nblock_id, const int *block_ids);
+/* Restricts which data subsequent calls to do_enx read from ef.
+ * Only the nterm energy terms with indices in terms are read, the other
+ * entries in fr->ener are left untouched. Only blocks with one of the
+ * nblock_id ids in block_ids are returned in fr->block, so fr->nblock
+ * only counts those. The unselected data is skipped in the file
+ * without being decoded, which makes reading a few terms or only the
+ * free-energy blocks from large files much faster.
+ * nterm < 0 or nblock_id < 0 selects all terms or all blocks, which is
+ * the default. Pass nterm = nblock_id = 0 to only read frame headers.
+ */
+
 void get_enx_state(const char *fn, real t,
                    const gmx_groups_t *groups, t_inputrec *ir,
                    t_state *state);
@@ -665,10 +665,26 @@ gmx_bool gmx_fio_ndoe_string(t_fileio *fio, char *item[], int n,
     gmx_bool ret = TRUE;
     int      i;
     gmx_fio_lock(fio);
-    for (i = 0; i < n; i++)
+    for (i = 0; i < n && ret; i++)
     {
-        ret = ret && do_xdr(fio, &(item[i]), 1, eioSTRING, desc,
-                            srcfile, line);
+        if (fio->bRead)
+        {
+            /* Read into newly allocated strings, do_xdr can only read
+             * into existing buffers. The layout is the same as in do_xdr.
+             */
+            int slen = 0;
+            if (xdr_int(fio->xdr, &slen) <= 0 || slen < 1)
+            {
+                ret = FALSE;
+                break;
+            }
+            srenew(item[i], slen);
+            ret = (xdr_string(fio->xdr, &(item[i]), slen) != 0);
+        }
+        else
+        {
+            ret = do_xdr(fio, item[i], 1, eioSTRING, desc, srcfile, line);
+        }
     }
     gmx_fio_unlock(fio);
     return ret;
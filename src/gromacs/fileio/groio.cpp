@@ -38,11 +38,14 @@
 
 #include "groio.h"
 
+#include <cctype>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
 
 #include <algorithm>
 #include <string>
+#include <vector>
 
 #include "gromacs/fileio/gmxfio.h"
 #include "gromacs/topology/atoms.h"
@@ -52,9 +55,12 @@
 #include "gromacs/trajectory/trajectoryframe.h"
 #include "gromacs/utility/coolstuff.h"
 #include "gromacs/utility/cstringutil.h"
+#include "gromacs/utility/exceptions.h"
 #include "gromacs/utility/fatalerror.h"
 #include "gromacs/utility/futil.h"
+#include "gromacs/utility/gmxomp.h"
 #include "gromacs/utility/smalloc.h"
+#include "gromacs/utility/snprintf.h"
 
 static void get_coordnum_fp(FILE *in, char *title, int *natoms)
 {
@@ -78,29 +84,70 @@ void get_coordnum(const char *infile, int *natoms)
     gmx_fio_fclose(in);
 }
 
+/* Number of atom lines that are read and parsed together */
+static const int c_groBatchSize = 65536;
+
+/* Parses a coordinate or velocity field of at most ddist characters
+ * starting at *ptr and advances *ptr past the field. Returns the number of
+ * values found in the field, as sscanf would with format "%lf %lf".
+ */
+static int get_gro_field(const char **ptr, int ddist, double *value)
+{
+    char        buf[256];
+    const char *field = *ptr;
+    int         c     = 0;
+
+    while (c < ddist && field[c] != '\0')
+    {
+        c++;
+    }
+    *ptr = field + c;
+
+    if (gmx_parse_fixed_decimal(field, c, value))
+    {
+        return 1;
+    }
+
+    /* Fall back to the general parser for unusual number formatting */
+    c = std::min(c, static_cast<int>(sizeof(buf)) - 1);
+    std::memcpy(buf, field, c);
+    buf[c] = '\0';
+    double dummy;
+
+    return sscanf(buf, "%lf %lf", value, &dummy);
+}
+
 /* Note that the .gro reading routine still support variable precision
  * for backward compatibility with old .gro files.
  * We have removed writing of variable precision to avoid compatibility
  * issues with other software packages.
+ *
+ * The atom lines are read in batches. The numerical fields of a batch
+ * are parsed in parallel, after which the names are stored in the symbol
+ * table in order.
  */
 static gmx_bool get_w_conf(FILE *in, const char *infile, char *title,
                            t_symtab *symtab, t_atoms *atoms, int *ndec,
                            rvec x[], rvec *v, matrix box)
 {
-    char       name[6];
-    char       resname[6], oldresname[6];
-    char       line[STRLEN+1], *ptr;
-    char       buf[256];
-    double     x1, y1, z1, x2, y2, z2;
-    rvec       xmin, xmax;
-    int        natoms, i, m, resnr, newres, oldres, ddist, c;
-    gmx_bool   bFirst, bVel, oldResFirst;
-    char      *p1, *p2, *p3;
+    char              name[6];
+    char              resname[6], oldresname[6];
+    char              line[STRLEN+1];
+    double            x1, y1, z1, x2, y2, z2;
+    rvec              xmin, xmax;
+    int               natoms, i, m, resnr, newres, oldres, ddist;
+    gmx_bool          bFirst, bVel, oldResFirst;
+    char             *p1, *p2, *p3;
+    std::string       batchLines;
+    std::vector<int>  lineStart;
+    std::vector<int>  batchResnr;
+    std::vector<char> batchHaveResnr;
 
     oldres      = -1;
     newres      = -1;
     oldResFirst = FALSE;
     ddist       = 0;
+    resnr       = 0;
 
     /* Read the title and number of atoms */
     get_coordnum_fp(in, title, &natoms);
@@ -129,125 +176,174 @@ static gmx_bool get_w_conf(FILE *in, const char *infile, char *title,
     resname[0]     = '\0';
     oldresname[0]  = '\0';
 
+    const int nthreads = gmx_omp_get_max_threads();
+
     /* just pray the arrays are big enough */
-    for (i = 0; (i < natoms); i++)
+    for (int batchStart = 0; batchStart < natoms; batchStart += c_groBatchSize)
     {
-        if ((fgets2(line, STRLEN, in)) == NULL)
-        {
-            gmx_fatal(FARGS, "Unexpected end of file in file %s at line %d",
-                      infile, i+2);
-        }
-        if (strlen(line) < 39)
-        {
-            gmx_fatal(FARGS, "Invalid line in %s for atom %d:\n%s", infile, i+1, line);
-        }
+        const int batchEnd = std::min(natoms, batchStart + c_groBatchSize);
 
-        /* determine read precision from distance between periods
-           (decimal points) */
-        if (bFirst)
+        batchLines.clear();
+        lineStart.clear();
+        for (i = batchStart; (i < batchEnd); i++)
         {
-            bFirst = FALSE;
-            p1     = strchr(line, '.');
-            if (p1 == NULL)
+            if ((fgets2(line, STRLEN, in)) == NULL)
             {
-                gmx_fatal(FARGS, "A coordinate in file %s does not contain a '.'", infile);
+                gmx_fatal(FARGS, "Unexpected end of file in file %s at line %d",
+                          infile, i+2);
             }
-            p2 = strchr(&p1[1], '.');
-            if (p2 == NULL)
+            size_t length = strlen(line);
+            if (length < 39)
             {
-                gmx_fatal(FARGS, "A coordinate in file %s does not contain a '.'", infile);
+                gmx_fatal(FARGS, "Invalid line in %s for atom %d:\n%s", infile, i+1, line);
             }
-            ddist = p2 - p1;
-            *ndec = ddist - 5;
 
-            p3 = strchr(&p2[1], '.');
-            if (p3 == NULL)
+            /* determine read precision from distance between periods
+               (decimal points) */
+            if (bFirst)
             {
-                gmx_fatal(FARGS, "A coordinate in file %s does not contain a '.'", infile);
-            }
+                bFirst = FALSE;
+                p1     = strchr(line, '.');
+                if (p1 == NULL)
+                {
+                    gmx_fatal(FARGS, "A coordinate in file %s does not contain a '.'", infile);
+                }
+                p2 = strchr(&p1[1], '.');
+                if (p2 == NULL)
+                {
+                    gmx_fatal(FARGS, "A coordinate in file %s does not contain a '.'", infile);
+                }
+                ddist = p2 - p1;
+                *ndec = ddist - 5;
 
-            if (p3 - p2 != ddist)
-            {
-                gmx_fatal(FARGS, "The spacing of the decimal points in file %s is not consistent for x, y and z", infile);
+                p3 = strchr(&p2[1], '.');
+                if (p3 == NULL)
+                {
+                    gmx_fatal(FARGS, "A coordinate in file %s does not contain a '.'", infile);
+                }
+
+                if (p3 - p2 != ddist)
+                {
+                    gmx_fatal(FARGS, "The spacing of the decimal points in file %s is not consistent for x, y and z", infile);
+                }
             }
-        }
 
-        /* residue number*/
-        memcpy(name, line, 5);
-        name[5] = '\0';
-        sscanf(name, "%d", &resnr);
-        sscanf(line+5, "%5s", resname);
+            lineStart.push_back(batchLines.size());
+            batchLines.append(line, length + 1);
+        }
 
-        if (!oldResFirst || oldres != resnr || strncmp(resname, oldresname, sizeof(resname)))
+        /* Parse the residue numbers, coordinates and velocities */
+        const int batchSize = batchEnd - batchStart;
+        int       nbad      = 0;
+        int       nvel      = 0;
+        batchResnr.resize(batchSize);
+        batchHaveResnr.resize(batchSize);
+#pragma omp parallel for num_threads(nthreads) schedule(static) reduction(+:nbad, nvel)
+        for (int j = 0; j < batchSize; j++)
         {
-            oldres      = resnr;
-            oldResFirst = TRUE;
-            newres++;
-            if (newres >= natoms)
+            const int   a        = batchStart + j;
+            const char *atomLine = batchLines.c_str() + lineStart[j];
+            char        resnrField[6];
+            char       *resnrEnd;
+            double      value;
+
+            /* residue number*/
+            std::memcpy(resnrField, atomLine, 5);
+            resnrField[5]     = '\0';
+            batchResnr[j]     = std::strtol(resnrField, &resnrEnd, 10);
+            batchHaveResnr[j] = (resnrEnd != resnrField);
+
+            /* coordinates (start after residue data) */
+            const char *ptr = atomLine + 20;
+            /* Read fixed format */
+            for (int d = 0; d < DIM; d++)
+            {
+                if (get_gro_field(&ptr, ddist, &value) != 1)
+                {
+                    nbad++;
+                    break;
+                }
+                x[a][d] = value;
+            }
+
+            /* velocities (start after residues and coordinates) */
+            if (v)
             {
-                gmx_fatal(FARGS, "More residues than atoms in %s (natoms = %d)",
-                          infile, natoms);
+                /* Read fixed format */
+                for (int d = 0; d < DIM; d++)
+                {
+                    if (get_gro_field(&ptr, ddist, &value) < 1)
+                    {
+                        v[a][d] = 0;
+                    }
+                    else
+                    {
+                        v[a][d] = value;
+                        nvel++;
+                    }
+                }
             }
-            atoms->atom[i].resind = newres;
-            t_atoms_set_resinfo(atoms, i, symtab, resname, resnr, ' ', 0, ' ');
         }
-        else
+        if (nbad > 0)
         {
-            atoms->atom[i].resind = newres;
+            gmx_fatal(FARGS, "Something is wrong in the coordinate formatting of file %s. Note that gro is fixed format (see the manual)", infile);
+        }
+        if (nvel > 0)
+        {
+            bVel = TRUE;
         }
 
-        /* atomname */
-        std::memcpy(name, line+10, 5);
-        atoms->atomname[i] = put_symtab(symtab, name);
-
-        /* Copy resname to oldresname after we are done with the sanity check above */
-        std::strncpy(oldresname, resname, sizeof(oldresname));
-
-        /* eventueel controle atomnumber met i+1 */
-
-        /* coordinates (start after residue data) */
-        ptr = line + 20;
-        /* Read fixed format */
-        for (m = 0; m < DIM; m++)
+        /* Store the residue and atom names in order */
+        for (i = batchStart; (i < batchEnd); i++)
         {
-            for (c = 0; (c < ddist && ptr[0]); c++)
+            const char *atomLine = batchLines.c_str() + lineStart[i - batchStart];
+
+            if (batchHaveResnr[i - batchStart])
             {
-                buf[c] = ptr[0];
-                ptr++;
+                resnr = batchResnr[i - batchStart];
             }
-            buf[c] = '\0';
-            if (sscanf(buf, "%lf %lf", &x1, &x2) != 1)
+            /* residue name, the same as sscanf(atomLine+5, "%5s", resname) */
+            const char *ptr = atomLine + 5;
+            while (*ptr != '\0' && std::isspace(static_cast<unsigned char>(*ptr)))
             {
-                gmx_fatal(FARGS, "Something is wrong in the coordinate formatting of file %s. Note that gro is fixed format (see the manual)", infile);
+                ptr++;
             }
-            else
+            if (*ptr != '\0')
             {
-                x[i][m] = x1;
+                int c = 0;
+                while (c < 5 && ptr[c] != '\0' && !std::isspace(static_cast<unsigned char>(ptr[c])))
+                {
+                    resname[c] = ptr[c];
+                    c++;
+                }
+                resname[c] = '\0';
             }
-        }
 
-        /* velocities (start after residues and coordinates) */
-        if (v)
-        {
-            /* Read fixed format */
-            for (m = 0; m < DIM; m++)
+            if (!oldResFirst || oldres != resnr || strncmp(resname, oldresname, sizeof(resname)))
             {
-                for (c = 0; (c < ddist && ptr[0]); c++)
-                {
-                    buf[c] = ptr[0];
-                    ptr++;
-                }
-                buf[c] = '\0';
-                if (sscanf(buf, "%lf", &x1) != 1)
-                {
-                    v[i][m] = 0;
-                }
-                else
+                oldres      = resnr;
+                oldResFirst = TRUE;
+                newres++;
+                if (newres >= natoms)
                 {
-                    v[i][m] = x1;
-                    bVel    = TRUE;
+                    gmx_fatal(FARGS, "More residues than atoms in %s (natoms = %d)",
+                              infile, natoms);
                 }
+                atoms->atom[i].resind = newres;
+                t_atoms_set_resinfo(atoms, i, symtab, resname, resnr, ' ', 0, ' ');
             }
+            else
+            {
+                atoms->atom[i].resind = newres;
+            }
+
+            /* atomname */
+            std::memcpy(name, atomLine+10, 5);
+            name[5]            = '\0';
+            atoms->atomname[i] = put_symtab(symtab, name);
+
+            /* Copy resname to oldresname after we are done with the sanity check above */
+            std::strncpy(oldresname, resname, sizeof(oldresname));
         }
     }
     atoms->nres = newres + 1;
@@ -445,55 +541,96 @@ static void write_hconf_box(FILE *out, const matrix box)
     }
 }
 
+/* Appends an atom line to buffer, format is the coordinate format */
+static void append_hconf_atomline(std::string *buffer, const char *format,
+                                  int resnr, const char *resnm, const char *nm,
+                                  int ai, const rvec x, const rvec *v)
+{
+    /* Large enough for any finite value in %8.3f */
+    char lineBuf[STRLEN];
+    int  n;
+
+    n = snprintf(lineBuf, sizeof(lineBuf), "%5d%-5.5s%5.5s%5d",
+                 resnr%100000, resnm, nm, (ai+1)%100000);
+    if (v)
+    {
+        n += snprintf(lineBuf + n, sizeof(lineBuf) - n, format,
+                      x[XX], x[YY], x[ZZ], (*v)[XX], (*v)[YY], (*v)[ZZ]);
+    }
+    else
+    {
+        n += snprintf(lineBuf + n, sizeof(lineBuf) - n, format,
+                      x[XX], x[YY], x[ZZ]);
+    }
+    buffer->append(lineBuf, n);
+}
+
 void write_hconf_indexed_p(FILE *out, const char *title, const t_atoms *atoms,
                            int nx, const int index[],
                            const rvec *x, const rvec *v, const matrix box)
 {
-    char resnm[6], nm[6];
-    int  ai, i, resind, resnr;
-
     fprintf(out, "%s\n", (title && title[0]) ? title : gmx::bromacs().c_str());
     fprintf(out, "%5d\n", nx);
 
     const char *format = get_hconf_format(v != NULL);
 
-    for (i = 0; (i < nx); i++)
+    /* The atom lines are formatted in parallel in batches, each thread
+     * formats a contiguous range into its own buffer, and the buffers
+     * are written in order.
+     */
+    const int                nthreads = gmx_omp_get_max_threads();
+    std::vector<std::string> threadBuffer(nthreads);
+    for (int batchStart = 0; batchStart < nx; batchStart += c_groBatchSize)
     {
-        ai = index[i];
-
-        resind = atoms->atom[ai].resind;
-        std::strncpy(resnm, " ??? ", sizeof(resnm)-1);
-        if (resind < atoms->nres)
-        {
-            std::strncpy(resnm, *atoms->resinfo[resind].name, sizeof(resnm)-1);
-            resnr = atoms->resinfo[resind].nr;
-        }
-        else
-        {
-            std::strncpy(resnm, " ??? ", sizeof(resnm)-1);
-            resnr = resind + 1;
-        }
-
-        if (atoms->atom)
+        const int batchSize = std::min(nx - batchStart, c_groBatchSize);
+#pragma omp parallel for num_threads(nthreads) schedule(static)
+        for (int th = 0; th < nthreads; th++)
         {
-            std::strncpy(nm, *atoms->atomname[ai], sizeof(nm)-1);
-        }
-        else
-        {
-            std::strncpy(nm, " ??? ", sizeof(nm)-1);
-        }
+            try
+            {
+                const int start = batchStart + (batchSize*th)/nthreads;
+                const int end   = batchStart + (batchSize*(th + 1))/nthreads;
 
-        fprintf(out, "%5d%-5.5s%5.5s%5d", resnr%100000, resnm, nm, (ai+1)%100000);
-        /* next fprintf uses built format string */
-        if (v)
-        {
-            fprintf(out, format,
-                    x[ai][XX], x[ai][YY], x[ai][ZZ], v[ai][XX], v[ai][YY], v[ai][ZZ]);
+                threadBuffer[th].clear();
+                for (int i = start; i < end; i++)
+                {
+                    char resnm[6], nm[6];
+                    int  ai, resind, resnr;
+
+                    ai = index[i];
+
+                    resind = atoms->atom[ai].resind;
+                    std::strncpy(resnm, " ??? ", sizeof(resnm)-1);
+                    if (resind < atoms->nres)
+                    {
+                        std::strncpy(resnm, *atoms->resinfo[resind].name, sizeof(resnm)-1);
+                        resnr = atoms->resinfo[resind].nr;
+                    }
+                    else
+                    {
+                        std::strncpy(resnm, " ??? ", sizeof(resnm)-1);
+                        resnr = resind + 1;
+                    }
+
+                    if (atoms->atom)
+                    {
+                        std::strncpy(nm, *atoms->atomname[ai], sizeof(nm)-1);
+                    }
+                    else
+                    {
+                        std::strncpy(nm, " ??? ", sizeof(nm)-1);
+                    }
+
+                    append_hconf_atomline(&threadBuffer[th], format,
+                                          resnr, resnm, nm, ai,
+                                          x[ai], v ? &v[ai] : NULL);
+                }
+            }
+            GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR;
         }
-        else
+        for (const std::string &buffer : threadBuffer)
         {
-            fprintf(out, format,
-                    x[ai][XX], x[ai][YY], x[ai][ZZ]);
+            fwrite(buffer.data(), sizeof(char), buffer.size(), out);
         }
     }
 
@@ -509,6 +646,7 @@ void write_hconf_mtop(FILE *out, const char *title, gmx_mtop_t *mtop,
     gmx_mtop_atomloop_all_t aloop;
     const t_atom           *atom;
     char                   *atomname, *resname;
+    std::string             buffer;
 
     fprintf(out, "%s\n", (title && title[0]) ? title : gmx::bromacs().c_str());
     fprintf(out, "%5d\n", mtop->natoms);
@@ -520,20 +658,15 @@ void write_hconf_mtop(FILE *out, const char *title, gmx_mtop_t *mtop,
     {
         gmx_mtop_atomloop_all_names(aloop, &atomname, &resnr, &resname);
 
-        fprintf(out, "%5d%-5.5s%5.5s%5d",
-                resnr%100000, resname, atomname, (i+1)%100000);
-        /* next fprintf uses built format string */
-        if (v)
-        {
-            fprintf(out, format,
-                    x[i][XX], x[i][YY], x[i][ZZ], v[i][XX], v[i][YY], v[i][ZZ]);
-        }
-        else
+        append_hconf_atomline(&buffer, format, resnr, resname, atomname, i,
+                              x[i], v ? &v[i] : NULL);
+        if ((i + 1) % c_groBatchSize == 0)
         {
-            fprintf(out, format,
-                    x[i][XX], x[i][YY], x[i][ZZ]);
+            fwrite(buffer.data(), sizeof(char), buffer.size(), out);
+            buffer.clear();
         }
     }
+    fwrite(buffer.data(), sizeof(char), buffer.size(), out);
 
     write_hconf_box(out, box);
 
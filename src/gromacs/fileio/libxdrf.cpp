@@ -1020,6 +1020,8 @@ int xdr3dfcoord(XDR *xdrs, float *fp, int *size, float *precision)
    The second 4 bytes are the number of atoms in the frame, and is
    assumed to be constant. The third 4 bytes are the frame number.
    The last 4 bytes are a floating point representation of the time.
+   Frames with coordinates stored in independently compressed atom
+   blocks use the magic number 2017, but the same header layout.
 
  ********************************************************************/
 
@@ -1027,6 +1029,9 @@ int xdr3dfcoord(XDR *xdrs, float *fp, int *size, float *precision)
 #ifndef XTC_MAGIC
 #define XTC_MAGIC 1995
 #endif
+#ifndef XTC_BLOCKED_MAGIC
+#define XTC_BLOCKED_MAGIC 2017
+#endif
 
 static const int header_size = 16;
 
@@ -1055,7 +1060,7 @@ static int xtc_at_header_start(FILE *fp, XDR *xdrs,
         }
     }
     /* quick return */
-    if (i_inp[0] != XTC_MAGIC)
+    if (i_inp[0] != XTC_MAGIC && i_inp[0] != XTC_BLOCKED_MAGIC)
     {
         if (gmx_fseek(fp, off+XDR_INT_SIZE, SEEK_SET))
         {
@@ -574,6 +574,19 @@ void get_pdb_atomnumber(const t_atoms *atoms, gmx_atomprop_t aps)
     }
 }
 
+/* Converts a fixed-width numerical field, equivalent to strtod(field, NULL) */
+static double pdb_field_to_double(const char *field, int width)
+{
+    double value;
+
+    if (!gmx_parse_fixed_decimal(field, width, &value))
+    {
+        value = std::strtod(field, NULL);
+    }
+
+    return value;
+}
+
 static int read_atom(t_symtab *symtab,
                      char line[], int type, int natom,
                      t_atoms *atoms, rvec x[], int chainnum, gmx_bool bChange)
@@ -708,17 +721,17 @@ static int read_atom(t_symtab *symtab,
         atomn->atomnumber      = atomnumber;
         strncpy(atomn->elem, elem, 4);
     }
-    x[natom][XX] = strtod(xc, NULL)*0.1;
-    x[natom][YY] = strtod(yc, NULL)*0.1;
-    x[natom][ZZ] = strtod(zc, NULL)*0.1;
+    x[natom][XX] = pdb_field_to_double(xc, 8)*0.1;
+    x[natom][YY] = pdb_field_to_double(yc, 8)*0.1;
+    x[natom][ZZ] = pdb_field_to_double(zc, 8)*0.1;
     if (atoms->pdbinfo)
     {
         atoms->pdbinfo[natom].type   = type;
         atoms->pdbinfo[natom].atomnr = strtol(anr, NULL, 10);
         atoms->pdbinfo[natom].altloc = altloc;
         strcpy(atoms->pdbinfo[natom].atomnm, anm_copy);
-        atoms->pdbinfo[natom].bfac  = strtod(bfac, NULL);
-        atoms->pdbinfo[natom].occup = strtod(occup, NULL);
+        atoms->pdbinfo[natom].bfac  = pdb_field_to_double(bfac, 7);
+        atoms->pdbinfo[natom].occup = pdb_field_to_double(occup, 6);
     }
     natom++;
 
@@ -208,4 +208,72 @@ INSTANTIATE_TEST_CASE_P(WithDifferentFormats,
                         StructureIORoundtripTest,
                             ::testing::Values(efGRO, efG96, efPDB, efESP));
 
+/*! \brief
+ * Tests reading and writing of gro files with more atoms than are
+ * processed in one batch, with velocities.
+ */
+class GroLargeRoundtripTest : public gmx::test::StringTestBase
+{
+    public:
+        GroLargeRoundtripTest()
+        {
+            referenceFilename_ = fileManager_.getTemporaryFilePath("ref.gro");
+            testFilename_      = fileManager_.getTemporaryFilePath("test.gro");
+        }
+
+        void writeReferenceFile(int atomCount)
+        {
+            t_symtab symtab;
+            t_atoms  atoms;
+            open_symtab(&symtab);
+            init_t_atoms(&atoms, atomCount, FALSE);
+            std::vector<gmx::RVec> x, v;
+            for (int i = 0; i < atomCount; ++i)
+            {
+                const char *atomNames[] = { "OW", "HW1", "HW2" };
+                atoms.atomname[i]    = put_symtab(&symtab, atomNames[i%3]);
+                atoms.atom[i].resind = i/3;
+                if (i%3 == 0)
+                {
+                    t_atoms_set_resinfo(&atoms, i, &symtab, "SOL", i/3 + 1, ' ', 0, ' ');
+                }
+                x.emplace_back(0.001*(i%1000), 0.01*(i/1000) - 5, -0.123*(i%7));
+                v.emplace_back(0.0001*(i%113) - 0.5, 0.5, -0.0007*(i%17));
+            }
+            atoms.nres = (atomCount + 2)/3;
+            matrix box = {{10, 0, 0}, {0, 11, 0}, {1, 2, 12}};
+            write_sto_conf(referenceFilename_.c_str(), "Large gro test", &atoms,
+                           as_rvec_array(x.data()), as_rvec_array(v.data()),
+                           -1, box);
+            done_atom(&atoms);
+            done_symtab(&symtab);
+        }
+
+        void readAndWriteTestFile()
+        {
+            t_topology top;
+            rvec      *x, *v = NULL;
+            matrix     box;
+            int        ePBC;
+            read_tps_conf(referenceFilename_.c_str(), &top, &ePBC, &x, &v, box, FALSE);
+            ASSERT_TRUE(v != NULL);
+            write_sto_conf(testFilename_.c_str(), *top.name, &top.atoms, x, v, -1, box);
+            sfree(x);
+            sfree(v);
+            done_top(&top);
+            testFilesEqual(referenceFilename_, testFilename_);
+        }
+
+    private:
+        gmx::test::TestFileManager      fileManager_;
+        std::string                     referenceFilename_;
+        std::string                     testFilename_;
+};
+
+TEST_F(GroLargeRoundtripTest, ReadWriteWithVelocities)
+{
+    writeReferenceFile(200003);
+    readAndWriteTestFile();
+}
+
 } // namespace
@@ -0,0 +1,277 @@
+/*
+ * This file is part of the GROMACS molecular simulation package.
+ *
+ * Copyright (c) 2017, by the GROMACS development team, led by
+ * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
+ * and including many others, as listed in the AUTHORS file in the
+ * top-level source directory and at http://www.gromacs.org.
+ *
+ * GROMACS is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ *
+ * GROMACS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GROMACS; if not, see
+ * http://www.gnu.org/licenses, or write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA.
+ *
+ * If you want to redistribute modifications to GROMACS, please
+ * consider that scientific software is very special. Version
+ * control is crucial - bugs must be traceable. We will be happy to
+ * consider code for inclusion in the official distribution, but
+ * derived work must not be called official GROMACS. Details are found
+ * in the README & COPYING files - if they are missing, get the
+ * official version at http://www.gromacs.org.
+ *
+ * To help us fund GROMACS development, we humbly ask that you cite
+ * the research papers on the package. Check out http://www.gromacs.org.
+ */
+/*! \internal \file
+ * \brief
+ * Tests for energy file I/O, in particular reading selected data.
+ *
+ * \ingroup module_fileio
+ */
+#include "gmxpre.h"
+
+#include "gromacs/fileio/enxio.h"
+
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "gromacs/utility/cstringutil.h"
+#include "gromacs/utility/smalloc.h"
+
+#include "testutils/testasserts.h"
+#include "testutils/testfilemanager.h"
+
+namespace
+{
+
+//! Number of energy terms in the test file.
+const int c_numTerms = 4;
+//! Number of frames in the test file.
+const int c_numFrames = 3;
+
+//! Returns the test value for energy term \p i in \p frame.
+real termValue(int frame, int i)
+{
+    return 10*frame + i + 0.5;
+}
+
+class EnxTest : public ::testing::Test
+{
+    public:
+        EnxTest() : filename_(fileManager_.getTemporaryFilePath(".edr"))
+        {
+            writeFile();
+        }
+
+        //! Writes frames with energies, sums and three blocks.
+        void writeFile()
+        {
+            gmx_enxnm_t *nms;
+            snew(nms, c_numTerms);
+            for (int i = 0; i < c_numTerms; i++)
+            {
+                char buf[STRLEN];
+                sprintf(buf, "Term %d", i);
+                nms[i].name = gmx_strdup(buf);
+                nms[i].unit = gmx_strdup("kJ/mol");
+            }
+
+            ener_file_t ef  = open_enx(filename_.c_str(), "w");
+            int         nre = c_numTerms;
+            do_enxnms(ef, &nre, &nms);
+
+            t_enxframe  fr;
+            init_enxframe(&fr);
+            fr.nre     = c_numTerms;
+            fr.e_alloc = c_numTerms;
+            snew(fr.ener, c_numTerms);
+            add_blocks_enxframe(&fr, 3);
+            const int ids[3] = { enxDHCOLL, enxDISRE, enxDH };
+            for (int b = 0; b < 3; b++)
+            {
+                fr.block[b].id = ids[b];
+                add_subblocks_enxblock(&fr.block[b], 2);
+                t_enxsubblock *sub = fr.block[b].sub;
+                sub[0].type       = xdr_datatype_double;
+                sub[0].nr         = 5;
+                sub[0].dval_alloc = 5;
+                snew(sub[0].dval, 5);
+                if (ids[b] == enxDISRE)
+                {
+                    /* Strings can not be skipped without reading them */
+                    sub[1].type       = xdr_datatype_string;
+                    sub[1].nr         = 2;
+                    sub[1].sval_alloc = 2;
+                    snew(sub[1].sval, 2);
+                    sub[1].sval[0] = gmx_strdup("a");
+                    sub[1].sval[1] = gmx_strdup("string");
+                }
+                else
+                {
+                    sub[1].type       = xdr_datatype_int;
+                    sub[1].nr         = 3;
+                    sub[1].ival_alloc = 3;
+                    snew(sub[1].ival, 3);
+                }
+            }
+
+            for (int frame = 0; frame < c_numFrames; frame++)
+            {
+                fr.t      = frame;
+                fr.step   = 100*frame;
+                fr.nsteps = 100;
+                /* Test both frames with and without sums */
+                fr.nsum   = (frame == 1) ? 0 : 100;
+                for (int i = 0; i < c_numTerms; i++)
+                {
+                    fr.ener[i].e    = termValue(frame, i);
+                    fr.ener[i].eav  = 2*termValue(frame, i);
+                    fr.ener[i].esum = 3*termValue(frame, i);
+                }
+                for (int b = 0; b < 3; b++)
+                {
+                    for (int j = 0; j < 5; j++)
+                    {
+                        fr.block[b].sub[0].dval[j] = 100*b + 10*frame + j;
+                    }
+                    if (ids[b] != enxDISRE)
+                    {
+                        for (int j = 0; j < 3; j++)
+                        {
+                            fr.block[b].sub[1].ival[j] = 1000*b + frame + j;
+                        }
+                    }
+                }
+                do_enx(ef, &fr);
+            }
+            free_enxframe(&fr);
+            free_enxnms(c_numTerms, nms);
+            done_ener_file(ef);
+        }
+
+        //! Checks the contents of block \p blk as written to \p frame.
+        void checkBlock(const t_enxblock &blk, int frame)
+        {
+            int b = (blk.id == enxDHCOLL) ? 0 : (blk.id == enxDISRE ? 1 : 2);
+            ASSERT_EQ(2, blk.nsub);
+            ASSERT_EQ(5, blk.sub[0].nr);
+            for (int j = 0; j < 5; j++)
+            {
+                EXPECT_EQ(100*b + 10*frame + j, blk.sub[0].dval[j]);
+            }
+            if (blk.id != enxDISRE)
+            {
+                ASSERT_EQ(3, blk.sub[1].nr);
+                for (int j = 0; j < 3; j++)
+                {
+                    EXPECT_EQ(1000*b + frame + j, blk.sub[1].ival[j]);
+                }
+            }
+        }
+
+        gmx::test::TestFileManager fileManager_;
+        std::string                filename_;
+};
+
+TEST_F(EnxTest, ReadsAllData)
+{
+    ener_file_t  ef  = open_enx(filename_.c_str(), "r");
+    int          nre;
+    gmx_enxnm_t *nms = NULL;
+    do_enxnms(ef, &nre, &nms);
+    ASSERT_EQ(c_numTerms, nre);
+
+    t_enxframe   fr;
+    init_enxframe(&fr);
+    for (int frame = 0; frame < c_numFrames; frame++)
+    {
+        ASSERT_TRUE(do_enx(ef, &fr));
+        EXPECT_EQ(100*frame, fr.step);
+        ASSERT_EQ(c_numTerms, fr.nre);
+        for (int i = 0; i < c_numTerms; i++)
+        {
+            EXPECT_REAL_EQ_TOL(termValue(frame, i), fr.ener[i].e, gmx::test::defaultRealTolerance());
+        }
+        ASSERT_EQ(3, fr.nblock);
+        for (int b = 0; b < fr.nblock; b++)
+        {
+            checkBlock(fr.block[b], frame);
+        }
+    }
+    EXPECT_FALSE(do_enx(ef, &fr));
+    free_enxframe(&fr);
+    free_enxnms(nre, nms);
+    done_ener_file(ef);
+}
+
+TEST_F(EnxTest, ReadsSelectedTermsAndBlocks)
+{
+    ener_file_t  ef  = open_enx(filename_.c_str(), "r");
+    int          nre;
+    gmx_enxnm_t *nms = NULL;
+    do_enxnms(ef, &nre, &nms);
+    const int    terms[]    = { 1, 3 };
+    const int    blockIds[] = { enxDH };
+    enx_set_read_selection(ef, 2, terms, 1, blockIds);
+
+    t_enxframe   fr;
+    init_enxframe(&fr);
+    for (int frame = 0; frame < c_numFrames; frame++)
+    {
+        ASSERT_TRUE(do_enx(ef, &fr));
+        EXPECT_EQ(100*frame, fr.step);
+        ASSERT_EQ(c_numTerms, fr.nre);
+        for (int i = 0; i < c_numTerms; i++)
+        {
+            /* Unselected terms are never read, and keep their initial zero */
+            real expected = (i == 1 || i == 3) ? termValue(frame, i) : 0;
+            EXPECT_REAL_EQ_TOL(expected, fr.ener[i].e, gmx::test::defaultRealTolerance());
+        }
+        if (fr.nsum > 0)
+        {
+            EXPECT_REAL_EQ_TOL(3*termValue(frame, 3), fr.ener[3].esum, gmx::test::defaultRealTolerance());
+        }
+        ASSERT_EQ(1, fr.nblock);
+        EXPECT_EQ(enxDH, fr.block[0].id);
+        checkBlock(fr.block[0], frame);
+    }
+    EXPECT_FALSE(do_enx(ef, &fr));
+    free_enxframe(&fr);
+    free_enxnms(nre, nms);
+    done_ener_file(ef);
+}
+
+TEST_F(EnxTest, ReadsOnlyHeaders)
+{
+    ener_file_t  ef  = open_enx(filename_.c_str(), "r");
+    int          nre;
+    gmx_enxnm_t *nms = NULL;
+    do_enxnms(ef, &nre, &nms);
+    enx_set_read_selection(ef, 0, NULL, 0, NULL);
+
+    t_enxframe   fr;
+    init_enxframe(&fr);
+    for (int frame = 0; frame < c_numFrames; frame++)
+    {
+        ASSERT_TRUE(do_enx(ef, &fr));
+        EXPECT_EQ(100*frame, fr.step);
+        EXPECT_EQ(0, fr.nblock);
+    }
+    EXPECT_FALSE(do_enx(ef, &fr));
+    free_enxframe(&fr);
+    free_enxnms(nre, nms);
+    done_ener_file(ef);
+}
+
+} // namespace
@@ -43,12 +43,21 @@
 
 #include "gromacs/fileio/tngio.h"
 
+#include <cstring>
+
 #include <string>
+#include <vector>
 
 #include <gtest/gtest.h>
 
+#include "gromacs/fileio/oenv.h"
+#include "gromacs/fileio/trxio.h"
+#include "gromacs/math/vec.h"
+#include "gromacs/mdtypes/inputrec.h"
+#include "gromacs/trajectory/trajectoryframe.h"
 #include "gromacs/utility/path.h"
 
+#include "testutils/testasserts.h"
 #include "testutils/testfilemanager.h"
 
 namespace
@@ -78,4 +87,66 @@ TEST_F(TngTest, CloseBeforeOpenIsNotFatal)
     gmx_tng_close(&tng);
 }
 
+TEST_F(TngTest, BackgroundWriterWritesAllFrames)
+{
+    const int         atomCount  = 5;
+    const int         frameCount = 25;
+    const int         stepStride = 10;
+    std::string       filename   = fileManager_.getTemporaryFilePath("background.tng");
+    tng_trajectory_t  tng;
+    matrix            box        = {{2, 0, 0}, {0, 3, 0}, {0, 0, 4}};
+
+    std::vector<gmx::RVec> x(atomCount);
+
+    t_inputrec        ir;
+    tng_trajectory_t  input      = NULL;
+    std::memset(&ir, 0, sizeof(ir));
+    ir.nstxout = stepStride;
+    ir.delta_t = 0.002;
+
+    // Without topology the atoms are written as implicit particles,
+    // the output intervals are set as in mdrun
+    gmx_prepare_tng_writing(filename.c_str(), 'w', &input, &tng, atomCount, NULL, NULL, NULL);
+    gmx_tng_prepare_md_writing(tng, NULL, &ir);
+    {
+        gmx::TngBackgroundWriter writer(tng);
+        // Make sure the frame set size is reduced while writing
+        writer.setTargetFrameSetLatency(1e-9);
+        for (int frame = 0; frame < frameCount; ++frame)
+        {
+            for (int i = 0; i < atomCount; ++i)
+            {
+                x[i] = gmx::RVec(frame, i, 0.5*(frame + i));
+            }
+            writer.writeFrame(FALSE, frame*stepStride, frame*0.02, 0, box,
+                              atomCount, as_rvec_array(x.data()), NULL, NULL);
+        }
+    }
+    gmx_tng_close(&tng);
+
+    gmx_output_env_t *oenv;
+    output_env_init_default(&oenv);
+    t_trxstatus      *status;
+    t_trxframe        fr;
+    int               frame = 0;
+    bool              bOk   = read_first_frame(oenv, &status, filename.c_str(), &fr, TRX_NEED_X);
+    while (bOk)
+    {
+        ASSERT_LT(frame, frameCount);
+        EXPECT_EQ(frame*stepStride, fr.step);
+        ASSERT_EQ(atomCount, fr.natoms);
+        for (int i = 0; i < atomCount; ++i)
+        {
+            EXPECT_REAL_EQ_TOL(frame, fr.x[i][XX], gmx::test::defaultRealTolerance());
+            EXPECT_REAL_EQ_TOL(i, fr.x[i][YY], gmx::test::defaultRealTolerance());
+            EXPECT_REAL_EQ_TOL(0.5*(frame + i), fr.x[i][ZZ], gmx::test::defaultRealTolerance());
+        }
+        ++frame;
+        bOk = read_next_frame(oenv, status, &fr);
+    }
+    EXPECT_EQ(frameCount, frame);
+    close_trx(status);
+    output_env_done(oenv);
+}
+
 } // namespace
@@ -0,0 +1,365 @@
+/*
+ * This file is part of the GROMACS molecular simulation package.
+ *
+ * Copyright (c) 2017, by the GROMACS development team, led by
+ * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
+ * and including many others, as listed in the AUTHORS file in the
+ * top-level source directory and at http://www.gromacs.org.
+ *
+ * GROMACS is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ *
+ * GROMACS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GROMACS; if not, see
+ * http://www.gnu.org/licenses, or write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA.
+ *
+ * If you want to redistribute modifications to GROMACS, please
+ * consider that scientific software is very special. Version
+ * control is crucial - bugs must be traceable. We will be happy to
+ * consider code for inclusion in the official distribution, but
+ * derived work must not be called official GROMACS. Details are found
+ * in the README & COPYING files - if they are missing, get the
+ * official version at http://www.gromacs.org.
+ *
+ * To help us fund GROMACS development, we humbly ask that you cite
+ * the research papers on the package. Check out http://www.gromacs.org.
+ */
+/*! \internal \file
+ * \brief
+ * Tests for gmx::TprReader.
+ *
+ * The sections read on demand are compared against the full read done by
+ * read_tpx().
+ *
+ * \ingroup module_fileio
+ */
+#include "gmxpre.h"
+
+#include "gromacs/fileio/tpxio.h"
+
+#include <cstring>
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "gromacs/math/vec.h"
+#include "gromacs/math/vectypes.h"
+#include "gromacs/mdrunutility/mdmodules.h"
+#include "gromacs/mdtypes/inputrec.h"
+#include "gromacs/mdtypes/state.h"
+#include "gromacs/topology/atoms.h"
+#include "gromacs/topology/block.h"
+#include "gromacs/topology/idef.h"
+#include "gromacs/topology/ifunc.h"
+#include "gromacs/topology/topology.h"
+#include "gromacs/utility/smalloc.h"
+
+#include "testutils/testfilemanager.h"
+
+namespace
+{
+
+//! Checks that two blocks are equal.
+void compareBlocks(const t_block &ref, const t_block &test)
+{
+    ASSERT_EQ(ref.nr, test.nr);
+    for (int i = 0; i <= ref.nr; ++i)
+    {
+        EXPECT_EQ(ref.index[i], test.index[i]);
+    }
+}
+
+//! Checks that two sets of atoms are equal.
+void compareAtoms(const t_atoms &ref, const t_atoms &test)
+{
+    ASSERT_EQ(ref.nr, test.nr);
+    for (int i = 0; i < ref.nr; ++i)
+    {
+        EXPECT_STREQ(*ref.atomname[i], *test.atomname[i]);
+        EXPECT_EQ(ref.atom[i].type, test.atom[i].type);
+        EXPECT_EQ(ref.atom[i].m, test.atom[i].m);
+        EXPECT_EQ(ref.atom[i].q, test.atom[i].q);
+        EXPECT_EQ(ref.atom[i].resind, test.atom[i].resind);
+    }
+    ASSERT_EQ(ref.nres, test.nres);
+    for (int i = 0; i < ref.nres; ++i)
+    {
+        EXPECT_STREQ(*ref.resinfo[i].name, *test.resinfo[i].name);
+        EXPECT_EQ(ref.resinfo[i].nr, test.resinfo[i].nr);
+    }
+}
+
+//! Checks that two sets of interaction lists are equal.
+void compareIlists(const t_ilist *ref, const t_ilist *test)
+{
+    for (int ftype = 0; ftype < F_NRE; ++ftype)
+    {
+        ASSERT_EQ(ref[ftype].nr, test[ftype].nr);
+        for (int j = 0; j < ref[ftype].nr; ++j)
+        {
+            EXPECT_EQ(ref[ftype].iatoms[j], test[ftype].iatoms[j]);
+        }
+    }
+}
+
+//! Returns the total number of entries in a set of interaction lists.
+int countIlistEntries(const t_ilist *ilist)
+{
+    int count = 0;
+    for (int ftype = 0; ftype < F_NRE; ++ftype)
+    {
+        count += ilist[ftype].nr;
+    }
+    return count;
+}
+
+//! Checks that two topologies are equal.
+void compareMtops(const gmx_mtop_t &ref, const gmx_mtop_t &test)
+{
+    EXPECT_STREQ(*ref.name, *test.name);
+    EXPECT_EQ(ref.natoms, test.natoms);
+
+    ASSERT_EQ(ref.ffparams.ntypes, test.ffparams.ntypes);
+    for (int i = 0; i < ref.ffparams.ntypes; ++i)
+    {
+        EXPECT_EQ(ref.ffparams.functype[i], test.ffparams.functype[i]);
+        EXPECT_EQ(0, std::memcmp(&ref.ffparams.iparams[i], &test.ffparams.iparams[i],
+                                 sizeof(t_iparams)));
+    }
+    EXPECT_EQ(ref.ffparams.fudgeQQ, test.ffparams.fudgeQQ);
+    EXPECT_EQ(ref.atomtypes.nr, test.atomtypes.nr);
+
+    ASSERT_EQ(ref.nmoltype, test.nmoltype);
+    for (int i = 0; i < ref.nmoltype; ++i)
+    {
+        const gmx_moltype_t &refType  = ref.moltype[i];
+        const gmx_moltype_t &testType = test.moltype[i];
+        EXPECT_STREQ(*refType.name, *testType.name);
+        compareAtoms(refType.atoms, testType.atoms);
+        compareIlists(refType.ilist, testType.ilist);
+        compareBlocks(refType.cgs, testType.cgs);
+        ASSERT_EQ(refType.excls.nr, testType.excls.nr);
+        ASSERT_EQ(refType.excls.nra, testType.excls.nra);
+        for (int j = 0; j < refType.excls.nra; ++j)
+        {
+            EXPECT_EQ(refType.excls.a[j], testType.excls.a[j]);
+        }
+    }
+
+    ASSERT_EQ(ref.nmolblock, test.nmolblock);
+    for (int i = 0; i < ref.nmolblock; ++i)
+    {
+        EXPECT_EQ(ref.molblock[i].type, test.molblock[i].type);
+        EXPECT_EQ(ref.molblock[i].nmol, test.molblock[i].nmol);
+        EXPECT_EQ(ref.molblock[i].natoms_mol, test.molblock[i].natoms_mol);
+        EXPECT_EQ(ref.molblock[i].nposres_xA, test.molblock[i].nposres_xA);
+        EXPECT_EQ(ref.molblock[i].nposres_xB, test.molblock[i].nposres_xB);
+    }
+    compareBlocks(ref.mols, test.mols);
+
+    EXPECT_EQ(ref.groups.ngrpname, test.groups.ngrpname);
+    for (int g = 0; g < egcNR; ++g)
+    {
+        ASSERT_EQ(ref.groups.grps[g].nr, test.groups.grps[g].nr);
+        for (int i = 0; i < ref.groups.grps[g].nr; ++i)
+        {
+            EXPECT_EQ(ref.groups.grps[g].nm_ind[i], test.groups.grps[g].nm_ind[i]);
+        }
+        ASSERT_EQ(ref.groups.ngrpnr[g], test.groups.ngrpnr[g]);
+        for (int i = 0; i < ref.groups.ngrpnr[g]; ++i)
+        {
+            EXPECT_EQ(ref.groups.grpnr[g][i], test.groups.grpnr[g][i]);
+        }
+    }
+}
+
+//! Checks that two sets of vectors are equal.
+void compareRVecs(const std::vector<gmx::RVec> &ref, gmx::ConstArrayRef<gmx::RVec> test)
+{
+    ASSERT_EQ(ref.size(), test.size());
+    for (size_t i = 0; i < ref.size(); ++i)
+    {
+        for (int d = 0; d < DIM; ++d)
+        {
+            EXPECT_EQ(ref[i][d], test[i][d]);
+        }
+    }
+}
+
+class TprReaderTest : public ::testing::Test
+{
+    public:
+        TprReaderTest()
+            : filename_(gmx::test::TestFileManager::getInputFilePath("emim-tfsi-co2.tpr")),
+              refHeader_()
+        {
+            read_tpxheader(filename_.c_str(), &refHeader_, TRUE);
+            refX_.resize(refHeader_.natoms);
+            refV_.resize(refHeader_.natoms);
+            int natoms = 0;
+            refEPBC_ = read_tpx(filename_.c_str(), NULL, refBox_, &natoms,
+                                as_rvec_array(refX_.data()),
+                                as_rvec_array(refV_.data()), &refMtop_);
+        }
+        ~TprReaderTest()
+        {
+            done_mtop(&refMtop_);
+        }
+
+        std::string             filename_;
+        t_tpxheader             refHeader_;
+        std::vector<gmx::RVec>  refX_;
+        std::vector<gmx::RVec>  refV_;
+        matrix                  refBox_;
+        int                     refEPBC_;
+        gmx_mtop_t              refMtop_;
+};
+
+TEST_F(TprReaderTest, ReadsSameAsReadTpx)
+{
+    gmx::TprReader     reader(filename_.c_str());
+
+    const t_tpxheader &header = reader.header();
+    EXPECT_EQ(refHeader_.bIr, header.bIr);
+    EXPECT_EQ(refHeader_.bBox, header.bBox);
+    EXPECT_EQ(refHeader_.bTop, header.bTop);
+    EXPECT_EQ(refHeader_.bX, header.bX);
+    EXPECT_EQ(refHeader_.bV, header.bV);
+    EXPECT_EQ(refHeader_.bF, header.bF);
+    EXPECT_EQ(refHeader_.natoms, header.natoms);
+    EXPECT_EQ(refHeader_.ngtc, header.ngtc);
+    EXPECT_EQ(refHeader_.lambda, header.lambda);
+    EXPECT_EQ(refHeader_.fep_state, header.fep_state);
+    // The test file should exercise all the sections read on demand.
+    ASSERT_TRUE(header.bTop && header.bX && header.bV);
+
+    matrix box;
+    reader.getBox(box);
+    for (int i = 0; i < DIM; ++i)
+    {
+        for (int j = 0; j < DIM; ++j)
+        {
+            EXPECT_EQ(refBox_[i][j], box[i][j]);
+        }
+    }
+    EXPECT_EQ(refEPBC_, reader.ePBC());
+    // Reading the sections in a different order than in the file should
+    // give the same result.
+    compareRVecs(refV_, reader.v());
+    compareRVecs(refX_, reader.x());
+    ASSERT_TRUE(reader.mtop() != NULL);
+    compareMtops(refMtop_, *reader.mtop());
+}
+
+TEST_F(TprReaderTest, ReleasesTopology)
+{
+    gmx::TprReader reader(filename_.c_str());
+    gmx_mtop_t     mtop;
+
+    reader.releaseMtop(&mtop);
+    EXPECT_TRUE(reader.mtop() == NULL);
+    compareMtops(refMtop_, mtop);
+    // The other sections should still be readable after the topology
+    // has been released.
+    EXPECT_EQ(refEPBC_, reader.ePBC());
+    compareRVecs(refX_, reader.x());
+    compareRVecs(refV_, reader.v());
+    done_mtop(&mtop);
+}
+
+TEST_F(TprReaderTest, ReadsInteractionsOnDemand)
+{
+    gmx::TprReader    reader(filename_.c_str());
+
+    const gmx_mtop_t *partial = reader.mtopWithoutInteractions();
+    ASSERT_TRUE(partial != NULL);
+    ASSERT_EQ(refMtop_.nmoltype, partial->nmoltype);
+    ASSERT_EQ(refMtop_.ffparams.ntypes, partial->ffparams.ntypes);
+    for (int i = 0; i < refMtop_.ffparams.ntypes; ++i)
+    {
+        EXPECT_EQ(refMtop_.ffparams.functype[i], partial->ffparams.functype[i]);
+    }
+    for (int mt = 0; mt < refMtop_.nmoltype; ++mt)
+    {
+        compareAtoms(refMtop_.moltype[mt].atoms, partial->moltype[mt].atoms);
+        EXPECT_EQ(0, countIlistEntries(partial->moltype[mt].ilist));
+    }
+
+    // Reading the lists of one molecule type should leave the others unread.
+    const int lastType = refMtop_.nmoltype - 1;
+    ASSERT_GT(countIlistEntries(refMtop_.moltype[lastType].ilist), 0);
+    compareIlists(refMtop_.moltype[lastType].ilist, reader.ilists(lastType));
+    for (int mt = 0; mt < lastType; ++mt)
+    {
+        EXPECT_EQ(0, countIlistEntries(partial->moltype[mt].ilist));
+    }
+
+    const gmx_ffparams_t &ffparams = reader.ffparams();
+    for (int i = 0; i < refMtop_.ffparams.ntypes; ++i)
+    {
+        EXPECT_EQ(0, std::memcmp(&refMtop_.ffparams.iparams[i], &ffparams.iparams[i],
+                                 sizeof(t_iparams)));
+    }
+
+    // The topology is complete after the remaining interactions are read.
+    compareMtops(refMtop_, *reader.mtop());
+    compareRVecs(refX_, reader.x());
+}
+
+TEST_F(TprReaderTest, ReadsInputrecAsReadTpx)
+{
+    gmx::MDModules  refModules;
+    t_inputrec     *refIr = refModules.inputrec();
+    t_state         refState {};
+    gmx_mtop_t      mtop;
+    read_tpx_state(filename_.c_str(), refIr, &refState, &mtop);
+    done_mtop(&mtop);
+
+    gmx::MDModules  modules;
+    t_inputrec     *ir = modules.inputrec();
+    gmx::TprReader  reader(filename_.c_str());
+    reader.readInputrec(ir);
+
+    EXPECT_EQ(refIr->eI, ir->eI);
+    EXPECT_EQ(refIr->nsteps, ir->nsteps);
+    EXPECT_EQ(refIr->delta_t, ir->delta_t);
+    EXPECT_EQ(refIr->cutoff_scheme, ir->cutoff_scheme);
+    EXPECT_EQ(refIr->coulombtype, ir->coulombtype);
+    EXPECT_EQ(refIr->rlist, ir->rlist);
+    EXPECT_EQ(refIr->rcoulomb, ir->rcoulomb);
+    EXPECT_EQ(refIr->rvdw, ir->rvdw);
+    EXPECT_EQ(refIr->epc, ir->epc);
+    EXPECT_EQ(refIr->ePBC, ir->ePBC);
+    EXPECT_EQ(refIr->bPeriodicMols, ir->bPeriodicMols);
+    ASSERT_EQ(refIr->opts.ngtc, ir->opts.ngtc);
+    for (int i = 0; i < refIr->opts.ngtc; ++i)
+    {
+        EXPECT_EQ(refIr->opts.ref_t[i], ir->opts.ref_t[i]);
+        EXPECT_EQ(refIr->opts.tau_t[i], ir->opts.tau_t[i]);
+    }
+    EXPECT_EQ(refIr->ePBC, reader.ePBC());
+
+    matrix boxRel;
+    reader.getBoxRel(boxRel);
+    for (int i = 0; i < DIM; ++i)
+    {
+        for (int j = 0; j < DIM; ++j)
+        {
+            EXPECT_EQ(refState.box_rel[i][j], boxRel[i][j]);
+        }
+    }
+    // Reading the input record should not need the interactions.
+    EXPECT_EQ(0, countIlistEntries(reader.mtopWithoutInteractions()->moltype[0].ilist));
+}
+
+} // namespace
@@ -0,0 +1,227 @@
+/*
+ * This file is part of the GROMACS molecular simulation package.
+ *
+ * Copyright (c) 2017, by the GROMACS development team, led by
+ * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
+ * and including many others, as listed in the AUTHORS file in the
+ * top-level source directory and at http://www.gromacs.org.
+ *
+ * GROMACS is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ *
+ * GROMACS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GROMACS; if not, see
+ * http://www.gnu.org/licenses, or write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA.
+ *
+ * If you want to redistribute modifications to GROMACS, please
+ * consider that scientific software is very special. Version
+ * control is crucial - bugs must be traceable. We will be happy to
+ * consider code for inclusion in the official distribution, but
+ * derived work must not be called official GROMACS. Details are found
+ * in the README & COPYING files - if they are missing, get the
+ * official version at http://www.gromacs.org.
+ *
+ * To help us fund GROMACS development, we humbly ask that you cite
+ * the research papers on the package. Check out http://www.gromacs.org.
+ */
+/*! \internal \file
+ * \brief
+ * Tests for xtc file I/O, including the blocked frame layout.
+ *
+ * \ingroup module_fileio
+ */
+#include "gmxpre.h"
+
+#include "gromacs/fileio/xtcio.h"
+
+#include <cstdio>
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "gromacs/math/vec.h"
+#include "gromacs/math/vectypes.h"
+#include "gromacs/utility/smalloc.h"
+#include "gromacs/utility/stringutil.h"
+
+#include "testutils/testasserts.h"
+#include "testutils/testfilemanager.h"
+
+namespace
+{
+
+//! Magic number of frames in the classic xtc layout.
+const int c_classicXtcMagic = 1995;
+//! Magic number of frames in the blocked xtc layout.
+const int c_blockedXtcMagic = 2017;
+
+class XtcTest : public ::testing::Test
+{
+    public:
+        XtcTest() : precision_(1000)
+        {
+            clear_mat(box_);
+            box_[XX][XX] = 5;
+            box_[YY][YY] = 6;
+            box_[ZZ][ZZ] = 7;
+        }
+
+        //! Fills x_ with natoms pseudo-random coordinates inside the box.
+        void generateCoordinates(int natoms)
+        {
+            x_.resize(natoms);
+            for (int i = 0; i < natoms; i++)
+            {
+                for (int d = 0; d < DIM; d++)
+                {
+                    x_[i][d] = ((i*7919 + d*104729) % 5003)*box_[d][d]/5003;
+                }
+            }
+        }
+
+        /*! \brief
+         * Writes two frames with the given block size and checks that they
+         * read back.
+         *
+         * Returns the name of the written file.
+         */
+        std::string runRoundtrip(int natoms, int atomsPerBlock)
+        {
+            generateCoordinates(natoms);
+            std::string filename = fileManager_.getTemporaryFilePath(
+                        gmx::formatString("%d.xtc", atomsPerBlock));
+            writeFrames(filename, natoms, atomsPerBlock);
+            readAndCheckFrames(filename, natoms);
+            return filename;
+        }
+
+        //! Writes two frames of x_ to \p filename with the given block size.
+        void writeFrames(const std::string &filename, int natoms, int atomsPerBlock)
+        {
+            t_fileio *fio = open_xtc(filename.c_str(), "w");
+            for (int frame = 0; frame < 2; frame++)
+            {
+                ASSERT_EQ(1, write_xtc_blocked(fio, natoms, frame, 0.5*frame, box_,
+                                               as_rvec_array(x_.data()), precision_,
+                                               atomsPerBlock));
+            }
+            close_xtc(fio);
+        }
+
+        //! Reads back the frames written by writeFrames() and checks them.
+        void readAndCheckFrames(const std::string &filename, int natoms)
+        {
+            int         readNatoms;
+            gmx_int64_t step;
+            real        time, prec;
+            matrix      box;
+            rvec       *x;
+            gmx_bool    bOK;
+            t_fileio   *fio = open_xtc(filename.c_str(), "r");
+            ASSERT_EQ(1, read_first_xtc(fio, &readNatoms, &step, &time, box, &x, &prec, &bOK));
+            ASSERT_EQ(natoms, readNatoms);
+            checkFrame(x, prec);
+            ASSERT_EQ(1, read_next_xtc(fio, natoms, &step, &time, box, x, &prec, &bOK));
+            EXPECT_EQ(1, step);
+            EXPECT_REAL_EQ_TOL(0.5, time, gmx::test::defaultRealTolerance());
+            EXPECT_REAL_EQ_TOL(box_[YY][YY], box[YY][YY], gmx::test::defaultRealTolerance());
+            checkFrame(x, prec);
+            EXPECT_EQ(0, read_next_xtc(fio, natoms, &step, &time, box, x, &prec, &bOK));
+            sfree(x);
+            close_xtc(fio);
+        }
+
+        //! Returns the contents of \p filename.
+        static std::vector<char> readFileContents(const std::string &filename)
+        {
+            std::vector<char> contents;
+            FILE             *fp = std::fopen(filename.c_str(), "rb");
+            EXPECT_TRUE(fp != NULL);
+            if (fp != NULL)
+            {
+                int c;
+                while ((c = std::fgetc(fp)) != EOF)
+                {
+                    contents.push_back(static_cast<char>(c));
+                }
+                std::fclose(fp);
+            }
+            return contents;
+        }
+
+        //! Returns the magic number of the first frame in \p filename.
+        static int readMagic(const std::string &filename)
+        {
+            const std::vector<char> contents = readFileContents(filename);
+            if (contents.size() < 4)
+            {
+                return -1;
+            }
+            // XDR stores integers in big-endian byte order.
+            int magic = 0;
+            for (int i = 0; i < 4; i++)
+            {
+                magic = (magic << 8) | static_cast<unsigned char>(contents[i]);
+            }
+            return magic;
+        }
+
+        //! Checks coordinates against x_ within the compression precision.
+        void checkFrame(const rvec *x, real prec)
+        {
+            EXPECT_REAL_EQ_TOL(precision_, prec, gmx::test::defaultRealTolerance());
+            for (size_t i = 0; i < x_.size(); i++)
+            {
+                for (int d = 0; d < DIM; d++)
+                {
+                    EXPECT_NEAR(x_[i][d], x[i][d], 0.51/precision_);
+                }
+            }
+        }
+
+        gmx::test::TestFileManager fileManager_;
+        std::vector<gmx::RVec>     x_;
+        matrix                     box_;
+        real                       precision_;
+};
+
+TEST_F(XtcTest, ClassicLayoutRoundtrips)
+{
+    std::string filename = runRoundtrip(1000, 0);
+    EXPECT_EQ(c_classicXtcMagic, readMagic(filename));
+}
+
+TEST_F(XtcTest, BlockedLayoutRoundtrips)
+{
+    std::string filename = runRoundtrip(1000, 128);
+    EXPECT_EQ(c_blockedXtcMagic, readMagic(filename));
+}
+
+TEST_F(XtcTest, BlockedLayoutHandlesSmallLastBlock)
+{
+    std::string filename = runRoundtrip(1003, 250);
+    EXPECT_EQ(c_blockedXtcMagic, readMagic(filename));
+}
+
+TEST_F(XtcTest, FrameFittingInOneBlockUsesClassicLayout)
+{
+    std::string filename = runRoundtrip(100, 128);
+    EXPECT_EQ(c_classicXtcMagic, readMagic(filename));
+
+    // The file should be identical to one written without blocks.
+    std::string classicFilename = fileManager_.getTemporaryFilePath("classic.xtc");
+    writeFrames(classicFilename, 100, 0);
+    EXPECT_TRUE(readFileContents(classicFilename) == readFileContents(filename));
+}
+
+} // namespace
@@ -40,7 +40,14 @@
 
 #include <cmath>
 
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #if GMX_USE_TNG
 #include "tng/tng_io.h"
@@ -48,12 +55,14 @@
 
 #include "gromacs/math/units.h"
 #include "gromacs/math/utilities.h"
+#include "gromacs/math/vec.h"
 #include "gromacs/mdtypes/inputrec.h"
 #include "gromacs/topology/ifunc.h"
 #include "gromacs/topology/topology.h"
 #include "gromacs/trajectory/trajectoryframe.h"
 #include "gromacs/utility/basedefinitions.h"
 #include "gromacs/utility/baseversion.h"
+#include "gromacs/utility/exceptions.h"
 #include "gromacs/utility/fatalerror.h"
 #include "gromacs/utility/futil.h"
 #include "gromacs/utility/gmxassert.h"
@@ -857,6 +866,242 @@ void fflush_tng(tng_trajectory_t tng)
 #endif
 }
 
+namespace gmx
+{
+
+/*! \brief
+ * Maximum number of frames queued for writing.
+ *
+ * Each queued frame holds a copy of the coordinates, velocities and
+ * forces, so this limits the memory use when the worker falls behind.
+ */
+static const size_t c_maxQueuedTngFrames = 4;
+
+class TngBackgroundWriter::Impl
+{
+    public:
+        //! Frame data copied for writing.
+        struct Frame
+        {
+            gmx_bool               bUseLossyCompression;
+            gmx_int64_t            step;
+            real                   time;
+            real                   lambda;
+            bool                   bBox;
+            matrix                 box;
+            int                    nAtoms;
+            bool                   bX, bV, bF;
+            std::vector<RVec>      x, v, f;
+        };
+
+        explicit Impl(tng_trajectory_t tng);
+        ~Impl();
+
+        //! Queues a frame, waiting when the queue is full.
+        void queueFrame(Frame &&frame);
+        //! Waits until the queue is empty and the worker is idle.
+        void waitUntilWritten();
+
+        //! TNG handle to write to.
+        tng_trajectory_t         tng_;
+        //! Target time for writing a frame set, 0 if not used.
+        double                   targetLatency_;
+
+    private:
+        //! Main loop of the worker thread.
+        void run();
+        //! Writes a frame and adjusts the frame set size if needed.
+        void write(const Frame &frame);
+
+        std::mutex               mutex_;
+        std::condition_variable  changed_;
+        std::deque<Frame>        queue_;
+        bool                     bWriting_;
+        bool                     bStop_;
+        //! Last step written, -1 before the first frame.
+        gmx_int64_t              lastStep_;
+        //! Greatest common divisor of the intervals between written steps.
+        gmx_int64_t              stepInterval_;
+        std::thread              thread_;
+};
+
+TngBackgroundWriter::Impl::Impl(tng_trajectory_t tng)
+    : tng_(tng), targetLatency_(0), bWriting_(false), bStop_(false),
+      lastStep_(-1), stepInterval_(0)
+{
+    thread_ = std::thread(&Impl::run, this);
+}
+
+TngBackgroundWriter::Impl::~Impl()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        bStop_ = true;
+    }
+    changed_.notify_all();
+    thread_.join();
+}
+
+void TngBackgroundWriter::Impl::queueFrame(Frame &&frame)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    changed_.wait(lock, [this]{ return queue_.size() < c_maxQueuedTngFrames; });
+    queue_.push_back(std::move(frame));
+    lock.unlock();
+    changed_.notify_all();
+}
+
+void TngBackgroundWriter::Impl::waitUntilWritten()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    changed_.wait(lock, [this]{ return queue_.empty() && !bWriting_; });
+}
+
+void TngBackgroundWriter::Impl::run()
+{
+    try
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true)
+        {
+            changed_.wait(lock, [this]{ return bStop_ || !queue_.empty(); });
+            if (queue_.empty())
+            {
+                break;
+            }
+            Frame frame = std::move(queue_.front());
+            queue_.pop_front();
+            bWriting_ = true;
+            lock.unlock();
+            changed_.notify_all();
+
+            write(frame);
+
+            lock.lock();
+            bWriting_ = false;
+            changed_.notify_all();
+        }
+    }
+    GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR;
+}
+
+void TngBackgroundWriter::Impl::write(const Frame &frame)
+{
+    if (lastStep_ >= 0 && frame.step > lastStep_)
+    {
+        gmx_int64_t a = frame.step - lastStep_;
+        gmx_int64_t b = stepInterval_;
+        while (b > 0)
+        {
+            gmx_int64_t r = a % b;
+            a             = b;
+            b             = r;
+        }
+        stepInterval_ = a;
+    }
+    lastStep_ = frame.step;
+
+    const auto startTime = std::chrono::steady_clock::now();
+    gmx_fwrite_tng(tng_, frame.bUseLossyCompression, frame.step,
+                   frame.time, frame.lambda,
+                   frame.bBox ? frame.box : NULL, frame.nAtoms,
+                   frame.bX ? as_rvec_array(frame.x.data()) : NULL,
+                   frame.bV ? as_rvec_array(frame.v.data()) : NULL,
+                   frame.bF ? as_rvec_array(frame.f.data()) : NULL);
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - startTime;
+
+#if GMX_USE_TNG
+    /* Only a frame that completes a frame set takes significant time */
+    if (targetLatency_ > 0 && stepInterval_ > 0 &&
+        elapsed.count() > targetLatency_)
+    {
+        gmx_int64_t                nFrames, firstFrame, lastFrame;
+        tng_trajectory_frame_set_t frameSet;
+        tng_num_frames_per_frame_set_get(tng_, &nFrames);
+        gmx_int64_t                nFramesNew = static_cast<gmx_int64_t>(nFrames*targetLatency_/elapsed.count());
+        nFramesNew = std::max(stepInterval_, nFramesNew - nFramesNew % stepInterval_);
+        /* The new size also applies to the current frame set,
+         * which should still contain all frames written to it.
+         */
+        if (tng_current_frame_set_get(tng_, &frameSet) == TNG_SUCCESS &&
+            tng_frame_set_frame_range_get(tng_, frameSet, &firstFrame, &lastFrame) == TNG_SUCCESS)
+        {
+            gmx_int64_t nFramesMin = frame.step - firstFrame + 1;
+            nFramesMin = ((nFramesMin + stepInterval_ - 1)/stepInterval_)*stepInterval_;
+            nFramesNew = std::max(nFramesNew, nFramesMin);
+        }
+        if (nFramesNew < nFrames)
+        {
+            tng_num_frames_per_frame_set_set(tng_, nFramesNew);
+        }
+    }
+#endif
+}
+
+TngBackgroundWriter::TngBackgroundWriter(tng_trajectory_t tng)
+    : impl_(new Impl(tng))
+{
+}
+
+TngBackgroundWriter::~TngBackgroundWriter()
+{
+}
+
+void TngBackgroundWriter::setTargetFrameSetLatency(double seconds)
+{
+    impl_->waitUntilWritten();
+    impl_->targetLatency_ = seconds;
+}
+
+void TngBackgroundWriter::writeFrame(gmx_bool     bUseLossyCompression,
+                                     gmx_int64_t  step,
+                                     real         elapsedPicoSeconds,
+                                     real         lambda,
+                                     const rvec  *box,
+                                     int          nAtoms,
+                                     const rvec  *x,
+                                     const rvec  *v,
+                                     const rvec  *f)
+{
+    Impl::Frame frame;
+
+    frame.bUseLossyCompression = bUseLossyCompression;
+    frame.step                 = step;
+    frame.time                 = elapsedPicoSeconds;
+    frame.lambda               = lambda;
+    frame.bBox                 = (box != NULL);
+    if (box)
+    {
+        copy_mat(box, frame.box);
+    }
+    frame.nAtoms               = nAtoms;
+    frame.bX                   = (x != NULL);
+    frame.bV                   = (v != NULL);
+    frame.bF                   = (f != NULL);
+    if (x)
+    {
+        frame.x.assign(x, x + nAtoms);
+    }
+    if (v)
+    {
+        frame.v.assign(v, v + nAtoms);
+    }
+    if (f)
+    {
+        frame.f.assign(f, f + nAtoms);
+    }
+    impl_->queueFrame(std::move(frame));
+}
+
+void TngBackgroundWriter::flush()
+{
+    impl_->waitUntilWritten();
+    fflush_tng(impl_->tng_);
+}
+
+} // namespace gmx
+
 float gmx_tng_get_time_of_final_frame(tng_trajectory_t tng)
 {
 #if GMX_USE_TNG
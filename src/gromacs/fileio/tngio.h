@@ -40,6 +40,7 @@
 
 #include "gromacs/math/vectypes.h"
 #include "gromacs/utility/basedefinitions.h"
+#include "gromacs/utility/classhelpers.h"
 #include "gromacs/utility/real.h"
 
 struct gmx_mtop_t;
@@ -206,4 +207,71 @@ gmx_bool gmx_get_tng_data_next_frame_of_block_type(tng_trajectory_t     input,
                                                    int                  maxLen,
                                                    gmx_bool            *bOK);
 
+namespace gmx
+{
+
+/*! \libinternal \brief
+ * Writes frames to a TNG file from a background thread.
+ *
+ * TNG keeps the frames of a frame set in memory, and compresses and
+ * writes all of them when the frame set is complete. With
+ * gmx_fwrite_tng() this stalls the caller for the whole frame set.
+ * writeFrame() instead copies the frame data and queues it for a worker
+ * thread that calls gmx_fwrite_tng(), so the caller only waits when the
+ * worker falls more than a few frames behind.
+ *
+ * When a target latency is set with setTargetFrameSetLatency(), the
+ * worker measures how long writing each frame takes, and reduces the
+ * number of frames per frame set when completing a frame set took longer
+ * than the target. The number of frames per frame set is kept a multiple
+ * of the interval between the written steps, and is never increased, so
+ * that seeking in the file still works.
+ *
+ * While the writer exists, \p tng should only be used by other code
+ * directly after flush().
+ */
+class TngBackgroundWriter
+{
+    public:
+        //! Starts a worker thread writing to \p tng.
+        explicit TngBackgroundWriter(tng_trajectory_t tng);
+        //! Writes all queued frames and stops the worker thread.
+        ~TngBackgroundWriter();
+
+        /*! \brief
+         * Sets the target time for writing a frame set.
+         *
+         * \param[in] seconds  Target time in seconds, 0 turns the
+         *     adjustment of the frame set size off (the default).
+         */
+        void setTargetFrameSetLatency(double seconds);
+        /*! \brief
+         * Queues a copy of a frame for writing.
+         *
+         * The parameters are the same as for gmx_fwrite_tng(), except that
+         * the TNG handle is that of the writer.
+         */
+        void writeFrame(gmx_bool     bUseLossyCompression,
+                        gmx_int64_t  step,
+                        real         elapsedPicoSeconds,
+                        real         lambda,
+                        const rvec  *box,
+                        int          nAtoms,
+                        const rvec  *x,
+                        const rvec  *v,
+                        const rvec  *f);
+        /*! \brief
+         * Waits until all queued frames have been written and writes the
+         * current frame set to disk, as fflush_tng().
+         */
+        void flush();
+
+    private:
+        class Impl;
+
+        PrivateImplPointer<Impl> impl_;
+};
+
+} // namespace gmx
+
 #endif /* GMX_FILEIO_TNGIO_H */
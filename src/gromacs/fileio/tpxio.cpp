@@ -2020,8 +2020,48 @@ static void do_ilist(t_fileio *fio, t_ilist *ilist, gmx_bool bRead, int file_ver
     gmx_fio_ndo_int(fio, ilist->iatoms, ilist->nr);
 }
 
+/* Skips the parameters of all function types in ffparams, which have
+ * already been read and renumbered. The size of the parameters only
+ * depends on the function type and the file version, so each function
+ * type is read once to measure it.
+ */
+static void skip_iparams(t_fileio *fio, const gmx_ffparams_t *ffparams,
+                         int file_version)
+{
+    gmx_off_t sizes[F_NRE];
+    gmx_off_t offset = gmx_fio_ftell(fio);
+    t_iparams iparams;
+
+    for (int ftype = 0; ftype < F_NRE; ftype++)
+    {
+        sizes[ftype] = -1;
+    }
+    for (int i = 0; i < ffparams->ntypes; i++)
+    {
+        const t_functype ftype = ffparams->functype[i];
+        if (sizes[ftype] < 0)
+        {
+            if (gmx_fio_seek(fio, offset) != 0)
+            {
+                gmx_file(gmx_fio_getname(fio));
+            }
+            do_iparams(fio, ftype, &iparams, TRUE, file_version);
+            sizes[ftype] = gmx_fio_ftell(fio) - offset;
+        }
+        offset += sizes[ftype];
+    }
+    if (gmx_fio_seek(fio, offset) != 0)
+    {
+        gmx_file(gmx_fio_getname(fio));
+    }
+}
+
+/* When iparamsOffset!=NULL, the parameters are not read, but skipped
+ * and their offset in the file is returned in *iparamsOffset.
+ */
 static void do_ffparams(t_fileio *fio, gmx_ffparams_t *ffparams,
-                        gmx_bool bRead, int file_version)
+                        gmx_bool bRead, int file_version,
+                        gmx_off_t *iparamsOffset = NULL)
 {
     int          idum, i;
     unsigned int k;
@@ -2074,8 +2114,16 @@ static void do_ffparams(t_fileio *fio, gmx_ffparams_t *ffparams,
             }
         }
 
-        do_iparams(fio, ffparams->functype[i], &ffparams->iparams[i], bRead,
-                   file_version);
+        if (iparamsOffset == NULL)
+        {
+            do_iparams(fio, ffparams->functype[i], &ffparams->iparams[i], bRead,
+                       file_version);
+        }
+    }
+    if (iparamsOffset != NULL)
+    {
+        *iparamsOffset = gmx_fio_ftell(fio);
+        skip_iparams(fio, ffparams, file_version);
     }
 }
 
@@ -2095,26 +2143,48 @@ static void add_settle_atoms(t_ilist *ilist)
     ilist->nr = 2*ilist->nr;
 }
 
+/* Returns whether files of file_version have no list for ftype */
+static gmx_bool ilist_not_in_file(int ftype, int file_version)
+{
+    for (unsigned int k = 0; k < NFTUPD; k++)
+    {
+        if ((file_version < ftupd[k].fvnr) && (ftype == ftupd[k].ftype))
+        {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/* Skips the interaction lists written by do_ilists() */
+static void skip_ilists(t_fileio *fio, int file_version)
+{
+    int nr;
+
+    GMX_RELEASE_ASSERT(file_version >= 44, "Skipping old interaction lists is not supported");
+    for (int j = 0; j < F_NRE; j++)
+    {
+        if (!ilist_not_in_file(j, file_version))
+        {
+            gmx_fio_do_int(fio, nr);
+            /* XDR stores an int in 4 bytes */
+            if (gmx_fio_seek(fio, gmx_fio_ftell(fio) + static_cast<gmx_off_t>(nr)*4) != 0)
+            {
+                gmx_file(gmx_fio_getname(fio));
+            }
+        }
+    }
+}
+
 static void do_ilists(t_fileio *fio, t_ilist *ilist, gmx_bool bRead,
                       int file_version)
 {
     int          j;
     gmx_bool     bClear;
-    unsigned int k;
 
     for (j = 0; (j < F_NRE); j++)
     {
-        bClear = FALSE;
-        if (bRead)
-        {
-            for (k = 0; k < NFTUPD; k++)
-            {
-                if ((file_version < ftupd[k].fvnr) && (j == ftupd[k].ftype))
-                {
-                    bClear = TRUE;
-                }
-            }
-        }
+        bClear = (bRead && ilist_not_in_file(j, file_version));
         if (bClear)
         {
             ilist[j].nr     = 0;
@@ -2580,9 +2650,12 @@ static void do_cmap(t_fileio *fio, gmx_cmap_t *cmap_grid, gmx_bool bRead)
 }
 
 
+/* When ilistsOffset!=NULL, the interaction lists are not read, but skipped
+ * and their offset in the file is returned in *ilistsOffset.
+ */
 static void do_moltype(t_fileio *fio, gmx_moltype_t *molt, gmx_bool bRead,
                        t_symtab *symtab, int file_version,
-                       gmx_groups_t *groups)
+                       gmx_groups_t *groups, gmx_off_t *ilistsOffset = NULL)
 {
     if (file_version >= 57)
     {
@@ -2593,7 +2666,15 @@ static void do_moltype(t_fileio *fio, gmx_moltype_t *molt, gmx_bool bRead,
 
     if (file_version >= 57)
     {
-        do_ilists(fio, molt->ilist, bRead, file_version);
+        if (ilistsOffset != NULL)
+        {
+            *ilistsOffset = gmx_fio_ftell(fio);
+            skip_ilists(fio, file_version);
+        }
+        else
+        {
+            do_ilists(fio, molt->ilist, bRead, file_version);
+        }
 
         do_block(fio, &molt->cgs, bRead, file_version);
     }
@@ -2777,12 +2858,29 @@ static void set_disres_npair(gmx_mtop_t *mtop)
     }
 }
 
+/* File offsets of the interaction parameters and lists skipped by do_mtop(),
+ * -1 for sections that are not present in the file.
+ */
+struct t_tpx_interaction_offsets
+{
+    gmx_off_t              iparams;              /* Interaction parameters      */
+    std::vector<gmx_off_t> moltypeIlists;        /* Lists of each molecule type */
+    gmx_off_t              intermolecularIlists; /* Intermolecular lists        */
+};
+
+/* When offsets!=NULL, the interaction parameters and lists are skipped
+ * and only their offsets are stored in offsets. This is only supported
+ * for reading files with version 57 or later.
+ */
 static void do_mtop(t_fileio *fio, gmx_mtop_t *mtop, gmx_bool bRead,
-                    int file_version)
+                    int file_version,
+                    t_tpx_interaction_offsets *offsets = NULL)
 {
     int            mt, mb;
     t_blocka       dumb;
 
+    GMX_RELEASE_ASSERT(offsets == NULL || (bRead && file_version >= 57),
+                       "Interactions can only be skipped when reading version 57 or later");
     if (bRead)
     {
         init_mtop(mtop);
@@ -2793,7 +2891,8 @@ static void do_mtop(t_fileio *fio, gmx_mtop_t *mtop, gmx_bool bRead,
 
     if (file_version >= 57)
     {
-        do_ffparams(fio, &mtop->ffparams, bRead, file_version);
+        do_ffparams(fio, &mtop->ffparams, bRead, file_version,
+                    offsets ? &offsets->iparams : NULL);
 
         gmx_fio_do_int(fio, mtop->nmoltype);
     }
@@ -2809,10 +2908,14 @@ static void do_mtop(t_fileio *fio, gmx_mtop_t *mtop, gmx_bool bRead,
             mtop->moltype[0].name = mtop->name;
         }
     }
+    if (offsets)
+    {
+        offsets->moltypeIlists.resize(mtop->nmoltype);
+    }
     for (mt = 0; mt < mtop->nmoltype; mt++)
     {
         do_moltype(fio, &mtop->moltype[mt], bRead, &mtop->symtab, file_version,
-                   &mtop->groups);
+                   &mtop->groups, offsets ? &offsets->moltypeIlists[mt] : NULL);
     }
 
     if (file_version >= 57)
@@ -2853,7 +2956,15 @@ static void do_mtop(t_fileio *fio, gmx_mtop_t *mtop, gmx_bool bRead,
             {
                 snew(mtop->intermolecular_ilist, F_NRE);
             }
-            do_ilists(fio, mtop->intermolecular_ilist, bRead, file_version);
+            if (offsets)
+            {
+                offsets->intermolecularIlists = gmx_fio_ftell(fio);
+                skip_ilists(fio, file_version);
+            }
+            else
+            {
+                do_ilists(fio, mtop->intermolecular_ilist, bRead, file_version);
+            }
         }
     }
     else
@@ -2927,12 +3038,15 @@ static void do_mtop(t_fileio *fio, gmx_mtop_t *mtop, gmx_bool bRead,
  * if the file is newer than the program.
  *
  * The version and generation of the topology (see top of this file)
- * are returned in the two last arguments, if those arguments are non-NULL.
+ * are returned in fileVersionPointer and fileGenerationPointer, and
+ * whether the file is in double precision in bDoublePointer, if those
+ * arguments are non-NULL.
  *
  * If possible, we will read the inputrec even when TopOnlyOK is TRUE.
  */
 static void do_tpxheader(t_fileio *fio, gmx_bool bRead, t_tpxheader *tpx,
-                         gmx_bool TopOnlyOK, int *fileVersionPointer, int *fileGenerationPointer)
+                         gmx_bool TopOnlyOK, int *fileVersionPointer, int *fileGenerationPointer,
+                         gmx_bool *bDoublePointer = NULL)
 {
     char      buf[STRLEN];
     char      file_tag[STRLEN];
@@ -3031,6 +3145,10 @@ static void do_tpxheader(t_fileio *fio, gmx_bool bRead, t_tpxheader *tpx,
     {
         *fileGenerationPointer = fileGeneration;
     }
+    if (bDoublePointer)
+    {
+        *bDoublePointer = bDouble;
+    }
 
     if ((fileVersion <= tpx_incompatible_version) ||
         ((fileVersion > tpx_version) && !TopOnlyOK) ||
@@ -3363,6 +3481,380 @@ int read_tpx_top(const char *fn,
     return ePBC;
 }
 
+namespace gmx
+{
+
+class TprReader::Impl
+{
+    public:
+        explicit Impl(const char *filename);
+        ~Impl();
+
+        //! Seeks to offset, with a fatal error on failure.
+        void seek(gmx_off_t offset);
+        //! Reads natoms rvecs from offset into x.
+        void readRVecs(gmx_off_t offset, std::vector<RVec> *x);
+        //! Reads the interaction parameters, if not done yet.
+        void readIparams();
+        //! Reads the interaction lists of molecule type \p mt, if not done yet.
+        void readIlists(int mt);
+        //! Reads all interaction parameters and lists, if not done yet.
+        void readInteractions();
+
+        t_fileio                  *fio_;
+        t_tpxheader                header_;
+        int                        fileVersion_;
+        int                        fileGeneration_;
+        matrix                     box_;
+        matrix                     boxRel_;
+        bool                       bHaveBoxRel_;
+        gmx_mtop_t                 mtop_;
+        t_tpx_interaction_offsets  offsets_;
+        bool                       bHaveIparams_;
+        std::vector<bool>          bHaveIlists_;
+        bool                       bHaveInteractions_;
+        bool                       bHaveInputrec_;
+        gmx_off_t                  xOffset_;
+        gmx_off_t                  vOffset_;
+        gmx_off_t                  irOffset_;
+        int                        ePBC_;
+        bool                       bHaveEPBC_;
+        std::vector<RVec>          x_;
+        std::vector<RVec>          v_;
+};
+
+TprReader::Impl::Impl(const char *filename)
+    : fio_(open_tpx(filename, "r")), header_(), fileVersion_(0), fileGeneration_(0),
+      bHaveBoxRel_(false), bHaveIparams_(true), bHaveInteractions_(true),
+      bHaveInputrec_(false), xOffset_(-1), vOffset_(-1), irOffset_(-1),
+      ePBC_(-1), bHaveEPBC_(false)
+{
+    gmx_bool bDouble = FALSE;
+
+    do_tpxheader(fio_, TRUE, &header_, TRUE, &fileVersion_, &fileGeneration_,
+                 &bDouble);
+
+    clear_mat(box_);
+    clear_mat(boxRel_);
+    if (header_.bBox)
+    {
+        matrix mdum;
+
+        gmx_fio_ndo_rvec(fio_, box_, DIM);
+        if (fileVersion_ >= 51)
+        {
+            gmx_fio_ndo_rvec(fio_, boxRel_, DIM);
+            bHaveBoxRel_ = true;
+        }
+        gmx_fio_ndo_rvec(fio_, mdum, DIM);
+        if (fileVersion_ < 56)
+        {
+            gmx_fio_ndo_rvec(fio_, mdum, DIM);
+        }
+    }
+    if (header_.ngtc > 0)
+    {
+        std::vector<real> dumv(header_.ngtc);
+        if (fileVersion_ < 69)
+        {
+            gmx_fio_ndo_real(fio_, dumv.data(), header_.ngtc);
+        }
+        gmx_fio_ndo_real(fio_, dumv.data(), header_.ngtc);
+    }
+
+    /* The topology has a variable size and needs to be read to find the
+     * sections after it. Only the interaction parameters and lists have
+     * sizes that can be computed without reading them, so those are
+     * skipped and read on first access. All later sections have sizes
+     * known from the header, so we only compute their offsets here.
+     * init_mtop() leaves the force-field parameters and atom types
+     * alone, so clear everything to make done_mtop() safe without a
+     * topology.
+     */
+    std::memset(&mtop_, 0, sizeof(mtop_));
+    init_mtop(&mtop_);
+    offsets_.iparams              = -1;
+    offsets_.intermolecularIlists = -1;
+    if (header_.bTop)
+    {
+        if (fileVersion_ >= 57)
+        {
+            do_mtop(fio_, &mtop_, TRUE, fileVersion_, &offsets_);
+            bHaveIparams_      = false;
+            bHaveIlists_.resize(mtop_.nmoltype, false);
+            bHaveInteractions_ = false;
+        }
+        else
+        {
+            /* Old files store the interactions after the atom types */
+            do_mtop(fio_, &mtop_, TRUE, fileVersion_);
+        }
+        gmx_mtop_finalize(&mtop_);
+    }
+
+    const gmx_off_t rvecsSize = static_cast<gmx_off_t>(header_.natoms)*DIM
+        *(bDouble ? sizeof(double) : sizeof(float));
+    gmx_off_t       offset    = gmx_fio_ftell(fio_);
+    if (header_.bX)
+    {
+        xOffset_ = offset;
+        offset  += rvecsSize;
+    }
+    if (header_.bV)
+    {
+        vOffset_ = offset;
+        offset  += rvecsSize;
+    }
+    if (header_.bF)
+    {
+        offset += rvecsSize;
+    }
+    if (header_.bIr)
+    {
+        irOffset_ = offset;
+    }
+}
+
+TprReader::Impl::~Impl()
+{
+    done_mtop(&mtop_);
+    close_tpx(fio_);
+}
+
+void TprReader::Impl::seek(gmx_off_t offset)
+{
+    if (gmx_fio_seek(fio_, offset) != 0)
+    {
+        gmx_file(gmx_fio_getname(fio_));
+    }
+}
+
+void TprReader::Impl::readRVecs(gmx_off_t offset, std::vector<RVec> *x)
+{
+    x->resize(header_.natoms);
+    seek(offset);
+    if (!gmx_fio_ndo_rvec(fio_, as_rvec_array(x->data()), header_.natoms))
+    {
+        gmx_file(gmx_fio_getname(fio_));
+    }
+}
+
+void TprReader::Impl::readIparams()
+{
+    if (!bHaveIparams_)
+    {
+        seek(offsets_.iparams);
+        for (int i = 0; i < mtop_.ffparams.ntypes; i++)
+        {
+            do_iparams(fio_, mtop_.ffparams.functype[i], &mtop_.ffparams.iparams[i],
+                       TRUE, fileVersion_);
+        }
+        bHaveIparams_ = true;
+    }
+}
+
+void TprReader::Impl::readIlists(int mt)
+{
+    if (!bHaveIlists_[mt])
+    {
+        seek(offsets_.moltypeIlists[mt]);
+        do_ilists(fio_, mtop_.moltype[mt].ilist, TRUE, fileVersion_);
+        bHaveIlists_[mt] = true;
+    }
+}
+
+void TprReader::Impl::readInteractions()
+{
+    if (!bHaveInteractions_)
+    {
+        readIparams();
+        for (int mt = 0; mt < mtop_.nmoltype; mt++)
+        {
+            readIlists(mt);
+        }
+        if (offsets_.intermolecularIlists >= 0)
+        {
+            seek(offsets_.intermolecularIlists);
+            do_ilists(fio_, mtop_.intermolecular_ilist, TRUE, fileVersion_);
+        }
+        if (bHaveInputrec_)
+        {
+            /* As read_tpx(), which only does this when reading the input record */
+            set_disres_npair(&mtop_);
+        }
+        bHaveInteractions_ = true;
+    }
+}
+
+TprReader::TprReader(const char *filename)
+    : impl_(new Impl(filename))
+{
+}
+
+TprReader::~TprReader()
+{
+}
+
+const t_tpxheader &TprReader::header() const
+{
+    return impl_->header_;
+}
+
+void TprReader::getBox(matrix box) const
+{
+    copy_mat(impl_->box_, box);
+}
+
+void TprReader::getBoxRel(matrix boxRel) const
+{
+    GMX_RELEASE_ASSERT(impl_->bHaveBoxRel_ || !impl_->header_.bBox,
+                       "The relative box of old run input files is only known after readInputrec()");
+    copy_mat(impl_->boxRel_, boxRel);
+}
+
+const gmx_mtop_t *TprReader::mtop()
+{
+    if (!impl_->header_.bTop)
+    {
+        return NULL;
+    }
+    impl_->readInteractions();
+    return &impl_->mtop_;
+}
+
+const gmx_mtop_t *TprReader::mtopWithoutInteractions() const
+{
+    return impl_->header_.bTop ? &impl_->mtop_ : NULL;
+}
+
+const gmx_ffparams_t &TprReader::ffparams()
+{
+    GMX_RELEASE_ASSERT(impl_->header_.bTop, "No topology in the run input file");
+    impl_->readIparams();
+    return impl_->mtop_.ffparams;
+}
+
+const t_ilist *TprReader::ilists(int moltype)
+{
+    GMX_RELEASE_ASSERT(impl_->header_.bTop, "No topology in the run input file");
+    GMX_RELEASE_ASSERT(moltype >= 0 && moltype < impl_->mtop_.nmoltype,
+                       "Molecule type out of range");
+    if (!impl_->bHaveInteractions_)
+    {
+        impl_->readIlists(moltype);
+    }
+    return impl_->mtop_.moltype[moltype].ilist;
+}
+
+void TprReader::releaseMtop(gmx_mtop_t *mtop)
+{
+    GMX_RELEASE_ASSERT(impl_->header_.bTop, "No topology in the run input file");
+    impl_->readInteractions();
+    *mtop = impl_->mtop_;
+    /* The caller now owns all the buffers, including those that
+     * init_mtop() does not reset, so none may be freed by done_mtop(). */
+    std::memset(&impl_->mtop_, 0, sizeof(impl_->mtop_));
+    init_mtop(&impl_->mtop_);
+    impl_->header_.bTop = FALSE;
+}
+
+int TprReader::ePBC()
+{
+    /* Old files store the PBC only inside the input record,
+     * we report it as unknown then, as read_tpx() does without
+     * an input record. */
+    if (!impl_->bHaveEPBC_ && impl_->irOffset_ >= 0 && impl_->fileVersion_ >= 53)
+    {
+        gmx_bool bPeriodicMols = FALSE;
+
+        impl_->seek(impl_->irOffset_);
+        gmx_fio_do_int(impl_->fio_, impl_->ePBC_);
+        gmx_fio_do_gmx_bool(impl_->fio_, bPeriodicMols);
+    }
+    impl_->bHaveEPBC_ = true;
+    return impl_->ePBC_;
+}
+
+void TprReader::readInputrec(t_inputrec *ir)
+{
+    if (impl_->irOffset_ < 0)
+    {
+        gmx_fatal(FARGS, "No input record in %s", gmx_fio_getname(impl_->fio_));
+    }
+    if (impl_->fileVersion_ > tpx_version)
+    {
+        /* The constructor only accepted this for reading the topology */
+        gmx_fatal(FARGS, "reading tpx file (%s) version %d with version %d program",
+                  gmx_fio_getname(impl_->fio_), impl_->fileVersion_, tpx_version);
+    }
+
+    int      ePBC          = -1;
+    gmx_bool bPeriodicMols = FALSE;
+    real     fudgeQQ       = 1;
+
+    impl_->seek(impl_->irOffset_);
+    if (impl_->fileVersion_ >= 53)
+    {
+        gmx_fio_do_int(impl_->fio_, ePBC);
+        gmx_fio_do_gmx_bool(impl_->fio_, bPeriodicMols);
+    }
+    do_inputrec(impl_->fio_, ir, TRUE, impl_->fileVersion_,
+                impl_->header_.bTop ? &impl_->mtop_.ffparams.fudgeQQ : &fudgeQQ);
+    if (impl_->fileVersion_ >= 53)
+    {
+        ir->ePBC          = ePBC;
+        ir->bPeriodicMols = bPeriodicMols;
+    }
+    impl_->ePBC_      = ir->ePBC;
+    impl_->bHaveEPBC_ = true;
+
+    if (!impl_->bHaveBoxRel_ && impl_->header_.bBox)
+    {
+        /* Old files do not store box_rel, do_tpx() computes it from
+         * the input record, which can also correct the box */
+        t_state state {};
+
+        copy_mat(impl_->box_, state.box);
+        set_box_rel(ir, &state);
+        copy_mat(state.box, impl_->box_);
+        copy_mat(state.box_rel, impl_->boxRel_);
+        impl_->bHaveBoxRel_ = true;
+    }
+
+    if (impl_->header_.bTop)
+    {
+        if (impl_->fileVersion_ < 57)
+        {
+            ir->eDisre = (impl_->mtop_.moltype[0].ilist[F_DISRES].nr > 0) ? edrSimple : edrNone;
+        }
+        if (impl_->bHaveInteractions_ && !impl_->bHaveInputrec_)
+        {
+            set_disres_npair(&impl_->mtop_);
+        }
+    }
+    impl_->bHaveInputrec_ = true;
+}
+
+ConstArrayRef<RVec> TprReader::x()
+{
+    if (impl_->x_.empty() && impl_->xOffset_ >= 0)
+    {
+        impl_->readRVecs(impl_->xOffset_, &impl_->x_);
+    }
+    return impl_->x_;
+}
+
+ConstArrayRef<RVec> TprReader::v()
+{
+    if (impl_->v_.empty() && impl_->vOffset_ >= 0)
+    {
+        impl_->readRVecs(impl_->vOffset_, &impl_->v_);
+    }
+    return impl_->v_;
+}
+
+} // namespace gmx
+
 gmx_bool fn2bTPX(const char *file)
 {
     return (efTPR == fn2ftp(file));
@@ -40,10 +40,14 @@
 #include <cstdio>
 
 #include "gromacs/mdtypes/state.h"
+#include "gromacs/utility/arrayref.h"
+#include "gromacs/utility/classhelpers.h"
 
+struct gmx_ffparams_t;
 struct gmx_mtop_t;
 struct t_atoms;
 struct t_block;
+struct t_ilist;
 struct t_inputrec;
 struct t_topology;
 
@@ -112,4 +116,87 @@ gmx_bool fn2bTPX(const char *file);
 
 void pr_tpxheader(FILE *fp, int indent, const char *title, const t_tpxheader *sh);
 
+namespace gmx
+{
+
+/*! \libinternal \brief
+ * Reads the sections of a run input file on demand.
+ *
+ * The constructor reads the header, the box and the compact topology
+ * description without its interaction parameters and lists, and computes
+ * the file offsets of those and of the coordinate, velocity and input
+ * record sections.  These sections are only read when first accessed,
+ * and are then cached.  Tools that only need the atoms of the topology
+ * thus avoid reading the interactions, coordinates and velocities of a
+ * large system.
+ *
+ * The file is kept open for the lifetime of the object.
+ * Errors in reading the file are fatal.
+ */
+class TprReader
+{
+    public:
+        //! Opens \p filename and reads the header and topology description.
+        explicit TprReader(const char *filename);
+        ~TprReader();
+
+        //! Returns the file header.
+        const t_tpxheader &header() const;
+        //! Copies the box from the file into \p box.
+        void getBox(matrix box) const;
+        /*! \brief
+         * Copies the relative box from the file into \p boxRel.
+         *
+         * Files older than version 51 do not store it, and it is only
+         * known after readInputrec() for those.
+         */
+        void getBoxRel(matrix boxRel) const;
+        /*! \brief
+         * Returns the topology, or NULL if the file has none.
+         *
+         * Reads all interaction parameters and lists that were not read yet.
+         */
+        const gmx_mtop_t *mtop();
+        /*! \brief
+         * Returns the topology without reading its interactions, or NULL
+         * if the file has none.
+         *
+         * The interaction parameters and lists are zero until read by
+         * ffparams(), ilists() or mtop().  The function types of the
+         * parameters are always set.
+         */
+        const gmx_mtop_t *mtopWithoutInteractions() const;
+        //! Returns the interaction parameters, read on first access.
+        const gmx_ffparams_t &ffparams();
+        //! Returns the interaction lists of \p moltype, read on first access.
+        const t_ilist *ilists(int moltype);
+        /*! \brief
+         * Moves the topology, with all its interactions, into \p mtop.
+         *
+         * Afterwards, mtop() returns NULL.
+         */
+        void releaseMtop(gmx_mtop_t *mtop);
+        //! Returns the PBC type, or -1 if not stored outside the input record.
+        int ePBC();
+        /*! \brief
+         * Reads the input record into \p ir.
+         *
+         * \p ir should be initialized as for read_tpx().  As in read_tpx(),
+         * the PBC type is set in \p ir, and the relative box is computed
+         * for old files that do not store it.
+         */
+        void readInputrec(t_inputrec *ir);
+        //! Returns the coordinates, read on first access (empty if none).
+        ConstArrayRef<RVec> x();
+        //! Returns the velocities, read on first access (empty if none).
+        ConstArrayRef<RVec> v();
+
+    private:
+        class Impl;
+
+        PrivateImplPointer<Impl> impl_;
+};
+
+} // namespace gmx
+
 #endif
@@ -38,17 +38,25 @@
 
 #include "xtcio.h"
 
+#include <cstdlib>
 #include <cstring>
 
+#include <algorithm>
+#include <vector>
+
 #include "gromacs/fileio/gmxfio.h"
 #include "gromacs/fileio/gmxfio-xdr.h"
 #include "gromacs/fileio/xdrf.h"
 #include "gromacs/math/vec.h"
 #include "gromacs/utility/fatalerror.h"
 #include "gromacs/utility/futil.h"
+#include "gromacs/utility/gmxomp.h"
 #include "gromacs/utility/smalloc.h"
 
 #define XTC_MAGIC 1995
+/* Magic number for frames whose coordinates are stored as a sequence of
+ * independently compressed atom blocks. Must match libxdrf.cpp. */
+#define XTC_BLOCKED_MAGIC 2017
 
 
 static int xdr_r2f(XDR *xdrs, real *r, gmx_bool gmx_unused bRead)
@@ -86,13 +94,25 @@ void close_xtc(t_fileio *fio)
 
 static void check_xtc_magic(int magic)
 {
-    if (magic != XTC_MAGIC)
+    if (magic != XTC_MAGIC && magic != XTC_BLOCKED_MAGIC)
     {
-        gmx_fatal(FARGS, "Magic Number Error in XTC file (read %d, should be %d)",
-                  magic, XTC_MAGIC);
+        gmx_fatal(FARGS, "Magic Number Error in XTC file (read %d, should be %d or %d)",
+                  magic, XTC_MAGIC, XTC_BLOCKED_MAGIC);
     }
 }
 
+/* Returns the atom block size requested with GMX_XTC_BLOCK_ATOMS,
+ * or 0 when frames should always use the classic layout. */
+static int xtc_env_block_size()
+{
+    static const int blockSize = []()
+        {
+            const char *env = getenv("GMX_XTC_BLOCK_ATOMS");
+            return (env != NULL) ? std::max(0, std::atoi(env)) : 0;
+        } ();
+    return blockSize;
+}
+
 static int xtc_check(const char *str, gmx_bool bResult, const char *file, int line)
 {
     if (!bResult)
@@ -196,11 +216,176 @@ static int xtc_coord(XDR *xd, int *natoms, rvec *box, rvec *x, real *prec, gmx_b
     return result;
 }
 
+/* Upper bound for the number of bytes xdr3dfcoord writes for n atoms */
+static unsigned int xtc_block_max_bytes(int n)
+{
+    /* Compressed data uses at most 1.2 ints per coordinate, the header
+     * with size, precision, bounds and bit counts is 10 ints. Small
+     * blocks are stored uncompressed with one float per coordinate. */
+    return static_cast<unsigned int>(sizeof(int)*(DIM*n*1.2 + 16));
+}
+
+/* Reads or writes the coordinates of a frame as nblocks independently
+ * compressed blocks of at most blockSize atoms each, in the classic
+ * xdr3dfcoord encoding. All block sizes are stored before the block
+ * data, so that all blocks can be read in one go and then decoded in
+ * parallel. Encoding is done in parallel into memory buffers.
+ */
+static int xtc_coord_blocked(XDR *xd, int *natoms, rvec *box, rvec *x, real *prec,
+                             int blockSize, gmx_bool bRead)
+{
+    int i, j, result;
+
+    result = 1;
+    for (i = 0; ((i < DIM) && result); i++)
+    {
+        for (j = 0; ((j < DIM) && result); j++)
+        {
+            result = XTC_CHECK("box", xdr_r2f(xd, &(box[i][j]), bRead));
+        }
+    }
+    if (result)
+    {
+        result = XTC_CHECK("block size", xdr_int(xd, &blockSize));
+    }
+    if (result)
+    {
+        result = XTC_CHECK("precision", xdr_r2f(xd, prec, bRead));
+    }
+    if (!result)
+    {
+        return result;
+    }
+    if (blockSize <= 0)
+    {
+        return XTC_CHECK("block size", FALSE);
+    }
+
+    const int                 nblocks = (*natoms + blockSize - 1)/blockSize;
+    std::vector<unsigned int> blockBytes(nblocks);
+    std::vector<int>          blockOk(nblocks, 1);
+    std::vector<float>        fx(DIM*(*natoms));
+
+    if (!bRead)
+    {
+        for (i = 0; i < *natoms; i++)
+        {
+            fx[DIM*i+XX] = x[i][XX];
+            fx[DIM*i+YY] = x[i][YY];
+            fx[DIM*i+ZZ] = x[i][ZZ];
+        }
+    }
+
+    /* The blocks are stored contiguously, each padded to whole XDR units */
+    std::vector<size_t> blockStart(nblocks + 1, 0);
+    std::vector<char>   data;
+    if (!bRead)
+    {
+        for (int b = 0; b < nblocks; b++)
+        {
+            int n             = std::min(blockSize, *natoms - b*blockSize);
+            blockStart[b + 1] = blockStart[b] + xtc_block_max_bytes(n);
+        }
+        data.resize(blockStart[nblocks]);
+    }
+    else
+    {
+        for (int b = 0; b < nblocks && result; b++)
+        {
+            result = XTC_CHECK("block bytes", xdr_u_int(xd, &blockBytes[b]));
+        }
+        if (!result)
+        {
+            return result;
+        }
+        for (int b = 0; b < nblocks; b++)
+        {
+            blockStart[b + 1] = blockStart[b] + ((blockBytes[b] + 3) & ~3U);
+        }
+        data.resize(blockStart[nblocks]);
+        result = XTC_CHECK("blocks", xdr_opaque(xd, data.data(), static_cast<unsigned int>(blockStart[nblocks])));
+        if (!result)
+        {
+            return result;
+        }
+    }
+
+    const int nthreads = std::min(gmx_omp_get_max_threads(), nblocks);
+#pragma omp parallel for num_threads(nthreads) schedule(dynamic)
+    for (int b = 0; b < nblocks; b++)
+    {
+        XDR   xdrBlock;
+        int   n         = std::min(blockSize, *natoms - b*blockSize);
+        float blockPrec = *prec;
+
+        xdrmem_create(&xdrBlock, &data[blockStart[b]],
+                      static_cast<unsigned int>(blockStart[b + 1] - blockStart[b]),
+                      bRead ? XDR_DECODE : XDR_ENCODE);
+        blockOk[b] = xdr3dfcoord(&xdrBlock, &fx[DIM*b*blockSize], &n, &blockPrec);
+        if (bRead)
+        {
+            blockOk[b] = (blockOk[b] && n == std::min(blockSize, *natoms - b*blockSize));
+        }
+        else
+        {
+            blockBytes[b] = xdr_getpos(&xdrBlock);
+        }
+        xdr_destroy(&xdrBlock);
+    }
+    for (int b = 0; b < nblocks && result; b++)
+    {
+        result = XTC_CHECK("x", blockOk[b]);
+    }
+
+    if (!bRead)
+    {
+        for (int b = 0; b < nblocks && result; b++)
+        {
+            result = XTC_CHECK("block bytes", xdr_u_int(xd, &blockBytes[b]));
+        }
+        for (int b = 0; b < nblocks && result; b++)
+        {
+            result = XTC_CHECK("x", xdr_opaque(xd, &data[blockStart[b]], blockBytes[b]));
+        }
+    }
+    else if (result)
+    {
+        for (i = 0; i < *natoms; i++)
+        {
+            x[i][XX] = fx[DIM*i+XX];
+            x[i][YY] = fx[DIM*i+YY];
+            x[i][ZZ] = fx[DIM*i+ZZ];
+        }
+    }
+
+    return result;
+}
+
+/* Reads the coordinates in the layout indicated by magic */
+static int xtc_read_coord(XDR *xd, int magic, int *natoms, rvec *box, rvec *x, real *prec)
+{
+    if (magic == XTC_BLOCKED_MAGIC)
+    {
+        /* The block size is read from the file */
+        return xtc_coord_blocked(xd, natoms, box, x, prec, 1, TRUE);
+    }
+    return xtc_coord(xd, natoms, box, x, prec, TRUE);
+}
+
 
 
 int write_xtc(t_fileio *fio,
               int natoms, gmx_int64_t step, real time,
               const rvec *box, const rvec *x, real prec)
+{
+    return write_xtc_blocked(fio, natoms, step, time, box, x, prec,
+                             xtc_env_block_size());
+}
+
+int write_xtc_blocked(t_fileio *fio,
+                      int natoms, gmx_int64_t step, real time,
+                      const rvec *box, const rvec *x, real prec,
+                      int atomsPerBlock)
 {
     int      magic_number = XTC_MAGIC;
     XDR     *xd;
@@ -215,6 +400,13 @@ int write_xtc(t_fileio *fio,
         return 1;
     }
 
+    /* Frames that fit in a single block use the classic layout */
+    const gmx_bool bBlocked = (atomsPerBlock > 0 && natoms > atomsPerBlock);
+    if (bBlocked)
+    {
+        magic_number = XTC_BLOCKED_MAGIC;
+    }
+
     xd = gmx_fio_getxdr(fio);
     /* write magic number and xtc identidier */
     if (xtc_header(xd, &magic_number, &natoms, &step, &time, FALSE, &bDum) == 0)
@@ -223,7 +415,14 @@ int write_xtc(t_fileio *fio,
     }
 
     /* write data */
-    bOK = xtc_coord(xd, &natoms, const_cast<rvec *>(box), const_cast<rvec *>(x), &prec, FALSE); /* bOK will be 1 if writing went well */
+    if (bBlocked)
+    {
+        bOK = xtc_coord_blocked(xd, &natoms, const_cast<rvec *>(box), const_cast<rvec *>(x), &prec, atomsPerBlock, FALSE);
+    }
+    else
+    {
+        bOK = xtc_coord(xd, &natoms, const_cast<rvec *>(box), const_cast<rvec *>(x), &prec, FALSE); /* bOK will be 1 if writing went well */
+    }
 
     if (bOK)
     {
@@ -255,7 +454,7 @@ int read_first_xtc(t_fileio *fio, int *natoms, gmx_int64_t *step, real *time,
 
     snew(*x, *natoms);
 
-    *bOK = xtc_coord(xd, natoms, box, *x, prec, TRUE);
+    *bOK = xtc_read_coord(xd, magic, natoms, box, *x, prec);
 
     return *bOK;
 }
@@ -286,7 +485,8 @@ int read_next_xtc(t_fileio* fio,
                   n, natoms);
     }
 
-    *bOK = xtc_coord(xd, &natoms, box, x, prec, TRUE);
+    /* Blocked frames are split according to the actual number of atoms */
+    *bOK = xtc_read_coord(xd, magic, (magic == XTC_BLOCKED_MAGIC) ? &n : &natoms, box, x, prec);
 
     return *bOK;
 }
@@ -78,7 +78,23 @@ int read_next_xtc(struct t_fileio *fio,
 int write_xtc(struct t_fileio *fio,
               int natoms, gmx_int64_t step, real time,
               const rvec *box, const rvec *x, real prec);
-/* Write a frame to xtc file */
+/* Write a frame to xtc file.
+ * When the environment variable GMX_XTC_BLOCK_ATOMS is set to a positive
+ * value, frames with more atoms are written as with write_xtc_blocked.
+ */
+
+int write_xtc_blocked(struct t_fileio *fio,
+                      int natoms, gmx_int64_t step, real time,
+                      const rvec *box, const rvec *x, real prec,
+                      int atomsPerBlock);
+/* Write a frame to xtc file, splitting the coordinates into blocks
+ * of atomsPerBlock atoms that are compressed independently and in
+ * parallel using OpenMP. Reading such frames also decodes the blocks
+ * in parallel. Frames with at most atomsPerBlock atoms, or with
+ * atomsPerBlock <= 0, are written in the classic xtc layout.
+ * Note that blocked frames can only be read by GROMACS versions
+ * that support this extension.
+ */
 
 #ifdef __cplusplus
 }
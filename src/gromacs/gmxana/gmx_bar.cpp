@@ -3165,6 +3165,11 @@ static void read_barsim_edr(char *fn, real *temp, sim_data_t *sd)
     fp = open_enx(fn, "r");
     do_enxnms(fp, &nre, &enm);
     snew(fr, 1);
+    /* We only need the free-energy blocks, skip everything else */
+    {
+        const int block_ids[] = { enxDHCOLL, enxDHHIST, enxDH };
+        enx_set_read_selection(fp, 0, NULL, asize(block_ids), block_ids);
+    }
 
     snew(native_lambda, 1);
     start_lambda.lc = NULL;
@@ -50,6 +50,7 @@
 #include "gromacs/fileio/xvgr.h"
 #include "gromacs/gmxana/cmat.h"
 #include "gromacs/gmxana/gmx_ana.h"
+#include "gromacs/gmxana/rmsdtiles.h"
 #include "gromacs/linearalgebra/eigensolver.h"
 #include "gromacs/math/do_fit.h"
 #include "gromacs/math/vec.h"
@@ -64,6 +65,7 @@
 #include "gromacs/utility/cstringutil.h"
 #include "gromacs/utility/fatalerror.h"
 #include "gromacs/utility/futil.h"
+#include "gromacs/utility/gmxomp.h"
 #include "gromacs/utility/smalloc.h"
 
 /* print to two file pointers at once (i.e. stderr and log) */
@@ -476,15 +478,34 @@ gmx_bool jp_same(int **nnb, int i, int j, int P)
     return (pp >= P);
 }
 
-static void jarvis_patrick(int n1, real **mat, int M, int P,
+/* Prepare the rows of the RMSD matrix starting at i0 for matrix_row(),
+ * returns the end of the rows. With a tiled matrix these are the rows
+ * of one band, otherwise all rows of the in-memory matrix.
+ */
+static int read_matrix_rows(gmx_rmsd_tiles_t *rt, int n1, int i0)
+{
+    if (rt == NULL)
+    {
+        return n1;
+    }
+    gmx_rmsd_tiles_read_band(rt, i0 >> GMX_RMSD_TILE_SHIFT);
+
+    return std::min(n1, i0 + GMX_RMSD_TILE);
+}
+
+static gmx_inline
+const real *matrix_row(real **mat, gmx_rmsd_tiles_t *rt, int i)
+{
+    return (rt != NULL) ? rt->row[i & (GMX_RMSD_TILE - 1)] : mat[i];
+}
+
+static void jarvis_patrick(int n1, real **mat, gmx_rmsd_tiles_t *rt, int M, int P,
                            real rmsdcut, t_clusters *clust)
 {
-    t_dist     *row;
     t_clustid  *c;
-    int       **nnb;
-    int         i, j, k, cid, diff, maxval;
+    int       **nnb, **link;
+    int         i, i0, i1, j, k, cid, diff, nthreads;
     gmx_bool    bChange;
-    real      **mcpy = NULL;
 
     if (rmsdcut < 0)
     {
@@ -495,55 +516,69 @@ static void jarvis_patrick(int n1, real **mat, int M, int P,
      * This gives us the nearest neighbor list.
      */
     snew(nnb, n1);
-    snew(row, n1);
-    for (i = 0; (i < n1); i++)
+    nthreads = gmx_omp_get_max_threads();
+    for (i0 = 0; i0 < n1; i0 = i1)
     {
-        for (j = 0; (j < n1); j++)
+        i1 = read_matrix_rows(rt, n1, i0);
+#pragma omp parallel num_threads(nthreads) private(j, k)
         {
-            row[j].j    = j;
-            row[j].dist = mat[i][j];
-        }
-        std::sort(row, row+n1, rms_dist_comp);
-        if (M > 0)
-        {
-            /* Put the M nearest neighbors in the list */
-            snew(nnb[i], M+1);
-            for (j = k = 0; (k < M) && (j < n1) && (mat[i][row[j].j] < rmsdcut); j++)
+            t_dist *row;
+            int     maxval;
+
+            snew(row, n1);
+#pragma omp for schedule(dynamic, 16)
+            for (i = i0; i < i1; i++)
             {
-                if (row[j].j  != i)
+                const real *mati = matrix_row(mat, rt, i);
+
+                for (j = 0; (j < n1); j++)
                 {
-                    nnb[i][k]  = row[j].j;
-                    k++;
+                    row[j].j    = j;
+                    row[j].dist = mati[j];
                 }
-            }
-            nnb[i][k] = -1;
-        }
-        else
-        {
-            /* Put all neighbors nearer than rmsdcut in the list */
-            maxval = 0;
-            k      = 0;
-            for (j = 0; (j < n1) && (mat[i][row[j].j] < rmsdcut); j++)
-            {
-                if (row[j].j != i)
+                std::sort(row, row+n1, rms_dist_comp);
+                if (M > 0)
                 {
-                    if (k >= maxval)
+                    /* Put the M nearest neighbors in the list */
+                    snew(nnb[i], M+1);
+                    for (j = k = 0; (k < M) && (j < n1) && (mati[row[j].j] < rmsdcut); j++)
                     {
-                        maxval += 10;
-                        srenew(nnb[i], maxval);
+                        if (row[j].j  != i)
+                        {
+                            nnb[i][k]  = row[j].j;
+                            k++;
+                        }
                     }
-                    nnb[i][k] = row[j].j;
-                    k++;
+                    nnb[i][k] = -1;
+                }
+                else
+                {
+                    /* Put all neighbors nearer than rmsdcut in the list */
+                    maxval = 0;
+                    k      = 0;
+                    for (j = 0; (j < n1) && (mati[row[j].j] < rmsdcut); j++)
+                    {
+                        if (row[j].j != i)
+                        {
+                            if (k >= maxval)
+                            {
+                                maxval += 10;
+                                srenew(nnb[i], maxval);
+                            }
+                            nnb[i][k] = row[j].j;
+                            k++;
+                        }
+                    }
+                    if (k == maxval)
+                    {
+                        srenew(nnb[i], maxval+1);
+                    }
+                    nnb[i][k] = -1;
                 }
             }
-            if (k == maxval)
-            {
-                srenew(nnb[i], maxval+1);
-            }
-            nnb[i][k] = -1;
+            sfree(row);
         }
     }
-    sfree(row);
     if (debug)
     {
         fprintf(debug, "Nearest neighborlist. M = %d, P = %d\n", M, P);
@@ -552,7 +587,14 @@ static void jarvis_patrick(int n1, real **mat, int M, int P,
             fprintf(debug, "i:%5d nbs:", i);
             for (j = 0; nnb[i][j] >= 0; j++)
             {
-                fprintf(debug, "%5d[%5.3f]", nnb[i][j], mat[i][nnb[i][j]]);
+                if (rt == NULL)
+                {
+                    fprintf(debug, "%5d[%5.3f]", nnb[i][j], mat[i][nnb[i][j]]);
+                }
+                else
+                {
+                    fprintf(debug, "%5d", nnb[i][j]);
+                }
             }
             fprintf(debug, "\n");
         }
@@ -560,14 +602,28 @@ static void jarvis_patrick(int n1, real **mat, int M, int P,
 
     c = new_clustid(n1);
     fprintf(stderr, "Linking structures ");
-    /* Use mcpy for temporary storage of booleans */
-    mcpy = mk_matrix(n1, n1, FALSE);
+    /* Structures can only be linked to their own neighbors, so store for
+     * each structure the later structures it is linked to, in order.
+     */
+    snew(link, n1);
     for (i = 0; i < n1; i++)
     {
-        for (j = i+1; j < n1; j++)
+        k = 0;
+        while (nnb[i][k] >= 0)
         {
-            mcpy[i][j] = jp_same(nnb, i, j, P);
+            k++;
+        }
+        snew(link[i], k+1);
+        k = 0;
+        for (j = 0; nnb[i][j] >= 0; j++)
+        {
+            if (nnb[i][j] > i && jp_same(nnb, i, nnb[i][j], P))
+            {
+                link[i][k++] = nnb[i][j];
+            }
         }
+        std::sort(link[i], link[i]+k);
+        link[i][k] = -1;
     }
     do
     {
@@ -575,22 +631,20 @@ static void jarvis_patrick(int n1, real **mat, int M, int P,
         bChange = FALSE;
         for (i = 0; i < n1; i++)
         {
-            for (j = i+1; j < n1; j++)
+            for (k = 0; link[i][k] >= 0; k++)
             {
-                if (mcpy[i][j])
+                j    = link[i][k];
+                diff = c[j].clust - c[i].clust;
+                if (diff)
                 {
-                    diff = c[j].clust - c[i].clust;
-                    if (diff)
+                    bChange = TRUE;
+                    if (diff > 0)
                     {
-                        bChange = TRUE;
-                        if (diff > 0)
-                        {
-                            c[j].clust = c[i].clust;
-                        }
-                        else
-                        {
-                            c[i].clust = c[j].clust;
-                        }
+                        c[j].clust = c[i].clust;
+                    }
+                    else
+                    {
+                        c[i].clust = c[j].clust;
                     }
                 }
             }
@@ -631,14 +685,14 @@ static void jarvis_patrick(int n1, real **mat, int M, int P,
         }
     }
 
-    done_matrix(n1, &mcpy);
-
     sfree(c);
     for (i = 0; (i < n1); i++)
     {
         sfree(nnb[i]);
+        sfree(link[i]);
     }
     sfree(nnb);
+    sfree(link);
 }
 
 static void dump_nnb (FILE *fp, const char *title, int n1, t_nnb *nnb)
@@ -658,43 +712,48 @@ static void dump_nnb (FILE *fp, const char *title, int n1, t_nnb *nnb)
     }
 }
 
-static void gromos(int n1, real **mat, real rmsdcut, t_clusters *clust)
+static void gromos(int n1, real **mat, gmx_rmsd_tiles_t *rt, real rmsdcut, t_clusters *clust)
 {
-    t_dist *row;
     t_nnb  *nnb;
-    int     i, j, k, j1, maxval;
+    int     i, i0, i1, j, k, j1, maxval, nthreads;
 
     /* Put all neighbors nearer than rmsdcut in the list */
     fprintf(stderr, "Making list of neighbors within cutoff ");
     snew(nnb, n1);
-    snew(row, n1);
-    for (i = 0; (i < n1); i++)
+    nthreads = gmx_omp_get_max_threads();
+    for (i0 = 0; i0 < n1; i0 = i1)
     {
-        maxval = 0;
-        k      = 0;
-        /* put all neighbors within cut-off in list */
-        for (j = 0; j < n1; j++)
+        i1 = read_matrix_rows(rt, n1, i0);
+#pragma omp parallel for num_threads(nthreads) private(j, k, maxval) schedule(dynamic, 16)
+        for (i = i0; i < i1; i++)
         {
-            if (mat[i][j] < rmsdcut)
+            const real *mati = matrix_row(mat, rt, i);
+
+            maxval = 0;
+            k      = 0;
+            /* put all neighbors within cut-off in list */
+            for (j = 0; j < n1; j++)
             {
-                if (k >= maxval)
+                if (mati[j] < rmsdcut)
                 {
-                    maxval += 10;
-                    srenew(nnb[i].nb, maxval);
+                    if (k >= maxval)
+                    {
+                        maxval += 10;
+                        srenew(nnb[i].nb, maxval);
+                    }
+                    nnb[i].nb[k] = j;
+                    k++;
                 }
-                nnb[i].nb[k] = j;
-                k++;
             }
-        }
-        /* store nr of neighbors, we'll need that */
-        nnb[i].nr = k;
-        if (i%(1+n1/100) == 0)
-        {
-            fprintf(stderr, "%3d%%\b\b\b\b", (i*100+1)/n1);
+            /* store nr of neighbors, we'll need that */
+            nnb[i].nr = k;
+            if (gmx_omp_get_thread_num() == 0 && i%(1+n1/100) == 0)
+            {
+                fprintf(stderr, "%3d%%\b\b\b\b", (i*100+1)/n1);
+            }
         }
     }
     fprintf(stderr, "%3d%%\n", 100);
-    sfree(row);
 
     /* sort neighbor list on number of neighbors, largest first */
     std::sort(nnb, nnb+n1, nrnb_comp);
@@ -981,7 +1040,42 @@ static void ana_trans(t_clusters *clust, int nf,
     sfree(axis);
 }
 
-static void analyze_clusters(int nf, t_clusters *clust, real **rmsd,
+/* Compute for every structure the sum of its RMSD values to the other
+ * structures in its cluster, reading the rows of the tiled matrix once.
+ */
+static void cluster_rmsd_sums(int nf, const t_clusters *clust, gmx_rmsd_tiles_t *rt,
+                              real *sum)
+{
+    int i, i0, i1, j, nthreads;
+
+    nthreads = gmx_omp_get_max_threads();
+    for (i0 = 0; i0 < nf; i0 = i1)
+    {
+        i1 = read_matrix_rows(rt, nf, i0);
+#pragma omp parallel for num_threads(nthreads) private(j) schedule(static)
+        for (i = i0; i < i1; i++)
+        {
+            const real *row = matrix_row(NULL, rt, i);
+
+            sum[i] = 0;
+            for (j = 0; j < nf; j++)
+            {
+                if (clust->cl[j] == clust->cl[i])
+                {
+                    sum[i] += row[j];
+                }
+            }
+        }
+    }
+}
+
+/* Return the RMSD of structures i < j from the in-memory or tiled matrix */
+static real cluster_rmsd(real **rmsd, gmx_rmsd_tiles_t *rt, int i, int j)
+{
+    return (rmsd != NULL) ? rmsd[i][j] : gmx_rmsd_tiles_get(rt, i, j);
+}
+
+static void analyze_clusters(int nf, t_clusters *clust, real **rmsd, gmx_rmsd_tiles_t *rt,
                              int natom, t_atoms *atoms, rvec *xtps,
                              real *mass, rvec **xx, real *time,
                              int ifsize, int *fitidx,
@@ -999,7 +1093,7 @@ static void analyze_clusters(int nf, t_clusters *clust, real **rmsd,
     t_trxstatus *trxsout = NULL;
     int          i, i1, cl, nstr, *structure, first = 0, midstr;
     gmx_bool    *bWrite = NULL;
-    real         r, clrmsd, midrmsd;
+    real         r, clrmsd, midrmsd, *rmsdsum = NULL;
     rvec        *xav = NULL;
     matrix       zerobox;
 
@@ -1089,6 +1183,11 @@ static void analyze_clusters(int nf, t_clusters *clust, real **rmsd,
             fprintf(size_fp, "@g%d type %s\n", 0, "bar");
         }
     }
+    if (rmsd == NULL)
+    {
+        snew(rmsdsum, nf);
+        cluster_rmsd_sums(nf, clust, rt, rmsdsum);
+    }
     snew(structure, nf);
     fprintf(log, "\n%3s | %3s  %4s | %6s %4s | cluster members\n",
             "cl.", "#st", "rmsd", "middle", "rmsd");
@@ -1145,15 +1244,22 @@ static void analyze_clusters(int nf, t_clusters *clust, real **rmsd,
             r = 0;
             if (nstr > 1)
             {
-                for (i = 0; i < nstr; i++)
+                if (rmsdsum != NULL)
                 {
-                    if (i < i1)
-                    {
-                        r += rmsd[structure[i]][structure[i1]];
-                    }
-                    else
+                    r = rmsdsum[structure[i1]];
+                }
+                else
+                {
+                    for (i = 0; i < nstr; i++)
                     {
-                        r += rmsd[structure[i1]][structure[i]];
+                        if (i < i1)
+                        {
+                            r += rmsd[structure[i]][structure[i1]];
+                        }
+                        else
+                        {
+                            r += rmsd[structure[i1]][structure[i]];
+                        }
                     }
                 }
                 r /= (nstr - 1);
@@ -1227,7 +1333,7 @@ static void analyze_clusters(int nf, t_clusters *clust, real **rmsd,
                         {
                             if (bWrite[i1])
                             {
-                                bWrite[i] = rmsd[structure[i1]][structure[i]] > rmsmin;
+                                bWrite[i] = cluster_rmsd(rmsd, rt, structure[i1], structure[i]) > rmsmin;
                             }
                         }
                     }
@@ -1276,6 +1382,7 @@ static void analyze_clusters(int nf, t_clusters *clust, real **rmsd,
         }
     }
     sfree(structure);
+    sfree(rmsdsum);
     if (trxsfn)
     {
         sfree(trxsfn);
@@ -1315,6 +1422,99 @@ static void convert_mat(t_matrix *mat, t_mat *rms)
     rms->nn = mat->nx;
 }
 
+/* Return where to store the RMSD of structures i < j */
+static gmx_inline
+real *rmsd_entry(t_mat *rms, gmx_rmsd_tiles_t *rt, int i, int j)
+{
+    return (rt != NULL) ? gmx_rmsd_tiles_entry(rt, i, j) : &rms->mat[i][j];
+}
+
+/* Add the computed rows b1 up to b2 to the statistics of the in-memory
+ * matrix, or write the band of the tiled matrix once it is complete.
+ */
+static void finish_rmsd_rows(t_mat *rms, gmx_rmsd_tiles_t *rt, int nf, int b1, int b2)
+{
+    int i1, i2;
+
+    if (rt == NULL)
+    {
+        for (i1 = b1; i1 < b2; i1++)
+        {
+            for (i2 = i1+1; i2 < nf; i2++)
+            {
+                set_mat_entry(rms, i1, i2, rms->mat[i1][i2]);
+            }
+        }
+    }
+    else if (b2 == std::min(nf, (rt->band + 1)*GMX_RMSD_TILE))
+    {
+        gmx_rmsd_tiles_write_band(rt);
+    }
+}
+
+/* Write the RMSD distribution like rmsd_distribution(), reading the
+ * rows of the tiled matrix once.
+ */
+static void rmsd_tiles_distribution(const char *fn, gmx_rmsd_tiles_t *rt,
+                                    const gmx_output_env_t *oenv)
+{
+    FILE *fp;
+    int   i, i0, i1, j, x, *histo;
+    real  fac;
+
+    fac = 100/rt->maxrms;
+    snew(histo, 101);
+    for (i0 = 0; i0 < rt->nn; i0 = i1)
+    {
+        i1 = read_matrix_rows(rt, rt->nn, i0);
+        for (i = i0; i < i1; i++)
+        {
+            const real *row = matrix_row(NULL, rt, i);
+
+            for (j = i+1; j < rt->nn; j++)
+            {
+                x = static_cast<int>(fac*row[j]+0.5);
+                if (x <= 100)
+                {
+                    histo[x]++;
+                }
+            }
+        }
+    }
+
+    fp = xvgropen(fn, "RMS Distribution", "RMS (nm)", "a.u.", oenv);
+    for (i = 0; (i < 101); i++)
+    {
+        fprintf(fp, "%10g  %10d\n", i/fac, histo[i]);
+    }
+    xvgrclose(fp);
+    sfree(histo);
+}
+
+/* Read the whole tiled matrix into memory */
+static t_mat *read_rmsd_tiles(gmx_rmsd_tiles_t *rt)
+{
+    t_mat *rms;
+    int    i, i0, i1, j;
+
+    rms = init_mat(rt->nn, FALSE);
+    for (i0 = 0; i0 < rt->nn; i0 = i1)
+    {
+        i1 = read_matrix_rows(rt, rt->nn, i0);
+        for (i = i0; i < i1; i++)
+        {
+            const real *row = matrix_row(NULL, rt, i);
+
+            for (j = i+1; j < rt->nn; j++)
+            {
+                set_mat_entry(rms, i, j, row[j]);
+            }
+        }
+    }
+
+    return rms;
+}
+
 int gmx_cluster(int argc, char *argv[])
 {
     const char        *desc[] = {
@@ -1361,6 +1561,14 @@ int gmx_cluster(int argc, char *argv[])
         "file. When writing all structures, separate numbered files are made",
         "for each cluster.[PAR]",
 
+        "With [TT]-tiles[tt] the RMSD matrix computed from a trajectory is",
+        "stored in tiles in the given file instead of in memory, and the",
+        "gromos and Jarvis Patrick methods read it back one band of rows at",
+        "a time, so more structures can be clustered than would fit in",
+        "memory with the whole matrix. The [TT]-o[tt] matrix is then only written",
+        "when that option is set explicitly, since it needs the whole matrix",
+        "in memory.[PAR]",
+
         "Two output files are always written:",
         "",
         " * [TT]-o[tt] writes the RMSD values in the upper left half of the matrix",
@@ -1393,14 +1601,16 @@ int gmx_cluster(int argc, char *argv[])
     };
 
     FILE              *fp, *log;
-    int                nf, i, i1, i2, j;
+    int                nf, i, i1, i2, j, b1, b2, nthreads, nblock;
     gmx_int64_t        nrms = 0;
 
     matrix             box;
-    rvec              *xtps, *usextps, *x1, **xx = NULL;
+    rvec              *xtps, *usextps, **xx = NULL;
     const char        *fn, *trx_out_fn;
     t_clusters         clust;
-    t_mat             *rms, *orig = NULL;
+    t_mat             *rms = NULL, *orig = NULL;
+    gmx_rmsd_tiles_t  *rt  = NULL;
+    real               minrms, maxrms, sumrms, emat;
     real              *eigenvalues;
     t_topology         top;
     int                ePBC;
@@ -1411,9 +1621,10 @@ int gmx_cluster(int argc, char *argv[])
     int                isize = 0, ifsize = 0, iosize = 0;
     int               *index = NULL, *fitidx = NULL, *outidx = NULL;
     char              *grpname;
-    real               rmsd, **d1, **d2, *time = NULL, time_invfac, *mass = NULL;
+    real            ***d1, ***d2, *time = NULL, time_invfac, *mass = NULL;
     char               buf[STRLEN], buf1[80], title[STRLEN];
     gmx_bool           bAnalyze, bUseRmsdCut, bJP_RMSD = FALSE, bReadMat, bReadTraj, bPBC = TRUE;
+    gmx_bool           bTiles;
 
     int                method, ncluster = 0;
     static const char *methodname[] = {
@@ -1489,6 +1700,7 @@ int gmx_cluster(int argc, char *argv[])
         { efNDX, NULL,     NULL,        ffOPTRD },
         { efXPM, "-dm",   "rmsd",       ffOPTRD },
         { efXPM, "-om",   "rmsd-raw",   ffWRITE },
+        { efDAT, "-tiles", "rmsd-tiles", ffOPTWR },
         { efXPM, "-o",    "rmsd-clust", ffWRITE },
         { efLOG, "-g",    "cluster",    ffWRITE },
         { efXVG, "-dist", "rmsd-dist",  ffOPTWR },
@@ -1551,6 +1763,15 @@ int gmx_cluster(int argc, char *argv[])
     bAnalyze = (method == m_linkage || method == m_jarvis_patrick ||
                 method == m_gromos );
 
+    bTiles = opt2bSet("-tiles", NFILE, fnm);
+    if (bTiles && (bReadMat || bBinary ||
+                   (method != m_gromos && method != m_jarvis_patrick)))
+    {
+        gmx_fatal(FARGS, "Option -tiles can only be used with the gromos and "
+                  "jarvis-patrick methods without -binary, when computing the "
+                  "RMSD matrix from a trajectory");
+    }
+
     /* Open log file */
     log = ftp2FILE(efLOG, NFILE, fnm, "w");
 
@@ -1728,83 +1949,169 @@ int gmx_cluster(int argc, char *argv[])
     }
     else   /* !bReadMat */
     {
-        rms  = init_mat(nf, method == m_diagonalize);
+        if (bTiles)
+        {
+            rt = gmx_rmsd_tiles_init(opt2fn("-tiles", NFILE, fnm), nf);
+        }
+        else
+        {
+            rms = init_mat(nf, method == m_diagonalize);
+        }
         nrms = (static_cast<gmx_int64_t>(nf)*static_cast<gmx_int64_t>(nf-1))/2;
         if (!bRMSdist)
         {
             fprintf(stderr, "Computing %dx%d RMS deviation matrix\n", nf, nf);
-            /* Initialize work array */
-            snew(x1, isize);
-            for (i1 = 0; i1 < nf; i1++)
+            /* The frames have been centered above, so with fitting we can
+             * obtain the RMSD after superposition directly from the
+             * quaternion characteristic polynomial, without rotating
+             * a copy of the coordinates. Rows are computed in blocks
+             * distributed over threads; the statistics in rms are
+             * accumulated afterwards, since set_mat_entry is not thread-safe.
+             * With a tiled matrix the blocks stay within a band of tiles.
+             */
+            nthreads = gmx_omp_get_max_threads();
+            for (b1 = 0; b1 < nf; b1 = b2)
             {
-                for (i2 = i1+1; i2 < nf; i2++)
+                b2 = std::min(nf, b1 + 4*nthreads);
+                if (rt != NULL)
                 {
-                    for (i = 0; i < isize; i++)
-                    {
-                        copy_rvec(xx[i1][i], x1[i]);
-                    }
-                    if (bFit)
+                    b2 = std::min(b2, (rt->band + 1)*GMX_RMSD_TILE);
+                }
+#pragma omp parallel for num_threads(nthreads) schedule(dynamic)
+                for (int r1 = b1; r1 < b2; r1++)
+                {
+                    for (int r2 = r1+1; r2 < nf; r2++)
                     {
-                        do_fit(isize, mass, xx[i2], x1);
+                        real rmsd_r;
+                        if (bFit)
+                        {
+                            rmsd_r = rmsdev_fit(isize, mass, xx[r2], xx[r1]);
+                        }
+                        else
+                        {
+                            rmsd_r = rmsdev(isize, mass, xx[r2], xx[r1]);
+                        }
+                        *rmsd_entry(rms, rt, r1, r2) = rmsd_r;
                     }
-                    rmsd = rmsdev(isize, mass, xx[i2], x1);
-                    set_mat_entry(rms, i1, i2, rmsd);
                 }
-                nrms -= nf-i1-1;
+                finish_rmsd_rows(rms, rt, nf, b1, b2);
+                for (i1 = b1; i1 < b2; i1++)
+                {
+                    nrms -= nf-i1-1;
+                }
                 fprintf(stderr, "\r# RMSD calculations left: " "%" GMX_PRId64 "   ", nrms);
                 fflush(stderr);
             }
-            sfree(x1);
         }
         else /* bRMSdist */
         {
             fprintf(stderr, "Computing %dx%d RMS distance deviation matrix\n", nf, nf);
 
-            /* Initiate work arrays */
-            snew(d1, isize);
-            snew(d2, isize);
-            for (i = 0; (i < isize); i++)
+            /* Precompute the distance matrices of a block of frames,
+             * then compare all later frames against this block in parallel,
+             * with a separate work array per thread.
+             */
+            nthreads = gmx_omp_get_max_threads();
+            nblock   = std::max(1, std::min(nf, 4*nthreads));
+            snew(d1, nblock);
+            for (b1 = 0; b1 < nblock; b1++)
             {
-                snew(d1[i], isize);
-                snew(d2[i], isize);
+                snew(d1[b1], isize);
+                for (i = 0; (i < isize); i++)
+                {
+                    snew(d1[b1][i], isize);
+                }
             }
-            for (i1 = 0; i1 < nf; i1++)
+            snew(d2, nthreads);
+            for (b1 = 0; b1 < nthreads; b1++)
             {
-                calc_dist(isize, xx[i1], d1);
-                for (i2 = i1+1; (i2 < nf); i2++)
+                snew(d2[b1], isize);
+                for (i = 0; (i < isize); i++)
                 {
-                    calc_dist(isize, xx[i2], d2);
-                    set_mat_entry(rms, i1, i2, rms_dist(isize, d1, d2));
+                    snew(d2[b1][i], isize);
+                }
+            }
+            for (b1 = 0; b1 < nf; b1 = b2)
+            {
+                b2 = std::min(nf, b1 + nblock);
+                if (rt != NULL)
+                {
+                    b2 = std::min(b2, (rt->band + 1)*GMX_RMSD_TILE);
+                }
+#pragma omp parallel for num_threads(nthreads) schedule(static)
+                for (int r1 = b1; r1 < b2; r1++)
+                {
+                    calc_dist(isize, xx[r1], d1[r1-b1]);
+                }
+#pragma omp parallel for num_threads(nthreads) schedule(dynamic)
+                for (int r2 = b1+1; r2 < nf; r2++)
+                {
+                    real **d2_thread = d2[gmx_omp_get_thread_num()];
+
+                    calc_dist(isize, xx[r2], d2_thread);
+                    for (int r1 = b1; r1 < std::min(r2, b2); r1++)
+                    {
+                        *rmsd_entry(rms, rt, r1, r2) = rms_dist(isize, d1[r1-b1], d2_thread);
+                    }
+                }
+                finish_rmsd_rows(rms, rt, nf, b1, b2);
+                for (i1 = b1; i1 < b2; i1++)
+                {
+                    nrms -= nf-i1-1;
                 }
-                nrms -= nf-i1-1;
                 fprintf(stderr, "\r# RMSD calculations left: " "%" GMX_PRId64 "   ", nrms);
                 fflush(stderr);
             }
             /* Clean up work arrays */
-            for (i = 0; (i < isize); i++)
+            for (b1 = 0; b1 < nblock; b1++)
             {
-                sfree(d1[i]);
-                sfree(d2[i]);
+                for (i = 0; (i < isize); i++)
+                {
+                    sfree(d1[b1][i]);
+                }
+                sfree(d1[b1]);
+            }
+            for (b1 = 0; b1 < nthreads; b1++)
+            {
+                for (i = 0; (i < isize); i++)
+                {
+                    sfree(d2[b1][i]);
+                }
+                sfree(d2[b1]);
             }
             sfree(d1);
             sfree(d2);
         }
         fprintf(stderr, "\n\n");
     }
+    if (rt != NULL)
+    {
+        minrms = rt->minrms;
+        maxrms = rt->maxrms;
+        sumrms = rt->sumrms;
+        emat   = rt->energy;
+    }
+    else
+    {
+        minrms = rms->minrms;
+        maxrms = rms->maxrms;
+        sumrms = rms->sumrms;
+        emat   = mat_energy(rms);
+    }
     ffprintf_gg(stderr, log, buf, "The RMSD ranges from %g to %g nm\n",
-                rms->minrms, rms->maxrms);
-    ffprintf_g(stderr, log, buf, "Average RMSD is %g\n", 2*rms->sumrms/(nf*(nf-1)));
+                minrms, maxrms);
+    ffprintf_g(stderr, log, buf, "Average RMSD is %g\n", 2*sumrms/(nf*(nf-1)));
     ffprintf_d(stderr, log, buf, "Number of structures for matrix %d\n", nf);
-    ffprintf_g(stderr, log, buf, "Energy of the matrix is %g.\n", mat_energy(rms));
-    if (bUseRmsdCut && (rmsdcut < rms->minrms || rmsdcut > rms->maxrms) )
+    ffprintf_g(stderr, log, buf, "Energy of the matrix is %g.\n", emat);
+    if (bUseRmsdCut && (rmsdcut < minrms || rmsdcut > maxrms) )
     {
         fprintf(stderr, "WARNING: rmsd cutoff %g is outside range of rmsd values "
-                "%g to %g\n", rmsdcut, rms->minrms, rms->maxrms);
+                "%g to %g\n", rmsdcut, minrms, maxrms);
     }
-    if (bAnalyze && (rmsmin < rms->minrms) )
+    if (bAnalyze && (rmsmin < minrms) )
     {
         fprintf(stderr, "WARNING: rmsd minimum %g is below lowest rmsd value %g\n",
-                rmsmin, rms->minrms);
+                rmsmin, minrms);
     }
     if (bAnalyze && (rmsmin > rmsdcut) )
     {
@@ -1813,7 +2120,14 @@ int gmx_cluster(int argc, char *argv[])
     }
 
     /* Plot the rmsd distribution */
-    rmsd_distribution(opt2fn("-dist", NFILE, fnm), rms, oenv);
+    if (rt != NULL)
+    {
+        rmsd_tiles_distribution(opt2fn("-dist", NFILE, fnm), rt, oenv);
+    }
+    else
+    {
+        rmsd_distribution(opt2fn("-dist", NFILE, fnm), rms, oenv);
+    }
 
     if (bBinary)
     {
@@ -1864,10 +2178,11 @@ int gmx_cluster(int argc, char *argv[])
                         opt2fn_null("-conv", NFILE, fnm), oenv);
             break;
         case m_jarvis_patrick:
-            jarvis_patrick(rms->nn, rms->mat, M, P, bJP_RMSD ? rmsdcut : -1, &clust);
+            jarvis_patrick(nf, rms != NULL ? rms->mat : NULL, rt, M, P,
+                           bJP_RMSD ? rmsdcut : -1, &clust);
             break;
         case m_gromos:
-            gromos(rms->nn, rms->mat, rmsdcut, &clust);
+            gromos(nf, rms != NULL ? rms->mat : NULL, rt, rmsdcut, &clust);
             break;
         default:
             gmx_fatal(FARGS, "DEATH HORROR unknown method \"%s\"", methodname[0]);
@@ -1879,15 +2194,24 @@ int gmx_cluster(int argc, char *argv[])
                 mat_energy(rms));
     }
 
+    if (rt != NULL && opt2bSet("-o", NFILE, fnm))
+    {
+        /* Writing the matrix needs all of it in memory */
+        rms = read_rmsd_tiles(rt);
+    }
+
     if (bAnalyze)
     {
-        if (minstruct > 1)
-        {
-            ncluster = plot_clusters(nf, rms->mat, &clust, minstruct);
-        }
-        else
+        if (rms != NULL)
         {
-            mark_clusters(nf, rms->mat, rms->maxrms, &clust);
+            if (minstruct > 1)
+            {
+                ncluster = plot_clusters(nf, rms->mat, &clust, minstruct);
+            }
+            else
+            {
+                mark_clusters(nf, rms->mat, rms->maxrms, &clust);
+            }
         }
         init_t_atoms(&useatoms, isize, FALSE);
         snew(usextps, isize);
@@ -1900,7 +2224,7 @@ int gmx_cluster(int argc, char *argv[])
             copy_rvec(xtps[index[i]], usextps[i]);
         }
         useatoms.nr = isize;
-        analyze_clusters(nf, &clust, rms->mat, isize, &useatoms, usextps, mass, xx, time,
+        analyze_clusters(nf, &clust, rms != NULL ? rms->mat : NULL, rt, isize, &useatoms, usextps, mass, xx, time,
                          ifsize, fitidx, iosize, outidx,
                          bReadTraj ? trx_out_fn : NULL,
                          opt2fn_null("-sz", NFILE, fnm),
@@ -1927,35 +2251,43 @@ int gmx_cluster(int argc, char *argv[])
         }
     }
 
-    fp = opt2FILE("-o", NFILE, fnm, "w");
-    fprintf(stderr, "Writing rms distance/clustering matrix ");
-    if (bReadMat)
-    {
-        write_xpm(fp, 0, readmat[0].title, readmat[0].legend, readmat[0].label_x,
-                  readmat[0].label_y, nf, nf, readmat[0].axis_x, readmat[0].axis_y,
-                  rms->mat, 0.0, rms->maxrms, rlo_top, rhi_top, &nlevels);
-    }
-    else
+    if (rms != NULL)
     {
-        sprintf(buf, "Time (%s)", output_env_get_time_unit(oenv));
-        sprintf(title, "RMS%sDeviation / Cluster Index",
-                bRMSdist ? " Distance " : " ");
-        if (minstruct > 1)
+        fp = opt2FILE("-o", NFILE, fnm, "w");
+        fprintf(stderr, "Writing rms distance/clustering matrix ");
+        if (bReadMat)
         {
-            write_xpm_split(fp, 0, title, "RMSD (nm)", buf, buf,
-                            nf, nf, time, time, rms->mat, 0.0, rms->maxrms, &nlevels,
-                            rlo_top, rhi_top, 0.0, ncluster,
-                            &ncluster, TRUE, rlo_bot, rhi_bot);
+            write_xpm(fp, 0, readmat[0].title, readmat[0].legend, readmat[0].label_x,
+                      readmat[0].label_y, nf, nf, readmat[0].axis_x, readmat[0].axis_y,
+                      rms->mat, 0.0, rms->maxrms, rlo_top, rhi_top, &nlevels);
         }
         else
         {
-            write_xpm(fp, 0, title, "RMSD (nm)", buf, buf,
-                      nf, nf, time, time, rms->mat, 0.0, rms->maxrms,
-                      rlo_top, rhi_top, &nlevels);
+            sprintf(buf, "Time (%s)", output_env_get_time_unit(oenv));
+            sprintf(title, "RMS%sDeviation / Cluster Index",
+                    bRMSdist ? " Distance " : " ");
+            if (minstruct > 1)
+            {
+                write_xpm_split(fp, 0, title, "RMSD (nm)", buf, buf,
+                                nf, nf, time, time, rms->mat, 0.0, rms->maxrms, &nlevels,
+                                rlo_top, rhi_top, 0.0, ncluster,
+                                &ncluster, TRUE, rlo_bot, rhi_bot);
+            }
+            else
+            {
+                write_xpm(fp, 0, title, "RMSD (nm)", buf, buf,
+                          nf, nf, time, time, rms->mat, 0.0, rms->maxrms,
+                          rlo_top, rhi_top, &nlevels);
+            }
         }
+        fprintf(stderr, "\n");
+        gmx_ffclose(fp);
+    }
+    else
+    {
+        fprintf(stderr, "Not writing the RMSD matrix, which is only stored in %s; "
+                "set -o to write it\n", opt2fn("-tiles", NFILE, fnm));
     }
-    fprintf(stderr, "\n");
-    gmx_ffclose(fp);
     if (NULL != orig)
     {
         fp = opt2FILE("-om", NFILE, fnm, "w");
@@ -1983,6 +2315,10 @@ int gmx_cluster(int argc, char *argv[])
         do_view(oenv, opt2fn_null("-clid", NFILE, fnm), "-nxy");
     }
     do_view(oenv, opt2fn_null("-conv", NFILE, fnm), NULL);
+    if (rt != NULL)
+    {
+        gmx_rmsd_tiles_done(rt);
+    }
 
     return 0;
 }
@@ -39,6 +39,8 @@
 #include <cmath>
 #include <cstring>
 
+#include <algorithm>
+
 #include "gromacs/commandline/pargs.h"
 #include "gromacs/fileio/confio.h"
 #include "gromacs/fileio/matio.h"
@@ -57,9 +59,49 @@
 #include "gromacs/utility/cstringutil.h"
 #include "gromacs/utility/fatalerror.h"
 #include "gromacs/utility/futil.h"
+#include "gromacs/utility/gmxomp.h"
 #include "gromacs/utility/smalloc.h"
 #include "gromacs/utility/sysinfo.h"
 
+//! Number of frames added to the covariance matrix at once
+static const int c_covarFrameBlockSize = 32;
+//! Number of matrix columns updated with all frames of a block before moving on
+static const int c_covarColumnBlockSize = 2048;
+
+/*! \brief Add the outer products of a block of frames to the covariance matrix
+ *
+ * Only the upper triangle at atom level is updated, as in the rest of
+ * gmx covar. Each part of a matrix row is updated with all frames of the
+ * block while it is in cache, which saves most of the memory traffic of
+ * updating the matrix once per frame. Rows are distributed over threads.
+ * The frames are added in order, so the result does not depend on the
+ * block size.
+ */
+static void add_frames_to_covariance(real *mat, gmx_int64_t ndim, const real *xblock, int nblock)
+{
+    int nthreads = gmx_omp_get_max_threads();
+
+#pragma omp parallel for num_threads(nthreads) schedule(dynamic, DIM)
+    for (gmx_int64_t row = 0; row < ndim; row++)
+    {
+        real       *matRow   = mat + ndim*row;
+        gmx_int64_t colStart = (row/DIM)*DIM;
+        for (gmx_int64_t col0 = colStart; col0 < ndim; col0 += c_covarColumnBlockSize)
+        {
+            gmx_int64_t col1 = std::min(col0 + c_covarColumnBlockSize, ndim);
+            for (int f = 0; f < nblock; f++)
+            {
+                const real *x    = xblock + ndim*f;
+                real        xrow = x[row];
+                for (gmx_int64_t col = col0; col < col1; col++)
+                {
+                    matRow[col] += x[col]*xrow;
+                }
+            }
+        }
+    }
+}
+
 int gmx_covar(int argc, char *argv[])
 {
     const char       *desc[] = {
@@ -93,9 +135,15 @@ int gmx_covar(int argc, char *argv[])
         "of atoms involved. It is easy to run out of memory, in which",
         "case this tool will probably exit with a 'Segmentation fault'. You",
         "should consider carefully whether a reduced set of atoms will meet",
-        "your needs for lower costs."
+        "your needs for lower costs.",
+        "[PAR]",
+        "With [TT]-partial[tt], only the eigenvectors up to [TT]-last[tt] with",
+        "the largest eigenvalues are computed with an iterative Lanczos solver.",
+        "For large systems, this is much faster than the full diagonalization.",
+        "The sum of all eigenvalues is then not known, so the log reports which",
+        "fraction of the trace is covered by the computed eigenvalues."
     };
-    static gmx_bool   bFit = TRUE, bRef = FALSE, bM = FALSE, bPBC = TRUE;
+    static gmx_bool   bFit = TRUE, bRef = FALSE, bM = FALSE, bPBC = TRUE, bPartial = FALSE;
     static int        end  = -1;
     t_pargs           pa[] = {
         { "-fit",  FALSE, etBOOL, {&bFit},
@@ -106,6 +154,8 @@ int gmx_covar(int argc, char *argv[])
           "Mass-weighted covariance analysis"},
         { "-last",  FALSE, etINT, {&end},
           "Last eigenvector to write away (-1 is till the last)" },
+        { "-partial", FALSE, etBOOL, {&bPartial},
+          "Only compute the eigenvectors up to [TT]-last[tt] with an iterative solver" },
         { "-pbc",  FALSE,  etBOOL, {&bPBC},
           "Apply corrections for periodic boundary conditions" }
     };
@@ -116,12 +166,12 @@ int gmx_covar(int argc, char *argv[])
     t_atoms          *atoms;
     rvec             *x, *xread, *xref, *xav, *xproj;
     matrix            box, zerobox;
-    real             *sqrtm, *mat, *eigenvalues, sum, trace, inv_nframes;
+    real             *sqrtm, *mat, *eigenvalues, sum, trace, inv_nframes, *xblock;
     real              t, tstart, tend, **mat2;
-    real              xj, *w_rls = NULL;
+    real             *w_rls = NULL;
     real              min, max, *axis;
-    int               natoms, nat, nframes0, nframes, nlevels;
-    gmx_int64_t       ndim, i, j, k, l;
+    int               natoms, nat, nframes0, nframes, nlevels, nblock;
+    gmx_int64_t       ndim, i, j, k;
     int               WriteXref;
     const char       *fitfile, *trxfile, *ndxfile;
     const char       *eigvalfile, *eigvecfile, *averfile, *logfile;
@@ -257,6 +307,10 @@ int gmx_covar(int argc, char *argv[])
     {
         gmx_fatal(FARGS, "Number of degrees of freedoms to large for matrix.\n");
     }
+    if (bPartial && (end < 1 || end >= ndim))
+    {
+        gmx_fatal(FARGS, "With -partial, -last should be between 1 and %d\n", static_cast<int>(ndim)-1);
+    }
     snew(mat, ndim*ndim);
 
     fprintf(stderr, "Calculating the average structure ...\n");
@@ -301,6 +355,8 @@ int gmx_covar(int argc, char *argv[])
     sfree(xread);
 
     fprintf(stderr, "Constructing covariance matrix (%dx%d) ...\n", static_cast<int>(ndim), static_cast<int>(ndim));
+    snew(xblock, c_covarFrameBlockSize*ndim);
+    nblock  = 0;
     nframes = 0;
     nat     = read_first_x(oenv, &status, trxfile, &t, &xread, box);
     tstart  = t;
@@ -333,27 +389,20 @@ int gmx_covar(int argc, char *argv[])
             }
         }
 
-        for (j = 0; j < natoms; j++)
+        std::memcpy(xblock + ndim*nblock, x[0], ndim*sizeof(real));
+        nblock++;
+        if (nblock == c_covarFrameBlockSize)
         {
-            for (dj = 0; dj < DIM; dj++)
-            {
-                k  = ndim*(DIM*j+dj);
-                xj = x[j][dj];
-                for (i = j; i < natoms; i++)
-                {
-                    l = k+DIM*i;
-                    for (d = 0; d < DIM; d++)
-                    {
-                        mat[l+d] += x[i][d]*xj;
-                    }
-                }
-            }
+            add_frames_to_covariance(mat, ndim, xblock, nblock);
+            nblock = 0;
         }
     }
     while (read_next_x(oenv, status, &t, xread, box) &&
            (bRef || nframes < nframes0));
     close_trj(status);
     gmx_rmpbc_done(gpbc);
+    add_frames_to_covariance(mat, ndim, xblock, nblock);
+    sfree(xblock);
 
     fprintf(stderr, "Read %d frames\n", nframes);
 
@@ -512,13 +561,34 @@ int gmx_covar(int argc, char *argv[])
     /* call diagonalization routine */
 
     snew(eigenvalues, ndim);
-    snew(eigenvectors, ndim*ndim);
 
-    std::memcpy(eigenvectors, mat, ndim*ndim*sizeof(real));
-    fprintf(stderr, "\nDiagonalizing ...\n");
-    fflush(stderr);
-    eigensolver(eigenvectors, ndim, 0, ndim, eigenvalues, mat);
-    sfree(eigenvectors);
+    if (bPartial)
+    {
+        real *partialValues;
+
+        /* Only the largest eigenpairs are computed. They are stored at the
+         * end of the arrays, where the full diagonalization puts them.
+         */
+        snew(partialValues, end);
+        snew(eigenvectors, end*ndim);
+        fprintf(stderr, "\nComputing the %d largest eigenvalues ...\n", end);
+        fflush(stderr);
+        partial_eigensolver(mat, ndim, end, partialValues, eigenvectors, 100000);
+        std::copy(partialValues, partialValues + end, eigenvalues + ndim - end);
+        std::copy(eigenvectors, eigenvectors + end*ndim, mat + (ndim - end)*ndim);
+        sfree(partialValues);
+        sfree(eigenvectors);
+    }
+    else
+    {
+        snew(eigenvectors, ndim*ndim);
+
+        std::memcpy(eigenvectors, mat, ndim*ndim*sizeof(real));
+        fprintf(stderr, "\nDiagonalizing ...\n");
+        fflush(stderr);
+        eigensolver(eigenvectors, ndim, 0, ndim, eigenvalues, mat);
+        sfree(eigenvectors);
+    }
 
     /* now write the output */
 
@@ -527,11 +597,19 @@ int gmx_covar(int argc, char *argv[])
     {
         sum += eigenvalues[i];
     }
-    fprintf(stderr, "\nSum of the eigenvalues: %g (%snm^2)\n",
-            sum, bM ? "u " : "");
-    if (std::abs(trace-sum) > 0.01*trace)
+    if (bPartial)
     {
-        fprintf(stderr, "\nWARNING: eigenvalue sum deviates from the trace of the covariance matrix\n");
+        fprintf(stderr, "\nSum of the %d largest eigenvalues: %g (%snm^2), %.1f%% of the trace\n",
+                end, sum, bM ? "u " : "", 100*sum/trace);
+    }
+    else
+    {
+        fprintf(stderr, "\nSum of the eigenvalues: %g (%snm^2)\n",
+                sum, bM ? "u " : "");
+        if (std::abs(trace-sum) > 0.01*trace)
+        {
+            fprintf(stderr, "\nWARNING: eigenvalue sum deviates from the trace of the covariance matrix\n");
+        }
     }
 
     /* Set 'end', the maximum eigenvector and -value index used for output */
@@ -626,8 +704,15 @@ int gmx_covar(int argc, char *argv[])
     fprintf(out, "Diagonalized the %dx%d covariance matrix\n", static_cast<int>(ndim), static_cast<int>(ndim));
     fprintf(out, "Trace of the covariance matrix before diagonalizing: %g\n",
             trace);
-    fprintf(out, "Trace of the covariance matrix after diagonalizing: %g\n\n",
-            sum);
+    if (bPartial)
+    {
+        fprintf(out, "Sum of the %d largest eigenvalues: %g\n\n", end, sum);
+    }
+    else
+    {
+        fprintf(out, "Trace of the covariance matrix after diagonalizing: %g\n\n",
+                sum);
+    }
 
     fprintf(out, "Wrote %d eigenvalues to %s\n", static_cast<int>(end), eigvalfile);
     if (WriteXref == eWXR_YES)
@@ -46,6 +46,7 @@
 #include "gromacs/fileio/trxio.h"
 #include "gromacs/fileio/xvgr.h"
 #include "gromacs/gmxana/gmx_ana.h"
+#include "gromacs/gmxana/gridhist.h"
 #include "gromacs/gmxana/gstat.h"
 #include "gromacs/math/units.h"
 #include "gromacs/math/vec.h"
@@ -55,9 +56,11 @@
 #include "gromacs/topology/topology.h"
 #include "gromacs/utility/arraysize.h"
 #include "gromacs/utility/cstringutil.h"
+#include "gromacs/utility/exceptions.h"
 #include "gromacs/utility/fatalerror.h"
 #include "gromacs/utility/futil.h"
 #include "gromacs/utility/gmxassert.h"
+#include "gromacs/utility/gmxomp.h"
 #include "gromacs/utility/smalloc.h"
 
 typedef struct {
@@ -129,8 +132,12 @@ int get_electrons(t_electron **eltab, const char *fn)
     return nr;
 }
 
-void center_coords(t_atoms *atoms, int *index_center, int ncenter,
-                   matrix box, rvec x0[])
+/* Shifts the n atoms in x0 so the center of mass of the ncenter atoms
+ * in index_center, which are stored at local_center in x0, is in the
+ * center of the box.
+ */
+void center_coords(t_atoms *atoms, int *index_center, const int *local_center, int ncenter,
+                   matrix box, rvec x0[], int n)
 {
     int  i, k, m;
     real tmass, mm;
@@ -150,7 +157,7 @@ void center_coords(t_atoms *atoms, int *index_center, int ncenter,
         tmass += mm;
         for (m = 0; (m < DIM); m++)
         {
-            com[m] += mm*x0[i][m];
+            com[m] += mm*x0[local_center[k]][m];
         }
     }
     for (m = 0; (m < DIM); m++)
@@ -161,35 +168,41 @@ void center_coords(t_atoms *atoms, int *index_center, int ncenter,
     rvec_sub(com, box_center, shift);
 
     /* Important - while the center was calculated based on a group, we should move all atoms */
-    for (i = 0; (i < atoms->nr); i++)
+    for (i = 0; (i < n); i++)
     {
         rvec_dec(x0[i], shift);
     }
 }
 
-void calc_electron_density(const char *fn, int **index, int gnx[],
-                           double ***slDensity, int *nslices, t_topology *top,
-                           int ePBC,
-                           int axis, int nr_grps, real *slWidth,
-                           t_electron eltab[], int nr, gmx_bool bCenter,
-                           int *index_center, int ncenter,
-                           gmx_bool bRelative, const gmx_output_env_t *oenv)
-{
-    rvec        *x0;            /* coordinates without pbc */
-    matrix       box;           /* box (3x3) */
-    double       invvol;
-    int          natoms;        /* nr. atoms in trj */
-    t_trxstatus *status;
-    int          i, n,          /* loop indices */
-                 nr_frames = 0, /* number of frames */
-                 slice;         /* current slice */
-    t_electron  *found;         /* found by bsearch */
-    t_electron   sought;        /* thingie thought by bsearch */
-    real         boxSz, aveBox;
-    gmx_rmpbc_t  gpbc = NULL;
+/* Number of frames per thread that are read before binning them in parallel */
+static const int c_framesPerThread = 4;
 
-    real         t,
-                 z;
+/* Bins the atoms of all groups along axis over the whole trajectory,
+ * with weight[n][i] for atom i of group n, and returns the average
+ * per frame in slDensity. Returns the number of frames.
+ */
+static int calc_slice_density(const char *fn, int **index, int gnx[], double **weight,
+                              double ***slDensity, int *nslices, t_topology *top, int ePBC,
+                              int axis, int nr_grps, real *slWidth, gmx_bool bCenter,
+                              int *index_center, int ncenter,
+                              gmx_bool bRelative, const gmx_output_env_t *oenv)
+{
+    rvec                 *x0;            /* coordinates without pbc */
+    matrix                box;           /* box (3x3) */
+    int                   natoms;        /* nr. atoms in trj */
+    t_trxstatus          *status;
+    int                   i, n,          /* loop indices */
+                          nr_frames = 0; /* number of frames */
+    real                  t;
+    real                  aveBox;
+    gmx_rmpbc_t           gpbc = NULL;
+    gmx_bool              bMore;
+    int                   nthreads;
+    gmx_frame_batch_t    *fb;
+    gmx_grid_histogram_t *gh;
+    double               *sum;
+    int                 **batchIndex, *batchSize;
+    int                 **local, *local_center = NULL;
 
     if (axis < 0 || axis >= DIM)
     {
@@ -209,11 +222,34 @@ void calc_electron_density(const char *fn, int **index, int gnx[],
         fprintf(stderr, "\nDividing the box in %d slices\n", *nslices);
     }
 
-    snew(*slDensity, nr_grps);
-    for (i = 0; i < nr_grps; i++)
+    /* Frames are read and made whole serially, then binned in parallel
+     * into private grids of the threads. The batch only keeps the atoms
+     * of the groups and the center group.
+     */
+    nthreads = gmx_omp_get_max_threads();
+    snew(batchIndex, nr_grps + 1);
+    snew(batchSize, nr_grps + 1);
+    for (n = 0; n < nr_grps; n++)
     {
-        snew((*slDensity)[i], *nslices);
+        batchIndex[n] = index[n];
+        batchSize[n]  = gnx[n];
     }
+    batchIndex[nr_grps] = index_center;
+    batchSize[nr_grps]  = bCenter ? ncenter : 0;
+    fb = gmx_frame_batch_init(natoms, nr_grps + 1, batchSize, batchIndex,
+                              c_framesPerThread*nthreads);
+    sfree(batchIndex);
+    sfree(batchSize);
+    snew(local, nr_grps);
+    for (n = 0; n < nr_grps; n++)
+    {
+        local[n] = gmx_frame_batch_local_index(fb, gnx[n], index[n]);
+    }
+    if (bCenter)
+    {
+        local_center = gmx_frame_batch_local_index(fb, ncenter, index_center);
+    }
+    gh = gmx_grid_histogram_init(nr_grps, *nslices, 1, FALSE, nthreads);
 
     gpbc = gmx_rmpbc_init(&top->idef, ePBC, top->atoms.nr);
     /*********** Start processing trajectory ***********/
@@ -221,93 +257,115 @@ void calc_electron_density(const char *fn, int **index, int gnx[],
     {
         gmx_rmpbc(gpbc, natoms, box, x0);
 
-        /* Translate atoms so the com of the center-group is in the
-         * box geometrical center.
-         */
-        if (bCenter)
-        {
-            center_coords(&top->atoms, index_center, ncenter, box, x0);
-        }
-
-        invvol   = *nslices/(box[XX][XX]*box[YY][YY]*box[ZZ][ZZ]);
-
         if (bRelative)
         {
             *slWidth = 1.0/(*nslices);
-            boxSz    = 1.0;
         }
         else
         {
             *slWidth = box[axis][axis]/(*nslices);
-            boxSz    = box[axis][axis];
         }
 
         aveBox += box[axis][axis];
+        nr_frames++;
 
-        for (n = 0; n < nr_grps; n++)
+        gmx_frame_batch_add(fb, x0, box, t);
+        bMore = read_next_x(oenv, status, &t, x0, box);
+        if (fb->nframes < fb->nalloc && bMore)
         {
-            for (i = 0; i < gnx[n]; i++) /* loop over all atoms in index file */
-            {
-                z = x0[index[n][i]][axis];
-                while (z < 0)
-                {
-                    z += box[axis][axis];
-                }
-                while (z > box[axis][axis])
-                {
-                    z -= box[axis][axis];
-                }
-
-                if (bRelative)
-                {
-                    z = z/box[axis][axis];
-                }
+            continue;
+        }
 
-                /* determine which slice atom is in */
+#pragma omp parallel for num_threads(nthreads) schedule(dynamic)
+        for (int f = 0; f < fb->nframes; f++)
+        {
+            try
+            {
+                rvec   *x      = fb->x[f];
+                real    boxLen = fb->box[f][axis][axis];
+                real    width, boxSz, z;
+                double  invvol;
+                int     slice, thread = gmx_omp_get_thread_num();
+
+                /* Translate atoms so the com of the center-group is in the
+                 * box geometrical center.
+                 */
                 if (bCenter)
                 {
-                    slice = static_cast<int>(std::floor( (z-(boxSz/2.0)) / (*slWidth) ) + *nslices/2);
-                }
-                else
-                {
-                    slice = static_cast<int>(z / (*slWidth));
+                    center_coords(&top->atoms, index_center, local_center, ncenter,
+                                  fb->box[f], x, fb->nstored);
                 }
-                sought.nr_el    = 0;
-                sought.atomname = gmx_strdup(*(top->atoms.atomname[index[n][i]]));
 
-                /* now find the number of electrons. This is not efficient. */
-                found = (t_electron *)
-                    bsearch((const void *)&sought,
-                            (const void *)eltab, nr, sizeof(t_electron),
-                            (int(*)(const void*, const void*))compare);
+                invvol = *nslices/(fb->box[f][XX][XX]*fb->box[f][YY][YY]*fb->box[f][ZZ][ZZ]);
+                width  = bRelative ? 1.0/(*nslices) : boxLen/(*nslices);
+                boxSz  = bRelative ? 1.0 : boxLen;
 
-                if (found == NULL)
-                {
-                    fprintf(stderr, "Couldn't find %s. Add it to the .dat file\n",
-                            *(top->atoms.atomname[index[n][i]]));
-                }
-                else
+                for (int g = 0; g < nr_grps; g++)
                 {
-                    (*slDensity)[n][slice] += (found->nr_el -
-                                               top->atoms.atom[index[n][i]].q)*invvol;
+                    for (int a = 0; a < gnx[g]; a++) /* loop over all atoms in index file */
+                    {
+                        z = x[local[g][a]][axis];
+                        while (z < 0)
+                        {
+                            z += boxLen;
+                        }
+                        while (z > boxLen)
+                        {
+                            z -= boxLen;
+                        }
+
+                        if (bRelative)
+                        {
+                            z = z/boxLen;
+                        }
+
+                        /* determine which slice atom is in */
+                        if (bCenter)
+                        {
+                            slice = static_cast<int>(std::floor( (z-(boxSz/2.0)) / width ) + *nslices/2);
+                        }
+                        else
+                        {
+                            slice = static_cast<int>(std::floor(z / width));
+                        }
+
+                        /* Slice should already be 0<=slice<nslices, but we just make
+                         * sure we are not hit by IEEE rounding errors since we do
+                         * math operations after applying PBC above.
+                         */
+                        if (slice < 0)
+                        {
+                            slice += *nslices;
+                        }
+                        else if (slice >= *nslices)
+                        {
+                            slice -= *nslices;
+                        }
+
+                        gmx_grid_histogram_add(gh, thread, g, slice, 0, weight[g][a]*invvol);
+                    }
                 }
-                free(sought.atomname);
             }
+            GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR;
         }
-        nr_frames++;
+        fb->nframes = 0;
     }
-    while (read_next_x(oenv, status, &t, x0, box));
+    while (bMore);
     gmx_rmpbc_done(gpbc);
 
     /*********** done with status file **********/
     close_trj(status);
 
-/* slDensity now contains the total number of electrons per slice, summed
-   over all frames. Now divide by nr_frames and volume of slice
- */
-
-    fprintf(stderr, "\nRead %d frames from trajectory. Counting electrons\n",
-            nr_frames);
+    snew(sum, nr_grps*(*nslices));
+    gmx_grid_histogram_reduce(gh, sum);
+    gmx_grid_histogram_done(gh);
+    gmx_frame_batch_done(fb);
+    for (n = 0; n < nr_grps; n++)
+    {
+        sfree(local[n]);
+    }
+    sfree(local);
+    sfree(local_center);
 
     if (bRelative)
     {
@@ -315,164 +373,111 @@ void calc_electron_density(const char *fn, int **index, int gnx[],
         *slWidth = aveBox/(*nslices);
     }
 
+    /* sum contains the total weight per slice, summed over all
+       frames. Now divide by nr_frames.
+     */
+    snew(*slDensity, nr_grps);
     for (n = 0; n < nr_grps; n++)
     {
+        snew((*slDensity)[n], *nslices);
         for (i = 0; i < *nslices; i++)
         {
-            (*slDensity)[n][i] /= nr_frames;
+            (*slDensity)[n][i] = sum[n*(*nslices) + i]/nr_frames;
         }
     }
 
+    sfree(sum);
     sfree(x0); /* free memory used by coordinate array */
+
+    return nr_frames;
 }
 
-void calc_density(const char *fn, int **index, int gnx[],
-                  double ***slDensity, int *nslices, t_topology *top, int ePBC,
-                  int axis, int nr_grps, real *slWidth, gmx_bool bCenter,
-                  int *index_center, int ncenter,
-                  gmx_bool bRelative, const gmx_output_env_t *oenv)
+void calc_electron_density(const char *fn, int **index, int gnx[],
+                           double ***slDensity, int *nslices, t_topology *top,
+                           int ePBC,
+                           int axis, int nr_grps, real *slWidth,
+                           t_electron eltab[], int nr, gmx_bool bCenter,
+                           int *index_center, int ncenter,
+                           gmx_bool bRelative, const gmx_output_env_t *oenv)
 {
-    rvec        *x0;            /* coordinates without pbc */
-    matrix       box;           /* box (3x3) */
-    double       invvol;
-    int          natoms;        /* nr. atoms in trj */
-    t_trxstatus *status;
-    int          i, n,          /* loop indices */
-                 nr_frames = 0, /* number of frames */
-                 slice;         /* current slice */
-    real         t,
-                 z;
-    real         boxSz, aveBox;
-    gmx_rmpbc_t  gpbc = NULL;
-
-    if (axis < 0 || axis >= DIM)
-    {
-        gmx_fatal(FARGS, "Invalid axes. Terminating\n");
-    }
-
-    if ((natoms = read_first_x(oenv, &status, fn, &t, &x0, box)) == 0)
-    {
-        gmx_fatal(FARGS, "Could not read coordinates from statusfile\n");
-    }
-
-    aveBox = 0;
-
-    if (!*nslices)
-    {
-        *nslices = static_cast<int>(box[axis][axis] * 10); /* default value */
-        fprintf(stderr, "\nDividing the box in %d slices\n", *nslices);
-    }
-
-    snew(*slDensity, nr_grps);
-    for (i = 0; i < nr_grps; i++)
-    {
-        snew((*slDensity)[i], *nslices);
-    }
+    t_electron  *found;         /* found by bsearch */
+    t_electron   sought;        /* thingie thought by bsearch */
+    double     **weight;
+    int          i, n, nr_frames;
 
-    gpbc = gmx_rmpbc_init(&top->idef, ePBC, top->atoms.nr);
-    /*********** Start processing trajectory ***********/
-    do
+    /* Look up the number of electrons of every atom once */
+    snew(weight, nr_grps);
+    for (n = 0; n < nr_grps; n++)
     {
-        gmx_rmpbc(gpbc, natoms, box, x0);
-
-        /* Translate atoms so the com of the center-group is in the
-         * box geometrical center.
-         */
-        if (bCenter)
+        snew(weight[n], gnx[n]);
+        for (i = 0; i < gnx[n]; i++)
         {
-            center_coords(&top->atoms, index_center, ncenter, box, x0);
-        }
+            sought.nr_el    = 0;
+            sought.atomname = gmx_strdup(*(top->atoms.atomname[index[n][i]]));
 
-        invvol   = *nslices/(box[XX][XX]*box[YY][YY]*box[ZZ][ZZ]);
+            found = (t_electron *)
+                bsearch((const void *)&sought,
+                        (const void *)eltab, nr, sizeof(t_electron),
+                        (int(*)(const void*, const void*))compare);
 
-        if (bRelative)
-        {
-            *slWidth = 1.0/(*nslices);
-            boxSz    = 1.0;
-        }
-        else
-        {
-            *slWidth = box[axis][axis]/(*nslices);
-            boxSz    = box[axis][axis];
-        }
-
-        aveBox += box[axis][axis];
-
-        for (n = 0; n < nr_grps; n++)
-        {
-            for (i = 0; i < gnx[n]; i++) /* loop over all atoms in index file */
+            if (found == NULL)
             {
-                z = x0[index[n][i]][axis];
-                while (z < 0)
-                {
-                    z += box[axis][axis];
-                }
-                while (z > box[axis][axis])
-                {
-                    z -= box[axis][axis];
-                }
-
-                if (bRelative)
-                {
-                    z = z/box[axis][axis];
-                }
-
-                /* determine which slice atom is in */
-                if (bCenter)
-                {
-                    slice = static_cast<int>(std::floor( (z-(boxSz/2.0)) / (*slWidth) ) + *nslices/2);
-                }
-                else
-                {
-                    slice = static_cast<int>(std::floor(z / (*slWidth)));
-                }
-
-                /* Slice should already be 0<=slice<nslices, but we just make
-                 * sure we are not hit by IEEE rounding errors since we do
-                 * math operations after applying PBC above.
-                 */
-                if (slice < 0)
-                {
-                    slice += *nslices;
-                }
-                else if (slice >= *nslices)
-                {
-                    slice -= *nslices;
-                }
-
-                (*slDensity)[n][slice] += top->atoms.atom[index[n][i]].m*invvol;
+                fprintf(stderr, "Couldn't find %s. Add it to the .dat file\n",
+                        *(top->atoms.atomname[index[n][i]]));
+            }
+            else
+            {
+                weight[n][i] = found->nr_el - top->atoms.atom[index[n][i]].q;
             }
+            free(sought.atomname);
         }
-        nr_frames++;
     }
-    while (read_next_x(oenv, status, &t, x0, box));
-    gmx_rmpbc_done(gpbc);
-
-    /*********** done with status file **********/
-    close_trj(status);
 
-    /* slDensity now contains the total mass per slice, summed over all
-       frames. Now divide by nr_frames and volume of slice
-     */
+    nr_frames = calc_slice_density(fn, index, gnx, weight, slDensity, nslices, top, ePBC,
+                                   axis, nr_grps, slWidth, bCenter, index_center, ncenter,
+                                   bRelative, oenv);
 
-    fprintf(stderr, "\nRead %d frames from trajectory. Calculating density\n",
+    fprintf(stderr, "\nRead %d frames from trajectory. Counting electrons\n",
             nr_frames);
 
-    if (bRelative)
+    for (n = 0; n < nr_grps; n++)
     {
-        aveBox  /= nr_frames;
-        *slWidth = aveBox/(*nslices);
+        sfree(weight[n]);
     }
+    sfree(weight);
+}
+
+void calc_density(const char *fn, int **index, int gnx[],
+                  double ***slDensity, int *nslices, t_topology *top, int ePBC,
+                  int axis, int nr_grps, real *slWidth, gmx_bool bCenter,
+                  int *index_center, int ncenter,
+                  gmx_bool bRelative, const gmx_output_env_t *oenv)
+{
+    double **weight;
+    int      i, n, nr_frames;
 
+    snew(weight, nr_grps);
     for (n = 0; n < nr_grps; n++)
     {
-        for (i = 0; i < *nslices; i++)
+        snew(weight[n], gnx[n]);
+        for (i = 0; i < gnx[n]; i++)
         {
-            (*slDensity)[n][i] /= nr_frames;
+            weight[n][i] = top->atoms.atom[index[n][i]].m;
         }
     }
 
-    sfree(x0); /* free memory used by coordinate array */
+    nr_frames = calc_slice_density(fn, index, gnx, weight, slDensity, nslices, top, ePBC,
+                                   axis, nr_grps, slWidth, bCenter, index_center, ncenter,
+                                   bRelative, oenv);
+
+    fprintf(stderr, "\nRead %d frames from trajectory. Calculating density\n",
+            nr_frames);
+
+    for (n = 0; n < nr_grps; n++)
+    {
+        sfree(weight[n]);
+    }
+    sfree(weight);
 }
 
 void plot_density(double *slDensity[], const char *afile, int nslices,
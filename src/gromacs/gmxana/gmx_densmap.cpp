@@ -45,6 +45,7 @@
 #include "gromacs/fileio/matio.h"
 #include "gromacs/fileio/trxio.h"
 #include "gromacs/gmxana/gmx_ana.h"
+#include "gromacs/gmxana/gridhist.h"
 #include "gromacs/gmxana/gstat.h"
 #include "gromacs/math/utilities.h"
 #include "gromacs/math/vec.h"
@@ -53,11 +54,16 @@
 #include "gromacs/topology/topology.h"
 #include "gromacs/utility/arraysize.h"
 #include "gromacs/utility/cstringutil.h"
+#include "gromacs/utility/exceptions.h"
 #include "gromacs/utility/fatalerror.h"
 #include "gromacs/utility/futil.h"
 #include "gromacs/utility/gmxassert.h"
+#include "gromacs/utility/gmxomp.h"
 #include "gromacs/utility/smalloc.h"
 
+/* Number of frames per thread that are read before binning them in parallel */
+static const int c_framesPerThread = 4;
+
 int gmx_densmap(int argc, char *argv[])
 {
     const char        *desc[] = {
@@ -133,17 +139,21 @@ int gmx_densmap(int argc, char *argv[])
     t_trxstatus       *status;
     t_topology         top;
     int                ePBC = -1;
-    rvec              *x, xcom[2], direction, center, dx;
+    rvec              *x;
     matrix             box;
-    real               t, m, mtot;
-    t_pbc              pbc;
+    real               t;
     int                cav = 0, c1 = 0, c2 = 0;
     char             **grpname, buf[STRLEN];
     const char        *unit;
-    int                i, j, k, l, ngrps, anagrp, *gnx = NULL, nindex, nradial = 0, nfr, nmpower;
-    int              **ind = NULL, *index;
-    real             **grid, maxgrid, m1, m2, box1, box2, *tickx, *tickz, invcellvol;
-    real               invspa = 0, invspz = 0, axial, r, vol_old, vol, rowsum;
+    int                i, j, k, ngrps, anagrp, *gnx = NULL, nindex, nradial = 0, nfr, nmpower;
+    int                natoms, nthreads;
+    int              **ind = NULL, **local, *localIndex;
+    real             **grid, maxgrid, box1, box2, *tickx, *tickz;
+    real               invspa = 0, invspz = 0, vol_old, vol, rowsum;
+    double            *sum;
+    gmx_bool           bMore;
+    gmx_frame_batch_t    *fb;
+    gmx_grid_histogram_t *gh;
     int                nlev   = 51;
     t_rgb              rlo    = {1, 1, 1}, rhi = {0, 0, 0};
     gmx_output_env_t  *oenv;
@@ -217,7 +227,6 @@ int gmx_densmap(int argc, char *argv[])
     get_index(&top.atoms, ftp2fn_null(efNDX, NFILE, fnm), ngrps, gnx, ind, grpname);
     anagrp = ngrps - 1;
     nindex = gnx[anagrp];
-    index  = ind[anagrp];
     if (bRadial)
     {
         if ((gnx[0] > 1 || gnx[1] > 1) && !ftp2bSet(efTPS, NFILE, fnm))
@@ -235,7 +244,7 @@ int gmx_densmap(int argc, char *argv[])
         case 'z': cav = ZZ; c1 = XX; c2 = YY; break;
     }
 
-    read_first_x(oenv, &status, ftp2fn(efTRX, NFILE, fnm), &t, &x, box);
+    natoms = read_first_x(oenv, &status, ftp2fn(efTRX, NFILE, fnm), &t, &x, box);
 
     if (!bRadial)
     {
@@ -270,6 +279,19 @@ int gmx_densmap(int argc, char *argv[])
         snew(grid[i], n2);
     }
 
+    /* Frames are read serially and binned in parallel into private
+     * grids of the threads. The batch only keeps the atoms of the groups.
+     */
+    nthreads = gmx_omp_get_max_threads();
+    fb       = gmx_frame_batch_init(natoms, ngrps, gnx, ind, c_framesPerThread*nthreads);
+    gh       = gmx_grid_histogram_init(n1, n2, 1, FALSE, nthreads);
+    snew(local, ngrps);
+    for (i = 0; i < ngrps; i++)
+    {
+        local[i] = gmx_frame_batch_local_index(fb, gnx[i], ind[i]);
+    }
+    localIndex = local[anagrp];
+
     box1 = 0;
     box2 = 0;
     nfr  = 0;
@@ -279,98 +301,143 @@ int gmx_densmap(int argc, char *argv[])
         {
             box1      += box[c1][c1];
             box2      += box[c2][c2];
-            invcellvol = n1*n2;
-            if (nmpower == -3)
-            {
-                invcellvol /= det(box);
-            }
-            else if (nmpower == -2)
-            {
-                invcellvol /= box[c1][c1]*box[c2][c2];
-            }
-            for (i = 0; i < nindex; i++)
+        }
+        nfr++;
+
+        gmx_frame_batch_add(fb, x, box, t);
+        bMore = read_next_x(oenv, status, &t, x, box);
+        if (fb->nframes < fb->nalloc && bMore)
+        {
+            continue;
+        }
+
+#pragma omp parallel for num_threads(nthreads) schedule(dynamic)
+        for (int f = 0; f < fb->nframes; f++)
+        {
+            try
             {
-                j = index[i];
-                if ((!bXmin || x[j][cav] >= xmin) &&
-                    (!bXmax || x[j][cav] <= xmax))
+                const rvec *xf     = fb->x[f];
+                matrix     &boxf   = fb->box[f];
+                int         thread = gmx_omp_get_thread_num();
+
+                if (!bRadial)
                 {
-                    m1 = x[j][c1]/box[c1][c1];
-                    if (m1 >= 1)
+                    real invcellvol = n1*n2;
+                    if (nmpower == -3)
                     {
-                        m1 -= 1;
+                        invcellvol /= det(boxf);
                     }
-                    if (m1 < 0)
+                    else if (nmpower == -2)
                     {
-                        m1 += 1;
+                        invcellvol /= boxf[c1][c1]*boxf[c2][c2];
                     }
-                    m2 = x[j][c2]/box[c2][c2];
-                    if (m2 >= 1)
+                    for (int i = 0; i < nindex; i++)
                     {
-                        m2 -= 1;
-                    }
-                    if (m2 < 0)
-                    {
-                        m2 += 1;
+                        int j = localIndex[i];
+                        if ((!bXmin || xf[j][cav] >= xmin) &&
+                            (!bXmax || xf[j][cav] <= xmax))
+                        {
+                            real m1 = xf[j][c1]/boxf[c1][c1];
+                            if (m1 >= 1)
+                            {
+                                m1 -= 1;
+                            }
+                            if (m1 < 0)
+                            {
+                                m1 += 1;
+                            }
+                            real m2 = xf[j][c2]/boxf[c2][c2];
+                            if (m2 >= 1)
+                            {
+                                m2 -= 1;
+                            }
+                            if (m2 < 0)
+                            {
+                                m2 += 1;
+                            }
+                            gmx_grid_histogram_add(gh, thread, static_cast<int>(m1*n1), static_cast<int>(m2*n2), 0, invcellvol);
+                        }
                     }
-                    grid[static_cast<int>(m1*n1)][static_cast<int>(m2*n2)] += invcellvol;
-                }
-            }
-        }
-        else
-        {
-            set_pbc(&pbc, ePBC, box);
-            for (i = 0; i < 2; i++)
-            {
-                if (gnx[i] == 1)
-                {
-                    /* One atom, just copy the coordinates */
-                    copy_rvec(x[ind[i][0]], xcom[i]);
                 }
                 else
                 {
-                    /* Calculate the center of mass */
-                    clear_rvec(xcom[i]);
-                    mtot = 0;
-                    for (j = 0; j < gnx[i]; j++)
+                    t_pbc pbc;
+                    rvec  xcom[2], direction, center, dx;
+
+                    set_pbc(&pbc, ePBC, boxf);
+                    for (int i = 0; i < 2; i++)
                     {
-                        k = ind[i][j];
-                        m = top.atoms.atom[k].m;
-                        for (l = 0; l < DIM; l++)
+                        if (gnx[i] == 1)
                         {
-                            xcom[i][l] += m*x[k][l];
+                            /* One atom, just copy the coordinates */
+                            copy_rvec(xf[local[i][0]], xcom[i]);
+                        }
+                        else
+                        {
+                            /* Calculate the center of mass */
+                            real mtot = 0;
+                            clear_rvec(xcom[i]);
+                            for (int j = 0; j < gnx[i]; j++)
+                            {
+                                int  k = local[i][j];
+                                real m = top.atoms.atom[ind[i][j]].m;
+                                for (int l = 0; l < DIM; l++)
+                                {
+                                    xcom[i][l] += m*xf[k][l];
+                                }
+                                mtot += m;
+                            }
+                            svmul(1/mtot, xcom[i], xcom[i]);
                         }
-                        mtot += m;
                     }
-                    svmul(1/mtot, xcom[i], xcom[i]);
-                }
-            }
-            pbc_dx(&pbc, xcom[1], xcom[0], direction);
-            for (i = 0; i < DIM; i++)
-            {
-                center[i] = xcom[0][i] + 0.5*direction[i];
-            }
-            unitv(direction, direction);
-            for (i = 0; i < nindex; i++)
-            {
-                j = index[i];
-                pbc_dx(&pbc, x[j], center, dx);
-                axial = iprod(dx, direction);
-                r     = std::sqrt(norm2(dx) - axial*axial);
-                if (axial >= -amax && axial < amax && r < rmax)
-                {
-                    if (bMirror)
+                    pbc_dx(&pbc, xcom[1], xcom[0], direction);
+                    for (int i = 0; i < DIM; i++)
+                    {
+                        center[i] = xcom[0][i] + 0.5*direction[i];
+                    }
+                    unitv(direction, direction);
+                    for (int i = 0; i < nindex; i++)
                     {
-                        r += rmax;
+                        int j = localIndex[i];
+                        pbc_dx(&pbc, xf[j], center, dx);
+                        real axial = iprod(dx, direction);
+                        real r     = std::sqrt(norm2(dx) - axial*axial);
+                        if (axial >= -amax && axial < amax && r < rmax)
+                        {
+                            if (bMirror)
+                            {
+                                r += rmax;
+                            }
+                            gmx_grid_histogram_add(gh, thread, static_cast<int>((axial + amax)*invspa), static_cast<int>(r*invspz), 0, 1);
+                        }
                     }
-                    grid[static_cast<int>((axial + amax)*invspa)][static_cast<int>(r*invspz)] += 1;
                 }
             }
+            GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR;
         }
-        nfr++;
+        fb->nframes = 0;
     }
-    while (read_next_x(oenv, status, &t, x, box));
+    while (bMore);
     close_trj(status);
 
+    snew(sum, n1*n2);
+    gmx_grid_histogram_reduce(gh, sum);
+    for (i = 0; i < n1; i++)
+    {
+        for (j = 0; j < n2; j++)
+        {
+            grid[i][j] = sum[i*n2 + j];
+        }
+    }
+    sfree(sum);
+    gmx_grid_histogram_done(gh);
+    gmx_frame_batch_done(fb);
+    for (i = 0; i < ngrps; i++)
+    {
+        sfree(local[i]);
+    }
+    sfree(local);
+
     /* normalize gridpoints */
     maxgrid = 0;
     if (!bRadial)
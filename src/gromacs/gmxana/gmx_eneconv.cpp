@@ -165,6 +165,8 @@ static int scan_ene_files(char **fnms, int nfiles,
         in  = open_enx(fnms[f], "r");
         enm = NULL;
         do_enxnms(in, &nre, &enm);
+        /* Only the frame headers are needed here */
+        enx_set_read_selection(in, 0, NULL, 0, NULL);
 
         if (f == 0)
         {
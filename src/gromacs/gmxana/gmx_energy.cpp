@@ -1495,6 +1495,7 @@ static void fec(const char *ene2fn, const char *runavgfn,
     enm = NULL;
     enx = open_enx(ene2fn, "r");
     do_enxnms(enx, &(fr->nre), &enm);
+    enx_set_read_selection(enx, nset, set, 0, NULL);
 
     snew(eneset2, nset+1);
     nenergy2  = 0;
@@ -2324,6 +2325,32 @@ int gmx_energy(int argc, char *argv[])
         get_dhdl_parms(ftp2fn(efTPR, NFILE, fnm), ir);
     }
 
+    /* Only read the energy terms and blocks we actually use */
+    {
+        int nblock_id = 0;
+        int block_ids[enxNR];
+
+        if (bDisRe)
+        {
+            block_ids[nblock_id++] = enxDISRE;
+        }
+        if (bORIRE)
+        {
+            block_ids[nblock_id++] = enx_i;
+        }
+        if (bOTEN)
+        {
+            block_ids[nblock_id++] = enxORT;
+        }
+        if (bDHDL)
+        {
+            block_ids[nblock_id++] = enxDHCOLL;
+            block_ids[nblock_id++] = enxDHHIST;
+            block_ids[nblock_id++] = enxDH;
+        }
+        enx_set_read_selection(fp, nset, set, nblock_id, block_ids);
+    }
+
     /* Initiate energies and set them to zero */
     edat.nsteps    = 0;
     edat.npoints   = 0;
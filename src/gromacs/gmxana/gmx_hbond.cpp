@@ -43,6 +43,7 @@
 #include <cstring>
 
 #include <algorithm>
+#include <vector>
 
 #include "gromacs/commandline/pargs.h"
 #include "gromacs/commandline/viewit.h"
@@ -62,6 +63,7 @@
 #include "gromacs/mdrunutility/mdmodules.h"
 #include "gromacs/mdtypes/inputrec.h"
 #include "gromacs/pbcutil/pbc.h"
+#include "gromacs/selection/nbsearch.h"
 #include "gromacs/topology/ifunc.h"
 #include "gromacs/topology/index.h"
 #include "gromacs/topology/topology.h"
@@ -98,8 +100,6 @@ static const unsigned char c_donorMask    = (1 << 1);
 static const unsigned char c_inGroupMask  = (1 << 2);
 
 
-static const char *grpnames[grNR] = {"0", "1", "I" };
-
 static gmx_bool    bDebug = FALSE;
 
 #define HB_NO 0
@@ -116,32 +116,32 @@ static gmx_bool    bDebug = FALSE;
 #define ISDON(h)   ((h) & c_donorMask)
 #define ISINGRP(h) ((h) & c_inGroupMask)
 
-typedef struct {
-    int      nr;
-    int      maxnr;
-    int     *atoms;
-} t_ncell;
-
-typedef struct {
-    t_ncell d[grNR];
-    t_ncell a[grNR];
-} t_gridcell;
-
 typedef int     t_icell[grNR];
 typedef int h_id[MAXHYDRO];
 
+/* The frames in which a hbond exists, stored as sorted, non-overlapping
+ * and non-adjacent runs of frames [start[i], end[i]). Since hbonds
+ * typically persist for many frames, this takes much less memory than
+ * one bit per frame for long trajectories.
+ */
+typedef struct {
+    int      nrun, maxrun;
+    int     *start;
+    int     *end;
+} t_hbexist;
+
 typedef struct {
     int      history[MAXHYDRO];
     /* Has this hbond existed ever? If so as hbDist or hbHB or both.
      * Result is stored as a bitmap (1 = hbDist) || (2 = hbHB)
      */
-    /* Bitmask array which tells whether a hbond is present
+    /* Existence maps which tell whether a hbond is present
      * at a given time. Either of these may be NULL
      */
     int            n0;                 /* First frame a HB was found     */
-    int            nframes, maxframes; /* Amount of frames in this hbond */
-    unsigned int **h;
-    unsigned int **g;
+    int            nframes;            /* Amount of frames in this hbond */
+    t_hbexist    **h;
+    t_hbexist    **g;
     /* See Xu and Berne, JPCB 105 (2001), p. 11929. We define the
      * function g(t) = [1-h(t)] H(t) where H(t) is one when the donor-
      * acceptor distance is less than the user-specified distance (typically
@@ -168,7 +168,6 @@ typedef struct {
 
 typedef struct {
     gmx_bool        bHBmap, bDAnr;
-    int             wordlen;
     /* The following arrays are nframes long */
     int             nframes, max_frames, maxhydro;
     int            *nhb, *ndist;
@@ -195,7 +194,6 @@ static t_hbdata *mk_hbdata(gmx_bool bHBmap, gmx_bool bDAnr, gmx_bool oneHB)
     t_hbdata *hb;
 
     snew(hb, 1);
-    hb->wordlen = 8*sizeof(unsigned int);
     hb->bHBmap  = bHBmap;
     hb->bDAnr   = bDAnr;
     if (oneHB)
@@ -246,29 +244,74 @@ static void add_frames(t_hbdata *hb, int nframes)
     hb->nframes = nframes;
 }
 
-#define OFFSET(frame) (frame / 32)
-#define MASK(frame)   (1 << (frame % 32))
-
-static void _set_hb(unsigned int hbexist[], unsigned int frame, gmx_bool bValue)
+/* Marks frames [start, end) as present in e */
+static void add_hbexist_range(t_hbexist *e, int start, int end)
 {
-    if (bValue)
+    int i, j, n;
+
+    /* Frames are almost always added in increasing order, so first check
+     * whether we can extend or append to the last run.
+     */
+    n = e->nrun;
+    if (n > 0 && start >= e->start[n-1] && start <= e->end[n-1])
+    {
+        e->end[n-1] = std::max(e->end[n-1], end);
+        return;
+    }
+    /* i is the first run that overlaps with or follows [start, end),
+     * j is one past the last run that overlaps with or precedes it.
+     */
+    i = std::lower_bound(e->end, e->end+n, start) - e->end;
+    j = std::upper_bound(e->start, e->start+n, end) - e->start;
+    if (i < j)
     {
-        hbexist[OFFSET(frame)] |= MASK(frame);
+        /* Merge runs i to j-1 with the new range */
+        e->start[i] = std::min(e->start[i], start);
+        e->end[i]   = std::max(e->end[j-1], end);
+        std::copy(e->start+j, e->start+n, e->start+i+1);
+        std::copy(e->end+j, e->end+n, e->end+i+1);
+        e->nrun -= j-i-1;
     }
     else
     {
-        hbexist[OFFSET(frame)] &= ~MASK(frame);
+        if (n >= e->maxrun)
+        {
+            e->maxrun = std::max(4, 2*e->maxrun);
+            srenew(e->start, e->maxrun);
+            srenew(e->end, e->maxrun);
+        }
+        std::copy_backward(e->start+i, e->start+n, e->start+n+1);
+        std::copy_backward(e->end+i, e->end+n, e->end+n+1);
+        e->start[i] = start;
+        e->end[i]   = end;
+        e->nrun++;
+    }
+}
+
+static void done_hbexist(t_hbexist **e)
+{
+    if (*e)
+    {
+        sfree((*e)->start);
+        sfree((*e)->end);
+        sfree(*e);
+        *e = NULL;
     }
 }
 
-static gmx_bool is_hb(unsigned int hbexist[], int frame)
+static gmx_bool is_hb(const t_hbexist *e, int frame)
 {
-    return ((hbexist[OFFSET(frame)] & MASK(frame)) != 0) ? 1 : 0;
+    int i;
+
+    /* Find the last run starting at or before frame */
+    i = std::upper_bound(e->start, e->start+e->nrun, frame) - e->start - 1;
+
+    return (i >= 0 && frame < e->end[i]);
 }
 
 static void set_hb(t_hbdata *hb, int id, int ih, int ia, int frame, int ihb)
 {
-    unsigned int *ghptr = NULL;
+    t_hbexist *ghptr = NULL;
 
     if (ihb == hbHB)
     {
@@ -283,49 +326,28 @@ static void set_hb(t_hbdata *hb, int id, int ih, int ia, int frame, int ihb)
         gmx_fatal(FARGS, "Incomprehensible iValue %d in set_hb", ihb);
     }
 
-    _set_hb(ghptr, frame-hb->hbmap[id][ia]->n0, TRUE);
+    frame -= hb->hbmap[id][ia]->n0;
+    add_hbexist_range(ghptr, frame, frame+1);
 }
 
 static void add_ff(t_hbdata *hbd, int id, int h, int ia, int frame, int ihb)
 {
-    int         i, j, n;
+    int         i;
     t_hbond    *hb       = hbd->hbmap[id][ia];
     int         maxhydro = std::min(hbd->maxhydro, hbd->d.nhydro[id]);
-    int         wlen     = hbd->wordlen;
-    int         delta    = 32*wlen;
 
     if (!hb->h[0])
     {
-        hb->n0        = frame;
-        hb->maxframes = delta;
+        hb->n0 = frame;
         for (i = 0; (i < maxhydro); i++)
         {
-            snew(hb->h[i], hb->maxframes/wlen);
-            snew(hb->g[i], hb->maxframes/wlen);
+            snew(hb->h[i], 1);
+            snew(hb->g[i], 1);
         }
     }
     else
     {
         hb->nframes = frame-hb->n0;
-        /* We need a while loop here because hbonds may be returning
-         * after a long time.
-         */
-        while (hb->nframes >= hb->maxframes)
-        {
-            n = hb->maxframes + delta;
-            for (i = 0; (i < maxhydro); i++)
-            {
-                srenew(hb->h[i], n/wlen);
-                srenew(hb->g[i], n/wlen);
-                for (j = hb->maxframes/wlen; (j < n/wlen); j++)
-                {
-                    hb->h[i][j] = 0;
-                    hb->g[i][j] = 0;
-                }
-            }
-
-            hb->maxframes = n;
-        }
     }
     if (frame >= 0)
     {
@@ -863,43 +885,6 @@ static void search_donors(const t_topology *top, int isize, const int *index,
     }
 }
 
-static t_gridcell ***init_grid(gmx_bool bBox, rvec box[], real rcut, ivec ngrid)
-{
-    t_gridcell ***grid;
-    int           i, y, z;
-
-    if (bBox)
-    {
-        for (i = 0; i < DIM; i++)
-        {
-            ngrid[i] = static_cast<int>(box[i][i]/(1.2*rcut));
-        }
-    }
-
-    if (!bBox || (ngrid[XX] < 3) || (ngrid[YY] < 3) || (ngrid[ZZ] < 3) )
-    {
-        for (i = 0; i < DIM; i++)
-        {
-            ngrid[i] = 1;
-        }
-    }
-    else
-    {
-        printf("\nWill do grid-seach on %dx%dx%d grid, rcut=%g\n",
-               ngrid[XX], ngrid[YY], ngrid[ZZ], rcut);
-    }
-    snew(grid, ngrid[ZZ]);
-    for (z = 0; z < ngrid[ZZ]; z++)
-    {
-        snew((grid)[z], ngrid[YY]);
-        for (y = 0; y < ngrid[YY]; y++)
-        {
-            snew((grid)[z][y], ngrid[XX]);
-        }
-    }
-    return grid;
-}
-
 static void reset_nhbonds(t_donors *ddd)
 {
     int i, j;
@@ -913,324 +898,104 @@ static void reset_nhbonds(t_donors *ddd)
     }
 }
 
-static void pbc_correct_gem(rvec dx, matrix box, rvec hbox);
-static void pbc_in_gridbox(rvec dx, matrix box);
-
-static void build_grid(t_hbdata *hb, rvec x[], rvec xshell,
-                       gmx_bool bBox, matrix box, rvec hbox,
-                       real rcut, real rshell,
-                       ivec ngrid, t_gridcell ***grid)
+static void pbc_correct_gem(rvec dx, matrix box, rvec hbox)
 {
-    int         i, m, gr, xi, yi, zi, nr;
-    int        *ad;
-    ivec        grididx;
-    rvec        invdelta, dshell;
-    t_ncell    *newgrid;
-    gmx_bool    bDoRshell, bInShell, bAcc;
-    real        rshell2 = 0;
-    int         gx, gy, gz;
-    int         dum = -1;
-
-    bDoRshell = (rshell > 0);
-    rshell2   = gmx::square(rshell);
-    bInShell  = TRUE;
-
-#define DBB(x) if (debug && bDebug) fprintf(debug, "build_grid, line %d, %s = %d\n", __LINE__,#x, x)
-    DBB(dum);
-    for (m = 0; m < DIM; m++)
-    {
-        hbox[m] = box[m][m]*0.5;
-        if (bBox)
-        {
-            invdelta[m] = ngrid[m]/box[m][m];
-            if (1/invdelta[m] < rcut)
-            {
-                gmx_fatal(FARGS, "Your computational box has shrunk too much.\n"
-                          "%s can not handle this situation, sorry.\n",
-                          gmx::getProgramContext().displayName());
-            }
-        }
-        else
-        {
-            invdelta[m] = 0;
-        }
-    }
-    grididx[XX] = 0;
-    grididx[YY] = 0;
-    grididx[ZZ] = 0;
-    DBB(dum);
-    /* resetting atom counts */
-    for (gr = 0; (gr < grNR); gr++)
+    int      m;
+    gmx_bool bDone = FALSE;
+    while (!bDone)
     {
-        for (zi = 0; zi < ngrid[ZZ]; zi++)
-        {
-            for (yi = 0; yi < ngrid[YY]; yi++)
-            {
-                for (xi = 0; xi < ngrid[XX]; xi++)
-                {
-                    grid[zi][yi][xi].d[gr].nr = 0;
-                    grid[zi][yi][xi].a[gr].nr = 0;
-                }
-            }
-        }
-        DBB(dum);
-
-        /* put atoms in grid cells */
-        for (bAcc = FALSE; (bAcc <= TRUE); bAcc++)
+        bDone = TRUE;
+        for (m = DIM-1; m >= 0; m--)
         {
-            if (bAcc)
-            {
-                nr = hb->a.nra;
-                ad = hb->a.acc;
-            }
-            else
+            if (dx[m] < -hbox[m])
             {
-                nr = hb->d.nrd;
-                ad = hb->d.don;
+                bDone = FALSE;
+                rvec_inc(dx, box[m]);
             }
-            DBB(bAcc);
-            for (i = 0; (i < nr); i++)
+            if (dx[m] >= hbox[m])
             {
-                /* check if we are inside the shell */
-                /* if bDoRshell=FALSE then bInShell=TRUE always */
-                DBB(i);
-                if (bDoRshell)
-                {
-                    bInShell = TRUE;
-                    rvec_sub(x[ad[i]], xshell, dshell);
-                    if (bBox)
-                    {
-                        gmx_bool bDone = FALSE;
-                        while (!bDone)
-                        {
-                            bDone = TRUE;
-                            for (m = DIM-1; m >= 0 && bInShell; m--)
-                            {
-                                if (dshell[m] < -hbox[m])
-                                {
-                                    bDone = FALSE;
-                                    rvec_inc(dshell, box[m]);
-                                }
-                                if (dshell[m] >= hbox[m])
-                                {
-                                    bDone      = FALSE;
-                                    dshell[m] -= 2*hbox[m];
-                                }
-                            }
-                        }
-                        for (m = DIM-1; m >= 0 && bInShell; m--)
-                        {
-                            /* if we're outside the cube, we're outside the sphere also! */
-                            if ( (dshell[m] > rshell) || (-dshell[m] > rshell) )
-                            {
-                                bInShell = FALSE;
-                            }
-                        }
-                    }
-                    /* if we're inside the cube, check if we're inside the sphere */
-                    if (bInShell)
-                    {
-                        bInShell = norm2(dshell) < rshell2;
-                    }
-                }
-                DBB(i);
-                if (bInShell)
-                {
-                    if (bBox)
-                    {
-                        pbc_in_gridbox(x[ad[i]], box);
-
-                        for (m = DIM-1; m >= 0; m--)
-                        {   /* determine grid index of atom */
-                            grididx[m] = static_cast<int>(x[ad[i]][m]*invdelta[m]);
-                            grididx[m] = (grididx[m]+ngrid[m]) % ngrid[m];
-                        }
-                    }
-
-                    gx = grididx[XX];
-                    gy = grididx[YY];
-                    gz = grididx[ZZ];
-                    range_check(gx, 0, ngrid[XX]);
-                    range_check(gy, 0, ngrid[YY]);
-                    range_check(gz, 0, ngrid[ZZ]);
-                    DBB(gx);
-                    DBB(gy);
-                    DBB(gz);
-                    /* add atom to grid cell */
-                    if (bAcc)
-                    {
-                        newgrid = &(grid[gz][gy][gx].a[gr]);
-                    }
-                    else
-                    {
-                        newgrid = &(grid[gz][gy][gx].d[gr]);
-                    }
-                    if (newgrid->nr >= newgrid->maxnr)
-                    {
-                        newgrid->maxnr += 10;
-                        DBB(newgrid->maxnr);
-                        srenew(newgrid->atoms, newgrid->maxnr);
-                    }
-                    DBB(newgrid->nr);
-                    newgrid->atoms[newgrid->nr] = ad[i];
-                    newgrid->nr++;
-                }
+                bDone = FALSE;
+                rvec_dec(dx, box[m]);
             }
         }
     }
 }
 
-static void count_da_grid(ivec ngrid, t_gridcell ***grid, t_icell danr)
+/* Puts the donors and acceptors of each group that are within the shell
+ * (all of them when rshell <= 0) in donors[] and acceptors[], counts
+ * the donors in danr (if not NULL) and returns the largest
+ * donor-hydrogen distance.
+ */
+static real select_donors_acceptors(t_hbdata *hb, rvec x[], const rvec xshell,
+                                    real rshell, gmx_bool bBox, matrix box, rvec hbox,
+                                    std::vector<int> donors[], std::vector<int> acceptors[],
+                                    int *danr)
 {
-    int gr, xi, yi, zi;
+    int      i, h, gr, ndon;
+    rvec     dx;
+    real     r2, rshell2, maxdh2;
 
+    rshell2 = gmx::square(rshell);
     for (gr = 0; (gr < grNR); gr++)
     {
-        danr[gr] = 0;
-        for (zi = 0; zi < ngrid[ZZ]; zi++)
-        {
-            for (yi = 0; yi < ngrid[YY]; yi++)
-            {
-                for (xi = 0; xi < ngrid[XX]; xi++)
-                {
-                    danr[gr] += grid[zi][yi][xi].d[gr].nr;
-                }
-            }
-        }
+        donors[gr].clear();
+        acceptors[gr].clear();
     }
-}
-
-/* The grid loop.
- * Without a box, the grid is 1x1x1, so all loops are 1 long.
- * With a rectangular box (bTric==FALSE) all loops are 3 long.
- * With a triclinic box all loops are 3 long, except when a cell is
- * located next to one of the box edges which is not parallel to the
- * x/y-plane, in that case all cells in a line or layer are searched.
- * This could be implemented slightly more efficient, but the code
- * would get much more complicated.
- */
-static gmx_inline gmx_bool grid_loop_begin(int n, int x, gmx_bool bTric, gmx_bool bEdge)
-{
-    return ((n == 1) ? x : bTric && bEdge ? 0     : (x-1));
-}
-static gmx_inline gmx_bool grid_loop_end(int n, int x, gmx_bool bTric, gmx_bool bEdge)
-{
-    return ((n == 1) ? x : bTric && bEdge ? (n-1) : (x+1));
-}
-static gmx_inline int grid_mod(int j, int n)
-{
-    return (j+n) % (n);
-}
-
-static void dump_grid(FILE *fp, ivec ngrid, t_gridcell ***grid)
-{
-    int gr, x, y, z, sum[grNR];
-
-    fprintf(fp, "grid %dx%dx%d\n", ngrid[XX], ngrid[YY], ngrid[ZZ]);
-    for (gr = 0; gr < grNR; gr++)
+    ndon   = 0;
+    maxdh2 = 0;
+    for (i = 0; (i < hb->d.nrd); i++)
     {
-        sum[gr] = 0;
-        fprintf(fp, "GROUP %d (%s)\n", gr, grpnames[gr]);
-        for (z = 0; z < ngrid[ZZ]; z += 2)
+        if (rshell > 0)
         {
-            fprintf(fp, "Z=%d,%d\n", z, z+1);
-            for (y = 0; y < ngrid[YY]; y++)
+            rvec_sub(x[hb->d.don[i]], xshell, dx);
+            if (bBox)
             {
-                for (x = 0; x < ngrid[XX]; x++)
-                {
-                    fprintf(fp, "%3d", grid[x][y][z].d[gr].nr);
-                    sum[gr] += grid[z][y][x].d[gr].nr;
-                    fprintf(fp, "%3d", grid[x][y][z].a[gr].nr);
-                    sum[gr] += grid[z][y][x].a[gr].nr;
-
-                }
-                fprintf(fp, " | ");
-                if ( (z+1) < ngrid[ZZ])
-                {
-                    for (x = 0; x < ngrid[XX]; x++)
-                    {
-                        fprintf(fp, "%3d", grid[z+1][y][x].d[gr].nr);
-                        sum[gr] += grid[z+1][y][x].d[gr].nr;
-                        fprintf(fp, "%3d", grid[z+1][y][x].a[gr].nr);
-                        sum[gr] += grid[z+1][y][x].a[gr].nr;
-                    }
-                }
-                fprintf(fp, "\n");
+                pbc_correct_gem(dx, box, hbox);
+            }
+            if (norm2(dx) >= rshell2)
+            {
+                continue;
             }
         }
-    }
-    fprintf(fp, "TOTALS:");
-    for (gr = 0; gr < grNR; gr++)
-    {
-        fprintf(fp, " %d=%d", gr, sum[gr]);
-    }
-    fprintf(fp, "\n");
-}
-
-/* New GMX record! 5 * in a row. Congratulations!
- * Sorry, only four left.
- */
-static void free_grid(ivec ngrid, t_gridcell ****grid)
-{
-    int           y, z;
-    t_gridcell ***g = *grid;
-
-    for (z = 0; z < ngrid[ZZ]; z++)
-    {
-        for (y = 0; y < ngrid[YY]; y++)
+        donors[hb->d.grp[i]].push_back(hb->d.don[i]);
+        ndon++;
+        for (h = 0; (h < hb->d.nhydro[i]); h++)
         {
-            sfree(g[z][y]);
+            rvec_sub(x[hb->d.don[i]], x[hb->d.hydro[i][h]], dx);
+            if (bBox)
+            {
+                pbc_correct_gem(dx, box, hbox);
+            }
+            r2     = norm2(dx);
+            maxdh2 = std::max(maxdh2, r2);
         }
-        sfree(g[z]);
     }
-    sfree(g);
-    g = NULL;
-}
-
-static void pbc_correct_gem(rvec dx, matrix box, rvec hbox)
-{
-    int      m;
-    gmx_bool bDone = FALSE;
-    while (!bDone)
+    for (i = 0; (i < hb->a.nra); i++)
     {
-        bDone = TRUE;
-        for (m = DIM-1; m >= 0; m--)
+        if (rshell > 0)
         {
-            if (dx[m] < -hbox[m])
+            rvec_sub(x[hb->a.acc[i]], xshell, dx);
+            if (bBox)
             {
-                bDone = FALSE;
-                rvec_inc(dx, box[m]);
+                pbc_correct_gem(dx, box, hbox);
             }
-            if (dx[m] >= hbox[m])
+            if (norm2(dx) >= rshell2)
             {
-                bDone = FALSE;
-                rvec_dec(dx, box[m]);
+                continue;
             }
         }
+        acceptors[hb->a.grp[i]].push_back(hb->a.acc[i]);
     }
-}
-
-static void pbc_in_gridbox(rvec dx, matrix box)
-{
-    int      m;
-    gmx_bool bDone = FALSE;
-    while (!bDone)
+    if (danr)
     {
-        bDone = TRUE;
-        for (m = DIM-1; m >= 0; m--)
+        /* All donors are candidates for each group */
+        for (gr = 0; (gr < grNR); gr++)
         {
-            if (dx[m] < 0)
-            {
-                bDone = FALSE;
-                rvec_inc(dx, box[m]);
-            }
-            if (dx[m] >= box[m][m])
-            {
-                bDone = FALSE;
-                rvec_dec(dx, box[m]);
-            }
+            danr[gr] = ndon;
         }
     }
+
+    return std::sqrt(maxdh2);
 }
 
 /* Added argument r2cut, changed contact and implemented
@@ -1357,71 +1122,47 @@ static int is_hbond(t_hbdata *hb, int grpd, int grpa, int d, int a,
 /* Merging is now done on the fly, so do_merge is most likely obsolete now.
  * Will do some more testing before removing the function entirely.
  * - Erik Marklund, MAY 10 2010 */
-static void do_merge(t_hbdata *hb, int ntmp,
-                     unsigned int htmp[], unsigned int gtmp[],
-                     t_hbond *hb0, t_hbond *hb1)
+static void merge_hbexist(t_hbexist *dest, int destShift,
+                          const t_hbexist *src, int srcShift)
+{
+    int i;
+
+    for (i = 0; (i < dest->nrun); i++)
+    {
+        dest->start[i] += destShift;
+        dest->end[i]   += destShift;
+    }
+    for (i = 0; (i < src->nrun); i++)
+    {
+        add_hbexist_range(dest, src->start[i]+srcShift, src->end[i]+srcShift);
+    }
+}
+
+static void do_merge(t_hbond *hb0, t_hbond *hb1)
 {
     /* Here we need to make sure we're treating periodicity in
      * the right way for the geminate recombination kinetics. */
 
-    int       m, mm, n00, n01, nn0, nnframes;
+    int       n00, n01, nn0, nnframes;
 
     /* Decide where to start from when merging */
     n00      = hb0->n0;
     n01      = hb1->n0;
     nn0      = std::min(n00, n01);
     nnframes = std::max(n00 + hb0->nframes, n01 + hb1->nframes) - nn0;
-    /* Initiate tmp arrays */
-    for (m = 0; (m < ntmp); m++)
-    {
-        htmp[m] = 0;
-        gtmp[m] = 0;
-    }
-    /* Fill tmp arrays with values due to first HB */
-    /* Once again '<' had to be replaced with '<='
-       to catch the last frame in which the hbond
-       appears.
-       - Erik Marklund, June 1, 2006 */
-    for (m = 0; (m <= hb0->nframes); m++)
-    {
-        mm       = m+n00-nn0;
-        htmp[mm] = is_hb(hb0->h[0], m);
-    }
-    for (m = 0; (m <= hb0->nframes); m++)
-    {
-        mm       = m+n00-nn0;
-        gtmp[mm] = is_hb(hb0->g[0], m);
-    }
-    /* Next HB */
-    for (m = 0; (m <= hb1->nframes); m++)
-    {
-        mm       = m+n01-nn0;
-        htmp[mm] = htmp[mm] || is_hb(hb1->h[0], m);
-        gtmp[mm] = gtmp[mm] || is_hb(hb1->g[0], m);
-    }
-    /* Reallocate target array */
-    if (nnframes > hb0->maxframes)
-    {
-        srenew(hb0->h[0], 4+nnframes/hb->wordlen);
-        srenew(hb0->g[0], 4+nnframes/hb->wordlen);
-    }
 
-    /* Copy temp array to target array */
-    for (m = 0; (m <= nnframes); m++)
-    {
-        _set_hb(hb0->h[0], m, htmp[m]);
-        _set_hb(hb0->g[0], m, gtmp[m]);
-    }
+    /* Take the union of the existence of both HBs */
+    merge_hbexist(hb0->h[0], n00-nn0, hb1->h[0], n01-nn0);
+    merge_hbexist(hb0->g[0], n00-nn0, hb1->g[0], n01-nn0);
 
     /* Set scalar variables */
-    hb0->n0        = nn0;
-    hb0->maxframes = nnframes;
+    hb0->n0      = nn0;
+    hb0->nframes = nnframes;
 }
 
 static void merge_hb(t_hbdata *hb, gmx_bool bTwo, gmx_bool bContact)
 {
-    int           i, inrnew, indnew, j, ii, jj, id, ia, ntmp;
-    unsigned int *htmp, *gtmp;
+    int           i, inrnew, indnew, j, ii, jj, id, ia;
     t_hbond      *hb0, *hb1;
 
     inrnew = hb->nrhb;
@@ -1430,9 +1171,6 @@ static void merge_hb(t_hbdata *hb, gmx_bool bTwo, gmx_bool bContact)
     /* Check whether donors are also acceptors */
     printf("Merging hbonds with Acceptor and Donor swapped\n");
 
-    ntmp = 2*hb->max_frames;
-    snew(gtmp, ntmp);
-    snew(htmp, ntmp);
     for (i = 0; (i < hb->d.nrd); i++)
     {
         fprintf(stderr, "\r%d/%d", i+1, hb->d.nrd);
@@ -1450,7 +1188,7 @@ static void merge_hb(t_hbdata *hb, gmx_bool bTwo, gmx_bool bContact)
                 hb1 = hb->hbmap[jj][ii];
                 if (hb0 && hb1 && ISHB(hb0->history[0]) && ISHB(hb1->history[0]))
                 {
-                    do_merge(hb, ntmp, htmp, gtmp, hb0, hb1);
+                    do_merge(hb0, hb1);
                     if (ISHB(hb1->history[0]))
                     {
                         inrnew--;
@@ -1468,10 +1206,8 @@ static void merge_hb(t_hbdata *hb, gmx_bool bTwo, gmx_bool bContact)
                     {
                         gmx_incons("Neither hydrogen bond nor distance");
                     }
-                    sfree(hb1->h[0]);
-                    sfree(hb1->g[0]);
-                    hb1->h[0]       = NULL;
-                    hb1->g[0]       = NULL;
+                    done_hbexist(&hb1->h[0]);
+                    done_hbexist(&hb1->g[0]);
                     hb1->history[0] = hbNo;
                 }
             }
@@ -1482,8 +1218,6 @@ static void merge_hb(t_hbdata *hb, gmx_bool bTwo, gmx_bool bContact)
     printf("- Reduced number of distances from %d to %d\n", hb->nrdist, indnew);
     hb->nrhb   = inrnew;
     hb->nrdist = indnew;
-    sfree(gtmp);
-    sfree(htmp);
 }
 
 static void do_nhb_dist(FILE *fp, t_hbdata *hb, real t)
@@ -1519,9 +1253,9 @@ static void do_hblife(const char *fn, t_hbdata *hb, gmx_bool bMerge, gmx_bool bC
     FILE          *fp;
     const char    *leg[] = { "p(t)", "t p(t)" };
     int           *histo;
-    int            i, j, j0, k, m, nh, ihb, ohb, nhydro, ndump = 0;
+    int            i, j, j0, k, m, nh, nhydro, ndump = 0;
     int            nframes = hb->nframes;
-    unsigned int **h;
+    t_hbexist    **h;
     real           t, x1, dt;
     double         sum, integral;
     t_hbond       *hbh;
@@ -1561,27 +1295,16 @@ static void do_hblife(const char *fn, t_hbdata *hb, gmx_bool bMerge, gmx_bool bC
                 }
                 for (nh = 0; (nh < nhydro); nh++)
                 {
-                    ohb = 0;
-                    j0  = 0;
-
-                    for (j = 0; (j <= hbh->nframes); j++)
+                    /* Only runs that end within the analyzed frames count */
+                    for (j = 0; (j < h[nh]->nrun); j++)
                     {
-                        ihb      = is_hb(h[nh], j);
                         if (debug && (ndump < 10))
                         {
-                            fprintf(debug, "%5d  %5d\n", j, ihb);
+                            fprintf(debug, "%5d  %5d\n", h[nh]->start[j], h[nh]->end[j]);
                         }
-                        if (ihb != ohb)
+                        if (h[nh]->end[j] <= hbh->nframes)
                         {
-                            if (ihb)
-                            {
-                                j0 = j;
-                            }
-                            else
-                            {
-                                histo[j-j0]++;
-                            }
-                            ohb = ihb;
+                            histo[h[nh]->end[j]-h[nh]->start[j]]++;
                         }
                     }
                     ndump++;
@@ -1928,7 +1651,7 @@ static void do_hbac(const char *fn, t_hbdata *hb,
     real          *ct, tail, tail2, dtail, *cct;
     const real     tol     = 1e-3;
     int            nframes = hb->nframes;
-    unsigned int **h       = NULL, **g = NULL;
+    t_hbexist    **h       = NULL, **g = NULL;
     int            nh, nhbonds, nhydro;
     t_hbond       *hbh;
     int            acType;
@@ -2520,27 +2243,28 @@ int gmx_hbond(int argc, char *argv[])
     real                  t, ccut, dist = 0.0, ang = 0.0;
     double                max_nhb, aver_nhb, aver_dist;
     int                   h = 0, i = 0, j, k = 0, ogrp, nsel;
-    int                   xi, yi, zi, ai;
-    int                   xj, yj, zj, aj, xjj, yjj, zjj;
-    gmx_bool              bSelected, bHBmap, bStop, bTwo, bBox, bTric;
+    int                   ai;
+    gmx_bool              bSelected, bHBmap, bStop, bTwo, bBox;
     int                  *adist, *rdist;
     int                   grp, nabin, nrbin, resdist, ihb;
     char                **leg;
     t_hbdata             *hb;
     FILE                 *fp, *fpnhb = NULL, *donor_properties = NULL;
-    t_gridcell         ***grid;
-    t_ncell              *icell, *jcell;
-    ivec                  ngrid;
+    t_pbc                 pbc;
+    real                  maxdh;
+    std::vector<int>      donors[grNR], acceptors[grNR]; /* within the shell */
     unsigned char        *datable;
     gmx_output_env_t     *oenv;
     int                   ii, hh, actual_nThreads;
     int                   threadNr = 0;
     gmx_bool              bParallel;
-    gmx_bool              bEdge_yjj, bEdge_xjj;
 
     t_hbdata            **p_hb    = NULL;                   /* one per thread, then merge after the frame loop */
     int                 **p_adist = NULL, **p_rdist = NULL; /* a histogram for each thread. */
 
+    gmx::AnalysisNeighborhood       nb;
+    gmx::AnalysisNeighborhoodSearch nbsearch[grNR]; /* acceptors of each group */
+
     const bool            bOMP = GMX_OPENMP;
 
     npargs = asize(pa);
@@ -2767,7 +2491,6 @@ int gmx_hbond(int argc, char *argv[])
     }
 
     bBox  = (ir->ePBC != epbcNONE);
-    grid  = init_grid(bBox, box, (rcut > r2cut) ? rcut : r2cut, ngrid);
     nabin = static_cast<int>(acut/abin);
     nrbin = static_cast<int>(rcut/rbin);
     snew(adist, nabin+1);
@@ -2821,7 +2544,6 @@ int gmx_hbond(int argc, char *argv[])
 
             p_hb[i]->bHBmap     = hb->bHBmap;
             p_hb[i]->bDAnr      = hb->bDAnr;
-            p_hb[i]->wordlen    = hb->wordlen;
             p_hb[i]->nframes    = hb->nframes;
             p_hb[i]->maxhydro   = hb->maxhydro;
             p_hb[i]->danr       = hb->danr;
@@ -2840,13 +2562,9 @@ int gmx_hbond(int argc, char *argv[])
 
 #pragma omp parallel \
     firstprivate(i) \
-    private(j, h, ii, hh, \
-    xi, yi, zi, xj, yj, zj, threadNr, \
-    dist, ang, icell, jcell, \
-    grp, ogrp, ai, aj, xjj, yjj, zjj, \
-    ihb, resdist, \
-    k, bTric, \
-    bEdge_xjj, bEdge_yjj) \
+    private(j, h, ii, hh, threadNr, \
+    dist, ang, grp, ogrp, ai, \
+    ihb, resdist, k) \
     default(shared)
     {                           /* Start of parallel region */
 #if !defined __clang_analyzer__ // clang complains about unused value.
@@ -2855,9 +2573,6 @@ int gmx_hbond(int argc, char *argv[])
 
         do
         {
-
-            bTric = bBox && TRICLINIC(box);
-
             if (bOMP)
             {
                 try
@@ -2870,21 +2585,32 @@ int gmx_hbond(int argc, char *argv[])
             {
                 try
                 {
-                    build_grid(hb, x, x[shatom], bBox, box, hbox, (rcut > r2cut) ? rcut : r2cut,
-                               rshell, ngrid, grid);
-                    reset_nhbonds(&(hb->d));
-
-                    if (debug && bDebug)
+                    if (bBox)
+                    {
+                        set_pbc(&pbc, ir->ePBC, box);
+                    }
+                    for (k = 0; (k < DIM); k++)
                     {
-                        dump_grid(debug, ngrid, grid);
+                        hbox[k] = box[k][k]*0.5;
                     }
+                    reset_nhbonds(&(hb->d));
 
                     add_frames(hb, nframes);
                     init_hbframe(hb, nframes, output_env_conv_time(oenv, t));
 
-                    if (hb->bDAnr)
+                    maxdh = select_donors_acceptors(hb, x, x[shatom], rshell, bBox, box, hbox,
+                                                    donors, acceptors,
+                                                    hb->bDAnr ? hb->danr[nframes] : NULL);
+                    /* With the hydrogen-acceptor distance criterion, the
+                     * donor-acceptor distance can exceed the cut-off by
+                     * at most the donor-hydrogen distance.
+                     */
+                    nb.setCutoff(((rcut > r2cut) ? rcut : r2cut) + ((bDA || bContact) ? 0 : maxdh));
+                    for (grp = gr0; (grp <= (bTwo ? gr1 : gr0)); grp++)
                     {
-                        count_da_grid(ngrid, grid, hb->danr[nframes]);
+                        gmx::AnalysisNeighborhoodPositions accPos(x, natoms);
+                        nbsearch[grp] = nb.initSearch(bBox ? &pbc : NULL,
+                                                      accPos.indexed(acceptors[grp]));
                     }
                 }
                 GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR;
@@ -2925,116 +2651,78 @@ int gmx_hbond(int argc, char *argv[])
             }     /* if (bSelected) */
             else
             {
-                /* The outer grid loop will have to do for now. */
-#pragma omp for schedule(dynamic)
-                for (xi = 0; xi < ngrid[XX]; xi++)
+                /* Loop over donor groups gr0 (always) and gr1 (if necessary)
+                 * and search the acceptors of the other group around each donor.
+                 */
+                for (grp = gr0; (grp <= (bTwo ? gr1 : gr0)); grp++)
                 {
-                    try
+                    if (bTwo)
+                    {
+                        ogrp = 1-grp;
+                    }
+                    else
+                    {
+                        ogrp = grp;
+                    }
+                    int ndonors = donors[grp].size();
+#pragma omp for schedule(dynamic, 16)
+                    for (ai = 0; ai < ndonors; ai++)
                     {
-                        for (yi = 0; (yi < ngrid[YY]); yi++)
+                        try
                         {
-                            for (zi = 0; (zi < ngrid[ZZ]); zi++)
+                            gmx::AnalysisNeighborhoodPair       pair;
+                            gmx::AnalysisNeighborhoodPairSearch pairSearch =
+                                nbsearch[ogrp].startPairSearch(x[donors[grp][ai]]);
+
+                            i = donors[grp][ai];
+                            while (pairSearch.findNextPair(&pair))
                             {
+                                j = acceptors[ogrp][pair.refIndex()];
+                                h = NOTSET;
 
-                                /* loop over donor groups gr0 (always) and gr1 (if necessary) */
-                                for (grp = gr0; (grp <= (bTwo ? gr1 : gr0)); grp++)
-                                {
-                                    icell = &(grid[zi][yi][xi].d[grp]);
+                                /* check if this once was a h-bond */
+                                ihb  = is_hbond(__HBDATA, grp, ogrp, i, j, rcut, r2cut, ccut, x, bBox, box,
+                                                hbox, &dist, &ang, bDA, &h, bContact, bMerge);
 
-                                    if (bTwo)
-                                    {
-                                        ogrp = 1-grp;
-                                    }
-                                    else
-                                    {
-                                        ogrp = grp;
-                                    }
+                                if (ihb)
+                                {
+                                    /* add to index if not already there */
+                                    /* Add a hbond */
+                                    add_hbond(__HBDATA, i, j, h, grp, ogrp, nframes, bMerge, ihb, bContact);
 
-                                    /* loop over all hydrogen atoms from group (grp)
-                                     * in this gridcell (icell)
-                                     */
-                                    for (ai = 0; (ai < icell->nr); ai++)
+                                    /* make angle and distance distributions */
+                                    if (ihb == hbHB && !bContact)
                                     {
-                                        i  = icell->atoms[ai];
-
-                                        /* loop over all adjacent gridcells (xj,yj,zj) */
-                                        for (zjj = grid_loop_begin(ngrid[ZZ], zi, bTric, FALSE);
-                                             zjj <= grid_loop_end(ngrid[ZZ], zi, bTric, FALSE);
-                                             zjj++)
+                                        if (dist > rcut)
                                         {
-                                            zj        = grid_mod(zjj, ngrid[ZZ]);
-                                            bEdge_yjj = (zj == 0) || (zj == ngrid[ZZ] - 1);
-                                            for (yjj = grid_loop_begin(ngrid[YY], yi, bTric, bEdge_yjj);
-                                                 yjj <= grid_loop_end(ngrid[YY], yi, bTric, bEdge_yjj);
-                                                 yjj++)
+                                            gmx_fatal(FARGS, "distance is higher than what is allowed for an hbond: %f", dist);
+                                        }
+                                        ang *= RAD2DEG;
+                                        __ADIST[static_cast<int>( ang/abin)]++;
+                                        __RDIST[static_cast<int>(dist/rbin)]++;
+                                        if (!bTwo)
+                                        {
+                                            if (donor_index(&hb->d, grp, i) == NOTSET)
+                                            {
+                                                gmx_fatal(FARGS, "Invalid donor %d", i);
+                                            }
+                                            if (acceptor_index(&hb->a, ogrp, j) == NOTSET)
                                             {
-                                                yj        = grid_mod(yjj, ngrid[YY]);
-                                                bEdge_xjj =
-                                                    (yj == 0) || (yj == ngrid[YY] - 1) ||
-                                                    (zj == 0) || (zj == ngrid[ZZ] - 1);
-                                                for (xjj = grid_loop_begin(ngrid[XX], xi, bTric, bEdge_xjj);
-                                                     xjj <= grid_loop_end(ngrid[XX], xi, bTric, bEdge_xjj);
-                                                     xjj++)
-                                                {
-                                                    xj    = grid_mod(xjj, ngrid[XX]);
-                                                    jcell = &(grid[zj][yj][xj].a[ogrp]);
-                                                    /* loop over acceptor atoms from other group (ogrp)
-                                                     * in this adjacent gridcell (jcell)
-                                                     */
-                                                    for (aj = 0; (aj < jcell->nr); aj++)
-                                                    {
-                                                        j = jcell->atoms[aj];
-
-                                                        /* check if this once was a h-bond */
-                                                        ihb  = is_hbond(__HBDATA, grp, ogrp, i, j, rcut, r2cut, ccut, x, bBox, box,
-                                                                        hbox, &dist, &ang, bDA, &h, bContact, bMerge);
-
-                                                        if (ihb)
-                                                        {
-                                                            /* add to index if not already there */
-                                                            /* Add a hbond */
-                                                            add_hbond(__HBDATA, i, j, h, grp, ogrp, nframes, bMerge, ihb, bContact);
-
-                                                            /* make angle and distance distributions */
-                                                            if (ihb == hbHB && !bContact)
-                                                            {
-                                                                if (dist > rcut)
-                                                                {
-                                                                    gmx_fatal(FARGS, "distance is higher than what is allowed for an hbond: %f", dist);
-                                                                }
-                                                                ang *= RAD2DEG;
-                                                                __ADIST[static_cast<int>( ang/abin)]++;
-                                                                __RDIST[static_cast<int>(dist/rbin)]++;
-                                                                if (!bTwo)
-                                                                {
-                                                                    if (donor_index(&hb->d, grp, i) == NOTSET)
-                                                                    {
-                                                                        gmx_fatal(FARGS, "Invalid donor %d", i);
-                                                                    }
-                                                                    if (acceptor_index(&hb->a, ogrp, j) == NOTSET)
-                                                                    {
-                                                                        gmx_fatal(FARGS, "Invalid acceptor %d", j);
-                                                                    }
-                                                                    resdist = std::abs(top.atoms.atom[i].resind-top.atoms.atom[j].resind);
-                                                                    if (resdist >= max_hx)
-                                                                    {
-                                                                        resdist = max_hx-1;
-                                                                    }
-                                                                    __HBDATA->nhx[nframes][resdist]++;
-                                                                }
-                                                            }
-
-                                                        }
-                                                    } /* for aj  */
-                                                }     /* for xjj */
-                                            }         /* for yjj */
-                                        }             /* for zjj */
-                                    }                 /* for ai  */
-                                }                     /* for grp */
-                            }                         /* for xi,yi,zi */
+                                                gmx_fatal(FARGS, "Invalid acceptor %d", j);
+                                            }
+                                            resdist = std::abs(top.atoms.atom[i].resind-top.atoms.atom[j].resind);
+                                            if (resdist >= max_hx)
+                                            {
+                                                resdist = max_hx-1;
+                                            }
+                                            __HBDATA->nhx[nframes][resdist]++;
+                                        }
+                                    }
+                                }
+                            } /* for pairs */
                         }
+                        GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR;
                     }
-                    GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR;
                 }
             } /* if (bSelected) {...} else */
 
@@ -3155,8 +2843,6 @@ int gmx_hbond(int argc, char *argv[])
         gmx_fatal(FARGS, "Cannot calculate autocorrelation of life times with less than two frames");
     }
 
-    free_grid(ngrid, &grid);
-
     close_trj(status);
 
     if (donor_properties)
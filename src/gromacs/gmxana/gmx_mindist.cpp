@@ -41,6 +41,7 @@
 #include <cstring>
 
 #include <algorithm>
+#include <vector>
 
 #include "gromacs/commandline/pargs.h"
 #include "gromacs/commandline/viewit.h"
@@ -53,24 +54,72 @@
 #include "gromacs/mdtypes/md_enums.h"
 #include "gromacs/pbcutil/pbc.h"
 #include "gromacs/pbcutil/rmpbc.h"
+#include "gromacs/selection/nbsearch.h"
 #include "gromacs/topology/index.h"
 #include "gromacs/topology/topology.h"
+#include "gromacs/utility/arrayref.h"
 #include "gromacs/utility/arraysize.h"
 #include "gromacs/utility/cstringutil.h"
+#include "gromacs/utility/exceptions.h"
 #include "gromacs/utility/fatalerror.h"
 #include "gromacs/utility/futil.h"
 #include "gromacs/utility/gmxassert.h"
+#include "gromacs/utility/gmxomp.h"
 #include "gromacs/utility/smalloc.h"
 
 
+/* Margin added to the neighborhood search cutoffs. Distances of the found
+ * pairs are recomputed with the same expressions as the all-pairs loops
+ * (for bitwise identical output), and these can differ in the last bits
+ * from the distances in the search; the margin makes sure no pair within
+ * the actual cutoff is missed.
+ */
+static const real c_searchMargin = 1e-3;
+
+/* Smallest cutoff for the search of the minimum distance to an image */
+static const real c_minSearchCutoff = 0.5;
+
+/* Candidate for the minimum distance, found by a neighborhood search */
+typedef struct {
+    real r2;    /* Squared distance */
+    int  outer; /* Index in the outer loop of the all-pairs search */
+    int  inner; /* Index in the inner loop of the all-pairs search */
+} t_mindist_pair;
+
+/* Returns whether a pair at distance r2 would be reported instead of p by
+ * the all-pairs loops, which keep the first pair with the smallest distance.
+ */
+static gmx_bool pair_precedes(real r2, int outer, int inner,
+                              const t_mindist_pair *p)
+{
+    if (r2 != p->r2)
+    {
+        return r2 < p->r2;
+    }
+    return outer < p->outer || (outer == p->outer && inner < p->inner);
+}
+
+static void update_mindist_pair(real r2, int outer, int inner,
+                                t_mindist_pair *p)
+{
+    if (pair_precedes(r2, outer, inner, p))
+    {
+        p->r2    = r2;
+        p->outer = outer;
+        p->inner = inner;
+    }
+}
+
 static void periodic_dist(int ePBC,
                           matrix box, rvec x[], int n, int index[],
-                          real *rmin, real *rmax, int *min_ind)
+                          real *rmin, real *rmax, int *min_ind,
+                          real *searchCutoff, int nthreads, gmx_int64_t minSearchPairs)
 {
 #define NSHIFT_MAX 26
-    int  nsz, nshift, sx, sy, sz, i, j, s;
-    real sqr_box, r2min, r2max, r2;
-    rvec shift[NSHIFT_MAX], d0, d;
+    int            nsz, nshift, sx, sy, sz, i;
+    real           sqr_box, r2max, cutoff;
+    rvec           shift[NSHIFT_MAX];
+    t_mindist_pair min_pair;
 
     sqr_box = std::min(norm2(box[XX]), norm2(box[YY]));
     if (ePBC == epbcXYZ)
@@ -109,40 +158,179 @@ static void periodic_dist(int ePBC,
         }
     }
 
-    r2min = sqr_box;
+    /* The maximum internal distance needs all pairs */
     r2max = 0;
+#pragma omp parallel num_threads(nthreads)
+    {
+        real r2max_thread = 0;
 
-    for (i = 0; i < n; i++)
+#pragma omp for schedule(dynamic, 16)
+        for (int a = 0; a < n; a++)
+        {
+            for (int b = a+1; b < n; b++)
+            {
+                rvec d0;
+
+                rvec_sub(x[index[a]], x[index[b]], d0);
+                r2max_thread = std::max(r2max_thread, norm2(d0));
+            }
+        }
+#pragma omp critical
+        {
+            r2max = std::max(r2max, r2max_thread);
+        }
+    }
+
+    /* The minimum distance to an image is found by searching the pairs
+     * between the group and each of its shifted images. The range of the
+     * minimum is not known beforehand, so we start from the cutoff that
+     * worked for the previous frame, and double it until it contains a pair,
+     * or all pairs shorter than the box are covered.
+     * Only image positions close to the bounding box of the group are
+     * searched, which are few for all shifts except for very small boxes.
+     * Pairs exactly at the box length are never reported, as in the
+     * all-pairs loop, thanks to the invalid initial indices.
+     */
+    min_pair.r2    = sqr_box;
+    min_pair.outer = -1;
+    min_pair.inner = -1;
+    if (static_cast<gmx_int64_t>(n)*(n - 1)/2*nshift < minSearchPairs)
     {
-        for (j = i+1; j < n; j++)
+        /* Few pairs, check all of them */
+        for (int a = 0; a < n; a++)
         {
-            rvec_sub(x[index[i]], x[index[j]], d0);
-            r2 = norm2(d0);
-            if (r2 > r2max)
+            for (int b = a+1; b < n; b++)
             {
-                r2max = r2;
+                rvec d0, d;
+
+                rvec_sub(x[index[a]], x[index[b]], d0);
+                for (int s = 0; s < nshift; s++)
+                {
+                    rvec_add(d0, shift[s], d);
+                    update_mindist_pair(norm2(d), a, b, &min_pair);
+                }
             }
-            for (s = 0; s < nshift; s++)
+        }
+        if (min_pair.outer >= 0)
+        {
+            min_ind[0] = min_pair.outer;
+            min_ind[1] = min_pair.inner;
+        }
+    }
+    else if (n > 1)
+    {
+        rvec bbmin, bbmax;
+
+        copy_rvec(x[index[0]], bbmin);
+        copy_rvec(x[index[0]], bbmax);
+        for (int a = 1; a < n; a++)
+        {
+            for (int d = 0; d < DIM; d++)
             {
-                rvec_add(d0, shift[s], d);
-                r2 = norm2(d);
-                if (r2 < r2min)
+                bbmin[d] = std::min(bbmin[d], x[index[a]][d]);
+                bbmax[d] = std::max(bbmax[d], x[index[a]][d]);
+            }
+        }
+
+        cutoff = std::min(std::max(*searchCutoff, c_minSearchCutoff),
+                          std::sqrt(sqr_box));
+        while (TRUE)
+        {
+            gmx::AnalysisNeighborhood       nb;
+            gmx::AnalysisNeighborhoodSearch search;
+            real                            range = cutoff + c_searchMargin;
+
+            nb.setCutoff(range);
+            search = nb.initSearch(NULL,
+                                   gmx::AnalysisNeighborhoodPositions(x, n)
+                                       .indexed(gmx::constArrayRefFromArray(index, n)));
+#pragma omp parallel num_threads(nthreads)
+            {
+                try
                 {
-                    r2min      = r2;
-                    min_ind[0] = i;
-                    min_ind[1] = j;
+                    t_mindist_pair         min_thread = min_pair;
+                    std::vector<gmx::RVec> ximage;
+                    std::vector<int>       image_index;
+
+#pragma omp for schedule(dynamic)
+                    for (int s = 0; s < nshift; s++)
+                    {
+                        ximage.clear();
+                        image_index.clear();
+                        for (int b = 0; b < n; b++)
+                        {
+                            rvec xb;
+                            int  d;
+
+                            rvec_sub(x[index[b]], shift[s], xb);
+                            for (d = 0; d < DIM; d++)
+                            {
+                                if (xb[d] < bbmin[d] - range || xb[d] > bbmax[d] + range)
+                                {
+                                    break;
+                                }
+                            }
+                            if (d == DIM)
+                            {
+                                ximage.push_back(xb);
+                                image_index.push_back(b);
+                            }
+                        }
+                        if (ximage.empty())
+                        {
+                            continue;
+                        }
+
+                        gmx::AnalysisNeighborhoodPairSearch pairSearch =
+                            search.startPairSearch(ximage);
+                        gmx::AnalysisNeighborhoodPair       pair;
+                        while (pairSearch.findNextPair(&pair))
+                        {
+                            int a = pair.refIndex();
+                            int b = image_index[pair.testIndex()];
+                            if (a < b)
+                            {
+                                rvec d0, d;
+
+                                /* Same expression as in the all-pairs loop */
+                                rvec_sub(x[index[a]], x[index[b]], d0);
+                                rvec_add(d0, shift[s], d);
+                                update_mindist_pair(norm2(d), a, b, &min_thread);
+                            }
+                        }
+                    }
+#pragma omp critical
+                    {
+                        update_mindist_pair(min_thread.r2, min_thread.outer,
+                                            min_thread.inner, &min_pair);
+                    }
                 }
+                GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR;
             }
+            if (min_pair.r2 <= gmx::square(cutoff) || gmx::square(cutoff) >= sqr_box)
+            {
+                break;
+            }
+            cutoff = std::min(2*cutoff, std::sqrt(sqr_box));
+        }
+        if (min_pair.outer >= 0)
+        {
+            min_ind[0]    = min_pair.outer;
+            min_ind[1]    = min_pair.inner;
+            /* Leave some room for the distance to grow in the next frame */
+            *searchCutoff = std::max(c_minSearchCutoff,
+                                     static_cast<real>(1.1*std::sqrt(min_pair.r2)));
         }
     }
 
-    *rmin = std::sqrt(r2min);
+    *rmin = std::sqrt(min_pair.r2);
     *rmax = std::sqrt(r2max);
 }
 
 static void periodic_mindist_plot(const char *trxfn, const char *outfn,
                                   const t_topology *top, int ePBC,
                                   int n, int index[], gmx_bool bSplit,
+                                  gmx_int64_t minSearchPairs,
                                   const gmx_output_env_t *oenv)
 {
     FILE        *out;
@@ -154,7 +342,9 @@ static void periodic_mindist_plot(const char *trxfn, const char *outfn,
     int          natoms, ind_min[2] = {0, 0}, ind_mini = 0, ind_minj = 0;
     real         rmin, rmax, rmint, tmint;
     gmx_bool     bFirst;
-    gmx_rmpbc_t  gpbc = NULL;
+    gmx_rmpbc_t  gpbc         = NULL;
+    real         searchCutoff = c_minSearchCutoff;
+    int          nthreads     = gmx_omp_get_max_threads();
 
     natoms = read_first_x(oenv, &status, trxfn, &t, &x, box);
 
@@ -184,7 +374,8 @@ static void periodic_mindist_plot(const char *trxfn, const char *outfn,
             gmx_rmpbc(gpbc, natoms, box, x);
         }
 
-        periodic_dist(ePBC, box, x, n, index, &rmin, &rmax, ind_min);
+        periodic_dist(ePBC, box, x, n, index, &rmin, &rmax, ind_min,
+                      &searchCutoff, nthreads, minSearchPairs);
         if (rmin < rmint)
         {
             rmint    = rmin;
@@ -325,13 +516,192 @@ static void calc_dist(real rcut, gmx_bool bPBC, int ePBC, matrix box, rvec x[],
     *rmax = std::sqrt(rmax2);
 }
 
+/* Returns whether calc_mindist_search() can be used, and is worth it */
+static gmx_bool use_mindist_search(real rcut, gmx_bool bPBC, int ePBC, matrix box,
+                                   int nx1, int nx2, gmx_int64_t minSearchPairs)
+{
+    if (rcut <= 0 || static_cast<gmx_int64_t>(nx1)*nx2 < minSearchPairs)
+    {
+        return FALSE;
+    }
+    if (bPBC && ePBC != epbcNONE)
+    {
+        /* pbc_dx() and the search should both find the closest image */
+        return ((ePBC == epbcXYZ || ePBC == epbcXY) &&
+                gmx::square(rcut + c_searchMargin) < max_cutoff2(ePBC, box));
+    }
+    return TRUE;
+}
+
+/* Computes the minimum distance, the corresponding atom pair and the number
+ * of contacts between two groups exactly as calc_dist() with bMin, but only
+ * looks at the pairs within rcut found by a neighborhood search. The test
+ * group is divided over nthreads threads.
+ * When nres > 0, resmin2 returns the minimum squared distance for each
+ * residue of group 1 (posres gives the residue of each position in the
+ * group), or -1 when the residue has no pair within rcut.
+ * Returns FALSE when no pair is within rcut; the minimum distance is then
+ * not known and calc_dist() should be used instead.
+ */
+static gmx_bool calc_mindist_search(real rcut, gmx_bool bPBC, int ePBC, matrix box,
+                                    rvec x[], int natoms,
+                                    int nx1, int nx2, int index1[], int index2[],
+                                    gmx_bool bGroup, int nthreads,
+                                    real *rmin, int *nmin, int *ixmin, int *jxmin,
+                                    int nres, const int *posres, real *resmin2)
+{
+    t_pbc                           pbc;
+    real                            rcut2;
+    gmx::AnalysisNeighborhood       nb;
+    gmx::AnalysisNeighborhoodSearch search;
+    t_mindist_pair                  min_pair;
+    std::vector<int>                ncontact(nx2, 0);
+    std::vector<real>               resmin2_thread(nthreads*nres, -1);
+
+    rcut2 = gmx::square(rcut);
+    bPBC  = bPBC && ePBC != epbcNONE;
+    if (bPBC)
+    {
+        set_pbc(&pbc, ePBC, box);
+    }
+    nb.setCutoff(rcut + c_searchMargin);
+    search = nb.initSearch(bPBC ? &pbc : NULL,
+                           gmx::AnalysisNeighborhoodPositions(x, natoms)
+                               .indexed(gmx::constArrayRefFromArray(index1, nx1)));
+
+    /* Pairs beyond rcut never count as the minimum */
+    min_pair.r2    = rcut2;
+    min_pair.outer = nx2;
+    min_pair.inner = nx1;
+#pragma omp parallel num_threads(nthreads)
+    {
+        try
+        {
+            int            thread     = gmx_omp_get_thread_num();
+            int            j0         = (thread*nx2)/nthreads;
+            int            j1         = ((thread + 1)*nx2)/nthreads;
+            real          *resmin2_th = nres > 0 ? &resmin2_thread[thread*nres] : NULL;
+            t_mindist_pair min_thread = min_pair;
+
+            gmx::AnalysisNeighborhoodPairSearch pairSearch =
+                search.startPairSearch(gmx::AnalysisNeighborhoodPositions(x, natoms)
+                                           .indexed(gmx::constArrayRefFromArray(index2 + j0, j1 - j0)));
+            gmx::AnalysisNeighborhoodPair       pair;
+            while (pairSearch.findNextPair(&pair))
+            {
+                int  i  = pair.refIndex();
+                int  j  = j0 + pair.testIndex();
+                int  ix = index1[i];
+                int  jx = index2[j];
+                rvec dx;
+                real r2;
+
+                if (ix == jx)
+                {
+                    continue;
+                }
+                /* Same expression as in calc_dist() */
+                if (bPBC)
+                {
+                    pbc_dx(&pbc, x[ix], x[jx], dx);
+                }
+                else
+                {
+                    rvec_sub(x[ix], x[jx], dx);
+                }
+                r2 = iprod(dx, dx);
+                if (r2 > rcut2)
+                {
+                    continue;
+                }
+                ncontact[j]++;
+                update_mindist_pair(r2, j, i, &min_thread);
+                if (nres > 0)
+                {
+                    real *r2res = &resmin2_th[posres[i]];
+                    if (*r2res < 0 || r2 < *r2res)
+                    {
+                        *r2res = r2;
+                    }
+                }
+            }
+#pragma omp critical
+            {
+                update_mindist_pair(min_thread.r2, min_thread.outer,
+                                    min_thread.inner, &min_pair);
+            }
+        }
+        GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR;
+    }
+
+    if (min_pair.outer == nx2)
+    {
+        return FALSE;
+    }
+
+    *rmin  = std::sqrt(min_pair.r2);
+    *ixmin = index1[min_pair.inner];
+    *jxmin = index2[min_pair.outer];
+    *nmin  = 0;
+    for (int j = 0; j < nx2; j++)
+    {
+        if (bGroup)
+        {
+            *nmin += (ncontact[j] > 0 ? 1 : 0);
+        }
+        else
+        {
+            *nmin += ncontact[j];
+        }
+    }
+    for (int r = 0; r < nres; r++)
+    {
+        resmin2[r] = -1;
+        for (int thread = 0; thread < nthreads; thread++)
+        {
+            real r2 = resmin2_thread[thread*nres + r];
+            if (r2 >= 0 && (resmin2[r] < 0 || r2 < resmin2[r]))
+            {
+                resmin2[r] = r2;
+            }
+        }
+    }
+
+    return TRUE;
+}
+
+/* Calls calc_dist(), or calc_mindist_search() for the minimum distance
+ * when that is possible. In the latter case, only the outputs for the
+ * minimum distance are set.
+ */
+static void calc_group_dist(real rcut, gmx_bool bMin, gmx_bool bPBC, int ePBC, matrix box,
+                            rvec x[], int natoms,
+                            int nx1, int nx2, int index1[], int index2[],
+                            gmx_bool bGroup, int nthreads, gmx_int64_t minSearchPairs,
+                            real *rmin, real *rmax, int *nmin, int *nmax,
+                            int *ixmin, int *jxmin, int *ixmax, int *jxmax,
+                            int nres, const int *posres, real *resmin2, gmx_bool *bResSearched)
+{
+    *bResSearched = FALSE;
+    if (bMin && use_mindist_search(rcut, bPBC, ePBC, box, nx1, nx2, minSearchPairs) &&
+        calc_mindist_search(rcut, bPBC, ePBC, box, x, natoms, nx1, nx2, index1, index2,
+                            bGroup, nthreads, rmin, nmin, ixmin, jxmin,
+                            nres, posres, resmin2))
+    {
+        *bResSearched = (nres > 0);
+        return;
+    }
+    calc_dist(rcut, bPBC, ePBC, box, x, nx1, nx2, index1, index2, bGroup,
+              rmin, rmax, nmin, nmax, ixmin, jxmin, ixmax, jxmax);
+}
+
 void dist_plot(const char *fn, const char *afile, const char *dfile,
                const char *nfile, const char *rfile, const char *xfile,
                real rcut, gmx_bool bMat, const t_atoms *atoms,
                int ng, int *index[], int gnx[], char *grpn[], gmx_bool bSplit,
                gmx_bool bMin, int nres, int *residue, gmx_bool bPBC, int ePBC,
                gmx_bool bGroup, gmx_bool bEachResEachTime, gmx_bool bPrintResName,
-               const gmx_output_env_t *oenv)
+               gmx_int64_t minSearchPairs, const gmx_output_env_t *oenv)
 {
     FILE            *atm, *dist, *num;
     t_trxstatus     *trxout;
@@ -341,7 +711,7 @@ void dist_plot(const char *fn, const char *afile, const char *dfile,
     int              nmin, nmax;
     t_trxstatus     *status;
     int              i = -1, j, k;
-    int              min2, max2, min1r, min2r, max1r, max2r;
+    int              min2, max2;
     int              min1 = 0;
     int              max1 = 0;
     int              oindex[2];
@@ -349,8 +719,14 @@ void dist_plot(const char *fn, const char *afile, const char *dfile,
     matrix           box;
     gmx_bool         bFirst;
     FILE            *respertime = NULL;
+    int              natoms;
+    int              nthreads     = gmx_omp_get_max_threads();
+    gmx_bool         bResSearched = FALSE;
+    std::vector<int> posres;
+    std::vector<real> resmin2(nres);
 
-    if (read_first_x(oenv, &status, fn, &t, &x0, box) == 0)
+    natoms = read_first_x(oenv, &status, fn, &t, &x0, box);
+    if (natoms == 0)
     {
         gmx_fatal(FARGS, "Could not read coordinates from statusfile\n");
     }
@@ -439,6 +815,15 @@ void dist_plot(const char *fn, const char *afile, const char *dfile,
             }
             /* maxdres[*][*] is already 0 */
         }
+        /* Residue of each position in the first group */
+        posres.resize(residue[nres]);
+        for (j = 0; j < nres; j++)
+        {
+            for (k = residue[j]; k < residue[j+1]; k++)
+            {
+                posres[k] = j;
+            }
+        }
     }
     bFirst = TRUE;
     do
@@ -465,8 +850,10 @@ void dist_plot(const char *fn, const char *afile, const char *dfile,
         {
             if (ng == 1)
             {
-                calc_dist(rcut, bPBC, ePBC, box, x0, gnx[0], gnx[0], index[0], index[0], bGroup,
-                          &dmin, &dmax, &nmin, &nmax, &min1, &min2, &max1, &max2);
+                calc_group_dist(rcut, bMin, bPBC, ePBC, box, x0, natoms, gnx[0], gnx[0],
+                                index[0], index[0], bGroup, nthreads, minSearchPairs,
+                                &dmin, &dmax, &nmin, &nmax, &min1, &min2, &max1, &max2,
+                                0, NULL, NULL, &bResSearched);
                 fprintf(dist, "  %12e", bMin ? dmin : dmax);
                 if (num)
                 {
@@ -479,8 +866,10 @@ void dist_plot(const char *fn, const char *afile, const char *dfile,
                 {
                     for (k = i+1; (k < ng); k++)
                     {
-                        calc_dist(rcut, bPBC, ePBC, box, x0, gnx[i], gnx[k], index[i], index[k],
-                                  bGroup, &dmin, &dmax, &nmin, &nmax, &min1, &min2, &max1, &max2);
+                        calc_group_dist(rcut, bMin, bPBC, ePBC, box, x0, natoms, gnx[i], gnx[k],
+                                        index[i], index[k], bGroup, nthreads, minSearchPairs,
+                                        &dmin, &dmax, &nmin, &nmax, &min1, &min2, &max1, &max2,
+                                        0, NULL, NULL, &bResSearched);
                         fprintf(dist, "  %12e", bMin ? dmin : dmax);
                         if (num)
                         {
@@ -494,8 +883,10 @@ void dist_plot(const char *fn, const char *afile, const char *dfile,
         {
             for (i = 1; (i < ng); i++)
             {
-                calc_dist(rcut, bPBC, ePBC, box, x0, gnx[0], gnx[i], index[0], index[i], bGroup,
-                          &dmin, &dmax, &nmin, &nmax, &min1, &min2, &max1, &max2);
+                calc_group_dist(rcut, bMin, bPBC, ePBC, box, x0, natoms, gnx[0], gnx[i],
+                                index[0], index[i], bGroup, nthreads, minSearchPairs,
+                                &dmin, &dmax, &nmin, &nmax, &min1, &min2, &max1, &max2,
+                                nres, posres.data(), resmin2.data(), &bResSearched);
                 fprintf(dist, "  %12e", bMin ? dmin : dmax);
                 if (num)
                 {
@@ -503,13 +894,27 @@ void dist_plot(const char *fn, const char *afile, const char *dfile,
                 }
                 if (nres)
                 {
-                    for (j = 0; j < nres; j++)
+                    /* Residues without pairs within the cut-off in the
+                     * search still need all their pairs.
+                     */
+#pragma omp parallel for num_threads(nthreads) schedule(dynamic)
+                    for (int r = 0; r < nres; r++)
                     {
-                        calc_dist(rcut, bPBC, ePBC, box, x0, residue[j+1]-residue[j], gnx[i],
-                                  &(index[0][residue[j]]), index[i], bGroup,
-                                  &dmin, &dmax, &nmin, &nmax, &min1r, &min2r, &max1r, &max2r);
-                        mindres[i-1][j] = std::min(mindres[i-1][j], dmin);
-                        maxdres[i-1][j] = std::max(maxdres[i-1][j], dmax);
+                        real dminr, dmaxr;
+                        int  nminr, nmaxr, min1r, min2r, max1r, max2r;
+
+                        if (bResSearched && resmin2[r] >= 0)
+                        {
+                            dminr = std::sqrt(resmin2[r]);
+                        }
+                        else
+                        {
+                            calc_dist(rcut, bPBC, ePBC, box, x0, residue[r+1]-residue[r], gnx[i],
+                                      &(index[0][residue[r]]), index[i], bGroup,
+                                      &dminr, &dmaxr, &nminr, &nmaxr, &min1r, &min2r, &max1r, &max2r);
+                            maxdres[i-1][r] = std::max(maxdres[i-1][r], dmaxr);
+                        }
+                        mindres[i-1][r] = std::min(mindres[i-1][r], dminr);
                     }
                 }
             }
@@ -670,6 +1075,7 @@ int gmx_mindist(int argc, char *argv[])
     static real       rcutoff          = 0.6;
     static int        ng               = 1;
     static gmx_bool   bEachResEachTime = FALSE, bPrintResName = FALSE;
+    int               minSearchPairs   = 10000;
     t_pargs           pa[]             = {
         { "-matrix", FALSE, etBOOL, {&bMat},
           "Calculate half a matrix of group-group distances" },
@@ -690,7 +1096,9 @@ int gmx_mindist(int argc, char *argv[])
         { "-respertime",  FALSE, etBOOL, {&bEachResEachTime},
           "When writing per-residue distances, write distance for each time point" },
         { "-printresname",  FALSE, etBOOL, {&bPrintResName},
-          "Write residue names" }
+          "Write residue names" },
+        { "-searchpairs", FALSE, etINT, {&minSearchPairs},
+          "HIDDENSmallest number of atom pairs for which a neighborhood search is used for the minimum distance" }
     };
     gmx_output_env_t *oenv;
     t_topology       *top  = NULL;
@@ -801,14 +1209,15 @@ int gmx_mindist(int argc, char *argv[])
 
     if (bPI)
     {
-        periodic_mindist_plot(trxfnm, distfnm, top, ePBC, gnx[0], index[0], bSplit, oenv);
+        periodic_mindist_plot(trxfnm, distfnm, top, ePBC, gnx[0], index[0], bSplit,
+                              minSearchPairs, oenv);
     }
     else
     {
         dist_plot(trxfnm, atmfnm, distfnm, numfnm, resfnm, oxfnm,
                   rcutoff, bMat, top ? &(top->atoms) : NULL,
                   ng, index, gnx, grpname, bSplit, !bMax, nres, residues, bPBC, ePBC,
-                  bGroup, bEachResEachTime, bPrintResName, oenv);
+                  bGroup, bEachResEachTime, bPrintResName, minSearchPairs, oenv);
     }
 
     do_view(oenv, distfnm, "-nxy");
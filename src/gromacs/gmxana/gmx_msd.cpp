@@ -37,16 +37,22 @@
 #include "gmxpre.h"
 
 #include <cmath>
+#include <cstdio>
 #include <cstring>
 
+#include <algorithm>
+#include <vector>
+
 #include "gromacs/commandline/pargs.h"
 #include "gromacs/commandline/viewit.h"
 #include "gromacs/fileio/confio.h"
 #include "gromacs/fileio/trxio.h"
 #include "gromacs/fileio/xvgr.h"
+#include "gromacs/fft/fft.h"
 #include "gromacs/gmxana/gmx_ana.h"
 #include "gromacs/gmxana/gstat.h"
 #include "gromacs/math/functions.h"
+#include "gromacs/math/gmxcomplex.h"
 #include "gromacs/math/utilities.h"
 #include "gromacs/math/vec.h"
 #include "gromacs/pbcutil/rmpbc.h"
@@ -54,9 +60,12 @@
 #include "gromacs/topology/index.h"
 #include "gromacs/topology/topology.h"
 #include "gromacs/utility/arraysize.h"
+#include "gromacs/utility/cstringutil.h"
+#include "gromacs/utility/exceptions.h"
 #include "gromacs/utility/fatalerror.h"
 #include "gromacs/utility/futil.h"
 #include "gromacs/utility/gmxassert.h"
+#include "gromacs/utility/gmxomp.h"
 #include "gromacs/utility/smalloc.h"
 
 #define FACTOR  1000.0  /* Convert nm^2/ps to 10e-5 cm^2/s */
@@ -68,6 +77,137 @@ typedef enum {
     NOT_USED, NORMAL, X, Y, Z, LATERAL
 } msd_type;
 
+/* Stores the unwrapped coordinates of one group for all frames, for the
+ * FFT-based MSD calculation that uses all time origins.
+ * Frames are kept in memory until they would use more than maxMemory
+ * bytes, then all frames are moved to a temporary file. The coordinates
+ * are read back in blocks of atoms (or molecules) for all frames.
+ */
+class MsdCoordinateStore
+{
+    public:
+        MsdCoordinateStore(int ncoords, size_t maxMemory)
+            : ncoords_(ncoords), nframes_(0), maxMemory_(maxMemory),
+              fp_(NULL), bWriting_(FALSE)
+        {
+            fn_[0] = '\0';
+        }
+        ~MsdCoordinateStore()
+        {
+            if (fp_)
+            {
+                std::fclose(fp_);
+            }
+            if (fn_[0] != '\0')
+            {
+                std::remove(fn_);
+            }
+        }
+
+        /* Adds coordinates x[index[i]] (x[i] when index is NULL) minus com */
+        void addFrame(const int *index, const rvec x[], const rvec com)
+        {
+            std::vector<gmx::RVec> frame(ncoords_);
+            for (int i = 0; i < ncoords_; i++)
+            {
+                rvec_sub(x[index ? index[i] : i], com, frame[i]);
+            }
+            if (!fp_ && (x_.size() + ncoords_)*sizeof(x_[0]) > maxMemory_)
+            {
+                spill();
+            }
+            if (fp_)
+            {
+                write(frame.data(), ncoords_);
+            }
+            else
+            {
+                x_.insert(x_.end(), frame.begin(), frame.end());
+            }
+            nframes_++;
+        }
+
+        int numFrames() const { return nframes_; }
+
+        /* The number of coordinates to process per call of getBlock() */
+        int blockSize() const
+        {
+            if (!fp_)
+            {
+                return ncoords_;
+            }
+            size_t n = maxMemory_/(std::max(nframes_, 1)*sizeof(gmx::RVec));
+            return std::max(1, static_cast<int>(std::min(n, static_cast<size_t>(ncoords_))));
+        }
+
+        /* Returns coordinates a0 to a1 for all frames, coordinate a of
+         * frame f is at index f*stride+a-a0.
+         */
+        const gmx::RVec *getBlock(int a0, int a1, int *stride)
+        {
+            if (!fp_)
+            {
+                *stride = ncoords_;
+                return x_.data() + a0;
+            }
+            if (bWriting_)
+            {
+                std::fclose(fp_);
+                fp_ = open("rb");
+                bWriting_ = FALSE;
+            }
+            *stride = a1 - a0;
+            x_.resize(static_cast<size_t>(nframes_)*(*stride));
+            for (int f = 0; f < nframes_; f++)
+            {
+                gmx_off_t offset = (static_cast<gmx_off_t>(f)*ncoords_ + a0)*sizeof(gmx::RVec);
+                if (gmx_fseek(fp_, offset, SEEK_SET) != 0 ||
+                    std::fread(x_.data() + static_cast<size_t>(f)*(*stride),
+                               sizeof(gmx::RVec), *stride, fp_) != static_cast<size_t>(*stride))
+                {
+                    gmx_fatal(FARGS, "Error reading coordinates from temporary file %s", fn_);
+                }
+            }
+            return x_.data();
+        }
+
+    private:
+        void write(const gmx::RVec *x, int n)
+        {
+            if (std::fwrite(x, sizeof(x[0]), n, fp_) != static_cast<size_t>(n))
+            {
+                gmx_fatal(FARGS, "Error writing coordinates to temporary file %s", fn_);
+            }
+        }
+        FILE *open(const char *mode)
+        {
+            FILE *fp = std::fopen(fn_, mode);
+            if (fp == NULL)
+            {
+                gmx_fatal(FARGS, "Can not open temporary file %s", fn_);
+            }
+            return fp;
+        }
+        void spill()
+        {
+            std::strcpy(fn_, "msdXXXXXX");
+            gmx_tmpnam(fn_);
+            fp_       = open("wb");
+            bWriting_ = TRUE;
+            fprintf(stderr, "\nStoring coordinates in temporary file %s\n", fn_);
+            write(x_.data(), x_.size());
+            std::vector<gmx::RVec>().swap(x_);
+        }
+
+        int                    ncoords_;
+        int                    nframes_;
+        size_t                 maxMemory_;
+        std::vector<gmx::RVec> x_;
+        FILE                  *fp_;
+        gmx_bool               bWriting_;
+        char                   fn_[STRLEN];
+};
+
 typedef struct {
     real          t0;         /* start time and time increment between  */
     real          delta_t;    /* time between restart points */
@@ -94,6 +234,8 @@ typedef struct {
     int          *n_offs;
     int         **ndata;      /* the number of msds (particles/mols) per data
                                  point. */
+    gmx_bool      bFFT;       /* use all time origins, computed with FFTs */
+    MsdCoordinateStore **store; /* the coordinates for each group with bFFT */
 } t_corr;
 
 typedef real t_calc_func (t_corr *curr, int nx, int index[], int nx0, rvec xc[],
@@ -111,7 +253,7 @@ static gmx_bool in_data(t_corr *curr, int nx00)
 
 t_corr *init_corr(int nrgrp, int type, int axis, real dim_factor,
                   int nmol, gmx_bool bTen, gmx_bool bMass, real dt, const t_topology *top,
-                  real beginfit, real endfit)
+                  real beginfit, real endfit, gmx_bool bFFT)
 {
     t_corr  *curr;
     int      i;
@@ -129,6 +271,8 @@ t_corr *init_corr(int nrgrp, int type, int axis, real dim_factor,
     curr->nframes    = 0;
     curr->nlast      = 0;
     curr->dim_factor = dim_factor;
+    curr->bFFT       = bFFT;
+    curr->store      = NULL;
 
     snew(curr->ndata, nrgrp);
     snew(curr->data, nrgrp);
@@ -184,8 +328,16 @@ static void corr_print(t_corr *curr, gmx_bool bTen, const char *fn, const char *
     out = xvgropen(fn, title, output_env_get_xvgr_tlabel(oenv), yaxis, oenv);
     if (DD)
     {
-        fprintf(out, "# MSD gathered over %g %s with %d restarts\n",
-                msdtime, output_env_get_time_unit(oenv), curr->nrestart);
+        if (curr->bFFT)
+        {
+            fprintf(out, "# MSD gathered over %g %s using all time origins\n",
+                    msdtime, output_env_get_time_unit(oenv));
+        }
+        else
+        {
+            fprintf(out, "# MSD gathered over %g %s with %d restarts\n",
+                    msdtime, output_env_get_time_unit(oenv), curr->nrestart);
+        }
         fprintf(out, "# Diffusion constants fitted from time %g to %g %s\n",
                 beginfit, endfit, output_env_get_time_unit(oenv));
         for (i = 0; i < curr->ngrp; i++)
@@ -544,6 +696,335 @@ static real calc1_mol(t_corr *curr, int nx, int gmx_unused index[], int nx0, rve
     return gtot/nx;
 }
 
+/* Returns the smallest FFT size >= n with only factors 2, 3 and 5 */
+static int fft_size(int n)
+{
+    int nfft, m;
+
+    for (nfft = std::max(n, 1);; nfft++)
+    {
+        m = nfft;
+        while (m % 2 == 0)
+        {
+            m /= 2;
+        }
+        while (m % 3 == 0)
+        {
+            m /= 3;
+        }
+        while (m % 5 == 0)
+        {
+            m /= 5;
+        }
+        if (m == 1)
+        {
+            return nfft;
+        }
+    }
+}
+
+/* Per-thread buffers for the transform of one atom in calc_corr_fft() */
+struct MsdFftWork
+{
+    real                   w;         /* The weight of the atom, 0 when none */
+    std::vector<double>    xd[DIM];   /* The trajectory relative to its mean */
+    std::vector<t_complex> spec[DIM]; /* The spectrum of each dimension */
+};
+
+/* Computes the MSD of group nr using all time origins.
+ *
+ * For a coordinate trajectory x(k), k = 0..N-1, the sum over all origins
+ * of the squared displacement over m frames is
+ *   sum_k (x(k+m) - x(k))^2 = sum_k [x(k)^2 + x(k+m)^2] - 2 sum_k x(k) x(k+m),
+ * where the first sum is computed recursively and the correlation
+ * with FFTs, which takes O(N log N) instead of O(N^2) operations.
+ * The off-diagonal tensor elements use the cross-correlations
+ * of two dimensions in the same way. Since the inverse transform is
+ * linear, the power spectra of all atoms (or molecules) are summed
+ * before a single inverse transform. The atoms are distributed over
+ * threads, each with its own FFT setup. The sums are shared, and each
+ * thread adds the spectra of all threads to its own range of frequencies,
+ * so the memory for the sums does not grow with the number of threads.
+ */
+static void calc_corr_fft(t_corr *curr, int nr, int nx, int index[], gmx_bool bTen)
+{
+    MsdCoordinateStore *store   = curr->store[nr];
+    const int           nframes = store->numFrames();
+    const int           nfft    = fft_size(2*nframes);
+    const gmx_bool      bMol    = (curr->nmol > 0);
+    int                 dims[DIM], ndim, pair[DIM*(DIM+1)/2][2], npair;
+    int                 nthreads, d, e, p, m, a0, a1, stride;
+    const gmx::RVec    *xblock;
+
+    /* The dimensions to consider and the pairs of dimensions to correlate,
+     * the latter in the order of the tensor output.
+     */
+    ndim = 0;
+    for (d = 0; d < DIM; d++)
+    {
+        if (curr->type == NORMAL ||
+            (curr->type == LATERAL && d != curr->axis) ||
+            ((curr->type == X || curr->type == Y || curr->type == Z) && d == curr->type - X))
+        {
+            dims[ndim++] = d;
+        }
+    }
+    npair = 0;
+    for (d = 0; d < ndim; d++)
+    {
+        pair[npair][0]   = dims[d];
+        pair[npair++][1] = dims[d];
+    }
+    if (bTen)
+    {
+        for (d = 0; d < DIM; d++)
+        {
+            for (e = 0; e < d; e++)
+            {
+                pair[npair][0]   = d;
+                pair[npair++][1] = e;
+            }
+        }
+    }
+
+    /* The weighted sums over atoms of the spectra and of x1(k) x2(k)
+     * for each pair of dimensions, shared by all threads.
+     */
+    std::vector<std::vector<double> > specSum(npair, std::vector<double>(nfft, 0));
+    std::vector<std::vector<double> > prodSum(npair, std::vector<double>(nframes, 0));
+    double                            wtot = 0;
+
+    nthreads = gmx_omp_get_max_threads();
+    std::vector<MsdFftWork> work(nthreads);
+
+    for (a0 = 0; a0 < nx; a0 = a1)
+    {
+        a1     = std::min(nx, a0 + store->blockSize());
+        xblock = store->getBlock(a0, a1, &stride);
+
+#pragma omp parallel num_threads(nthreads)
+        {
+            try
+            {
+                int                    thread = gmx_omp_get_thread_num();
+                MsdFftWork            &wk     = work[thread];
+                gmx_fft_t              fft;
+                std::vector<t_complex> in(nfft), out(nfft);
+                std::vector<double>    msdMol;
+                /* The part of the sums this thread adds to */
+                const int              k0 = (thread*nfft)/nthreads;
+                const int              k1 = ((thread + 1)*nfft)/nthreads;
+                const int              f0 = (thread*nframes)/nthreads;
+                const int              f1 = ((thread + 1)*nframes)/nthreads;
+
+                for (int i = 0; i < ndim; i++)
+                {
+                    wk.spec[dims[i]].resize(nfft);
+                    wk.xd[dims[i]].resize(nframes);
+                }
+                if (bMol)
+                {
+                    msdMol.resize(nframes);
+                }
+                gmx_fft_init_1d(&fft, nfft, GMX_FFT_FLAG_CONSERVATIVE);
+
+                /* Each thread transforms one atom per round, after which
+                 * the spectra of all threads are added to the sums.
+                 */
+                for (int aRound = a0; aRound < a1; aRound += nthreads)
+                {
+                    int a = aRound + thread;
+
+                    wk.w = 0;
+                    if (a < a1)
+                    {
+                        wk.w = curr->mass ? curr->mass[bMol ? a : index[a]] : 1;
+                    }
+                    if (wk.w != 0)
+                    {
+                        /* Extract the trajectory of each dimension, relative
+                         * to its mean to reduce the rounding errors.
+                         */
+                        for (int i = 0; i < ndim; i++)
+                        {
+                            int                  dim = dims[i];
+                            std::vector<double> &xd  = wk.xd[dim];
+                            double               sum = 0;
+                            for (int f = 0; f < nframes; f++)
+                            {
+                                xd[f] = xblock[static_cast<size_t>(f)*stride + a - a0][dim];
+                                sum  += xd[f];
+                            }
+                            for (int f = 0; f < nframes; f++)
+                            {
+                                xd[f] -= sum/nframes;
+                            }
+                        }
+
+                        /* Transform two dimensions at a time as the real
+                         * and imaginary part of one complex signal.
+                         */
+                        for (int i = 0; i < ndim; i += 2)
+                        {
+                            int dre = dims[i];
+                            int dim = (i + 1 < ndim) ? dims[i+1] : -1;
+                            for (int f = 0; f < nfft; f++)
+                            {
+                                in[f].re = (f < nframes) ? wk.xd[dre][f] : 0;
+                                in[f].im = (f < nframes && dim >= 0) ? wk.xd[dim][f] : 0;
+                            }
+                            gmx_fft_1d(fft, GMX_FFT_FORWARD, in.data(), out.data());
+                            for (int k = 0; k < nfft; k++)
+                            {
+                                const t_complex &c  = out[k];
+                                const t_complex &cc = out[(nfft - k) % nfft];
+                                wk.spec[dre][k].re = 0.5*(c.re + cc.re);
+                                wk.spec[dre][k].im = 0.5*(c.im - cc.im);
+                                if (dim >= 0)
+                                {
+                                    wk.spec[dim][k].re = 0.5*(c.im + cc.im);
+                                    wk.spec[dim][k].im = 0.5*(cc.re - c.re);
+                                }
+                            }
+                        }
+
+                        if (bMol)
+                        {
+                            /* The MSD of this molecule is needed for its own fit */
+                            std::fill(msdMol.begin(), msdMol.end(), 0);
+                            for (int i = 0; i < ndim; i++)
+                            {
+                                const std::vector<double> &xd = wk.xd[dims[i]];
+                                double                     q  = 0;
+                                for (int f = 0; f < nframes; f++)
+                                {
+                                    q += 2*xd[f]*xd[f];
+                                }
+                                for (int m = 0; m < nframes; m++)
+                                {
+                                    if (m > 0)
+                                    {
+                                        q -= xd[m-1]*xd[m-1] + xd[nframes-m]*xd[nframes-m];
+                                    }
+                                    msdMol[m] += q;
+                                }
+                            }
+                            for (int k = 0; k < nfft; k++)
+                            {
+                                in[k].re = 0;
+                                in[k].im = 0;
+                                for (int i = 0; i < ndim; i++)
+                                {
+                                    const t_complex &c = wk.spec[dims[i]][k];
+                                    in[k].re          += 2*(c.re*c.re + c.im*c.im);
+                                }
+                            }
+                            gmx_fft_1d(fft, GMX_FFT_BACKWARD, in.data(), out.data());
+                            for (int m = 0; m < nframes; m++)
+                            {
+                                real tt  = curr->time[m];
+                                real msd = (msdMol[m] - out[m].re/nfft)/(nframes - m);
+                                if (tt >= curr->beginfit && (curr->endfit < 0 || tt <= curr->endfit))
+                                {
+                                    gmx_stats_add_point(curr->lsq[0][a], tt, msd, 0, 0);
+                                }
+                            }
+                        }
+                    }
+#pragma omp barrier
+                    /* Each thread adds the contributions of all atoms
+                     * of this round to its own part of the sums.
+                     */
+                    for (int t = 0; t < nthreads; t++)
+                    {
+                        const MsdFftWork &wt = work[t];
+                        if (wt.w == 0)
+                        {
+                            continue;
+                        }
+                        if (thread == 0)
+                        {
+                            wtot += wt.w;
+                        }
+                        for (int p = 0; p < npair; p++)
+                        {
+                            const std::vector<t_complex> &sd = wt.spec[pair[p][0]];
+                            const std::vector<t_complex> &se = wt.spec[pair[p][1]];
+                            const std::vector<double>    &x1 = wt.xd[pair[p][0]];
+                            const std::vector<double>    &x2 = wt.xd[pair[p][1]];
+                            std::vector<double>          &ss = specSum[p];
+                            std::vector<double>          &ps = prodSum[p];
+
+                            /* The spectrum of the sum of both cross-correlations */
+                            for (int k = k0; k < k1; k++)
+                            {
+                                ss[k] += wt.w*2*(sd[k].re*se[k].re + sd[k].im*se[k].im);
+                            }
+                            for (int f = f0; f < f1; f++)
+                            {
+                                ps[f] += wt.w*x1[f]*x2[f];
+                            }
+                        }
+                    }
+#pragma omp barrier
+                }
+
+                gmx_fft_destroy(fft);
+            }
+            GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR;
+        }
+    }
+
+    /* Transform the summed spectra back */
+    if (wtot == 0)
+    {
+        gmx_fatal(FARGS, "All atoms in group %d have zero mass", nr);
+    }
+    {
+        gmx_fft_t              fft;
+        std::vector<t_complex> in(nfft), out(nfft);
+
+        gmx_fft_init_1d(&fft, nfft, GMX_FFT_FLAG_CONSERVATIVE);
+        for (p = 0; p < npair; p++)
+        {
+            for (int k = 0; k < nfft; k++)
+            {
+                in[k].re = specSum[p][k];
+                in[k].im = 0;
+            }
+            gmx_fft_1d(fft, GMX_FFT_BACKWARD, in.data(), out.data());
+            /* sum_k [x1(k) x2(k) + x1(k+m) x2(k+m)] for all m */
+            double q = 0;
+            for (int f = 0; f < nframes; f++)
+            {
+                q += 2*prodSum[p][f];
+            }
+            for (m = 0; m < nframes; m++)
+            {
+                if (m > 0)
+                {
+                    q -= prodSum[p][m-1] + prodSum[p][nframes-m];
+                }
+                /* The sum over all origins, normalized by the weights */
+                real g = (q - out[m].re/nfft)/wtot;
+                if (p < ndim)
+                {
+                    curr->data[nr][m] += g;
+                }
+                if (bTen)
+                {
+                    curr->datam[nr][m][pair[p][0]][pair[p][1]] = g;
+                }
+            }
+        }
+        gmx_fft_destroy(fft);
+    }
+    for (m = 0; m < nframes; m++)
+    {
+        curr->ndata[nr][m] = nframes - m;
+    }
+}
+
 static void printmol(t_corr *curr, const char *fn,
                      const char *fn_pdb, int *molindex, const t_topology *top,
                      rvec *x, int ePBC, matrix box, const gmx_output_env_t *oenv)
@@ -709,7 +1190,7 @@ int corr_loop(t_corr *curr, const char *fn, const t_topology *top, int ePBC,
 
 
         /* check whether we've reached a restart point */
-        if (bRmod(t, curr->t0, dt))
+        if (!curr->bFFT && bRmod(t, curr->t0, dt))
         {
             curr->nrestart++;
 
@@ -807,9 +1288,17 @@ int corr_loop(t_corr *curr, const char *fn, const t_topology *top, int ePBC,
         /* loop over all groups in index file */
         for (i = 0; (i < curr->ngrp); i++)
         {
-            /* calculate something useful, like mean square displacements */
-            calc_corr(curr, i, gnx[i], index[i], xa[cur], (gnx_com != NULL), com,
-                      calc1, bTen);
+            if (curr->bFFT)
+            {
+                /* store the coordinates, all origins are processed at the end */
+                curr->store[i]->addFrame(bMol ? NULL : index[i], xa[cur], com);
+            }
+            else
+            {
+                /* calculate something useful, like mean square displacements */
+                calc_corr(curr, i, gnx[i], index[i], xa[cur], (gnx_com != NULL), com,
+                          calc1, bTen);
+            }
         }
         cur    = prev;
         t_prev = t;
@@ -817,11 +1306,34 @@ int corr_loop(t_corr *curr, const char *fn, const t_topology *top, int ePBC,
         curr->nframes++;
     }
     while (read_next_x(oenv, status, &t, x[cur], box));
-    fprintf(stderr, "\nUsed %d restart points spaced %g %s over %g %s\n\n",
-            curr->nrestart,
-            output_env_conv_time(oenv, dt), output_env_get_time_unit(oenv),
-            output_env_conv_time(oenv, curr->time[curr->nframes-1]),
-            output_env_get_time_unit(oenv) );
+
+    if (curr->bFFT)
+    {
+        /* With all time origins there is one set of fits per molecule */
+        curr->nrestart = 1;
+        snew(curr->lsq, 1);
+        snew(curr->lsq[0], curr->nmol);
+        for (i = 0; i < curr->nmol; i++)
+        {
+            curr->lsq[0][i] = gmx_stats_init();
+        }
+        for (i = 0; (i < curr->ngrp); i++)
+        {
+            calc_corr_fft(curr, i, gnx[i], index[i], bTen);
+        }
+        fprintf(stderr, "\nUsed all %d time origins over %g %s\n\n",
+                curr->nframes,
+                output_env_conv_time(oenv, curr->time[curr->nframes-1]),
+                output_env_get_time_unit(oenv) );
+    }
+    else
+    {
+        fprintf(stderr, "\nUsed %d restart points spaced %g %s over %g %s\n\n",
+                curr->nrestart,
+                output_env_conv_time(oenv, dt), output_env_get_time_unit(oenv),
+                output_env_conv_time(oenv, curr->time[curr->nframes-1]),
+                output_env_get_time_unit(oenv) );
+    }
 
     if (bMol)
     {
@@ -872,7 +1384,8 @@ void do_corr(const char *trx_file, const char *ndx_file, const char *msd_file,
              int nrgrp, t_topology *top, int ePBC,
              gmx_bool bTen, gmx_bool bMW, gmx_bool bRmCOMM,
              int type, real dim_factor, int axis,
-             real dt, real beginfit, real endfit, const gmx_output_env_t *oenv)
+             real dt, real beginfit, real endfit, gmx_bool bFFT, int fftMemory,
+             const gmx_output_env_t *oenv)
 {
     t_corr        *msd;
     int           *gnx;   /* the selected groups' sizes */
@@ -910,7 +1423,16 @@ void do_corr(const char *trx_file, const char *ndx_file, const char *msd_file,
 
     msd = init_corr(nrgrp, type, axis, dim_factor,
                     mol_file == NULL ? 0 : gnx[0], bTen, bMW, dt, top,
-                    beginfit, endfit);
+                    beginfit, endfit, bFFT);
+    if (bFFT)
+    {
+        /* The memory limit is shared by all groups */
+        snew(msd->store, nrgrp);
+        for (i = 0; i < nrgrp; i++)
+        {
+            msd->store[i] = new MsdCoordinateStore(gnx[i], static_cast<size_t>(fftMemory)*1024*1024/nrgrp);
+        }
+    }
 
     nat_trx =
         corr_loop(msd, trx_file, top, ePBC, mol_file ? gnx[0] : 0, gnx, index,
@@ -1021,6 +1543,15 @@ void do_corr(const char *trx_file, const char *ndx_file, const char *msd_file,
                "Mean Square Displacement",
                "MSD (nm\\S2\\N)",
                msd->time[msd->nframes-1], beginfit, endfit, DD, SigmaD, grpname, oenv);
+
+    if (bFFT)
+    {
+        for (i = 0; i < nrgrp; i++)
+        {
+            delete msd->store[i];
+        }
+        sfree(msd->store);
+    }
 }
 
 int gmx_msd(int argc, char *argv[])
@@ -1067,7 +1598,16 @@ int gmx_msd(int argc, char *argv[])
         "Option [TT]-pdb[tt] writes a [REF].pdb[ref] file with the coordinates of the frame",
         "at time [TT]-tpdb[tt] with in the B-factor field the square root of",
         "the diffusion coefficient of the molecule.",
-        "This option implies option [TT]-mol[tt]."
+        "This option implies option [TT]-mol[tt].[PAR]",
+        "With [TT]-fft[tt], all frames are used as time origins instead of",
+        "only the restart points set with [TT]-trestart[tt]. The MSD is then",
+        "computed from the coordinate autocorrelation using FFTs, which scales",
+        "as N log N with the number of frames N. The coordinates of all frames",
+        "are stored; when they need more than [TT]-fftmem[tt] MB, they are",
+        "written to a temporary file and processed in blocks of atoms.",
+        "Note that with single precision the subtraction of large sums",
+        "reduces the relative accuracy of the MSD at short times,",
+        "in particular for long trajectories and large displacements."
     };
     static const char *normtype[] = { NULL, "no", "x", "y", "z", NULL };
     static const char *axtitle[]  = { NULL, "no", "x", "y", "z", NULL };
@@ -1079,6 +1619,8 @@ int gmx_msd(int argc, char *argv[])
     static gmx_bool    bTen       = FALSE;
     static gmx_bool    bMW        = TRUE;
     static gmx_bool    bRmCOMM    = FALSE;
+    static gmx_bool    bFFT       = FALSE;
+    static int         fftMemory  = 4096;
     t_pargs            pa[]       = {
         { "-type",    FALSE, etENUM, {normtype},
           "Compute diffusion coefficient in one direction" },
@@ -1099,7 +1641,11 @@ int gmx_msd(int argc, char *argv[])
         { "-beginfit", FALSE, etTIME, {&beginfit},
           "Start time for fitting the MSD (%t), -1 is 10%" },
         { "-endfit", FALSE, etTIME, {&endfit},
-          "End time for fitting the MSD (%t), -1 is 90%" }
+          "End time for fitting the MSD (%t), -1 is 90%" },
+        { "-fft", FALSE, etBOOL, {&bFFT},
+          "Use all time origins, computed with FFTs" },
+        { "-fftmem", FALSE, etINT, {&fftMemory},
+          "Memory (MB) for storing coordinates with [TT]-fft[tt], the remainder goes to a temporary file" }
     };
 
     t_filenm           fnm[] = {
@@ -1187,6 +1733,10 @@ int gmx_msd(int argc, char *argv[])
     {
         gmx_fatal(FARGS, "Can only calculate the full tensor for 3D msd");
     }
+    if (bFFT && fftMemory < 1)
+    {
+        gmx_fatal(FARGS, "The memory for -fft should be at least 1 MB (now %d)", fftMemory);
+    }
 
     bTop = read_tps_conf(tps_file, &top, &ePBC, &xdum, NULL, box, bMW || bRmCOMM);
     if (mol_file && !bTop)
@@ -1198,6 +1748,7 @@ int gmx_msd(int argc, char *argv[])
 
     do_corr(trx_file, ndx_file, msd_file, mol_file, pdb_file, t_pdb, ngroup,
             &top, ePBC, bTen, bMW, bRmCOMM, type, dim_factor, axis, dt, beginfit, endfit,
+            bFFT, fftMemory,
             oenv);
 
     view_all(oenv, NFILE, fnm);
@@ -59,8 +59,10 @@
 #include "gromacs/topology/index.h"
 #include "gromacs/topology/topology.h"
 #include "gromacs/utility/arraysize.h"
+#include "gromacs/utility/exceptions.h"
 #include "gromacs/utility/fatalerror.h"
 #include "gromacs/utility/futil.h"
+#include "gromacs/utility/gmxomp.h"
 #include "gromacs/utility/pleasecite.h"
 #include "gromacs/utility/smalloc.h"
 
@@ -97,6 +99,173 @@ static void norm_princ(const t_atoms *atoms, int isize, int *index, int natoms,
     }
 }
 
+/* What needs to be done to a frame before it is compared */
+typedef struct {
+    gmx_rmpbc_t    gpbc;       /* Remove pbc when not NULL */
+    gmx_bool       bReset;     /* Put the COM of the fit group in the origin */
+    gmx_bool       bNormPrinc; /* Scale the principal components, for rhosc */
+    gmx_bool       bFit;       /* Fit to the reference structure xp */
+    const t_atoms *atoms;
+    int            ifit;
+    int           *ind_fit;
+    real          *w_rls;
+    const rvec    *xp;
+} t_frame_prep;
+
+static void prepare_frame(const t_frame_prep *prep, int natoms, matrix box, rvec *x)
+{
+    if (prep->gpbc != NULL)
+    {
+        gmx_rmpbc(prep->gpbc, natoms, box, x);
+    }
+    if (prep->bReset)
+    {
+        reset_x(prep->ifit, prep->ind_fit, natoms, NULL, x, prep->w_rls);
+    }
+    if (prep->bNormPrinc)
+    {
+        norm_princ(prep->atoms, prep->ifit, prep->ind_fit, natoms, x);
+    }
+    if (prep->bFit)
+    {
+        /*do the least squares fit to original structure*/
+        do_fit(natoms, prep->w_rls, prep->xp, x);
+    }
+}
+
+/* Reads the matrix frames of a trajectory in tiles, so the comparison
+ * matrices can be built without keeping all frames in memory.
+ */
+typedef struct {
+    t_trxstatus *status;
+    rvec        *x;
+    matrix       box;
+    int          natoms;  /* Number of atoms to prepare */
+    int          freq;    /* Only every freq-th frame goes into the matrix */
+    int          teller;  /* Number of frames read so far */
+    gmx_bool     bEOF;
+} t_matrix_reader;
+
+static void open_matrix_reader(t_matrix_reader *rd, const gmx_output_env_t *oenv,
+                               const char *fn, int natoms, int freq)
+{
+    real t;
+
+    read_first_x(oenv, &rd->status, fn, &t, &rd->x, rd->box);
+    rd->natoms = natoms;
+    rd->freq   = freq;
+    rd->teller = 0;
+    rd->bEOF   = FALSE;
+}
+
+static void close_matrix_reader(t_matrix_reader *rd)
+{
+    close_trj(rd->status);
+    sfree(rd->x);
+}
+
+/* Skips nskip matrix frames and then reads up to nmax matrix frames,
+ * prepared as in the first pass, into tile. Returns the number read.
+ */
+static int read_matrix_tile(t_matrix_reader *rd, const gmx_output_env_t *oenv,
+                            const t_frame_prep *prep, int n_ind_m, const int *ind_m,
+                            int nskip, int nmax, rvec **tile)
+{
+    real t;
+    int  n = 0;
+
+    while (!rd->bEOF && n < nmax)
+    {
+        if (rd->teller % rd->freq == 0)
+        {
+            if (nskip > 0)
+            {
+                nskip--;
+            }
+            else
+            {
+                prepare_frame(prep, rd->natoms, rd->box, rd->x);
+                for (int i = 0; i < n_ind_m; i++)
+                {
+                    copy_rvec(rd->x[ind_m[i]], tile[n][i]);
+                }
+                n++;
+            }
+        }
+        rd->teller++;
+        rd->bEOF = !read_next_x(oenv, rd->status, &t, rd->x, rd->box);
+    }
+
+    return n;
+}
+
+/* Computes the matrix elements between frames i0 to i0+ni, stored in x_i,
+ * and frames j0 to j0+nj, stored in x_j. With bSymmetric only the upper
+ * triangle is computed (including the diagonal for the bond matrix).
+ * w_fit=NULL means no fitting. rmsd_mat and/or bond_mat can be NULL.
+ */
+static void calc_matrix_tile(gmx_bool bRho, gmx_bool bSymmetric, int n_ind_m,
+                             const real *w_fit, const real *w_sim,
+                             int i0, int ni, rvec **x_i, int j0, int nj, rvec **x_j,
+                             real **rmsd_mat, real **bond_mat,
+                             int ibond, const int *ind_bond1, const int *ind_bond2,
+                             int nthreads)
+{
+#pragma omp parallel for num_threads(nthreads) schedule(dynamic)
+    for (int i = 0; i < ni; i++)
+    {
+        try
+        {
+            const int ig = i0 + i;
+
+            if (rmsd_mat != NULL)
+            {
+                const int jstart = bSymmetric ? std::max(0, ig + 1 - j0) : 0;
+                if (jstart < nj)
+                {
+                    calc_similar_fit_batch(bRho, n_ind_m, w_fit, w_sim, x_i[i],
+                                           nj - jstart, x_j + jstart,
+                                           rmsd_mat[ig] + j0 + jstart);
+                }
+            }
+            if (bond_mat != NULL)
+            {
+                const int jstart = bSymmetric ? std::max(0, ig - j0) : 0;
+                matrix   *R      = NULL;
+                rvec      vec1, vec2, dx;
+
+                if (jstart < nj && w_fit != NULL)
+                {
+                    snew(R, nj - jstart);
+                    calc_fit_R_batch(3, n_ind_m, w_fit, x_i[i],
+                                     nj - jstart, x_j + jstart, R);
+                }
+                for (int j = jstart; j < nj; j++)
+                {
+                    real ang = 0.0;
+                    for (int m = 0; m < ibond; m++)
+                    {
+                        rvec_sub(x_i[i][ind_bond1[m]], x_i[i][ind_bond2[m]], vec1);
+                        rvec_sub(x_j[j][ind_bond1[m]], x_j[j][ind_bond2[m]], dx);
+                        if (R != NULL)
+                        {
+                            mvmul(R[j - jstart], dx, vec2);
+                        }
+                        else
+                        {
+                            copy_rvec(dx, vec2);
+                        }
+                        ang += std::acos(cos_angle(vec1, vec2));
+                    }
+                    bond_mat[ig][j0 + j] = ang*180.0/(M_PI*ibond);
+                }
+                sfree(R);
+            }
+        }
+        GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR;
+    }
+}
+
 int gmx_rms(int argc, char *argv[])
 {
     const char     *desc[] =
@@ -143,6 +312,11 @@ int gmx_rms(int argc, char *argv[])
 
         "Option [TT]-bin[tt] does a binary dump of the comparison matrix.[PAR]",
 
+        "By default all frames are kept in memory for building the matrices.",
+        "With [TT]-mtile[tt] the matrices are built in tiles of the given",
+        "number of frames, reading the trajectories again for each tile,",
+        "so memory use does not grow with the trajectory length.[PAR]",
+
         "Option [TT]-bm[tt] produces a matrix of average bond angle deviations",
         "analogously to the [TT]-m[tt] option. Only bonds between atoms in the",
         "comparison group are considered."
@@ -150,6 +324,7 @@ int gmx_rms(int argc, char *argv[])
     static gmx_bool bPBC              = TRUE, bFitAll = TRUE, bSplit = FALSE;
     static gmx_bool bDeltaLog         = FALSE;
     static int      prev              = 0, freq = 1, freq2 = 1, nlevels = 80, avl = 0;
+    static int      mtile             = 0;
     static real     rmsd_user_max     = -1, rmsd_user_min = -1, bond_user_max = -1,
                     bond_user_min     = -1, delta_maxy = 0.0;
     /* strings and things for selecting difference method */
@@ -198,6 +373,8 @@ int gmx_rms(int argc, char *argv[])
           { &freq }, "Only write every nr-th frame to matrix" },
         { "-skip2", FALSE, etINT,
           { &freq2 }, "Only write every nr-th frame to matrix" },
+        { "-mtile", FALSE, etINT,
+          { &mtile }, "Number of frames per tile for the matrices, 0 keeps all frames in memory" },
         { "-max", FALSE, etREAL,
           { &rmsd_user_max }, "Maximum level in comparison matrix" },
         { "-min", FALSE, etREAL,
@@ -222,39 +399,40 @@ int gmx_rms(int argc, char *argv[])
           "HIDDENAverage over this distance in the RMSD matrix" }
     };
     int             natoms_trx, natoms_trx2, natoms;
-    int             i, j, k, m, teller, teller2, tel_mat, tel_mat2;
+    int             i, j, k, teller, teller2, tel_mat, tel_mat2;
 #define NFRAME 5000
     int             maxframe = NFRAME, maxframe2 = NFRAME;
     real            t, *w_rls, *w_rms, *w_rls_m = NULL, *w_rms_m = NULL;
     gmx_bool        bNorm, bAv, bFreq2, bFile2, bMat, bBond, bDelta, bMirror, bMass;
+    gmx_bool        bTileMat, bKeepMat, bSameW;
     gmx_bool        bFit, bReset;
     t_topology      top;
     int             ePBC;
     t_iatom        *iatom = NULL;
 
     matrix          box = {{0}};
-    rvec           *x, *xp, *xm = NULL, **mat_x = NULL, **mat_x2, *mat_x2_j = NULL, vec1,
-                    vec2;
+    rvec           *x, *xp, *xm = NULL, **mat_x = NULL, **mat_x2;
     t_trxstatus    *status;
     char            buf[256], buf2[256];
     int             ncons = 0;
     FILE           *fp;
     real            rlstot = 0, **rls, **rlsm = NULL, *time, *time2, *rlsnorm = NULL,
     **rmsd_mat             = NULL, **bond_mat = NULL, *axis, *axis2, *del_xaxis,
-    *del_yaxis, rmsd_max, rmsd_min, rmsd_avg, bond_max, bond_min, ang;
+    *del_yaxis, rmsd_max, rmsd_min, rmsd_avg, bond_max, bond_min;
     real            **rmsdav_mat = NULL, av_tot, weight, weight_tot;
     real            **delta      = NULL, delta_max, delta_scalex = 0, delta_scaley = 0,
     *delta_tot;
     int               delta_xsize = 0, del_lev = 100, mx, my, abs_my;
     gmx_bool          bA1, bA2, bPrev, bTop, *bInMat = NULL;
     int               ifit, *irms, ibond = 0, *ind_bond1 = NULL, *ind_bond2 = NULL, n_ind_m =
-        0;
+        0, nthreads;
     int              *ind_fit, **ind_rms, *ind_m = NULL, *rev_ind_m = NULL, *ind_rms_m =
         NULL;
     char             *gn_fit, **gn_rms;
     t_rgb             rlo, rhi;
     gmx_output_env_t *oenv;
     gmx_rmpbc_t       gpbc = NULL;
+    t_frame_prep      prep;
 
     t_filenm          fnm[] =
     {
@@ -358,6 +536,15 @@ int gmx_rms(int argc, char *argv[])
         }
     }
 
+    bTileMat = ((bMat || bBond) && mtile > 0);
+    if (bTileMat && bPrev)
+    {
+        fprintf(stderr, "WARNING: option -prev keeps all frames in memory, ignoring -mtile\n");
+        bTileMat = FALSE;
+    }
+    /* Whether to keep the matrix frames in memory during the passes */
+    bKeepMat = ((bMat || bBond) && !bTileMat);
+
     bTop = read_tps_conf(ftp2fn(efTPS, NFILE, fnm), &top, &ePBC, &xp,
                          NULL, box, TRUE);
     snew(w_rls, top.atoms.nr);
@@ -494,6 +681,16 @@ int gmx_rms(int argc, char *argv[])
         norm_princ(&top.atoms, ifit, ind_fit, top.atoms.nr, xp);
     }
 
+    prep.gpbc       = gpbc;
+    prep.bReset     = bReset;
+    prep.bNormPrinc = (ewhat == ewRhoSc);
+    prep.bFit       = bFit;
+    prep.atoms      = &top.atoms;
+    prep.ifit       = ifit;
+    prep.ind_fit    = ind_fit;
+    prep.w_rls      = w_rls;
+    prep.xp         = xp;
+
     /* read first frame */
     natoms_trx = read_first_x(oenv, &status, opt2fn("-f", NFILE, fnm), &t, &x, box);
     if (natoms_trx != top.atoms.nr)
@@ -614,30 +811,12 @@ int gmx_rms(int argc, char *argv[])
     teller  = 0;
     do
     {
-        if (bPBC)
-        {
-            gmx_rmpbc(gpbc, natoms, box, x);
-        }
-
-        if (bReset)
-        {
-            reset_x(ifit, ind_fit, natoms, NULL, x, w_rls);
-        }
-        if (ewhat == ewRhoSc)
-        {
-            norm_princ(&top.atoms, ifit, ind_fit, natoms, x);
-        }
-
-        if (bFit)
-        {
-            /*do the least squares fit to original structure*/
-            do_fit(natoms, w_rls, xp, x);
-        }
+        prepare_frame(&prep, natoms, box, x);
 
         if (teller % freq == 0)
         {
             /* keep frame for matrix calculation */
-            if (bMat || bBond || bPrev)
+            if (bKeepMat || bPrev)
             {
                 if (tel_mat >= NFRAME)
                 {
@@ -742,31 +921,12 @@ int gmx_rms(int argc, char *argv[])
         teller2  = 0;
         do
         {
-            if (bPBC)
-            {
-                gmx_rmpbc(gpbc, natoms, box, x);
-            }
-
-            if (bReset)
-            {
-                reset_x(ifit, ind_fit, natoms, NULL, x, w_rls);
-            }
-            if (ewhat == ewRhoSc)
-            {
-                norm_princ(&top.atoms, ifit, ind_fit, natoms, x);
-            }
-
-            if (bFit)
-            {
-                /*do the least squares fit to original structure*/
-                do_fit(natoms, w_rls, xp, x);
-            }
-
             if (teller2 % freq2 == 0)
             {
                 /* keep frame for matrix calculation */
-                if (bMat)
+                if (bKeepMat)
                 {
+                    prepare_frame(&prep, natoms, box, x);
                     if (tel_mat2 >= NFRAME)
                     {
                         srenew(mat_x2, tel_mat2+1);
@@ -799,7 +959,6 @@ int gmx_rms(int argc, char *argv[])
         tel_mat2 = tel_mat;
         freq2    = freq;
     }
-    gmx_rmpbc_done(gpbc);
 
     if (bMat || bBond)
     {
@@ -862,15 +1021,9 @@ int gmx_rms(int argc, char *argv[])
             }
         }
 
-        if (bFitAll)
-        {
-            snew(mat_x2_j, natoms);
-        }
         for (i = 0; i < tel_mat; i++)
         {
             axis[i] = time[freq*i];
-            fprintf(stderr, "\r element %5d; time %5.2f  ", i, axis[i]);
-            fflush(stderr);
             if (bMat)
             {
                 snew(rmsd_mat[i], tel_mat2);
@@ -879,27 +1032,110 @@ int gmx_rms(int argc, char *argv[])
             {
                 snew(bond_mat[i], tel_mat2);
             }
-            for (j = 0; j < tel_mat2; j++)
+        }
+
+        /* Use the same weights pointer when fitting and comparing
+         * with the same weights, which allows for a faster fit.
+         */
+        bSameW = bFitAll;
+        for (i = 0; i < n_ind_m && bSameW; i++)
+        {
+            bSameW = (w_rms_m[i] == w_rls_m[i]);
+        }
+        nthreads = gmx_omp_get_max_threads();
+        if (!bTileMat)
+        {
+            /* All frames are in memory, process rows in blocks for progress */
+            const int c_rowBlock = 100;
+
+            for (i = 0; i < tel_mat; i += c_rowBlock)
             {
-                if (bFitAll)
+                fprintf(stderr, "\r element %5d; time %5.2f  ", i, axis[i]);
+                fflush(stderr);
+                j = (bFile2 ? 0 : i);
+                calc_matrix_tile(ewhat != ewRMSD, !bFile2, n_ind_m,
+                                 bFitAll ? w_rls_m : NULL, bSameW ? w_rls_m : w_rms_m,
+                                 i, std::min(c_rowBlock, tel_mat - i), mat_x + i,
+                                 j, tel_mat2 - j, mat_x2 + j,
+                                 rmsd_mat, bond_mat, ibond, ind_bond1, ind_bond2,
+                                 nthreads);
+            }
+        }
+        else
+        {
+            t_matrix_reader reader_i, reader_j;
+            rvec          **tile_i, **tile_j;
+            int             ni, nj, nskip;
+
+            snew(tile_i, mtile);
+            snew(tile_j, mtile);
+            for (i = 0; i < mtile; i++)
+            {
+                snew(tile_i[i], n_ind_m);
+                snew(tile_j[i], n_ind_m);
+            }
+            open_matrix_reader(&reader_i, oenv, opt2fn("-f", NFILE, fnm), natoms, freq);
+            for (i = 0; i < tel_mat; i += ni)
+            {
+                fprintf(stderr, "\r element %5d; time %5.2f  ", i, axis[i]);
+                fflush(stderr);
+                ni = read_matrix_tile(&reader_i, oenv, &prep, n_ind_m, ind_m, 0, mtile, tile_i);
+                if (ni == 0)
                 {
-                    for (k = 0; k < n_ind_m; k++)
-                    {
-                        copy_rvec(mat_x2[j][k], mat_x2_j[k]);
-                    }
-                    do_fit(n_ind_m, w_rls_m, mat_x[i], mat_x2_j);
+                    gmx_fatal(FARGS, "Could not read frame %d of %s again",
+                              i, opt2fn("-f", NFILE, fnm));
                 }
-                else
+                nskip = 0;
+                if (!bFile2)
                 {
-                    mat_x2_j = mat_x2[j];
+                    /* The diagonal tile, frames before it are not needed */
+                    calc_matrix_tile(ewhat != ewRMSD, TRUE, n_ind_m,
+                                     bFitAll ? w_rls_m : NULL, bSameW ? w_rls_m : w_rms_m,
+                                     i, ni, tile_i, i, ni, tile_i,
+                                     rmsd_mat, bond_mat, ibond, ind_bond1, ind_bond2,
+                                     nthreads);
+                    nskip = i + ni;
                 }
+                if (nskip < tel_mat2)
+                {
+                    open_matrix_reader(&reader_j, oenv, opt2fn(bFile2 ? "-f2" : "-f", NFILE, fnm),
+                                       natoms, freq2);
+                    for (j = nskip; j < tel_mat2; j += nj)
+                    {
+                        nj = read_matrix_tile(&reader_j, oenv, &prep, n_ind_m, ind_m, nskip, mtile, tile_j);
+                        if (nj == 0)
+                        {
+                            gmx_fatal(FARGS, "Could not read matrix frame %d again", j);
+                        }
+                        nskip = 0;
+                        calc_matrix_tile(ewhat != ewRMSD, !bFile2, n_ind_m,
+                                         bFitAll ? w_rls_m : NULL, bSameW ? w_rls_m : w_rms_m,
+                                         i, ni, tile_i, j, nj, tile_j,
+                                         rmsd_mat, bond_mat, ibond, ind_bond1, ind_bond2,
+                                         nthreads);
+                    }
+                    close_matrix_reader(&reader_j);
+                }
+            }
+            close_matrix_reader(&reader_i);
+            for (i = 0; i < mtile; i++)
+            {
+                sfree(tile_i[i]);
+                sfree(tile_j[i]);
+            }
+            sfree(tile_i);
+            sfree(tile_j);
+        }
+
+        /* Fill the lower triangle and collect the statistics */
+        for (i = 0; i < tel_mat; i++)
+        {
+            for (j = 0; j < tel_mat2; j++)
+            {
                 if (bMat)
                 {
                     if (bFile2 || (i < j))
                     {
-                        rmsd_mat[i][j] =
-                            calc_similar_ind(ewhat != ewRMSD, irms[0], ind_rms_m,
-                                             w_rms_m, mat_x[i], mat_x2_j);
                         if (rmsd_mat[i][j] > rmsd_max)
                         {
                             rmsd_max = rmsd_mat[i][j];
@@ -919,14 +1155,6 @@ int gmx_rms(int argc, char *argv[])
                 {
                     if (bFile2 || (i <= j))
                     {
-                        ang = 0.0;
-                        for (m = 0; m < ibond; m++)
-                        {
-                            rvec_sub(mat_x[i][ind_bond1[m]], mat_x[i][ind_bond2[m]], vec1);
-                            rvec_sub(mat_x2_j[ind_bond1[m]], mat_x2_j[ind_bond2[m]], vec2);
-                            ang += std::acos(cos_angle(vec1, vec2));
-                        }
-                        bond_mat[i][j] = ang*180.0/(M_PI*ibond);
                         if (bond_mat[i][j] > bond_max)
                         {
                             bond_max = bond_mat[i][j];
@@ -1114,6 +1342,8 @@ int gmx_rms(int argc, char *argv[])
         }
     }
 
+    gmx_rmpbc_done(gpbc);
+
     bAv = opt2bSet("-a", NFILE, fnm);
 
     /* Write the RMSD's to file */
@@ -73,6 +73,9 @@ int gmx_sans(int argc, char *argv[])
         "[TT]-qstep[tt] Stepping in q space[PAR]",
         "Note: When using Debye direct method computational cost increases as",
         "1/2 * N * (N - 1) where N is atom number in group of interest.",
+        "The direct method bins the pairs in tiles of atoms on all threads and,",
+        "unless per-frame output is requested, accumulates all frames in a",
+        "single histogram.",
         "[PAR]",
         "WARNING: If sq or pr specified this tool can produce large number of files! Up to two times larger than number of frames!"
     };
@@ -125,6 +128,7 @@ int gmx_sans(int argc, char *argv[])
     gmx_rmpbc_t                           gpbc = NULL;
     gmx_bool                              bFFT = FALSE, bDEBYE = FALSE;
     gmx_bool                              bMC  = FALSE;
+    gmx_bool                              bFrameOutput;
     int                                   ePBC = -1;
     matrix                                box;
     rvec                                 *x;
@@ -139,6 +143,7 @@ int gmx_sans(int argc, char *argv[])
     t_filenm                             *fnmdup         = NULL;
     gmx_radial_distribution_histogram_t  *prframecurrent = NULL, *pr = NULL;
     gmx_static_structurefactor_t         *sqframecurrent = NULL, *sq = NULL;
+    gmx_debye_histogram_t                *dh             = NULL;
     gmx_output_env_t                     *oenv;
 
 #define NFILE asize(fnm)
@@ -240,6 +245,13 @@ int gmx_sans(int argc, char *argv[])
         gmx_rmpbc(gpbc, top->atoms.nr, box, x);
     }
 
+    bFrameOutput = (opt2fn_null("-prframe", NFILE, fnm) != NULL ||
+                    opt2fn_null("-sqframe", NFILE, fnm) != NULL);
+    if (!bMC && !bFrameOutput)
+    {
+        dh = gmx_debye_histogram_init(binwidth, 1);
+    }
+
     natoms = read_first_x(oenv, &status, fnTRX, &t, &x, box);
     if (natoms != top->atoms.nr)
     {
@@ -252,6 +264,12 @@ int gmx_sans(int argc, char *argv[])
         {
             gmx_rmpbc(gpbc, top->atoms.nr, box, x);
         }
+        if (dh != NULL)
+        {
+            /* without per-frame output all frames go into one histogram */
+            gmx_debye_histogram_add_frame(dh, x, box, index, isize, NULL, gsans->slength);
+            continue;
+        }
         /* allocate memory for pr */
         if (pr == NULL)
         {
@@ -287,8 +305,6 @@ int gmx_sans(int argc, char *argv[])
         }
         /* normalize histo */
         normalize_probability(prframecurrent->grn, prframecurrent->gr);
-        /* convert p(r) to sq */
-        sqframecurrent = convert_histogram_to_intensity_curve(prframecurrent, start_q, end_q, q_step);
         /* print frame data if needed */
         if (opt2fn_null("-prframe", NFILE, fnm))
         {
@@ -313,6 +329,8 @@ int gmx_sans(int argc, char *argv[])
         }
         if (opt2fn_null("-sqframe", NFILE, fnm))
         {
+            /* convert p(r) to sq */
+            sqframecurrent = convert_histogram_to_intensity_curve(prframecurrent, start_q, end_q, q_step);
             snew(hdr, 25);
             snew(suffix, GMX_PATH_MAX);
             /* prepare header */
@@ -331,19 +349,25 @@ int gmx_sans(int argc, char *argv[])
             sfree(hdr);
             sfree(suffix);
             sfree(fnmdup);
+            /* free sq structure */
+            sfree(sqframecurrent->q);
+            sfree(sqframecurrent->s);
+            sfree(sqframecurrent);
         }
         /* free pr structure */
         sfree(prframecurrent->gr);
         sfree(prframecurrent->r);
         sfree(prframecurrent);
-        /* free sq structure */
-        sfree(sqframecurrent->q);
-        sfree(sqframecurrent->s);
-        sfree(sqframecurrent);
     }
     while (read_next_x(oenv, status, &t, x, box));
     close_trj(status);
 
+    if (dh != NULL)
+    {
+        pr = gmx_debye_histogram_to_radial_distribution(dh);
+        gmx_debye_histogram_done(dh);
+    }
+
     /* normalize histo */
     normalize_probability(pr->grn, pr->gr);
     sq = convert_histogram_to_intensity_curve(pr, start_q, end_q, q_step);
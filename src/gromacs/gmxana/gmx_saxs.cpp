@@ -51,11 +51,21 @@ int gmx_saxs(int argc, char *argv[])
     const char       *desc[] = {
         "[THISMODULE] calculates SAXS structure factors for given index",
         "groups based on Cromer's method.",
-        "Both topology and trajectory files are required."
+        "Both topology and trajectory files are required.[PAR]",
+        "With [TT]-method lattice[tt] the structure factor is sampled on the",
+        "reciprocal lattice of the box. With [TT]-method debye[tt] the",
+        "intensity is computed with the Debye formula from pair-distance",
+        "histograms per pair of atom types, with bins of [TT]-bin[tt] nm,",
+        "accumulated over all frames and evaluated every [TT]-qstep[tt].",
+        "The pairs are binned on all threads, so this mode is practical for",
+        "large systems and long trajectories. Distances are not corrected",
+        "for periodicity, so the molecules in the groups should be whole."
     };
 
     static real       start_q = 0.0, end_q = 60.0, energy = 12.0;
+    static real       q_step  = 0.1, binwidth = 0.002;
     static int        ngroups = 1;
+    static const char *emethod[] = { NULL, "lattice", "debye", NULL };
 
     t_pargs           pa[] = {
         { "-ng",       FALSE, etINT, {&ngroups},
@@ -65,7 +75,13 @@ int gmx_saxs(int argc, char *argv[])
         {"-endq", FALSE, etREAL, {&end_q},
          "Ending q (1/nm)"},
         {"-energy", FALSE, etREAL, {&energy},
-         "Energy of the incoming X-ray (keV) "}
+         "Energy of the incoming X-ray (keV) "},
+        { "-method", FALSE, etENUM, {emethod},
+          "Method for the scattering intensity" },
+        {"-qstep", FALSE, etREAL, {&q_step},
+         "Stepping in q (1/nm) for the Debye method"},
+        {"-bin", FALSE, etREAL, {&binwidth},
+         "Binwidth (nm) of the pair-distance histograms for the Debye method"}
     };
 #define NPA asize(pa)
     const char       *fnTPS, *fnTRX, *fnNDX, *fnDAT = NULL;
@@ -90,9 +106,19 @@ int gmx_saxs(int argc, char *argv[])
     fnDAT = ftp2fn(efDAT, NFILE, fnm);
     fnNDX = ftp2fn_null(efNDX, NFILE, fnm);
 
-    do_scattering_intensity(fnTPS, fnNDX, opt2fn("-sq", NFILE, fnm),
-                            fnTRX, fnDAT,
-                            start_q, end_q, energy, ngroups, oenv);
+    if (emethod[0][0] == 'd')
+    {
+        do_debye_scattering_intensity(fnTPS, fnNDX, opt2fn("-sq", NFILE, fnm),
+                                      fnTRX, fnDAT,
+                                      start_q, end_q, q_step, binwidth,
+                                      energy, ngroups, oenv);
+    }
+    else
+    {
+        do_scattering_intensity(fnTPS, fnNDX, opt2fn("-sq", NFILE, fnm),
+                                fnTRX, fnDAT,
+                                start_q, end_q, energy, ngroups, oenv);
+    }
 
     please_cite(stdout, "Cromer1968a");
 
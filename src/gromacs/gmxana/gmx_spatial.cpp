@@ -37,10 +37,13 @@
 #include <cmath>
 #include <cstdlib>
 
+#include <algorithm>
+
 #include "gromacs/commandline/pargs.h"
 #include "gromacs/fileio/confio.h"
 #include "gromacs/fileio/trxio.h"
 #include "gromacs/gmxana/gmx_ana.h"
+#include "gromacs/gmxana/gridhist.h"
 #include "gromacs/math/vec.h"
 #include "gromacs/pbcutil/pbc.h"
 #include "gromacs/pbcutil/rmpbc.h"
@@ -49,11 +52,16 @@
 #include "gromacs/trajectory/trajectoryframe.h"
 #include "gromacs/utility/arraysize.h"
 #include "gromacs/utility/cstringutil.h"
+#include "gromacs/utility/exceptions.h"
 #include "gromacs/utility/futil.h"
+#include "gromacs/utility/gmxomp.h"
 #include "gromacs/utility/smalloc.h"
 
 static const double bohr = 0.529177249;  /* conversion factor to compensate for VMD plugin conversion... */
 
+/* Number of frames per thread that are read before binning them in parallel */
+static const int    c_framesPerThread = 4;
+
 int gmx_spatial(int argc, char *argv[])
 {
     const char       *desc[] = {
@@ -112,6 +120,7 @@ int gmx_spatial(int argc, char *argv[])
     static real       rBINWIDTH    = 0.05; /* nm */
     static gmx_bool   bCALCDIV     = TRUE;
     static int        iNAB         = 4;
+    static gmx_bool   bSparse      = TRUE;
 
     t_pargs           pa[] = {
         { "-pbc",      FALSE, etBOOL, {&bPBC},
@@ -125,7 +134,9 @@ int gmx_spatial(int argc, char *argv[])
         { "-bin",      FALSE, etREAL, {&rBINWIDTH},
           "Width of the bins (nm)" },
         { "-nab",      FALSE, etINT, {&iNAB},
-          "Number of additional bins to ensure proper memory allocation" }
+          "Number of additional bins to ensure proper memory allocation" },
+        { "-sparse",   FALSE, etBOOL, {&bSparse},
+          "Only allocate the blocks of bins that are occupied in the per-thread grids" }
     };
 
     double            MINBIN[3];
@@ -154,6 +165,12 @@ int gmx_spatial(int argc, char *argv[])
     double            norm;
     gmx_output_env_t *oenv;
     gmx_rmpbc_t       gpbc = NULL;
+    int               nthreads;
+    gmx_bool          bMore;
+    double           *sum;
+    gmx_frame_batch_t    *fb;
+    gmx_grid_histogram_t *gh;
+    int                  *local;
 
     t_filenm          fnm[] = {
         { efTPS,  NULL,  NULL, ffREAD }, /* this is for the topology */
@@ -234,6 +251,15 @@ int gmx_spatial(int argc, char *argv[])
     minx  = miny = minz = 999;
     maxx  = maxy = maxz = 0;
 
+    /* Frames are read and checked serially, then binned in parallel into
+     * private grids of the threads. The batch only keeps the SDF group,
+     * in the order of index.
+     */
+    nthreads = gmx_omp_get_max_threads();
+    fb       = gmx_frame_batch_init(fr.natoms, 1, &nidx, &index, c_framesPerThread*nthreads);
+    local    = gmx_frame_batch_local_index(fb, nidx, index);
+    gh       = gmx_grid_histogram_init(nbin[XX], nbin[YY], nbin[ZZ], bSparse, nthreads);
+
     if (bPBC)
     {
         gpbc = gmx_rmpbc_init(&top.idef, ePBC, natoms);
@@ -252,49 +278,75 @@ int gmx_spatial(int argc, char *argv[])
 
         for (i = 0; i < nidx; i++)
         {
-            if (fr.x[index[i]][XX] < MINBIN[XX] || fr.x[index[i]][XX] > MAXBIN[XX] ||
-                fr.x[index[i]][YY] < MINBIN[YY] || fr.x[index[i]][YY] > MAXBIN[YY] ||
-                fr.x[index[i]][ZZ] < MINBIN[ZZ] || fr.x[index[i]][ZZ] > MAXBIN[ZZ])
+            if (fr.x[index[i]][XX] < MINBIN[XX] || fr.x[index[i]][XX] >= MAXBIN[XX] ||
+                fr.x[index[i]][YY] < MINBIN[YY] || fr.x[index[i]][YY] >= MAXBIN[YY] ||
+                fr.x[index[i]][ZZ] < MINBIN[ZZ] || fr.x[index[i]][ZZ] >= MAXBIN[ZZ])
             {
                 printf("There was an item outside of the allocated memory. Increase the value given with the -nab option.\n");
                 printf("Memory was allocated for [%f,%f,%f]\tto\t[%f,%f,%f]\n", MINBIN[XX], MINBIN[YY], MINBIN[ZZ], MAXBIN[XX], MAXBIN[YY], MAXBIN[ZZ]);
                 printf("Memory was required for [%f,%f,%f]\n", fr.x[index[i]][XX], fr.x[index[i]][YY], fr.x[index[i]][ZZ]);
                 exit(1);
             }
-            x = static_cast<int>(std::ceil((fr.x[index[i]][XX]-MINBIN[XX])/rBINWIDTH));
-            y = static_cast<int>(std::ceil((fr.x[index[i]][YY]-MINBIN[YY])/rBINWIDTH));
-            z = static_cast<int>(std::ceil((fr.x[index[i]][ZZ]-MINBIN[ZZ])/rBINWIDTH));
-            ++bin[x][y][z];
-            if (x < minx)
-            {
-                minx = x;
-            }
-            if (x > maxx)
-            {
-                maxx = x;
-            }
-            if (y < miny)
-            {
-                miny = y;
-            }
-            if (y > maxy)
-            {
-                maxy = y;
-            }
-            if (z < minz)
+        }
+        numfr++;
+        /* printf("%f\t%f\t%f\n",box[XX][XX],box[YY][YY],box[ZZ][ZZ]); */
+
+        gmx_frame_batch_add(fb, fr.x, fr.box, fr.time);
+        bMore = read_next_frame(oenv, status, &fr);
+        if (fb->nframes < fb->nalloc && bMore)
+        {
+            continue;
+        }
+
+#pragma omp parallel for num_threads(nthreads) schedule(dynamic)
+        for (int f = 0; f < fb->nframes; f++)
+        {
+            try
             {
-                minz = z;
+                const rvec *xf     = fb->x[f];
+                int         thread = gmx_omp_get_thread_num();
+
+                for (int a = 0; a < nidx; a++)
+                {
+                    const real *xa = xf[local[a]];
+                    int         bx = static_cast<int>(std::ceil((xa[XX]-MINBIN[XX])/rBINWIDTH));
+                    int         by = static_cast<int>(std::ceil((xa[YY]-MINBIN[YY])/rBINWIDTH));
+                    int         bz = static_cast<int>(std::ceil((xa[ZZ]-MINBIN[ZZ])/rBINWIDTH));
+                    gmx_grid_histogram_add(gh, thread, bx, by, bz, 1);
+                }
             }
-            if (z > maxz)
+            GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR;
+        }
+        fb->nframes = 0;
+    }
+    while (bMore);
+
+    /* Collect the counts and the range of occupied bins */
+    snew(sum, static_cast<size_t>(nbin[XX])*nbin[YY]*nbin[ZZ]);
+    gmx_grid_histogram_reduce(gh, sum);
+    gmx_grid_histogram_done(gh);
+    gmx_frame_batch_done(fb);
+    sfree(local);
+    for (x = 0; x < nbin[XX]; x++)
+    {
+        for (y = 0; y < nbin[YY]; y++)
+        {
+            for (z = 0; z < nbin[ZZ]; z++)
             {
-                maxz = z;
+                bin[x][y][z] = static_cast<int>(sum[(x*nbin[YY] + y)*nbin[ZZ] + z]);
+                if (bin[x][y][z] > 0)
+                {
+                    minx = std::min(minx, x);
+                    maxx = std::max(maxx, x);
+                    miny = std::min(miny, y);
+                    maxy = std::max(maxy, y);
+                    minz = std::min(minz, z);
+                    maxz = std::max(maxz, z);
+                }
             }
         }
-        numfr++;
-        /* printf("%f\t%f\t%f\n",box[XX][XX],box[YY][YY],box[ZZ][ZZ]); */
-
     }
-    while (read_next_frame(oenv, status, &fr));
+    sfree(sum);
 
     if (bPBC)
     {
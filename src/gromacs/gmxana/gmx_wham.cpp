@@ -53,6 +53,7 @@
 
 #include <algorithm>
 #include <sstream>
+#include <vector>
 
 #include "gromacs/commandline/pargs.h"
 #include "gromacs/fileio/tpxio.h"
@@ -188,6 +189,14 @@ typedef struct
 
     /*! \brief TRUE, if any data point of the histogram is within min and max, otherwise FALSE */
     gmx_bool **bContrib;
+    /*! \brief Umbrella potential U/kT in each bin
+     *
+     * This does not change during the WHAM iterations, so it is computed
+     * only once by setup_reduced_potentials().  The exponent is stored
+     * instead of the Boltzmann factor, so that it can be combined with z
+     * before exponentiation without overflowing.
+     */
+    double   **betaU;
     real     **ztime;     //!< input data z(t) as a function of time. Required to compute ACTs
 
     /*! \brief average force estimated from average displacement, fAv=dzAv*k
@@ -222,6 +231,7 @@ typedef struct
 
     gmx_bool          bInitPotByIntegration;      //!< before WHAM, guess potential by force integration. Yields 1.5 to 2 times faster convergence
     int               stepUpdateContrib;          //!< update contribution table every ... iterations. Accelerates WHAM.
+    int               diisDepth;                  //!< nr of previous iterations used for DIIS extrapolation of z, 0 = plain iteration
     int               nCoordsel;                  //!< if >0: use only certain group in WHAM, if ==0: use all groups
     t_coordselection *coordsel;                   //!< for each tpr file: which pull coordinates to use in WHAM?
     /*!\}*/
@@ -318,8 +328,6 @@ typedef struct
     double                            *tabX, *tabY, tabMin, tabMax, tabDz;
     int                                tabNbins;
     /*!\}*/
-    gmx::DefaultRandomEngine           rng;                 //!< gromacs random number generator
-    gmx::TabulatedNormalDistribution<> normalDistribution;  //!< Uses default: real output, 14-bit table
 } t_UmbrellaOptions;
 
 //! Make an umbrella window (may contain several histograms)
@@ -335,6 +343,7 @@ t_UmbrellaWindow * initUmbrellaWindows(int nwin)
         win[i].N        = win[i].Ntot = 0;
         win[i].g        = win[i].tau  = win[i].tausmooth = 0;
         win[i].bContrib = 0;
+        win[i].betaU    = 0;
         win[i].ztime    = 0;
         win[i].forceAv  = 0;
         win[i].aver     = win[i].sigma = 0;
@@ -370,6 +379,13 @@ void freeUmbrellaWindows(t_UmbrellaWindow *win, int nwin)
                 sfree(win[i].bContrib[j]);
             }
         }
+        if (win[i].betaU)
+        {
+            for (j = 0; j < win[i].nPull; j++)
+            {
+                sfree(win[i].betaU[j]);
+            }
+        }
         sfree(win[i].Histo);
         sfree(win[i].cum);
         sfree(win[i].k);
@@ -381,6 +397,7 @@ void freeUmbrellaWindows(t_UmbrellaWindow *win, int nwin)
         sfree(win[i].tau);
         sfree(win[i].tausmooth);
         sfree(win[i].bContrib);
+        sfree(win[i].betaU);
         sfree(win[i].ztime);
         sfree(win[i].forceAv);
         sfree(win[i].aver);
@@ -826,6 +843,63 @@ double tabulated_pot(double dist, t_UmbrellaOptions *opt)
 }
 
 
+//! Return the umbrella potential of pull coordinate \p pullid of \p window in bin \p bin
+double umbrella_potential(t_UmbrellaWindow *window, int pullid, int bin, t_UmbrellaOptions *opt)
+{
+    double ztot      = opt->max-opt->min;
+    double ztot_half = ztot/2;
+    double distance  = (1.0*bin+0.5)*opt->dz+opt->min - window->pos[pullid]; /* distance to umbrella center */
+
+    if (opt->bCycl)
+    {                                     /* in cyclic wham:             */
+        if (distance > ztot_half)         /*    |distance| < ztot_half   */
+        {
+            distance -= ztot;
+        }
+        else if (distance < -ztot_half)
+        {
+            distance += ztot;
+        }
+    }
+
+    if (!opt->bTab)
+    {
+        return 0.5*window->k[pullid]*gmx::square(distance);       /* harmonic potential assumed. */
+    }
+    else
+    {
+        return tabulated_pot(distance, opt);                      /* Use tabulated potential     */
+    }
+}
+
+/*! \brief
+ * Tabulate the umbrella potentials in units of kT
+ *
+ * The umbrella potentials do not change during the WHAM iterations, so
+ * they are computed once here instead of in every iteration.
+ */
+void setup_reduced_potentials(t_UmbrellaWindow * window, int nWindows, t_UmbrellaOptions *opt,
+                              int nthreads)
+{
+#pragma omp parallel for num_threads(nthreads) schedule(dynamic)
+    for (int i = 0; i < nWindows; ++i)
+    {
+        try
+        {
+            snew(window[i].betaU, window[i].nPull);
+            for (int j = 0; j < window[i].nPull; ++j)
+            {
+                snew(window[i].betaU[j], opt->bins);
+                for (int k = 0; k < opt->bins; ++k)
+                {
+                    window[i].betaU[j][k] = umbrella_potential(&window[i], j, k, opt)/(BOLTZ*opt->Temperature);
+                }
+            }
+        }
+        GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR;
+    }
+}
+
 /*! \brief
  * Check which bins substiantially contribute (accelerates WHAM)
  *
@@ -834,71 +908,43 @@ double tabulated_pot(double dist, t_UmbrellaOptions *opt)
  * full precision.
  */
 void setup_acc_wham(double *profile, t_UmbrellaWindow * window, int nWindows,
-                    t_UmbrellaOptions *opt)
+                    t_UmbrellaOptions *opt, int nthreads)
 {
-    int           i, j, k, nGrptot = 0, nContrib = 0, nTot = 0;
-    double        U, min = opt->min, dz = opt->dz, temp, ztot_half, distance, ztot, contrib1, contrib2;
-    gmx_bool      bAnyContrib;
+    int           i, nGrptot = 0, nContrib = 0, nTot = 0;
+    double        wham_contrib_lim;
     static int    bFirst = 1;
-    static double wham_contrib_lim;
 
-    if (bFirst)
+    for (i = 0; i < nWindows; ++i)
     {
-        for (i = 0; i < nWindows; ++i)
-        {
-            nGrptot += window[i].nPull;
-        }
-        wham_contrib_lim = opt->Tolerance/nGrptot;
+        nGrptot += window[i].nPull;
     }
+    wham_contrib_lim = opt->Tolerance/nGrptot;
 
-    ztot      = opt->max-opt->min;
-    ztot_half = ztot/2;
-
+#pragma omp parallel for num_threads(nthreads) reduction(+:nContrib, nTot) schedule(static)
     for (i = 0; i < nWindows; ++i)
     {
         if (!window[i].bContrib)
         {
             snew(window[i].bContrib, window[i].nPull);
         }
-        for (j = 0; j < window[i].nPull; ++j)
+        for (int j = 0; j < window[i].nPull; ++j)
         {
             if (!window[i].bContrib[j])
             {
                 snew(window[i].bContrib[j], opt->bins);
             }
-            bAnyContrib = FALSE;
-            for (k = 0; k < opt->bins; ++k)
+            /* Note: there are two contributions to bin k in the wham equations:
+               i)  N[j]*exp(- U/(BOLTZ*opt->Temperature) + window[i].z[j])
+               ii) exp(- U/(BOLTZ*opt->Temperature))
+               where U is the umbrella potential
+               If any of these number is larger wham_contrib_lim, I set contrib=TRUE
+             */
+            const double *betaU       = window[i].betaU[j];
+            gmx_bool      bAnyContrib = FALSE;
+            for (int k = 0; k < opt->bins; ++k)
             {
-                temp     = (1.0*k+0.5)*dz+min;
-                distance = temp - window[i].pos[j];   /* distance to umbrella center */
-                if (opt->bCycl)
-                {                                     /* in cyclic wham:             */
-                    if (distance > ztot_half)         /*    |distance| < ztot_half   */
-                    {
-                        distance -= ztot;
-                    }
-                    else if (distance < -ztot_half)
-                    {
-                        distance += ztot;
-                    }
-                }
-                /* Note: there are two contributions to bin k in the wham equations:
-                   i)  N[j]*exp(- U/(BOLTZ*opt->Temperature) + window[i].z[j])
-                   ii) exp(- U/(BOLTZ*opt->Temperature))
-                   where U is the umbrella potential
-                   If any of these number is larger wham_contrib_lim, I set contrib=TRUE
-                 */
-
-                if (!opt->bTab)
-                {
-                    U = 0.5*window[i].k[j]*gmx::square(distance);       /* harmonic potential assumed. */
-                }
-                else
-                {
-                    U = tabulated_pot(distance, opt);            /* Use tabulated potential     */
-                }
-                contrib1                 = profile[k]*std::exp(-U/(BOLTZ*opt->Temperature));
-                contrib2                 = window[i].N[j]*std::exp(-U/(BOLTZ*opt->Temperature) + window[i].z[j]);
+                double contrib1 = profile[k]*std::exp(-betaU[k]);
+                double contrib2 = window[i].N[j]*std::exp(-betaU[k] + window[i].z[j]);
                 window[i].bContrib[j][k] = (contrib1 > wham_contrib_lim || contrib2 > wham_contrib_lim);
                 bAnyContrib              = (bAnyContrib | window[i].bContrib[j][k]);
                 if (window[i].bContrib[j][k])
@@ -912,7 +958,7 @@ void setup_acc_wham(double *profile, t_UmbrellaWindow * window, int nWindows,
                them all to true.*/
             if (!bAnyContrib)
             {
-                for (k = 0; k < opt->bins; ++k)
+                for (int k = 0; k < opt->bins; ++k)
                 {
                     window[i].bContrib[j][k] = TRUE;
                 }
@@ -923,6 +969,7 @@ void setup_acc_wham(double *profile, t_UmbrellaWindow * window, int nWindows,
     {
         printf("Initialized rapid wham stuff (contrib tolerance %g)\n"
                "Evaluating only %d of %d expressions.\n\n", wham_contrib_lim, nContrib, nTot);
+        bFirst = 0;
     }
 
     if (opt->verbose)
@@ -930,70 +977,60 @@ void setup_acc_wham(double *profile, t_UmbrellaWindow * window, int nWindows,
         printf("Updated rapid wham stuff. (evaluating only %d of %d contributions)\n",
                nContrib, nTot);
     }
-    bFirst = 0;
 }
 
 //! Compute the PMF (one of the two main WHAM routines)
 void calc_profile(double *profile, t_UmbrellaWindow * window, int nWindows,
-                  t_UmbrellaOptions *opt, gmx_bool bExact)
+                  t_UmbrellaOptions *opt, gmx_bool bExact, int nthreads)
 {
-    double ztot_half, ztot, min = opt->min, dz = opt->dz;
-
-    ztot      = opt->max-opt->min;
-    ztot_half = ztot/2;
-
-#pragma omp parallel
+#pragma omp parallel num_threads(nthreads)
     {
         try
         {
-            int nthreads  = gmx_omp_get_max_threads();
-            int thread_id = gmx_omp_get_thread_num();
-            int i;
-            int i0        = thread_id*opt->bins/nthreads;
-            int i1        = std::min(opt->bins, ((thread_id+1)*opt->bins)/nthreads);
-
-            for (i = i0; i < i1; ++i)
+            int                 thread_id = gmx_omp_get_thread_num();
+            int                 i0        = thread_id*opt->bins/nthreads;
+            int                 i1        = std::min(opt->bins, ((thread_id+1)*opt->bins)/nthreads);
+            std::vector<double> num(i1 - i0, 0.0), denom(i1 - i0, 0.0);
+
+            /* Loop over the histograms outermost, so the inner loop runs
+             * over contiguous bins of the tabulated potentials. */
+            for (int j = 0; j < nWindows; ++j)
             {
-                int    j, k;
-                double num, denom, invg, temp = 0, distance, U = 0;
-                num = denom = 0.;
-                for (j = 0; j < nWindows; ++j)
+                for (int k = 0; k < window[j].nPull; ++k)
                 {
-                    for (k = 0; k < window[j].nPull; ++k)
-                    {
-                        invg = 1.0/window[j].g[k] * window[j].bsWeight[k];
-                        temp = (1.0*i+0.5)*dz+min;
-                        num += invg*window[j].Histo[k][i];
+                    const double *histo  = window[j].Histo[k];
+                    const double *betaU  = window[j].betaU[k];
+                    double        invg   = 1.0/window[j].g[k] * window[j].bsWeight[k];
+                    double        weight = invg*window[j].N[k];
+                    double        z      = window[j].z[k];
 
-                        if (!(bExact || window[j].bContrib[k][i]))
+                    for (int i = i0; i < i1; ++i)
+                    {
+                        num[i - i0] += invg*histo[i];
+                    }
+                    if (bExact)
+                    {
+                        for (int i = i0; i < i1; ++i)
                         {
-                            continue;
+                            denom[i - i0] += weight*std::exp(-betaU[i] + z);
                         }
-                        distance = temp - window[j].pos[k];   /* distance to umbrella center */
-                        if (opt->bCycl)
-                        {                                     /* in cyclic wham:             */
-                            if (distance > ztot_half)         /*    |distance| < ztot_half   */
-                            {
-                                distance -= ztot;
-                            }
-                            else if (distance < -ztot_half)
+                    }
+                    else
+                    {
+                        const gmx_bool *bContrib = window[j].bContrib[k];
+                        for (int i = i0; i < i1; ++i)
+                        {
+                            if (bContrib[i])
                             {
-                                distance += ztot;
+                                denom[i - i0] += weight*std::exp(-betaU[i] + z);
                             }
                         }
-
-                        if (!opt->bTab)
-                        {
-                            U = 0.5*window[j].k[k]*gmx::square(distance);       /* harmonic potential assumed. */
-                        }
-                        else
-                        {
-                            U = tabulated_pot(distance, opt);            /* Use tabulated potential     */
-                        }
-                        denom += invg*window[j].N[k]*std::exp(-U/(BOLTZ*opt->Temperature) + window[j].z[k]);
                     }
                 }
-                profile[i] = num/denom;
+            }
+            for (int i = i0; i < i1; ++i)
+            {
+                profile[i] = num[i - i0]/denom[i - i0];
             }
         }
         GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR;
@@ -1002,62 +1039,43 @@ void calc_profile(double *profile, t_UmbrellaWindow * window, int nWindows,
 
 //! Compute the free energy offsets z (one of the two main WHAM routines)
 double calc_z(double * profile, t_UmbrellaWindow * window, int nWindows,
-              t_UmbrellaOptions *opt, gmx_bool bExact)
+              gmx_bool bExact, int nthreads)
 {
-    double min     = opt->min, dz = opt->dz, ztot_half, ztot;
     double maxglob = -1e20;
 
-    ztot      = opt->max-opt->min;
-    ztot_half = ztot/2;
-
-#pragma omp parallel
+#pragma omp parallel num_threads(nthreads)
     {
         try
         {
-            int    nthreads  = gmx_omp_get_max_threads();
             int    thread_id = gmx_omp_get_thread_num();
-            int    i;
             int    i0        = thread_id*nWindows/nthreads;
             int    i1        = std::min(nWindows, ((thread_id+1)*nWindows)/nthreads);
             double maxloc    = -1e20;
 
-            for (i = i0; i < i1; ++i)
+            for (int i = i0; i < i1; ++i)
             {
-                double total     = 0, temp, distance, U = 0;
-                int    j, k;
-
-                for (j = 0; j < window[i].nPull; ++j)
+                for (int j = 0; j < window[i].nPull; ++j)
                 {
-                    total = 0;
-                    for (k = 0; k < window[i].nBin; ++k)
+                    const double *betaU = window[i].betaU[j];
+                    double        total = 0;
+
+                    if (bExact)
                     {
-                        if (!(bExact || window[i].bContrib[j][k]))
+                        for (int k = 0; k < window[i].nBin; ++k)
                         {
-                            continue;
+                            total += profile[k]*std::exp(-betaU[k]);
                         }
-                        temp     = (1.0*k+0.5)*dz+min;
-                        distance = temp - window[i].pos[j];   /* distance to umbrella center */
-                        if (opt->bCycl)
-                        {                                     /* in cyclic wham:             */
-                            if (distance > ztot_half)         /*    |distance| < ztot_half   */
-                            {
-                                distance -= ztot;
-                            }
-                            else if (distance < -ztot_half)
+                    }
+                    else
+                    {
+                        const gmx_bool *bContrib = window[i].bContrib[j];
+                        for (int k = 0; k < window[i].nBin; ++k)
+                        {
+                            if (bContrib[k])
                             {
-                                distance += ztot;
+                                total += profile[k]*std::exp(-betaU[k]);
                             }
                         }
-
-                        if (!opt->bTab)
-                        {
-                            U = 0.5*window[i].k[j]*gmx::square(distance);       /* harmonic potential assumed. */
-                        }
-                        else
-                        {
-                            U = tabulated_pot(distance, opt);            /* Use tabulated potential     */
-                        }
-                        total += profile[k]*std::exp(-U/(BOLTZ*opt->Temperature));
                     }
                     /* Avoid floating point exception if window is far outside min and max */
                     if (total != 0.0)
@@ -1068,7 +1086,7 @@ double calc_z(double * profile, t_UmbrellaWindow * window, int nWindows,
                     {
                         total = 1000.0;
                     }
-                    temp = std::abs(total - window[i].z[j]);
+                    double temp = std::abs(total - window[i].z[j]);
                     if (temp > maxloc)
                     {
                         maxloc = temp;
@@ -1094,6 +1112,269 @@ double calc_z(double * profile, t_UmbrellaWindow * window, int nWindows,
     return maxglob;
 }
 
+/*! \brief
+ * DIIS (Pulay) extrapolation of the free energy offsets z
+ *
+ * One WHAM iteration maps z to new offsets z'. Plain iteration converges
+ * slowly when neighboring histograms overlap poorly. DIIS stores the last
+ * few pairs of z' and residuals z'-z and replaces z' by the linear
+ * combination of the stored z' that minimizes the norm of the combined
+ * residual.
+ */
+class WhamDiis
+{
+    public:
+        //! Set up extrapolation using the last \p depth iterations of \p window, 0 disables it
+        WhamDiis(int depth, t_UmbrellaWindow *window, int nWindows)
+            : depth_(depth), window_(window), nWindows_(nWindows)
+        {
+        }
+
+        //! Clear the history, needed whenever the WHAM equations change
+        void reset()
+        {
+            zOut_.clear();
+            residual_.clear();
+        }
+
+        //! Store the offsets used as input of the coming iteration
+        void storeInput()
+        {
+            if (depth_ > 0)
+            {
+                gather(&zIn_);
+            }
+        }
+
+        //! Replace the offsets computed in the last iteration by the extrapolated ones
+        void extrapolate()
+        {
+            if (depth_ <= 0)
+            {
+                return;
+            }
+            std::vector<double> zOut, residual;
+            gather(&zOut);
+            residual.resize(zOut.size());
+            for (size_t i = 0; i < zOut.size(); i++)
+            {
+                residual[i] = zOut[i] - zIn_[i];
+            }
+            if (static_cast<int>(zOut_.size()) == depth_)
+            {
+                zOut_.erase(zOut_.begin());
+                residual_.erase(residual_.begin());
+            }
+            zOut_.push_back(zOut);
+            residual_.push_back(residual);
+
+            std::vector<double> coeff;
+            while (zOut_.size() > 1 && !solveCoefficients(&coeff))
+            {
+                /* Nearly linearly dependent residuals, drop the oldest */
+                zOut_.erase(zOut_.begin());
+                residual_.erase(residual_.begin());
+            }
+            if (zOut_.size() < 2)
+            {
+                return;
+            }
+            std::vector<double> z(zOut.size(), 0.0);
+            for (size_t m = 0; m < zOut_.size(); m++)
+            {
+                for (size_t i = 0; i < z.size(); i++)
+                {
+                    z[i] += coeff[m]*zOut_[m][i];
+                }
+            }
+            scatter(z);
+        }
+
+    private:
+        //! Copy z of all histograms into \p z
+        void gather(std::vector<double> *z) const
+        {
+            z->clear();
+            for (int i = 0; i < nWindows_; i++)
+            {
+                z->insert(z->end(), window_[i].z, window_[i].z + window_[i].nPull);
+            }
+        }
+
+        //! Copy \p z back to the histograms
+        void scatter(const std::vector<double> &z)
+        {
+            const double *src = z.data();
+            for (int i = 0; i < nWindows_; i++)
+            {
+                std::copy(src, src + window_[i].nPull, window_[i].z);
+                src += window_[i].nPull;
+            }
+        }
+
+        /*! \brief Solve the DIIS equations for the mixing coefficients
+         *
+         * Minimizes |sum_m c_m r_m|^2 subject to sum_m c_m = 1 with a
+         * Lagrange multiplier. Returns FALSE if the system is singular.
+         */
+        gmx_bool solveCoefficients(std::vector<double> *coeff) const
+        {
+            int                 n = zOut_.size();
+            int                 nr = n + 1;
+            std::vector<double> a(nr*nr, 0.0), b(nr, 0.0);
+            double              scale = 0;
+
+            for (int m = 0; m < n; m++)
+            {
+                for (int l = 0; l <= m; l++)
+                {
+                    double dot = 0;
+                    for (size_t i = 0; i < residual_[m].size(); i++)
+                    {
+                        dot += residual_[m][i]*residual_[l][i];
+                    }
+                    a[m*nr + l] = a[l*nr + m] = dot;
+                }
+                scale = std::max(scale, a[m*nr + m]);
+            }
+            if (scale <= 0)
+            {
+                return FALSE;
+            }
+            for (int m = 0; m < n; m++)
+            {
+                for (int l = 0; l < n; l++)
+                {
+                    a[m*nr + l] /= scale;
+                }
+                a[m*nr + n] = a[n*nr + m] = -1;
+            }
+            b[n] = -1;
+
+            /* Gaussian elimination with partial pivoting */
+            for (int col = 0; col < nr; col++)
+            {
+                int pivot = col;
+                for (int row = col + 1; row < nr; row++)
+                {
+                    if (std::abs(a[row*nr + col]) > std::abs(a[pivot*nr + col]))
+                    {
+                        pivot = row;
+                    }
+                }
+                if (std::abs(a[pivot*nr + col]) < 1e-12)
+                {
+                    return FALSE;
+                }
+                if (pivot != col)
+                {
+                    std::swap_ranges(a.begin() + pivot*nr, a.begin() + (pivot + 1)*nr, a.begin() + col*nr);
+                    std::swap(b[pivot], b[col]);
+                }
+                for (int row = col + 1; row < nr; row++)
+                {
+                    double f = a[row*nr + col]/a[col*nr + col];
+                    for (int l = col; l < nr; l++)
+                    {
+                        a[row*nr + l] -= f*a[col*nr + l];
+                    }
+                    b[row] -= f*b[col];
+                }
+            }
+            coeff->resize(nr);
+            for (int row = nr - 1; row >= 0; row--)
+            {
+                double sum = b[row];
+                for (int l = row + 1; l < nr; l++)
+                {
+                    sum -= a[row*nr + l]*(*coeff)[l];
+                }
+                (*coeff)[row] = sum/a[row*nr + row];
+            }
+            for (int m = 0; m < n; m++)
+            {
+                if (!std::isfinite((*coeff)[m]))
+                {
+                    return FALSE;
+                }
+            }
+            return TRUE;
+        }
+
+        int                               depth_;
+        t_UmbrellaWindow                 *window_;
+        int                               nWindows_;
+        std::vector<double>               zIn_;
+        std::vector<std::vector<double> > zOut_;
+        std::vector<std::vector<double> > residual_;
+};
+
+/*! \brief Iterate the WHAM equations until self-consistency
+ *
+ * The contribution table is used for rapid convergence, followed by exact
+ * iterations. With bsIndex >= 0, the messages refer to that bootstrap.
+ * Returns the number of iterations.
+ */
+int do_wham_iterations(double *profile, t_UmbrellaWindow * window, int nWindows,
+                       t_UmbrellaOptions *opt, int bsIndex, int nthreads)
+{
+    WhamDiis diis(opt->diisDepth, window, nWindows);
+    double   maxchange = 1e20;
+    gmx_bool bExact    = FALSE, bConverged;
+    int      i         = 0;
+
+    do
+    {
+        if ( (i%opt->stepUpdateContrib) == 0)
+        {
+            setup_acc_wham(profile, window, nWindows, opt, nthreads);
+            diis.reset();
+        }
+        if (maxchange < opt->Tolerance)
+        {
+            bExact = TRUE;
+            diis.reset();
+            if (bsIndex < 0)
+            {
+                printf("Switched to exact iteration in iteration %d\n", i);
+            }
+        }
+        calc_profile(profile, window, nWindows, opt, bExact, nthreads);
+        if (((i%opt->stepchange) == 0 || i == 1) && i != 0)
+        {
+            if (bsIndex < 0)
+            {
+                printf("\t%4d) Maximum change %e\n", i, maxchange);
+            }
+            else
+            {
+                printf("\tBootstrap %d: %4d) Maximum change %e\n", bsIndex+1, i, maxchange);
+            }
+        }
+        i++;
+        diis.storeInput();
+        maxchange  = calc_z(profile, window, nWindows, bExact, nthreads);
+        bConverged = (maxchange <= opt->Tolerance && bExact);
+        if (!bConverged)
+        {
+            diis.extrapolate();
+        }
+    }
+    while (!bConverged);
+
+    if (bsIndex < 0)
+    {
+        printf("Converged in %d iterations. Final maximum change %g\n", i, maxchange);
+    }
+    else
+    {
+        printf("\tBootstrap %d: Converged in %d iterations. Final maximum change %g\n",
+               bsIndex+1, i, maxchange);
+    }
+
+    return i;
+}
+
 //! Make PMF symmetric around 0 (useful e.g. for membranes)
 void symmetrizeProfile(double* profile, t_UmbrellaOptions *opt)
 {
@@ -1248,7 +1529,7 @@ void copy_pullgrp_to_synthwindow(t_UmbrellaWindow *synthWindow,
     synthWindow->pos     [0] = thisWindow->pos      [pullid];
     synthWindow->z       [0] = thisWindow->z        [pullid];
     synthWindow->k       [0] = thisWindow->k        [pullid];
-    synthWindow->bContrib[0] = thisWindow->bContrib [pullid];
+    synthWindow->betaU   [0] = thisWindow->betaU    [pullid];
     synthWindow->g       [0] = thisWindow->g        [pullid];
     synthWindow->bsWeight[0] = thisWindow->bsWeight [pullid];
 }
@@ -1358,7 +1639,8 @@ void searchCumulative(double xx[], int n, double x, int *j)
 
 //! Bootstrap new trajectories and thereby generate new (bootstrapped) histograms
 void create_synthetic_histo(t_UmbrellaWindow *synthWindow, t_UmbrellaWindow *thisWindow,
-                            int pullid, t_UmbrellaOptions *opt)
+                            int pullid, t_UmbrellaOptions *opt, gmx::DefaultRandomEngine *rng,
+                            gmx::TabulatedNormalDistribution<> *normalDistribution)
 {
     int    N, i, nbins, r_index, ibin;
     double r, tausteps = 0.0, a, ap, dt, x, invsqrt2, g, y, sig = 0., z, mu = 0.;
@@ -1399,7 +1681,7 @@ void create_synthetic_histo(t_UmbrellaWindow *synthWindow, t_UmbrellaWindow *thi
     synthWindow->pos     [0] = thisWindow->pos[pullid];
     synthWindow->z       [0] = thisWindow->z[pullid];
     synthWindow->k       [0] = thisWindow->k[pullid];
-    synthWindow->bContrib[0] = thisWindow->bContrib[pullid];
+    synthWindow->betaU   [0] = thisWindow->betaU[pullid];
     synthWindow->g       [0] = thisWindow->g       [pullid];
     synthWindow->bsWeight[0] = thisWindow->bsWeight[pullid];
 
@@ -1435,14 +1717,14 @@ void create_synthetic_histo(t_UmbrellaWindow *synthWindow, t_UmbrellaWindow *thi
     invsqrt2 = 1.0/std::sqrt(2.0);
 
     /* init random sequence */
-    x = opt->normalDistribution(opt->rng);
+    x = (*normalDistribution)(*rng);
 
     if (opt->bsMethod == bsMethod_traj)
     {
         /* bootstrap points from the umbrella histograms */
         for (i = 0; i < N; i++)
         {
-            y = opt->normalDistribution(opt->rng);
+            y = (*normalDistribution)(*rng);
             x = a*x+ap*y;
             /* get flat distribution in [0,1] using cumulative distribution function of Gauusian
                Note: CDF(Gaussian) = 0.5*{1+erf[x/sqrt(2)]}
@@ -1462,7 +1744,7 @@ void create_synthetic_histo(t_UmbrellaWindow *synthWindow, t_UmbrellaWindow *thi
         i = 0;
         while (i < N)
         {
-            y    = opt->normalDistribution(opt->rng);
+            y    = (*normalDistribution)(*rng);
             x    = a*x+ap*y;
             z    = x*sig+mu;
             ibin = static_cast<int> (std::floor((z-opt->min)/opt->dz));
@@ -1569,7 +1851,7 @@ int func_wham_is_larger(const void *a, const void *b)
 }
 
 //! Make random weights for histograms for the Bayesian bootstrap of complete histograms)
-void setRandomBsWeights(t_UmbrellaWindow *synthwin, int nAllPull, t_UmbrellaOptions *opt)
+void setRandomBsWeights(t_UmbrellaWindow *synthwin, int nAllPull, gmx::DefaultRandomEngine *rng)
 {
     int     i;
     double *r;
@@ -1580,7 +1862,7 @@ void setRandomBsWeights(t_UmbrellaWindow *synthwin, int nAllPull, t_UmbrellaOpti
     /* generate ordered random numbers between 0 and nAllPull  */
     for (i = 0; i < nAllPull-1; i++)
     {
-        r[i] = dist(opt->rng);
+        r[i] = dist(*rng);
     }
     qsort((void *)r, nAllPull-1, sizeof(double), &func_wham_is_larger);
     r[nAllPull-1] = 1.0*nAllPull;
@@ -1603,26 +1885,91 @@ void setRandomBsWeights(t_UmbrellaWindow *synthwin, int nAllPull, t_UmbrellaOpti
     sfree(r);
 }
 
-//! The main bootstrapping routine
+/*! \brief Make one set of synthetic windows with one histogram each for bootstrapping
+ *
+ * The contribution tables are owned by each set, since they are updated
+ * during the WHAM iterations. All other arrays point into \p window.
+ */
+t_UmbrellaWindow *initSynthWindows(t_UmbrellaWindow *window, int nAllPull,
+                                   const int *allPull_winId, const int *allPull_pullId,
+                                   t_UmbrellaOptions *opt)
+{
+    t_UmbrellaWindow *synthWindow;
+
+    snew(synthWindow, nAllPull);
+    for (int i = 0; i < nAllPull; i++)
+    {
+        synthWindow[i].nPull = 1;
+        synthWindow[i].nBin  = opt->bins;
+        snew(synthWindow[i].Histo, 1);
+        if (opt->bsMethod == bsMethod_traj || opt->bsMethod == bsMethod_trajGauss)
+        {
+            snew(synthWindow[i].Histo[0], opt->bins);
+        }
+        snew(synthWindow[i].N, 1);
+        snew(synthWindow[i].pos, 1);
+        snew(synthWindow[i].z, 1);
+        snew(synthWindow[i].k, 1);
+        snew(synthWindow[i].bContrib, 1);
+        snew(synthWindow[i].bContrib[0], opt->bins);
+        snew(synthWindow[i].betaU, 1);
+        snew(synthWindow[i].g, 1);
+        snew(synthWindow[i].bsWeight, 1);
+        if (opt->bsMethod == bsMethod_BayesianHist)
+        {
+            /* just copy all histogams into synthWindow array */
+            copy_pullgrp_to_synthwindow(synthWindow+i, window+allPull_winId[i], allPull_pullId[i]);
+        }
+    }
+
+    return synthWindow;
+}
+
+//! Free synthetic windows made by initSynthWindows()
+void freeSynthWindows(t_UmbrellaWindow *synthWindow, int nAllPull, t_UmbrellaOptions *opt)
+{
+    for (int i = 0; i < nAllPull; i++)
+    {
+        if (opt->bsMethod == bsMethod_traj || opt->bsMethod == bsMethod_trajGauss)
+        {
+            sfree(synthWindow[i].Histo[0]);
+        }
+        sfree(synthWindow[i].Histo);
+        sfree(synthWindow[i].N);
+        sfree(synthWindow[i].pos);
+        sfree(synthWindow[i].z);
+        sfree(synthWindow[i].k);
+        sfree(synthWindow[i].bContrib[0]);
+        sfree(synthWindow[i].bContrib);
+        sfree(synthWindow[i].betaU);
+        sfree(synthWindow[i].g);
+        sfree(synthWindow[i].bsWeight);
+    }
+    sfree(synthWindow);
+}
+
+/*! \brief The main bootstrapping routine
+ *
+ * The bootstraps are independent, so they are distributed over the OpenMP
+ * threads. Each bootstrap draws from its own counter range of the random
+ * engine, so the results do not depend on the number of threads.
+ */
 void do_bootstrapping(const char *fnres, const char* fnprof, const char *fnhist,
                       const char *xlabel, char* ylabel, double *profile,
                       t_UmbrellaWindow * window, int nWindows, t_UmbrellaOptions *opt)
 {
-    t_UmbrellaWindow * synthWindow;
-    double            *bsProfile, *bsProfiles_av, *bsProfiles_av2, maxchange = 1e20, tmp, stddev;
-    int                i, j, *randomArray = 0, winid, pullid, ib;
+    double            *bsProfiles, *bsProfiles_av, *bsProfiles_av2, tmp, stddev;
+    int                i, j, ib, nthreads;
     int                iAllPull, nAllPull, *allPull_winId, *allPull_pullId;
     FILE              *fp;
-    gmx_bool           bExact = FALSE;
 
     /* init random generator */
     if (opt->bsSeed == 0)
     {
         opt->bsSeed = static_cast<int>(gmx::makeRandomSeed());
     }
-    opt->rng.seed(opt->bsSeed);
 
-    snew(bsProfile,     opt->bins);
+    snew(bsProfiles, opt->nBootStrap*opt->bins);
     snew(bsProfiles_av, opt->bins);
     snew(bsProfiles_av2, opt->bins);
 
@@ -1648,41 +1995,13 @@ void do_bootstrapping(const char *fnres, const char* fnprof, const char *fnhist,
         }
     }
 
-    /* setup stuff for synthetic windows */
-    snew(synthWindow, nAllPull);
-    for (i = 0; i < nAllPull; i++)
-    {
-        synthWindow[i].nPull = 1;
-        synthWindow[i].nBin  = opt->bins;
-        snew(synthWindow[i].Histo, 1);
-        if (opt->bsMethod == bsMethod_traj || opt->bsMethod == bsMethod_trajGauss)
-        {
-            snew(synthWindow[i].Histo[0], opt->bins);
-        }
-        snew(synthWindow[i].N, 1);
-        snew(synthWindow[i].pos, 1);
-        snew(synthWindow[i].z, 1);
-        snew(synthWindow[i].k, 1);
-        snew(synthWindow[i].bContrib, 1);
-        snew(synthWindow[i].g, 1);
-        snew(synthWindow[i].bsWeight, 1);
-    }
-
     switch (opt->bsMethod)
     {
         case bsMethod_hist:
-            snew(randomArray, nAllPull);
             printf("\n\nWhen computing statistical errors by bootstrapping entire histograms:\n");
             please_cite(stdout, "Hub2006");
             break;
         case bsMethod_BayesianHist:
-            /* just copy all histogams into synthWindow array */
-            for (i = 0; i < nAllPull; i++)
-            {
-                winid  = allPull_winId [i];
-                pullid = allPull_pullId[i];
-                copy_pullgrp_to_synthwindow(synthWindow+i, window+winid, pullid);
-            }
             break;
         case bsMethod_traj:
         case bsMethod_trajGauss:
@@ -1693,88 +2012,95 @@ void do_bootstrapping(const char *fnres, const char* fnprof, const char *fnhist,
     }
 
     /* do bootstrapping */
-    fp = xvgropen(fnprof, "Bootstrap profiles", xlabel, ylabel, opt->oenv);
-    for (ib = 0; ib < opt->nBootStrap; ib++)
+    nthreads = std::min(gmx_omp_get_max_threads(), opt->nBootStrap);
+#pragma omp parallel num_threads(nthreads)
     {
-        printf("  *******************************************\n"
-               "  ******** Start bootstrap nr %d ************\n"
-               "  *******************************************\n", ib+1);
-
-        switch (opt->bsMethod)
+        try
         {
-            case bsMethod_hist:
-                /* bootstrap complete histograms from given histograms */
-                getRandomIntArray(nAllPull, opt->histBootStrapBlockLength, randomArray, &opt->rng);
-                for (i = 0; i < nAllPull; i++)
+            /* setup stuff for synthetic windows */
+            t_UmbrellaWindow *synthWindow = initSynthWindows(window, nAllPull, allPull_winId,
+                                                             allPull_pullId, opt);
+            std::vector<int>  randomArray(nAllPull);
+
+#pragma omp for schedule(dynamic)
+            for (int ib = 0; ib < opt->nBootStrap; ib++)
+            {
+                gmx::DefaultRandomEngine           rng(opt->bsSeed);
+                gmx::TabulatedNormalDistribution<> normalDistribution;
+                double                            *bsProfile = bsProfiles + ib*opt->bins;
+
+                rng.restart(ib, 0);
+                printf("  ******** Start bootstrap nr %d ************\n", ib+1);
+
+                switch (opt->bsMethod)
                 {
-                    winid  = allPull_winId [randomArray[i]];
-                    pullid = allPull_pullId[randomArray[i]];
-                    copy_pullgrp_to_synthwindow(synthWindow+i, window+winid, pullid);
+                    case bsMethod_hist:
+                        /* bootstrap complete histograms from given histograms */
+                        getRandomIntArray(nAllPull, opt->histBootStrapBlockLength, randomArray.data(), &rng);
+                        for (int i = 0; i < nAllPull; i++)
+                        {
+                            int winid  = allPull_winId [randomArray[i]];
+                            int pullid = allPull_pullId[randomArray[i]];
+                            copy_pullgrp_to_synthwindow(synthWindow+i, window+winid, pullid);
+                        }
+                        break;
+                    case bsMethod_BayesianHist:
+                        /* keep histos, but assign random weights ("Bayesian bootstrap") */
+                        setRandomBsWeights(synthWindow, nAllPull, &rng);
+                        for (int i = 0; i < nAllPull; i++)
+                        {
+                            synthWindow[i].z[0] = window[allPull_winId[i]].z[allPull_pullId[i]];
+                        }
+                        break;
+                    case bsMethod_traj:
+                    case bsMethod_trajGauss:
+                        /* create new histos from given histos, that is generate new hypothetical
+                           trajectories */
+                        for (int i = 0; i < nAllPull; i++)
+                        {
+                            int winid  = allPull_winId[i];
+                            int pullid = allPull_pullId[i];
+                            create_synthetic_histo(synthWindow+i, window+winid, pullid, opt,
+                                                   &rng, &normalDistribution);
+                        }
+                        break;
                 }
-                break;
-            case bsMethod_BayesianHist:
-                /* keep histos, but assign random weights ("Bayesian bootstrap") */
-                setRandomBsWeights(synthWindow, nAllPull, opt);
-                break;
-            case bsMethod_traj:
-            case bsMethod_trajGauss:
-                /* create new histos from given histos, that is generate new hypothetical
-                   trajectories */
-                for (i = 0; i < nAllPull; i++)
+
+                /* write histos in case of verbose output */
+                if (opt->bs_verbose)
                 {
-                    winid  = allPull_winId[i];
-                    pullid = allPull_pullId[i];
-                    create_synthetic_histo(synthWindow+i, window+winid, pullid, opt);
+#pragma omp critical
+                    print_histograms(fnhist, synthWindow, nAllPull, ib, opt, xlabel);
                 }
-                break;
-        }
 
-        /* write histos in case of verbose output */
-        if (opt->bs_verbose)
-        {
-            print_histograms(fnhist, synthWindow, nAllPull, ib, opt, xlabel);
-        }
+                /* do wham, using the profile as guess */
+                std::memcpy(bsProfile, profile, opt->bins*sizeof(double));
+                do_wham_iterations(bsProfile, synthWindow, nAllPull, opt, ib, 1);
 
-        /* do wham */
-        i         = 0;
-        bExact    = FALSE;
-        maxchange = 1e20;
-        std::memcpy(bsProfile, profile, opt->bins*sizeof(double)); /* use profile as guess */
-        do
-        {
-            if ( (i%opt->stepUpdateContrib) == 0)
-            {
-                setup_acc_wham(bsProfile, synthWindow, nAllPull, opt);
-            }
-            if (maxchange < opt->Tolerance)
-            {
-                bExact = TRUE;
-            }
-            if (((i%opt->stepchange) == 0 || i == 1) && i != 0)
-            {
-                printf("\t%4d) Maximum change %e\n", i, maxchange);
-            }
-            calc_profile(bsProfile, synthWindow, nAllPull, opt, bExact);
-            i++;
-        }
-        while ( (maxchange = calc_z(bsProfile, synthWindow, nAllPull, opt, bExact)) > opt->Tolerance || !bExact);
-        printf("\tConverged in %d iterations. Final maximum change %g\n", i, maxchange);
+                if (opt->bLog)
+                {
+                    prof_normalization_and_unit(bsProfile, opt);
+                }
 
-        if (opt->bLog)
-        {
-            prof_normalization_and_unit(bsProfile, opt);
-        }
+                /* symmetrize profile around z=0 */
+                if (opt->bSym)
+                {
+                    symmetrizeProfile(bsProfile, opt);
+                }
+            }
 
-        /* symmetrize profile around z=0 */
-        if (opt->bSym)
-        {
-            symmetrizeProfile(bsProfile, opt);
+            freeSynthWindows(synthWindow, nAllPull, opt);
         }
+        GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR;
+    }
 
-        /* save stuff to get average and stddev */
+    /* save stuff to get average and stddev, in the order of the bootstraps */
+    fp = xvgropen(fnprof, "Bootstrap profiles", xlabel, ylabel, opt->oenv);
+    for (ib = 0; ib < opt->nBootStrap; ib++)
+    {
         for (i = 0; i < opt->bins; i++)
         {
-            tmp                = bsProfile[i];
+            tmp                = bsProfiles[ib*opt->bins + i];
             bsProfiles_av[i]  += tmp;
             bsProfiles_av2[i] += tmp*tmp;
             fprintf(fp, "%e\t%e\n", (i+0.5)*opt->dz+opt->min, tmp);
@@ -1799,6 +2125,12 @@ void do_bootstrapping(const char *fnres, const char* fnprof, const char *fnhist,
     }
     xvgrclose(fp);
     printf("Wrote boot strap result to %s\n", fnres);
+
+    sfree(bsProfiles);
+    sfree(bsProfiles_av);
+    sfree(bsProfiles_av2);
+    sfree(allPull_winId);
+    sfree(allPull_pullId);
 }
 
 //! Return type of input file based on file extension (xvg, pdo, or tpr)
@@ -3131,7 +3463,7 @@ void guessPotByIntegration(t_UmbrellaWindow *window, int nWindows, t_UmbrellaOpt
     {
         pot[j] = std::exp(-pot[j]/(BOLTZ*opt->Temperature));
     }
-    calc_z(pot, window, nWindows, opt, TRUE);
+    calc_z(pot, window, nWindows, TRUE, gmx_omp_get_max_threads());
 
     sfree(pot);
     sfree(f);
@@ -3316,6 +3648,7 @@ int gmx_wham(int argc, char *argv[])
         "* [TT]-tol[tt]    Stop iteration if profile (probability) changed less than tolerance",
         "* [TT]-auto[tt]   Automatic determination of boundaries",
         "* [TT]-min,-max[tt]   Boundaries of the profile",
+        "* [TT]-diis[tt]   Accelerate convergence by DIIS extrapolation over this many iterations",
         "",
         "The data points that are used to compute the profile",
         "can be restricted with options [TT]-b[tt], [TT]-e[tt], and [TT]-dt[tt]. ",
@@ -3338,6 +3671,9 @@ int gmx_wham(int argc, char *argv[])
         "^^^^^^^^^^^^^^^",
         "",
         "If available, the number of OpenMP threads used by gmx wham is controlled with [TT]-nt[tt].",
+        "The WHAM iterations are parallelized over histogram bins and windows, and",
+        "with bootstrapping, the bootstraps are distributed over the threads. Each bootstrap",
+        "uses its own random number stream, so the results do not depend on the number of threads.",
         "",
         "Autocorrelations",
         "^^^^^^^^^^^^^^^^",
@@ -3423,6 +3759,8 @@ int gmx_wham(int argc, char *argv[])
           "Temperature"},
         { "-tol", FALSE, etREAL, {&opt.Tolerance},
           "Tolerance"},
+        { "-diis", FALSE, etINT, {&opt.diisDepth},
+          "Number of previous iterations used for DIIS extrapolation of the free energy offsets (0 = plain iteration)"},
         { "-v", FALSE, etBOOL, {&opt.verbose},
           "Verbose mode"},
         { "-b", FALSE, etREAL, {&opt.tmin},
@@ -3492,8 +3830,8 @@ int gmx_wham(int argc, char *argv[])
     int                      i, j, l, nfiles, nwins, nfiles2;
     t_UmbrellaHeader         header;
     t_UmbrellaWindow       * window = NULL;
-    double                  *profile, maxchange = 1e20;
-    gmx_bool                 bMinSet, bMaxSet, bAutoSet, bExact = FALSE;
+    double                  *profile;
+    gmx_bool                 bMinSet, bMaxSet, bAutoSet;
     char                   **fninTpr, **fninPull, **fninPdo;
     const char              *fnPull;
     FILE                    *histout, *profout;
@@ -3534,6 +3872,7 @@ int gmx_wham(int argc, char *argv[])
     opt.acTrestart            = 1.0;
     opt.stepchange            = 100;
     opt.stepUpdateContrib     = 100;
+    opt.diisDepth             = 0;
 
     if (!parse_common_args(&argc, argv, 0,
                            NFILE, fnm, asize(pa), pa, asize(desc), desc, 0, NULL, &opt.oenv))
@@ -3593,6 +3932,11 @@ int gmx_wham(int argc, char *argv[])
         opt.bAuto = FALSE;
     }
 
+    if (opt.diisDepth < 0)
+    {
+        gmx_fatal(FARGS, "The DIIS depth (option -diis) cannot be negative\n");
+    }
+
     if (opt.bTauIntGiven && opt.bCalcTauInt)
     {
         gmx_fatal(FARGS, "Either read (option -iiact) or calculate (option -ac) the\n"
@@ -3648,8 +3992,9 @@ int gmx_wham(int argc, char *argv[])
     }
 
     /* It is currently assumed that all pull coordinates have the same geometry, so they also have the same coordinate units.
-       We can therefore get the units for the xlabel from the first coordinate. */
-    sprintf(xlabel, "\\xx\\f{} (%s)", header.pcrd[0].coord_unit);
+       We can therefore get the units for the xlabel from the first coordinate.
+       PDO files do not store the pull coordinates, their displacements are in nm. */
+    sprintf(xlabel, "\\xx\\f{} (%s)", opt.bPdo ? "nm" : header.pcrd[0].coord_unit);
 
     nwins = nfiles;
 
@@ -3707,6 +4052,9 @@ int gmx_wham(int argc, char *argv[])
         averageSigma(window, nwins);
     }
 
+    /* Tabulate the umbrella potentials used in all WHAM iterations */
+    setup_reduced_potentials(window, nwins, &opt, gmx_omp_get_max_threads());
+
     /* Get initial potential by simple integration */
     if (opt.bInitPotByIntegration)
     {
@@ -3722,28 +4070,7 @@ int gmx_wham(int argc, char *argv[])
     {
         opt.stepchange = 1;
     }
-    i = 0;
-    do
-    {
-        if ( (i%opt.stepUpdateContrib) == 0)
-        {
-            setup_acc_wham(profile, window, nwins, &opt);
-        }
-        if (maxchange < opt.Tolerance)
-        {
-            bExact = TRUE;
-            /* if (opt.verbose) */
-            printf("Switched to exact iteration in iteration %d\n", i);
-        }
-        calc_profile(profile, window, nwins, &opt, bExact);
-        if (((i%opt.stepchange) == 0 || i == 1) && i != 0)
-        {
-            printf("\t%4d) Maximum change %e\n", i, maxchange);
-        }
-        i++;
-    }
-    while ( (maxchange = calc_z(profile, window, nwins, &opt, bExact)) > opt.Tolerance || !bExact);
-    printf("Converged in %d iterations. Final maximum change %g\n", i, maxchange);
+    do_wham_iterations(profile, window, nwins, &opt, -1, gmx_omp_get_max_threads());
 
     /* calc error from Kumar's formula */
     /* Unclear how the error propagates along reaction coordinate, therefore
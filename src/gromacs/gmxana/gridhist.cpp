@@ -0,0 +1,245 @@
+/*
+ * This file is part of the GROMACS molecular simulation package.
+ *
+ * Copyright (c) 2017, by the GROMACS development team, led by
+ * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
+ * and including many others, as listed in the AUTHORS file in the
+ * top-level source directory and at http://www.gromacs.org.
+ *
+ * GROMACS is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ *
+ * GROMACS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GROMACS; if not, see
+ * http://www.gnu.org/licenses, or write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA.
+ *
+ * If you want to redistribute modifications to GROMACS, please
+ * consider that scientific software is very special. Version
+ * control is crucial - bugs must be traceable. We will be happy to
+ * consider code for inclusion in the official distribution, but
+ * derived work must not be called official GROMACS. Details are found
+ * in the README & COPYING files - if they are missing, get the
+ * official version at http://www.gromacs.org.
+ *
+ * To help us fund GROMACS development, we humbly ask that you cite
+ * the research papers on the package. Check out http://www.gromacs.org.
+ */
+#include "gmxpre.h"
+
+#include "gridhist.h"
+
+#include <algorithm>
+
+#include "gromacs/math/vec.h"
+#include "gromacs/utility/fatalerror.h"
+#include "gromacs/utility/smalloc.h"
+
+/* Maximum memory for the coordinates in a frame batch */
+static const size_t c_maxBatchBytes = 64*1024*1024;
+
+gmx_grid_histogram_t *gmx_grid_histogram_init(int nx, int ny, int nz,
+                                              gmx_bool bSparse, int nthreads)
+{
+    gmx_grid_histogram_t *gh;
+    int                   t;
+
+    snew(gh, 1);
+    gh->n[XX]    = nx;
+    gh->n[YY]    = ny;
+    gh->n[ZZ]    = nz;
+    gh->ncell    = nx*ny*nz;
+    gh->nthreads = nthreads;
+    gh->bSparse  = bSparse;
+    gh->nblock   = (gh->ncell + GMX_GRIDHIST_BLOCK_SIZE - 1)/GMX_GRIDHIST_BLOCK_SIZE;
+    if (bSparse)
+    {
+        snew(gh->block, nthreads);
+        for (t = 0; t < nthreads; t++)
+        {
+            snew(gh->block[t], gh->nblock);
+        }
+    }
+    else
+    {
+        snew(gh->grid, nthreads);
+        for (t = 0; t < nthreads; t++)
+        {
+            snew(gh->grid[t], gh->ncell);
+        }
+    }
+
+    return gh;
+}
+
+void gmx_grid_histogram_reduce(const gmx_grid_histogram_t *gh, double *sum)
+{
+    int t, b, c, c0, c1;
+
+    for (t = 0; t < gh->nthreads; t++)
+    {
+        if (gh->bSparse)
+        {
+            for (b = 0; b < gh->nblock; b++)
+            {
+                if (gh->block[t][b] != NULL)
+                {
+                    c0 = b*GMX_GRIDHIST_BLOCK_SIZE;
+                    c1 = std::min(c0 + GMX_GRIDHIST_BLOCK_SIZE, gh->ncell);
+                    for (c = c0; c < c1; c++)
+                    {
+                        sum[c] += gh->block[t][b][c - c0];
+                    }
+                }
+            }
+        }
+        else
+        {
+            for (c = 0; c < gh->ncell; c++)
+            {
+                sum[c] += gh->grid[t][c];
+            }
+        }
+    }
+}
+
+void gmx_grid_histogram_done(gmx_grid_histogram_t *gh)
+{
+    int t, b;
+
+    for (t = 0; t < gh->nthreads; t++)
+    {
+        if (gh->bSparse)
+        {
+            for (b = 0; b < gh->nblock; b++)
+            {
+                sfree(gh->block[t][b]);
+            }
+            sfree(gh->block[t]);
+        }
+        else
+        {
+            sfree(gh->grid[t]);
+        }
+    }
+    sfree(gh->block);
+    sfree(gh->grid);
+    sfree(gh);
+}
+
+gmx_frame_batch_t *gmx_frame_batch_init(int natoms, int ngroups, const int *gnx, int **index,
+                                        int maxframes)
+{
+    gmx_frame_batch_t *fb;
+    int                g, i, f;
+
+    snew(fb, 1);
+    fb->natoms = natoms;
+    snew(fb->pos, natoms);
+    for (i = 0; i < natoms; i++)
+    {
+        fb->pos[i] = -1;
+    }
+    /* Store the atoms in the order of the input, for locality */
+    for (g = 0; g < ngroups; g++)
+    {
+        for (i = 0; i < gnx[g]; i++)
+        {
+            if (index[g][i] < 0 || index[g][i] >= natoms)
+            {
+                gmx_fatal(FARGS, "Index group %d refers to atom %d, while the frames have %d atoms",
+                          g + 1, index[g][i] + 1, natoms);
+            }
+            fb->pos[index[g][i]] = 0;
+        }
+    }
+    fb->nstored = 0;
+    for (i = 0; i < natoms; i++)
+    {
+        if (fb->pos[i] == 0)
+        {
+            fb->pos[i] = fb->nstored++;
+        }
+    }
+    snew(fb->atom, fb->nstored);
+    for (i = 0; i < natoms; i++)
+    {
+        if (fb->pos[i] >= 0)
+        {
+            fb->atom[fb->pos[i]] = i;
+        }
+    }
+
+    fb->nalloc = std::max(1, maxframes);
+    if (fb->nstored > 0)
+    {
+        fb->nalloc = std::min(fb->nalloc,
+                              std::max(1, static_cast<int>(c_maxBatchBytes/(fb->nstored*sizeof(rvec)))));
+    }
+    fb->nframes = 0;
+    snew(fb->x, fb->nalloc);
+    for (f = 0; f < fb->nalloc; f++)
+    {
+        snew(fb->x[f], fb->nstored);
+    }
+    snew(fb->box, fb->nalloc);
+    snew(fb->t, fb->nalloc);
+
+    return fb;
+}
+
+int *gmx_frame_batch_local_index(const gmx_frame_batch_t *fb, int n, const int *index)
+{
+    int *local;
+    int  i;
+
+    snew(local, n);
+    for (i = 0; i < n; i++)
+    {
+        local[i] = fb->pos[index[i]];
+        if (local[i] < 0)
+        {
+            gmx_incons("Atom not stored in the frame batch");
+        }
+    }
+
+    return local;
+}
+
+gmx_bool gmx_frame_batch_add(gmx_frame_batch_t *fb, const rvec *x, const matrix box, real t)
+{
+    int i;
+
+    for (i = 0; i < fb->nstored; i++)
+    {
+        copy_rvec(x[fb->atom[i]], fb->x[fb->nframes][i]);
+    }
+    copy_mat(box, fb->box[fb->nframes]);
+    fb->t[fb->nframes] = t;
+    fb->nframes++;
+
+    return fb->nframes == fb->nalloc;
+}
+
+void gmx_frame_batch_done(gmx_frame_batch_t *fb)
+{
+    int f;
+
+    for (f = 0; f < fb->nalloc; f++)
+    {
+        sfree(fb->x[f]);
+    }
+    sfree(fb->x);
+    sfree(fb->box);
+    sfree(fb->t);
+    sfree(fb->atom);
+    sfree(fb->pos);
+    sfree(fb);
+}
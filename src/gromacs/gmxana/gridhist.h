@@ -0,0 +1,131 @@
+/*
+ * This file is part of the GROMACS molecular simulation package.
+ *
+ * Copyright (c) 2017, by the GROMACS development team, led by
+ * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
+ * and including many others, as listed in the AUTHORS file in the
+ * top-level source directory and at http://www.gromacs.org.
+ *
+ * GROMACS is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ *
+ * GROMACS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GROMACS; if not, see
+ * http://www.gnu.org/licenses, or write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA.
+ *
+ * If you want to redistribute modifications to GROMACS, please
+ * consider that scientific software is very special. Version
+ * control is crucial - bugs must be traceable. We will be happy to
+ * consider code for inclusion in the official distribution, but
+ * derived work must not be called official GROMACS. Details are found
+ * in the README & COPYING files - if they are missing, get the
+ * official version at http://www.gromacs.org.
+ *
+ * To help us fund GROMACS development, we humbly ask that you cite
+ * the research papers on the package. Check out http://www.gromacs.org.
+ */
+
+#ifndef GMX_GMXANA_GRIDHIST_H
+#define GMX_GMXANA_GRIDHIST_H
+
+#include "gromacs/math/vectypes.h"
+#include "gromacs/utility/basedefinitions.h"
+#include "gromacs/utility/real.h"
+#include "gromacs/utility/smalloc.h"
+
+/* Number of consecutive cells in a block of a sparse grid */
+#define GMX_GRIDHIST_BLOCK_SHIFT 9
+#define GMX_GRIDHIST_BLOCK_SIZE  (1 << GMX_GRIDHIST_BLOCK_SHIFT)
+
+/* Histogram on a grid of nx*ny*nz cells with a private grid for every
+ * OpenMP thread, so threads can bin atoms or frames without locking.
+ * A sparse grid only allocates the blocks of cells that get hit, which
+ * keeps the per-thread copies of large, mostly empty 3D grids small.
+ */
+typedef struct gmx_grid_histogram_t {
+    int       n[DIM];   /* number of cells along each dimension */
+    int       ncell;    /* total number of cells */
+    int       nthreads; /* number of private grids */
+    gmx_bool  bSparse;  /* whether the grids are stored sparsely */
+    int       nblock;   /* number of blocks per sparse grid */
+    double  **grid;     /* dense grid per thread */
+    double ***block;    /* block pointers per thread for sparse grids */
+} gmx_grid_histogram_t;
+
+/* Batch of frames read serially and processed in parallel. Only the
+ * coordinates of the atoms in the index groups of the batch are stored,
+ * so callers index them with the positions returned by
+ * gmx_frame_batch_local_index().
+ */
+typedef struct gmx_frame_batch_t {
+    int      natoms;  /* number of atoms in the input frames */
+    int      nstored; /* number of atoms stored per frame */
+    int     *atom;    /* input atom number of each stored atom */
+    int     *pos;     /* stored position of each input atom, -1 if not stored */
+    int      nalloc;  /* maximum number of frames */
+    int      nframes; /* number of frames stored */
+    rvec   **x;       /* coordinates of the stored atoms */
+    matrix  *box;     /* boxes */
+    real    *t;       /* times */
+} gmx_frame_batch_t;
+
+gmx_grid_histogram_t *gmx_grid_histogram_init(int nx, int ny, int nz,
+                                              gmx_bool bSparse, int nthreads);
+/* Set up nthreads empty grids, for 2D or 1D grids pass 1 for nz or ny */
+
+static inline void gmx_grid_histogram_add(gmx_grid_histogram_t *gh, int thread,
+                                          int ix, int iy, int iz, double w)
+/* Add w to cell (ix,iy,iz) of the grid of thread */
+{
+    int c = (ix*gh->n[YY] + iy)*gh->n[ZZ] + iz;
+
+    if (!gh->bSparse)
+    {
+        gh->grid[thread][c] += w;
+    }
+    else
+    {
+        double **b = &gh->block[thread][c >> GMX_GRIDHIST_BLOCK_SHIFT];
+        if (*b == NULL)
+        {
+            snew(*b, GMX_GRIDHIST_BLOCK_SIZE);
+        }
+        (*b)[c & (GMX_GRIDHIST_BLOCK_SIZE - 1)] += w;
+    }
+}
+
+void gmx_grid_histogram_reduce(const gmx_grid_histogram_t *gh, double *sum);
+/* Add the sum of the thread grids to the ncell cells of sum, with the
+ * cell (ix,iy,iz) at (ix*ny + iy)*nz + iz
+ */
+
+void gmx_grid_histogram_done(gmx_grid_histogram_t *gh);
+
+gmx_frame_batch_t *gmx_frame_batch_init(int natoms, int ngroups, const int *gnx, int **index,
+                                        int maxframes);
+/* Set up a batch for frames of natoms atoms that stores the atoms in the
+ * ngroups index groups. The number of frames is limited to maxframes and
+ * by the memory for the coordinates, but is at least one.
+ */
+
+int *gmx_frame_batch_local_index(const gmx_frame_batch_t *fb, int n, const int *index);
+/* Return a new array with the stored positions of the n atoms in index,
+ * which should be in the groups of the batch
+ */
+
+gmx_bool gmx_frame_batch_add(gmx_frame_batch_t *fb, const rvec *x, const matrix box, real t);
+/* Copy the stored atoms of a frame into the batch, returns TRUE when the
+ * batch is full
+ */
+
+void gmx_frame_batch_done(gmx_frame_batch_t *fb);
+
+#endif
@@ -0,0 +1,236 @@
+/*
+ * This file is part of the GROMACS molecular simulation package.
+ *
+ * Copyright (c) 2017, by the GROMACS development team, led by
+ * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
+ * and including many others, as listed in the AUTHORS file in the
+ * top-level source directory and at http://www.gromacs.org.
+ *
+ * GROMACS is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ *
+ * GROMACS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GROMACS; if not, see
+ * http://www.gnu.org/licenses, or write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA.
+ *
+ * If you want to redistribute modifications to GROMACS, please
+ * consider that scientific software is very special. Version
+ * control is crucial - bugs must be traceable. We will be happy to
+ * consider code for inclusion in the official distribution, but
+ * derived work must not be called official GROMACS. Details are found
+ * in the README & COPYING files - if they are missing, get the
+ * official version at http://www.gromacs.org.
+ *
+ * To help us fund GROMACS development, we humbly ask that you cite
+ * the research papers on the package. Check out http://www.gromacs.org.
+ */
+/*! \internal \file
+ * \brief
+ * Tests for gmx cluster
+ *
+ * Clustering with the RMSD matrix stored in tiles on disk should give
+ * the same results as with the matrix in memory.
+ */
+
+#include "gmxpre.h"
+
+#include <cmath>
+
+#include <string>
+#include <vector>
+
+#include "gromacs/fileio/confio.h"
+#include "gromacs/fileio/trrio.h"
+#include "gromacs/gmxana/gmx_ana.h"
+#include "gromacs/math/vec.h"
+#include "gromacs/math/vectypes.h"
+#include "gromacs/topology/topology.h"
+#include "gromacs/utility/smalloc.h"
+#include "gromacs/utility/textreader.h"
+
+#include "testutils/cmdlinetest.h"
+#include "testutils/integrationtests.h"
+
+namespace
+{
+
+//! Number of frames, more than two bands of tiles and not a multiple of them.
+const int c_nframes = 150;
+
+class GmxCluster : public gmx::test::IntegrationTestFixture
+{
+    public:
+        GmxCluster() : tprFileName_(fileManager_.getInputFilePath("emim-tfsi-co2.tpr")),
+                       trajectoryFileName_(fileManager_.getTemporaryFilePath("traj.trr"))
+        {
+            t_topology top;
+            rvec      *x = NULL;
+            int        ePBC;
+            matrix     box;
+            read_tps_conf(tprFileName_.c_str(), &top, &ePBC, &x, NULL, box, FALSE);
+
+            // Frames from a few families of deformations of the
+            // structure, with deviations within a family that are around
+            // the clustering cutoff.
+            t_fileio *fio = gmx_trr_open(trajectoryFileName_.c_str(), "w");
+            for (int frame = 0; frame < c_nframes; ++frame)
+            {
+                const int              family = (frame*7) % 5;
+                std::vector<gmx::RVec> frameX(top.atoms.nr);
+                for (int i = 0; i < top.atoms.nr; ++i)
+                {
+                    for (int d = 0; d < DIM; ++d)
+                    {
+                        frameX[i][d] = x[i][d]
+                            + 0.3*std::sin(1.1*i + 2.3*d + 1.7*family)
+                            + 0.05*std::sin(0.37*i*(d + 1) + 0.9*frame);
+                    }
+                }
+                gmx_trr_write_frame(fio, frame, frame, 0, box, top.atoms.nr,
+                                    as_rvec_array(frameX.data()), NULL, NULL);
+            }
+            gmx_trr_close(fio);
+            sfree(x);
+            done_top(&top);
+        }
+
+        /*! \brief
+         * Runs gmx cluster on the CO2 molecules with \p args, writing the
+         * outputs with \p prefix.
+         */
+        void runCluster(const std::string &prefix, const std::vector<std::string> &args)
+        {
+            gmx::test::CommandLine caller;
+            caller.append("cluster");
+            caller.addOption("-s", tprFileName_);
+            caller.addOption("-f", trajectoryFileName_);
+            caller.addOption("-om", fileManager_.getTemporaryFilePath(prefix + "-raw.xpm"));
+            caller.addOption("-g", fileManager_.getTemporaryFilePath(prefix + ".log"));
+            caller.addOption("-dist", fileManager_.getTemporaryFilePath(prefix + "-dist.xvg"));
+            caller.addOption("-sz", fileManager_.getTemporaryFilePath(prefix + "-size.xvg"));
+            caller.addOption("-clid", fileManager_.getTemporaryFilePath(prefix + "-id.xvg"));
+            caller.addOption("-cutoff", "0.12");
+            caller.addOption("-skip", "1");
+            caller.addOption("-M", "10");
+            caller.addOption("-P", "3");
+            caller.addOption("-minstruct", "1");
+            // Write the middle structures and the structures of the first
+            // clusters that differ from each other.
+            caller.addOption("-cl", fileManager_.getTemporaryFilePath(prefix + "-clusters.pdb"));
+            caller.addOption("-wcl", "2");
+            caller.addOption("-nst", "1");
+            caller.addOption("-rmsmin", "0.1");
+            for (const std::string &arg : args)
+            {
+                caller.append(arg);
+            }
+            redirectStringToStdin("CO2\nCO2\n");
+            EXPECT_EQ(0, gmx_cluster(caller.argc(), caller.argv()));
+        }
+
+        //! Checks that output \p suffix of the runs \p ref and \p test is the same.
+        void compareOutput(const std::string &ref, const std::string &test,
+                           const std::string &suffix)
+        {
+            std::string refText  = gmx::TextReader::readFileToString(
+                        fileManager_.getTemporaryFilePath(ref + suffix));
+            std::string testText = gmx::TextReader::readFileToString(
+                        fileManager_.getTemporaryFilePath(test + suffix));
+            // Skip the headers of the xvg files, which contain the command line.
+            refText  = refText.substr(refText.find("\n@"));
+            testText = testText.substr(testText.find("\n@"));
+            EXPECT_EQ(refText, testText) << suffix;
+        }
+
+        //! Returns the lines of log \p name that do not contain file names.
+        std::vector<std::string> readLog(const std::string &name)
+        {
+            std::vector<std::string> lines;
+            gmx::TextReader          reader(fileManager_.getTemporaryFilePath(name));
+            std::string              line;
+            while (reader.readLine(&line))
+            {
+                if (line.find("Writing") != 0)
+                {
+                    lines.push_back(line);
+                }
+            }
+            return lines;
+        }
+
+        /*! \brief
+         * Runs \p method with the matrix in memory and in tiles and compares.
+         *
+         * With \p bWriteMatrix the tiled run also writes the matrix.
+         */
+        void testMethod(const char *method, const std::vector<std::string> &extraArgs,
+                        bool bWriteMatrix)
+        {
+            std::vector<std::string> args(extraArgs);
+            args.push_back("-method");
+            args.push_back(method);
+            std::vector<std::string> memoryArgs(args);
+            memoryArgs.push_back("-o");
+            memoryArgs.push_back(fileManager_.getTemporaryFilePath("memory.xpm"));
+            runCluster("memory", memoryArgs);
+            std::vector<std::string> tiledArgs(args);
+            tiledArgs.push_back("-tiles");
+            tiledArgs.push_back(fileManager_.getTemporaryFilePath("rmsd-tiles.dat"));
+            if (bWriteMatrix)
+            {
+                tiledArgs.push_back("-o");
+                tiledArgs.push_back(fileManager_.getTemporaryFilePath("tiles.xpm"));
+            }
+            runCluster("tiles", tiledArgs);
+            if (bWriteMatrix)
+            {
+                EXPECT_EQ(gmx::TextReader::readFileToString(
+                                  fileManager_.getTemporaryFilePath("memory.xpm")),
+                          gmx::TextReader::readFileToString(
+                                  fileManager_.getTemporaryFilePath("tiles.xpm")));
+            }
+
+            compareOutput("memory", "tiles", "-dist.xvg");
+            compareOutput("memory", "tiles", "-size.xvg");
+            compareOutput("memory", "tiles", "-id.xvg");
+            EXPECT_EQ(gmx::TextReader::readFileToString(
+                              fileManager_.getTemporaryFilePath("memory-clusters.pdb")),
+                      gmx::TextReader::readFileToString(
+                              fileManager_.getTemporaryFilePath("tiles-clusters.pdb")));
+            // The log contains the matrix statistics, the cluster members
+            // and their RMSD values, and apart from the file names should
+            // be the same.
+            const std::vector<std::string> memoryLog = readLog("memory.log");
+            const std::vector<std::string> tilesLog  = readLog("tiles.log");
+            EXPECT_EQ(memoryLog, tilesLog);
+            ASSERT_GT(memoryLog.size(), 10U);
+        }
+
+        std::string tprFileName_;
+        std::string trajectoryFileName_;
+};
+
+TEST_F(GmxCluster, GromosWithTilesMatchesMemory)
+{
+    testMethod("gromos", { "-fit" }, true);
+}
+
+TEST_F(GmxCluster, JarvisPatrickWithTilesMatchesMemory)
+{
+    testMethod("jarvis-patrick", { "-fit" }, false);
+}
+
+TEST_F(GmxCluster, DistanceRmsdWithTilesMatchesMemory)
+{
+    testMethod("gromos", { "-dista" }, true);
+}
+
+} // namespace
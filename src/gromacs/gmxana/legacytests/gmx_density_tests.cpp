@@ -0,0 +1,402 @@
+/*
+ * This file is part of the GROMACS molecular simulation package.
+ *
+ * Copyright (c) 2017, by the GROMACS development team, led by
+ * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
+ * and including many others, as listed in the AUTHORS file in the
+ * top-level source directory and at http://www.gromacs.org.
+ *
+ * GROMACS is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ *
+ * GROMACS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GROMACS; if not, see
+ * http://www.gnu.org/licenses, or write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA.
+ *
+ * If you want to redistribute modifications to GROMACS, please
+ * consider that scientific software is very special. Version
+ * control is crucial - bugs must be traceable. We will be happy to
+ * consider code for inclusion in the official distribution, but
+ * derived work must not be called official GROMACS. Details are found
+ * in the README & COPYING files - if they are missing, get the
+ * official version at http://www.gromacs.org.
+ *
+ * To help us fund GROMACS development, we humbly ask that you cite
+ * the research papers on the package. Check out http://www.gromacs.org.
+ */
+/*! \internal \file
+ * \brief
+ * Tests for gmx density, gmx densmap and gmx spatial
+ *
+ * These tools read frames in batches and bin them on all threads, so
+ * they are run with different numbers of threads and compared against
+ * direct binning where that is simple enough.
+ */
+
+#include "gmxpre.h"
+
+#include <cmath>
+
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "gromacs/fileio/confio.h"
+#include "gromacs/fileio/trrio.h"
+#include "gromacs/gmxana/gmx_ana.h"
+#include "gromacs/math/vec.h"
+#include "gromacs/math/vectypes.h"
+#include "gromacs/topology/topology.h"
+#include "gromacs/utility/futil.h"
+#include "gromacs/utility/gmxomp.h"
+#include "gromacs/utility/smalloc.h"
+#include "gromacs/utility/stringutil.h"
+#include "gromacs/utility/textreader.h"
+
+#include "testutils/cmdlinetest.h"
+#include "testutils/integrationtests.h"
+#include "testutils/testasserts.h"
+
+namespace
+{
+
+//! Number of frames in the test trajectory, more than in a batch.
+const int c_nframes = 30;
+
+//! Signature of the legacy tools.
+typedef int (*LegacyToolFunction)(int argc, char *argv[]);
+
+class GmxDensityTools : public gmx::test::IntegrationTestFixture
+{
+    public:
+        GmxDensityTools() : tprFileName_(fileManager_.getInputFilePath("emim-tfsi-co2.tpr")),
+                            trajectoryFileName_(fileManager_.getTemporaryFilePath("traj.trr"))
+        {
+            rvec  *x = NULL;
+            int    ePBC;
+            matrix box;
+            read_tps_conf(tprFileName_.c_str(), &top_, &ePBC, &x, NULL, box, FALSE);
+
+            // Frames with a slowly growing box and atoms that move a bit
+            // around their position in the run input file.
+            t_fileio *fio = gmx_trr_open(trajectoryFileName_.c_str(), "w");
+            for (int frame = 0; frame < c_nframes; ++frame)
+            {
+                const real             scale = 1 + 0.001*frame;
+                std::vector<gmx::RVec> frameX(top_.atoms.nr);
+                matrix                 frameBox;
+                for (int i = 0; i < top_.atoms.nr; ++i)
+                {
+                    for (int d = 0; d < DIM; ++d)
+                    {
+                        frameX[i][d] = scale*x[i][d] + 0.02*std::sin(0.7*i + 1.3*d + 0.4*frame);
+                    }
+                }
+                msmul(box, scale, frameBox);
+                gmx_trr_write_frame(fio, frame, frame, 0, frameBox, top_.atoms.nr,
+                                    as_rvec_array(frameX.data()), NULL, NULL);
+                frames_.push_back(frameX);
+                boxes_.push_back(std::vector<gmx::RVec>(frameBox, frameBox + DIM));
+            }
+            gmx_trr_close(fio);
+            sfree(x);
+        }
+        ~GmxDensityTools()
+        {
+            done_top(&top_);
+        }
+
+        //! Returns the atoms in residues called \p name.
+        std::vector<int> residueAtoms(const char *name) const
+        {
+            std::vector<int> atoms;
+            for (int i = 0; i < top_.atoms.nr; ++i)
+            {
+                if (std::string(*top_.atoms.resinfo[top_.atoms.atom[i].resind].name) == name)
+                {
+                    atoms.push_back(i);
+                }
+            }
+            return atoms;
+        }
+
+        /*! \brief
+         * Runs \p tool with \p args and the groups in \p groups on stdin,
+         * with \p nthreads OpenMP threads.
+         */
+        void runTool(LegacyToolFunction tool, const char *name, int nthreads,
+                     const std::vector<std::string> &args, const char *groups)
+        {
+            gmx::test::CommandLine caller;
+            caller.append(name);
+            caller.addOption("-s", tprFileName_);
+            caller.addOption("-f", trajectoryFileName_);
+            for (const std::string &arg : args)
+            {
+                caller.append(arg);
+            }
+
+            const int maxThreads = gmx_omp_get_max_threads();
+            gmx_omp_set_num_threads(nthreads);
+            redirectStringToStdin(groups);
+            EXPECT_EQ(0, tool(caller.argc(), caller.argv()));
+            gmx_omp_set_num_threads(maxThreads);
+        }
+
+        /*! \brief
+         * Returns the numbers on the lines of \p fileName, starting from
+         * line \p firstLine and skipping xvg comments.
+         */
+        std::vector<std::vector<double> > readNumbers(const std::string &fileName,
+                                                      int                firstLine = 0)
+        {
+            std::vector<std::vector<double> > data;
+            gmx::TextReader                   reader(fileName);
+            std::string                       line;
+            for (int i = 0; reader.readLine(&line); ++i)
+            {
+                if (i < firstLine || line.empty() || line[0] == '#' || line[0] == '@')
+                {
+                    continue;
+                }
+                std::istringstream  stream(line);
+                std::vector<double> values;
+                double              value;
+                while (stream >> value)
+                {
+                    values.push_back(value);
+                }
+                if (!values.empty())
+                {
+                    data.push_back(values);
+                }
+            }
+            return data;
+        }
+
+        //! Checks that \p test matches \p ref to within the output precision.
+        void compareNumbers(const std::vector<std::vector<double> > &ref,
+                            const std::vector<std::vector<double> > &test)
+        {
+            ASSERT_EQ(ref.size(), test.size());
+            ASSERT_FALSE(ref.empty());
+            for (size_t i = 0; i < ref.size(); ++i)
+            {
+                ASSERT_EQ(ref[i].size(), test[i].size());
+                for (size_t j = 0; j < ref[i].size(); ++j)
+                {
+                    EXPECT_REAL_EQ_TOL(ref[i][j], test[i][j],
+                                       gmx::test::relativeToleranceAsFloatingPoint(ref[i][j], 1e-5))
+                    << "line " << i << ", column " << j;
+                }
+            }
+        }
+
+        std::string                          tprFileName_;
+        std::string                          trajectoryFileName_;
+        t_topology                           top_;
+        std::vector<std::vector<gmx::RVec> > frames_;
+        std::vector<std::vector<gmx::RVec> > boxes_;
+};
+
+TEST_F(GmxDensityTools, DensityMatchesDirectBinning)
+{
+    const int         nslices = 20;
+    const std::string outFileName = fileManager_.getTemporaryFilePath("density.xvg");
+    runTool(gmx_density, "density", 3,
+            { "-o", outFileName, "-dens", "number", "-sl", "20", "-d", "Z",
+              "-ng", "2", "-nocenter", "-nosymm", "-norelative" },
+            "EMI\nCO2\n");
+    const std::vector<std::vector<double> > output = readNumbers(outFileName);
+    ASSERT_EQ(static_cast<size_t>(nslices), output.size());
+
+    // Bin the atoms the same way as gmx density, in the same precision.
+    const std::vector<int> groups[] = { residueAtoms("EMI"), residueAtoms("CO2") };
+    for (int g = 0; g < 2; ++g)
+    {
+        std::vector<double> density(nslices, 0.0);
+        for (int frame = 0; frame < c_nframes; ++frame)
+        {
+            const std::vector<gmx::RVec> &box    = boxes_[frame];
+            const real                    boxLen = box[ZZ][ZZ];
+            const real                    width  = boxLen/nslices;
+            const double                  invvol = nslices/(box[XX][XX]*box[YY][YY]*box[ZZ][ZZ]);
+            for (int atom : groups[g])
+            {
+                real z = frames_[frame][atom][ZZ];
+                while (z < 0)
+                {
+                    z += boxLen;
+                }
+                while (z > boxLen)
+                {
+                    z -= boxLen;
+                }
+                int slice = static_cast<int>(std::floor(z/width));
+                slice = (slice + nslices) % nslices;
+                density[slice] += invvol;
+            }
+        }
+        for (int slice = 0; slice < nslices; ++slice)
+        {
+            ASSERT_EQ(3U, output[slice].size());
+            EXPECT_REAL_EQ_TOL(density[slice]/c_nframes, output[slice][1 + g],
+                               gmx::test::relativeToleranceAsFloatingPoint(density[slice]/c_nframes, 1e-5))
+            << "group " << g << ", slice " << slice;
+        }
+    }
+}
+
+TEST_F(GmxDensityTools, CenteredDensityDoesNotDependOnThreadCount)
+{
+    const std::string              fileName1 = fileManager_.getTemporaryFilePath("density1.xvg");
+    const std::string              fileName3 = fileManager_.getTemporaryFilePath("density3.xvg");
+    const std::vector<std::string> args      = {
+        "-dens", "number", "-sl", "16", "-d", "Y", "-ng", "1", "-center", "-nosymm", "-norelative"
+    };
+    std::vector<std::string>       args1(args), args3(args);
+    args1.push_back("-o");
+    args1.push_back(fileName1);
+    args3.push_back("-o");
+    args3.push_back(fileName3);
+    runTool(gmx_density, "density", 1, args1, "CO2\nTFS\n");
+    runTool(gmx_density, "density", 3, args3, "CO2\nTFS\n");
+    const std::vector<std::vector<double> > reference = readNumbers(fileName1);
+    compareNumbers(reference, readNumbers(fileName3));
+
+    // Every atom is in some slice in every frame.
+    double sum = 0, expectedSum = 0;
+    for (const std::vector<double> &slice : reference)
+    {
+        sum += slice[1];
+    }
+    for (int frame = 0; frame < c_nframes; ++frame)
+    {
+        const std::vector<gmx::RVec> &box = boxes_[frame];
+        expectedSum += residueAtoms("TFS").size()*16/(box[XX][XX]*box[YY][YY]*box[ZZ][ZZ]);
+    }
+    EXPECT_REAL_EQ_TOL(expectedSum/c_nframes, sum, gmx::test::relativeToleranceAsFloatingPoint(sum, 1e-4));
+}
+
+TEST_F(GmxDensityTools, DensmapMatchesDirectBinning)
+{
+    const std::string outFileName = fileManager_.getTemporaryFilePath("densmap.dat");
+    runTool(gmx_densmap, "densmap", 3,
+            { "-od", outFileName, "-o", fileManager_.getTemporaryFilePath("densmap.xpm"),
+              "-aver", "z", "-bin", "0.5", "-n1", "0", "-n2", "0", "-unit", "count",
+              "-amax", "0", "-rmax", "0" },
+            "CO2\n");
+    // The first line and column contain the grid coordinates.
+    const std::vector<std::vector<double> > output = readNumbers(outFileName, 1);
+    ASSERT_FALSE(output.empty());
+    const int n1 = output.size();
+    const int n2 = output[0].size() - 1;
+
+    std::vector<double> grid(n1*n2, 0.0);
+    for (int frame = 0; frame < c_nframes; ++frame)
+    {
+        const std::vector<gmx::RVec> &box = boxes_[frame];
+        for (int atom : residueAtoms("CO2"))
+        {
+            real m1 = frames_[frame][atom][XX]/box[XX][XX];
+            real m2 = frames_[frame][atom][YY]/box[YY][YY];
+            m1 -= (m1 >= 1) ? 1 : 0;
+            m1 += (m1 < 0) ? 1 : 0;
+            m2 -= (m2 >= 1) ? 1 : 0;
+            m2 += (m2 < 0) ? 1 : 0;
+            grid[static_cast<int>(m1*n1)*n2 + static_cast<int>(m2*n2)] += n1*n2;
+        }
+    }
+    for (int i = 0; i < n1; ++i)
+    {
+        ASSERT_EQ(static_cast<size_t>(n2 + 1), output[i].size());
+        for (int j = 0; j < n2; ++j)
+        {
+            const double reference = grid[i*n2 + j]/c_nframes;
+            EXPECT_REAL_EQ_TOL(reference, output[i][1 + j],
+                               gmx::test::relativeToleranceAsFloatingPoint(reference, 1e-5))
+            << "cell " << i << ", " << j;
+        }
+    }
+}
+
+TEST_F(GmxDensityTools, RadialDensmapDoesNotDependOnThreadCount)
+{
+    const std::string              fileName1 = fileManager_.getTemporaryFilePath("densmap1.dat");
+    const std::string              fileName3 = fileManager_.getTemporaryFilePath("densmap3.dat");
+    const std::vector<std::string> args      = {
+        "-o", fileManager_.getTemporaryFilePath("densmap.xpm"),
+        "-bin", "0.1", "-n1", "0", "-n2", "0", "-unit", "nm-3", "-amax", "1.5", "-rmax", "1.5",
+        "-mirror"
+    };
+    std::vector<std::string>       args1(args), args3(args);
+    args1.push_back("-od");
+    args1.push_back(fileName1);
+    args3.push_back("-od");
+    args3.push_back(fileName3);
+    runTool(gmx_densmap, "densmap", 1, args1, "EMI\nTFS\nCO2\n");
+    runTool(gmx_densmap, "densmap", 3, args3, "EMI\nTFS\nCO2\n");
+    const std::vector<std::vector<double> > reference = readNumbers(fileName1, 1);
+    compareNumbers(reference, readNumbers(fileName3, 1));
+
+    // Some atoms should be within the cylinder.
+    double maxDensity = 0;
+    for (const std::vector<double> &line : reference)
+    {
+        for (size_t j = 1; j < line.size(); ++j)
+        {
+            maxDensity = std::max(maxDensity, line[j]);
+        }
+    }
+    EXPECT_GT(maxDensity, 0.0);
+}
+
+TEST_F(GmxDensityTools, SpatialDoesNotDependOnThreadCountOrStorage)
+{
+    char currentDir[GMX_PATH_MAX];
+    gmx_getcwd(currentDir, sizeof(currentDir));
+    // gmx spatial always writes grid.cube in the working directory.
+    gmx_chdir(fileManager_.getOutputTempDirectory());
+    const std::vector<std::string> args = {
+        "-nopbc", "-nodiv", "-ign", "0", "-bin", "0.2", "-nab", "4"
+    };
+    std::vector<std::vector<std::vector<double> > > outputs;
+    for (int nthreads : { 1, 3 })
+    {
+        for (const char *storage : { "-sparse", "-nosparse" })
+        {
+            std::vector<std::string> toolArgs(args);
+            toolArgs.push_back(storage);
+            runTool(gmx_spatial, "spatial", nthreads, toolArgs, "CO2\nCO2\n");
+            // Skip the header and the coordinates of the output group.
+            outputs.push_back(readNumbers("grid.cube", 6 + residueAtoms("CO2").size()));
+        }
+    }
+    gmx_chdir(currentDir);
+
+    for (size_t i = 1; i < outputs.size(); ++i)
+    {
+        compareNumbers(outputs[0], outputs[i]);
+    }
+    // With -nodiv the cubes contain the average number of atoms.
+    double sum = 0;
+    for (const std::vector<double> &line : outputs[0])
+    {
+        for (double value : line)
+        {
+            sum += value;
+        }
+    }
+    EXPECT_REAL_EQ_TOL(residueAtoms("CO2").size(), sum, gmx::test::absoluteTolerance(0.02));
+}
+
+} // namespace
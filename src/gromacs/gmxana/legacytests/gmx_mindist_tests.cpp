@@ -0,0 +1,300 @@
+/*
+ * This file is part of the GROMACS molecular simulation package.
+ *
+ * Copyright (c) 2017, by the GROMACS development team, led by
+ * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
+ * and including many others, as listed in the AUTHORS file in the
+ * top-level source directory and at http://www.gromacs.org.
+ *
+ * GROMACS is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ *
+ * GROMACS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GROMACS; if not, see
+ * http://www.gnu.org/licenses, or write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA.
+ *
+ * If you want to redistribute modifications to GROMACS, please
+ * consider that scientific software is very special. Version
+ * control is crucial - bugs must be traceable. We will be happy to
+ * consider code for inclusion in the official distribution, but
+ * derived work must not be called official GROMACS. Details are found
+ * in the README & COPYING files - if they are missing, get the
+ * official version at http://www.gromacs.org.
+ *
+ * To help us fund GROMACS development, we humbly ask that you cite
+ * the research papers on the package. Check out http://www.gromacs.org.
+ */
+/*! \internal \file
+ * \brief
+ * Tests for gmx mindist
+ */
+
+#include "gmxpre.h"
+
+#include <cmath>
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "gromacs/gmxana/gmx_ana.h"
+#include "gromacs/math/vectypes.h"
+#include "gromacs/utility/stringutil.h"
+#include "gromacs/utility/textreader.h"
+#include "gromacs/utility/textwriter.h"
+
+#include "testutils/cmdlinetest.h"
+#include "testutils/integrationtests.h"
+#include "testutils/testasserts.h"
+
+namespace
+{
+
+//! Number of atoms in each of the two index groups.
+const int c_groupSize = 150;
+
+//! Value for -searchpairs that makes gmx mindist always loop over all pairs.
+const char *const c_neverSearch = "2000000000";
+
+class GmxMindist : public gmx::test::IntegrationTestFixture
+{
+    public:
+        GmxMindist() : structureFileName_(fileManager_.getTemporaryFilePath("conf.pdb")),
+                       trajectoryFileName_(fileManager_.getTemporaryFilePath("traj.gro")),
+                       indexFileName_(fileManager_.getTemporaryFilePath("groups.ndx"))
+        {
+            writeTrajectory();
+            writeIndexFile();
+        }
+
+        /*! \brief
+         * Writes a trajectory of scattered atoms in a triclinic box.
+         *
+         * Some of the atoms are outside the unit cell, and the box changes
+         * between the frames.  The first frame is also written as a pdb
+         * file, which unlike a gro file specifies full periodicity.
+         */
+        void writeTrajectory()
+        {
+            const int       natoms = 2*c_groupSize;
+            gmx::TextWriter writer(trajectoryFileName_);
+            gmx::TextWriter structureWriter(structureFileName_);
+            for (int frame = 0; frame < 4; ++frame)
+            {
+                const double scale = 1.0 + 0.02*frame;
+                const double box[DIM][DIM] = {
+                    { 3.0*scale, 0.0, 0.0 },
+                    { 1.0*scale, 2.8*scale, 0.0 },
+                    { -0.8*scale, 1.0*scale, 2.6*scale }
+                };
+                if (frame == 0)
+                {
+                    // The unscaled box below; only the periodicity and the
+                    // atoms are used from this file.
+                    structureWriter.writeLine("CRYST1   30.000   29.732   28.983  76.58 106.02  70.35 P 1           1");
+                }
+                writer.writeLine(gmx::formatString("Scattered atoms t= %d.00000", frame));
+                writer.writeLine(gmx::formatString("%5d", natoms));
+                for (int i = 0; i < natoms; ++i)
+                {
+                    double x[DIM] = { 0.0, 0.0, 0.0 };
+                    for (int m = 0; m < DIM; ++m)
+                    {
+                        const double hash     = 43758.5453*std::sin(12.9898*i + 78.233*m + 3.1*frame);
+                        const double fraction = 1.2*(hash - std::floor(hash)) - 0.1;
+                        for (int d = 0; d < DIM; ++d)
+                        {
+                            x[d] += fraction*box[m][d];
+                        }
+                    }
+                    writer.writeLine(gmx::formatString("%5d%-5s%5s%5d%8.3f%8.3f%8.3f",
+                                                       i/3 + 1, "RES", "A", i + 1,
+                                                       x[XX], x[YY], x[ZZ]));
+                    if (frame == 0)
+                    {
+                        structureWriter.writeLine(gmx::formatString("ATOM  %5d  A   RES  %4d    %8.3f%8.3f%8.3f  1.00  0.00",
+                                                                    i + 1, i/3 + 1,
+                                                                    10*x[XX], 10*x[YY], 10*x[ZZ]));
+                    }
+                }
+                writer.writeLine(gmx::formatString("%10.5f%10.5f%10.5f%10.5f%10.5f%10.5f%10.5f%10.5f%10.5f",
+                                                   box[XX][XX], box[YY][YY], box[ZZ][ZZ],
+                                                   box[XX][YY], box[XX][ZZ], box[YY][XX],
+                                                   box[YY][ZZ], box[ZZ][XX], box[ZZ][YY]));
+            }
+            writer.close();
+            structureWriter.close();
+        }
+
+        //! Writes an index file that splits the atoms into two groups.
+        void writeIndexFile()
+        {
+            gmx::TextWriter writer(indexFileName_);
+            const char     *names[] = { "First", "Second" };
+            for (int g = 0; g < 2; ++g)
+            {
+                writer.writeLine(gmx::formatString("[ %s ]", names[g]));
+                for (int i = 0; i < c_groupSize; ++i)
+                {
+                    writer.writeLine(gmx::formatString("%d", g*c_groupSize + i + 1));
+                }
+            }
+            writer.close();
+        }
+
+        //! Returns the numbers in the data lines of file \p fileName.
+        std::vector<std::vector<double> > readData(const std::string &fileName)
+        {
+            std::vector<std::vector<double> > data;
+            gmx::TextReader                   reader(fileName);
+            std::string                       line;
+            while (reader.readLine(&line))
+            {
+                if (line.empty() || line[0] == '#' || line[0] == '@' || line[0] == '&')
+                {
+                    continue;
+                }
+                std::istringstream  stream(line);
+                std::vector<double> values;
+                double              value;
+                while (stream >> value)
+                {
+                    values.push_back(value);
+                }
+                data.push_back(values);
+            }
+            return data;
+        }
+
+        //! Output of a single gmx mindist run.
+        struct Output
+        {
+            //! Contents of the -od file.
+            std::vector<std::vector<double> > distances;
+            //! Contents of the -on file.
+            std::vector<std::vector<double> > contacts;
+            //! Contents of the -o file.
+            std::vector<std::vector<double> > atomPairs;
+            //! Contents of the -or file.
+            std::vector<std::vector<double> > residues;
+        };
+
+        /*! \brief
+         * Runs gmx mindist between the two groups.
+         *
+         * \p searchPairs is passed to -searchpairs to select between the
+         * neighborhood search and the loop over all pairs, and \p option
+         * is appended to the command line.
+         */
+        Output runMindist(const char *searchPairs, const char *option)
+        {
+            const std::string      prefix = fileManager_.getTemporaryFilePath(
+                        gmx::formatString("%s%s", searchPairs, option));
+            gmx::test::CommandLine caller;
+            caller.append("mindist");
+            caller.addOption("-f", trajectoryFileName_);
+            caller.addOption("-s", structureFileName_);
+            caller.addOption("-n", indexFileName_);
+            caller.addOption("-od", prefix + "-dist.xvg");
+            caller.addOption("-on", prefix + "-num.xvg");
+            caller.addOption("-o", prefix + "-pair.out");
+            caller.addOption("-or", prefix + "-res.xvg");
+            caller.addOption("-d", "0.5");
+            caller.addOption("-ng", "1");
+            caller.addOption("-searchpairs", searchPairs);
+            caller.append("-nopi");
+            caller.append(option);
+
+            redirectStringToStdin("0\n1\n");
+            EXPECT_EQ(0, gmx_mindist(caller.argc(), caller.argv()));
+
+            Output output;
+            output.distances = readData(prefix + "-dist.xvg");
+            output.contacts  = readData(prefix + "-num.xvg");
+            output.atomPairs = readData(prefix + "-pair.out");
+            output.residues  = readData(prefix + "-res.xvg");
+            return output;
+        }
+
+        //! Runs gmx mindist -pi and returns the contents of the -od file.
+        std::vector<std::vector<double> > runPeriodicMindist(const char *searchPairs)
+        {
+            const std::string      distFileName = fileManager_.getTemporaryFilePath(
+                        gmx::formatString("%s-periodic.xvg", searchPairs));
+            gmx::test::CommandLine caller;
+            caller.append("mindist");
+            caller.addOption("-f", trajectoryFileName_);
+            caller.addOption("-s", structureFileName_);
+            caller.addOption("-n", indexFileName_);
+            caller.addOption("-od", distFileName);
+            caller.addOption("-searchpairs", searchPairs);
+            caller.append("-pi");
+
+            redirectStringToStdin("0\n");
+            EXPECT_EQ(0, gmx_mindist(caller.argc(), caller.argv()));
+
+            return readData(distFileName);
+        }
+
+        //! Checks that \p test matches \p ref within a small tolerance.
+        void compareData(const std::vector<std::vector<double> > &ref,
+                         const std::vector<std::vector<double> > &test)
+        {
+            ASSERT_EQ(ref.size(), test.size());
+            ASSERT_FALSE(ref.empty());
+            for (size_t i = 0; i < ref.size(); ++i)
+            {
+                ASSERT_EQ(ref[i].size(), test[i].size());
+                for (size_t j = 0; j < ref[i].size(); ++j)
+                {
+                    EXPECT_REAL_EQ_TOL(ref[i][j], test[i][j],
+                                       gmx::test::relativeToleranceAsFloatingPoint(ref[i][j], 1e-5))
+                    << "line " << i << ", column " << j;
+                }
+            }
+        }
+
+        std::string structureFileName_;
+        std::string trajectoryFileName_;
+        std::string indexFileName_;
+};
+
+TEST_F(GmxMindist, SearchMatchesAllPairs)
+{
+    const Output reference = runMindist(c_neverSearch, "-nogroup");
+    const Output search    = runMindist("0", "-nogroup");
+
+    compareData(reference.distances, search.distances);
+    compareData(reference.contacts, search.contacts);
+    compareData(reference.atomPairs, search.atomPairs);
+    compareData(reference.residues, search.residues);
+}
+
+TEST_F(GmxMindist, SearchMatchesAllPairsWithGroupedContacts)
+{
+    const Output reference = runMindist(c_neverSearch, "-group");
+    const Output search    = runMindist("0", "-group");
+
+    compareData(reference.distances, search.distances);
+    compareData(reference.contacts, search.contacts);
+    compareData(reference.atomPairs, search.atomPairs);
+    compareData(reference.residues, search.residues);
+}
+
+TEST_F(GmxMindist, PeriodicImageSearchMatchesAllPairs)
+{
+    const std::vector<std::vector<double> > reference = runPeriodicMindist(c_neverSearch);
+    const std::vector<std::vector<double> > search    = runPeriodicMindist("0");
+
+    compareData(reference, search);
+}
+
+} // namespace
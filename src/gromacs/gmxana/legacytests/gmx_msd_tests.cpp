@@ -0,0 +1,150 @@
+/*
+ * This file is part of the GROMACS molecular simulation package.
+ *
+ * Copyright (c) 2017, by the GROMACS development team, led by
+ * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
+ * and including many others, as listed in the AUTHORS file in the
+ * top-level source directory and at http://www.gromacs.org.
+ *
+ * GROMACS is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ *
+ * GROMACS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GROMACS; if not, see
+ * http://www.gnu.org/licenses, or write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA.
+ *
+ * If you want to redistribute modifications to GROMACS, please
+ * consider that scientific software is very special. Version
+ * control is crucial - bugs must be traceable. We will be happy to
+ * consider code for inclusion in the official distribution, but
+ * derived work must not be called official GROMACS. Details are found
+ * in the README & COPYING files - if they are missing, get the
+ * official version at http://www.gromacs.org.
+ *
+ * To help us fund GROMACS development, we humbly ask that you cite
+ * the research papers on the package. Check out http://www.gromacs.org.
+ */
+/*! \internal \file
+ * \brief
+ * Tests for gmx msd
+ */
+
+#include "gmxpre.h"
+
+#include <cmath>
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "gromacs/gmxana/gmx_ana.h"
+#include "gromacs/utility/stringutil.h"
+#include "gromacs/utility/textreader.h"
+#include "gromacs/utility/textwriter.h"
+
+#include "testutils/cmdlinetest.h"
+#include "testutils/integrationtests.h"
+#include "testutils/testasserts.h"
+
+namespace
+{
+
+class GmxMsd : public gmx::test::IntegrationTestFixture
+{
+    public:
+        GmxMsd() : groFileName_(fileManager_.getInputFilePath("spc2.gro")),
+                   trajectoryFileName_(fileManager_.getTemporaryFilePath("traj.gro"))
+        {
+            writeTrajectory();
+        }
+
+        /*! \brief
+         * Writes a trajectory of the molecules in spc2.gro moving along
+         * deterministic paths, one frame per ps.
+         */
+        void writeTrajectory()
+        {
+            const char     *atomNames[] = { "OW", "HW1", "HW2" };
+            gmx::TextWriter writer(trajectoryFileName_);
+            for (int frame = 0; frame < 40; ++frame)
+            {
+                writer.writeLine(gmx::formatString("Two waters t= %d.00000", frame));
+                writer.writeLine(" 6");
+                for (int i = 0; i < 6; ++i)
+                {
+                    double x[3];
+                    for (int d = 0; d < 3; ++d)
+                    {
+                        x[d] = 1.0 + 0.2*d + 0.3*(i/3)
+                            + 0.02*frame*(d - 1) + 0.1*std::sin(0.3*frame*(i + 1) + d);
+                    }
+                    writer.writeLine(gmx::formatString("%5d%-5s%5s%5d%8.3f%8.3f%8.3f",
+                                                       i/3 + 1, "SOL", atomNames[i % 3], i + 1,
+                                                       x[0], x[1], x[2]));
+                }
+                writer.writeLine("   3.01000   3.01000   3.01000");
+            }
+            writer.close();
+        }
+
+        //! Runs gmx msd with \p extraOption and returns the MSD values.
+        std::vector<double> runMsd(const char *extraOption)
+        {
+            std::string            msdFileName = fileManager_.getTemporaryFilePath(
+                        std::string(extraOption + 1) + ".xvg");
+            gmx::test::CommandLine caller;
+            caller.append("msd");
+            caller.addOption("-f", trajectoryFileName_);
+            caller.addOption("-s", groFileName_);
+            caller.addOption("-o", msdFileName);
+            caller.addOption("-trestart", "1");
+            caller.append(extraOption);
+
+            redirectStringToStdin("0\n");
+            EXPECT_EQ(0, gmx_msd(caller.argc(), caller.argv()));
+
+            std::vector<double> msd;
+            gmx::TextReader     reader(msdFileName);
+            std::string         line;
+            while (reader.readLine(&line))
+            {
+                if (line.empty() || line[0] == '#' || line[0] == '@')
+                {
+                    continue;
+                }
+                std::istringstream stream(line);
+                double             t, value;
+                stream >> t >> value;
+                msd.push_back(value);
+            }
+            return msd;
+        }
+
+        std::string groFileName_;
+        std::string trajectoryFileName_;
+};
+
+TEST_F(GmxMsd, FftMatchesDirectWithAllOrigins)
+{
+    // With a restart interval equal to the frame spacing, the direct
+    // calculation uses all time origins, like -fft.
+    const std::vector<double> direct = runMsd("-nofft");
+    const std::vector<double> fft    = runMsd("-fft");
+
+    ASSERT_EQ(direct.size(), fft.size());
+    ASSERT_GT(direct.size(), 1U);
+    for (size_t i = 0; i < direct.size(); ++i)
+    {
+        EXPECT_REAL_EQ_TOL(direct[i], fft[i], gmx::test::relativeToleranceAsFloatingPoint(direct.back(), 1e-4));
+    }
+}
+
+} // namespace
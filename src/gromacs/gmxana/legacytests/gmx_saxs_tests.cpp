@@ -0,0 +1,335 @@
+/*
+ * This file is part of the GROMACS molecular simulation package.
+ *
+ * Copyright (c) 2017, by the GROMACS development team, led by
+ * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
+ * and including many others, as listed in the AUTHORS file in the
+ * top-level source directory and at http://www.gromacs.org.
+ *
+ * GROMACS is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ *
+ * GROMACS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GROMACS; if not, see
+ * http://www.gnu.org/licenses, or write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA.
+ *
+ * If you want to redistribute modifications to GROMACS, please
+ * consider that scientific software is very special. Version
+ * control is crucial - bugs must be traceable. We will be happy to
+ * consider code for inclusion in the official distribution, but
+ * derived work must not be called official GROMACS. Details are found
+ * in the README & COPYING files - if they are missing, get the
+ * official version at http://www.gromacs.org.
+ *
+ * To help us fund GROMACS development, we humbly ask that you cite
+ * the research papers on the package. Check out http://www.gromacs.org.
+ */
+/*! \internal \file
+ * \brief
+ * Tests for the Debye methods of gmx saxs and gmx sans
+ *
+ * The intensities and pair-distance distributions are compared against
+ * sums over all pairs of atoms.
+ */
+
+#include "gmxpre.h"
+
+#include <cmath>
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "gromacs/fileio/confio.h"
+#include "gromacs/fileio/trrio.h"
+#include "gromacs/gmxana/gmx_ana.h"
+#include "gromacs/gmxana/nsfactor.h"
+#include "gromacs/gmxana/sfactor.h"
+#include "gromacs/math/units.h"
+#include "gromacs/math/vec.h"
+#include "gromacs/math/vectypes.h"
+#include "gromacs/topology/topology.h"
+#include "gromacs/utility/smalloc.h"
+#include "gromacs/utility/textreader.h"
+
+#include "testutils/cmdlinetest.h"
+#include "testutils/integrationtests.h"
+#include "testutils/testasserts.h"
+
+namespace
+{
+
+//! Number of frames in the test trajectory.
+const int c_nframes = 2;
+
+class GmxScattering : public gmx::test::IntegrationTestFixture
+{
+    public:
+        GmxScattering() : tprFileName_(fileManager_.getInputFilePath("emim-tfsi-co2.tpr")),
+                          trajectoryFileName_(fileManager_.getTemporaryFilePath("traj.trr"))
+        {
+            rvec  *x = NULL;
+            int    ePBC;
+            matrix box;
+            read_tps_conf(tprFileName_.c_str(), &top_, &ePBC, &x, NULL, box, FALSE);
+            for (int i = 0; i < top_.atoms.nr; ++i)
+            {
+                if (std::string(*top_.atoms.resinfo[top_.atoms.atom[i].resind].name) == "TFS")
+                {
+                    index_.push_back(i);
+                }
+            }
+
+            // Frames that are scaled versions of the configuration in the
+            // run input file.
+            t_fileio *fio = gmx_trr_open(trajectoryFileName_.c_str(), "w");
+            for (int frame = 0; frame < c_nframes; ++frame)
+            {
+                const real             scale = 1 + 0.02*frame;
+                std::vector<gmx::RVec> frameX(top_.atoms.nr);
+                matrix                 frameBox;
+                for (int i = 0; i < top_.atoms.nr; ++i)
+                {
+                    svmul(scale, x[i], frameX[i]);
+                }
+                msmul(box, scale, frameBox);
+                gmx_trr_write_frame(fio, frame, frame, 0, frameBox, top_.atoms.nr,
+                                    as_rvec_array(frameX.data()), NULL, NULL);
+                frames_.push_back(frameX);
+            }
+            gmx_trr_close(fio);
+            sfree(x);
+        }
+        ~GmxScattering()
+        {
+            done_top(&top_);
+        }
+
+        //! Returns the columns of the data in xvg file \p fileName.
+        std::vector<std::vector<double> > readXvg(const std::string &fileName)
+        {
+            std::vector<std::vector<double> > columns;
+            gmx::TextReader                   reader(fileName);
+            std::string                       line;
+            while (reader.readLine(&line))
+            {
+                if (line.empty() || line[0] == '#' || line[0] == '@')
+                {
+                    continue;
+                }
+                std::istringstream stream(line);
+                double             value;
+                for (size_t i = 0; stream >> value; ++i)
+                {
+                    if (i == columns.size())
+                    {
+                        columns.resize(i + 1);
+                    }
+                    columns[i].push_back(value);
+                }
+            }
+            return columns;
+        }
+
+        //! Returns the distance between atoms \p i and \p j in \p frame.
+        double distance(int frame, int i, int j) const
+        {
+            double r2 = 0;
+            for (int d = 0; d < DIM; ++d)
+            {
+                const double dx = frames_[frame][i][d] - frames_[frame][j][d];
+                r2 += dx*dx;
+            }
+            return std::sqrt(r2);
+        }
+
+        //! Runs gmx sans and returns the columns of the -pr and -sq output.
+        void runSans(bool bFrameOutput,
+                     std::vector<std::vector<double> > *pr,
+                     std::vector<std::vector<double> > *sq)
+        {
+            const std::string      prFileName = fileManager_.getTemporaryFilePath("pr.xvg");
+            const std::string      sqFileName = fileManager_.getTemporaryFilePath("sq.xvg");
+            gmx::test::CommandLine caller;
+            caller.append("sans");
+            caller.addOption("-s", tprFileName_);
+            caller.addOption("-f", trajectoryFileName_);
+            caller.addOption("-pr", prFileName);
+            caller.addOption("-sq", sqFileName);
+            if (bFrameOutput)
+            {
+                caller.addOption("-prframe", fileManager_.getTemporaryFilePath("prframe.xvg"));
+            }
+            caller.addOption("-mode", "direct");
+            caller.addOption("-method", "debye");
+            caller.addOption("-bin", "0.2");
+            caller.addOption("-startq", "0");
+            caller.addOption("-endq", "2");
+            caller.addOption("-qstep", "0.05");
+            caller.append("-nopbc");
+
+            redirectStringToStdin("TFS\n");
+            EXPECT_EQ(0, gmx_sans(caller.argc(), caller.argv()));
+
+            *pr = readXvg(prFileName);
+            *sq = readXvg(sqFileName);
+        }
+
+        std::string                          tprFileName_;
+        std::string                          trajectoryFileName_;
+        t_topology                           top_;
+        std::vector<int>                     index_;
+        std::vector<std::vector<gmx::RVec> > frames_;
+};
+
+TEST_F(GmxScattering, SaxsDebyeMatchesAllPairs)
+{
+    const std::string      sqFileName = fileManager_.getTemporaryFilePath("saxs.xvg");
+    gmx::test::CommandLine caller;
+    caller.append("saxs");
+    caller.addOption("-s", tprFileName_);
+    caller.addOption("-f", trajectoryFileName_);
+    caller.addOption("-sq", sqFileName);
+    caller.addOption("-method", "debye");
+    caller.addOption("-startq", "0");
+    caller.addOption("-endq", "10");
+    caller.addOption("-qstep", "2");
+    caller.addOption("-bin", "0.002");
+    caller.addOption("-energy", "12");
+    caller.addOption("-ng", "1");
+
+    redirectStringToStdin("TFS\n");
+    ASSERT_EQ(0, gmx_saxs(caller.argc(), caller.argv()));
+    const std::vector<std::vector<double> > output = readXvg(sqFileName);
+    ASSERT_EQ(2U, output.size());
+    ASSERT_EQ(6U, output[0].size());
+
+    // The Debye formula with the Cromer-Mann form factors, averaged over
+    // the frames.  The atoms in the group have no hydrogens attached.
+    gmx_structurefactors_t *gsf      = gmx_structurefactors_init("sfactor.dat");
+    const double            hc       = 1239.842;
+    const double            momentum = 2*1000*M_PI*12/hc;
+    const double            lambda   = hc/(1000*12);
+    const size_t            nq       = output[0].size();
+    const int               n        = index_.size();
+    std::vector<double>     f(nq*n), intensity(nq, 0.0);
+    for (size_t q = 0; q < nq; ++q)
+    {
+        const double A = output[0][q]/(2*momentum);
+        for (int i = 0; i < n; ++i)
+        {
+            const int type = return_atom_type(*top_.atoms.atomname[index_[i]], gsf);
+            f[q*n + i]     = CMSF(gsf, type, 0, lambda, A);
+            intensity[q]  += c_nframes*f[q*n + i]*f[q*n + i];
+        }
+    }
+    for (int frame = 0; frame < c_nframes; ++frame)
+    {
+        for (int i = 0; i < n; ++i)
+        {
+            for (int j = i + 1; j < n; ++j)
+            {
+                const double r = distance(frame, index_[i], index_[j]);
+                for (size_t q = 0; q < nq; ++q)
+                {
+                    const double qr = output[0][q]*r;
+                    intensity[q] += 2*f[q*n + i]*f[q*n + j]*(q > 0 ? std::sin(qr)/qr : 1.0);
+                }
+            }
+        }
+    }
+    gmx_structurefactors_done(gsf);
+
+    for (size_t q = 0; q < nq; ++q)
+    {
+        const double A            = output[0][q]/(2*momentum);
+        const double polarization = 1 - 2*A*A*(1 - A*A);
+        const double reference    = intensity[q]*polarization/(c_nframes*top_.atoms.nr);
+        EXPECT_REAL_EQ_TOL(reference, output[1][q],
+                           gmx::test::relativeToleranceAsFloatingPoint(output[1][0], 1e-4))
+        << "q = " << output[0][q];
+    }
+}
+
+TEST_F(GmxScattering, SansDistributionMatchesAllPairs)
+{
+    std::vector<std::vector<double> > pr, sq;
+    runSans(false, &pr, &sq);
+    ASSERT_EQ(2U, pr.size());
+    ASSERT_FALSE(pr[0].empty());
+
+    gmx_neutron_atomic_structurefactors_t *gnsf  = gmx_neutronstructurefactors_init("nsfactor.dat");
+    gmx_sans_t                            *gsans = gmx_sans_init(&top_, gnsf);
+    const double                           binwidth = 0.2;
+    std::vector<double>                    reference(pr[0].size(), 0.0);
+    double                                 sum = 0;
+    for (int frame = 0; frame < c_nframes; ++frame)
+    {
+        for (size_t i = 0; i < index_.size(); ++i)
+        {
+            for (size_t j = i + 1; j < index_.size(); ++j)
+            {
+                const double r      = distance(frame, index_[i], index_[j]);
+                const double weight = gsans->slength[index_[i]]*gsans->slength[index_[j]];
+                const size_t bin    = static_cast<size_t>(r/binwidth);
+                ASSERT_LT(bin, reference.size());
+                reference[bin] += weight;
+                sum            += weight;
+            }
+        }
+    }
+    sfree(gsans->slength);
+    sfree(gsans);
+    for (int i = 0; i < gnsf->nratoms; ++i)
+    {
+        sfree(gnsf->atomnm[i]);
+    }
+    sfree(gnsf->atomnm);
+    sfree(gnsf->p);
+    sfree(gnsf->n);
+    sfree(gnsf->slength);
+    sfree(gnsf);
+
+    for (size_t bin = 0; bin < reference.size(); ++bin)
+    {
+        EXPECT_REAL_EQ_TOL(binwidth*(bin + 0.5), pr[0][bin], gmx::test::absoluteTolerance(1e-6));
+        // Pairs at a bin edge can go into either bin.
+        EXPECT_REAL_EQ_TOL(reference[bin]/sum, pr[1][bin], gmx::test::absoluteTolerance(1e-5))
+        << "r = " << pr[0][bin];
+    }
+}
+
+TEST_F(GmxScattering, SansFrameOutputDoesNotChangeResult)
+{
+    std::vector<std::vector<double> > pr, sq, prFrames, sqFrames;
+    runSans(false, &pr, &sq);
+    runSans(true, &prFrames, &sqFrames);
+
+    ASSERT_EQ(2U, pr.size());
+    ASSERT_EQ(2U, sq.size());
+    ASSERT_EQ(pr.size(), prFrames.size());
+    ASSERT_EQ(sq.size(), sqFrames.size());
+    for (size_t c = 0; c < pr.size(); ++c)
+    {
+        ASSERT_EQ(pr[c].size(), prFrames[c].size());
+        for (size_t i = 0; i < pr[c].size(); ++i)
+        {
+            EXPECT_REAL_EQ_TOL(pr[c][i], prFrames[c][i], gmx::test::absoluteTolerance(2e-6));
+        }
+        ASSERT_EQ(sq[c].size(), sqFrames[c].size());
+        for (size_t i = 0; i < sq[c].size(); ++i)
+        {
+            EXPECT_REAL_EQ_TOL(sq[c][i], sqFrames[c][i], gmx::test::absoluteTolerance(2e-6));
+        }
+    }
+}
+
+} // namespace
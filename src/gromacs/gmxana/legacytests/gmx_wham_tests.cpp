@@ -0,0 +1,230 @@
+/*
+ * This file is part of the GROMACS molecular simulation package.
+ *
+ * Copyright (c) 2017, by the GROMACS development team, led by
+ * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
+ * and including many others, as listed in the AUTHORS file in the
+ * top-level source directory and at http://www.gromacs.org.
+ *
+ * GROMACS is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ *
+ * GROMACS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GROMACS; if not, see
+ * http://www.gnu.org/licenses, or write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA.
+ *
+ * If you want to redistribute modifications to GROMACS, please
+ * consider that scientific software is very special. Version
+ * control is crucial - bugs must be traceable. We will be happy to
+ * consider code for inclusion in the official distribution, but
+ * derived work must not be called official GROMACS. Details are found
+ * in the README & COPYING files - if they are missing, get the
+ * official version at http://www.gromacs.org.
+ *
+ * To help us fund GROMACS development, we humbly ask that you cite
+ * the research papers on the package. Check out http://www.gromacs.org.
+ */
+/*! \internal \file
+ * \brief
+ * Tests for gmx wham
+ */
+
+#include "gmxpre.h"
+
+#include <cmath>
+
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "gromacs/gmxana/gmx_ana.h"
+#include "gromacs/utility/gmxomp.h"
+#include "gromacs/utility/stringutil.h"
+#include "gromacs/utility/textreader.h"
+#include "gromacs/utility/textwriter.h"
+
+#include "testutils/cmdlinetest.h"
+#include "testutils/integrationtests.h"
+#include "testutils/testasserts.h"
+
+namespace
+{
+
+class GmxWham : public gmx::test::IntegrationTestFixture
+{
+    public:
+        //! Writes a pdo file for a window with the umbrella at \p position.
+        std::string writePdoFile(const char *name, double position)
+        {
+            std::string     fileName = fileManager_.getTemporaryFilePath(name);
+            gmx::TextWriter writer(fileName);
+            writer.writeLine("# UMBRELLA      3.0");
+            writer.writeLine("# Component selection: 0 0 1");
+            writer.writeLine("# nSkip 1");
+            writer.writeLine("# Ref. Group 'Reference'");
+            writer.writeLine("# Nr. of pull groups 1");
+            writer.writeLine(gmx::formatString("# Group 1 'Pulled'  Umb. Pos. %g Umb. Cons. 1000", position));
+            writer.writeLine("#####");
+            // Deterministic displacements that roughly cover the width of
+            // the umbrella potential.
+            for (int i = 0; i < 2000; ++i)
+            {
+                const double dx = 0.1*std::sin(1.3*i) + 0.05*std::sin(0.37*i);
+                writer.writeLine(gmx::formatString("%g %g", 0.1*i, dx));
+            }
+            writer.close();
+            return fileName;
+        }
+
+        /*! \brief
+         * Runs gmx wham on the given pdo files and returns the profile.
+         *
+         * \p extraArgs are appended to the command line.
+         */
+        std::vector<double> runWham(const std::vector<std::string> &pdoFiles,
+                                    const std::vector<std::string> &extraArgs
+                                        = std::vector<std::string>())
+        {
+            std::string     listFileName = fileManager_.getTemporaryFilePath("pdo-files.dat");
+            gmx::TextWriter listWriter(listFileName);
+            for (const std::string &fileName : pdoFiles)
+            {
+                listWriter.writeLine(fileName);
+            }
+            listWriter.close();
+
+            std::string            profileFileName = fileManager_.getTemporaryFilePath("profile.xvg");
+            gmx::test::CommandLine caller;
+            caller.append("wham");
+            caller.addOption("-ip", listFileName);
+            caller.addOption("-o", profileFileName);
+            caller.addOption("-hist", fileManager_.getTemporaryFilePath("histo.xvg"));
+            caller.addOption("-min", "0.1");
+            caller.addOption("-max", "0.9");
+            caller.addOption("-bins", "40");
+            for (const std::string &arg : extraArgs)
+            {
+                caller.append(arg);
+            }
+            EXPECT_EQ(0, gmx_wham(caller.argc(), caller.argv()));
+
+            return readXvgColumn(profileFileName, 1);
+        }
+
+        //! Returns column \p column of the data in xvg file \p fileName.
+        std::vector<double> readXvgColumn(const std::string &fileName, int column)
+        {
+            std::vector<double> values;
+            gmx::TextReader     reader(fileName);
+            std::string         line;
+            while (reader.readLine(&line))
+            {
+                if (line.empty() || line[0] == '#' || line[0] == '@')
+                {
+                    continue;
+                }
+                std::istringstream stream(line);
+                double             value = 0;
+                for (int i = 0; i <= column; ++i)
+                {
+                    stream >> value;
+                }
+                values.push_back(value);
+            }
+            return values;
+        }
+
+        //! Writes the pdo files for three overlapping windows.
+        std::vector<std::string> writeOverlappingWindows()
+        {
+            std::vector<std::string> pdoFiles;
+            pdoFiles.push_back(writePdoFile("window1.pdo", 0.25));
+            pdoFiles.push_back(writePdoFile("window2.pdo", 0.5));
+            pdoFiles.push_back(writePdoFile("window3.pdo", 0.75));
+            return pdoFiles;
+        }
+};
+
+TEST_F(GmxWham, HandlesWindowOutsideHistogramRange)
+{
+    std::vector<std::string>  pdoFiles  = writeOverlappingWindows();
+    const std::vector<double> reference = runWham(pdoFiles);
+
+    // A window far outside -min and -max has no data in the histogram
+    // range, and its free energy offset becomes large enough for exp(z)
+    // to overflow.  It should not change the profile.
+    pdoFiles.push_back(writePdoFile("window4.pdo", 3.0));
+    const std::vector<double> profile = runWham(pdoFiles);
+
+    ASSERT_EQ(reference.size(), profile.size());
+    ASSERT_FALSE(profile.empty());
+    for (size_t i = 0; i < profile.size(); ++i)
+    {
+        EXPECT_TRUE(std::isfinite(profile[i]));
+        EXPECT_REAL_EQ_TOL(reference[i], profile[i], gmx::test::absoluteTolerance(1e-4));
+    }
+}
+
+TEST_F(GmxWham, DiisMatchesPlainIteration)
+{
+    const std::vector<std::string> pdoFiles  = writeOverlappingWindows();
+    const std::vector<double>      reference = runWham(pdoFiles, { "-tol", "1e-8" });
+    const std::vector<double>      profile   =
+        runWham(pdoFiles, { "-tol", "1e-8", "-diis", "5" });
+
+    ASSERT_EQ(reference.size(), profile.size());
+    ASSERT_FALSE(profile.empty());
+    for (size_t i = 0; i < profile.size(); ++i)
+    {
+        EXPECT_REAL_EQ_TOL(reference[i], profile[i], gmx::test::absoluteTolerance(1e-3));
+    }
+}
+
+TEST_F(GmxWham, BootstrapDoesNotDependOnThreadCount)
+{
+    const std::vector<std::string> pdoFiles   = writeOverlappingWindows();
+    const std::string              bsFileName = fileManager_.getTemporaryFilePath("bsResult.xvg");
+    const std::vector<std::string> bsArgs     = {
+        "-nBootstrap", "4", "-bs-seed", "1234", "-bsres", bsFileName,
+        "-bsprof", fileManager_.getTemporaryFilePath("bsProfs.xvg")
+    };
+    const int                      maxThreads = gmx_omp_get_max_threads();
+
+    gmx_omp_set_num_threads(1);
+    runWham(pdoFiles, bsArgs);
+    const std::vector<double> referenceAverage = readXvgColumn(bsFileName, 1);
+    const std::vector<double> referenceError   = readXvgColumn(bsFileName, 2);
+
+    gmx_omp_set_num_threads(4);
+    runWham(pdoFiles, bsArgs);
+    const std::vector<double> average = readXvgColumn(bsFileName, 1);
+    const std::vector<double> error   = readXvgColumn(bsFileName, 2);
+    gmx_omp_set_num_threads(maxThreads);
+
+    ASSERT_EQ(referenceAverage.size(), average.size());
+    ASSERT_EQ(referenceError.size(), error.size());
+    ASSERT_FALSE(average.empty());
+    for (size_t i = 0; i < average.size(); ++i)
+    {
+        EXPECT_REAL_EQ_TOL(referenceAverage[i], average[i], gmx::test::absoluteTolerance(1e-6));
+        EXPECT_REAL_EQ_TOL(referenceError[i], error[i], gmx::test::absoluteTolerance(1e-6));
+    }
+    // The bootstraps should actually differ from each other.
+    double maxError = 0;
+    for (double value : referenceError)
+    {
+        maxError = std::max(maxError, value);
+    }
+    EXPECT_GT(maxError, 0.0);
+}
+
+} // namespace
@@ -39,11 +39,16 @@
 #include "config.h"
 
 #include <cmath>
+#include <cstdint>
 #include <cstring>
 
+#include <algorithm>
+
 #include "gromacs/math/vec.h"
 #include "gromacs/random/threefry.h"
 #include "gromacs/random/uniformintdistribution.h"
+#include "gromacs/simd/simd.h"
+#include "gromacs/simd/simd_math.h"
 #include "gromacs/topology/topology.h"
 #include "gromacs/utility/cstringutil.h"
 #include "gromacs/utility/exceptions.h"
@@ -189,6 +194,326 @@ gmx_sans_t *gmx_sans_init (const t_topology *top, gmx_neutron_atomic_structurefa
     return gsans;
 }
 
+struct gmx_debye_histogram_t
+{
+    double  binwidth; /* bin size */
+    int     ntype;    /* number of atom types */
+    int     npair;    /* number of type pairs, ntype*(ntype+1)/2 */
+    int     nbin;     /* number of bins per type pair */
+    double *h;        /* npair histograms of nbin bins each */
+    int     nframes;  /* number of frames added */
+};
+
+namespace
+{
+
+/* Number of atoms in a tile of the pair loop, a multiple of the SIMD width.
+ * Three coordinate arrays of a tile pair stay in the L1 cache.
+ */
+const int c_debyeTileSize = 512;
+
+int debye_pair_index(int ntype, int t1, int t2)
+{
+    if (t1 > t2)
+    {
+        std::swap(t1, t2);
+    }
+    return t1*ntype - (t1*(t1 - 1))/2 + t2 - t1;
+}
+
+void debye_histogram_resize(gmx_debye_histogram_t *dh, int nbin)
+{
+    double *h;
+    int     p, b;
+
+    snew(h, dh->npair*nbin);
+    for (p = 0; p < dh->npair; p++)
+    {
+        for (b = 0; b < dh->nbin; b++)
+        {
+            h[p*nbin + b] = dh->h[p*dh->nbin + b];
+        }
+    }
+    sfree(dh->h);
+    dh->h    = h;
+    dh->nbin = nbin;
+}
+
+/* Bins the pairs of atoms i in [i0,i1) and j in [j0,j1) with j > i.
+ * The coordinates are stored as padded, aligned SoA arrays and j0 is
+ * a multiple of the SIMD width. pairOffset[t1*ntype+t2] is the offset of
+ * the histogram of the types t1 and t2 in h.
+ */
+void debye_bin_tile_pair(const real *xs, const real *ys, const real *zs,
+                         const int *ts, const double *ws,
+                         const int *pairOffset, int ntype, int nbin, real invBinwidth,
+                         int i0, int i1, int j0, int j1, double *h)
+{
+    for (int i = i0; i < i1; i++)
+    {
+        const int     jStart  = std::max(j0, i + 1);
+        const double  wi      = ws[i];
+        const int    *pairRow = pairOffset + ts[i]*ntype;
+#if GMX_SIMD_HAVE_REAL
+        using namespace gmx;
+
+        GMX_ALIGNED(std::int32_t, GMX_SIMD_REAL_WIDTH) bin[GMX_SIMD_REAL_WIDTH];
+        const SimdReal xi(xs[i]);
+        const SimdReal yi(ys[i]);
+        const SimdReal zi(zs[i]);
+        const SimdReal invBw(invBinwidth);
+        const SimdReal lastBin(static_cast<real>(nbin - 1));
+
+        for (int jb = (jStart/GMX_SIMD_REAL_WIDTH)*GMX_SIMD_REAL_WIDTH; jb < j1; jb += GMX_SIMD_REAL_WIDTH)
+        {
+            SimdReal xj = load(xs + jb);
+            SimdReal yj = load(ys + jb);
+            SimdReal zj = load(zs + jb);
+            SimdReal dx = xi - xj;
+            SimdReal dy = yi - yj;
+            SimdReal dz = zi - zj;
+            SimdReal r2 = fma(dx, dx, fma(dy, dy, dz*dz));
+            /* Clamping in floating point guards against rounding beyond the
+             * last bin, which is sized from the extent of the group.
+             */
+            store(bin, cvttR2I(min(sqrt(r2)*invBw, lastBin)));
+
+            const int lStart = std::max(jStart - jb, 0);
+            const int lEnd   = std::min(j1 - jb, GMX_SIMD_REAL_WIDTH);
+            for (int l = lStart; l < lEnd; l++)
+            {
+                h[pairRow[ts[jb + l]] + bin[l]] += wi*ws[jb + l];
+            }
+        }
+#else
+        for (int j = jStart; j < j1; j++)
+        {
+            real dx  = xs[i] - xs[j];
+            real dy  = ys[i] - ys[j];
+            real dz  = zs[i] - zs[j];
+            int  bin = static_cast<int>(std::min(std::sqrt(dx*dx + dy*dy + dz*dz)*invBinwidth,
+                                                 static_cast<real>(nbin - 1)));
+            h[pairRow[ts[j]] + bin] += wi*ws[j];
+        }
+#endif
+    }
+}
+
+}   // namespace
+
+gmx_debye_histogram_t *gmx_debye_histogram_init(double binwidth, int ntype)
+{
+    gmx_debye_histogram_t *dh;
+
+    snew(dh, 1);
+    dh->binwidth = binwidth;
+    dh->ntype    = ntype;
+    dh->npair    = ntype*(ntype + 1)/2;
+    dh->nbin     = 0;
+    dh->h        = NULL;
+    dh->nframes  = 0;
+
+    return dh;
+}
+
+void gmx_debye_histogram_add_frame(gmx_debye_histogram_t *dh, const rvec *x, const matrix box,
+                                   const int *index, int isize,
+                                   const int *type, const double *weight)
+{
+    real    *xs, *ys, *zs;
+    int     *ts, *pairOffset, *tileI, *tileJ;
+    double  *ws, **th;
+    rvec     dist, xmin, xmax;
+    int      npad, ntile, nwork, nbin, nthreads;
+    int      i, j, t, d;
+
+    /* Copy the group to padded SoA arrays and find its extent */
+    npad = ((isize + c_debyeTileSize - 1)/c_debyeTileSize)*c_debyeTileSize;
+    snew_aligned(xs, npad, 64);
+    snew_aligned(ys, npad, 64);
+    snew_aligned(zs, npad, 64);
+    snew(ts, npad);
+    snew(ws, npad);
+    clear_rvec(xmin);
+    clear_rvec(xmax);
+    for (i = 0; i < isize; i++)
+    {
+        const int a = index[i];
+        xs[i] = x[a][XX];
+        ys[i] = x[a][YY];
+        zs[i] = x[a][ZZ];
+        ts[i] = (type != NULL) ? type[a] : 0;
+        ws[i] = (weight != NULL) ? weight[a] : 1.0;
+        for (d = 0; d < DIM; d++)
+        {
+            xmin[d] = (i == 0) ? x[a][d] : std::min(xmin[d], x[a][d]);
+            xmax[d] = (i == 0) ? x[a][d] : std::max(xmax[d], x[a][d]);
+        }
+    }
+
+    /* The bins cover the box diagonal, as well as the extent of the group
+     * in case it sticks out of the box.
+     */
+    rvec_add(box[XX], box[YY], dist);
+    rvec_add(box[ZZ], dist, dist);
+    nbin = static_cast<int>(std::floor(norm(dist)/dh->binwidth) + 1);
+    rvec_sub(xmax, xmin, dist);
+    nbin = std::max(nbin, static_cast<int>(std::floor(norm(dist)/dh->binwidth) + 1));
+    if (nbin > dh->nbin)
+    {
+        debye_histogram_resize(dh, nbin);
+    }
+
+    snew(pairOffset, dh->ntype*dh->ntype);
+    for (i = 0; i < dh->ntype; i++)
+    {
+        for (j = 0; j < dh->ntype; j++)
+        {
+            pairOffset[i*dh->ntype + j] = debye_pair_index(dh->ntype, i, j)*dh->nbin;
+        }
+    }
+
+    /* All pairs of tiles, including each tile with itself */
+    ntile = npad/c_debyeTileSize;
+    nwork = ntile*(ntile + 1)/2;
+    snew(tileI, nwork);
+    snew(tileJ, nwork);
+    t = 0;
+    for (i = 0; i < ntile; i++)
+    {
+        for (j = i; j < ntile; j++)
+        {
+            tileI[t] = i;
+            tileJ[t] = j;
+            t++;
+        }
+    }
+
+    /* Thread 0 adds to the histogram itself, the others to their own */
+    nthreads = std::max(1, std::min(gmx_omp_get_max_threads(), nwork));
+    snew(th, nthreads);
+    th[0] = dh->h;
+    for (t = 1; t < nthreads; t++)
+    {
+        snew(th[t], dh->npair*dh->nbin);
+    }
+
+#pragma omp parallel for num_threads(nthreads) schedule(dynamic)
+    for (int w = 0; w < nwork; w++)
+    {
+        try
+        {
+            const int i0 = tileI[w]*c_debyeTileSize;
+            const int j0 = tileJ[w]*c_debyeTileSize;
+            debye_bin_tile_pair(xs, ys, zs, ts, ws, pairOffset, dh->ntype, dh->nbin,
+                                static_cast<real>(1.0/dh->binwidth),
+                                i0, std::min(i0 + c_debyeTileSize, isize),
+                                j0, std::min(j0 + c_debyeTileSize, isize),
+                                th[gmx_omp_get_thread_num()]);
+        }
+        GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR;
+    }
+
+    for (t = 1; t < nthreads; t++)
+    {
+        for (i = 0; i < dh->npair*dh->nbin; i++)
+        {
+            dh->h[i] += th[t][i];
+        }
+        sfree(th[t]);
+    }
+    sfree(th);
+    dh->nframes++;
+
+    sfree(tileI);
+    sfree(tileJ);
+    sfree(pairOffset);
+    sfree(ws);
+    sfree(ts);
+    sfree_aligned(zs);
+    sfree_aligned(ys);
+    sfree_aligned(xs);
+}
+
+void gmx_debye_histogram_add_histogram(gmx_debye_histogram_t *dh, const gmx_debye_histogram_t *src)
+{
+    int p, b;
+
+    if (src->ntype != dh->ntype || src->binwidth != dh->binwidth)
+    {
+        gmx_incons("Adding Debye histograms with different types or bins");
+    }
+    if (src->nbin > dh->nbin)
+    {
+        debye_histogram_resize(dh, src->nbin);
+    }
+    for (p = 0; p < dh->npair; p++)
+    {
+        for (b = 0; b < src->nbin; b++)
+        {
+            dh->h[p*dh->nbin + b] += src->h[p*src->nbin + b];
+        }
+    }
+    dh->nframes += src->nframes;
+}
+
+int gmx_debye_histogram_nbin(const gmx_debye_histogram_t *dh)
+{
+    return dh->nbin;
+}
+
+int gmx_debye_histogram_nframes(const gmx_debye_histogram_t *dh)
+{
+    return dh->nframes;
+}
+
+const double *gmx_debye_histogram_get(const gmx_debye_histogram_t *dh, int type1, int type2)
+{
+    return dh->h + debye_pair_index(dh->ntype, type1, type2)*dh->nbin;
+}
+
+gmx_radial_distribution_histogram_t *gmx_debye_histogram_to_radial_distribution(const gmx_debye_histogram_t *dh)
+{
+    gmx_radial_distribution_histogram_t *pr;
+    int                                  p, i;
+
+    snew(pr, 1);
+    pr->binwidth = dh->binwidth;
+    pr->grn      = dh->nbin;
+    snew(pr->gr, pr->grn);
+    snew(pr->r, pr->grn);
+    for (p = 0; p < dh->npair; p++)
+    {
+        for (i = 0; i < pr->grn; i++)
+        {
+            pr->gr[i] += dh->h[p*dh->nbin + i];
+        }
+    }
+    for (i = 0; i < pr->grn; i++)
+    {
+        pr->r[i] = (pr->binwidth*i+pr->binwidth*0.5);
+    }
+
+    return pr;
+}
+
+void gmx_debye_histogram_reset(gmx_debye_histogram_t *dh)
+{
+    int i;
+
+    for (i = 0; i < dh->npair*dh->nbin; i++)
+    {
+        dh->h[i] = 0;
+    }
+    dh->nframes = 0;
+}
+
+void gmx_debye_histogram_done(gmx_debye_histogram_t *dh)
+{
+    sfree(dh->h);
+    sfree(dh);
+}
+
 gmx_radial_distribution_histogram_t *calc_radial_distribution_histogram (
         gmx_sans_t  *gsans,
         rvec        *x,
@@ -302,54 +627,13 @@ gmx_radial_distribution_histogram_t *calc_radial_distribution_histogram (
     }
     else
     {
-#if GMX_OPENMP
-        nthreads = gmx_omp_get_max_threads();
-        /* Allocating memory for tgr arrays */
-        snew(tgr, nthreads);
-        for (i = 0; i < nthreads; i++)
-        {
-            snew(tgr[i], pr->grn);
-        }
-        #pragma omp parallel shared(tgr) private(tid,i,j)
-        {
-            tid = gmx_omp_get_thread_num();
-            /* starting parallel threads */
-            #pragma omp for
-            for (i = 0; i < isize; i++)
-            {
-                try
-                {
-                    for (j = 0; j < i; j++)
-                    {
-                        tgr[tid][static_cast<int>(std::floor(std::sqrt(distance2(x[index[i]], x[index[j]]))/binwidth))] += gsans->slength[index[i]]*gsans->slength[index[j]];
-                    }
-                }
-                GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR;
-            }
-        }
-        /* collecating data for pr->gr */
-        for (i = 0; i < pr->grn; i++)
-        {
-            for (j = 0; j < nthreads; j++)
-            {
-                pr->gr[i] += tgr[j][i];
-            }
-        }
-        /* freeing memory for tgr */
-        for (i = 0; i < nthreads; i++)
-        {
-            sfree(tgr[i]);
-        }
-        sfree(tgr);
-#else
-        for (i = 0; i < isize; i++)
-        {
-            for (j = 0; j < i; j++)
-            {
-                pr->gr[static_cast<int>(std::floor(std::sqrt(distance2(x[index[i]], x[index[j]]))/binwidth))] += gsans->slength[index[i]]*gsans->slength[index[j]];
-            }
-        }
-#endif
+        /* the direct sum bins all pairs with the tiled pair histogram */
+        gmx_debye_histogram_t *dh = gmx_debye_histogram_init(binwidth, 1);
+        gmx_debye_histogram_add_frame(dh, x, box, index, isize, NULL, gsans->slength);
+        pr->grn = gmx_debye_histogram_nbin(dh);
+        srenew(pr->gr, pr->grn);
+        std::copy(gmx_debye_histogram_get(dh, 0, 0), gmx_debye_histogram_get(dh, 0, 0) + pr->grn, pr->gr);
+        gmx_debye_histogram_done(dh);
     }
 
     /* normalize if needed */
@@ -68,6 +68,13 @@ typedef struct gmx_static_structurefactor_t {
     double   qstep; /* q increment */
 } gmx_static_structurefactor_t;
 
+/* Pair-distance histograms for the Debye formula, kept separately for
+ * every pair of atom types and accumulated over any number of frames.
+ * The histogram grows when a frame has pairs further apart than the
+ * current number of bins covers, so frames may differ in size.
+ */
+typedef struct gmx_debye_histogram_t gmx_debye_histogram_t;
+
 void check_binwidth(real binwidth);
 
 void check_mcover(real mcover);
@@ -91,5 +98,35 @@ gmx_radial_distribution_histogram_t *calc_radial_distribution_histogram  (gmx_sa
 
 gmx_static_structurefactor_t *convert_histogram_to_intensity_curve (gmx_radial_distribution_histogram_t *pr, double start_q, double end_q, double q_step);
 
+gmx_debye_histogram_t *gmx_debye_histogram_init(double binwidth, int ntype);
+/* Set up an empty histogram with bins of binwidth for ntype atom types */
+
+void gmx_debye_histogram_add_frame(gmx_debye_histogram_t *dh, const rvec *x, const matrix box,
+                                   const int *index, int isize,
+                                   const int *type, const double *weight);
+/* Bin all isize*(isize-1)/2 pair distances of the atoms in index, adding
+ * weight[i]*weight[j] to the histogram of the type pair of i and j.
+ * type and weight are indexed by atom number like x; NULL type puts all
+ * atoms in type 0 and NULL weight uses a weight of 1. No periodic images
+ * are considered. Uses as many OpenMP threads as gmx_omp_get_max_threads().
+ */
+
+void gmx_debye_histogram_add_histogram(gmx_debye_histogram_t *dh, const gmx_debye_histogram_t *src);
+/* Add the bins and frame count of src, with the same binwidth and types, to dh */
+
+int gmx_debye_histogram_nbin(const gmx_debye_histogram_t *dh);
+
+int gmx_debye_histogram_nframes(const gmx_debye_histogram_t *dh);
+
+const double *gmx_debye_histogram_get(const gmx_debye_histogram_t *dh, int type1, int type2);
+/* Return the nbin bins for the pair of type1 and type2, in either order */
+
+gmx_radial_distribution_histogram_t *gmx_debye_histogram_to_radial_distribution(const gmx_debye_histogram_t *dh);
+/* Return the sum over all type pairs as an unnormalized histogram */
+
+void gmx_debye_histogram_reset(gmx_debye_histogram_t *dh);
+
+void gmx_debye_histogram_done(gmx_debye_histogram_t *dh);
+
 
 #endif
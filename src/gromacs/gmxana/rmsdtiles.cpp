@@ -0,0 +1,220 @@
+/*
+ * This file is part of the GROMACS molecular simulation package.
+ *
+ * Copyright (c) 2017, by the GROMACS development team, led by
+ * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
+ * and including many others, as listed in the AUTHORS file in the
+ * top-level source directory and at http://www.gromacs.org.
+ *
+ * GROMACS is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ *
+ * GROMACS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GROMACS; if not, see
+ * http://www.gnu.org/licenses, or write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA.
+ *
+ * If you want to redistribute modifications to GROMACS, please
+ * consider that scientific software is very special. Version
+ * control is crucial - bugs must be traceable. We will be happy to
+ * consider code for inclusion in the official distribution, but
+ * derived work must not be called official GROMACS. Details are found
+ * in the README & COPYING files - if they are missing, get the
+ * official version at http://www.gromacs.org.
+ *
+ * To help us fund GROMACS development, we humbly ask that you cite
+ * the research papers on the package. Check out http://www.gromacs.org.
+ */
+#include "gmxpre.h"
+
+#include "rmsdtiles.h"
+
+#include <cstring>
+
+#include <algorithm>
+
+#include "gromacs/math/functions.h"
+#include "gromacs/utility/cstringutil.h"
+#include "gromacs/utility/fatalerror.h"
+#include "gromacs/utility/futil.h"
+#include "gromacs/utility/smalloc.h"
+
+/* Number of values in a tile */
+static const int c_tileSize = GMX_RMSD_TILE*GMX_RMSD_TILE;
+
+/* Return the position in the file of tile (ti,tj), ti <= tj */
+static gmx_off_t tile_offset(const gmx_rmsd_tiles_t *rt, int ti, int tj)
+{
+    gmx_off_t ntile = rt->ntile;
+    gmx_off_t index = ti*ntile - (static_cast<gmx_off_t>(ti)*(ti - 1))/2 + (tj - ti);
+
+    return index*c_tileSize*static_cast<gmx_off_t>(sizeof(real));
+}
+
+static void seek_tiles(gmx_rmsd_tiles_t *rt, gmx_off_t offset)
+{
+    if (gmx_fseek(rt->fp, offset, SEEK_SET) != 0)
+    {
+        gmx_fatal(FARGS, "Could not seek in the RMSD matrix file %s", rt->fn);
+    }
+}
+
+gmx_rmsd_tiles_t *gmx_rmsd_tiles_init(const char *fn, int nn)
+{
+    gmx_rmsd_tiles_t *rt;
+    int               r;
+
+    snew(rt, 1);
+    rt->fn     = gmx_strdup(fn);
+    rt->fp     = gmx_ffopen(fn, "w+b");
+    rt->nn     = nn;
+    rt->ntile  = (nn + GMX_RMSD_TILE - 1)/GMX_RMSD_TILE;
+    rt->band   = 0;
+    rt->minrms = 1e20;
+    rt->maxrms = 0;
+    rt->sumrms = 0;
+    rt->energy = 0;
+    /* A band of tiles and a band of rows take the same memory */
+    snew(rt->buf, static_cast<size_t>(rt->ntile)*c_tileSize);
+    snew(rt->tile, c_tileSize);
+    snew(rt->row, GMX_RMSD_TILE);
+    for (r = 0; r < GMX_RMSD_TILE; r++)
+    {
+        rt->row[r] = rt->buf + static_cast<size_t>(r)*rt->ntile*GMX_RMSD_TILE;
+    }
+
+    return rt;
+}
+
+void gmx_rmsd_tiles_write_band(gmx_rmsd_tiles_t *rt)
+{
+    int    i0, i1, i, j, r;
+    size_t nvalue;
+    real  *diag, val;
+
+    if (rt->band >= rt->ntile)
+    {
+        gmx_incons("All bands of the RMSD matrix have been written");
+    }
+    i0 = rt->band*GMX_RMSD_TILE;
+    i1 = std::min(rt->nn, i0 + GMX_RMSD_TILE);
+
+    /* Only the values above the diagonal have been stored, complete the
+     * diagonal tile so reading a band does not need to treat it specially.
+     */
+    diag = rt->buf;
+    for (r = 0; r < GMX_RMSD_TILE; r++)
+    {
+        diag[r*GMX_RMSD_TILE + r] = 0;
+        for (j = 0; j < r; j++)
+        {
+            diag[r*GMX_RMSD_TILE + j] = diag[j*GMX_RMSD_TILE + r];
+        }
+    }
+
+    /* Accumulate the statistics in the same order as set_mat_entry()
+     * on the full matrix.
+     */
+    for (i = i0; i < i1; i++)
+    {
+        for (j = i + 1; j < rt->nn; j++)
+        {
+            val        = *gmx_rmsd_tiles_entry(rt, i, j);
+            rt->maxrms = std::max(rt->maxrms, val);
+            rt->minrms = std::min(rt->minrms, val);
+            rt->sumrms = rt->sumrms + val;
+            if (j == i + 1)
+            {
+                rt->energy += gmx::square(val);
+            }
+        }
+    }
+
+    nvalue = static_cast<size_t>(rt->ntile - rt->band)*c_tileSize;
+    seek_tiles(rt, tile_offset(rt, rt->band, rt->band));
+    if (fwrite(rt->buf, sizeof(real), nvalue, rt->fp) != nvalue)
+    {
+        gmx_fatal(FARGS, "Could not write to the RMSD matrix file %s", rt->fn);
+    }
+    std::memset(rt->buf, 0, nvalue*sizeof(real));
+    rt->band++;
+}
+
+/* Read tile (ti,tj), ti <= tj, into rt->tile */
+static void read_tile(gmx_rmsd_tiles_t *rt, int ti, int tj)
+{
+    seek_tiles(rt, tile_offset(rt, ti, tj));
+    if (fread(rt->tile, sizeof(real), c_tileSize, rt->fp) != static_cast<size_t>(c_tileSize))
+    {
+        gmx_fatal(FARGS, "Could not read from the RMSD matrix file %s", rt->fn);
+    }
+}
+
+void gmx_rmsd_tiles_read_band(gmx_rmsd_tiles_t *rt, int band)
+{
+    int tj, r, c;
+
+    if (rt->band < rt->ntile)
+    {
+        gmx_incons("Reading an RMSD matrix band before all bands have been written");
+    }
+    for (tj = 0; tj < rt->ntile; tj++)
+    {
+        /* Tiles below the diagonal are stored transposed above it */
+        if (tj < band)
+        {
+            read_tile(rt, tj, band);
+            for (r = 0; r < GMX_RMSD_TILE; r++)
+            {
+                for (c = 0; c < GMX_RMSD_TILE; c++)
+                {
+                    rt->row[r][tj*GMX_RMSD_TILE + c] = rt->tile[c*GMX_RMSD_TILE + r];
+                }
+            }
+        }
+        else
+        {
+            read_tile(rt, band, tj);
+            for (r = 0; r < GMX_RMSD_TILE; r++)
+            {
+                std::memcpy(rt->row[r] + tj*GMX_RMSD_TILE, rt->tile + r*GMX_RMSD_TILE,
+                            GMX_RMSD_TILE*sizeof(real));
+            }
+        }
+    }
+}
+
+real gmx_rmsd_tiles_get(gmx_rmsd_tiles_t *rt, int i, int j)
+{
+    real val;
+
+    if (i > j)
+    {
+        std::swap(i, j);
+    }
+    seek_tiles(rt, tile_offset(rt, i >> GMX_RMSD_TILE_SHIFT, j >> GMX_RMSD_TILE_SHIFT)
+               + ((i & (GMX_RMSD_TILE - 1))*GMX_RMSD_TILE + (j & (GMX_RMSD_TILE - 1)))*sizeof(real));
+    if (fread(&val, sizeof(real), 1, rt->fp) != 1)
+    {
+        gmx_fatal(FARGS, "Could not read from the RMSD matrix file %s", rt->fn);
+    }
+
+    return val;
+}
+
+void gmx_rmsd_tiles_done(gmx_rmsd_tiles_t *rt)
+{
+    gmx_ffclose(rt->fp);
+    sfree(rt->fn);
+    sfree(rt->row);
+    sfree(rt->tile);
+    sfree(rt->buf);
+    sfree(rt);
+}
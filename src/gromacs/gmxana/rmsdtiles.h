@@ -0,0 +1,98 @@
+/*
+ * This file is part of the GROMACS molecular simulation package.
+ *
+ * Copyright (c) 2017, by the GROMACS development team, led by
+ * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
+ * and including many others, as listed in the AUTHORS file in the
+ * top-level source directory and at http://www.gromacs.org.
+ *
+ * GROMACS is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ *
+ * GROMACS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GROMACS; if not, see
+ * http://www.gnu.org/licenses, or write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA.
+ *
+ * If you want to redistribute modifications to GROMACS, please
+ * consider that scientific software is very special. Version
+ * control is crucial - bugs must be traceable. We will be happy to
+ * consider code for inclusion in the official distribution, but
+ * derived work must not be called official GROMACS. Details are found
+ * in the README & COPYING files - if they are missing, get the
+ * official version at http://www.gromacs.org.
+ *
+ * To help us fund GROMACS development, we humbly ask that you cite
+ * the research papers on the package. Check out http://www.gromacs.org.
+ */
+#ifndef GMX_GMXANA_RMSDTILES_H
+#define GMX_GMXANA_RMSDTILES_H
+
+#include <cstdio>
+
+#include "gromacs/utility/basedefinitions.h"
+#include "gromacs/utility/real.h"
+
+/* Number of rows and columns of a tile of the RMSD matrix */
+#define GMX_RMSD_TILE_SHIFT 6
+#define GMX_RMSD_TILE       (1 << GMX_RMSD_TILE_SHIFT)
+
+/* Symmetric nn*nn RMSD matrix stored in a file, for matrices that do not
+ * fit in memory. The matrix is split in tiles of GMX_RMSD_TILE rows and
+ * columns, of which only those on and above the diagonal are stored,
+ * each tile contiguously. The matrix is written one band of
+ * GMX_RMSD_TILE rows at a time, in order, after which bands of rows can
+ * be read back in any order. Only a single band is kept in memory.
+ */
+typedef struct gmx_rmsd_tiles_t {
+    char    *fn;       /* name of the file */
+    FILE    *fp;       /* the file */
+    int      nn;       /* number of structures */
+    int      ntile;    /* number of tiles along a row */
+    int      band;     /* band that is being written */
+    real     minrms;   /* minimum off-diagonal value written */
+    real     maxrms;   /* maximum value written */
+    real     sumrms;   /* sum of the values above the diagonal */
+    real     energy;   /* sum of the squares of the values next to the diagonal */
+    real    *buf;      /* tiles of the band being written or rows of the band read */
+    real    *tile;     /* a single tile for reading */
+    real   **row;      /* rows of the band read with gmx_rmsd_tiles_read_band() */
+} gmx_rmsd_tiles_t;
+
+gmx_rmsd_tiles_t *gmx_rmsd_tiles_init(const char *fn, int nn);
+/* Create the file fn for an nn*nn matrix */
+
+static inline real *gmx_rmsd_tiles_entry(gmx_rmsd_tiles_t *rt, int i, int j)
+/* Return where to store the value for structures i < j,
+ * with i in the band that is being written
+ */
+{
+    return rt->buf + ((((j >> GMX_RMSD_TILE_SHIFT) - rt->band) << (2*GMX_RMSD_TILE_SHIFT))
+                      + ((i & (GMX_RMSD_TILE - 1)) << GMX_RMSD_TILE_SHIFT)
+                      + (j & (GMX_RMSD_TILE - 1)));
+}
+
+void gmx_rmsd_tiles_write_band(gmx_rmsd_tiles_t *rt);
+/* Write the values stored for the current band to the file and
+ * continue with the next band
+ */
+
+void gmx_rmsd_tiles_read_band(gmx_rmsd_tiles_t *rt, int band);
+/* Read rows band*GMX_RMSD_TILE up to (band+1)*GMX_RMSD_TILE of the
+ * matrix, or up to nn, into rt->row. All bands should have been written.
+ */
+
+real gmx_rmsd_tiles_get(gmx_rmsd_tiles_t *rt, int i, int j);
+/* Read the single value for structures i and j from the file */
+
+void gmx_rmsd_tiles_done(gmx_rmsd_tiles_t *rt);
+/* Close the file and free rt */
+
+#endif
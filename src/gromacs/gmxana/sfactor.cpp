@@ -46,6 +46,7 @@
 #include "gromacs/fileio/confio.h"
 #include "gromacs/fileio/trxio.h"
 #include "gromacs/fileio/xvgr.h"
+#include "gromacs/gmxana/nsfactor.h"
 #include "gromacs/math/functions.h"
 #include "gromacs/math/utilities.h"
 #include "gromacs/math/vec.h"
@@ -552,6 +553,165 @@ extern int do_scattering_intensity (const char* fnTPS, const char* fnNDX,
 }
 
 
+extern int do_debye_scattering_intensity (const char* fnTPS, const char* fnNDX,
+                                          const char* fnXVG, const char *fnTRX,
+                                          const char* fnDAT,
+                                          real start_q, real end_q, real q_step,
+                                          real binwidth, real energy, int ng,
+                                          const gmx_output_env_t *oenv)
+{
+    int                     i, j, g, t, u, b, *isize, flags = TRX_READ_X;
+    t_trxstatus            *status;
+    char                  **grpname;
+    int                   **index;
+    t_topology              top;
+    int                     ePBC;
+    t_trxframe              fr;
+    rvec                   *xtop;
+    matrix                  box;
+    int                    *atype, *typemap, *sftype, ntype, NCMT, **count, nq, nbin;
+    gmx_debye_histogram_t **dh;
+    double                  hc = 1239.842, momentum, lambda;
+    double                  q, A, polarization_factor, intensity, *f, *sinc;
+    FILE                   *fp;
+
+    gmx_structurefactors_t *gmx_sf = gmx_structurefactors_init(fnDAT);
+    NCMT = ((gmx_structurefactors *)gmx_sf)->nratoms;
+
+    /* Read the topology informations */
+    read_tps_conf (fnTPS, &top, &ePBC, &xtop, NULL, box, TRUE);
+    sfree (xtop);
+
+    /* groups stuff... */
+    snew (isize, ng);
+    snew (index, ng);
+    snew (grpname, ng);
+
+    fprintf (stderr, "\nSelect %d group%s\n", ng,
+             ng == 1 ? "" : "s");
+    get_index (&top.atoms, fnNDX, ng, isize, index, grpname);
+
+    /* Only the atom types present in the groups get a histogram,
+     * numbered in the order they are found.
+     */
+    snew(atype, top.atoms.nr);
+    snew(typemap, NCMT + 3);
+    snew(sftype, NCMT + 3);
+    for (t = 0; t < NCMT + 3; t++)
+    {
+        typemap[t] = -1;
+    }
+    ntype = 0;
+    for (g = 0; g < ng; g++)
+    {
+        for (i = 0; i < isize[g]; i++)
+        {
+            t = return_atom_type(*(top.atoms.atomname[index[g][i]]), gmx_sf);
+            if (typemap[t] < 0)
+            {
+                typemap[t]      = ntype;
+                sftype[ntype++] = t;
+            }
+            atype[index[g][i]] = typemap[t];
+        }
+    }
+    snew(count, ng);
+    snew(dh, ng);
+    for (g = 0; g < ng; g++)
+    {
+        snew(count[g], ntype);
+        for (i = 0; i < isize[g]; i++)
+        {
+            count[g][atype[index[g][i]]]++;
+        }
+        dh[g] = gmx_debye_histogram_init(binwidth, ntype);
+    }
+
+    read_first_frame (oenv, &status, fnTRX, &fr, flags);
+    do
+    {
+        for (g = 0; g < ng; g++)
+        {
+            gmx_debye_histogram_add_frame(dh[g], fr.x, fr.box, index[g], isize[g], atype, NULL);
+        }
+    }
+    while (read_next_frame (oenv, status, &fr));
+    close_trj(status);
+
+    /* \hbar \omega \lambda = hc = 1239.842 eV * nm */
+    momentum = (static_cast<double>(2. * 1000.0 * M_PI * energy) / hc);
+    lambda   = hc / (1000.0 * energy);
+    fprintf (stderr, "\nwavelenght = %f nm\n", lambda);
+
+    /*
+     * I(q) = SUM_i f_i(q)^2 + 2 SUM_i<j f_i(q) f_j(q) sin(q r_ij)/(q r_ij)
+     * with the pairs binned by distance for every pair of atom types.
+     */
+    fp = xvgropen (fnXVG, "Scattering Intensity", "q (1/nm)",
+                   "Intensity (a.u.)", oenv);
+    nq = static_cast<int>(std::floor((end_q - start_q)/q_step + 0.5)) + 1;
+    snew(f, ntype);
+    for (i = 0; i < nq; i++)
+    {
+        q = start_q + i*q_step;
+        /* theta is half the angle between incoming and scattered wavevectors */
+        A = q / (2.0 * momentum);
+        for (t = 0; t < ntype; t++)
+        {
+            f[t] = CMSF(gmx_sf, sftype[t], sftype[t] < NCMT ? 0 : sftype[t] - NCMT + 1, lambda, A);
+        }
+        polarization_factor = 1 - 2.0 * gmx::square(A) * (1 - gmx::square(A));
+
+        fprintf (fp, "%10.5f  ", q);
+        for (g = 0; g < ng; g++)
+        {
+            nbin = gmx_debye_histogram_nbin(dh[g]);
+            snew(sinc, nbin);
+            for (b = 0; b < nbin; b++)
+            {
+                double qr = q*binwidth*(b + 0.5);
+                sinc[b]   = (qr > 0) ? std::sin(qr)/qr : 1.0;
+            }
+            intensity = 0;
+            for (t = 0; t < ntype; t++)
+            {
+                intensity += count[g][t]*gmx::square(f[t]);
+                for (u = t; u < ntype; u++)
+                {
+                    const double *h     = gmx_debye_histogram_get(dh[g], t, u);
+                    double        cross = 0;
+                    for (j = 0; j < nbin; j++)
+                    {
+                        cross += h[j]*sinc[j];
+                    }
+                    intensity += 2*f[t]*f[u]*cross/gmx_debye_histogram_nframes(dh[g]);
+                }
+            }
+            sfree(sinc);
+            fprintf (fp, "  %10.5f ", intensity*polarization_factor/fr.natoms);
+        }
+        fprintf (fp, "\n");
+    }
+    xvgrclose (fp);
+
+    for (g = 0; g < ng; g++)
+    {
+        gmx_debye_histogram_done(dh[g]);
+        sfree(count[g]);
+    }
+    sfree(dh);
+    sfree(count);
+    sfree(f);
+    sfree(sftype);
+    sfree(typemap);
+    sfree(atype);
+
+    gmx_structurefactors_done(gmx_sf);
+
+    return 0;
+}
+
+
 extern void save_data (structure_factor_t *sft, const char *file, int ngrps,
                        real start_q, real end_q, const gmx_output_env_t *oenv)
 {
@@ -82,6 +82,13 @@ int do_scattering_intensity (const char* fnTPS, const char* fnNDX,
                              real start_q, real end_q,
                              real energy, int ng, const gmx_output_env_t *oenv);
 
+int do_debye_scattering_intensity (const char* fnTPS, const char* fnNDX,
+                                   const char* fnXVG, const char *fnTRX,
+                                   const char* fnDAT,
+                                   real start_q, real end_q, real q_step,
+                                   real binwidth, real energy, int ng,
+                                   const gmx_output_env_t *oenv);
+
 t_complex *** rc_tensor_allocation(int x, int y, int z);
 
 real **compute_scattering_factor_table (gmx_structurefactors_t *gsf, structure_factor_t * sft);
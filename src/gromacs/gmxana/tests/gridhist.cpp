@@ -0,0 +1,231 @@
+/*
+ * This file is part of the GROMACS molecular simulation package.
+ *
+ * Copyright (c) 2017, by the GROMACS development team, led by
+ * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
+ * and including many others, as listed in the AUTHORS file in the
+ * top-level source directory and at http://www.gromacs.org.
+ *
+ * GROMACS is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ *
+ * GROMACS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GROMACS; if not, see
+ * http://www.gnu.org/licenses, or write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA.
+ *
+ * If you want to redistribute modifications to GROMACS, please
+ * consider that scientific software is very special. Version
+ * control is crucial - bugs must be traceable. We will be happy to
+ * consider code for inclusion in the official distribution, but
+ * derived work must not be called official GROMACS. Details are found
+ * in the README & COPYING files - if they are missing, get the
+ * official version at http://www.gromacs.org.
+ *
+ * To help us fund GROMACS development, we humbly ask that you cite
+ * the research papers on the package. Check out http://www.gromacs.org.
+ */
+/*! \internal \file
+ * \brief
+ * Tests for the per-thread grid histograms and frame batches in gridhist.
+ */
+#include "gmxpre.h"
+
+#include "gromacs/gmxana/gridhist.h"
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "gromacs/math/vec.h"
+#include "gromacs/math/vectypes.h"
+#include "gromacs/utility/smalloc.h"
+
+namespace
+{
+
+//! Grid dimensions used in the histogram tests.
+const int c_n[DIM] = { 13, 17, 11 };
+
+//! Returns the cell hit by sample \p i.
+void sampleCell(int i, int *ix, int *iy, int *iz)
+{
+    *ix = (7*i) % c_n[XX];
+    *iy = (3*i + i/5) % c_n[YY];
+    // Only use half of the grid along z, so a sparse grid has empty blocks.
+    *iz = (i*i) % (c_n[ZZ]/2);
+}
+
+//! Returns the weight of sample \p i, exact in double so the sums are too.
+double sampleWeight(int i)
+{
+    return 1 + i % 4;
+}
+
+/*! \brief
+ * Bins \p nsamples samples on the grids of \p nthreads threads with the given storage
+ * and returns the reduced grid.
+ */
+std::vector<double> binSamples(int nsamples, int nthreads, bool bSparse)
+{
+    gmx_grid_histogram_t *gh =
+        gmx_grid_histogram_init(c_n[XX], c_n[YY], c_n[ZZ], bSparse, nthreads);
+    EXPECT_EQ(c_n[XX]*c_n[YY]*c_n[ZZ], gh->ncell);
+    EXPECT_EQ(nthreads, gh->nthreads);
+
+    // Spread the samples over the thread grids like a dynamic schedule would.
+    for (int i = 0; i < nsamples; i++)
+    {
+        int ix, iy, iz;
+        sampleCell(i, &ix, &iy, &iz);
+        gmx_grid_histogram_add(gh, (i/7) % nthreads, ix, iy, iz, sampleWeight(i));
+    }
+
+    // The reduction adds to what is already in the output.
+    std::vector<double> sum(gh->ncell, 0.5);
+    gmx_grid_histogram_reduce(gh, sum.data());
+    gmx_grid_histogram_done(gh);
+    for (double &value : sum)
+    {
+        value -= 0.5;
+    }
+    return sum;
+}
+
+//! Returns the grid filled by a plain serial loop over the samples.
+std::vector<double> referenceGrid(int nsamples)
+{
+    std::vector<double> grid(c_n[XX]*c_n[YY]*c_n[ZZ], 0.0);
+    for (int i = 0; i < nsamples; i++)
+    {
+        int ix, iy, iz;
+        sampleCell(i, &ix, &iy, &iz);
+        grid[(ix*c_n[YY] + iy)*c_n[ZZ] + iz] += sampleWeight(i);
+    }
+    return grid;
+}
+
+TEST(GridHistogramTest, ReducesThreadGrids)
+{
+    const int                 nsamples  = 5000;
+    const std::vector<double> reference = referenceGrid(nsamples);
+    for (int nthreads : { 1, 3 })
+    {
+        for (bool bSparse : { false, true })
+        {
+            SCOPED_TRACE(bSparse ? "sparse" : "dense");
+            SCOPED_TRACE(nthreads);
+            EXPECT_EQ(reference, binSamples(nsamples, nthreads, bSparse));
+        }
+    }
+}
+
+TEST(GridHistogramTest, SparseGridOnlyAllocatesBlocksThatAreHit)
+{
+    const int             ncell = c_n[XX]*c_n[YY]*c_n[ZZ];
+    gmx_grid_histogram_t *gh    =
+        gmx_grid_histogram_init(c_n[XX], c_n[YY], c_n[ZZ], TRUE, 2);
+    ASSERT_EQ((ncell + GMX_GRIDHIST_BLOCK_SIZE - 1)/GMX_GRIDHIST_BLOCK_SIZE, gh->nblock);
+    for (int t = 0; t < 2; t++)
+    {
+        for (int b = 0; b < gh->nblock; b++)
+        {
+            EXPECT_TRUE(gh->block[t][b] == NULL);
+        }
+    }
+
+    // One cell in the first block on thread 0 and one in the last block,
+    // including the very last cell, on thread 1.
+    gmx_grid_histogram_add(gh, 0, 0, 1, 2, 1.5);
+    gmx_grid_histogram_add(gh, 1, c_n[XX] - 1, c_n[YY] - 1, c_n[ZZ] - 1, 2.5);
+    gmx_grid_histogram_add(gh, 1, c_n[XX] - 1, c_n[YY] - 1, c_n[ZZ] - 1, 1.0);
+    for (int b = 0; b < gh->nblock; b++)
+    {
+        EXPECT_EQ(b == 0, gh->block[0][b] != NULL) << "block " << b;
+        EXPECT_EQ(b == gh->nblock - 1, gh->block[1][b] != NULL) << "block " << b;
+    }
+
+    std::vector<double> sum(ncell, 0.0);
+    gmx_grid_histogram_reduce(gh, sum.data());
+    gmx_grid_histogram_done(gh);
+    for (int c = 0; c < ncell; c++)
+    {
+        const double expected = (c == 1*c_n[ZZ] + 2 ? 1.5 : (c == ncell - 1 ? 3.5 : 0.0));
+        EXPECT_EQ(expected, sum[c]) << "cell " << c;
+    }
+}
+
+TEST(FrameBatchTest, StoresOnlyGroupAtoms)
+{
+    const int natoms   = 10;
+    int       group1[] = { 7, 2, 5 };
+    int       group2[] = { 5, 9 };
+    int       gnx[]    = { 3, 2, 0 };
+    int      *index[]  = { group1, group2, NULL };
+
+    gmx_frame_batch_t *fb = gmx_frame_batch_init(natoms, 3, gnx, index, 2);
+    EXPECT_EQ(natoms, fb->natoms);
+    // The atoms are stored in input order, atoms in several groups once.
+    ASSERT_EQ(4, fb->nstored);
+    const int storedAtoms[] = { 2, 5, 7, 9 };
+    for (int i = 0; i < fb->nstored; i++)
+    {
+        EXPECT_EQ(storedAtoms[i], fb->atom[i]);
+    }
+    EXPECT_EQ(2, fb->nalloc);
+
+    int *local1 = gmx_frame_batch_local_index(fb, gnx[0], group1);
+    int *local2 = gmx_frame_batch_local_index(fb, gnx[1], group2);
+
+    rvec   x[natoms];
+    matrix box;
+    clear_mat(box);
+    box[XX][XX] = box[YY][YY] = box[ZZ][ZZ] = 3;
+    for (int f = 0; f < 2; f++)
+    {
+        for (int i = 0; i < natoms; i++)
+        {
+            x[i][XX] = i;
+            x[i][YY] = f;
+            x[i][ZZ] = -i;
+        }
+        EXPECT_EQ(f == 1, gmx_frame_batch_add(fb, x, box, 0.5*f));
+    }
+    ASSERT_EQ(2, fb->nframes);
+    for (int f = 0; f < 2; f++)
+    {
+        EXPECT_EQ(0.5*f, fb->t[f]);
+        EXPECT_EQ(3, fb->box[f][ZZ][ZZ]);
+        for (int i = 0; i < gnx[0]; i++)
+        {
+            EXPECT_EQ(group1[i], fb->x[f][local1[i]][XX]);
+            EXPECT_EQ(f, fb->x[f][local1[i]][YY]);
+        }
+        for (int i = 0; i < gnx[1]; i++)
+        {
+            EXPECT_EQ(-group2[i], fb->x[f][local2[i]][ZZ]);
+        }
+    }
+    sfree(local1);
+    sfree(local2);
+    gmx_frame_batch_done(fb);
+}
+
+TEST(FrameBatchTest, HoldsAtLeastOneFrame)
+{
+    int                group[] = { 0 };
+    int                gnx     = 1;
+    int               *index   = group;
+    gmx_frame_batch_t *fb      = gmx_frame_batch_init(1, 1, &gnx, &index, 0);
+    EXPECT_EQ(1, fb->nalloc);
+    gmx_frame_batch_done(fb);
+}
+
+} // namespace
@@ -0,0 +1,255 @@
+/*
+ * This file is part of the GROMACS molecular simulation package.
+ *
+ * Copyright (c) 2017, by the GROMACS development team, led by
+ * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
+ * and including many others, as listed in the AUTHORS file in the
+ * top-level source directory and at http://www.gromacs.org.
+ *
+ * GROMACS is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ *
+ * GROMACS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GROMACS; if not, see
+ * http://www.gnu.org/licenses, or write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA.
+ *
+ * If you want to redistribute modifications to GROMACS, please
+ * consider that scientific software is very special. Version
+ * control is crucial - bugs must be traceable. We will be happy to
+ * consider code for inclusion in the official distribution, but
+ * derived work must not be called official GROMACS. Details are found
+ * in the README & COPYING files - if they are missing, get the
+ * official version at http://www.gromacs.org.
+ *
+ * To help us fund GROMACS development, we humbly ask that you cite
+ * the research papers on the package. Check out http://www.gromacs.org.
+ */
+/*! \internal \file
+ * \brief
+ * Tests for the Debye pair-distance histograms in nsfactor.
+ *
+ * The histograms are compared against a plain loop over all pairs.
+ */
+#include "gmxpre.h"
+
+#include "gromacs/gmxana/nsfactor.h"
+
+#include <cmath>
+
+#include <algorithm>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "gromacs/math/vec.h"
+#include "gromacs/math/vectypes.h"
+#include "gromacs/utility/gmxomp.h"
+
+#include "testutils/testasserts.h"
+
+namespace
+{
+
+//! Number of atom types in the test system.
+const int    c_ntype    = 3;
+//! Width of the histogram bins.
+const double c_binwidth = 0.01;
+/*! \brief
+ * Distance from a bin edge within which a pair may go in either bin.
+ *
+ * The histogram computes the distances in real precision.
+ */
+const double c_edgeTolerance = 1e-4;
+
+//! Atom positions, types and weights of a test frame.
+class DebyeTestFrame
+{
+    public:
+        //! Scatters \p natoms atoms in and around a cubic box of size \p boxSize.
+        DebyeTestFrame(int natoms, real boxSize, int seed)
+            : x_(natoms), type_(natoms), weight_(natoms)
+        {
+            clear_mat(box_);
+            for (int d = 0; d < DIM; ++d)
+            {
+                box_[d][d] = boxSize;
+            }
+            for (int a = 0; a < natoms; ++a)
+            {
+                for (int d = 0; d < DIM; ++d)
+                {
+                    const double hash = 43758.5453*std::sin(12.9898*a + 78.233*d + 3.1*seed);
+                    x_[a][d] = boxSize*(1.2*(hash - std::floor(hash)) - 0.1);
+                }
+                type_[a]   = a % c_ntype;
+                weight_[a] = 0.5 + 0.3*(a % 5);
+            }
+            // Leave out some atoms so that the group size is not a multiple
+            // of the SIMD width or the tile size.
+            for (int a = 0; a < natoms; ++a)
+            {
+                if (a % 7 != 3)
+                {
+                    index_.push_back(a);
+                }
+            }
+        }
+
+        //! Adds the frame to \p dh.
+        void addTo(gmx_debye_histogram_t *dh) const
+        {
+            gmx_debye_histogram_add_frame(dh, as_rvec_array(x_.data()), box_,
+                                          index_.data(), index_.size(),
+                                          type_.data(), weight_.data());
+        }
+
+        std::vector<gmx::RVec> x_;
+        matrix                 box_;
+        std::vector<int>       index_;
+        std::vector<int>       type_;
+        std::vector<double>    weight_;
+};
+
+/*! \brief
+ * Bins the pairs of the frames with a plain double loop.
+ *
+ * Pairs close to a bin edge are not binned, but their weight is added to
+ * \p allowance for both bins.
+ */
+void binAllPairs(const std::vector<DebyeTestFrame> &frames, int nbin,
+                 std::vector<double> *reference, std::vector<double> *allowance)
+{
+    reference->assign(c_ntype*c_ntype*nbin, 0.0);
+    allowance->assign(c_ntype*c_ntype*nbin, 0.0);
+    for (const DebyeTestFrame &frame : frames)
+    {
+        const std::vector<int> &index = frame.index_;
+        for (size_t i = 0; i < index.size(); ++i)
+        {
+            for (size_t j = i + 1; j < index.size(); ++j)
+            {
+                const int    a      = index[i];
+                const int    b      = index[j];
+                double       r2     = 0;
+                for (int d = 0; d < DIM; ++d)
+                {
+                    const double dx = frame.x_[a][d] - frame.x_[b][d];
+                    r2 += dx*dx;
+                }
+                const double r      = std::sqrt(r2)/c_binwidth;
+                const int    bin    = std::min(static_cast<int>(r), nbin - 1);
+                const int    t1     = std::min(frame.type_[a], frame.type_[b]);
+                const int    t2     = std::max(frame.type_[a], frame.type_[b]);
+                const int    offset = (t1*c_ntype + t2)*nbin;
+                const double weight = frame.weight_[a]*frame.weight_[b];
+                const double eps    = c_edgeTolerance/c_binwidth;
+                if (bin > 0 && r - bin < eps)
+                {
+                    (*allowance)[offset + bin - 1] += weight;
+                    (*allowance)[offset + bin]     += weight;
+                }
+                else if (bin < nbin - 1 && bin + 1 - r < eps)
+                {
+                    (*allowance)[offset + bin]     += weight;
+                    (*allowance)[offset + bin + 1] += weight;
+                }
+                else
+                {
+                    (*reference)[offset + bin] += weight;
+                }
+            }
+        }
+    }
+}
+
+//! Checks the histograms in \p dh against a plain loop over the pairs in \p frames.
+void checkAgainstAllPairs(const gmx_debye_histogram_t         *dh,
+                          const std::vector<DebyeTestFrame>   &frames)
+{
+    const int           nbin = gmx_debye_histogram_nbin(dh);
+    std::vector<double> reference, allowance;
+    binAllPairs(frames, nbin, &reference, &allowance);
+
+    EXPECT_EQ(static_cast<int>(frames.size()), gmx_debye_histogram_nframes(dh));
+    for (int t1 = 0; t1 < c_ntype; ++t1)
+    {
+        for (int t2 = t1; t2 < c_ntype; ++t2)
+        {
+            const double *h          = gmx_debye_histogram_get(dh, t1, t2);
+            const double *hSwapped   = gmx_debye_histogram_get(dh, t2, t1);
+            const int     offset     = (t1*c_ntype + t2)*nbin;
+            double        sum        = 0;
+            double        sumRef     = 0;
+            for (int b = 0; b < nbin; ++b)
+            {
+                const double ref = reference[offset + b];
+                EXPECT_EQ(h[b], hSwapped[b]);
+                EXPECT_GE(h[b], ref - 1e-9*(ref + 1))
+                << "types " << t1 << " and " << t2 << ", bin " << b;
+                EXPECT_LE(h[b], ref + allowance[offset + b] + 1e-9*(ref + 1))
+                << "types " << t1 << " and " << t2 << ", bin " << b;
+                sum    += h[b];
+                sumRef += ref + 0.5*allowance[offset + b];
+            }
+            EXPECT_REAL_EQ_TOL(sumRef, sum, gmx::test::relativeToleranceAsFloatingPoint(sumRef, 1e-9));
+            EXPECT_GT(sum, 0.0);
+        }
+    }
+}
+
+TEST(DebyeHistogramTest, MatchesAllPairsWithDifferentThreadCounts)
+{
+    // The second frame is larger, so the histogram grows.
+    std::vector<DebyeTestFrame> frames;
+    frames.push_back(DebyeTestFrame(1300, 2.5, 1));
+    frames.push_back(DebyeTestFrame(1300, 3.0, 2));
+    ASSERT_NE(0U, frames[0].index_.size() % 64);
+    ASSERT_NE(0U, frames[0].index_.size() % 512);
+
+    const int maxThreads = gmx_omp_get_max_threads();
+    for (int nthreads : { 1, 3 })
+    {
+        SCOPED_TRACE(nthreads);
+        gmx_omp_set_num_threads(nthreads);
+        gmx_debye_histogram_t *dh = gmx_debye_histogram_init(c_binwidth, c_ntype);
+        frames[0].addTo(dh);
+        const int              nbinFirst = gmx_debye_histogram_nbin(dh);
+        frames[1].addTo(dh);
+        EXPECT_GT(gmx_debye_histogram_nbin(dh), nbinFirst);
+        checkAgainstAllPairs(dh, frames);
+        gmx_debye_histogram_done(dh);
+    }
+    gmx_omp_set_num_threads(maxThreads);
+}
+
+TEST(DebyeHistogramTest, AddsHistograms)
+{
+    std::vector<DebyeTestFrame> frames;
+    frames.push_back(DebyeTestFrame(700, 2.0, 3));
+    frames.push_back(DebyeTestFrame(700, 2.0, 4));
+
+    gmx_debye_histogram_t *dh    = gmx_debye_histogram_init(c_binwidth, c_ntype);
+    gmx_debye_histogram_t *other = gmx_debye_histogram_init(c_binwidth, c_ntype);
+    frames[0].addTo(dh);
+    frames[1].addTo(other);
+    gmx_debye_histogram_add_histogram(dh, other);
+    checkAgainstAllPairs(dh, frames);
+
+    gmx_debye_histogram_reset(dh);
+    EXPECT_EQ(0, gmx_debye_histogram_nframes(dh));
+    frames[1].addTo(dh);
+    checkAgainstAllPairs(dh, std::vector<DebyeTestFrame>(1, frames[1]));
+
+    gmx_debye_histogram_done(other);
+    gmx_debye_histogram_done(dh);
+}
+
+} // namespace
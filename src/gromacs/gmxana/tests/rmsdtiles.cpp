@@ -0,0 +1,115 @@
+/*
+ * This file is part of the GROMACS molecular simulation package.
+ *
+ * Copyright (c) 2017, by the GROMACS development team, led by
+ * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
+ * and including many others, as listed in the AUTHORS file in the
+ * top-level source directory and at http://www.gromacs.org.
+ *
+ * GROMACS is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ *
+ * GROMACS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GROMACS; if not, see
+ * http://www.gnu.org/licenses, or write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA.
+ *
+ * If you want to redistribute modifications to GROMACS, please
+ * consider that scientific software is very special. Version
+ * control is crucial - bugs must be traceable. We will be happy to
+ * consider code for inclusion in the official distribution, but
+ * derived work must not be called official GROMACS. Details are found
+ * in the README & COPYING files - if they are missing, get the
+ * official version at http://www.gromacs.org.
+ *
+ * To help us fund GROMACS development, we humbly ask that you cite
+ * the research papers on the package. Check out http://www.gromacs.org.
+ */
+/*! \internal \file
+ * \brief
+ * Tests for the RMSD matrix stored in tiles in rmsdtiles.
+ */
+#include "gmxpre.h"
+
+#include "gromacs/gmxana/rmsdtiles.h"
+
+#include <cmath>
+
+#include <algorithm>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "testutils/testfilemanager.h"
+
+namespace
+{
+
+//! Returns the test value for structures i < j.
+real matrixValue(int i, int j)
+{
+    return 1 + 0.5*std::sin(0.1*i + 0.37*j);
+}
+
+TEST(RmsdTilesTest, ReadsBackWrittenMatrix)
+{
+    gmx::test::TestFileManager fileManager;
+    std::string                fileName = fileManager.getTemporaryFilePath("tiles.dat");
+    // Not a multiple of the tile size, so the last band is partial.
+    const int                  nn       = 2*GMX_RMSD_TILE + 13;
+    gmx_rmsd_tiles_t          *rt       = gmx_rmsd_tiles_init(fileName.c_str(), nn);
+    ASSERT_EQ(3, rt->ntile);
+
+    real minrms = 1e20, maxrms = 0, sumrms = 0, energy = 0;
+    for (int band = 0; band < rt->ntile; band++)
+    {
+        EXPECT_EQ(band, rt->band);
+        for (int i = band*GMX_RMSD_TILE; i < std::min(nn, (band + 1)*GMX_RMSD_TILE); i++)
+        {
+            for (int j = i + 1; j < nn; j++)
+            {
+                *gmx_rmsd_tiles_entry(rt, i, j) = matrixValue(i, j);
+                minrms  = std::min(minrms, matrixValue(i, j));
+                maxrms  = std::max(maxrms, matrixValue(i, j));
+                sumrms += matrixValue(i, j);
+                if (j == i + 1)
+                {
+                    energy += matrixValue(i, j)*matrixValue(i, j);
+                }
+            }
+        }
+        gmx_rmsd_tiles_write_band(rt);
+    }
+    EXPECT_EQ(minrms, rt->minrms);
+    EXPECT_EQ(maxrms, rt->maxrms);
+    EXPECT_EQ(sumrms, rt->sumrms);
+    EXPECT_EQ(energy, rt->energy);
+
+    // Read the bands in a different order than they were written.
+    for (int band : { 2, 0, 1 })
+    {
+        gmx_rmsd_tiles_read_band(rt, band);
+        for (int i = band*GMX_RMSD_TILE; i < std::min(nn, (band + 1)*GMX_RMSD_TILE); i++)
+        {
+            const real *row = rt->row[i - band*GMX_RMSD_TILE];
+            for (int j = 0; j < nn; j++)
+            {
+                const real expected = (i == j ? 0 : matrixValue(std::min(i, j), std::max(i, j)));
+                EXPECT_EQ(expected, row[j]) << "row " << i << ", column " << j;
+            }
+        }
+    }
+    EXPECT_EQ(matrixValue(5, 140), gmx_rmsd_tiles_get(rt, 140, 5));
+    EXPECT_EQ(matrixValue(70, 71), gmx_rmsd_tiles_get(rt, 70, 71));
+    EXPECT_EQ(0, gmx_rmsd_tiles_get(rt, 3, 3));
+    gmx_rmsd_tiles_done(rt);
+}
+
+} // namespace
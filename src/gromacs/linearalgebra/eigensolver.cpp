@@ -38,8 +38,12 @@
 
 #include "eigensolver.h"
 
+#include <algorithm>
+
 #include "gromacs/linearalgebra/sparsematrix.h"
+#include "gromacs/utility/basedefinitions.h"
 #include "gromacs/utility/fatalerror.h"
+#include "gromacs/utility/gmxomp.h"
 #include "gromacs/utility/real.h"
 #include "gromacs/utility/smalloc.h"
 
@@ -389,3 +393,149 @@ sparse_eigensolver(gmx_sparsematrix_t *    A,
     sfree(workl);
     sfree(select);
 }
+
+
+/*! \brief Multiply the dense symmetric n*n matrix \p a with \p x into \p y.
+ *
+ * The rows are independent, so they are distributed over the threads.
+ */
+static void
+dense_matrix_vector_multiply(const real *a, int n, const real *x, real *y)
+{
+    int nthreads = gmx_omp_get_max_threads();
+
+#pragma omp parallel for num_threads(nthreads) schedule(static)
+    for (int i = 0; i < n; i++)
+    {
+        const real *row = a + static_cast<gmx_int64_t>(i)*n;
+        real        sum = 0;
+        for (int j = 0; j < n; j++)
+        {
+            sum += row[j]*x[j];
+        }
+        y[i] = sum;
+    }
+}
+
+
+void
+partial_eigensolver(const real *   a,
+                    int            n,
+                    int            neig,
+                    real *         eigenvalues,
+                    real *         eigenvectors,
+                    int            maxiter)
+{
+    int      iwork[80];
+    int      iparam[11];
+    int      ipntr[11];
+    real *   resid;
+    real *   workd;
+    real *   workl;
+    real *   v;
+    int      ido, info, lworkl, i, ncv, dovec;
+    real     abstol;
+    int *    select;
+    int      iter;
+
+    if (neig < 1 || neig >= n)
+    {
+        gmx_fatal(FARGS, "Can only compute between 1 and %d eigenvalues of a %dx%d matrix iteratively, not %d",
+                  n-1, n, n, neig);
+    }
+
+    dovec = (eigenvectors != NULL) ? 1 : 0;
+
+    /* More Lanczos vectors than eigenvalues are required, a few extra
+     * ones speed up convergence when only few eigenvalues are requested.
+     */
+    ncv = std::max(2*neig, neig+20);
+    if (ncv > n)
+    {
+        ncv = n;
+    }
+
+    for (i = 0; i < 11; i++)
+    {
+        iparam[i] = ipntr[i] = 0;
+    }
+
+    iparam[0] = 1;       /* Don't use explicit shifts */
+    iparam[2] = maxiter; /* Max number of iterations */
+    iparam[6] = 1;       /* Standard symmetric eigenproblem */
+
+    lworkl = ncv*(8+ncv);
+    snew(resid, n);
+    snew(workd, (3*n+4));
+    snew(workl, lworkl);
+    snew(select, ncv);
+    snew(v, static_cast<gmx_int64_t>(n)*ncv);
+
+    /* Use machine tolerance - roughly 1e-16 in double precision */
+    abstol = 0;
+
+    ido = info = 0;
+    fprintf(stderr, "Calculation Ritz values and Lanczos vectors, max %d iterations...\n", maxiter);
+
+    iter = 1;
+    do
+    {
+#if GMX_DOUBLE
+        F77_FUNC(dsaupd, DSAUPD) (&ido, "I", &n, "LA", &neig, &abstol,
+                                  resid, &ncv, v, &n, iparam, ipntr,
+                                  workd, iwork, workl, &lworkl, &info);
+#else
+        F77_FUNC(ssaupd, SSAUPD) (&ido, "I", &n, "LA", &neig, &abstol,
+                                  resid, &ncv, v, &n, iparam, ipntr,
+                                  workd, iwork, workl, &lworkl, &info);
+#endif
+        if (ido == -1 || ido == 1)
+        {
+            dense_matrix_vector_multiply(a, n, workd+ipntr[0]-1, workd+ipntr[1]-1);
+        }
+
+        fprintf(stderr, "\rIteration %4d: %3d out of %3d Ritz values converged.", iter++, iparam[4], neig);
+        fflush(stderr);
+    }
+    while (info == 0 && (ido == -1 || ido == 1));
+
+    fprintf(stderr, "\n");
+    if (info == 1)
+    {
+        gmx_fatal(FARGS,
+                  "Maximum number of iterations (%d) reached in Arnoldi\n"
+                  "diagonalization, but only %d of %d eigenvectors converged.\n",
+                  maxiter, iparam[4], neig);
+    }
+    else if (info != 0)
+    {
+        gmx_fatal(FARGS, "Unspecified error from Arnoldi diagonalization:%d\n", info);
+    }
+
+    info = 0;
+    /* Extract eigenvalues and vectors from data */
+    fprintf(stderr, "Calculating eigenvalues and eigenvectors...\n");
+
+#if GMX_DOUBLE
+    F77_FUNC(dseupd, DSEUPD) (&dovec, "A", select, eigenvalues, eigenvectors,
+                              &n, NULL, "I", &n, "LA", &neig, &abstol,
+                              resid, &ncv, v, &n, iparam, ipntr,
+                              workd, workl, &lworkl, &info);
+#else
+    F77_FUNC(sseupd, SSEUPD) (&dovec, "A", select, eigenvalues, eigenvectors,
+                              &n, NULL, "I", &n, "LA", &neig, &abstol,
+                              resid, &ncv, v, &n, iparam, ipntr,
+                              workd, workl, &lworkl, &info);
+#endif
+
+    sfree(v);
+    sfree(resid);
+    sfree(workd);
+    sfree(workl);
+    sfree(select);
+
+    if (info != 0)
+    {
+        gmx_fatal(FARGS, "Unspecified error from Arnoldi eigenvector extraction:%d\n", info);
+    }
+}
@@ -75,6 +75,34 @@ eigensolver(real *   a,
 
 
 
+/*! \brief Iterative eigensolver for the largest eigenvalues of a dense symmetric matrix.
+ *
+ *  This routine uses the implicitly restarted Lanczos method in ARPACK,
+ *  which only needs (threaded) matrix-vector products. When only a few
+ *  eigenvectors of a large matrix are needed, this is much faster than
+ *  the full diagonalization in eigensolver().
+ *
+ *  \param a            Pointer to the symmetric matrix data, total size n*n.
+ *                      The matrix is not changed.
+ *  \param n            Side of the matrix.
+ *  \param neig         Number of largest eigenvalues to determine, must be
+ *                      smaller than n.
+ *  \param eigenvalues  Array of length neig with the eigenvalues sorted
+ *                      in ascending order on return.
+ *  \param eigenvec     If this pointer is non-NULL, the eigenvectors
+ *                      are returned as rows of a matrix, i.e. eigenvector
+ *                      j starts at offset j*n, and is of length n.
+ *  \param maxiter      Maximum number of Arnoldi update iterations.
+ */
+void
+partial_eigensolver(const real *   a,
+                    int            n,
+                    int            neig,
+                    real *         eigenvalues,
+                    real *         eigenvec,
+                    int            maxiter);
+
+
 /*! \brief Sparse matrix eigensolver.
  *
  *  This routine is intended for large matrices that might not fit in memory.
@@ -0,0 +1,110 @@
+/*
+ * This file is part of the GROMACS molecular simulation package.
+ *
+ * Copyright (c) 2017, by the GROMACS development team, led by
+ * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
+ * and including many others, as listed in the AUTHORS file in the
+ * top-level source directory and at http://www.gromacs.org.
+ *
+ * GROMACS is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ *
+ * GROMACS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GROMACS; if not, see
+ * http://www.gnu.org/licenses, or write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA.
+ *
+ * If you want to redistribute modifications to GROMACS, please
+ * consider that scientific software is very special. Version
+ * control is crucial - bugs must be traceable. We will be happy to
+ * consider code for inclusion in the official distribution, but
+ * derived work must not be called official GROMACS. Details are found
+ * in the README & COPYING files - if they are missing, get the
+ * official version at http://www.gromacs.org.
+ *
+ * To help us fund GROMACS development, we humbly ask that you cite
+ * the research papers on the package. Check out http://www.gromacs.org.
+ */
+/*! \internal \file
+ * \brief
+ * Tests dense eigensolver routines
+ */
+#include "gmxpre.h"
+
+#include "gromacs/linearalgebra/eigensolver.h"
+
+#include <cmath>
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "testutils/testasserts.h"
+
+namespace
+{
+
+//! Returns a symmetric test matrix with well separated largest eigenvalues.
+std::vector<real> makeSymmetricMatrix(int n)
+{
+    std::vector<real> a(n*n);
+    for (int i = 0; i < n; i++)
+    {
+        for (int j = 0; j <= i; j++)
+        {
+            real value = 0.1*std::cos(0.7*i + 1.3*j);
+            if (i == j)
+            {
+                value += i;
+            }
+            a[i*n + j] = value;
+            a[j*n + i] = value;
+        }
+    }
+    return a;
+}
+
+TEST(PartialEigensolverTest, MatchesFullEigensolver)
+{
+    const int         n    = 30;
+    const int         neig = 4;
+    std::vector<real> matrix(makeSymmetricMatrix(n));
+
+    std::vector<real> partialValues(neig);
+    std::vector<real> partialVectors(neig*n);
+    partial_eigensolver(matrix.data(), n, neig, partialValues.data(),
+                        partialVectors.data(), 10000);
+    // The matrix should not be changed.
+    EXPECT_EQ(makeSymmetricMatrix(n), matrix);
+
+    std::vector<real> fullValues(n);
+    std::vector<real> fullVectors(n*n);
+    eigensolver(matrix.data(), n, 0, n, fullValues.data(), fullVectors.data());
+
+    // Both return the eigenvalues in ascending order, and the partial
+    // solver the largest ones.
+    const gmx::test::FloatingPointTolerance tolerance(
+            gmx::test::relativeToleranceAsFloatingPoint(n, 1e-5));
+    for (int i = 0; i < neig; i++)
+    {
+        const int j = n - neig + i;
+        EXPECT_REAL_EQ_TOL(fullValues[j], partialValues[i], tolerance);
+
+        // Eigenvectors are only determined up to their sign.
+        real dot = 0;
+        for (int k = 0; k < n; k++)
+        {
+            dot += fullVectors[j*n + k]*partialVectors[i*n + k];
+        }
+        EXPECT_REAL_EQ_TOL(1.0, std::abs(dot), tolerance);
+    }
+}
+
+} // namespace
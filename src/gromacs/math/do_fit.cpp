@@ -41,10 +41,18 @@
 #include <math.h>
 #include <stdio.h>
 
+#include <cmath>
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
 #include "gromacs/linearalgebra/nrjac.h"
 #include "gromacs/math/functions.h"
 #include "gromacs/math/utilities.h"
 #include "gromacs/math/vec.h"
+#include "gromacs/simd/simd.h"
+#include "gromacs/utility/alignedallocator.h"
 #include "gromacs/utility/fatalerror.h"
 #include "gromacs/utility/smalloc.h"
 
@@ -291,6 +299,469 @@ void do_fit(int natoms, real *w_rls, const rvec *xp, rvec *x)
     do_fit_ndim(3, natoms, w_rls, xp, x);
 }
 
+/* Returns the minimal weighted sum of squared deviations over all rotations,
+ * given the correlation matrix S[a][b] = sum_i w_i x_i[a] xp_i[b] and the
+ * inner products ga = sum_i w_i x_i.x_i and gb = sum_i w_i xp_i.xp_i.
+ *
+ * Quaternion characteristic polynomial (QCP) method:
+ * D. L. Theobald, Acta Cryst. A 61, 478 (2005) and
+ * P. Liu, D. K. Agrafiotis, D. L. Theobald, J. Comput. Chem. 31, 1561 (2010).
+ * The largest eigenvalue of the 4x4 quaternion key matrix built from
+ * the correlation matrix S gives the minimal sum of squared deviations.
+ */
+static double qcp_min_sqdev(const double S[DIM][DIM], double ga, double gb)
+{
+    const double Sxx = S[XX][XX], Sxy = S[XX][YY], Sxz = S[XX][ZZ];
+    const double Syx = S[YY][XX], Syy = S[YY][YY], Syz = S[YY][ZZ];
+    const double Szx = S[ZZ][XX], Szy = S[ZZ][YY], Szz = S[ZZ][ZZ];
+
+    const double Sxx2 = Sxx*Sxx, Syy2 = Syy*Syy, Szz2 = Szz*Szz;
+    const double Sxy2 = Sxy*Sxy, Syz2 = Syz*Syz, Sxz2 = Sxz*Sxz;
+    const double Syx2 = Syx*Syx, Szy2 = Szy*Szy, Szx2 = Szx*Szx;
+
+    const double SyzSzymSyySzz2       = 2*(Syz*Szy - Syy*Szz);
+    const double Sxx2Syy2Szz2Syz2Szy2 = Syy2 + Szz2 - Sxx2 + Syz2 + Szy2;
+    const double Sxy2Sxz2Syx2Szx2     = Sxy2 + Sxz2 - Syx2 - Szx2;
+
+    const double SxzpSzx = Sxz + Szx, SyzpSzy = Syz + Szy, SxypSyx = Sxy + Syx;
+    const double SyzmSzy = Syz - Szy, SxzmSzx = Sxz - Szx, SxymSyx = Sxy - Syx;
+    const double SxxpSyy = Sxx + Syy, SxxmSyy = Sxx - Syy;
+
+    /* Coefficients of the characteristic polynomial
+     * P(l) = l^4 + c2 l^2 + c1 l + c0
+     */
+    const double c2 = -2*(Sxx2 + Syy2 + Szz2 + Sxy2 + Syx2 + Sxz2 + Szx2 + Syz2 + Szy2);
+    const double c1 = 8*(Sxx*Syz*Szy + Syy*Szx*Sxz + Szz*Sxy*Syx
+                         - Sxx*Syy*Szz - Syz*Szx*Sxy - Szy*Syx*Sxz);
+    const double c0 =
+        Sxy2Sxz2Syx2Szx2*Sxy2Sxz2Syx2Szx2
+        + (Sxx2Syy2Szz2Syz2Szy2 + SyzSzymSyySzz2)*(Sxx2Syy2Szz2Syz2Szy2 - SyzSzymSyySzz2)
+        + (-SxzpSzx*SyzmSzy + SxymSyx*(SxxmSyy - Szz))*(-SxzmSzx*SyzpSzy + SxymSyx*(SxxmSyy + Szz))
+        + (-SxzpSzx*SyzpSzy - SxypSyx*(SxxpSyy - Szz))*(-SxzmSzx*SyzmSzy - SxypSyx*(SxxpSyy + Szz))
+        + (SxypSyx*SyzpSzy + SxzpSzx*(SxxmSyy + Szz))*(-SxymSyx*SyzmSzy + SxzpSzx*(SxxpSyy + Szz))
+        + (SxypSyx*SyzmSzy + SxzmSzx*(SxxmSyy - Szz))*(-SxymSyx*SyzpSzy + SxzmSzx*(SxxpSyy - Szz));
+
+    /* Newton-Raphson for the largest root, which is bounded by (ga + gb)/2 */
+    const double e0      = 0.5*(ga + gb);
+    double       lambda  = e0;
+    for (int iter = 0; iter < 50; iter++)
+    {
+        const double lambdaOld = lambda;
+        const double lambda2   = lambda*lambda;
+        const double b         = (lambda2 + c2)*lambda;
+        const double a         = b + c1;
+        const double denom     = 2*lambda2*lambda + b + a;
+        if (denom == 0)
+        {
+            break;
+        }
+        lambda -= (a*lambda + c0)/denom;
+        if (std::fabs(lambda - lambdaOld) <= 1e-11*std::fabs(lambda))
+        {
+            break;
+        }
+    }
+
+    return std::fabs(2*(e0 - lambda));
+}
+
+real rmsdev_fit(int natoms, const real *w_rls, const rvec *xp, const rvec *x)
+{
+    double S[DIM][DIM] = {{0}};
+    double ga          = 0, gb = 0, wtot = 0;
+
+    for (int i = 0; i < natoms; i++)
+    {
+        const double w = w_rls[i];
+        if (w == 0)
+        {
+            continue;
+        }
+        for (int a = 0; a < DIM; a++)
+        {
+            const double wx = w*x[i][a];
+            for (int b = 0; b < DIM; b++)
+            {
+                S[a][b] += wx*xp[i][b];
+            }
+            ga += wx*x[i][a];
+            gb += w*xp[i][a]*xp[i][a];
+        }
+        wtot += w;
+    }
+
+    return std::sqrt(qcp_min_sqdev(S, ga, gb)/wtot);
+}
+
+namespace
+{
+
+/*! \brief
+ * Number of SIMD blocks accumulated in single precision before the partial
+ * sums are added to the double precision totals.
+ */
+const int c_flushInterval = 32;
+
+//! Sums over the atoms of a structure x compared to a reference xp.
+struct FitSums
+{
+    //! Correlation matrix S[a][b] = sum_i w_i x_i[a] xp_i[b].
+    double S[DIM][DIM];
+    //! sum_i w_i x_i.x_i
+    double gx;
+    //! sum_i w_i (x_i - xp_i).(x_i - xp_i), without fitting
+    double dd;
+};
+
+/*! \brief
+ * Weighted reference structure for computing FitSums of many structures.
+ *
+ * The sums are accumulated over the deviations d_i = x_i - xp_i and
+ * combined with the reference correlation matrix, which is computed once
+ * in double precision. This avoids loss of precision for the small
+ * deviations that matter most, while the per-structure loop runs
+ * in single precision SIMD.
+ *
+ * The weighted reference is stored three times as a flat array, with the
+ * components shifted cyclically by k = 0, 1, 2. Multiplying the flat
+ * deviation array element-wise with shift k, element 3i+a contributes
+ * to D[a][(a+k) % 3]. This lets the SIMD loop run directly over rvec arrays.
+ */
+class FitReference
+{
+    public:
+        FitReference(int natoms, const real *w, const rvec *xp);
+
+        //! Computes the sums for x.
+        void sums(const rvec *x, FitSums *sums) const;
+
+        //! Returns sum_i w_i xp_i.xp_i.
+        double gxp() const { return gxp_; }
+        //! Returns the sum of the weights.
+        double wtot() const { return wtot_; }
+
+    private:
+        typedef std::vector<real, gmx::AlignedAllocator<real> > AlignedRealVector;
+
+        int               natoms_;
+        //! Number of atoms handled by the SIMD loop, the rest is done in double.
+        int               nsimd_;
+        const real       *w_;
+        const rvec       *xp_;
+        AlignedRealVector xp3_;
+        AlignedRealVector wxp_[DIM];
+        AlignedRealVector w3_;
+        //! The reference correlation matrix sum_i w_i xp_i[a] xp_i[b].
+        double            G_[DIM][DIM];
+        double            gxp_;
+        double            wtot_;
+};
+
+FitReference::FitReference(int natoms, const real *w, const rvec *xp)
+    : natoms_(natoms), nsimd_(0), w_(w), xp_(xp), gxp_(0), wtot_(0)
+{
+#if GMX_SIMD_HAVE_REAL && GMX_SIMD_HAVE_LOADU
+    nsimd_ = (natoms/GMX_SIMD_REAL_WIDTH)*GMX_SIMD_REAL_WIDTH;
+    xp3_.resize(DIM*nsimd_);
+    for (int k = 0; k < DIM; k++)
+    {
+        wxp_[k].resize(DIM*nsimd_);
+    }
+    w3_.resize(DIM*nsimd_);
+    for (int i = 0; i < nsimd_; i++)
+    {
+        for (int a = 0; a < DIM; a++)
+        {
+            xp3_[DIM*i + a] = xp[i][a];
+            for (int k = 0; k < DIM; k++)
+            {
+                wxp_[k][DIM*i + a] = w[i]*xp[i][(a + k) % DIM];
+            }
+            w3_[DIM*i + a] = w[i];
+        }
+    }
+#endif
+    for (int a = 0; a < DIM; a++)
+    {
+        for (int b = 0; b < DIM; b++)
+        {
+            G_[a][b] = 0;
+        }
+    }
+    for (int i = 0; i < natoms; i++)
+    {
+        for (int a = 0; a < DIM; a++)
+        {
+            const double wxp = static_cast<double>(w[i])*xp[i][a];
+            for (int b = 0; b < DIM; b++)
+            {
+                G_[a][b] += wxp*xp[i][b];
+            }
+        }
+        wtot_ += w[i];
+    }
+    gxp_ = G_[XX][XX] + G_[YY][YY] + G_[ZZ][ZZ];
+}
+
+void FitReference::sums(const rvec *x, FitSums *sums) const
+{
+    double D[DIM][DIM] = {{0}};
+    double dd          = 0;
+
+#if GMX_SIMD_HAVE_REAL && GMX_SIMD_HAVE_LOADU
+    using namespace gmx;
+
+    const int nblock = nsimd_/GMX_SIMD_REAL_WIDTH;
+    GMX_ALIGNED(real, GMX_SIMD_REAL_WIDTH) buf[GMX_SIMD_REAL_WIDTH];
+
+    for (int block0 = 0; block0 < nblock; block0 += c_flushInterval)
+    {
+        const int block1 = std::min(nblock, block0 + c_flushInterval);
+        SimdReal  acc[DIM][DIM];
+        SimdReal  accdd = setZero();
+
+        for (int k = 0; k < DIM; k++)
+        {
+            for (int j = 0; j < DIM; j++)
+            {
+                acc[k][j] = setZero();
+            }
+        }
+        /* Each block holds GMX_SIMD_REAL_WIDTH atoms, i.e. DIM SIMD chunks;
+         * lane l of chunk j always holds component (j*width + l) % 3.
+         */
+        for (int block = block0; block < block1; block++)
+        {
+            for (int j = 0; j < DIM; j++)
+            {
+                const int      offset = (block*DIM + j)*GMX_SIMD_REAL_WIDTH;
+                const SimdReal xv     = loadU(x[0] + offset);
+                const SimdReal xpv    = load(xp3_.data() + offset);
+                const SimdReal dv     = xv - xpv;
+                for (int k = 0; k < DIM; k++)
+                {
+                    acc[k][j] = fma(dv, load(wxp_[k].data() + offset), acc[k][j]);
+                }
+                accdd = fma(dv*dv, load(w3_.data() + offset), accdd);
+            }
+        }
+        for (int k = 0; k < DIM; k++)
+        {
+            for (int j = 0; j < DIM; j++)
+            {
+                store(buf, acc[k][j]);
+                for (int l = 0; l < GMX_SIMD_REAL_WIDTH; l++)
+                {
+                    const int a = (j*GMX_SIMD_REAL_WIDTH + l) % DIM;
+                    D[a][(a + k) % DIM] += buf[l];
+                }
+            }
+        }
+        dd += reduce(accdd);
+    }
+#endif
+
+    for (int i = nsimd_; i < natoms_; i++)
+    {
+        const double w = w_[i];
+        for (int a = 0; a < DIM; a++)
+        {
+            const double d = static_cast<double>(x[i][a]) - xp_[i][a];
+            for (int b = 0; b < DIM; b++)
+            {
+                D[a][b] += w*d*xp_[i][b];
+            }
+            dd += w*d*d;
+        }
+    }
+
+    for (int a = 0; a < DIM; a++)
+    {
+        for (int b = 0; b < DIM; b++)
+        {
+            sums->S[a][b] = G_[a][b] + D[a][b];
+        }
+    }
+    /* x.x = xp.xp + 2 d.xp + d.d */
+    sums->gx = gxp_ + 2*(D[XX][XX] + D[YY][YY] + D[ZZ][ZZ]) + dd;
+    sums->dd = dd;
+}
+
+/*! \brief
+ * Computes the rotation matrix R that fits a structure to the reference,
+ * given their correlation matrix S as computed by FitReference::sums().
+ *
+ * For a 3D fit R is obtained in double precision from the quaternion
+ * that is the leading eigenvector of the 4x4 key matrix,
+ * B. K. P. Horn, J. Opt. Soc. Am. A 4, 629 (1987).
+ * This gives the same rotation as calc_fit_R, but R is orthonormal
+ * to double precision.
+ */
+void calc_fit_R_from_sums(int ndim, const double S[DIM][DIM], double R[DIM][DIM])
+{
+    if (ndim == 2)
+    {
+        /* Rotation around z maximizing sum_i w_i (R x_i).xp_i */
+        const double angle = std::atan2(S[XX][YY] - S[YY][XX], S[XX][XX] + S[YY][YY]);
+        const double c     = std::cos(angle);
+        const double s     = std::sin(angle);
+
+        R[XX][XX] = c;
+        R[XX][YY] = -s;
+        R[XX][ZZ] = 0;
+        R[YY][XX] = s;
+        R[YY][YY] = c;
+        R[YY][ZZ] = 0;
+        R[ZZ][XX] = 0;
+        R[ZZ][YY] = 0;
+        R[ZZ][ZZ] = 1;
+        return;
+    }
+
+    const double Sxx = S[XX][XX], Sxy = S[XX][YY], Sxz = S[XX][ZZ];
+    const double Syx = S[YY][XX], Syy = S[YY][YY], Syz = S[YY][ZZ];
+    const double Szx = S[ZZ][XX], Szy = S[ZZ][YY], Szz = S[ZZ][ZZ];
+    double       key[4][4] = {
+        { Sxx + Syy + Szz, Syz - Szy,        Szx - Sxz,        Sxy - Syx       },
+        { Syz - Szy,       Sxx - Syy - Szz,  Sxy + Syx,        Szx + Sxz       },
+        { Szx - Sxz,       Sxy + Syx,        -Sxx + Syy - Szz, Syz + Szy       },
+        { Sxy - Syx,       Szx + Sxz,        Syz + Szy,        -Sxx - Syy + Szz }
+    };
+    double       vec[4][4], eig[4];
+    double      *keyRows[4], *vecRows[4];
+    int          nrot, imax;
+
+    for (int i = 0; i < 4; i++)
+    {
+        keyRows[i] = key[i];
+        vecRows[i] = vec[i];
+    }
+    jacobi(keyRows, 4, eig, vecRows, &nrot);
+    imax = 0;
+    for (int i = 1; i < 4; i++)
+    {
+        if (eig[i] > eig[imax])
+        {
+            imax = i;
+        }
+    }
+
+    double       q0   = vec[0][imax], q1 = vec[1][imax], q2 = vec[2][imax], q3 = vec[3][imax];
+    const double norm = 1/std::sqrt(q0*q0 + q1*q1 + q2*q2 + q3*q3);
+    q0       *= norm;
+    q1       *= norm;
+    q2       *= norm;
+    q3       *= norm;
+
+    R[XX][XX] = q0*q0 + q1*q1 - q2*q2 - q3*q3;
+    R[XX][YY] = 2*(q1*q2 - q0*q3);
+    R[XX][ZZ] = 2*(q1*q3 + q0*q2);
+    R[YY][XX] = 2*(q1*q2 + q0*q3);
+    R[YY][YY] = q0*q0 - q1*q1 + q2*q2 - q3*q3;
+    R[YY][ZZ] = 2*(q2*q3 - q0*q1);
+    R[ZZ][XX] = 2*(q1*q3 - q0*q2);
+    R[ZZ][YY] = 2*(q2*q3 + q0*q1);
+    R[ZZ][ZZ] = q0*q0 - q1*q1 - q2*q2 + q3*q3;
+}
+
+}   // namespace
+
+void calc_fit_R_batch(int ndim, int natoms, const real *w_rls, const rvec *xp,
+                      int nframes, const rvec * const *x, matrix *R)
+{
+    if (ndim != 3 && ndim != 2)
+    {
+        gmx_fatal(FARGS, "calc_fit_R_batch called with ndim=%d instead of 3 or 2", ndim);
+    }
+
+    FitReference reference(natoms, w_rls, xp);
+    for (int f = 0; f < nframes; f++)
+    {
+        FitSums sums;
+        double  Rd[DIM][DIM];
+
+        reference.sums(x[f], &sums);
+        calc_fit_R_from_sums(ndim, sums.S, Rd);
+        for (int r = 0; r < DIM; r++)
+        {
+            for (int c = 0; c < DIM; c++)
+            {
+                R[f][r][c] = Rd[r][c];
+            }
+        }
+    }
+}
+
+void calc_similar_fit_batch(gmx_bool bRho, int natoms,
+                            const real *w_rls, const real *w_rms,
+                            const rvec *xp, int nframes, const rvec * const *x,
+                            real *result)
+{
+    /* With equal weights for fitting and RMSD we only need the minimal
+     * deviation, which QCP gives without computing the rotation.
+     */
+    const gmx_bool bQCP = (w_rls != NULL && w_rls == w_rms && !bRho);
+    FitReference                  rmsReference(natoms, w_rms, xp);
+    std::unique_ptr<FitReference> fitReference;
+
+    if (w_rls != NULL && w_rls != w_rms)
+    {
+        fitReference.reset(new FitReference(natoms, w_rls, xp));
+    }
+
+    for (int f = 0; f < nframes; f++)
+    {
+        FitSums sums;
+        double  sqdev, deficit;
+
+        rmsReference.sums(x[f], &sums);
+        if (bQCP)
+        {
+            sqdev = qcp_min_sqdev(sums.S, sums.gx, rmsReference.gxp());
+            /* Without rotation the deviation can not be smaller */
+            sqdev = std::min(sqdev, sums.dd);
+            result[f] = std::sqrt(sqdev/rmsReference.wtot());
+            continue;
+        }
+
+        /* deficit = sum_i w_i (x_i - R x_i).xp_i, zero without fitting */
+        deficit = 0;
+        if (w_rls != NULL)
+        {
+            double R[DIM][DIM];
+            if (fitReference)
+            {
+                FitSums fitSums;
+
+                fitReference->sums(x[f], &fitSums);
+                calc_fit_R_from_sums(3, fitSums.S, R);
+            }
+            else
+            {
+                calc_fit_R_from_sums(3, sums.S, R);
+            }
+            for (int r = 0; r < DIM; r++)
+            {
+                for (int c = 0; c < DIM; c++)
+                {
+                    deficit += ((r == c ? 1.0 : 0.0) - R[r][c])*sums.S[c][r];
+                }
+            }
+        }
+        sqdev = std::max(sums.dd + 2*deficit, 0.0);
+        if (bRho)
+        {
+            const double sqsum = sums.gx + rmsReference.gxp()
+                + 2*(sums.S[XX][XX] + sums.S[YY][YY] + sums.S[ZZ][ZZ] - deficit);
+            result[f] = 2*std::sqrt(sqdev/sqsum);
+        }
+        else
+        {
+            result[f] = std::sqrt(sqdev/rmsReference.wtot());
+        }
+    }
+}
+
 void reset_x_ndim(int ndim, int ncm, const int *ind_cm,
                   int nreset, const int *ind_reset,
                   rvec x[], const real mass[])
@@ -86,6 +86,37 @@ void do_fit_ndim(int ndim, int natoms, real *w_rls, const rvec *xp, rvec *x);
 void do_fit(int natoms, real *w_rls, const rvec *xp, rvec *x);
 /* Calls do_fit with ndim=3, thus fitting in 3D */
 
+real rmsdev_fit(int natoms, const real *w_rls, const rvec *xp, const rvec *x);
+/* Returns the RMS deviation between x and xp, weighted with w_rls, after
+ * a least squares fit of x to xp, i.e. the same as do_fit followed by
+ * rmsdev, but without computing the rotation or modifying x.
+ * As for do_fit, both x and xp should be centered round the origin.
+ * Uses the quaternion characteristic polynomial method, which is
+ * considerably faster than do_fit.
+ */
+
+void calc_fit_R_batch(int ndim, int natoms, const real *w_rls, const rvec *xp,
+                      int nframes, const rvec * const *x, matrix *R);
+/* Calculates the rotation matrices R[f] as calc_fit_R does for fitting
+ * each of the nframes structures x[f] to xp. The per-structure sums
+ * are vectorized and computed against a single copy of the weighted
+ * reference, which makes this much faster than repeated calls
+ * to calc_fit_R for many structures.
+ */
+
+void calc_similar_fit_batch(gmx_bool bRho, int natoms,
+                            const real *w_rls, const real *w_rms,
+                            const rvec *xp, int nframes, const rvec * const *x,
+                            real *result);
+/* Returns in result[f] the RMSD or Rho (depending on bRho) between xp and
+ * each of the nframes structures x[f], weighted with w_rms, as
+ * calc_similar_ind would after do_fit of a copy of x[f] to xp with w_rls.
+ * When w_rls=NULL no fit is done. The structures are not modified.
+ * Since the measures are symmetric, this can also be used to compare
+ * one structure to many references. As for do_fit, all structures
+ * should be centered round the origin.
+ */
+
 void reset_x_ndim(int ndim, int ncm, const int *ind_cm,
                   int nreset, const int *ind_reset,
                   rvec x[], const real mass[]);
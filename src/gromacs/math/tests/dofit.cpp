@@ -0,0 +1,236 @@
+/*
+ * This file is part of the GROMACS molecular simulation package.
+ *
+ * Copyright (c) 2017, by the GROMACS development team, led by
+ * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
+ * and including many others, as listed in the AUTHORS file in the
+ * top-level source directory and at http://www.gromacs.org.
+ *
+ * GROMACS is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ *
+ * GROMACS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GROMACS; if not, see
+ * http://www.gnu.org/licenses, or write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA.
+ *
+ * If you want to redistribute modifications to GROMACS, please
+ * consider that scientific software is very special. Version
+ * control is crucial - bugs must be traceable. We will be happy to
+ * consider code for inclusion in the official distribution, but
+ * derived work must not be called official GROMACS. Details are found
+ * in the README & COPYING files - if they are missing, get the
+ * official version at http://www.gromacs.org.
+ *
+ * To help us fund GROMACS development, we humbly ask that you cite
+ * the research papers on the package. Check out http://www.gromacs.org.
+ */
+/*! \internal \file
+ * \brief
+ * Tests structure fitting routines
+ *
+ * \ingroup module_math
+ */
+#include "gmxpre.h"
+
+#include "gromacs/math/do_fit.h"
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "gromacs/math/units.h"
+#include "gromacs/math/vec.h"
+#include "gromacs/random/threefry.h"
+#include "gromacs/random/uniformrealdistribution.h"
+
+#include "testutils/testasserts.h"
+
+namespace
+{
+
+class FitTest : public ::testing::Test
+{
+    public:
+        FitTest() : rng_(12345, gmx::RandomDomain::Other), dist_(-1, 1)
+        {
+        }
+
+        //! Fills x with random coordinates and w with random weights
+        void generateStructure(int natoms)
+        {
+            x_.resize(natoms);
+            w_.resize(natoms);
+            for (int i = 0; i < natoms; i++)
+            {
+                for (int d = 0; d < DIM; d++)
+                {
+                    x_[i][d] = dist_(rng_);
+                }
+                w_[i] = (i % 5 == 0) ? 0 : 1 + dist_(rng_)*dist_(rng_);
+            }
+            reset_x(natoms, NULL, natoms, NULL, as_rvec_array(x_.data()), w_.data());
+        }
+
+        //! Returns x rotated around the axes and with noise of size \p noise
+        std::vector<gmx::RVec> perturbedStructure(real noise)
+        {
+            matrix rotX, rotZ, rot;
+            clear_mat(rotX);
+            clear_mat(rotZ);
+            const real a = 0.3*M_PI, b = 0.7*M_PI;
+            rotX[XX][XX] = 1;
+            rotX[YY][YY] = std::cos(a);
+            rotX[YY][ZZ] = -std::sin(a);
+            rotX[ZZ][YY] = std::sin(a);
+            rotX[ZZ][ZZ] = std::cos(a);
+            rotZ[XX][XX] = std::cos(b);
+            rotZ[XX][YY] = -std::sin(b);
+            rotZ[YY][XX] = std::sin(b);
+            rotZ[YY][YY] = std::cos(b);
+            rotZ[ZZ][ZZ] = 1;
+            mmul(rotX, rotZ, rot);
+
+            std::vector<gmx::RVec> xp(x_.size());
+            for (size_t i = 0; i < x_.size(); i++)
+            {
+                mvmul(rot, x_[i], xp[i]);
+                for (int d = 0; d < DIM; d++)
+                {
+                    xp[i][d] += noise*dist_(rng_);
+                }
+            }
+            reset_x(xp.size(), NULL, xp.size(), NULL, as_rvec_array(xp.data()), w_.data());
+
+            return xp;
+        }
+
+        gmx::ThreeFry2x64<64>              rng_;
+        gmx::UniformRealDistribution<real> dist_;
+        std::vector<gmx::RVec>             x_;
+        std::vector<real>                  w_;
+};
+
+TEST_F(FitTest, RmsdevFitMatchesDoFit)
+{
+    generateStructure(50);
+    std::vector<gmx::RVec> xp = perturbedStructure(0.1);
+
+    std::vector<gmx::RVec> xfit(x_);
+    do_fit(x_.size(), w_.data(), as_rvec_array(xp.data()), as_rvec_array(xfit.data()));
+    const real reference = rmsdev(x_.size(), w_.data(), as_rvec_array(xp.data()),
+                                  as_rvec_array(xfit.data()));
+
+    const real result = rmsdev_fit(x_.size(), w_.data(), as_rvec_array(xp.data()),
+                                   as_rvec_array(x_.data()));
+    EXPECT_REAL_EQ_TOL(reference, result, gmx::test::absoluteTolerance(1e-5));
+    EXPECT_GT(result, 0.01);
+}
+
+TEST_F(FitTest, RmsdevFitIsZeroForRotatedStructure)
+{
+    generateStructure(20);
+    std::vector<gmx::RVec> xp = perturbedStructure(0);
+
+    const real result = rmsdev_fit(x_.size(), w_.data(), as_rvec_array(xp.data()),
+                                   as_rvec_array(x_.data()));
+    EXPECT_REAL_EQ_TOL(0, result, gmx::test::absoluteTolerance(1e-3));
+}
+
+TEST_F(FitTest, CalcFitRBatchMatchesCalcFitR)
+{
+    generateStructure(43);
+    std::vector<gmx::RVec>                xref = x_;
+    std::vector<std::vector<gmx::RVec> > frames;
+    std::vector<const rvec *>             framePtrs;
+    for (int f = 0; f < 3; f++)
+    {
+        frames.push_back(perturbedStructure(0.05*f));
+    }
+    for (const auto &frame : frames)
+    {
+        framePtrs.push_back(as_rvec_array(frame.data()));
+    }
+
+    for (int ndim = 2; ndim <= 3; ndim++)
+    {
+        matrix R[3];
+        calc_fit_R_batch(ndim, x_.size(), w_.data(), as_rvec_array(xref.data()),
+                         frames.size(), framePtrs.data(), R);
+        for (size_t f = 0; f < frames.size(); f++)
+        {
+            std::vector<gmx::RVec> xfit(frames[f]);
+            matrix                 reference;
+            calc_fit_R(ndim, x_.size(), w_.data(), as_rvec_array(xref.data()),
+                       as_rvec_array(xfit.data()), reference);
+            for (int r = 0; r < DIM; r++)
+            {
+                for (int c = 0; c < DIM; c++)
+                {
+                    EXPECT_REAL_EQ_TOL(reference[r][c], R[f][r][c],
+                                       gmx::test::absoluteTolerance(1e-4))
+                    << "ndim " << ndim << " frame " << f;
+                }
+            }
+        }
+    }
+}
+
+TEST_F(FitTest, CalcSimilarFitBatchMatchesDoFit)
+{
+    generateStructure(61);
+    std::vector<gmx::RVec>                xref = x_;
+    std::vector<std::vector<gmx::RVec> > frames;
+    std::vector<const rvec *>             framePtrs;
+    for (int f = 0; f < 4; f++)
+    {
+        frames.push_back(perturbedStructure(0.1 + 0.05*f));
+    }
+    for (const auto &frame : frames)
+    {
+        framePtrs.push_back(as_rvec_array(frame.data()));
+    }
+    /* RMSD weights that differ from the fit weights */
+    std::vector<real> w_rms(x_.size());
+    for (size_t i = 0; i < x_.size(); i++)
+    {
+        w_rms[i] = (i % 3 == 0) ? 1 : 0;
+    }
+
+    for (int bRho = 0; bRho <= 1; bRho++)
+    {
+        for (int weights = 0; weights < 3; weights++)
+        {
+            const real *w_rls = (weights == 2 ? NULL : w_.data());
+            real       *w_sim = (weights == 1 ? w_rms.data() : w_.data());
+
+            std::vector<real> result(frames.size());
+            calc_similar_fit_batch(bRho, x_.size(), w_rls, w_sim,
+                                   as_rvec_array(xref.data()),
+                                   frames.size(), framePtrs.data(), result.data());
+            for (size_t f = 0; f < frames.size(); f++)
+            {
+                std::vector<gmx::RVec> xfit(frames[f]);
+                if (w_rls != NULL)
+                {
+                    do_fit(x_.size(), w_.data(), as_rvec_array(xref.data()),
+                           as_rvec_array(xfit.data()));
+                }
+                const real reference =
+                    calc_similar_ind(bRho, x_.size(), NULL, w_sim,
+                                     as_rvec_array(xref.data()), as_rvec_array(xfit.data()));
+                EXPECT_REAL_EQ_TOL(reference, result[f], gmx::test::absoluteTolerance(1e-4))
+                << "bRho " << bRho << " weights " << weights << " frame " << f;
+            }
+        }
+    }
+}
+
+} // namespace
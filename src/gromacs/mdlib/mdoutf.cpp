@@ -36,6 +36,8 @@
 
 #include "mdoutf.h"
 
+#include <cstdlib>
+
 #include "gromacs/commandline/filenm.h"
 #include "gromacs/domdec/domdec.h"
 #include "gromacs/domdec/domdec_struct.h"
@@ -57,27 +59,81 @@
 #include "gromacs/utility/smalloc.h"
 
 struct gmx_mdoutf {
-    t_fileio         *fp_trn;
-    t_fileio         *fp_xtc;
-    tng_trajectory_t  tng;
-    tng_trajectory_t  tng_low_prec;
-    int               x_compression_precision; /* only used by XTC output */
-    ener_file_t       fp_ene;
-    const char       *fn_cpt;
-    gmx_bool          bKeepAndNumCPT;
-    int               eIntegrator;
-    gmx_bool          bExpanded;
-    int               elamstats;
-    int               simulation_part;
-    FILE             *fp_dhdl;
-    int               natoms_global;
-    int               natoms_x_compressed;
-    gmx_groups_t     *groups; /* for compressed position writing */
-    gmx_wallcycle_t   wcycle;
-    rvec             *f_global;
+    t_fileio                 *fp_trn;
+    t_fileio                 *fp_xtc;
+    tng_trajectory_t          tng;
+    tng_trajectory_t          tng_low_prec;
+    /* Background writers for tng and tng_low_prec, NULL when not used */
+    gmx::TngBackgroundWriter *tng_writer;
+    gmx::TngBackgroundWriter *tng_low_prec_writer;
+    int                       x_compression_precision; /* only used by XTC output */
+    ener_file_t               fp_ene;
+    const char               *fn_cpt;
+    gmx_bool                  bKeepAndNumCPT;
+    int                       eIntegrator;
+    gmx_bool                  bExpanded;
+    int                       elamstats;
+    int                       simulation_part;
+    FILE                     *fp_dhdl;
+    int                       natoms_global;
+    int                       natoms_x_compressed;
+    gmx_groups_t             *groups; /* for compressed position writing */
+    gmx_wallcycle_t           wcycle;
+    rvec                     *f_global;
 };
 
 
+/*! \brief Returns a background writer for \p tng, or NULL when there is
+ * no TNG file or background writing is turned off in the environment */
+static gmx::TngBackgroundWriter *init_tng_writer(tng_trajectory_t tng)
+{
+    if (tng == NULL || getenv("GMX_NO_TNG_BACKGROUND_WRITING") != NULL)
+    {
+        return NULL;
+    }
+    gmx::TngBackgroundWriter *writer = new gmx::TngBackgroundWriter(tng);
+    const char               *env    = getenv("GMX_TNG_FRAME_SET_LATENCY");
+    if (env != NULL)
+    {
+        writer->setTargetFrameSetLatency(strtod(env, NULL));
+    }
+    return writer;
+}
+
+/*! \brief Writes a TNG frame, through \p writer when it is not NULL */
+static void write_tng_frame(gmx::TngBackgroundWriter *writer,
+                            tng_trajectory_t          tng,
+                            gmx_bool                  bUseLossyCompression,
+                            gmx_int64_t               step,
+                            real                      t,
+                            real                      lambda,
+                            const rvec               *box,
+                            int                       natoms,
+                            const rvec               *x,
+                            const rvec               *v,
+                            const rvec               *f)
+{
+    if (writer)
+    {
+        writer->writeFrame(bUseLossyCompression, step, t, lambda, box,
+                           natoms, x, v, f);
+    }
+    else
+    {
+        gmx_fwrite_tng(tng, bUseLossyCompression, step, t, lambda, box,
+                       natoms, x, v, f);
+    }
+}
+
+/*! \brief Stops the background TNG writers, writing all queued frames */
+static void done_tng_writers(gmx_mdoutf_t of)
+{
+    delete of->tng_writer;
+    delete of->tng_low_prec_writer;
+    of->tng_writer          = NULL;
+    of->tng_low_prec_writer = NULL;
+}
+
 gmx_mdoutf_t init_mdoutf(FILE *fplog, int nfile, const t_filenm fnm[],
                          int mdrun_flags, const t_commrec *cr,
                          const t_inputrec *ir, gmx_mtop_t *top_global,
@@ -97,6 +153,9 @@ gmx_mdoutf_t init_mdoutf(FILE *fplog, int nfile, const t_filenm fnm[],
     of->tng_low_prec = NULL;
     of->fp_dhdl      = NULL;
 
+    of->tng_writer          = NULL;
+    of->tng_low_prec_writer = NULL;
+
     of->eIntegrator             = ir->eI;
     of->bExpanded               = ir->bExpanded;
     of->elamstats               = ir->expandedvals->elamstats;
@@ -213,6 +272,9 @@ gmx_mdoutf_t init_mdoutf(FILE *fplog, int nfile, const t_filenm fnm[],
         {
             snew(of->f_global, top_global->natoms);
         }
+
+        of->tng_writer          = init_tng_writer(of->tng);
+        of->tng_low_prec_writer = init_tng_writer(of->tng_low_prec);
     }
 
     if (bCiteTng)
@@ -286,8 +348,22 @@ void mdoutf_write_to_trajectory_files(FILE *fplog, t_commrec *cr,
     {
         if (mdof_flags & MDOF_CPT)
         {
-            fflush_tng(of->tng);
-            fflush_tng(of->tng_low_prec);
+            if (of->tng_writer)
+            {
+                of->tng_writer->flush();
+            }
+            else
+            {
+                fflush_tng(of->tng);
+            }
+            if (of->tng_low_prec_writer)
+            {
+                of->tng_low_prec_writer->flush();
+            }
+            else
+            {
+                fflush_tng(of->tng_low_prec);
+            }
             ivec one_ivec = { 1, 1, 1 };
             write_checkpoint(of->fn_cpt, of->bKeepAndNumCPT,
                              fplog, cr,
@@ -319,19 +395,21 @@ void mdoutf_write_to_trajectory_files(FILE *fplog, t_commrec *cr,
                velocities and forces to it. */
             else if (of->tng)
             {
-                gmx_fwrite_tng(of->tng, FALSE, step, t, state_local->lambda[efptFEP],
-                               state_local->box,
-                               top_global->natoms,
-                               x, v, f);
+                write_tng_frame(of->tng_writer, of->tng, FALSE, step, t,
+                                state_local->lambda[efptFEP],
+                                state_local->box,
+                                top_global->natoms,
+                                x, v, f);
             }
             /* If only a TNG file is open for compressed coordinate output (no uncompressed
                coordinate output) also write forces and velocities to it. */
             else if (of->tng_low_prec)
             {
-                gmx_fwrite_tng(of->tng_low_prec, FALSE, step, t, state_local->lambda[efptFEP],
-                               state_local->box,
-                               top_global->natoms,
-                               x, v, f);
+                write_tng_frame(of->tng_low_prec_writer, of->tng_low_prec, FALSE, step, t,
+                                state_local->lambda[efptFEP],
+                                state_local->box,
+                                top_global->natoms,
+                                x, v, f);
             }
         }
         if (mdof_flags & MDOF_X_COMPRESSED)
@@ -365,16 +443,17 @@ void mdoutf_write_to_trajectory_files(FILE *fplog, t_commrec *cr,
             {
                 gmx_fatal(FARGS, "XTC error - maybe you are out of disk space?");
             }
-            gmx_fwrite_tng(of->tng_low_prec,
-                           TRUE,
-                           step,
-                           t,
-                           state_local->lambda[efptFEP],
-                           state_local->box,
-                           of->natoms_x_compressed,
-                           xxtc,
-                           NULL,
-                           NULL);
+            write_tng_frame(of->tng_low_prec_writer,
+                            of->tng_low_prec,
+                            TRUE,
+                            step,
+                            t,
+                            state_local->lambda[efptFEP],
+                            state_local->box,
+                            of->natoms_x_compressed,
+                            xxtc,
+                            NULL,
+                            NULL);
             if (of->natoms_x_compressed != of->natoms_global)
             {
                 sfree(xxtc);
@@ -388,6 +467,7 @@ void mdoutf_tng_close(gmx_mdoutf_t of)
     if (of->tng || of->tng_low_prec)
     {
         wallcycle_start(of->wcycle, ewcTRAJ);
+        done_tng_writers(of);
         gmx_tng_close(&of->tng);
         gmx_tng_close(&of->tng_low_prec);
         wallcycle_stop(of->wcycle, ewcTRAJ);
@@ -418,6 +498,7 @@ void done_mdoutf(gmx_mdoutf_t of, const t_inputrec *ir)
         sfree(of->f_global);
     }
 
+    done_tng_writers(of);
     gmx_tng_close(&of->tng);
     gmx_tng_close(&of->tng_low_prec);
 
@@ -1,7 +1,7 @@
 /*
  * This file is part of the GROMACS molecular simulation package.
  *
- * Copyright (c) 2009,2010,2011,2012,2013,2014,2015,2016, by the GROMACS development team, led by
+ * Copyright (c) 2009,2010,2011,2012,2013,2014,2015,2016,2017, by the GROMACS development team, led by
  * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
  * and including many others, as listed in the AUTHORS file in the
  * top-level source directory and at http://www.gromacs.org.
@@ -82,8 +82,12 @@
  *  -# Subexpressions are extracted: a separate root is created for each
  *     subexpression, and placed before the expression is first used.
  *     Currently, only variables and expressions used to evaluate parameter
- *     values are extracted, but common subexpression could also be detected
- *     here.
+ *     values are extracted.
+ *  -# Common subexpressions are merged: if two extracted subexpressions are
+ *     structurally identical, all references to the latter are redirected to
+ *     the first one, and the latter is removed.  The merged subexpression is
+ *     then evaluated only once per frame for all the selections that use it,
+ *     and its static parts are evaluated only once during compilation.
  *  -# A second pass (in fact, multiple passes because of interdependencies)
  *     with simple reordering and initialization is done:
  *    -# Boolean expressions are combined such that one element can evaluate,
@@ -130,6 +134,9 @@
  *     cleared.  At the same time, position calculation data is initialized for
  *     for selection method elements that require it.  Compiler data is also
  *     freed as it is no longer needed.
+ *  -# If multiple threads are available, the root elements are partitioned
+ *     for parallel evaluation: roots that share subexpressions are assigned
+ *     to the same thread, and each thread gets its own memory pool.
  *  -# A final pass initializes the total masses and charges in the
  *     \c gmx_ana_selection_t data structures.
  *
@@ -275,13 +282,17 @@
 
 #include <math.h>
 #include <stdarg.h>
+#include <string.h>
 
 #include <algorithm>
+#include <map>
+#include <vector>
 
 #include "gromacs/math/vec.h"
 #include "gromacs/selection/indexutil.h"
 #include "gromacs/selection/selection.h"
 #include "gromacs/utility/exceptions.h"
+#include "gromacs/utility/gmxomp.h"
 #include "gromacs/utility/smalloc.h"
 #include "gromacs/utility/stringutil.h"
 
@@ -870,6 +881,319 @@ extract_subexpressions(SelectionTreeElementPointer sel)
 }
 
 
+/********************************************************************
+ * COMMON SUBEXPRESSION MERGING
+ ********************************************************************/
+
+static bool
+is_selelem_equal(const SelectionTreeElement &sel1,
+                 const SelectionTreeElement &sel2);
+
+/*! \brief
+ * Checks whether two constant parameter values are equal.
+ *
+ * \param[in] param1  First parameter to compare.
+ * \param[in] param2  Second parameter to compare.
+ * \returns   true if the parameters are known to have the same value.
+ *
+ * Position and group values are never considered equal; such values are
+ * normally provided through subexpression references, which are compared
+ * separately.
+ */
+static bool
+is_param_value_equal(const gmx_ana_selparam_t &param1,
+                     const gmx_ana_selparam_t &param2)
+{
+    if (param1.flags != param2.flags || param1.val.type != param2.val.type
+        || param1.val.nr != param2.val.nr)
+    {
+        return false;
+    }
+    if (!(param1.flags & SPAR_SET))
+    {
+        return true;
+    }
+    const int n = (param1.flags & SPAR_RANGES) ? 2*param1.val.nr : param1.val.nr;
+    switch (param1.val.type)
+    {
+        case NO_VALUE:
+            if (param1.val.u.b == NULL || param2.val.u.b == NULL)
+            {
+                return param1.val.u.b == param2.val.u.b;
+            }
+            return *param1.val.u.b == *param2.val.u.b;
+        case INT_VALUE:
+            return std::equal(param1.val.u.i, param1.val.u.i + n, param2.val.u.i);
+        case REAL_VALUE:
+            return std::equal(param1.val.u.r, param1.val.u.r + n, param2.val.u.r);
+        case STR_VALUE:
+            for (int i = 0; i < n; ++i)
+            {
+                if (strcmp(param1.val.u.s[i], param2.val.u.s[i]) != 0)
+                {
+                    return false;
+                }
+            }
+            return true;
+        default:
+            return n == 0;
+    }
+}
+
+/*! \brief
+ * Checks whether two \ref SEL_EXPRESSION elements evaluate to the same value.
+ *
+ * \param[in] sel1  First element to compare.
+ * \param[in] sel2  Second element to compare.
+ * \returns   true if the elements are known to be equivalent.
+ *
+ * Helper function for is_selelem_equal().
+ */
+static bool
+is_expression_equal(const SelectionTreeElement &sel1,
+                    const SelectionTreeElement &sel2)
+{
+    const gmx_ana_selmethod_t *method1 = sel1.u.expr.method;
+    const gmx_ana_selmethod_t *method2 = sel2.u.expr.method;
+    if (method1->name != method2->name || method1->flags != method2->flags
+        || method1->nparams != method2->nparams
+        || method1->init != method2->init
+        || method1->init_frame != method2->init_frame
+        || method1->update != method2->update
+        || method1->pupdate != method2->pupdate)
+    {
+        return false;
+    }
+    /* Reference positions explicitly set by the user are not compared. */
+    if (sel1.u.expr.pc != NULL || sel2.u.expr.pc != NULL)
+    {
+        return false;
+    }
+    if (!_gmx_selelem_is_kwpos_data_equal(sel1, sel2)
+        || !_gmx_selelem_is_keyword_data_equal(sel1, sel2))
+    {
+        return false;
+    }
+    /* Compare parameters that get their values from subexpressions. */
+    std::vector<bool>           bFromChild(method1->nparams, false);
+    SelectionTreeElementPointer child1 = sel1.child;
+    SelectionTreeElementPointer child2 = sel2.child;
+    while (child1 && child2)
+    {
+        if (child1->type != SEL_SUBEXPRREF || child2->type != SEL_SUBEXPRREF
+            || child1->u.param == NULL || child2->u.param == NULL)
+        {
+            return false;
+        }
+        const int index = child1->u.param - method1->param;
+        if (index != child2->u.param - method2->param
+            || index < 0 || index >= method1->nparams)
+        {
+            return false;
+        }
+        if (!is_selelem_equal(*child1, *child2))
+        {
+            return false;
+        }
+        bFromChild[index] = true;
+        child1            = child1->next;
+        child2            = child2->next;
+    }
+    if (child1 || child2)
+    {
+        return false;
+    }
+    /* Compare the remaining, constant parameter values. */
+    for (int i = 0; i < method1->nparams; ++i)
+    {
+        if (!bFromChild[i]
+            && !is_param_value_equal(method1->param[i], method2->param[i]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*! \brief
+ * Checks whether two selection subtrees evaluate to the same value.
+ *
+ * \param[in] sel1  Root of the first subtree to compare.
+ * \param[in] sel2  Root of the second subtree to compare.
+ * \returns   true if the subtrees are known to be equivalent.
+ *
+ * The comparison is conservative: false is returned for all element types
+ * and values for which equality is not easy to establish (e.g., modifiers
+ * and constant positions).  Subexpression references are equal if they
+ * refer to the same subexpression or to equivalent subexpressions; the latter
+ * covers subexpressions that merge_common_subexpressions() does not merge.
+ *
+ * Can only be called before the compiler data has been initialized.
+ */
+static bool
+is_selelem_equal(const SelectionTreeElement &sel1,
+                 const SelectionTreeElement &sel2)
+{
+    if (sel1.type != sel2.type || sel1.flags != sel2.flags
+        || sel1.v.type != sel2.v.type)
+    {
+        return false;
+    }
+    switch (sel1.type)
+    {
+        case SEL_CONST:
+            if (sel1.v.nr != sel2.v.nr)
+            {
+                return false;
+            }
+            switch (sel1.v.type)
+            {
+                case INT_VALUE:
+                    return std::equal(sel1.v.u.i, sel1.v.u.i + sel1.v.nr, sel2.v.u.i);
+                case REAL_VALUE:
+                    return std::equal(sel1.v.u.r, sel1.v.u.r + sel1.v.nr, sel2.v.u.r);
+                case STR_VALUE:
+                    for (int i = 0; i < sel1.v.nr; ++i)
+                    {
+                        if (strcmp(sel1.v.u.s[i], sel2.v.u.s[i]) != 0)
+                        {
+                            return false;
+                        }
+                    }
+                    return true;
+                case GROUP_VALUE:
+                    return gmx_ana_index_equals(
+                            const_cast<gmx_ana_index_t *>(&sel1.u.cgrp),
+                            const_cast<gmx_ana_index_t *>(&sel2.u.cgrp));
+                default:
+                    return false;
+            }
+        case SEL_EXPRESSION:
+            return is_expression_equal(sel1, sel2);
+        case SEL_BOOLEAN:
+        case SEL_ARITHMETIC:
+        {
+            if ((sel1.type == SEL_BOOLEAN && sel1.u.boolt != sel2.u.boolt)
+                || (sel1.type == SEL_ARITHMETIC
+                    && sel1.u.arith.type != sel2.u.arith.type))
+            {
+                return false;
+            }
+            SelectionTreeElementPointer child1 = sel1.child;
+            SelectionTreeElementPointer child2 = sel2.child;
+            while (child1 && child2)
+            {
+                if (!is_selelem_equal(*child1, *child2))
+                {
+                    return false;
+                }
+                child1 = child1->next;
+                child2 = child2->next;
+            }
+            return !child1 && !child2;
+        }
+        case SEL_SUBEXPR:
+            return is_selelem_equal(*sel1.child, *sel2.child);
+        case SEL_SUBEXPRREF:
+            return sel1.child == sel2.child
+                   || is_selelem_equal(*sel1.child, *sel2.child);
+        default:
+            return false;
+    }
+}
+
+/*! \brief
+ * Replaces references to a subexpression with references to another one.
+ *
+ * \param[in] sel     Root of the subtree to process.
+ * \param[in] oldexpr Subexpression whose references should be replaced.
+ * \param[in] newexpr Subexpression to refer to instead.
+ */
+static void
+replace_subexpression_refs(const SelectionTreeElementPointer &sel,
+                           const SelectionTreeElementPointer &oldexpr,
+                           const SelectionTreeElementPointer &newexpr)
+{
+    SelectionTreeElementPointer child = sel->child;
+    while (child)
+    {
+        if (child->type == SEL_SUBEXPRREF && child->child == oldexpr)
+        {
+            child->child = newexpr;
+            child->setName(newexpr->name());
+        }
+        else if (child->type != SEL_SUBEXPRREF)
+        {
+            replace_subexpression_refs(child, oldexpr, newexpr);
+        }
+        child = child->next;
+    }
+}
+
+/*! \brief
+ * Merges identical subexpressions in the selection chain.
+ *
+ * \param   root First selection in the whole selection chain.
+ * \returns The new first element for the chain.
+ *
+ * Should be called after extract_subexpressions().
+ * The chain is processed in order, and each subexpression is compared to
+ * the earlier ones.  Because subexpressions are always placed before the
+ * expressions that use them, references within a subexpression have already
+ * been merged when the subexpression itself is compared.
+ * If a match is found, all later references are redirected to the earlier
+ * subexpression, and the duplicate is removed from the chain.
+ * Only group subexpressions and dynamic numeric subexpressions are merged:
+ * evaluation through multiple references is not implemented for other value
+ * types, and static atom-valued subexpressions referenced from several
+ * dynamic expressions do not evaluate correctly.
+ */
+static SelectionTreeElementPointer
+merge_common_subexpressions(SelectionTreeElementPointer root)
+{
+    std::vector<SelectionTreeElementPointer> subexprs;
+    bool                                     bMerged = false;
+    SelectionTreeElementPointer              item    = root;
+    while (item)
+    {
+        const SelectionTreeElementPointer &subexpr = item->child;
+        if (subexpr->type == SEL_SUBEXPR
+            && (subexpr->v.type == GROUP_VALUE
+                || ((subexpr->v.type == INT_VALUE || subexpr->v.type == REAL_VALUE)
+                    && (subexpr->flags & SEL_DYNAMIC))))
+        {
+            std::vector<SelectionTreeElementPointer>::const_iterator match;
+            for (match = subexprs.begin(); match != subexprs.end(); ++match)
+            {
+                if (is_selelem_equal(**match, *subexpr))
+                {
+                    break;
+                }
+            }
+            if (match != subexprs.end())
+            {
+                SelectionTreeElementPointer next = item->next;
+                while (next)
+                {
+                    replace_subexpression_refs(next, subexpr, *match);
+                    next = next->next;
+                }
+                bMerged = true;
+            }
+            else
+            {
+                subexprs.push_back(subexpr);
+            }
+        }
+        item = item->next;
+    }
+    if (bMerged)
+    {
+        root = remove_unused_subexpressions(root);
+    }
+    return root;
+}
+
 /********************************************************************
  * BOOLEAN OPERATION REORDERING
  ********************************************************************/
@@ -2681,6 +3005,199 @@ free_item_compilerdata(const SelectionTreeElementPointer &sel)
 }
 
 
+/********************************************************************
+ * PARALLEL EVALUATION INITIALIZATION
+ ********************************************************************/
+
+/*! \brief
+ * Collects the subexpressions referenced from a selection subtree.
+ *
+ * \param[in]     sel   Root of the subtree to process.
+ * \param[in,out] refs  Referenced subexpressions are appended here.
+ *
+ * References are not followed into the subexpressions.
+ */
+static void
+collect_subexpr_refs(const SelectionTreeElementPointer  &sel,
+                     std::vector<SelectionTreeElement *> *refs)
+{
+    SelectionTreeElementPointer child = sel->child;
+    while (child)
+    {
+        if (child->type == SEL_SUBEXPRREF)
+        {
+            refs->push_back(child->child.get());
+        }
+        else
+        {
+            collect_subexpr_refs(child, refs);
+        }
+        child = child->next;
+    }
+}
+
+/*! \brief
+ * Replaces the memory pool in a selection subtree.
+ *
+ * \param[in,out] sel      Root of the subtree to process.
+ * \param[in]     mempool  Memory pool to use.
+ *
+ * Elements that do not use a memory pool are not changed.
+ * References are not followed into the subexpressions.
+ */
+static void
+set_item_mempool(const SelectionTreeElementPointer &sel,
+                 gmx_sel_mempool_t                 *mempool)
+{
+    if (sel->mempool)
+    {
+        sel->mempool = mempool;
+    }
+    if (sel->type != SEL_SUBEXPRREF)
+    {
+        SelectionTreeElementPointer child = sel->child;
+        while (child)
+        {
+            set_item_mempool(child, mempool);
+            child = child->next;
+        }
+    }
+}
+
+/*! \brief
+ * Partitions the root elements for parallel evaluation.
+ *
+ * \param[in,out] sc  Selection collection data.
+ *
+ * Root elements that reference the same subexpression (directly or
+ * through other subexpressions) are grouped together, and the groups are
+ * distributed to threads such that the number of atoms in the evaluation
+ * groups is balanced.  Each thread evaluates its roots in the original chain
+ * order, so subexpressions are still evaluated before they are referenced,
+ * and the results do not depend on the number of threads.
+ * If there are not enough threads or independent groups, \c sc->threadRoots
+ * is left empty, and the selections are evaluated serially.
+ *
+ * Should be called after the memory pool has been reserved.
+ */
+static void
+init_parallel_evaluation(gmx_ana_selcollection_t *sc)
+{
+    const int maxThreads = gmx_omp_get_max_threads();
+    if (maxThreads <= 1)
+    {
+        return;
+    }
+
+    std::vector<SelectionTreeElementPointer> roots;
+    SelectionTreeElementPointer              item = sc->root;
+    while (item)
+    {
+        roots.push_back(item);
+        item = item->next;
+    }
+    const int nroots = roots.size();
+
+    /* Merge roots that share subexpressions using a union-find forest. */
+    std::vector<int> group(nroots);
+    for (int i = 0; i < nroots; ++i)
+    {
+        group[i] = i;
+    }
+    std::map<SelectionTreeElement *, int> subexprRoot;
+    std::vector<SelectionTreeElement *>   refs;
+    for (int i = 0; i < nroots; ++i)
+    {
+        refs.clear();
+        collect_subexpr_refs(roots[i], &refs);
+        for (size_t r = 0; r < refs.size(); ++r)
+        {
+            std::map<SelectionTreeElement *, int>::const_iterator j
+                = subexprRoot.find(refs[r]);
+            if (j == subexprRoot.end())
+            {
+                /* The subexpression is not evaluated through an earlier
+                 * root; evaluate everything serially to be safe. */
+                return;
+            }
+            int gi = i, gj = j->second;
+            while (group[gi] != gi)
+            {
+                gi = group[gi];
+            }
+            while (group[gj] != gj)
+            {
+                gj = group[gj];
+            }
+            group[std::max(gi, gj)] = std::min(gi, gj);
+        }
+        subexprRoot[roots[i]->child.get()] = i;
+    }
+
+    /* Estimate the work for each independent group. */
+    std::vector<int>  groupIndex(nroots, -1);
+    std::vector<long> groupWork;
+    for (int i = 0; i < nroots; ++i)
+    {
+        int g = i;
+        while (group[g] != g)
+        {
+            g = group[g];
+        }
+        group[i] = g;
+        if (groupIndex[g] < 0)
+        {
+            groupIndex[g] = groupWork.size();
+            groupWork.push_back(0);
+        }
+        const int isize = roots[i]->u.cgrp.isize;
+        groupWork[groupIndex[g]] += 1 + (isize < 0 ? sc->gall.isize : isize);
+    }
+    const int ngroups  = groupWork.size();
+    const int nthreads = std::min(maxThreads, ngroups);
+    if (nthreads <= 1)
+    {
+        return;
+    }
+
+    /* Assign the largest groups first, each to the least loaded thread. */
+    std::vector<int> order(ngroups);
+    for (int g = 0; g < ngroups; ++g)
+    {
+        order[g] = g;
+    }
+    std::stable_sort(order.begin(), order.end(),
+                     [&groupWork](int a, int b)
+                     { return groupWork[a] > groupWork[b]; });
+    std::vector<int>  groupThread(ngroups);
+    std::vector<long> threadWork(nthreads, 0);
+    for (int k = 0; k < ngroups; ++k)
+    {
+        const int g = order[k];
+        const int t = std::min_element(threadWork.begin(), threadWork.end())
+            - threadWork.begin();
+        groupThread[g] = t;
+        threadWork[t] += groupWork[g];
+    }
+
+    sc->threadMempools.resize(nthreads);
+    sc->threadMempools[0] = sc->mempool;
+    const size_t poolSize = _gmx_sel_mempool_get_maxsize(sc->mempool);
+    for (int t = 1; t < nthreads; ++t)
+    {
+        sc->threadMempools[t] = _gmx_sel_mempool_create();
+        _gmx_sel_mempool_reserve(sc->threadMempools[t], poolSize);
+    }
+    sc->threadRoots.resize(nthreads);
+    for (int i = 0; i < nroots; ++i)
+    {
+        const int t = groupThread[groupIndex[group[i]]];
+        sc->threadRoots[t].push_back(roots[i]);
+        set_item_mempool(roots[i], sc->threadMempools[t]);
+    }
+}
+
+
 /********************************************************************
  * MAIN COMPILATION FUNCTION
  ********************************************************************/
@@ -2745,6 +3262,8 @@ SelectionCompiler::compile(SelectionCollection *coll)
     sc->root = remove_unused_subexpressions(sc->root);
     /* Extract subexpressions into separate roots */
     sc->root = extract_subexpressions(sc->root);
+    /* Merge identical subexpressions */
+    sc->root = merge_common_subexpressions(sc->root);
 
     /* Initialize the evaluation callbacks and process the tree structure
      * to conform to the expectations of the callback functions. */
@@ -2918,6 +3437,8 @@ SelectionCompiler::compile(SelectionCollection *coll)
 
     /* Allocate memory for the evaluation memory pool. */
     _gmx_sel_mempool_reserve(sc->mempool, 0);
+    /* Partition the selections for parallel evaluation. */
+    init_parallel_evaluation(sc);
 
     /* Finish up by calculating total masses and charges. */
     for (i = 0; i < sc->sel.size(); ++i)
@@ -1,7 +1,7 @@
 /*
  * This file is part of the GROMACS molecular simulation package.
  *
- * Copyright (c) 2009,2010,2011,2012,2013,2014,2015,2016, by the GROMACS development team, led by
+ * Copyright (c) 2009,2010,2011,2012,2013,2014,2015,2016,2017, by the GROMACS development team, led by
  * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
  * and including many others, as listed in the AUTHORS file in the
  * top-level source directory and at http://www.gromacs.org.
@@ -57,6 +57,8 @@
 #include <string.h>
 
 #include <algorithm>
+#include <exception>
+#include <vector>
 
 #include "gromacs/math/utilities.h"
 #include "gromacs/math/vec.h"
@@ -410,6 +412,38 @@ init_frame_eval(SelectionTreeElementPointer sel)
     }
 }
 
+/*! \brief
+ * Evaluates a root element for a new frame.
+ *
+ * \param[in]     data Data for the current frame.
+ * \param[in,out] sel  Root element to evaluate.
+ */
+static void
+evaluate_root_item(gmx_sel_evaluate_t                     *data,
+                   const gmx::SelectionTreeElementPointer &sel)
+{
+    /* Clear the evaluation group of subexpressions */
+    if (sel->child && sel->child->type == SEL_SUBEXPR
+        && sel->child->evaluate != NULL)
+    {
+        sel->child->u.cgrp.isize = 0;
+        /* Not strictly necessary, because the value will be overwritten
+         * during first evaluation of the subexpression anyways, but we
+         * clear the group for clarity. Note that this is _not_ done during
+         * compilation because of some additional complexities involved
+         * (see compiler.cpp), so it should not be relied upon in
+         * _gmx_sel_evaluate_subexpr(). */
+        if (sel->child->v.type == GROUP_VALUE)
+        {
+            sel->child->v.u.g->isize = 0;
+        }
+    }
+    if (sel->evaluate)
+    {
+        sel->evaluate(data, sel, NULL);
+    }
+}
+
 namespace gmx
 {
 
@@ -427,6 +461,8 @@ SelectionEvaluator::SelectionEvaluator()
  * clears some information in the selection to initialize the evaluation
  * for a new frame, and evaluates \p sel and all the selections pointed by
  * the \p next pointers of \p sel.
+ * If the compiler has partitioned the selections for parallel evaluation,
+ * each thread evaluates its own roots with its own memory pool.
  *
  * This is the only function that user code should call if they want to
  * evaluate a selection for a new frame.
@@ -438,32 +474,51 @@ SelectionEvaluator::evaluate(SelectionCollection *coll,
     gmx_ana_selcollection_t *sc = &coll->impl_->sc_;
     gmx_sel_evaluate_t       data;
 
-    _gmx_sel_evaluate_init(&data, sc->mempool, &sc->gall, sc->top, fr, pbc);
     init_frame_eval(sc->root);
-    SelectionTreeElementPointer sel = sc->root;
-    while (sel)
+    if (sc->threadRoots.empty())
     {
-        /* Clear the evaluation group of subexpressions */
-        if (sel->child && sel->child->type == SEL_SUBEXPR
-            && sel->child->evaluate != NULL)
+        _gmx_sel_evaluate_init(&data, sc->mempool, &sc->gall, sc->top, fr, pbc);
+        SelectionTreeElementPointer sel = sc->root;
+        while (sel)
         {
-            sel->child->u.cgrp.isize = 0;
-            /* Not strictly necessary, because the value will be overwritten
-             * during first evaluation of the subexpression anyways, but we
-             * clear the group for clarity. Note that this is _not_ done during
-             * compilation because of some additional complexities involved
-             * (see compiler.cpp), so it should not be relied upon in
-             * _gmx_sel_evaluate_subexpr(). */
-            if (sel->child->v.type == GROUP_VALUE)
+            evaluate_root_item(&data, sel);
+            sel = sel->next;
+        }
+    }
+    else
+    {
+        /* Shared position calculations are evaluated here such that the
+         * threads only read them. */
+        sc->pcc.updateSharedCalculations(fr, pbc);
+        const int                       nthreads = sc->threadRoots.size();
+        std::vector<std::exception_ptr> exceptions(nthreads);
+#pragma omp parallel for num_threads(nthreads) schedule(static)
+        for (int t = 0; t < nthreads; ++t)
+        {
+            try
             {
-                sel->child->v.u.g->isize = 0;
+                gmx_sel_evaluate_t threadData;
+                _gmx_sel_evaluate_init(&threadData, sc->threadMempools[t],
+                                       &sc->gall, sc->top, fr, pbc);
+                const std::vector<SelectionTreeElementPointer> &roots
+                    = sc->threadRoots[t];
+                for (size_t i = 0; i < roots.size(); ++i)
+                {
+                    evaluate_root_item(&threadData, roots[i]);
+                }
+            }
+            catch (...)
+            {
+                exceptions[t] = std::current_exception();
             }
         }
-        if (sel->evaluate)
+        for (int t = 0; t < nthreads; ++t)
         {
-            sel->evaluate(&data, sel, NULL);
+            if (exceptions[t])
+            {
+                std::rethrow_exception(exceptions[t]);
+            }
         }
-        sel = sel->next;
     }
     /* Update selection information */
     SelectionDataList::const_iterator isel;
@@ -1,7 +1,7 @@
 /*
  * This file is part of the GROMACS molecular simulation package.
  *
- * Copyright (c) 2009,2010,2012,2014,2015, by the GROMACS development team, led by
+ * Copyright (c) 2009,2010,2012,2014,2015,2017, by the GROMACS development team, led by
  * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
  * and including many others, as listed in the AUTHORS file in the
  * top-level source directory and at http://www.gromacs.org.
@@ -82,11 +82,41 @@ _gmx_selelem_set_kwpos_type(gmx::SelectionTreeElement *sel, const char *type);
 /** Sets the flags for position keyword evaluation. */
 void
 _gmx_selelem_set_kwpos_flags(gmx::SelectionTreeElement *sel, int flags);
+/*! \brief
+ * Checks whether two elements have the same position keyword settings.
+ *
+ * \param[in] sel1  First selection element to compare.
+ * \param[in] sel2  Second selection element to compare.
+ * \returns   ``true`` unless the elements are position keyword evaluations
+ *     that use a different position type or different flags.
+ *
+ * Only compares data that is not stored in the method parameters.
+ * This method only works before the selection has been compiled.
+ */
+bool
+_gmx_selelem_is_kwpos_data_equal(const gmx::SelectionTreeElement &sel1,
+                                 const gmx::SelectionTreeElement &sel2);
 
 /** Sets the string match type for string keyword evaluation. */
 void
 _gmx_selelem_set_kwstr_match_type(const gmx::SelectionTreeElementPointer &sel,
                                   gmx::SelectionStringMatchType           matchType);
+/*! \brief
+ * Checks whether two elements have the same keyword evaluation settings.
+ *
+ * \param[in] sel1  First selection element to compare.
+ * \param[in] sel2  Second selection element to compare.
+ * \returns   ``false`` if the elements are string keyword evaluations with
+ *     a different string match type, or if either of them evaluates a
+ *     keyword in a given group or positions (these are never considered
+ *     equal), ``true`` otherwise.
+ *
+ * Only compares data that is not stored in the method parameters.
+ * This method only works before the selection has been compiled.
+ */
+bool
+_gmx_selelem_is_keyword_data_equal(const gmx::SelectionTreeElement &sel1,
+                                   const gmx::SelectionTreeElement &sel2);
 
 /** Does custom processing for parameters of the \c same selection method. */
 void
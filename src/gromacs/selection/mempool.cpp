@@ -1,7 +1,7 @@
 /*
  * This file is part of the GROMACS molecular simulation package.
  *
- * Copyright (c) 2010,2011,2012,2014, by the GROMACS development team, led by
+ * Copyright (c) 2010,2011,2012,2014,2017, by the GROMACS development team, led by
  * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
  * and including many others, as listed in the AUTHORS file in the
  * top-level source directory and at http://www.gromacs.org.
@@ -214,6 +214,12 @@ _gmx_sel_mempool_reserve(gmx_sel_mempool_t *mp, size_t size)
     mp->freeptr  = mp->buffer;
 }
 
+size_t
+_gmx_sel_mempool_get_maxsize(gmx_sel_mempool_t *mp)
+{
+    return mp->maxsize;
+}
+
 void
 _gmx_sel_mempool_alloc_group(gmx_sel_mempool_t *mp, gmx_ana_index_t *g,
                              int isize)
@@ -1,7 +1,7 @@
 /*
  * This file is part of the GROMACS molecular simulation package.
  *
- * Copyright (c) 2010,2011,2014, by the GROMACS development team, led by
+ * Copyright (c) 2010,2011,2014,2017, by the GROMACS development team, led by
  * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
  * and including many others, as listed in the AUTHORS file in the
  * top-level source directory and at http://www.gromacs.org.
@@ -70,6 +70,9 @@ _gmx_sel_mempool_free(gmx_sel_mempool_t *mp, void *ptr);
 /** Set the size of a memory pool. */
 void
 _gmx_sel_mempool_reserve(gmx_sel_mempool_t *mp, size_t size);
+/** Get the largest number of bytes allocated simultaneously before reserving. */
+size_t
+_gmx_sel_mempool_get_maxsize(gmx_sel_mempool_t *mp);
 
 /** Convenience function for allocating an index group from a memory pool. */
 void
@@ -1,7 +1,7 @@
 /*
  * This file is part of the GROMACS molecular simulation package.
  *
- * Copyright (c) 2009,2010,2011,2012,2013,2014,2015,2016, by the GROMACS development team, led by
+ * Copyright (c) 2009,2010,2011,2012,2013,2014,2015,2016,2017, by the GROMACS development team, led by
  * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
  * and including many others, as listed in the AUTHORS file in the
  * top-level source directory and at http://www.gromacs.org.
@@ -38,10 +38,16 @@
  *
  * High-level overview of the algorithm is at \ref page_analysisnbsearch.
  *
+ * The reference positions on the grid are sorted by cell into contiguous
+ * coordinate arrays, and each cell is padded to a multiple of the SIMD width.
+ * Each such cluster of positions has a bounding box, which is used to skip
+ * clusters (and thereby cells) that are completely outside the cutoff sphere,
+ * and the distances to the positions in a cluster are computed with SIMD.
+ * The cluster test only serves as a filter: the distances of the returned
+ * pairs are always computed with the same scalar expressions.
+ *
  * \todo
  * The grid implementation could still be optimized in several different ways:
- *   - Pruning grid cells from the search list if they are completely outside
- *     the sphere that is being considered.
  *   - A better heuristic could be added for falling back to simple loops for a
  *     small number of reference particles.
  *   - A better heuristic for selecting the grid size.
@@ -66,7 +72,9 @@
 #include "gromacs/math/vec.h"
 #include "gromacs/pbcutil/pbc.h"
 #include "gromacs/selection/position.h"
+#include "gromacs/simd/simd.h"
 #include "gromacs/topology/block.h"
+#include "gromacs/utility/alignedallocator.h"
 #include "gromacs/utility/arrayref.h"
 #include "gromacs/utility/exceptions.h"
 #include "gromacs/utility/gmxassert.h"
@@ -79,30 +87,44 @@ namespace gmx
 namespace
 {
 
+#if GMX_SIMD_HAVE_REAL
+//! Number of reference positions in a cluster that are tested together.
+const int  c_clusterSize = GMX_SIMD_REAL_WIDTH;
+#else
+//! Number of reference positions in a cluster that are tested together.
+const int  c_clusterSize = 4;
+#endif
+//! Coordinate used for padding clusters; never within the cutoff.
+const real c_clusterPaddingCoordinate = 1e10;
+
 /*! \brief
  * Computes the bounding box for a set of positions.
  *
- * \param[in]  posCount Number of positions in \p x.
+ * \param[in]  posCount Number of positions.
  * \param[in]  x        Positions to compute the bounding box for.
+ * \param[in]  indices  Indices of the positions in \p x, or NULL if the
+ *     first \p posCount positions of \p x are used.
  * \param[out] origin   Origin of the bounding box.
  * \param[out] size     Size of the bounding box.
  */
-void computeBoundingBox(int posCount, const rvec x[], rvec origin, rvec size)
+void computeBoundingBox(int posCount, const rvec x[], const int indices[],
+                        rvec origin, rvec size)
 {
     rvec maxBound;
-    copy_rvec(x[0], origin);
-    copy_rvec(x[0], maxBound);
+    copy_rvec(x[indices != NULL ? indices[0] : 0], origin);
+    copy_rvec(origin, maxBound);
     for (int i = 1; i < posCount; ++i)
     {
+        const int ii = (indices != NULL) ? indices[i] : i;
         for (int d = 0; d < DIM; ++d)
         {
-            if (origin[d] > x[i][d])
+            if (origin[d] > x[ii][d])
             {
-                origin[d] = x[i][d];
+                origin[d] = x[ii][d];
             }
-            if (maxBound[d] < x[i][d])
+            if (maxBound[d] < x[ii][d])
             {
-                maxBound[d] = x[i][d];
+                maxBound[d] = x[ii][d];
             }
         }
     }
@@ -124,7 +146,7 @@ class AnalysisNeighborhoodSearchImpl
         typedef AnalysisNeighborhoodPairSearch::ImplPointer
             PairSearchImplPointer;
         typedef std::vector<PairSearchImplPointer> PairSearchList;
-        typedef std::vector<std::vector<int> > CellList;
+        typedef std::vector<real, AlignedAllocator<real> > ClusterCoordinateList;
 
         explicit AnalysisNeighborhoodSearchImpl(real cutoff);
         ~AnalysisNeighborhoodSearchImpl();
@@ -172,13 +194,15 @@ class AnalysisNeighborhoodSearchImpl
          * Sets ua a search grid for a given box.
          *
          * \param[in] pbc      Information about the box.
-         * \param[in] posCount Number of positions in \p x.
+         * \param[in] posCount Number of positions.
          * \param[in] x        Reference positions that will be put on the grid.
+         * \param[in] indices  Indices of the positions in \p x, or NULL.
          * \param[in] bForce   If `true`, grid searching will be used if at all
          *     possible, even if a simple search might give better performance.
          * \returns   `false` if grid search is not suitable.
          */
-        bool initGrid(const t_pbc &pbc, int posCount, const rvec x[], bool bForce);
+        bool initGrid(const t_pbc &pbc, int posCount, const rvec x[],
+                      const int indices[], bool bForce);
         /*! \brief
          * Maps a point into a grid cell.
          *
@@ -199,16 +223,37 @@ class AnalysisNeighborhoodSearchImpl
          */
         int getGridCellIndex(const ivec cell) const;
         /*! \brief
-         * Adds an index into a grid cell.
+         * Calculates linear index of the grid cell that contains a point.
          *
-         * \param[in]  cell Fractional cell coordinates into which \p i should
-         *     be added.
-         * \param[in]  i    Index to add.
+         * \param[in]  cell Fractional cell coordinates of the point.
+         * \returns    Linear index of the cell into which the point belongs.
          *
          * \p cell should satisfy the conditions that \p mapPointToGridCell()
-         * produces.
+         * produces.  Points outside the grid in non-periodic dimensions are
+         * put into the closest edge cell.
+         */
+        int getGridCellIndexForPoint(const rvec cell) const;
+        /*! \brief
+         * Sorts the reference positions into clusters on the grid.
+         *
+         * Uses \p xref_ and the cell indices in \p refCellIndex_.
+         * Positions within a cell retain their relative order.
+         */
+        void sortReferencesIntoClusters();
+        /*! \brief
+         * Finds candidate positions for a neighbor in a cluster.
+         *
+         * \param[in] cluster  Index of the cluster to test.
+         * \param[in] x        Test position, shifted to the periodic image
+         *     that corresponds to the cell of \p cluster.
+         * \returns   Bit mask of positions in \p cluster that may be within
+         *     the cutoff of \p x.
+         *
+         * The test uses a cutoff slightly larger than \p cutoff_ to account
+         * for rounding differences, so the distances of the candidates still
+         * need to be checked.
          */
-        void addToGridCell(const rvec cell, int i);
+        unsigned int findClusterCandidates(int cluster, const rvec x) const;
         /*! \brief
          * Initializes a cell pair loop for a dimension.
          *
@@ -305,8 +350,26 @@ class AnalysisNeighborhoodSearchImpl
         real                    cellShiftYX_;
         //! Number of cells along each dimension.
         ivec                    ncelldim_;
-        //! Data structure to hold the grid cell contents.
-        CellList                cells_;
+        //! Grid cell index of each reference position.
+        std::vector<int>        refCellIndex_;
+        /*! \brief
+         * Index of the first sorted position in each cell.
+         *
+         * Each cell starts at a cluster boundary.  Has one more element than
+         * there are cells, such that the last element is the total number of
+         * sorted positions, including padding.
+         */
+        std::vector<int>        cellStart_;
+        //! Number of reference positions in each cell (excluding padding).
+        std::vector<int>        cellCount_;
+        //! Reference position index of each sorted position (-1 for padding).
+        std::vector<int>        sortedRefIndex_;
+        //! Sorted reference positions, separately for each dimension.
+        ClusterCoordinateList   sortedX_[DIM];
+        //! Bounding box of each cluster (lower corner, then upper corner).
+        std::vector<real>       clusterBounds_;
+        //! Squared cutoff used in the cluster test (slightly larger than cutoff2_).
+        real                    clusterCutoff2_;
 
         Mutex                   createPairSearchMutex_;
         PairSearchList          pairSearchList_;
@@ -337,6 +400,13 @@ class AnalysisNeighborhoodPairSearchImpl
 
         //! Initializes a search to find reference positions neighboring \p x.
         void startSearch(const AnalysisNeighborhoodPositions &positions);
+        /*! \brief
+         * Initializes a search for a range of test positions.
+         *
+         * Only the positions `[begin, end)` in \p positions are searched.
+         */
+        void startSearch(const AnalysisNeighborhoodPositions &positions,
+                         int begin, int end);
         //! Searches for the next neighbor.
         template <class Action>
         bool searchNext(Action action);
@@ -344,6 +414,8 @@ class AnalysisNeighborhoodPairSearchImpl
         void initFoundPair(AnalysisNeighborhoodPair *pair) const;
         //! Advances to the next test position, skipping any remaining pairs.
         void nextTestPosition();
+        //! Returns the index of the test position currently being searched.
+        int currentTestIndex() const { return testIndex_; }
 
     private:
         //! Clears the loop indices.
@@ -385,6 +457,10 @@ class AnalysisNeighborhoodPairSearchImpl
         ivec                                    cellBound_;
         //! Stores the index within the current cell during pair loops.
         int                                     prevcai_;
+        //! Stores the cluster for which \p clusterMask_ is valid (-1 if none).
+        int                                     clusterIndex_;
+        //! Stores the candidate positions in the current cluster.
+        unsigned int                            clusterMask_;
 
         GMX_DISALLOW_COPY_AND_ASSIGN(AnalysisNeighborhoodPairSearchImpl);
 };
@@ -423,6 +499,7 @@ AnalysisNeighborhoodSearchImpl::AnalysisNeighborhoodSearchImpl(real cutoff)
     clear_rvec(cellSize_);
     clear_rvec(invCellSize_);
     clear_ivec(ncelldim_);
+    clusterCutoff2_ = cutoff2_;
 }
 
 AnalysisNeighborhoodSearchImpl::~AnalysisNeighborhoodSearchImpl()
@@ -583,22 +660,14 @@ bool AnalysisNeighborhoodSearchImpl::initGridCells(
     {
         return false;
     }
-    // Never decrease the size of the cell vector to avoid reallocating
-    // memory for the nested vectors.  The actual size of the vector is not
-    // used outside this function.
-    if (cells_.size() < static_cast<size_t>(totalCellCount))
-    {
-        cells_.resize(totalCellCount);
-    }
-    for (int ci = 0; ci < totalCellCount; ++ci)
-    {
-        cells_[ci].clear();
-    }
+    cellStart_.resize(totalCellCount + 1);
+    cellCount_.resize(totalCellCount);
     return true;
 }
 
 bool AnalysisNeighborhoodSearchImpl::initGrid(
-        const t_pbc &pbc, int posCount, const rvec x[], bool bForce)
+        const t_pbc &pbc, int posCount, const rvec x[], const int indices[],
+        bool bForce)
 {
     if (posCount == 0)
     {
@@ -634,7 +703,7 @@ bool AnalysisNeighborhoodSearchImpl::initGrid(
     // dimensions as well if the bounding box is sufficiently far from the box
     // edges.
     rvec   origin, boundingBoxSize;
-    computeBoundingBox(posCount, x, origin, boundingBoxSize);
+    computeBoundingBox(posCount, x, indices, origin, boundingBoxSize);
     clear_rvec(gridOrigin_);
     for (int dd = 0; dd < DIM; ++dd)
     {
@@ -725,7 +794,7 @@ int AnalysisNeighborhoodSearchImpl::getGridCellIndex(const ivec cell) const
            + cell[ZZ] * ncelldim_[XX] * ncelldim_[YY];
 }
 
-void AnalysisNeighborhoodSearchImpl::addToGridCell(const rvec cell, int i)
+int AnalysisNeighborhoodSearchImpl::getGridCellIndexForPoint(const rvec cell) const
 {
     ivec icell;
     for (int dd = 0; dd < DIM; ++dd)
@@ -745,8 +814,149 @@ void AnalysisNeighborhoodSearchImpl::addToGridCell(const rvec cell, int i)
         }
         icell[dd] = cellIndex;
     }
-    const int ci = getGridCellIndex(icell);
-    cells_[ci].push_back(i);
+    return getGridCellIndex(icell);
+}
+
+void AnalysisNeighborhoodSearchImpl::sortReferencesIntoClusters()
+{
+    const int cellCount = static_cast<int>(cellCount_.size());
+    std::fill(cellCount_.begin(), cellCount_.end(), 0);
+    for (int i = 0; i < nref_; ++i)
+    {
+        ++cellCount_[refCellIndex_[i]];
+    }
+    int sortedCount = 0;
+    for (int ci = 0; ci < cellCount; ++ci)
+    {
+        cellStart_[ci] = sortedCount;
+        sortedCount   += (cellCount_[ci] + c_clusterSize - 1)
+            / c_clusterSize * c_clusterSize;
+    }
+    cellStart_[cellCount] = sortedCount;
+
+    sortedRefIndex_.assign(sortedCount, -1);
+    for (int d = 0; d < DIM; ++d)
+    {
+        sortedX_[d].assign(sortedCount, c_clusterPaddingCoordinate);
+    }
+    // Positions are added in increasing index order, which keeps the
+    // exclusion IDs ascending within each cell.
+    std::fill(cellCount_.begin(), cellCount_.end(), 0);
+    for (int i = 0; i < nref_; ++i)
+    {
+        const int ci = refCellIndex_[i];
+        const int si = cellStart_[ci] + cellCount_[ci];
+        ++cellCount_[ci];
+        sortedRefIndex_[si] = i;
+        for (int d = 0; d < DIM; ++d)
+        {
+            sortedX_[d][si] = xref_[i][d];
+        }
+    }
+
+    // Positions outside the grid in non-periodic dimensions and the
+    // shifts applied during the search can make the coordinates large
+    // compared to the cutoff, so the margin for rounding scales with them.
+    real maxCoordinate = 0;
+    for (int i = 0; i < nref_; ++i)
+    {
+        for (int d = 0; d < DIM; ++d)
+        {
+            maxCoordinate = std::max(maxCoordinate, std::fabs(xref_[i][d]));
+        }
+    }
+    for (int d = 0; d < DIM; ++d)
+    {
+        for (int dd = 0; dd < DIM; ++dd)
+        {
+            maxCoordinate += std::fabs(pbc_.box[d][dd]);
+        }
+    }
+    const real margin = 8*GMX_REAL_EPS*(maxCoordinate + cutoff_);
+    clusterCutoff2_ = gmx::square(cutoff_ + margin) * (1 + 8*GMX_REAL_EPS);
+
+    const int clusterCount = sortedCount / c_clusterSize;
+    clusterBounds_.resize(2*DIM*clusterCount);
+    for (int c = 0; c < clusterCount; ++c)
+    {
+        real *bounds = &clusterBounds_[2*DIM*c];
+        for (int d = 0; d < DIM; ++d)
+        {
+            bounds[d]       = GMX_REAL_MAX;
+            bounds[DIM + d] = -GMX_REAL_MAX;
+        }
+        for (int si = c*c_clusterSize; si < (c + 1)*c_clusterSize; ++si)
+        {
+            if (sortedRefIndex_[si] < 0)
+            {
+                break;
+            }
+            for (int d = 0; d < DIM; ++d)
+            {
+                bounds[d]       = std::min(bounds[d], sortedX_[d][si]);
+                bounds[DIM + d] = std::max(bounds[DIM + d], sortedX_[d][si]);
+            }
+        }
+    }
+}
+
+unsigned int
+AnalysisNeighborhoodSearchImpl::findClusterCandidates(int cluster, const rvec x) const
+{
+    const real *bounds   = &clusterBounds_[2*DIM*cluster];
+    const int   dimCount = bXY_ ? ZZ : DIM;
+    real        d2       = 0;
+    for (int d = 0; d < dimCount; ++d)
+    {
+        const real dist = std::max(bounds[d] - x[d], x[d] - bounds[DIM + d]);
+        if (dist > 0)
+        {
+            d2 += dist*dist;
+        }
+    }
+    if (d2 > clusterCutoff2_)
+    {
+        return 0;
+    }
+
+    const int offset = cluster*c_clusterSize;
+#if GMX_SIMD_HAVE_REAL
+    const SimdReal xr  = load(&sortedX_[XX][offset]);
+    const SimdReal yr  = load(&sortedX_[YY][offset]);
+    const SimdReal dx  = xr - SimdReal(x[XX]);
+    const SimdReal dy  = yr - SimdReal(x[YY]);
+    SimdReal       rsq = dx * dx + dy * dy;
+    if (!bXY_)
+    {
+        const SimdReal zr = load(&sortedX_[ZZ][offset]);
+        const SimdReal dz = zr - SimdReal(x[ZZ]);
+        rsq = rsq + dz * dz;
+    }
+    GMX_ALIGNED(real, c_clusterSize) r2[c_clusterSize];
+    store(r2, rsq);
+#else
+    real r2[c_clusterSize];
+    for (int l = 0; l < c_clusterSize; ++l)
+    {
+        const real dx = sortedX_[XX][offset + l] - x[XX];
+        const real dy = sortedX_[YY][offset + l] - x[YY];
+        r2[l] = dx*dx + dy*dy;
+        if (!bXY_)
+        {
+            const real dz = sortedX_[ZZ][offset + l] - x[ZZ];
+            r2[l] += dz*dz;
+        }
+    }
+#endif
+    unsigned int mask = 0;
+    for (int l = 0; l < c_clusterSize; ++l)
+    {
+        if (r2[l] <= clusterCutoff2_)
+        {
+            mask |= 1U << l;
+        }
+    }
+    return mask;
 }
 
 void AnalysisNeighborhoodSearchImpl::initCellRange(
@@ -801,13 +1011,20 @@ void AnalysisNeighborhoodSearchImpl::initCellRange(
     // For non-periodic dimensions, clamp to the actual grid edges.
     if (!bGridPBC_[dim])
     {
-        // If endOffset < 0 or startOffset > N, these may cause the whole
+        // If endOffset < 0 or startOffset >= N, these may cause the whole
         // test position/grid plane/grid row to be skipped.
+        // The starting cell still needs to be within the grid, since it is
+        // accessed before the bounds are checked.
+        const int cellCount = ncelldim_[dim];
         if (startOffset < 0)
         {
             startOffset = 0;
         }
-        const int cellCount = ncelldim_[dim];
+        else if (startOffset >= cellCount)
+        {
+            startOffset = cellCount - 1;
+            endOffset   = cellCount - 2;
+        }
         if (endOffset > cellCount - 1)
         {
             endOffset = cellCount - 1;
@@ -921,7 +1138,7 @@ void AnalysisNeighborhoodSearchImpl::init(
     }
     else if (bTryGrid_)
     {
-        bGrid_ = initGrid(pbc_, positions.count_, positions.x_,
+        bGrid_ = initGrid(pbc_, positions.count_, positions.x_, positions.indices_,
                           mode == AnalysisNeighborhood::eSearchMode_Grid);
     }
     refIndices_ = positions.indices_;
@@ -929,14 +1146,16 @@ void AnalysisNeighborhoodSearchImpl::init(
     {
         xrefAlloc_.resize(nref_);
         xref_ = as_rvec_array(xrefAlloc_.data());
+        refCellIndex_.resize(nref_);
 
         for (int i = 0; i < nref_; ++i)
         {
             const int ii = (refIndices_ != NULL) ? refIndices_[i] : i;
             rvec      refcell;
             mapPointToGridCell(positions.x_[ii], refcell, xrefAlloc_[i]);
-            addToGridCell(refcell, i);
+            refCellIndex_[i] = getGridCellIndexForPoint(refcell);
         }
+        sortReferencesIntoClusters();
     }
     else if (refIndices_ != NULL)
     {
@@ -1006,6 +1225,8 @@ void AnalysisNeighborhoodPairSearchImpl::reset(int testIndex)
     clear_rvec(prevdx_);
     exclind_   = 0;
     prevcai_   = -1;
+    clusterIndex_ = -1;
+    clusterMask_  = 0;
 }
 
 void AnalysisNeighborhoodPairSearchImpl::nextTestPosition()
@@ -1059,6 +1280,18 @@ void AnalysisNeighborhoodPairSearchImpl::startSearch(
     }
 }
 
+void AnalysisNeighborhoodPairSearchImpl::startSearch(
+        const AnalysisNeighborhoodPositions &positions, int begin, int end)
+{
+    GMX_RELEASE_ASSERT(positions.index_ < 0,
+                       "Individual indexed positions not supported with a range");
+    GMX_RELEASE_ASSERT(begin >= 0 && begin <= end && end <= positions.count_,
+                       "Invalid test position range");
+    startSearch(positions);
+    testPosCount_ = end;
+    reset(begin);
+}
+
 template <class Action>
 bool AnalysisNeighborhoodPairSearchImpl::searchNext(Action action)
 {
@@ -1071,11 +1304,36 @@ bool AnalysisNeighborhoodPairSearchImpl::searchNext(Action action)
             do
             {
                 rvec      shift;
-                const int ci       = search_.shiftCell(currCell_, shift);
-                const int cellSize = static_cast<int>(search_.cells_[ci].size());
+                const int ci        = search_.shiftCell(currCell_, shift);
+                const int cellStart = search_.cellStart_[ci];
+                const int cellSize  = search_.cellCount_[ci];
+                rvec      xshifted;
+                rvec_add(xtest_, shift, xshifted);
                 for (; cai < cellSize; ++cai)
                 {
-                    const int i = search_.cells_[ci][cai];
+                    const int si      = cellStart + cai;
+                    const int cluster = si / c_clusterSize;
+                    if (cluster != clusterIndex_)
+                    {
+                        clusterIndex_ = cluster;
+                        clusterMask_  = search_.findClusterCandidates(cluster, xshifted);
+                    }
+                    // Skip directly to the next candidate in the cluster,
+                    // or to the last position of the cluster if none.
+                    unsigned int remaining = clusterMask_ >> (si % c_clusterSize);
+                    if (remaining == 0)
+                    {
+                        cai = (cluster + 1)*c_clusterSize - 1 - cellStart;
+                        continue;
+                    }
+                    while (!(remaining & 1U))
+                    {
+                        remaining >>= 1;
+                        ++cai;
+                    }
+                    // Padding positions are never candidates, so cai is
+                    // still within the cell.
+                    const int i = search_.sortedRefIndex_[cellStart + cai];
                     if (isExcluded(i))
                     {
                         continue;
@@ -1099,8 +1357,9 @@ bool AnalysisNeighborhoodPairSearchImpl::searchNext(Action action)
                         }
                     }
                 }
-                exclind_ = 0;
-                cai      = 0;
+                exclind_      = 0;
+                cai           = 0;
+                clusterIndex_ = -1;
             }
             while (search_.nextCell(testcell_, currCell_, cellBound_));
         }
@@ -1225,6 +1484,47 @@ class MindistAction
         GMX_DISALLOW_ASSIGN(MindistAction);
 };
 
+/*! \brief
+ * Search action to collect all pairs into a list.
+ *
+ * Used as the action for AnalysisNeighborhoodPairSearchImpl::searchNext() to
+ * find all pairs at once.
+ *
+ * With this action, AnalysisNeighborhoodPairSearchImpl::searchNext() always
+ * returns false, and all the found pairs are added to the list passed to the
+ * constructor.
+ */
+class PairListAction
+{
+    public:
+        /*! \brief
+         * Initializes the action.
+         *
+         * \param[in]  search  Search that this action is used with.
+         * \param[out] pairs   List that receives the found pairs.
+         */
+        PairListAction(const internal::AnalysisNeighborhoodPairSearchImpl &search,
+                       AnalysisNeighborhoodPairList                       *pairs)
+            : search_(search), pairs_(*pairs)
+        {
+        }
+        //! Copies the action.
+        PairListAction(const PairListAction &)          = default;
+
+        //! Adds a neighbor to the list.
+        bool operator()(int i, real r2, const rvec dx)
+        {
+            pairs_.addPair(i, search_.currentTestIndex(), r2, dx);
+            return false;
+        }
+
+    private:
+        const internal::AnalysisNeighborhoodPairSearchImpl &search_;
+        AnalysisNeighborhoodPairList                       &pairs_;
+
+        GMX_DISALLOW_ASSIGN(PairListAction);
+};
+
 }   // namespace
 
 /********************************************************************
@@ -1396,6 +1696,30 @@ AnalysisNeighborhoodSearch::nearestPoint(
     return AnalysisNeighborhoodPair(closestPoint, 0, minDist2, dx);
 }
 
+void AnalysisNeighborhoodSearch::findPairs(
+        const AnalysisNeighborhoodPositions &positions,
+        AnalysisNeighborhoodPairList        *pairs) const
+{
+    GMX_RELEASE_ASSERT(impl_, "Accessing an invalid search object");
+    pairs->clear();
+    internal::AnalysisNeighborhoodPairSearchImpl pairSearch(*impl_);
+    pairSearch.startSearch(positions);
+    PairListAction action(pairSearch, pairs);
+    (void)pairSearch.searchNext(action);
+}
+
+void AnalysisNeighborhoodSearch::findPairs(
+        const AnalysisNeighborhoodPositions &positions, int begin, int end,
+        AnalysisNeighborhoodPairList        *pairs) const
+{
+    GMX_RELEASE_ASSERT(impl_, "Accessing an invalid search object");
+    pairs->clear();
+    internal::AnalysisNeighborhoodPairSearchImpl pairSearch(*impl_);
+    pairSearch.startSearch(positions, begin, end);
+    PairListAction action(pairSearch, pairs);
+    (void)pairSearch.searchNext(action);
+}
+
 AnalysisNeighborhoodPairSearch
 AnalysisNeighborhoodSearch::startPairSearch(
         const AnalysisNeighborhoodPositions &positions) const
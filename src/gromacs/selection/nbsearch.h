@@ -1,7 +1,7 @@
 /*
  * This file is part of the GROMACS molecular simulation package.
  *
- * Copyright (c) 2009,2010,2011,2012,2013,2014,2015, by the GROMACS development team, led by
+ * Copyright (c) 2009,2010,2011,2012,2013,2014,2015,2017, by the GROMACS development team, led by
  * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
  * and including many others, as listed in the AUTHORS file in the
  * top-level source directory and at http://www.gromacs.org.
@@ -392,6 +392,78 @@ class AnalysisNeighborhoodPair
         rvec                    dx_;
 };
 
+/*! \brief
+ * Buffer for a set of pairs found in neighborhood searching.
+ *
+ * Stores the pairs as separate arrays of reference indices, test indices,
+ * squared distances and distance vectors, such that the caller can process
+ * all the pairs in simple loops.  The indices have the same meaning as in
+ * AnalysisNeighborhoodPair.
+ *
+ * The buffer is filled by AnalysisNeighborhoodSearch::findPairs(), and can be
+ * reused for multiple calls to avoid repeated memory allocation.
+ *
+ * \inpublicapi
+ * \ingroup module_selection
+ */
+class AnalysisNeighborhoodPairList
+{
+    public:
+        //! Returns the number of pairs in the list.
+        int size() const { return static_cast<int>(refIndices_.size()); }
+        //! Whether the list is empty.
+        bool empty() const { return refIndices_.empty(); }
+
+        //! Returns the reference index for each pair.
+        ConstArrayRef<int> refIndices() const { return refIndices_; }
+        //! Returns the test index for each pair.
+        ConstArrayRef<int> testIndices() const { return testIndices_; }
+        //! Returns the squared distance for each pair.
+        ConstArrayRef<real> distances2() const { return distances2_; }
+        /*! \brief
+         * Returns the shortest vector for each pair.
+         *
+         * The vectors are from the test position to the reference position.
+         */
+        ConstArrayRef<RVec> dx() const { return dx_; }
+        //! Returns a single pair from the list.
+        AnalysisNeighborhoodPair pair(int i) const
+        {
+            GMX_ASSERT(i >= 0 && i < size(), "Pair index out of range");
+            return AnalysisNeighborhoodPair(refIndices_[i], testIndices_[i],
+                                            distances2_[i], dx_[i]);
+        }
+
+        //! Removes all pairs from the list, retaining the allocated memory.
+        void clear()
+        {
+            refIndices_.clear();
+            testIndices_.clear();
+            distances2_.clear();
+            dx_.clear();
+        }
+        /*! \brief
+         * Adds a pair to the list.
+         *
+         * \throws std::bad_alloc if out of memory.
+         *
+         * Used by AnalysisNeighborhoodSearch::findPairs().
+         */
+        void addPair(int refIndex, int testIndex, real distance2, const rvec dx)
+        {
+            refIndices_.push_back(refIndex);
+            testIndices_.push_back(testIndex);
+            distances2_.push_back(distance2);
+            dx_.push_back(RVec(dx));
+        }
+
+    private:
+        std::vector<int>        refIndices_;
+        std::vector<int>        testIndices_;
+        std::vector<real>       distances2_;
+        std::vector<RVec>       dx_;
+};
+
 /*! \brief
  * Initialized neighborhood search with a fixed set of reference positions.
  *
@@ -400,7 +472,8 @@ class AnalysisNeighborhoodPair
  * against the provided set of reference positions.
  * It is possible to create concurrent pair searches (including from different
  * threads), as well as call other methods in this class while a pair search is
- * in progress.
+ * in progress.  For processing pairs in parallel, findPairs() returns all
+ * pairs for a block of test positions at once.
  *
  * This class works like a pointer: copies of it point to the same search.
  * In general, avoid creating copies, and only use the copy/assignment support
@@ -509,6 +582,44 @@ class AnalysisNeighborhoodSearch
          */
         AnalysisNeighborhoodPairSearch
         startPairSearch(const AnalysisNeighborhoodPositions &positions) const;
+        /*! \brief
+         * Finds all reference positions within the cutoff from a set of test
+         * positions.
+         *
+         * \param[in]  positions  Set of test positions to use.
+         * \param[out] pairs      Buffer that receives all pairs within the
+         *     cutoff.  Any earlier contents are cleared.
+         * \throws     std::bad_alloc if out of memory.
+         *
+         * The pairs are stored in the same order in which
+         * AnalysisNeighborhoodPairSearch::findNextPair() would return them.
+         * Unlike startPairSearch(), this method does not keep any state in the
+         * search object, so it can be called concurrently from multiple
+         * threads as long as each thread uses its own \p pairs.
+         */
+        void findPairs(const AnalysisNeighborhoodPositions &positions,
+                       AnalysisNeighborhoodPairList        *pairs) const;
+        /*! \brief
+         * Finds all reference positions within the cutoff from a block of
+         * test positions.
+         *
+         * \param[in]  positions  Set of test positions to use.
+         * \param[in]  begin      Index of the first test position to search.
+         * \param[in]  end        Index after the last test position to search.
+         * \param[out] pairs      Buffer that receives all pairs within the
+         *     cutoff.  Any earlier contents are cleared.
+         * \throws     std::bad_alloc if out of memory.
+         *
+         * Works as findPairs() above, but only searches the test positions
+         * `[begin, end)`.  The test indices in \p pairs are still indices
+         * into \p positions.  This makes it possible to divide the test
+         * positions into blocks that are processed in different threads.
+         * The input positions cannot use
+         * AnalysisNeighborhoodPositions::selectSingleFromArray().
+         */
+        void findPairs(const AnalysisNeighborhoodPositions &positions,
+                       int begin, int end,
+                       AnalysisNeighborhoodPairList        *pairs) const;
 
     private:
         typedef internal::AnalysisNeighborhoodSearchImpl Impl;
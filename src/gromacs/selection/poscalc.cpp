@@ -1,7 +1,7 @@
 /*
  * This file is part of the GROMACS molecular simulation package.
  *
- * Copyright (c) 2009,2010,2011,2012,2013,2014,2015,2016, by the GROMACS development team, led by
+ * Copyright (c) 2009,2010,2011,2012,2013,2014,2015,2016,2017, by the GROMACS development team, led by
  * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
  * and including many others, as listed in the AUTHORS file in the
  * top-level source directory and at http://www.gromacs.org.
@@ -722,6 +722,20 @@ void PositionCalculationCollection::initFrame(const t_trxframe *fr)
     }
 }
 
+void PositionCalculationCollection::updateSharedCalculations(t_trxframe  *fr,
+                                                             const t_pbc *pbc)
+{
+    gmx_ana_poscalc_t *pc = impl_->first_;
+    while (pc)
+    {
+        if (pc->sbase)
+        {
+            gmx_ana_poscalc_update(pc->sbase, NULL, NULL, fr, pbc);
+        }
+        pc = pc->next;
+    }
+}
+
 } // namespace gmx
 
 /*! \brief
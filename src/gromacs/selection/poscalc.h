@@ -1,7 +1,7 @@
 /*
  * This file is part of the GROMACS molecular simulation package.
  *
- * Copyright (c) 2009,2010,2011,2012,2013,2014,2015,2016, by the GROMACS development team, led by
+ * Copyright (c) 2009,2010,2011,2012,2013,2014,2015,2016,2017, by the GROMACS development team, led by
  * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
  * and including many others, as listed in the AUTHORS file in the
  * top-level source directory and at http://www.gromacs.org.
@@ -166,6 +166,11 @@ namespace gmx
  * The position evaluation is simple: initFrame() should be
  * called once for each frame, and gmx_ana_poscalc_update() can then be called
  * for each calculation that is needed for that frame.
+ * Calculations in the same collection may share internal data, so
+ * gmx_ana_poscalc_update() should not be called concurrently from multiple
+ * threads, unless updateSharedCalculations() has first been called for the
+ * frame.  After that, calculations that are not otherwise shared can be
+ * updated concurrently.
  *
  * It is also possible to initialize the calculations based on a type provided
  * as a string.
@@ -335,6 +340,20 @@ class PositionCalculationCollection
          * future.
          */
         void initFrame(const t_trxframe *fr);
+        /*! \brief
+         * Evaluates calculations that are shared by other calculations.
+         *
+         * \param[in] fr  Current frame.
+         * \param[in] pbc PBC data, or NULL if no PBC should be used.
+         *
+         * Should be called after initFrame().
+         * Evaluates positions that gmx_ana_poscalc_update() otherwise
+         * evaluates on demand, such that later gmx_ana_poscalc_update()
+         * calls for this frame only read the shared data.
+         *
+         * Does not throw.
+         */
+        void updateSharedCalculations(t_trxframe *fr, const t_pbc *pbc);
 
     private:
         class Impl;
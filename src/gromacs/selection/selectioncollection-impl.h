@@ -1,7 +1,7 @@
 /*
  * This file is part of the GROMACS molecular simulation package.
  *
- * Copyright (c) 2009,2010,2011,2012,2013,2014,2015,2016, by the GROMACS development team, led by
+ * Copyright (c) 2009,2010,2011,2012,2013,2014,2015,2016,2017, by the GROMACS development team, led by
  * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
  * and including many others, as listed in the AUTHORS file in the
  * top-level source directory and at http://www.gromacs.org.
@@ -105,6 +105,20 @@ struct gmx_ana_selcollection_t
     gmx_ana_index_t                                    gall;
     /** Memory pool used for selection evaluation. */
     gmx_sel_mempool_t                                 *mempool;
+    /*! \brief
+     * Root elements evaluated by each thread in parallel evaluation.
+     *
+     * Each list is in the order of the \a root chain, and roots that share
+     * subexpressions are always in the same list.
+     * Empty if the selections are evaluated serially.
+     */
+    std::vector<std::vector<gmx::SelectionTreeElementPointer> > threadRoots;
+    /*! \brief
+     * Memory pool for each thread in parallel evaluation.
+     *
+     * The first pool is \a mempool; the others are owned by the collection.
+     */
+    std::vector<gmx_sel_mempool_t *>                   threadMempools;
     //! Parser symbol table.
     // Never releases ownership.
     std::unique_ptr<gmx::SelectionParserSymbolTable>   symtab;
@@ -1,7 +1,7 @@
 /*
  * This file is part of the GROMACS molecular simulation package.
  *
- * Copyright (c) 2010,2011,2012,2013,2014,2015,2016, by the GROMACS development team, led by
+ * Copyright (c) 2010,2011,2012,2013,2014,2015,2016,2017, by the GROMACS development team, led by
  * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
  * and including many others, as listed in the AUTHORS file in the
  * top-level source directory and at http://www.gromacs.org.
@@ -102,6 +102,7 @@ SelectionCollection::Impl::~Impl()
     clearSymbolTable();
     // The tree must be freed before the SelectionData objects, since the
     // tree may hold references to the position data in SelectionData.
+    sc_.threadRoots.clear();
     sc_.root.reset();
     sc_.sel.clear();
     for (int i = 0; i < sc_.nvars; ++i)
@@ -114,6 +115,10 @@ SelectionCollection::Impl::~Impl()
     {
         _gmx_sel_mempool_destroy(sc_.mempool);
     }
+    for (size_t i = 1; i < sc_.threadMempools.size(); ++i)
+    {
+        _gmx_sel_mempool_destroy(sc_.threadMempools[i]);
+    }
     gmx_ana_index_deinit(&requiredAtoms_);
 }
 
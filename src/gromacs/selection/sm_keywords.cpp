@@ -1,7 +1,7 @@
 /*
  * This file is part of the GROMACS molecular simulation package.
  *
- * Copyright (c) 2009,2010,2011,2012,2013,2014,2015,2016, by the GROMACS development team, led by
+ * Copyright (c) 2009,2010,2011,2012,2013,2014,2015,2016,2017, by the GROMACS development team, led by
  * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
  * and including many others, as listed in the AUTHORS file in the
  * top-level source directory and at http://www.gromacs.org.
@@ -609,6 +609,31 @@ _gmx_selelem_set_kwstr_match_type(const gmx::SelectionTreeElementPointer &sel,
     d->matchType = matchType;
 }
 
+bool
+_gmx_selelem_is_keyword_data_equal(const gmx::SelectionTreeElement &sel1,
+                                   const gmx::SelectionTreeElement &sel2)
+{
+    if (sel1.type != SEL_EXPRESSION || !sel1.u.expr.method
+        || sel2.type != SEL_EXPRESSION || !sel2.u.expr.method)
+    {
+        return true;
+    }
+    const gmx_ana_selmethod_t *method1 = sel1.u.expr.method;
+    const gmx_ana_selmethod_t *method2 = sel2.u.expr.method;
+    if (method1->update == &evaluate_kweval || method1->update == &evaluate_kweval_pos
+        || method2->update == &evaluate_kweval || method2->update == &evaluate_kweval_pos)
+    {
+        return false;
+    }
+    if (method1->name != sm_keyword_str.name || method2->name != sm_keyword_str.name)
+    {
+        return true;
+    }
+    t_methoddata_kwstr *d1 = static_cast<t_methoddata_kwstr *>(sel1.u.expr.mdata);
+    t_methoddata_kwstr *d2 = static_cast<t_methoddata_kwstr *>(sel2.u.expr.mdata);
+    return d1->matchType == d2->matchType;
+}
+
 static void
 init_kwstr(const gmx_mtop_t * /* top */, int /* npar */, gmx_ana_selparam_t *param, void *data)
 {
@@ -1,7 +1,7 @@
 /*
  * This file is part of the GROMACS molecular simulation package.
  *
- * Copyright (c) 2009,2010,2011,2012,2013,2014,2015,2016, by the GROMACS development team, led by
+ * Copyright (c) 2009,2010,2011,2012,2013,2014,2015,2016,2017, by the GROMACS development team, led by
  * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
  * and including many others, as listed in the AUTHORS file in the
  * top-level source directory and at http://www.gromacs.org.
@@ -41,6 +41,8 @@
  */
 #include "gmxpre.h"
 
+#include <string.h>
+
 #include "gromacs/selection/indexutil.h"
 #include "gromacs/selection/position.h"
 #include "gromacs/utility/arraysize.h"
@@ -288,6 +290,28 @@ _gmx_selelem_set_kwpos_type(gmx::SelectionTreeElement *sel, const char *type)
     }
 }
 
+bool
+_gmx_selelem_is_kwpos_data_equal(const gmx::SelectionTreeElement &sel1,
+                                 const gmx::SelectionTreeElement &sel2)
+{
+    const bool bKwpos1 = (sel1.type == SEL_EXPRESSION && sel1.u.expr.method
+                          && sel1.u.expr.method->name == sm_keyword_pos.name);
+    const bool bKwpos2 = (sel2.type == SEL_EXPRESSION && sel2.u.expr.method
+                          && sel2.u.expr.method->name == sm_keyword_pos.name);
+    if (!bKwpos1 || !bKwpos2)
+    {
+        return bKwpos1 == bKwpos2;
+    }
+
+    t_methoddata_pos *d1 = static_cast<t_methoddata_pos *>(sel1.u.expr.mdata);
+    t_methoddata_pos *d2 = static_cast<t_methoddata_pos *>(sel2.u.expr.mdata);
+    if (d1->type == NULL || d2->type == NULL)
+    {
+        return false;
+    }
+    return d1->flags == d2->flags && strcmp(d1->type, d2->type) == 0;
+}
+
 /*!
  * \param[in,out] sel   Selection element to initialize.
  * \param[in]     flags Default completion flags
@@ -1,7 +1,7 @@
 /*
  * This file is part of the GROMACS molecular simulation package.
  *
- * Copyright (c) 2013,2014,2015,2016, by the GROMACS development team, led by
+ * Copyright (c) 2013,2014,2015,2016,2017, by the GROMACS development team, led by
  * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
  * and including many others, as listed in the AUTHORS file in the
  * top-level source directory and at http://www.gromacs.org.
@@ -882,6 +882,40 @@ class RandomBoxNoPBCData
         NeighborhoodSearchTestData data_;
 };
 
+class RandomBoxNoPBCOutsideData
+{
+    public:
+        static const NeighborhoodSearchTestData &get()
+        {
+            static RandomBoxNoPBCOutsideData singleton;
+            return singleton.data_;
+        }
+
+        RandomBoxNoPBCOutsideData() : data_(12345, 1.0)
+        {
+            data_.box_[XX][XX] = 10.0;
+            data_.box_[YY][YY] = 5.0;
+            data_.box_[ZZ][ZZ] = 7.0;
+            data_.generateRandomRefPositions(1000);
+            // Test positions on all sides of the grid, also further away
+            // than the cutoff.
+            const real offsets[] = { -5.0, -0.5, 0.5, 5.0 };
+            for (int i = 0; i < 100; ++i)
+            {
+                gmx::RVec  x   = data_.generateRandomPosition();
+                const real off = offsets[i % 4];
+                const int  dim = (i / 4) % DIM;
+                x[dim] += (off < 0 ? off : data_.box_[dim][dim] + off);
+                data_.addTestPosition(x);
+            }
+            set_pbc(&data_.pbc_, epbcNONE, data_.box_);
+            data_.computeReferences(NULL);
+        }
+
+    private:
+        NeighborhoodSearchTestData data_;
+};
+
 /********************************************************************
  * Actual tests
  */
@@ -951,7 +985,13 @@ TEST_F(NeighborhoodSearchTest, GridSearchTriclinic)
         nb_.initSearch(&data.pbc_, data.refPositions());
     ASSERT_EQ(gmx::AnalysisNeighborhood::eSearchMode_Grid, search.mode());
 
+    testIsWithin(&search, data);
+    testMinimumDistance(&search, data);
+    testNearestPoint(&search, data);
     testPairSearch(&search, data);
+
+    search.reset();
+    testPairSearchIndexed(&nb_, data, 321);
 }
 
 TEST_F(NeighborhoodSearchTest, GridSearch2DPBC)
@@ -981,6 +1021,25 @@ TEST_F(NeighborhoodSearchTest, GridSearchNoPBC)
     ASSERT_EQ(gmx::AnalysisNeighborhood::eSearchMode_Grid, search.mode());
 
     testPairSearch(&search, data);
+
+    search.reset();
+    testPairSearchIndexed(&nb_, data, 789);
+}
+
+TEST_F(NeighborhoodSearchTest, GridSearchNoPBCOutsideGrid)
+{
+    const NeighborhoodSearchTestData &data = RandomBoxNoPBCOutsideData::get();
+
+    nb_.setCutoff(data.cutoff_);
+    nb_.setMode(gmx::AnalysisNeighborhood::eSearchMode_Grid);
+    gmx::AnalysisNeighborhoodSearch search =
+        nb_.initSearch(&data.pbc_, data.refPositions());
+    ASSERT_EQ(gmx::AnalysisNeighborhood::eSearchMode_Grid, search.mode());
+
+    testPairSearch(&search, data);
+
+    search.reset();
+    testPairSearchIndexed(&nb_, data, 789);
 }
 
 TEST_F(NeighborhoodSearchTest, GridSearchXYBox)
@@ -1097,6 +1156,56 @@ TEST_F(NeighborhoodSearchTest, HandlesSkippingPairs)
     }
 }
 
+TEST_F(NeighborhoodSearchTest, FindsPairsInBlocks)
+{
+    const NeighborhoodSearchTestData &data = RandomBoxFullPBCData::get();
+
+    nb_.setCutoff(data.cutoff_);
+    nb_.setMode(gmx::AnalysisNeighborhood::eSearchMode_Grid);
+    gmx::AnalysisNeighborhoodSearch search =
+        nb_.initSearch(&data.pbc_, data.refPositions());
+    ASSERT_EQ(gmx::AnalysisNeighborhood::eSearchMode_Grid, search.mode());
+
+    gmx::AnalysisNeighborhoodPairList allPairs;
+    search.findPairs(data.testPositions(), &allPairs);
+    ASSERT_FALSE(allPairs.empty());
+
+    gmx::AnalysisNeighborhoodPairSearch pairSearch =
+        search.startPairSearch(data.testPositions());
+    gmx::AnalysisNeighborhoodPair       pair;
+    int count = 0;
+    while (pairSearch.findNextPair(&pair))
+    {
+        ASSERT_LT(count, allPairs.size());
+        EXPECT_EQ(pair.refIndex(), allPairs.refIndices()[count]);
+        EXPECT_EQ(pair.testIndex(), allPairs.testIndices()[count]);
+        EXPECT_EQ(pair.distance2(), allPairs.distances2()[count]);
+        EXPECT_EQ(pair.dx()[XX], allPairs.dx()[count][XX]);
+        ++count;
+    }
+    EXPECT_EQ(allPairs.size(), count);
+
+    const int                         testCount = data.testPositions_.size();
+    const int                         blockSize = 17;
+    gmx::AnalysisNeighborhoodPairList blockPairs;
+    int                               offset = 0;
+    for (int begin = 0; begin < testCount; begin += blockSize)
+    {
+        const int end = std::min(begin + blockSize, testCount);
+        search.findPairs(data.testPositions(), begin, end, &blockPairs);
+        for (int i = 0; i < blockPairs.size(); ++i)
+        {
+            ASSERT_LT(offset + i, allPairs.size());
+            EXPECT_GE(blockPairs.testIndices()[i], begin);
+            EXPECT_LT(blockPairs.testIndices()[i], end);
+            EXPECT_EQ(allPairs.refIndices()[offset + i], blockPairs.refIndices()[i]);
+            EXPECT_EQ(allPairs.testIndices()[offset + i], blockPairs.testIndices()[i]);
+        }
+        offset += blockPairs.size();
+    }
+    EXPECT_EQ(allPairs.size(), offset);
+}
+
 TEST_F(NeighborhoodSearchTest, SimpleSearchExclusions)
 {
     const NeighborhoodSearchTestData &data = RandomBoxFullPBCData::get();
@@ -1,7 +1,7 @@
 /*
  * This file is part of the GROMACS molecular simulation package.
  *
- * Copyright (c) 2010,2011,2012,2013,2014,2015,2016, by the GROMACS development team, led by
+ * Copyright (c) 2010,2011,2012,2013,2014,2015,2016,2017, by the GROMACS development team, led by
  * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
  * and including many others, as listed in the AUTHORS file in the
  * top-level source directory and at http://www.gromacs.org.
@@ -54,6 +54,7 @@
 #include "gromacs/utility/arrayref.h"
 #include "gromacs/utility/exceptions.h"
 #include "gromacs/utility/flags.h"
+#include "gromacs/utility/gmxomp.h"
 #include "gromacs/utility/gmxregex.h"
 #include "gromacs/utility/stringutil.h"
 
@@ -1668,4 +1669,51 @@ TEST_F(SelectionCollectionDataTest, HandlesVariablesWithMixedEvaluationGroups2)
 }
 
 
+TEST_F(SelectionCollectionDataTest, HandlesCommonSubexpressions)
+{
+    static const char * const selections[] = {
+        "y > 1.5 and y < 3.5",
+        "resname RA and y > 1.5",
+        "within 1 of res_cog of resnr 2",
+        "resname RA RB and within 1 of res_cog of resnr 2",
+        "within 1.5 of res_cog of resnr 2"
+    };
+    setFlags(TestFlags() | efTestEvaluation);
+    runTest("simple.gro", selections);
+}
+
+
+TEST_F(SelectionCollectionDataTest, HandlesSimilarButDifferentSubexpressions)
+{
+    static const char * const selections[] = {
+        "within 1 of res_cog of resnr 2",
+        "within 1 of part_res_cog of resnr 2",
+        "within 1 of res_cog of resnr 3",
+        "y > 1.5 and x < 2.5",
+        "y > 2.5 and x < 3.5"
+    };
+    setFlags(TestFlags() | efTestEvaluation);
+    runTest("simple.gro", selections);
+}
+
+
+TEST_F(SelectionCollectionDataTest, EvaluatesIndependentSelectionsInParallel)
+{
+    static const char * const selections[] = {
+        "foo = y < 2.5",
+        "resnr 1 and foo",
+        "resnr 2 and x > 1.5",
+        "resnr 3 and foo",
+        "res_cog of resnr 4",
+        "resnr 5 and within 1 of res_cog of resnr 4",
+        "x + y < 4"
+    };
+    setFlags(TestFlags() | efTestEvaluation | efTestPositionCoordinates);
+    const int nthreads = gmx_omp_get_max_threads();
+    gmx_omp_set_num_threads(4);
+    runTest("simple.gro", selections);
+    gmx_omp_set_num_threads(nthreads);
+}
+
+
 } // namespace
@@ -1,7 +1,7 @@
 /*
  * This file is part of the GROMACS molecular simulation package.
  *
- * Copyright (c) 2013,2014,2015,2016, by the GROMACS development team, led by
+ * Copyright (c) 2013,2014,2015,2016,2017, by the GROMACS development team, led by
  * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
  * and including many others, as listed in the AUTHORS file in the
  * top-level source directory and at http://www.gromacs.org.
@@ -43,12 +43,18 @@
 
 #include "freevolume.h"
 
+#include <cmath>
+
+#include <algorithm>
 #include <string>
+#include <vector>
 
 #include "gromacs/analysisdata/analysisdata.h"
 #include "gromacs/analysisdata/modules/average.h"
+#include "gromacs/analysisdata/modules/histogram.h"
 #include "gromacs/analysisdata/modules/plot.h"
 #include "gromacs/math/functions.h"
+#include "gromacs/math/invertmatrix.h"
 #include "gromacs/math/units.h"
 #include "gromacs/math/vec.h"
 #include "gromacs/options/basicoptions.h"
@@ -60,12 +66,15 @@
 #include "gromacs/selection/nbsearch.h"
 #include "gromacs/selection/selection.h"
 #include "gromacs/selection/selectionoption.h"
+#include "gromacs/simd/simd.h"
 #include "gromacs/topology/atomprop.h"
 #include "gromacs/topology/topology.h"
 #include "gromacs/trajectory/trajectoryframe.h"
 #include "gromacs/trajectoryanalysis/analysissettings.h"
+#include "gromacs/utility/alignedallocator.h"
 #include "gromacs/utility/arrayref.h"
 #include "gromacs/utility/exceptions.h"
+#include "gromacs/utility/gmxomp.h"
 #include "gromacs/utility/pleasecite.h"
 
 namespace gmx
@@ -77,6 +86,370 @@ namespace analysismodules
 namespace
 {
 
+#if GMX_SIMD_HAVE_REAL
+//! Number of voxels processed together in the grid construction kernel.
+const int c_voxelBatchSize = GMX_SIMD_REAL_WIDTH;
+#else
+//! Number of voxels processed together in the grid construction kernel.
+const int c_voxelBatchSize = 1;
+#endif
+
+//! Number of random probe positions generated and tested at a time.
+const int c_insertionBatchSize = 4096;
+
+/*! \brief
+ * Largest number of voxels in a grid with automatically determined spacing.
+ *
+ * Keeps the memory use bounded for large boxes.
+ */
+const size_t c_maxAutomaticVoxelCount = 1<<22;
+
+//! Aligned array of reals for use with SIMD loads and stores.
+typedef std::vector<real, AlignedAllocator<real> > AlignedRealArray;
+
+//! Returns \p index wrapped into `[0, count)`.
+int wrapIndex(int index, int count)
+{
+    index %= count;
+    return (index < 0 ? index + count : index);
+}
+
+/*! \brief
+ * Computes squared distances from a row of voxel centers to a point.
+ *
+ * \param[in]  base        Vector from the point to the first voxel center.
+ * \param[in]  step        Vector between consecutive voxel centers.
+ * \param[in]  laneOffset  Values 0, 1, ..., \c c_voxelBatchSize-1.
+ * \param[in]  count       Number of voxels in the row.
+ * \param[out] dist2       Squared distance for each voxel (padded to
+ *     a multiple of \c c_voxelBatchSize).
+ */
+void computeRowDistances(const rvec base, const rvec step,
+                         const real *laneOffset, int count, real *dist2)
+{
+#if GMX_SIMD_HAVE_REAL
+    const SimdReal baseX(base[XX]), baseY(base[YY]), baseZ(base[ZZ]);
+    const SimdReal stepX(step[XX]), stepY(step[YY]), stepZ(step[ZZ]);
+    const SimdReal offset = load(laneOffset);
+    for (int k = 0; k < count; k += c_voxelBatchSize)
+    {
+        const SimdReal index = SimdReal(static_cast<real>(k)) + offset;
+        const SimdReal dx    = fma(index, stepX, baseX);
+        const SimdReal dy    = fma(index, stepY, baseY);
+        const SimdReal dz    = fma(index, stepZ, baseZ);
+        store(dist2 + k, fma(dx, dx, fma(dy, dy, dz*dz)));
+    }
+#else
+    GMX_UNUSED_VALUE(laneOffset);
+    for (int k = 0; k < count; ++k)
+    {
+        rvec dx;
+        for (int m = 0; m < DIM; ++m)
+        {
+            dx[m] = base[m] + k*step[m];
+        }
+        dist2[k] = norm2(dx);
+    }
+#endif
+}
+
+/*! \brief
+ * Grid of voxels that classifies space by overlap with atoms.
+ *
+ * The grid covers the unit cell with voxels along the box vectors.  For each
+ * frame, each voxel is marked as fully excluded if all points in it overlap
+ * with some atom, and as near an atom if some points in it may overlap.
+ * Probe positions in voxels that are neither can be accepted without
+ * checking individual atoms, and probe positions in excluded voxels rejected.
+ * Additionally, voxels whose center overlaps with an atom are marked for the
+ * cavity analysis.
+ *
+ * \ingroup module_trajectoryanalysis
+ */
+class ExcludedVolumeGrid
+{
+    public:
+        //! Flags stored for each voxel.
+        enum VoxelFlag
+        {
+            evfExcluded       = 1<<0, //!< All points in the voxel overlap.
+            evfNear           = 1<<1, //!< Some points in the voxel may overlap.
+            evfCenterOccupied = 1<<2, //!< The voxel center overlaps.
+            evfVisited        = 1<<3  //!< Used internally in findCavities().
+        };
+
+        ExcludedVolumeGrid();
+
+        /*! \brief
+         * Sets up the grid for a box and marks all voxels free.
+         *
+         * \param[in] box           Box to cover.
+         * \param[in] spacing       Maximum voxel edge length.
+         * \param[in] maxVoxelCount If nonzero, the spacing is increased
+         *     such that the grid has at most this many voxels.
+         *
+         * The memory for the voxels is reused if the grid does not grow.
+         */
+        void init(const matrix box, real spacing, size_t maxVoxelCount);
+        /*! \brief
+         * Marks voxels that overlap with the given atoms.
+         *
+         * \param[in] sel          Atoms to mark.
+         * \param[in] vdwRadius    Radius for each atom (indexed with refId()).
+         * \param[in] probeRadius  Radius added to each atom radius.
+         * \param[in] bCenters     Whether to mark voxels whose center
+         *     overlaps (only needed for findCavities()).
+         */
+        void addAtoms(const Selection &sel, const std::vector<double> &vdwRadius,
+                      real probeRadius, bool bCenters);
+        //! Returns flags for the voxel that contains \p x.
+        int voxelFlags(const rvec x) const;
+        //! Returns the volume of a single voxel.
+        real voxelVolume() const { return det(box_) / flags_.size(); }
+        /*! \brief
+         * Finds connected regions of voxels whose centers are free.
+         *
+         * \param[out] cavitySizes  Number of voxels in each region.
+         *
+         * Voxels are connected through their faces, including across the
+         * periodic boundaries.  addAtoms() should have been called with
+         * \p bCenters set.
+         */
+        void findCavities(std::vector<int> *cavitySizes);
+
+    private:
+        //! Returns the linear index of a voxel.
+        int voxelIndex(int ix, int iy, int iz) const
+        {
+            return (iz*cellCount_[YY] + iy)*cellCount_[XX] + ix;
+        }
+
+        //! Box vectors.
+        matrix                      box_;
+        //! Inverse of \a box_ for computing fractional coordinates.
+        matrix                      invBox_;
+        //! Number of voxels along each box vector.
+        ivec                        cellCount_;
+        /*! \brief
+         * Largest distance from a voxel center to any point in the voxel.
+         *
+         * Includes a small safety margin for rounding errors.
+         */
+        real                        halfDiagonal_;
+        //! Flags (see VoxelFlag) for each voxel.
+        std::vector<unsigned char>  flags_;
+        //! Voxels still to be visited in findCavities().
+        std::vector<int>            stack_;
+        //! Values 0, 1, ..., \c c_voxelBatchSize-1 for SIMD index arithmetic.
+        AlignedRealArray            laneOffset_;
+};
+
+ExcludedVolumeGrid::ExcludedVolumeGrid()
+    : halfDiagonal_(0.0), laneOffset_(c_voxelBatchSize)
+{
+    clear_mat(box_);
+    clear_mat(invBox_);
+    clear_ivec(cellCount_);
+    for (int i = 0; i < c_voxelBatchSize; ++i)
+    {
+        laneOffset_[i] = i;
+    }
+}
+
+void ExcludedVolumeGrid::init(const matrix box, real spacing, size_t maxVoxelCount)
+{
+    copy_mat(box, box_);
+    invertBoxMatrix(box_, invBox_);
+    size_t voxelCount;
+    while (true)
+    {
+        voxelCount = 1;
+        for (int m = 0; m < DIM; ++m)
+        {
+            cellCount_[m] = std::max(1, static_cast<int>(std::ceil(norm(box_[m])/spacing)));
+            voxelCount   *= cellCount_[m];
+        }
+        if (maxVoxelCount == 0 || voxelCount <= maxVoxelCount)
+        {
+            break;
+        }
+        spacing *= 1.01*std::cbrt(static_cast<real>(voxelCount)/maxVoxelCount);
+    }
+    rvec edge[DIM];
+    for (int m = 0; m < DIM; ++m)
+    {
+        svmul(1.0/cellCount_[m], box_[m], edge[m]);
+    }
+    halfDiagonal_ = 0.0;
+    for (int sy = -1; sy <= 1; sy += 2)
+    {
+        for (int sz = -1; sz <= 1; sz += 2)
+        {
+            rvec diagonal;
+            for (int m = 0; m < DIM; ++m)
+            {
+                diagonal[m] = edge[XX][m] + sy*edge[YY][m] + sz*edge[ZZ][m];
+            }
+            halfDiagonal_ = std::max(halfDiagonal_, static_cast<real>(0.5*norm(diagonal)));
+        }
+    }
+    halfDiagonal_ *= 1.01;
+    flags_.assign(voxelCount, 0);
+}
+
+void ExcludedVolumeGrid::addAtoms(const Selection          &sel,
+                                  const std::vector<double> &vdwRadius,
+                                  real                      probeRadius,
+                                  bool                      bCenters)
+{
+    // Each thread marks the voxels in a range of z layers, so that no two
+    // threads write to the same voxel.
+    const int nthreads = std::min(gmx_omp_get_max_threads(), cellCount_[ZZ]);
+#pragma omp parallel num_threads(nthreads)
+    {
+        try
+        {
+            const int        thread = gmx_omp_get_thread_num();
+            const int        zBegin = thread*cellCount_[ZZ]/nthreads;
+            const int        zEnd   = (thread + 1)*cellCount_[ZZ]/nthreads;
+            AlignedRealArray dist2;
+            for (int i = 0; i < sel.posCount(); ++i)
+            {
+                const SelectionPosition &p      = sel.position(i);
+                const real               radius = probeRadius + vdwRadius[p.refId()];
+                const real               outer  = radius + halfDiagonal_;
+                const real               outer2 = outer*outer;
+                const real               inner  = radius - halfDiagonal_;
+                const real               inner2 = (inner > 0 ? inner*inner : -1);
+                const real               center2 = (bCenters ? radius*radius : -1);
+                rvec                     s;
+                ivec                     cellMin, cellMax;
+                for (int m = 0; m < DIM; ++m)
+                {
+                    s[m] = 0.0;
+                    real extent2 = 0.0;
+                    for (int d = 0; d < DIM; ++d)
+                    {
+                        s[m]    += p.x()[d]*invBox_[d][m];
+                        extent2 += invBox_[d][m]*invBox_[d][m];
+                    }
+                    const real extent = outer*std::sqrt(extent2);
+                    cellMin[m] = static_cast<int>(std::ceil((s[m] - extent)*cellCount_[m] - 0.5));
+                    cellMax[m] = static_cast<int>(std::floor((s[m] + extent)*cellCount_[m] - 0.5));
+                }
+                const int rowLength = cellMax[XX] - cellMin[XX] + 1;
+                if (rowLength <= 0)
+                {
+                    continue;
+                }
+                dist2.resize((rowLength + c_voxelBatchSize - 1)/c_voxelBatchSize*c_voxelBatchSize);
+                rvec      step;
+                svmul(1.0/cellCount_[XX], box_[XX], step);
+                for (int iz = cellMin[ZZ]; iz <= cellMax[ZZ]; ++iz)
+                {
+                    const int izw = wrapIndex(iz, cellCount_[ZZ]);
+                    if (izw < zBegin || izw >= zEnd)
+                    {
+                        continue;
+                    }
+                    for (int iy = cellMin[YY]; iy <= cellMax[YY]; ++iy)
+                    {
+                        const int iyw = wrapIndex(iy, cellCount_[YY]);
+                        rvec      frac, base;
+                        frac[XX] = (cellMin[XX] + 0.5)/cellCount_[XX] - s[XX];
+                        frac[YY] = (iy + 0.5)/cellCount_[YY] - s[YY];
+                        frac[ZZ] = (iz + 0.5)/cellCount_[ZZ] - s[ZZ];
+                        for (int d = 0; d < DIM; ++d)
+                        {
+                            base[d] = frac[XX]*box_[XX][d] + frac[YY]*box_[YY][d]
+                                + frac[ZZ]*box_[ZZ][d];
+                        }
+                        computeRowDistances(base, step, laneOffset_.data(),
+                                            rowLength, dist2.data());
+                        unsigned char *row = &flags_[voxelIndex(0, iyw, izw)];
+                        int            ixw = wrapIndex(cellMin[XX], cellCount_[XX]);
+                        for (int k = 0; k < rowLength; ++k)
+                        {
+                            const real r2 = dist2[k];
+                            if (r2 < outer2)
+                            {
+                                row[ixw] |= evfNear
+                                    | (r2 < center2 ? evfCenterOccupied : 0)
+                                    | (r2 < inner2 ? evfExcluded : 0);
+                            }
+                            if (++ixw == cellCount_[XX])
+                            {
+                                ixw = 0;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+        GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR;
+    }
+}
+
+int ExcludedVolumeGrid::voxelFlags(const rvec x) const
+{
+    ivec cell;
+    for (int m = 0; m < DIM; ++m)
+    {
+        real s = 0.0;
+        for (int d = 0; d < DIM; ++d)
+        {
+            s += x[d]*invBox_[d][m];
+        }
+        s      -= std::floor(s);
+        cell[m] = std::min(static_cast<int>(s*cellCount_[m]), cellCount_[m] - 1);
+    }
+    return flags_[voxelIndex(cell[XX], cell[YY], cell[ZZ])];
+}
+
+void ExcludedVolumeGrid::findCavities(std::vector<int> *cavitySizes)
+{
+    // Voxels whose center is occupied are skipped like visited ones.
+    const unsigned char cSkip = evfCenterOccupied | evfVisited;
+    cavitySizes->clear();
+    for (size_t start = 0; start < flags_.size(); ++start)
+    {
+        if (flags_[start] & cSkip)
+        {
+            continue;
+        }
+        int size = 0;
+        flags_[start] |= evfVisited;
+        stack_.push_back(start);
+        while (!stack_.empty())
+        {
+            const int index = stack_.back();
+            stack_.pop_back();
+            ++size;
+            ivec      cell;
+            cell[XX] = index % cellCount_[XX];
+            cell[YY] = (index / cellCount_[XX]) % cellCount_[YY];
+            cell[ZZ] = index / (cellCount_[XX]*cellCount_[YY]);
+            for (int m = 0; m < DIM; ++m)
+            {
+                for (int dir = -1; dir <= 1; dir += 2)
+                {
+                    ivec neighbor;
+                    copy_ivec(cell, neighbor);
+                    neighbor[m] = wrapIndex(cell[m] + dir, cellCount_[m]);
+                    const int nbIndex
+                        = voxelIndex(neighbor[XX], neighbor[YY], neighbor[ZZ]);
+                    if (!(flags_[nbIndex] & cSkip))
+                    {
+                        flags_[nbIndex] |= evfVisited;
+                        stack_.push_back(nbIndex);
+                    }
+                }
+            }
+        }
+        cavitySizes->push_back(size);
+    }
+}
+
 /*! \brief
  * Class used to compute free volume in a simulations box.
  *
@@ -102,9 +475,12 @@ class FreeVolume : public TrajectoryAnalysisModule
 
     private:
         std::string                       fnFreevol_;
+        std::string                       fnCavities_;
         Selection                         sel_;
         AnalysisData                      data_;
         AnalysisDataAverageModulePointer  adata_;
+        AnalysisData                      cavities_;
+        AnalysisDataSimpleHistogramModulePointer cavityHistogram_;
 
         int                               nmol_;
         double                            mtot_;
@@ -112,7 +488,13 @@ class FreeVolume : public TrajectoryAnalysisModule
         double                            probeRadius_;
         gmx::DefaultRandomEngine          rng_;
         int                               seed_, ninsert_;
+        double                            gridSpacing_;
+        //! Whether \a gridSpacing_ was determined from the radii.
+        bool                              bAutomaticGridSpacing_;
+        double                            cavityBinWidth_;
+        double                            cavityMax_;
         AnalysisNeighborhood              nb_;
+        ExcludedVolumeGrid                grid_;
         //! The van der Waals radius per atom
         std::vector<double>               vdw_radius_;
 
@@ -124,18 +506,29 @@ class FreeVolume : public TrajectoryAnalysisModule
 // one. The type of this depends on what kind of tool you need.
 // Here we only have simple value/time kind of data.
 FreeVolume::FreeVolume()
-    : adata_(new AnalysisDataAverageModule())
+    : adata_(new AnalysisDataAverageModule()),
+      cavityHistogram_(new AnalysisDataSimpleHistogramModule())
 {
     // We only compute two numbers per frame
     data_.setColumnCount(0, 2);
     // Tell the analysis framework that this component exists
     registerAnalysisDataset(&data_, "freevolume");
+    // Cavity volumes are stored as one point per cavity
+    cavities_.setColumnCount(0, 1);
+    cavities_.setMultipoint(true);
+    cavities_.addModule(cavityHistogram_);
+    registerAnalysisDataset(&cavities_, "cavities");
+    registerBasicDataset(&cavityHistogram_->averager(), "cavityhist");
     nmol_        = 0;
     mtot_        = 0;
     cutoff_      = 0;
     probeRadius_ = 0;
-    seed_        = 0;
-    ninsert_     = 1000;
+    seed_           = 0;
+    ninsert_        = 1000;
+    gridSpacing_    = 0;
+    bAutomaticGridSpacing_ = false;
+    cavityBinWidth_ = 0.005;
+    cavityMax_      = 0.5;
 }
 
 
@@ -171,7 +564,20 @@ FreeVolume::initOptions(IOptionsContainer          *options,
         "we recommend to use the values due to Bondi (1964).[PAR]",
         "The Fractional Free Volume (FFV) that some authors like to use",
         "is given by 1 - 1.3*(1-Free Volume). This value is printed on",
-        "the terminal."
+        "the terminal.[PAR]",
+        "To speed up the insertions, the box is divided into a grid",
+        "with a spacing given by [TT]-gridspacing[tt], and each frame",
+        "voxels that are completely inside or outside the excluded",
+        "volume are determined. Only probes in the remaining voxels are",
+        "checked against individual atoms; the result does not depend",
+        "on the grid spacing. By default, the spacing is half of the",
+        "smallest sum of the probe radius and an atom radius, increased",
+        "if needed to keep the grid below about four million voxels.[PAR]",
+        "With [TT]-ocav[tt], connected regions of voxels whose centers",
+        "are free are determined for each frame, and the average number",
+        "of such cavities per frame is written as a function of their",
+        "volume. The cavity volumes are only as accurate as the grid",
+        "spacing allows."
     };
 
     settings->setHelpText(desc);
@@ -180,6 +586,9 @@ FreeVolume::initOptions(IOptionsContainer          *options,
     options->addOption(FileNameOption("o").filetype(eftPlot).outputFile()
                            .store(&fnFreevol_).defaultBasename("freevolume")
                            .description("Computed free volume"));
+    options->addOption(FileNameOption("ocav").filetype(eftPlot).outputFile()
+                           .store(&fnCavities_).defaultBasename("cavities")
+                           .description("Cavity size distribution"));
 
     // Add option for selecting a subset of atoms
     options->addOption(SelectionOption("select")
@@ -199,6 +608,12 @@ FreeVolume::initOptions(IOptionsContainer          *options,
     // Add option to determine number of insertion trials per frame
     options->addOption(IntegerOption("ninsert").store(&ninsert_)
                            .description("Number of probe insertions per cubic nm to try for each frame in the trajectory."));
+    options->addOption(DoubleOption("gridspacing").store(&gridSpacing_)
+                           .description("Grid spacing for classifying the insertion positions (nm, 0 means determine from the radii)"));
+    options->addOption(DoubleOption("cavbinw").store(&cavityBinWidth_)
+                           .description("Bin width for the cavity size distribution (nm^3)"));
+    options->addOption(DoubleOption("cavmax").store(&cavityMax_)
+                           .description("Largest cavity volume in the distribution (nm^3)"));
 
     // Control input settings
     settings->setFlags(TrajectoryAnalysisSettings::efRequireTop |
@@ -229,6 +644,23 @@ FreeVolume::initAnalysis(const TrajectoryAnalysisSettings &settings,
 
     data_.addModule(plotm_);
 
+    if (gridSpacing_ < 0)
+    {
+        GMX_THROW(InconsistentInputError("Grid spacing cannot be negative"));
+    }
+    cavityHistogram_->init(histogramFromRange(0.0, cavityMax_)
+                               .binWidth(cavityBinWidth_).includeAll());
+    if (!fnCavities_.empty())
+    {
+        AnalysisDataPlotModulePointer plotm(new AnalysisDataPlotModule());
+        plotm->setSettings(settings.plotSettings());
+        plotm->setFileName(fnCavities_);
+        plotm->setTitle("Cavity size distribution");
+        plotm->setXLabel("Cavity volume (nm\\S3\\N)");
+        plotm->setYLabel("Cavities per frame");
+        cavityHistogram_->averager().addModule(plotm);
+    }
+
     // Initiate variable
     cutoff_               = 0;
     int            nnovdw = 0;
@@ -285,6 +717,23 @@ FreeVolume::initAnalysis(const TrajectoryAnalysisSettings &settings,
     // anything
     cutoff_ += probeRadius_;
 
+    // Voxels smaller than the smallest excluded sphere can be fully
+    // excluded, which is what makes the grid effective.
+    bAutomaticGridSpacing_ = (gridSpacing_ == 0);
+    if (bAutomaticGridSpacing_)
+    {
+        double minRadius = cutoff_;
+        for (size_t i = 0; i < vdw_radius_.size(); ++i)
+        {
+            const double radius = probeRadius_ + vdw_radius_[i];
+            if (radius > 0 && radius < minRadius)
+            {
+                minRadius = radius;
+            }
+        }
+        gridSpacing_ = (minRadius > 0 ? 0.5*minRadius : 0.1);
+    }
+
     if (nnovdw >= maxnovdw)
     {
         fprintf(stderr, "Could not determine VDW radius for %d particles. These were set to zero.\n", nnovdw);
@@ -301,6 +750,7 @@ FreeVolume::initAnalysis(const TrajectoryAnalysisSettings &settings,
     printf("probe_radius = %g nm\n", probeRadius_);
     printf("seed         = %d\n", seed_);
     printf("ninsert      = %d probes per nm^3\n", ninsert_);
+    printf("gridspacing  = %g nm\n", gridSpacing_);
 
     // Initiate the random number generator
     rng_.seed(seed_);
@@ -329,42 +779,79 @@ FreeVolume::analyzeFrame(int frnr, const t_trxframe &fr, t_pbc *pbc,
     // Use neighborsearching tools!
     AnalysisNeighborhoodSearch nbsearch = nb_.initSearch(pbc, sel);
 
-    // Then loop over insertions
-    int NinsTot = 0;
-    for (int i = 0; (i < Ninsert); i++)
+    // Classify the voxels of the grid for this frame.
+    const bool bCavities = !fnCavities_.empty();
+    grid_.init(fr.box, gridSpacing_,
+               bAutomaticGridSpacing_ ? c_maxAutomaticVoxelCount : 0);
+    grid_.addAtoms(sel, vdw_radius_, probeRadius_, bCavities);
+
+    // Then loop over insertions in batches: the random positions are
+    // generated serially to keep the sequence independent of threading,
+    // and then tested in parallel.
+    int               NinsTot = 0;
+    std::vector<RVec> insertions;
+    const int         nthreads = gmx_omp_get_max_threads();
+    for (int batchStart = 0; batchStart < Ninsert; batchStart += c_insertionBatchSize)
     {
-        rvec rand, ins, dx;
-
-        for (int m = 0; (m < DIM); m++)
-        {
-            // Generate random number between 0 and 1
-            // cppcheck-suppress uninitvar
-            rand[m] = dist(rng_);
-        }
-        // Generate random 3D position within the box
-        mvmul(fr.box, rand, ins);
-
-        // Find the first reference position within the cutoff.
-        bool                           bOverlap = false;
-        AnalysisNeighborhoodPair       pair;
-        AnalysisNeighborhoodPairSearch pairSearch = nbsearch.startPairSearch(ins);
-        while (!bOverlap && pairSearch.findNextPair(&pair))
+        const int batchSize = std::min(c_insertionBatchSize, Ninsert - batchStart);
+        insertions.resize(batchSize);
+        for (int i = 0; i < batchSize; i++)
         {
-            int jp = pair.refIndex();
-            // Compute distance vector to first atom in the neighborlist
-            pbc_dx(pbc, ins, sel.position(jp).x(), dx);
-
-            // See whether the distance is smaller than allowed
-            bOverlap = (norm(dx) <
-                        probeRadius_+vdw_radius_[sel.position(jp).refId()]);
-
+            rvec rand;
+            for (int m = 0; (m < DIM); m++)
+            {
+                // Generate random number between 0 and 1
+                // cppcheck-suppress uninitvar
+                rand[m] = dist(rng_);
+            }
+            // Generate random 3D position within the box
+            mvmul(fr.box, rand, insertions[i]);
         }
 
-        if (!bOverlap)
+        int batchFree = 0;
+#pragma omp parallel for num_threads(nthreads) schedule(static) reduction(+:batchFree)
+        for (int i = 0; i < batchSize; i++)
         {
-            // We found some free volume!
-            NinsTot++;
+            try
+            {
+                const rvec &ins   = insertions[i].as_vec();
+                const int   flags = grid_.voxelFlags(ins);
+                if (flags & ExcludedVolumeGrid::evfExcluded)
+                {
+                    continue;
+                }
+                if (!(flags & ExcludedVolumeGrid::evfNear))
+                {
+                    ++batchFree;
+                    continue;
+                }
+
+                // Find the first reference position within the cutoff.
+                bool                           bOverlap = false;
+                AnalysisNeighborhoodPair       pair;
+                AnalysisNeighborhoodPairSearch pairSearch = nbsearch.startPairSearch(ins);
+                while (!bOverlap && pairSearch.findNextPair(&pair))
+                {
+                    int  jp = pair.refIndex();
+                    rvec dx;
+                    // Compute distance vector to first atom in the neighborlist
+                    pbc_dx(pbc, ins, sel.position(jp).x(), dx);
+
+                    // See whether the distance is smaller than allowed
+                    bOverlap = (norm(dx) <
+                                probeRadius_+vdw_radius_[sel.position(jp).refId()]);
+
+                }
+
+                if (!bOverlap)
+                {
+                    // We found some free volume!
+                    ++batchFree;
+                }
+            }
+            GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR;
         }
+        NinsTot += batchFree;
     }
     // Compute total free volume for this frame
     double frac = 0;
@@ -379,12 +866,28 @@ FreeVolume::analyzeFrame(int frnr, const t_trxframe &fr, t_pbc *pbc,
 
     // Magic
     dh.finishFrame();
+
+    if (bCavities)
+    {
+        AnalysisDataHandle ch = pdata->dataHandle(cavities_);
+        std::vector<int>   cavitySizes;
+        grid_.findCavities(&cavitySizes);
+        ch.startFrame(frnr, fr.time);
+        const real         voxelVolume = grid_.voxelVolume();
+        for (size_t i = 0; i < cavitySizes.size(); ++i)
+        {
+            ch.setPoint(0, cavitySizes[i]*voxelVolume);
+            ch.finishPointSet();
+        }
+        ch.finishFrame();
+    }
 }
 
 
 void
 FreeVolume::finishAnalysis(int /* nframes */)
 {
+    cavityHistogram_->averager().done();
     please_cite(stdout, "Bondi1964a");
     please_cite(stdout, "Lourenco2013a");
 }
@@ -3,7 +3,7 @@
  *
  * Copyright (c) 1991-2000, University of Groningen, The Netherlands.
  * Copyright (c) 2001-2004, The GROMACS development team.
- * Copyright (c) 2013,2014,2015,2016, by the GROMACS development team, led by
+ * Copyright (c) 2013,2014,2015,2016,2017, by the GROMACS development team, led by
  * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
  * and including many others, as listed in the AUTHORS file in the
  * top-level source directory and at http://www.gromacs.org.
@@ -48,6 +48,7 @@
 #include <cmath>
 
 #include <algorithm>
+#include <cstdint>
 #include <limits>
 #include <string>
 #include <vector>
@@ -71,6 +72,8 @@
 #include "gromacs/trajectoryanalysis/analysismodule.h"
 #include "gromacs/trajectoryanalysis/analysissettings.h"
 #include "gromacs/utility/exceptions.h"
+#include "gromacs/utility/gmxassert.h"
+#include "gromacs/utility/gmxomp.h"
 #include "gromacs/utility/stringutil.h"
 
 namespace gmx
@@ -108,6 +111,115 @@ enum SurfaceType
 //! String values corresponding to SurfaceType.
 const char *const c_SurfaceEnum[] = { "no", "mol", "res" };
 
+/*! \brief
+ * Largest number of pairs to search for at once in a single thread.
+ *
+ * Test positions are processed in chunks that produce about this many pairs,
+ * to limit the memory used for the pair lists.
+ */
+const int c_pairsPerChunk = 1 << 16;
+
+/*! \brief
+ * Maps squared distances to histogram bins without computing square roots.
+ *
+ * A lookup table over uniform intervals of the squared distance gives the
+ * first bin that each interval overlaps; the exact bin is then found by
+ * comparing to the squared bin edges.  Since the pair density grows with the
+ * distance, most pairs fall into intervals that overlap one or two bins.
+ */
+class SquaredDistanceBinner
+{
+    public:
+        SquaredDistanceBinner() : invLookupWidth_(0.0) {}
+
+        //! Initializes the binning for histogram bins from \p settings.
+        void init(const AnalysisHistogramSettings &settings)
+        {
+            GMX_RELEASE_ASSERT(settings.firstEdge() >= 0.0,
+                               "Squared distance binning requires non-negative edges");
+            const int nbin = settings.binCount();
+            edge2_.resize(nbin + 1);
+            for (int i = 0; i <= nbin; ++i)
+            {
+                // Adjust the edge to the smallest value that
+                // AnalysisHistogramSettings::findBin() would put into this
+                // bin after taking the square root, such that the binning is
+                // identical.
+                real edge2 = gmx::square(settings.firstEdge() + i*settings.binWidth());
+                while (edge2 > 0 && isInBinOrAbove(settings, std::nextafter(edge2, static_cast<real>(0)), i))
+                {
+                    edge2 = std::nextafter(edge2, static_cast<real>(0));
+                }
+                while (!isInBinOrAbove(settings, edge2, i))
+                {
+                    edge2 = std::nextafter(edge2, std::numeric_limits<real>::max());
+                }
+                edge2_[i] = edge2;
+            }
+            const int lookupCount = c_lookupPerBin*nbin;
+            invLookupWidth_ = lookupCount/edge2_[nbin];
+            lookup_.resize(lookupCount);
+            int       bin = 0;
+            for (int i = 0; i < lookupCount; ++i)
+            {
+                const real r2 = i/invLookupWidth_;
+                while (bin + 1 < nbin && edge2_[bin + 1] <= r2)
+                {
+                    ++bin;
+                }
+                lookup_[i] = bin;
+            }
+        }
+
+        /*! \brief
+         * Returns the bin for squared distance \p r2, or -1 if out of range.
+         */
+        int findBin(real r2) const
+        {
+            const int nbin = static_cast<int>(edge2_.size()) - 1;
+            if (r2 < edge2_[0] || r2 >= edge2_[nbin])
+            {
+                return -1;
+            }
+            const int lookupIndex
+                = std::min(static_cast<int>(r2*invLookupWidth_),
+                           static_cast<int>(lookup_.size()) - 1);
+            int       bin = lookup_[lookupIndex];
+            while (r2 >= edge2_[bin + 1])
+            {
+                ++bin;
+            }
+            return bin;
+        }
+
+    private:
+        //! Whether the distance for \p r2 is binned into \p bin or above.
+        static bool isInBinOrAbove(const AnalysisHistogramSettings &settings,
+                                   real r2, int bin)
+        {
+            const real r    = std::sqrt(r2);
+            const int  rBin = settings.findBin(r);
+            // findBin() returns -1 both below and above the histogram range.
+            if (rBin < 0)
+            {
+                return r >= settings.firstEdge();
+            }
+            return rBin >= bin;
+        }
+
+        //! Number of lookup table entries per histogram bin.
+        static const int  c_lookupPerBin = 4;
+
+        //! Squared bin edges (one more than the number of bins).
+        std::vector<real> edge2_;
+        //! First bin that overlaps each lookup table interval.
+        std::vector<int>  lookup_;
+        //! Inverse of the width of a lookup table interval.
+        real              invLookupWidth_;
+};
+
+class RdfModuleData;
+
 /*! \brief
  * Implements `gmx rdf` trajectory analysis module.
  */
@@ -134,6 +246,34 @@ class Rdf : public TrajectoryAnalysisModule
         virtual void writeOutput();
 
     private:
+        /*! \brief
+         * Bins all pairs between the reference and test positions.
+         *
+         * \param[in]  search       Search with the reference positions.
+         * \param[in]  testPositions Test positions.
+         * \param[in]  testCount    Number of test positions.
+         * \param[in]  rdfIndex     RDF to bin the pairs into, or -1 to
+         *     determine it from the types of the positions in `frameData`.
+         * \param[in]  maxChunkSize Largest number of test positions to
+         *     search at once.
+         * \param[in,out] frameData Frame data with the per-thread histograms.
+         */
+        void binPairs(const AnalysisNeighborhoodSearch  &search,
+                      const AnalysisNeighborhoodPositions &testPositions,
+                      int testCount, int rdfIndex, int maxChunkSize,
+                      RdfModuleData *frameData) const;
+        /*! \brief
+         * Bins the distances from test positions to the nearest position in
+         * each surface group of the reference selection.
+         *
+         * Parameters are as for binPairs().
+         */
+        void binSurfacePairs(const AnalysisNeighborhoodSearch  &search,
+                             const Selection                   &refSel,
+                             const AnalysisNeighborhoodPositions &testPositions,
+                             int testCount, int rdfIndex, int maxChunkSize,
+                             RdfModuleData *frameData) const;
+
         std::string                               fnRdf_;
         std::string                               fnCumulative_;
         SurfaceType                               surface_;
@@ -154,11 +294,13 @@ class Rdf : public TrajectoryAnalysisModule
         SelectionList                             sel_;
 
         /*! \brief
-         * Raw pairwise distance data from which the RDF is computed.
+         * Binned pairwise distance data from which the RDF is computed.
          *
-         * There is a data set for each selection in `sel_`, with a single
-         * column.  Each point set will contain a single pairwise distance
-         * that contributes to the RDF.
+         * There is a data set for each computed RDF, with two columns.
+         * Each point set contains the center of a histogram bin and the
+         * number of pairs in that bin.  The distances are binned already in
+         * analyzeFrame() such that each pair does not need to pass through
+         * the data framework.
          */
         AnalysisData                              pairDist_;
         /*! \brief
@@ -168,6 +310,10 @@ class Rdf : public TrajectoryAnalysisModule
          * that frame (with surface RDF, the number of groups).  There are
          * `sel_.size()` more columns, each containing the number density of
          * positions for one selection.
+         *
+         * With -allpairs, there is a column for the number of positions in
+         * each selection (`refSel_` first, followed by `sel_`), followed by a
+         * column for the number density of each selection.
          */
         AnalysisData                              normFactors_;
         /*! \brief
@@ -175,9 +321,11 @@ class Rdf : public TrajectoryAnalysisModule
          *
          * The per-frame histograms are raw pair counts in each bin;
          * the averager is normalized by the average number of reference
-         * positions (average of the first column of `normFactors_`).
+         * positions (average of the first column of `normFactors_`, or of
+         * the column for the reference selection of each RDF with
+         * -allpairs).
          */
-        AnalysisDataSimpleHistogramModulePointer  pairCounts_;
+        AnalysisDataWeightedHistogramModulePointer  pairCounts_;
         /*! \brief
          * Average normalization factors.
          */
@@ -193,23 +341,37 @@ class Rdf : public TrajectoryAnalysisModule
         bool                                      bNormalizationSet_;
         bool                                      bXY_;
         bool                                      bExclusions_;
+        bool                                      bAllPairs_;
 
         // Pre-computed values for faster access during analysis.
         real                                      cut2_;
         real                                      rmax2_;
         int                                       surfaceGroupCount_;
+        //! Number of computed RDFs (data sets in `pairDist_`).
+        int                                       rdfCount_;
+        /*! \brief
+         * RDF index for each pair of selections with -allpairs.
+         *
+         * Entry `a*(sel_.size()+1) + b` is the RDF with selection `a` as the
+         * reference and `b` as the other selection, where zero is `refSel_`
+         * and `g+1` is `sel_[g]`; -1 for pairs with `a > b`, which are only
+         * computed once as the pair with `a < b`.
+         */
+        std::vector<int>                          pairRdfIndex_;
+        //! Maps squared distances to bins in `pairCounts_`.
+        SquaredDistanceBinner                     binner_;
 
         // Copy and assign disallowed by base.
 };
 
 Rdf::Rdf()
     : surface_(SurfaceType_None),
-      pairCounts_(new AnalysisDataSimpleHistogramModule()),
+      pairCounts_(new AnalysisDataWeightedHistogramModule()),
       normAve_(new AnalysisDataAverageModule()),
       binwidth_(0.002), cutoff_(0.0), rmax_(0.0),
       normalization_(Normalization_Rdf), bNormalizationSet_(false), bXY_(false),
-      bExclusions_(false),
-      cut2_(0.0), rmax2_(0.0), surfaceGroupCount_(0)
+      bExclusions_(false), bAllPairs_(false),
+      cut2_(0.0), rmax2_(0.0), surfaceGroupCount_(0), rdfCount_(0)
 {
     pairDist_.setMultipoint(true);
     pairDist_.addModule(pairCounts_);
@@ -271,7 +433,15 @@ Rdf::initOptions(IOptionsContainer *options, TrajectoryAnalysisSettings *setting
         "the volume of a bin is not easily computable.",
         "",
         "Option [TT]-cn[tt] produces the cumulative number RDF,",
-        "i.e. the average number of particles within a distance r."
+        "i.e. the average number of particles within a distance r.",
+        "",
+        "To compute the RDFs between all pairs of the selections given to",
+        "[TT]-ref[tt] and [TT]-sel[tt] (including each selection with",
+        "itself), set [TT]-allpairs[tt]. All the RDFs are then computed from",
+        "a single neighbor search over all the selections, which is faster",
+        "than running the tool separately for each pair. In the output, an",
+        "RDF for A-B uses A as the reference. [TT]-allpairs[tt] cannot be",
+        "combined with [TT]-surf[tt] or [TT]-excl[tt]."
     };
 
     settings->setHelpText(desc);
@@ -301,6 +471,8 @@ Rdf::initOptions(IOptionsContainer *options, TrajectoryAnalysisSettings *setting
     options->addOption(EnumOption<SurfaceType>("surf").enumValue(c_SurfaceEnum)
                            .store(&surface_)
                            .description("RDF with respect to the surface of the reference"));
+    options->addOption(BooleanOption("allpairs").store(&bAllPairs_)
+                           .description("Compute RDFs between all pairs of selections"));
 
     options->addOption(SelectionOption("ref").store(&refSel_).required()
                            .description("Reference selection for RDF computation"));
@@ -325,6 +497,14 @@ Rdf::optionsFinished(TrajectoryAnalysisSettings *settings)
         {
             GMX_THROW(InconsistentInputError("-surf cannot be combined with -excl"));
         }
+        if (bAllPairs_)
+        {
+            GMX_THROW(InconsistentInputError("-surf cannot be combined with -allpairs"));
+        }
+    }
+    if (bAllPairs_ && bExclusions_)
+    {
+        GMX_THROW(InconsistentInputError("-allpairs cannot be combined with -excl"));
     }
     if (bExclusions_)
     {
@@ -340,16 +520,34 @@ void
 Rdf::initAnalysis(const TrajectoryAnalysisSettings &settings,
                   const TopologyInformation        &top)
 {
-    pairDist_.setDataSetCount(sel_.size());
-    for (size_t i = 0; i < sel_.size(); ++i)
+    if (bAllPairs_)
     {
-        pairDist_.setColumnCount(i, 1);
+        const int selCount = sel_.size() + 1;
+        pairRdfIndex_.assign(selCount*selCount, -1);
+        rdfCount_ = 0;
+        for (int a = 0; a < selCount; ++a)
+        {
+            for (int b = a; b < selCount; ++b)
+            {
+                pairRdfIndex_[a*selCount + b] = rdfCount_;
+                ++rdfCount_;
+            }
+        }
+        normFactors_.setColumnCount(0, 2*selCount);
+    }
+    else
+    {
+        rdfCount_ = sel_.size();
+        normFactors_.setColumnCount(0, sel_.size() + 1);
+    }
+    pairDist_.setDataSetCount(rdfCount_);
+    for (int i = 0; i < rdfCount_; ++i)
+    {
+        pairDist_.setColumnCount(i, 2);
     }
     plotSettings_ = settings.plotSettings();
     nb_.setXYMode(bXY_);
 
-    normFactors_.setColumnCount(0, sel_.size() + 1);
-
     const bool bSurface = (surface_ != SurfaceType_None);
     if (bSurface)
     {
@@ -415,10 +613,15 @@ Rdf::initAfterFirstFrame(const TrajectoryAnalysisSettings &settings,
     // We use the double amount of bins, so we can correctly
     // write the rdf and rdf_cn output at i*binwidth values.
     pairCounts_->init(histogramFromRange(0.0, rmax_).binWidth(binwidth_ / 2.0));
+    binner_.init(pairCounts_->settings());
 }
 
 /*! \brief
  * Temporary memory for use within a single-frame calculation.
+ *
+ * All memory that is written during analyzeFrame() is here, such that
+ * multiple frames can be processed concurrently.  Within a frame, the pairs
+ * are binned in parallel into a private histogram for each thread.
  */
 class RdfModuleData : public TrajectoryAnalysisModuleData
 {
@@ -427,20 +630,50 @@ class RdfModuleData : public TrajectoryAnalysisModuleData
          * Reserves memory for the frame-local data.
          *
          * `surfaceGroupCount` will be zero if -surf is not specified.
+         * `histogramSize` is the number of RDFs times the number of bins.
          */
         RdfModuleData(TrajectoryAnalysisModule          *module,
                       const AnalysisDataParallelOptions &opt,
                       const SelectionCollection         &selections,
-                      int                                surfaceGroupCount)
+                      int                                surfaceGroupCount,
+                      int                                histogramSize)
             : TrajectoryAnalysisModuleData(module, opt, selections)
         {
-            surfaceDist2_.resize(surfaceGroupCount);
+            const int nthreads = gmx_omp_get_max_threads();
+            threadPairs_.resize(nthreads);
+            threadHistograms_.resize(nthreads);
+            threadSurfaceDist2_.resize(nthreads);
+            for (int t = 0; t < nthreads; ++t)
+            {
+                threadHistograms_[t].resize(histogramSize);
+                threadSurfaceDist2_[t].resize(surfaceGroupCount);
+            }
         }
 
         virtual void finish() { finishDataHandles(); }
 
+        //! Returns the number of threads to use for binning the pairs.
+        int threadCount() const { return threadHistograms_.size(); }
+        //! Clears the histograms for a new frame.
+        void clearHistograms()
+        {
+            for (size_t t = 0; t < threadHistograms_.size(); ++t)
+            {
+                std::fill(threadHistograms_[t].begin(),
+                          threadHistograms_[t].end(), 0);
+            }
+        }
+
+        //! Buffer for the pairs found in a chunk, for each thread.
+        std::vector<AnalysisNeighborhoodPairList> threadPairs_;
         /*! \brief
-         * Minimum distance to each surface group.
+         * Pair counts in each bin for each thread.
+         *
+         * The bins for each RDF are stored consecutively.
+         */
+        std::vector<std::vector<std::int64_t> >   threadHistograms_;
+        /*! \brief
+         * Minimum distance to each surface group, for each thread.
          *
          * One entry for each group (residue/molecule, per -surf) in the
          * reference selection.
@@ -450,7 +683,11 @@ class RdfModuleData : public TrajectoryAnalysisModuleData
          * to find the minimum distance to each surface group, and then compute
          * the RDF from these numbers.
          */
-        std::vector<real> surfaceDist2_;
+        std::vector<std::vector<real> >           threadSurfaceDist2_;
+        //! Positions of all selections with -allpairs.
+        std::vector<RVec>                         allPositions_;
+        //! Selection (zero for `refSel_`) for each position in `allPositions_`.
+        std::vector<int>                          allTypes_;
 };
 
 TrajectoryAnalysisModuleDataPointer Rdf::startFrames(
@@ -458,7 +695,122 @@ TrajectoryAnalysisModuleDataPointer Rdf::startFrames(
         const SelectionCollection         &selections)
 {
     return TrajectoryAnalysisModuleDataPointer(
-            new RdfModuleData(this, opt, selections, surfaceGroupCount_));
+            new RdfModuleData(this, opt, selections, surfaceGroupCount_,
+                              rdfCount_*pairCounts_->settings().binCount()));
+}
+
+void
+Rdf::binPairs(const AnalysisNeighborhoodSearch    &search,
+              const AnalysisNeighborhoodPositions &testPositions,
+              int testCount, int rdfIndex, int maxChunkSize,
+              RdfModuleData *frameData) const
+{
+    const int  nbin       = pairCounts_->settings().binCount();
+    const int  selCount   = sel_.size() + 1;
+    const int *types      = frameData->allTypes_.data();
+    const int  chunkCount = (testCount + maxChunkSize - 1) / maxChunkSize;
+#pragma omp parallel for num_threads(frameData->threadCount()) schedule(dynamic)
+    for (int c = 0; c < chunkCount; ++c)
+    {
+        try
+        {
+            const int                     thread = gmx_omp_get_thread_num();
+            AnalysisNeighborhoodPairList &pairs  = frameData->threadPairs_[thread];
+            std::int64_t                 *hist   = frameData->threadHistograms_[thread].data();
+            const int                     begin  = c*maxChunkSize;
+            const int                     end    = std::min(begin + maxChunkSize, testCount);
+            search.findPairs(testPositions, begin, end, &pairs);
+            const ConstArrayRef<int>      refIndices  = pairs.refIndices();
+            const ConstArrayRef<int>      testIndices = pairs.testIndices();
+            const ConstArrayRef<real>     distances2  = pairs.distances2();
+            for (int p = 0; p < pairs.size(); ++p)
+            {
+                const real r2 = distances2[p];
+                if (r2 <= cut2_)
+                {
+                    continue;
+                }
+                int k = rdfIndex;
+                if (k < 0)
+                {
+                    k = pairRdfIndex_[types[refIndices[p]]*selCount + types[testIndices[p]]];
+                    if (k < 0)
+                    {
+                        continue;
+                    }
+                }
+                const int bin = binner_.findBin(r2);
+                if (bin >= 0)
+                {
+                    ++hist[k*nbin + bin];
+                }
+            }
+        }
+        GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR;
+    }
+}
+
+void
+Rdf::binSurfacePairs(const AnalysisNeighborhoodSearch    &search,
+                     const Selection                     &refSel,
+                     const AnalysisNeighborhoodPositions &testPositions,
+                     int testCount, int rdfIndex, int maxChunkSize,
+                     RdfModuleData *frameData) const
+{
+    const int nbin       = pairCounts_->settings().binCount();
+    const int chunkCount = (testCount + maxChunkSize - 1) / maxChunkSize;
+#pragma omp parallel for num_threads(frameData->threadCount()) schedule(dynamic)
+    for (int c = 0; c < chunkCount; ++c)
+    {
+        try
+        {
+            const int                     thread       = gmx_omp_get_thread_num();
+            AnalysisNeighborhoodPairList &pairs        = frameData->threadPairs_[thread];
+            std::int64_t                 *hist         = frameData->threadHistograms_[thread].data();
+            std::vector<real>            &surfaceDist2 = frameData->threadSurfaceDist2_[thread];
+            const int                     begin        = c*maxChunkSize;
+            const int                     end          = std::min(begin + maxChunkSize, testCount);
+            search.findPairs(testPositions, begin, end, &pairs);
+            const ConstArrayRef<int>      refIndices  = pairs.refIndices();
+            const ConstArrayRef<int>      testIndices = pairs.testIndices();
+            const ConstArrayRef<real>     distances2  = pairs.distances2();
+            // The pairs for each test position are consecutive in the list.
+            // Test positions without any pairs do not contribute.
+            int p = 0;
+            while (p < pairs.size())
+            {
+                std::fill(surfaceDist2.begin(), surfaceDist2.end(),
+                          std::numeric_limits<real>::max());
+                const int testIndex = testIndices[p];
+                for (; p < pairs.size() && testIndices[p] == testIndex; ++p)
+                {
+                    const real r2    = distances2[p];
+                    const int  refId = refSel.position(refIndices[p]).mappedId();
+                    if (r2 < surfaceDist2[refId])
+                    {
+                        surfaceDist2[refId] = r2;
+                    }
+                }
+                // Accumulate the RDF from the distances to the surface.
+                for (size_t i = 0; i < surfaceDist2.size(); ++i)
+                {
+                    const real r2 = surfaceDist2[i];
+                    // Here, we need to check for rmax, since the value might
+                    // be above the cutoff if no points were close to some
+                    // surface positions.
+                    if (r2 > cut2_ && r2 <= rmax2_)
+                    {
+                        const int bin = binner_.findBin(r2);
+                        if (bin >= 0)
+                        {
+                            ++hist[rdfIndex*nbin + bin];
+                        }
+                    }
+                }
+            }
+        }
+        GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR;
+    }
 }
 
 void
@@ -470,7 +822,7 @@ Rdf::analyzeFrame(int frnr, const t_trxframe &fr, t_pbc *pbc,
     const Selection     &refSel    = pdata->parallelSelection(refSel_);
     const SelectionList &sel       = pdata->parallelSelections(sel_);
     RdfModuleData       &frameData = *static_cast<RdfModuleData *>(pdata);
-    const bool           bSurface  = !frameData.surfaceDist2_.empty();
+    const bool           bSurface  = (surface_ != SurfaceType_None);
 
     matrix               boxForVolume;
     copy_mat(fr.box, boxForVolume);
@@ -482,105 +834,128 @@ Rdf::analyzeFrame(int frnr, const t_trxframe &fr, t_pbc *pbc,
     }
     const real inverseVolume = 1.0 / det(boxForVolume);
 
+    // Estimate the fraction of reference positions within the cutoff, to
+    // search enough test positions at once to amortize the overhead, while
+    // limiting the memory needed for the pair lists.
+    real pairFraction = 1.0;
+    if (pbc != NULL)
+    {
+        const real rangeVolume
+            = (bXY_ ? M_PI*rmax2_ : (4.0/3.0)*M_PI*rmax2_*rmax_);
+        pairFraction = std::min(rangeVolume*inverseVolume, static_cast<real>(1.0));
+    }
+
+    frameData.clearHistograms();
     nh.startFrame(frnr, fr.time);
-    // Compute the normalization factor for the number of reference positions.
-    if (bSurface)
+    if (bAllPairs_)
     {
-        if (refSel.isDynamic())
+        // Search all the selections at once; the selections of the two
+        // positions in a pair determine the RDF it contributes to.
+        const int          selCount = sel.size() + 1;
+        std::vector<RVec> &x        = frameData.allPositions_;
+        std::vector<int>  &types    = frameData.allTypes_;
+        x.clear();
+        types.clear();
+        for (int t = 0; t < selCount; ++t)
         {
-            // Count the number of distinct groups.
-            // This assumes that each group is continuous, which is currently
-            // the case.
-            int count  = 0;
-            int prevId = -1;
-            for (int i = 0; i < refSel.posCount(); ++i)
+            const Selection &s = (t == 0 ? refSel : sel[t - 1]);
+            for (int i = 0; i < s.posCount(); ++i)
             {
-                const int id = refSel.position(i).mappedId();
-                if (id != prevId)
-                {
-                    ++count;
-                    prevId = id;
-                }
+                x.emplace_back(s.position(i).x());
+                types.push_back(t);
             }
-            nh.setPoint(0, count);
-        }
-        else
-        {
-            nh.setPoint(0, surfaceGroupCount_);
+            nh.setPoint(t, s.posCount());
+            nh.setPoint(selCount + t, s.posCount() * inverseVolume);
         }
+        const int                     count = x.size();
+        const int                     maxChunkSize
+            = std::max(static_cast<int>(c_pairsPerChunk / (count*pairFraction + 1)), 1);
+        AnalysisNeighborhoodPositions pos(x);
+        AnalysisNeighborhoodSearch    nbsearch = nb_.initSearch(pbc, pos);
+        binPairs(nbsearch, pos, count, -1, maxChunkSize, &frameData);
     }
     else
     {
-        nh.setPoint(0, refSel.posCount());
-    }
-
-    dh.startFrame(frnr, fr.time);
-    AnalysisNeighborhoodSearch    nbsearch = nb_.initSearch(pbc, refSel);
-    for (size_t g = 0; g < sel.size(); ++g)
-    {
-        dh.selectDataSet(g);
-
+        // Compute the normalization factor for the number of reference
+        // positions.
         if (bSurface)
         {
-            // Special loop for surface calculation, where a separate neighbor
-            // search is done for each position in the selection, and the
-            // nearest position from each surface group is tracked.
-            std::vector<real> &surfaceDist2 = frameData.surfaceDist2_;
-            for (int i = 0; i < sel[g].posCount(); ++i)
+            if (refSel.isDynamic())
             {
-                std::fill(surfaceDist2.begin(), surfaceDist2.end(),
-                          std::numeric_limits<real>::max());
-                AnalysisNeighborhoodPairSearch pairSearch =
-                    nbsearch.startPairSearch(sel[g].position(i));
-                AnalysisNeighborhoodPair       pair;
-                while (pairSearch.findNextPair(&pair))
+                // Count the number of distinct groups.
+                // This assumes that each group is continuous, which is currently
+                // the case.
+                int count  = 0;
+                int prevId = -1;
+                for (int i = 0; i < refSel.posCount(); ++i)
                 {
-                    const real r2    = pair.distance2();
-                    const int  refId = refSel.position(pair.refIndex()).mappedId();
-                    if (r2 < surfaceDist2[refId])
+                    const int id = refSel.position(i).mappedId();
+                    if (id != prevId)
                     {
-                        surfaceDist2[refId] = r2;
-                    }
-                }
-                // Accumulate the RDF from the distances to the surface.
-                for (size_t i = 0; i < surfaceDist2.size(); ++i)
-                {
-                    const real r2 = surfaceDist2[i];
-                    // Here, we need to check for rmax, since the value might
-                    // be above the cutoff if no points were close to some
-                    // surface positions.
-                    if (r2 > cut2_ && r2 <= rmax2_)
-                    {
-                        dh.setPoint(0, std::sqrt(r2));
-                        dh.finishPointSet();
+                        ++count;
+                        prevId = id;
                     }
                 }
+                nh.setPoint(0, count);
+            }
+            else
+            {
+                nh.setPoint(0, surfaceGroupCount_);
             }
         }
         else
         {
-            // Standard neighborhood search over all pairs within the cutoff
-            // for the -surf no case.
-            AnalysisNeighborhoodPairSearch pairSearch = nbsearch.startPairSearch(sel[g]);
-            AnalysisNeighborhoodPair       pair;
-            while (pairSearch.findNextPair(&pair))
+            nh.setPoint(0, refSel.posCount());
+        }
+
+        const int                  maxChunkSize
+            = std::max(static_cast<int>(c_pairsPerChunk / (refSel.posCount()*pairFraction + 1)), 1);
+        AnalysisNeighborhoodSearch nbsearch = nb_.initSearch(pbc, refSel);
+        for (size_t g = 0; g < sel.size(); ++g)
+        {
+            if (bSurface)
             {
-                const real r2 = pair.distance2();
-                if (r2 > cut2_)
-                {
-                    // TODO: Consider whether the histogramming could be done with
-                    // less overhead (after first measuring the overhead).
-                    dh.setPoint(0, std::sqrt(r2));
-                    dh.finishPointSet();
-                }
+                // Special handling for surface calculation, where the nearest
+                // position from each surface group is tracked.
+                binSurfacePairs(nbsearch, refSel, sel[g], sel[g].posCount(),
+                                g, maxChunkSize, &frameData);
             }
+            else
+            {
+                binPairs(nbsearch, sel[g], sel[g].posCount(), g, maxChunkSize,
+                         &frameData);
+            }
+            // Normalization factor for the number density (only used without
+            // -surf, but does not hurt to populate otherwise).
+            nh.setPoint(g + 1, sel[g].posCount() * inverseVolume);
         }
-        // Normalization factor for the number density (only used without
-        // -surf, but does not hurt to populate otherwise).
-        nh.setPoint(g + 1, sel[g].posCount() * inverseVolume);
     }
-    dh.finishFrame();
     nh.finishFrame();
+
+    // Sum the per-thread histograms, and pass the nonzero bins on with their
+    // bin centers as the values.
+    const AnalysisHistogramSettings &settings = pairCounts_->settings();
+    const int                        nbin     = settings.binCount();
+    dh.startFrame(frnr, fr.time);
+    for (int k = 0; k < rdfCount_; ++k)
+    {
+        dh.selectDataSet(k);
+        for (int bin = 0; bin < nbin; ++bin)
+        {
+            std::int64_t count = 0;
+            for (int t = 0; t < frameData.threadCount(); ++t)
+            {
+                count += frameData.threadHistograms_[t][k*nbin + bin];
+            }
+            if (count > 0)
+            {
+                dh.setPoint(0, settings.firstEdge() + (bin + 0.5)*settings.binWidth());
+                dh.setPoint(1, count);
+                dh.finishPointSet();
+            }
+        }
+    }
+    dh.finishFrame();
 }
 
 void
@@ -588,8 +963,35 @@ Rdf::finishAnalysis(int /*nframes*/)
 {
     // Normalize the averager with the number of reference positions,
     // from where the normalization propagates to all the output.
-    const real refPosCount = normAve_->average(0, 0);
-    pairCounts_->averager().scaleAll(1.0 / refPosCount);
+    // With -allpairs, each RDF is described by the selections used as the
+    // reference and as the other selection.
+    const int                selCount = sel_.size() + 1;
+    std::vector<int>         rdfSel;
+    std::vector<std::string> legends;
+    if (bAllPairs_)
+    {
+        for (int a = 0; a < selCount; ++a)
+        {
+            const char *nameA = (a == 0 ? refSel_.name() : sel_[a - 1].name());
+            for (int b = a; b < selCount; ++b)
+            {
+                const char *nameB = (b == 0 ? refSel_.name() : sel_[b - 1].name());
+                rdfSel.push_back(b);
+                legends.push_back(formatString("%s-%s", nameA, nameB));
+                pairCounts_->averager().scaleSingle(
+                        pairRdfIndex_[a*selCount + b], 1.0 / normAve_->average(0, a));
+            }
+        }
+    }
+    else
+    {
+        const real refPosCount = normAve_->average(0, 0);
+        pairCounts_->averager().scaleAll(1.0 / refPosCount);
+        for (size_t g = 0; g < sel_.size(); ++g)
+        {
+            legends.push_back(sel_[g].name());
+        }
+    }
     pairCounts_->averager().done();
 
     // TODO: Consider how these could be exposed to the testing framework
@@ -626,9 +1028,19 @@ Rdf::finishAnalysis(int /*nframes*/)
         if (normalization_ == Normalization_Rdf)
         {
             // Normalize by particle density.
-            for (size_t g = 0; g < sel_.size(); ++g)
+            if (bAllPairs_)
             {
-                finalRdf->scaleSingle(g, 1.0 / normAve_->average(0, g + 1));
+                for (int k = 0; k < rdfCount_; ++k)
+                {
+                    finalRdf->scaleSingle(k, 1.0 / normAve_->average(0, selCount + rdfSel[k]));
+                }
+            }
+            else
+            {
+                for (size_t g = 0; g < sel_.size(); ++g)
+                {
+                    finalRdf->scaleSingle(g, 1.0 / normAve_->average(0, g + 1));
+                }
             }
         }
     }
@@ -647,12 +1059,15 @@ Rdf::finishAnalysis(int /*nframes*/)
                 new AnalysisDataPlotModule(plotSettings_));
         plotm->setFileName(fnRdf_);
         plotm->setTitle("Radial distribution");
-        plotm->setSubtitle(formatString("reference %s", refSel_.name()));
+        if (!bAllPairs_)
+        {
+            plotm->setSubtitle(formatString("reference %s", refSel_.name()));
+        }
         plotm->setXLabel("r (nm)");
         plotm->setYLabel("g(r)");
-        for (size_t i = 0; i < sel_.size(); ++i)
+        for (size_t i = 0; i < legends.size(); ++i)
         {
-            plotm->appendLegend(sel_[i].name());
+            plotm->appendLegend(legends[i]);
         }
         finalRdf->addModule(plotm);
     }
@@ -668,12 +1083,15 @@ Rdf::finishAnalysis(int /*nframes*/)
                 new AnalysisDataPlotModule(plotSettings_));
         plotm->setFileName(fnCumulative_);
         plotm->setTitle("Cumulative Number RDF");
-        plotm->setSubtitle(formatString("reference %s", refSel_.name()));
+        if (!bAllPairs_)
+        {
+            plotm->setSubtitle(formatString("reference %s", refSel_.name()));
+        }
         plotm->setXLabel("r (nm)");
         plotm->setYLabel("number");
-        for (size_t i = 0; i < sel_.size(); ++i)
+        for (size_t i = 0; i < legends.size(); ++i)
         {
-            plotm->appendLegend(sel_[i].name());
+            plotm->appendLegend(legends[i]);
         }
         cumulativeRdf->addModule(plotm);
     }
@@ -3,7 +3,7 @@
  *
  * Copyright (c) 1991-2000, University of Groningen, The Netherlands.
  * Copyright (c) 2001-2007, The GROMACS development team.
- * Copyright (c) 2013,2014,2015, by the GROMACS development team, led by
+ * Copyright (c) 2013,2014,2015,2017, by the GROMACS development team, led by
  * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
  * and including many others, as listed in the AUTHORS file in the
  * top-level source directory and at http://www.gromacs.org.
@@ -51,12 +51,14 @@
 #include "gromacs/math/vec.h"
 #include "gromacs/pbcutil/pbc.h"
 #include "gromacs/selection/nbsearch.h"
+#include "gromacs/simd/simd.h"
+#include "gromacs/utility/alignedallocator.h"
+#include "gromacs/utility/exceptions.h"
 #include "gromacs/utility/fatalerror.h"
 #include "gromacs/utility/gmxassert.h"
+#include "gromacs/utility/gmxomp.h"
 #include "gromacs/utility/smalloc.h"
 
-using namespace gmx;
-
 #define UNSP_ICO_DOD      9
 #define UNSP_ICO_ARC     10
 
@@ -551,15 +553,296 @@ static std::vector<real> make_unsp(int densit, int cubus)
     return xus;
 }
 
+namespace gmx
+{
+
+namespace
+{
+
+/*! \brief
+ * Buffer added to the pair list cutoff to allow reusing the list.
+ *
+ * The pair list is reused for subsequent calculations as long as no pair can
+ * have moved more than this distance closer to each other.
+ */
+const real c_pairListBuffer = 0.1;
+
+#if GMX_SIMD_HAVE_REAL
+//! Number of surface dots tested together in the dot occlusion kernel.
+const int  c_dotBatchSize = GMX_SIMD_REAL_WIDTH;
+#else
+//! Number of surface dots tested together in the dot occlusion kernel.
+const int  c_dotBatchSize = 1;
+#endif
+
+//! Aligned array of reals for use with SIMD loads and stores.
+typedef std::vector<real, AlignedAllocator<real> > AlignedRealArray;
+
+/*! \brief
+ * Unit sphere surface dots in the layout used by the dot occlusion kernel.
+ *
+ * The coordinates are stored separately for each dimension, padded to a
+ * multiple of \c c_dotBatchSize.  \c valid_ is one for actual dots and zero
+ * for padding.
+ */
+struct SurfaceDotArrays
+{
+    //! Initializes the arrays from x,y,z triplets.
+    void set(const std::vector<real> &xus)
+    {
+        count_ = static_cast<int>(xus.size())/3;
+        const int paddedCount
+            = (count_ + c_dotBatchSize - 1)/c_dotBatchSize*c_dotBatchSize;
+        x_.assign(paddedCount, 0.0);
+        y_.assign(paddedCount, 0.0);
+        z_.assign(paddedCount, 0.0);
+        valid_.assign(paddedCount, 0.0);
+        for (int i = 0; i < count_; ++i)
+        {
+            x_[i]     = xus[3*i];
+            y_[i]     = xus[3*i+1];
+            z_[i]     = xus[3*i+2];
+            valid_[i] = 1.0;
+        }
+    }
+
+    //! Number of padded dots in the arrays.
+    int paddedCount() const { return static_cast<int>(x_.size()); }
+
+    //! Number of actual dots.
+    int                 count_;
+    //! x coordinates of the dots.
+    AlignedRealArray    x_;
+    //! y coordinates of the dots.
+    AlignedRealArray    y_;
+    //! z coordinates of the dots.
+    AlignedRealArray    z_;
+    //! One for actual dots, zero for padding.
+    AlignedRealArray    valid_;
+};
+
+/*! \brief
+ * Per-thread work arrays for nsc_dclm_pbc().
+ *
+ * For each neighbor sphere k overlapping with the current sphere, a surface
+ * dot is covered if its dot product with (`nbX_[k]`, `nbY_[k]`, `nbZ_[k]`) is
+ * larger than `nbRefDot_[k]`.
+ */
+struct SurfaceAreaThreadWork
+{
+    //! x components of vectors to the overlapping neighbors.
+    std::vector<real>   nbX_;
+    //! y components of vectors to the overlapping neighbors.
+    std::vector<real>   nbY_;
+    //! z components of vectors to the overlapping neighbors.
+    std::vector<real>   nbZ_;
+    //! Dot product thresholds for the overlapping neighbors.
+    std::vector<real>   nbRefDot_;
+    //! For each surface dot, one if not covered, zero otherwise.
+    AlignedRealArray    uncovered_;
+};
+
+/*! \brief
+ * Determines which surface dots of a sphere are not covered by neighbors.
+ *
+ * \param[in]  dots     Unit sphere surface dots.
+ * \param[in]  nbCount  Number of overlapping neighbors in \p work.
+ * \param[in,out] work  Neighbor data in, `work->uncovered_` out.
+ * \returns    Number of uncovered dots.
+ *
+ * Batches of surface dots are tested against all neighbors, stopping once all
+ * dots in a batch are covered.
+ */
+int findUncoveredDots(const SurfaceDotArrays &dots, int nbCount,
+                      SurfaceAreaThreadWork *work)
+{
+    const real *nbX      = work->nbX_.data();
+    const real *nbY      = work->nbY_.data();
+    const real *nbZ      = work->nbZ_.data();
+    const real *nbRefDot = work->nbRefDot_.data();
+    real       *result   = work->uncovered_.data();
+#if GMX_SIMD_HAVE_REAL
+    real        count    = 0.0;
+    for (int l = 0; l < dots.paddedCount(); l += c_dotBatchSize)
+    {
+        const SimdReal x     = load(dots.x_.data() + l);
+        const SimdReal y     = load(dots.y_.data() + l);
+        const SimdReal z     = load(dots.z_.data() + l);
+        const SimdReal valid = load(dots.valid_.data() + l);
+        SimdBool       bUncovered = (setZero() < valid);
+        for (int k = 0; k < nbCount && anyTrue(bUncovered); ++k)
+        {
+            const SimdReal prod
+                = x*SimdReal(nbX[k]) + y*SimdReal(nbY[k]) + z*SimdReal(nbZ[k]);
+            bUncovered = bUncovered && (prod <= SimdReal(nbRefDot[k]));
+        }
+        const SimdReal flags = selectByMask(valid, bUncovered);
+        store(result + l, flags);
+        count += reduce(flags);
+    }
+    return static_cast<int>(count + 0.5);
+#else
+    int         count    = 0;
+    for (int l = 0; l < dots.count_; ++l)
+    {
+        const real x          = dots.x_[l];
+        const real y          = dots.y_[l];
+        const real z          = dots.z_[l];
+        bool       bUncovered = true;
+        for (int k = 0; k < nbCount; ++k)
+        {
+            if (x*nbX[k] + y*nbY[k] + z*nbZ[k] > nbRefDot[k])
+            {
+                bUncovered = false;
+                break;
+            }
+        }
+        result[l] = (bUncovered ? 1.0 : 0.0);
+        if (bUncovered)
+        {
+            ++count;
+        }
+    }
+    return count;
+#endif
+}
+
+/*! \brief
+ * Pair list of possibly overlapping spheres, reused between calculations.
+ *
+ * The list is built with a cutoff that exceeds the largest possible overlap
+ * distance by \c c_pairListBuffer.  It is reused as long as the same spheres
+ * are calculated, and their displacements together with the change in the
+ * box cannot have brought a pair from outside the buffered cutoff into
+ * overlap.  Pairs in the list still need to be checked for overlap.
+ */
+class SurfaceAreaPairList
+{
+    public:
+        SurfaceAreaPairList() : ePBC_(-1), bValid_(false)
+        {
+            clear_mat(box_);
+        }
+
+        //! Sets the largest distance between overlapping spheres.
+        void setCutoff(real cutoff)
+        {
+            nb_.setCutoff(cutoff + c_pairListBuffer);
+            bValid_ = false;
+        }
+
+        /*! \brief
+         * Makes the list valid for the given positions.
+         *
+         * Arguments are as for nsc_dclm_pbc().
+         * Rebuilds the list if it cannot be reused.
+         */
+        void update(const rvec *x, int nx, const t_pbc *pbc,
+                    int nat, const int index[])
+        {
+            if (isValid(x, pbc, nat, index))
+            {
+                return;
+            }
+            AnalysisNeighborhoodPositions pos(x, nx);
+            pos.indexed(constArrayRefFromArray(index, nat));
+            AnalysisNeighborhoodSearch    search(nb_.initSearch(pbc, pos));
+            search.findPairs(pos, &pairs_);
+
+            const ConstArrayRef<int>      refIndices  = pairs_.refIndices();
+            const ConstArrayRef<int>      testIndices = pairs_.testIndices();
+            start_.assign(nat + 1, 0);
+            for (int p = 0; p < pairs_.size(); ++p)
+            {
+                ++start_[testIndices[p] + 1];
+            }
+            for (int i = 0; i < nat; ++i)
+            {
+                start_[i + 1] += start_[i];
+            }
+            neighbors_.resize(pairs_.size());
+            std::vector<int> fill(start_.begin(), start_.end() - 1);
+            for (int p = 0; p < pairs_.size(); ++p)
+            {
+                neighbors_[fill[testIndices[p]]++] = refIndices[p];
+            }
+
+            index_.assign(index, index + nat);
+            xref_.resize(nat);
+            for (int i = 0; i < nat; ++i)
+            {
+                copy_rvec(x[index[i]], xref_[i]);
+            }
+            ePBC_ = (pbc != NULL ? pbc->ePBC : -1);
+            if (pbc != NULL)
+            {
+                copy_mat(pbc->box, box_);
+            }
+            bValid_ = true;
+        }
+
+        //! Returns the number of neighbors of the \p i th sphere.
+        int neighborCount(int i) const { return start_[i + 1] - start_[i]; }
+        //! Returns the neighbors (indices into `index`) of the \p i th sphere.
+        const int *neighbors(int i) const { return &neighbors_[start_[i]]; }
+
+    private:
+        //! Checks whether the current list can be used for \p x.
+        bool isValid(const rvec *x, const t_pbc *pbc,
+                     int nat, const int index[]) const
+        {
+            if (!bValid_ || nat != static_cast<int>(index_.size())
+                || (pbc != NULL ? pbc->ePBC : -1) != ePBC_
+                || !std::equal(index, index + nat, index_.begin()))
+            {
+                return false;
+            }
+            real boxChange = 0.0;
+            if (pbc != NULL)
+            {
+                for (int d = 0; d < DIM; ++d)
+                {
+                    rvec dbox;
+                    rvec_sub(pbc->box[d], box_[d], dbox);
+                    boxChange += norm(dbox);
+                }
+            }
+            real maxDisp2 = 0.0;
+            for (int i = 0; i < nat; ++i)
+            {
+                maxDisp2 = std::max(maxDisp2, distance2(x[index[i]], xref_[i]));
+            }
+            return 2*std::sqrt(maxDisp2) + boxChange <= c_pairListBuffer;
+        }
+
+        AnalysisNeighborhood          nb_;
+        AnalysisNeighborhoodPairList  pairs_;
+        //! Start of the neighbors of each sphere in \p neighbors_.
+        std::vector<int>              start_;
+        std::vector<int>              neighbors_;
+        //! Spheres for which the list was built.
+        std::vector<int>              index_;
+        //! Positions for which the list was built.
+        std::vector<RVec>             xref_;
+        //! PBC type for which the list was built (-1 for no PBC).
+        int                           ePBC_;
+        //! Box for which the list was built.
+        matrix                        box_;
+        bool                          bValid_;
+};
+
+}   // namespace
+
 static void
 nsc_dclm_pbc(const rvec *coords, const ConstArrayRef<real> &radius, int nat,
-             const real *xus, int n_dot, int mode,
+             const real *xus, const SurfaceDotArrays &dotArrays, int mode,
              real *value_of_area, real **at_area,
              real *value_of_vol,
              real **lidots, int *nu_dots,
-             int index[], AnalysisNeighborhood *nb,
+             int index[], SurfaceAreaPairList *pairList,
              const t_pbc *pbc)
 {
+    const int  n_dot   = dotArrays.count_;
     const real dotarea = FOURPI/(real) n_dot;
 
     if (debug)
@@ -567,29 +850,10 @@ nsc_dclm_pbc(const rvec *coords, const ConstArrayRef<real> &radius, int nat,
         fprintf(debug, "nsc_dclm: n_dot=%5d %9.3f\n", n_dot, dotarea);
     }
 
-    /* start with neighbour list */
-    /* calculate neighbour list with the box algorithm */
     if (nat == 0)
     {
         return;
     }
-    real        area = 0.0, vol = 0.0;
-    real       *dots = NULL, *atom_area = NULL;
-    int         lfnr = 0, maxdots = 0;
-    if (mode & FLAG_VOLUME)
-    {
-        vol = 0.;
-    }
-    if (mode & FLAG_DOTS)
-    {
-        maxdots = (3*n_dot*nat)/10;
-        snew(dots, maxdots);
-        lfnr = 0;
-    }
-    if (mode & FLAG_ATOM_AREA)
-    {
-        snew(atom_area, nat);
-    }
 
     // Compute the center of the molecule for volume calculation.
     // In principle, the center should not influence the results, but that is
@@ -610,109 +874,157 @@ nsc_dclm_pbc(const rvec *coords, const ConstArrayRef<real> &radius, int nat,
     ys /= nat;
     zs /= nat;
 
-    AnalysisNeighborhoodPositions pos(coords, radius.size());
-    pos.indexed(constArrayRefFromArray(index, nat));
-    AnalysisNeighborhoodSearch    nbsearch(nb->initSearch(pbc, pos));
+    pairList->update(coords, radius.size(), pbc, nat, index);
 
-    std::vector<int>              wkdot(n_dot);
+    // The spheres are processed in parallel into per-atom results, which are
+    // then combined serially such that the output does not depend on the
+    // number of threads.
+    std::vector<real> atomArea(nat);
+    std::vector<int>  atomDotCount(nat);
+    std::vector<real> atomVolume;
+    std::vector<char> atomDots;
+    if (mode & FLAG_VOLUME)
+    {
+        atomVolume.resize(nat);
+    }
+    if (mode & FLAG_DOTS)
+    {
+        atomDots.resize(static_cast<size_t>(nat)*n_dot);
+    }
 
-    for (int i = 0; i < nat; ++i)
+    const int nthreads = std::min(gmx_omp_get_max_threads(), nat);
+#pragma omp parallel num_threads(nthreads)
     {
-        const int                      iat  = index[i];
-        const real                     ai   = radius[iat];
-        const real                     aisq = ai*ai;
-        AnalysisNeighborhoodPairSearch pairSearch(
-                nbsearch.startPairSearch(coords[iat]));
-        AnalysisNeighborhoodPair       pair;
-        std::fill(wkdot.begin(), wkdot.end(), 1);
-        int currDotCount = n_dot;
-        while (currDotCount > 0 && pairSearch.findNextPair(&pair))
+        try
         {
-            const int  jat = index[pair.refIndex()];
-            const real aj  = radius[jat];
-            const real d2  = pair.distance2();
-            if (iat == jat || d2 > gmx::square(ai+aj))
+            SurfaceAreaThreadWork work;
+            work.uncovered_.resize(dotArrays.paddedCount());
+#pragma omp for schedule(dynamic, 16)
+            for (int i = 0; i < nat; ++i)
             {
-                continue;
-            }
-            const rvec &dx     = pair.dx();
-            const real  refdot = (d2 + aisq - aj*aj)/(2*ai);
-            // TODO: Consider whether micro-optimizations from the old
-            // implementation would be useful, compared to the complexity that
-            // they bring: instead of this direct loop, the neighbors were
-            // stored into a temporary array, the loop order was
-            // reversed (first over dots, then over neighbors), and for each
-            // dot, it was first checked whether the same neighbor that
-            // resulted in marking the previous dot covered would also cover
-            // this dot. This presumably plays together with sorting of the
-            // surface dots (done in make_unsp) to avoid some of the looping.
-            // Alternatively, we could keep a skip list here to avoid
-            // repeatedly looping over dots that have already marked as
-            // covered.
-            for (int j = 0; j < n_dot; ++j)
-            {
-                if (wkdot[j] && iprod(&xus[3*j], dx) > refdot)
+                const int  iat          = index[i];
+                const real ai           = radius[iat];
+                const real aisq         = ai*ai;
+                const int  nbCandidates = pairList->neighborCount(i);
+                const int *nbList       = pairList->neighbors(i);
+                if (static_cast<int>(work.nbX_.size()) < nbCandidates)
                 {
-                    --currDotCount;
-                    wkdot[j] = 0;
+                    work.nbX_.resize(nbCandidates);
+                    work.nbY_.resize(nbCandidates);
+                    work.nbZ_.resize(nbCandidates);
+                    work.nbRefDot_.resize(nbCandidates);
                 }
-            }
-        }
+                int nbCount = 0;
+                for (int k = 0; k < nbCandidates; ++k)
+                {
+                    const int  jat = index[nbList[k]];
+                    const real aj  = radius[jat];
+                    if (iat == jat)
+                    {
+                        continue;
+                    }
+                    rvec dx;
+                    if (pbc != NULL)
+                    {
+                        pbc_dx(pbc, coords[jat], coords[iat], dx);
+                    }
+                    else
+                    {
+                        rvec_sub(coords[jat], coords[iat], dx);
+                    }
+                    const real d2 = norm2(dx);
+                    if (d2 > gmx::square(ai+aj))
+                    {
+                        continue;
+                    }
+                    work.nbX_[nbCount]      = dx[XX];
+                    work.nbY_[nbCount]      = dx[YY];
+                    work.nbZ_[nbCount]      = dx[ZZ];
+                    work.nbRefDot_[nbCount] = (d2 + aisq - aj*aj)/(2*ai);
+                    ++nbCount;
+                }
+                const int   currDotCount = findUncoveredDots(dotArrays, nbCount, &work);
+                const real *wkdot        = work.uncovered_.data();
 
-        const real a = aisq * dotarea * currDotCount;
-        area = area + a;
-        if (mode & FLAG_ATOM_AREA)
-        {
-            atom_area[i] = a;
-        }
-        const real xi = coords[iat][XX];
-        const real yi = coords[iat][YY];
-        const real zi = coords[iat][ZZ];
-        if (mode & FLAG_DOTS)
-        {
-            for (int l = 0; l < n_dot; l++)
-            {
-                if (wkdot[l])
+                atomArea[i]     = aisq * dotarea * currDotCount;
+                atomDotCount[i] = currDotCount;
+                if (mode & FLAG_DOTS)
                 {
-                    lfnr++;
-                    if (maxdots <= 3*lfnr+1)
+                    for (int l = 0; l < n_dot; l++)
                     {
-                        maxdots = maxdots+n_dot*3;
-                        srenew(dots, maxdots);
+                        atomDots[static_cast<size_t>(i)*n_dot + l] = (wkdot[l] != 0);
                     }
-                    dots[3*lfnr-3] = ai*xus[3*l]+xi;
-                    dots[3*lfnr-2] = ai*xus[1+3*l]+yi;
-                    dots[3*lfnr-1] = ai*xus[2+3*l]+zi;
                 }
-            }
-        }
-        if (mode & FLAG_VOLUME)
-        {
-            real dx = 0.0, dy = 0.0, dz = 0.0;
-            for (int l = 0; l < n_dot; l++)
-            {
-                if (wkdot[l])
+                if (mode & FLAG_VOLUME)
                 {
-                    dx = dx+xus[3*l];
-                    dy = dy+xus[1+3*l];
-                    dz = dz+xus[2+3*l];
+                    const real xi = coords[iat][XX];
+                    const real yi = coords[iat][YY];
+                    const real zi = coords[iat][ZZ];
+                    real       dx = 0.0, dy = 0.0, dz = 0.0;
+                    for (int l = 0; l < n_dot; l++)
+                    {
+                        if (wkdot[l] != 0)
+                        {
+                            dx = dx+xus[3*l];
+                            dy = dy+xus[1+3*l];
+                            dz = dz+xus[2+3*l];
+                        }
+                    }
+                    atomVolume[i] = aisq*(dx*(xi-xs)+dy*(yi-ys)+dz*(zi-zs) + ai*currDotCount);
                 }
             }
-            vol = vol+aisq*(dx*(xi-xs)+dy*(yi-ys)+dz*(zi-zs) + ai*currDotCount);
         }
+        GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR;
     }
 
+    real area = 0.0;
+    for (int i = 0; i < nat; ++i)
+    {
+        area = area + atomArea[i];
+    }
     if (mode & FLAG_VOLUME)
     {
+        real vol = 0.0;
+        for (int i = 0; i < nat; ++i)
+        {
+            vol = vol + atomVolume[i];
+        }
         *value_of_vol = vol*FOURPI/(3.*n_dot);
     }
     if (mode & FLAG_DOTS)
     {
+        int lfnr = 0;
+        for (int i = 0; i < nat; ++i)
+        {
+            lfnr += atomDotCount[i];
+        }
+        real *dots;
+        snew(dots, std::max(3*lfnr, 1));
+        real *currDot = dots;
+        for (int i = 0; i < nat; ++i)
+        {
+            const int   iat   = index[i];
+            const real  ai    = radius[iat];
+            const char *wkdot = &atomDots[static_cast<size_t>(i)*n_dot];
+            for (int l = 0; l < n_dot; l++)
+            {
+                if (wkdot[l])
+                {
+                    currDot[XX] = ai*xus[3*l]+coords[iat][XX];
+                    currDot[YY] = ai*xus[1+3*l]+coords[iat][YY];
+                    currDot[ZZ] = ai*xus[2+3*l]+coords[iat][ZZ];
+                    currDot    += DIM;
+                }
+            }
+        }
         *nu_dots = lfnr;
         *lidots  = dots;
     }
     if (mode & FLAG_ATOM_AREA)
     {
+        real *atom_area;
+        snew(atom_area, nat);
+        std::copy(atomArea.begin(), atomArea.end(), atom_area);
         *at_area = atom_area;
     }
     *value_of_area = area;
@@ -723,9 +1035,6 @@ nsc_dclm_pbc(const rvec *coords, const ConstArrayRef<real> &radius, int nat,
     }
 }
 
-namespace gmx
-{
-
 class SurfaceAreaCalculator::Impl
 {
     public:
@@ -734,9 +1043,10 @@ class SurfaceAreaCalculator::Impl
         }
 
         std::vector<real>             unitSphereDots_;
+        SurfaceDotArrays              dotArrays_;
         ConstArrayRef<real>           radius_;
         int                           flags_;
-        mutable AnalysisNeighborhood  nb_;
+        mutable SurfaceAreaPairList   pairList_;
 };
 
 SurfaceAreaCalculator::SurfaceAreaCalculator()
@@ -751,6 +1061,7 @@ SurfaceAreaCalculator::~SurfaceAreaCalculator()
 void SurfaceAreaCalculator::setDotCount(int dotCount)
 {
     impl_->unitSphereDots_ = make_unsp(dotCount, 4);
+    impl_->dotArrays_.set(impl_->unitSphereDots_);
 }
 
 void SurfaceAreaCalculator::setRadii(const ConstArrayRef<real> &radius)
@@ -759,7 +1070,7 @@ void SurfaceAreaCalculator::setRadii(const ConstArrayRef<real> &radius)
     if (!radius.empty())
     {
         const real maxRadius = *std::max_element(radius.begin(), radius.end());
-        impl_->nb_.setCutoff(2*maxRadius);
+        impl_->pairList_.setCutoff(2*maxRadius);
     }
 }
 
@@ -839,9 +1150,9 @@ void SurfaceAreaCalculator::calculate(
         *n_dots = 0;
     }
     nsc_dclm_pbc(x, impl_->radius_, nat,
-                 &impl_->unitSphereDots_[0], impl_->unitSphereDots_.size()/3,
+                 &impl_->unitSphereDots_[0], impl_->dotArrays_,
                  flags, area, at_area, volume, lidots, n_dots, index,
-                 &impl_->nb_, pbc);
+                 &impl_->pairList_, pbc);
 }
 
 } // namespace gmx
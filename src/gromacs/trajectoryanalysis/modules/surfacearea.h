@@ -3,7 +3,7 @@
  *
  * Copyright (c) 1991-2000, University of Groningen, The Netherlands.
  * Copyright (c) 2001-2004, The GROMACS development team.
- * Copyright (c) 2013,2014,2015, by the GROMACS development team, led by
+ * Copyright (c) 2013,2014,2015,2017, by the GROMACS development team, led by
  * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
  * and including many others, as listed in the AUTHORS file in the
  * top-level source directory and at http://www.gromacs.org.
@@ -163,6 +163,12 @@ class SurfaceAreaCalculator
          * this particular calculation.  If any output is `NULL`, that output
          * is not calculated, irrespective of the calculation mode set.
          *
+         * The list of overlapping spheres is reused from the previous call
+         * if \p index is the same and the positions have not moved too
+         * much, which makes repeated calls for a trajectory faster.  Because
+         * of this, the method must not be called concurrently for the same
+         * object.
+         *
          * \todo
          * Make the output options more C++-like, in particular for the array
          * outputs.
@@ -180,9 +180,13 @@ TrajectoryAnalysisRunnerCommon::Impl::initTopology(bool required)
     // Load the topology if requested.
     if (!topfile_.empty())
     {
+        // Coordinates are only read if they will be used, which for
+        // run input files also skips that part of the file.
+        const bool bNeedX = !hasTrajectory()
+            || settings_.hasFlag(TrajectoryAnalysisSettings::efUseTopX);
         snew(topInfo_.mtop_, 1);
         readConfAndTopology(topfile_.c_str(), &topInfo_.bTop_, topInfo_.mtop_,
-                            &topInfo_.ePBC_, &topInfo_.xtop_, NULL,
+                            &topInfo_.ePBC_, bNeedX ? &topInfo_.xtop_ : NULL, NULL,
                             topInfo_.boxtop_);
         // TODO: Only load this here if the tool actually needs it; selections
         // take care of themselves.
@@ -195,12 +199,6 @@ TrajectoryAnalysisRunnerCommon::Impl::initTopology(bool required)
                 atomsSetMassesBasedOnNames(&moltype.atoms, FALSE);
             }
         }
-        if (hasTrajectory()
-            && !settings_.hasFlag(TrajectoryAnalysisSettings::efUseTopX))
-        {
-            sfree(topInfo_.xtop_);
-            topInfo_.xtop_ = NULL;
-        }
     }
 }
 
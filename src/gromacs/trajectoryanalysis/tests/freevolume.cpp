@@ -1,7 +1,7 @@
 /*
  * This file is part of the GROMACS molecular simulation package.
  *
- * Copyright (c) 2013,2014, by the GROMACS development team, led by
+ * Copyright (c) 2013,2014,2017, by the GROMACS development team, led by
  * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
  * and including many others, as listed in the AUTHORS file in the
  * top-level source directory and at http://www.gromacs.org.
@@ -46,6 +46,7 @@
 #include <gtest/gtest.h>
 
 #include "testutils/cmdlinetest.h"
+#include "testutils/textblockmatchers.h"
 
 #include "moduletest.h"
 
@@ -53,6 +54,7 @@ namespace
 {
 
 using gmx::test::CommandLine;
+using gmx::test::NoTextMatch;
 
 /********************************************************************
  * Tests for gmx::analysismodules::Angle.
@@ -69,6 +71,8 @@ TEST_F(FreeVolumeModuleTest, ComputesFreeVolume)
     };
     setTopology("freevolume.tpr");
     setTrajectory("freevolume.xtc");
+    excludeDataset("cavities");
+    excludeDataset("cavityhist");
     runTest(CommandLine(cmdline));
 }
 
@@ -80,6 +84,21 @@ TEST_F(FreeVolumeModuleTest, ComputesFreeVolumeSelection)
     };
     setTopology("freevolume.tpr");
     setTrajectory("freevolume.xtc");
+    excludeDataset("cavities");
+    excludeDataset("cavityhist");
+    runTest(CommandLine(cmdline));
+}
+
+TEST_F(FreeVolumeModuleTest, ComputesCavityDistribution)
+{
+    const char *const cmdline[] = {
+        "freevolume", "-seed", "13", "-gridspacing", "0.05",
+        "-cavbinw", "0.001", "-cavmax", "0.01"
+    };
+    setTopology("freevolume.tpr");
+    setTrajectory("freevolume.xtc");
+    setOutputFile("-ocav", ".xvg", NoTextMatch());
+    excludeDataset("cavities");
     runTest(CommandLine(cmdline));
 }
 
@@ -1,7 +1,7 @@
 /*
  * This file is part of the GROMACS molecular simulation package.
  *
- * Copyright (c) 2014,2015, by the GROMACS development team, led by
+ * Copyright (c) 2014,2015,2017, by the GROMACS development team, led by
  * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
  * and including many others, as listed in the AUTHORS file in the
  * top-level source directory and at http://www.gromacs.org.
@@ -119,4 +119,18 @@ TEST_F(RdfModuleTest, CalculatesXY)
     runTest(CommandLine(cmdline));
 }
 
+TEST_F(RdfModuleTest, CalculatesAllPairs)
+{
+    const char *const cmdline[] = {
+        "rdf",
+        "-bin", "0.05", "-allpairs",
+        "-ref", "name OW",
+        "-sel", "name HW1", "name HW2"
+    };
+    setTopology("spc216.gro");
+    setOutputFile("-o", ".xvg", NoTextMatch());
+    excludeDataset("pairdist");
+    runTest(CommandLine(cmdline));
+}
+
 } // namespace
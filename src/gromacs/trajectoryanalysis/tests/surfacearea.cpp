@@ -1,7 +1,7 @@
 /*
  * This file is part of the GROMACS molecular simulation package.
  *
- * Copyright (c) 2014,2015,2016, by the GROMACS development team, led by
+ * Copyright (c) 2014,2015,2016,2017, by the GROMACS development team, led by
  * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
  * and including many others, as listed in the AUTHORS file in the
  * top-level source directory and at http://www.gromacs.org.
@@ -45,6 +45,8 @@
 
 #include <cstdlib>
 
+#include <vector>
+
 #include <gtest/gtest.h>
 
 #include "gromacs/math/utilities.h"
@@ -138,7 +140,31 @@ class SurfaceAreaTest : public ::testing::Test
             }
         }
 
+        void perturbPoints(real maxDisplacement)
+        {
+            gmx::UniformRealDistribution<real> dist(-maxDisplacement, maxDisplacement);
+            for (size_t i = 0; i < x_.size(); ++i)
+            {
+                x_[i][XX] += dist(rng_);
+                x_[i][YY] += dist(rng_);
+                x_[i][ZZ] += dist(rng_);
+            }
+        }
+
+        void initCalculator(gmx::SurfaceAreaCalculator *calculator, int ndots)
+        {
+            calculator->setDotCount(ndots);
+            calculator->setRadii(radius_);
+        }
+
         void calculate(int ndots, int flags, bool bPBC)
+        {
+            gmx::SurfaceAreaCalculator calculator;
+            initCalculator(&calculator, ndots);
+            calculate(calculator, flags, bPBC);
+        }
+        void calculate(const gmx::SurfaceAreaCalculator &calculator,
+                       int flags, bool bPBC)
         {
             volume_   = 0.0;
             sfree(atomArea_);
@@ -153,9 +179,6 @@ class SurfaceAreaTest : public ::testing::Test
             }
             ASSERT_NO_THROW_GMX(
                     {
-                        gmx::SurfaceAreaCalculator calculator;
-                        calculator.setDotCount(ndots);
-                        calculator.setRadii(radius_);
                         calculator.calculate(as_rvec_array(x_.data()), bPBC ? &pbc : NULL,
                                              index_.size(), index_.data(), flags,
                                              &area_, &volume_, &atomArea_,
@@ -380,4 +403,43 @@ TEST_F(SurfaceAreaTest, Computes100PointsWithTriclinicPBC)
     checkReference(&checker, "100Points", false);
 }
 
+TEST_F(SurfaceAreaTest, ReusesPairListBetweenCalculations)
+{
+    box_[XX][XX] = 10.0;
+    box_[YY][YY] = 10.0;
+    box_[ZZ][ZZ] = 10.0;
+    generateRandomPositions(100);
+    box_[XX][XX] = 20.0;
+    box_[YY][YY] = 20.0;
+    box_[ZZ][ZZ] = 20.0;
+    gmx::SurfaceAreaCalculator calculator;
+    initCalculator(&calculator, 24);
+    const int                  flags = FLAG_ATOM_AREA | FLAG_VOLUME;
+    // The small displacements allow reusing the pair list for a few
+    // calculations, while the large one forces it to be rebuilt.
+    const real                 displacements[] = { 0.0, 0.02, 0.02, 0.02, 0.5, 0.02 };
+    for (real displacement : displacements)
+    {
+        if (displacement > 0.0)
+        {
+            perturbPoints(displacement);
+        }
+        ASSERT_NO_FATAL_FAILURE(calculate(calculator, flags, true));
+        const real              area   = resultArea();
+        const real              volume = resultVolume();
+        std::vector<real>       atomAreas;
+        for (int i = 0; i < 100; ++i)
+        {
+            atomAreas.push_back(atomArea(i));
+        }
+        ASSERT_NO_FATAL_FAILURE(calculate(24, flags, true));
+        EXPECT_REAL_EQ_TOL(resultArea(), area, gmx::test::defaultRealTolerance());
+        EXPECT_REAL_EQ_TOL(resultVolume(), volume, gmx::test::defaultRealTolerance());
+        for (int i = 0; i < 100; ++i)
+        {
+            EXPECT_REAL_EQ_TOL(atomArea(i), atomAreas[i], gmx::test::defaultRealTolerance());
+        }
+    }
+}
+
 } // namespace
@@ -535,6 +535,84 @@ str_to_int64_t(const char *str, char **endptr)
 #endif
 }
 
+gmx_bool gmx_parse_fixed_decimal(const char *str, int width, double *value)
+{
+    /* All powers of ten up to 1e22 are exactly representable as double */
+    static const double c_pow10[] = {
+        1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    const int   c_maxDecimals          = sizeof(c_pow10)/sizeof(c_pow10[0]) - 1;
+    /* With at most 15 significant digits the mantissa is exact */
+    const int   c_maxSignificantDigits = 15;
+
+    const char *end = str;
+    while (end - str < width && *end != '\0')
+    {
+        end++;
+    }
+    const char *p = str;
+    while (p < end && *p == ' ')
+    {
+        p++;
+    }
+    gmx_bool bNegative = FALSE;
+    if (p < end && (*p == '-' || *p == '+'))
+    {
+        bNegative = (*p == '-');
+        p++;
+    }
+    gmx_int64_t mantissa     = 0;
+    int         nsignificant = 0;
+    int         ndigits      = 0;
+    int         ndecimals    = 0;
+    gmx_bool    bPoint       = FALSE;
+    for (; p < end; p++)
+    {
+        if (*p >= '0' && *p <= '9')
+        {
+            if (mantissa > 0 || *p != '0')
+            {
+                nsignificant++;
+            }
+            mantissa = 10*mantissa + (*p - '0');
+            ndigits++;
+            if (bPoint)
+            {
+                ndecimals++;
+            }
+        }
+        else if (*p == '.' && !bPoint)
+        {
+            bPoint = TRUE;
+        }
+        else
+        {
+            break;
+        }
+    }
+    if (ndigits == 0 || nsignificant > c_maxSignificantDigits ||
+        ndecimals > c_maxDecimals)
+    {
+        return FALSE;
+    }
+    /* Only trailing spaces are allowed after the number */
+    for (; p < end; p++)
+    {
+        if (*p != ' ')
+        {
+            return FALSE;
+        }
+    }
+    /* Division of two exact values is correctly rounded,
+     * so this gives the same result as strtod().
+     */
+    double result = static_cast<double>(mantissa)/c_pow10[ndecimals];
+    *value        = bNegative ? -result : result;
+
+    return TRUE;
+}
+
 char *gmx_step_str(gmx_int64_t i, char *buf)
 {
     sprintf(buf, "%" GMX_PRId64, i);
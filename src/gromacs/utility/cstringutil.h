@@ -179,6 +179,23 @@ char *wrap_lines(const char *buf, int line_width, int indent,
  */
 gmx_int64_t str_to_int64_t(const char *str, char **endptr);
 
+/*! \brief
+ * Parses a plain decimal number from a fixed-width field.
+ *
+ * At most \p width characters of \p str are considered, fewer when \p str
+ * is terminated earlier. The field may contain leading and trailing spaces,
+ * a sign and at most one decimal point, but no exponent.
+ * Fields with more than 15 significant digits are rejected as well,
+ * so that the result is always identical to that of strtod().
+ *
+ * \returns TRUE and sets \p value on success, FALSE if the field does not
+ *     contain such a number, in which case the caller should fall back to
+ *     a general parser.
+ *
+ * This is intended for fast parsing of fixed-format structure files.
+ */
+gmx_bool gmx_parse_fixed_decimal(const char *str, int width, double *value);
+
 /** Minimum size of buffer to pass to gmx_step_str(). */
 #define STEPSTRSIZE 22
 